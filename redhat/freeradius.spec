@@ -768,6 +768,7 @@ fi
 /usr/bin/*
 # man-pages
 %doc %{_mandir}/man1/radclient.1.gz
+%doc %{_mandir}/man1/raddetail.1.gz
 %doc %{_mandir}/man1/radlast.1.gz
 %doc %{_mandir}/man1/radtest.1.gz
 %doc %{_mandir}/man1/radwho.1.gz
@@ -183,6 +183,8 @@ int			fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out,
 
 int			fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename);
 
+int			fr_dict_freeze(fr_dict_t *dict);
+
 int			fr_dict_parse_str(fr_dict_t *dict, char *buf,
 					  fr_dict_attr_t const *parent, unsigned int vendor);
 
@@ -131,6 +131,17 @@ typedef struct unlang_t {
 	int			actions[RLM_MODULE_NUMCODES];	//!< Priorities for the various return codes.
 } unlang_t;
 
+/** An entry in the dispatch table of a switch statement
+ *
+ * Built by the compiler when every case value is a literal of the
+ * switch attribute's type.
+ */
+typedef struct {
+	fr_value_box_t const	*value;		//!< Of the case statement.
+	unlang_t		*instruction;	//!< The case statement.
+	int			position;	//!< Of the case statement within the switch.
+} unlang_switch_case_t;
+
 /** Generic representation of a grouping
  *
  * Can represent IF statements, maps, update sections etc...
@@ -161,6 +172,11 @@ typedef struct {
 					void const		*process;	//!< #UNLANG_TYPE_CALL
 					CONF_SECTION		*server_cs;	//!< #UNLANG_TYPE_CALL
 				};
+				struct {
+					rbtree_t		*cases;		//!< #UNLANG_TYPE_SWITCH, #unlang_switch_case_t
+										//!< by value, or NULL for a linear scan.
+					unlang_t		*default_case;	//!< #UNLANG_TYPE_SWITCH
+				};
 			};
 		};
 		fr_cond_t		*cond;		//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.
@@ -0,0 +1,75 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_PAIR_HEAD_H
+#define _FR_PAIR_HEAD_H
+/**
+ * $Id$
+ *
+ * @file include/pair_head.h
+ * @brief A VALUE_PAIR list head with O(1) append, and an attribute index.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(pair_head_h, "$Id$")
+
+#include <freeradius-devel/pair.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_pair_index_s fr_pair_index_t;
+
+/** The head of a list of VALUE_PAIRs
+ *
+ * The list itself is still a normal list of VALUE_PAIRs linked by their
+ * next pointers, which starts at head.  The list head also tracks the
+ * last VALUE_PAIR, so appending doesn't walk the list, and builds an
+ * index of the first VALUE_PAIR of each attribute the first time the
+ * list is searched.
+ *
+ * Fields should not be accessed directly.  Anything which modifies the
+ * list other than via the fr_pair_head_* functions must get the list
+ * with #fr_pair_head_list, or #fr_pair_head_cursor_init, which discard
+ * the tail and the index.
+ */
+typedef struct {
+	VALUE_PAIR		*head;		//!< First VALUE_PAIR in the list.
+	VALUE_PAIR		*tail;		//!< Last VALUE_PAIR in the list, or NULL if unknown.
+	uint32_t		num;		//!< Number of VALUE_PAIRs, only valid if we have a tail.
+
+	TALLOC_CTX		*ctx;		//!< To allocate the index in.
+	fr_pair_index_t		*index;		//!< da -> first VALUE_PAIR.
+} fr_pair_head_t;
+
+void		fr_pair_head_init(TALLOC_CTX *ctx, fr_pair_head_t *list, VALUE_PAIR *vps) CC_HINT(nonnull(2));
+
+VALUE_PAIR	**fr_pair_head_list(fr_pair_head_t *list) CC_HINT(nonnull);
+
+VALUE_PAIR	*fr_pair_head_cursor_init(fr_cursor_t *cursor, fr_pair_head_t *list) CC_HINT(nonnull);
+
+void		fr_pair_head_add(fr_pair_head_t *list, VALUE_PAIR *vp) CC_HINT(nonnull(1));
+
+VALUE_PAIR	*fr_pair_head_find_by_da(fr_pair_head_t *list, fr_dict_attr_t const *da, int8_t tag) CC_HINT(nonnull);
+
+VALUE_PAIR	*fr_pair_head_release(fr_pair_head_t *list) CC_HINT(nonnull);
+
+void		fr_pair_head_free(fr_pair_head_t *list) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_PAIR_HEAD_H */
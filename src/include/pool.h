@@ -63,6 +63,10 @@ typedef struct fr_pool_state {
 	uint32_t       	num;			//!< Number of connections in the pool.
 	uint32_t	active;	 		//!< Number of currently reserved connections.
 
+	uint32_t	threads;		//!< Number of threads with their own slice of the pool.
+	uint64_t	borrowed;		//!< Number of times a thread reserved a connection
+						//!< from another thread's slice.
+
 	bool		reconnecting;		//!< We are currently reconnecting the pool.
 } fr_pool_state_t;
 
@@ -133,6 +137,8 @@ fr_pool_t	*fr_pool_init(TALLOC_CTX *ctx,
 
 fr_pool_t	*fr_pool_copy(TALLOC_CTX *ctx, fr_pool_t *pool, void *opaque);
 
+int	fr_pool_thread_instantiate(TALLOC_CTX *ctx, fr_pool_t *pool);
+
 
 /*
  *	Pool get/set
@@ -146,7 +152,7 @@ void const *fr_pool_opaque(fr_pool_t *pool);
 
 void	fr_pool_ref(fr_pool_t *pool);
 
-fr_pool_state_t const *fr_pool_state(fr_pool_t *pool);
+void	fr_pool_state(fr_pool_state_t *out, fr_pool_t *pool);
 
 void	fr_pool_reconnect_func(fr_pool_t *pool, fr_pool_reconnect_t reconnect);
 
@@ -136,6 +136,9 @@ typedef struct main_config {
 
 	uint32_t	num_networks;			//!< number of network threads
 	uint32_t	num_workers;			//!< number of network threads
+	char const	*network_cpus;			//!< CPUs to pin network threads to
+	char const	*worker_cpus;			//!< CPUs to pin worker threads to
+	bool		numa;				//!< networks only use workers on the same NUMA node
 
 	bool		drop_requests;			//!< Administratively disable request processing.
 
@@ -458,9 +461,19 @@ void		rad_suid_down_permanent(void);
  */
 #  define REQUEST_MAX_REGEX 32
 
+/*
+ *	Maximum number of runtime patterns each thread keeps compiled.
+ */
+#  define REGEX_CACHE_MAX 256
+
 void	regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value,
 			     size_t len, regmatch_t rxmatch[], size_t nmatch);
 
+ssize_t	regex_cache_compile(regex_t **out, char const *pattern, size_t len,
+			    bool ignore_case, bool multiline, bool subcaptures);
+
+uint32_t regex_cache_stats(uint64_t *hits, uint64_t *misses);
+
 int	regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t num);
 
 /*
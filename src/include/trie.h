@@ -0,0 +1,60 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_TRIE_H
+#define _FR_TRIE_H
+/**
+ * $Id$
+ *
+ * @file include/trie.h
+ * @brief Path compressed binary trie, for longest prefix matches.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(trie_h, "$Id$")
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	Keys are bit strings, given as a pointer to the data, and the
+ *	number of bits to use.  The bits are taken most significant
+ *	bit first, so IP addresses in network byte order work as-is.
+ *
+ *	There can be at most one writer at a time.  Readers don't
+ *	need any locks, and can run in parallel with the writer.
+ */
+typedef struct fr_trie_t fr_trie_t;
+
+fr_trie_t	*fr_trie_create(TALLOC_CTX *ctx);
+
+int		fr_trie_insert(fr_trie_t *ft, void const *key, size_t keylen, void *data) CC_HINT(nonnull(1,2));
+void		*fr_trie_remove(fr_trie_t *ft, void const *key, size_t keylen) CC_HINT(nonnull);
+
+void		*fr_trie_find(fr_trie_t const *ft, void const *key, size_t keylen) CC_HINT(nonnull);
+void		*fr_trie_lookup(fr_trie_t const *ft, void const *key, size_t keylen) CC_HINT(nonnull);
+
+uint32_t	fr_trie_num_elements(fr_trie_t const *ft) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FR_TRIE_H */
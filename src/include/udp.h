@@ -39,6 +39,30 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+#define UDP_MMSG_MAX		(64)		//!< Maximum number of datagrams read or written in one batch.
+
+/** One datagram in a batch read or write
+ *
+ * For reads, "data" and "data_len" describe the buffer the datagram
+ * is received into, and the remaining fields are filled in by
+ * udp_recv_mmsg().  For writes, all fields are provided by the caller.
+ * The addresses are always from the point of view of the packet,
+ * i.e. for replies "src" is our address, and "dst" is the client's.
+ */
+typedef struct {
+	uint8_t			*data;		//!< Packet data.
+	size_t			data_len;	//!< Size of the buffer (read), or of the packet (write).
+	size_t			packet_len;	//!< Amount of data received.  0 means "discard".
+
+	fr_ipaddr_t		src_ipaddr;	//!< Source address of the packet.
+	uint16_t		src_port;	//!< Source port of the packet.
+	fr_ipaddr_t		dst_ipaddr;	//!< Destination address of the packet.
+	uint16_t		dst_port;	//!< Destination port of the packet.
+	int			if_index;	//!< Interface the packet was received on / sent from.
+
+	struct timeval		when;		//!< When the packet was received.
+} udp_mmsg_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t const *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t const *dst_ipaddr, uint16_t dst_port);
@@ -52,6 +76,10 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 struct timeval *when);
 
+int udp_recv_mmsg(int sockfd, udp_mmsg_t *msgs, unsigned int num, int flags);
+
+int udp_send_mmsg(int sockfd, udp_mmsg_t *msgs, unsigned int num, int flags);
+
 #ifdef __cplusplus
 }
 #endif
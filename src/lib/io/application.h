@@ -108,7 +108,8 @@ typedef struct fr_app_io_t {
 	fr_io_data_vnode_t		vnode;		//!< Handle notifications that the VNODE has changed
 	fr_io_decode_t			decode;		//!< Translate raw bytes into VALUE_PAIRs and metadata.
 	fr_io_encode_t			encode;		//!< Pack VALUE_PAIRs back into a byte array.
-	fr_io_signal_t			flush;		//!< Flush the data when the socket is ready for writing.
+	fr_io_signal_t			flush;		//!< Send any data queued by write().  Called after the
+							//!< network side has written all pending replies.
 	fr_io_signal_t			error;		//!< There was an error on the socket.
 	fr_io_open_t			close;		//!< Close the transport.
 	fr_io_nak_t			nak;		//!< Function to send a NAK.
@@ -38,17 +38,10 @@ RCSID("$Id$")
 #define MPRINT(...)
 #endif
 
-/*
- *	We disable this until we fix all of the signaling issues...
- */
-#define ENABLE_SKIPS (0)
-
 #define TO_WORKER (0)
 #define FROM_WORKER (1)
 
-#if 0
-#define SIGNAL_INTERVAL (1000000)	//!< The minimum interval between worker signals.
-#endif
+#define SIGNAL_INTERVAL (1000000)	//!< The maximum interval between worker signals, when replies are skipped.
 
 /** Size of the atomic queues
  *
@@ -99,6 +92,8 @@ typedef struct fr_channel_end_t {
 
 	int			num_outstanding; //!< Number of outstanding requests with no reply.
 	bool			must_signal;	//!< we need to signal the other end
+	bool			must_ack;	//!< the other end signaled us, and is waiting for us
+						//!< to say we're done, or sleeping.
 
 	size_t			num_signals;	//!< Number of kevent signals we've sent.
 
@@ -205,6 +200,12 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_contro
 	ch->end[FROM_WORKER].last_read_other = when;
 	ch->end[FROM_WORKER].last_sent_signal = when;
 
+	/*
+	 *	The worker isn't running yet, so the first request
+	 *	has to wake it up.
+	 */
+	ch->end[TO_WORKER].must_signal = true;
+
 	ch->active = true;
 
 	return ch;
@@ -238,6 +239,13 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	end->last_sent_signal = when;
 	end->num_signals++;
 	end->must_signal = false;
+	end->sequence_at_last_signal = end->sequence;
+
+	/*
+	 *	Telling the master that we're done also tells it that
+	 *	we may be sleeping.
+	 */
+	if (which == FR_CHANNEL_SIGNAL_DATA_DONE_WORKER) end->must_ack = false;
 
 	cc.signal = which;
 	cc.ack = end->ack;
@@ -253,6 +261,13 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
  *
  * The message should be initialized, other than "sequence" and "ack".
  *
+ * We only signal the worker if it may be sleeping.  Once we've
+ * signaled it, the worker is awake until it tells us that it's done,
+ * or sleeping.  That message contains the sequence number of the last
+ * request the worker read.  If we've sent more requests since then,
+ * #fr_channel_service_message signals the worker again.  So skipping
+ * the signal here never leaves a request stuck in the queue.
+ *
  * No matter what the function returns, the caller should check the
  * reply pointer.  If the reply pointer is not NULL, the caller
  * should call #fr_channel_recv_reply until that function returns
@@ -306,32 +321,19 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_
 
 	MPRINT("MASTER requests %zd, num_outstanding %zd\n", master->num_packets, master->num_outstanding);
 
-#if ENABLE_SKIPS
 	/*
-	 *	We just sent the first packet.  There can't possibly be a reply, so don't bother looking.
+	 *	There is at least one old packet which is
+	 *	outstanding, look for a reply.
 	 */
-	if (master->num_outstanding == 1) {
-		*p_reply = NULL;
-
-
-		/*
-		 *	There is at least one old packet which is
-		 *	outstanding, look for a reply.
-		 */
-	} else if (master->num_outstanding > 1) {
-		*p_reply = fr_channel_recv_reply(ch);
+	if (master->num_outstanding > 1) *p_reply = fr_channel_recv_reply(ch);
 
-		/*
-		 *	There's no reply yet, so we still have packets outstanding.
-		 *	Or, there is a reply, and there are more packets outstanding.
-		 *	Skip the signal.
-		 */
-		if (!master->must_signal && (!*p_reply || (*p_reply && (master->num_outstanding > 1)))) {
-			MPRINT("MASTER SKIPS signal\n");
-			return 0;
-		}
+	/*
+	 *	The worker is awake, and will see this packet.
+	 */
+	if (!master->must_signal) {
+		MPRINT("MASTER SKIPS signal\n");
+		return 0;
 	}
-#endif
 
 	/*
 	 *	Tell the other end that there is new data ready.
@@ -498,40 +500,27 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_da
 		return fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_DONE_WORKER);
 	}
 
-	MPRINT("\twhen - last_read_other = %zd - %zd = %zd\n", when, worker->last_read_other, when - worker->last_read_other);
 	MPRINT("\twhen - last signal = %zd - %zd = %zd\n", when, worker->last_sent_signal, when - worker->last_sent_signal);
 	MPRINT("\tsequence - ack = %zd - %zd = %zd\n", worker->sequence, worker->their_view_of_my_sequence, worker->sequence - worker->their_view_of_my_sequence);
 
-#ifdef __APPLE__
-	/*
-	 *	If we've sent them a signal since the last ACK, they
-	 *	will receive it, and process the packets.  So we don't
-	 *	need to signal them again.
-	 *
-	 *	But... this doesn't appear to work on the Linux
-	 *	libkqueue implementation.
-	 */
-	if (worker->sequence_at_last_signal > worker->their_view_of_my_sequence) return 0;
-#endif
-
 	/*
-	 *	If we've received a new packet in the last while, OR
-	 *	we've sent a signal in the last while, then we don't
-	 *	need to send a new signal.  But we DO send a signal if
-	 *	we haven't seen an ACK for a few packets.
+	 *	If the master hasn't yet ACKed the replies we last
+	 *	signaled it about, then that signal is likely still
+	 *	pending, and the master will drain the queue when it
+	 *	gets it.  So we can skip this signal.
 	 *
-	 *	FIXME: make these limits configurable, or include
-	 *	predictions about packet processing time?
+	 *	The ACKs only arrive with new requests, so they may be
+	 *	stale.  We therefore still signal every so often, and
+	 *	fr_channel_worker_sleeping() sends any skipped signal
+	 *	before we go to sleep.
 	 */
 	rad_assert(worker->their_view_of_my_sequence <= worker->sequence);
-#if 0
-	if (((worker->sequence - worker->their_view_of_my_sequence) <= 1000) &&
-	    ((when - worker->last_read_other < SIGNAL_INTERVAL) ||
-	     ((when - worker->last_sent_signal) < SIGNAL_INTERVAL))) {
+	if ((worker->sequence_at_last_signal > worker->their_view_of_my_sequence) &&
+	    ((when - worker->last_sent_signal) < SIGNAL_INTERVAL)) {
 		MPRINT("\tWORKER SKIPS signal\n");
+		worker->must_signal = true;
 		return 0;
 	}
-#endif
 
 	MPRINT("\tWORKER SIGNALS num_outstanding %zd\n", worker->num_outstanding);
 	return fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_FROM_WORKER);
@@ -564,6 +553,10 @@ int fr_channel_null_reply(fr_channel_t *ch)
  * This function should be called from the workers idle loop.
  * i.e. only when it has nothing else to do.
  *
+ * The signal is only sent when the master needs it.  That is, when
+ * the master has signaled us since we last said we were sleeping, or
+ * when we skipped signaling the master about some replies.
+ *
  * @param[in] ch	the channel to signal we're no longer listening on.
  * @return
  *	- <0 on error
@@ -577,13 +570,15 @@ int fr_channel_worker_sleeping(fr_channel_t *ch)
 	worker = &(ch->end[FROM_WORKER]);
 
 	/*
-	 *	We don't have any outstanding requests to process for
-	 *	this channel, don't signal the network thread that
-	 *	we're sleeping.  It already knows.
+	 *	The master already knows we're sleeping, and has seen
+	 *	all of our replies.  Don't signal it again.
 	 */
-	if (worker->num_outstanding == 0) return 0;
+	if (!worker->must_ack && !worker->must_signal) return 0;
 
 	worker->num_signals++;
+	worker->must_ack = false;
+	worker->must_signal = false;
+	worker->sequence_at_last_signal = worker->sequence;
 
 	cc.signal = FR_CHANNEL_SIGNAL_WORKER_SLEEPING;
 	cc.ack = worker->ack;
@@ -611,9 +606,7 @@ int fr_channel_worker_sleeping(fr_channel_t *ch)
 fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
 {
 	int rcode;
-#if ENABLE_SKIPS
 	uint64_t ack;
-#endif
 	fr_channel_control_t cc;
 	fr_channel_signal_t cs;
 	fr_channel_event_t ce = FR_CHANNEL_ERROR;
@@ -624,19 +617,25 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	memcpy(&cc, data, data_size);
 
 	cs = cc.signal;
-#if ENABLE_SKIPS
 	ack = cc.ack;
-#endif
 	*p_channel = ch = cc.ch;
 
 	switch (cs) {
+	/*
+	 *	The master has woken us up.  It won't signal us
+	 *	again until we tell it that we're done, or sleeping.
+	 */
+	case FR_CHANNEL_SIGNAL_DATA_TO_WORKER:
+		MPRINT("channel got data_to_worker\n");
+		ch->end[FROM_WORKER].must_ack = true;
+		return FR_CHANNEL_DATA_READY_WORKER;
+
 	/*
 	 *	These all have the same numbers as the channel
 	 *	events, and have no extra processing.  We just
 	 *	return them as-is.
 	 */
 	case FR_CHANNEL_SIGNAL_ERROR:
-	case FR_CHANNEL_SIGNAL_DATA_TO_WORKER:
 	case FR_CHANNEL_SIGNAL_DATA_FROM_WORKER:
 	case FR_CHANNEL_SIGNAL_OPEN:
 	case FR_CHANNEL_SIGNAL_CLOSE:
@@ -645,8 +644,9 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 
 	/*
 	 *	Only sent by the worker.  Both of these
-	 *	situations are largely the same, except for
-	 *	return codes.
+	 *	situations are the same.  The worker may have
+	 *	skipped signaling us about replies, so we tell
+	 *	the caller to check for them.
 	 */
 	case FR_CHANNEL_SIGNAL_DATA_DONE_WORKER:
 		MPRINT("channel got data_done_worker\n");
@@ -656,19 +656,18 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 
 	case FR_CHANNEL_SIGNAL_WORKER_SLEEPING:
 		MPRINT("channel got worker_sleeping\n");
-		ce = FR_CHANNEL_NOOP;
+		ce = FR_CHANNEL_DATA_READY_NETWORK;
 		ch->end[TO_WORKER].must_signal = true;
 		break;
 	}
 
 	/*
 	 *	Compare their ACK to the last sequence we
-	 *	sent.  If it's different, we signal the worker
-	 *	to wake up.
+	 *	sent.  If it's the same, the worker has seen
+	 *	everything, and we signal it on the next request.
 	 */
 	master = &ch->end[TO_WORKER];
-#if ENABLE_SKIPS
-	if (!master->must_signal && (ack == master->sequence)) {
+	if (ack == master->sequence) {
 		MPRINT("MASTER SKIPS signal AFTER CE %d num_outstanding %zd\n", cs, master->num_outstanding);
 		MPRINT("MASTER has ack %zd, my seq %zd my_view %zd\n", ack, master->sequence, master->their_view_of_my_sequence);
 		return ce;
@@ -679,7 +678,6 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	 *	packets available, so we signal it to wake up again.
 	 */
 	rad_assert(ack <= master->sequence);
-#endif
 
 	/*
 	 *	We're signaling it again...
@@ -852,17 +850,28 @@ int fr_channel_signal_open(fr_channel_t *ch)
 	return fr_control_message_send(ch->end[TO_WORKER].control, ch->end[TO_WORKER].rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+static double channel_signals_per_packet(fr_channel_end_t const *end)
+{
+	if (!end->num_packets) return 0;
+
+	return (double) end->num_signals / (double) end->num_packets;
+}
+
 void fr_channel_debug(fr_channel_t *ch, FILE *fp)
 {
 	fprintf(fp, "to worker\n");
+	fprintf(fp, "\tnum_packets = %"PRIu64"\n", ch->end[TO_WORKER].num_packets);
 	fprintf(fp, "\tnum_signals sent = %zu\n", ch->end[TO_WORKER].num_signals);
 	fprintf(fp, "\tnum_signals re-sent = %zu\n", ch->end[TO_WORKER].num_resignals);
+	fprintf(fp, "\tsignals per packet = %.3f\n", channel_signals_per_packet(&ch->end[TO_WORKER]));
 	fprintf(fp, "\tnum_kevents checked = %zu\n", ch->end[TO_WORKER].num_kevents);
 	fprintf(fp, "\tsequence = %"PRIu64"\n", ch->end[TO_WORKER].sequence);
 	fprintf(fp, "\tack = %"PRIu64"\n", ch->end[TO_WORKER].ack);
 
 	fprintf(fp, "to receive\n");
+	fprintf(fp, "\tnum_packets = %"PRIu64"\n", ch->end[FROM_WORKER].num_packets);
 	fprintf(fp, "\tnum_signals sent = %zu\n", ch->end[FROM_WORKER].num_signals);
+	fprintf(fp, "\tsignals per packet = %.3f\n", channel_signals_per_packet(&ch->end[FROM_WORKER]));
 	fprintf(fp, "\tnum_kevents checked = %zu\n", ch->end[FROM_WORKER].num_kevents);
 	fprintf(fp, "\tsequence = %"PRIu64"\n", ch->end[FROM_WORKER].sequence);
 	fprintf(fp, "\tack = %"PRIu64"\n", ch->end[FROM_WORKER].ack);
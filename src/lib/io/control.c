@@ -308,13 +308,29 @@ int fr_control_message_push(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
  */
 int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id, void *data, size_t data_size)
 {
-	int rcode;
-	struct kevent kev;
-
 	(void) talloc_get_type_abort(c, fr_control_t);
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
+	return fr_control_signal(c);
+}
+
+
+/** Wake up the receiver of a control plane
+ *
+ *  Used after fr_control_message_push(), when the caller needs to
+ *  know whether or not the message was queued.
+ *
+ * @param[in] c the control structure
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_control_signal(fr_control_t *c)
+{
+	int rcode;
+	struct kevent kev;
+
 	EV_SET(&kev, c->ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
 	rcode = kevent(c->kq, &kev, 1, NULL, 0, NULL);
 	if (rcode >= 0) return rcode;
@@ -158,7 +158,11 @@ typedef size_t (*fr_io_nak_t)(void const *instance, uint8_t *const packet, size_
  * read.  However, the data MAY have moved, so please do not keep a
  * pointer to 'buffer' around.
  *
- * datagram sockets should always set '*leftover = 0'.
+ * datagram sockets should set '*leftover = 0', unless they read
+ * multiple packets at once (see fr_listen_t.max_batch).  In that case,
+ * the reader packs all of the datagrams into the buffer, returns the
+ * first one, and sets '*leftover' to the size of the remaining ones.
+ * It is then called again for each remaining packet.
  *
  * stream sockets can read one packet, and set '*leftover' to how many
  * bytes are left in the buffer.  The read routine will be called
@@ -204,6 +208,10 @@ typedef ssize_t (*fr_io_data_read_t)(void *instance, void **packet_ctx, fr_time_
  *  saying "I took saved the data, but the socket wasn't ready, so you
  *  need to call me again at a later point".
  *
+ *  Datagram writers may instead copy the data, and queue it for
+ *  sending in one system call.  The network side calls the app_io
+ *  "flush" function once it has written all of the pending replies.
+ *
  * @param[in] instance		the context for this function
  * @param[in] packet_ctx	Request specific data.
  * @param[in] request_time	when the original request was received
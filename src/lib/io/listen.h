@@ -34,6 +34,9 @@ struct fr_listen {
 
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+	uint32_t		max_batch;		//!< maximum number of packets the app_io reads at once.
+							///< The network side reserves room for this many
+							///< messages of default_message_size.
 };
 
 /**
@@ -54,6 +57,8 @@ struct fr_async_t {
 						//!< and how we'll send the reply.
 	uint32_t		priority;
 	bool			detached;	//!< if detached, we don't send real replies
+
+	struct fr_worker_t	*owner;		//!< if stolen, the worker which owns the channel
 };
 
 /** Information to track src/dst ip/port
@@ -85,6 +85,7 @@ typedef struct fr_network_socket_t {
 	fr_heap_t		*waiting;		//!< packets waiting to be written
 
 	fr_dlist_t		entry;			//!< for deleted sockets
+	fr_dlist_t		flush_entry;		//!< for sockets which have batched writes
 } fr_network_socket_t;
 
 /*
@@ -122,6 +123,7 @@ struct fr_network_t {
 	uint64_t		num_replies;		//!< number of replies we received
 
 	rbtree_t		*sockets;		//!< list of sockets we're managing
+	fr_dlist_t		flush;			//!< sockets which need their writes flushed
 
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_t		mutex;			//!< for sending us control messages
@@ -322,6 +324,7 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	fr_network_socket_t *s = ctx;
 	fr_network_t *nr = talloc_parent(s);
 	ssize_t data_size;
+	size_t reserve_size;
 	fr_channel_data_t *cd, *next;
 	fr_time_t *recv_time;
 
@@ -329,10 +332,18 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 
 	DEBUG3("network read");
 
+	/*
+	 *	Transports which read multiple packets at once need
+	 *	room for all of them.  The packets are then handed to
+	 *	us one at a time, with the rest as "leftover" data.
+	 */
+	reserve_size = s->listen->default_message_size;
+	if (s->listen->max_batch > 1) reserve_size *= s->listen->max_batch;
+
 	if (!s->cd) {
-		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, reserve_size);
 		if (!cd) {
-			fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", s->listen->default_message_size);
+			fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", reserve_size);
 			talloc_free(s);
 			return;
 		}
@@ -409,7 +420,7 @@ next_message:
 		 *	There are leftover bytes in the buffer, feed
 		 *	them to the next round of reading.
 		 */
-		next = (fr_channel_data_t *) fr_message_alloc_reserve(s->ms, &cd->m, data_size, s->listen->default_message_size);
+		next = (fr_channel_data_t *) fr_message_alloc_reserve(s->ms, &cd->m, data_size, reserve_size);
 		if (!next) {
 			fr_log(nr->log, L_ERR, "Failed reserving partial packet.");
 			// @todo - probably close the socket...
@@ -427,6 +438,19 @@ next_message:
 	 */
 	s->outstanding++;
 
+	if (!next) return;
+
+	/*
+	 *	A batching transport has handed us all of the packets
+	 *	it read.  Cache the new reservation for the next read,
+	 *	so that one wakeup reads at most one batch of packets
+	 *	from the socket.
+	 */
+	if (!s->leftover && (s->listen->max_batch > 1)) {
+		s->cd = next;
+		return;
+	}
+
 	/*
 	 *	If there is a next message, go read it from the buffer.
 	 *
@@ -435,10 +459,8 @@ next_message:
 	 *	able to check that, too.  We might just remove this
 	 *	"goto"...
 	 */
-	if (next) {
-		cd = next;
-		goto next_message;
-	}
+	cd = next;
+	goto next_message;
 }
 
 
@@ -502,6 +524,24 @@ static void fr_network_error(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 }
 
 
+/** Remember that a socket has written data which may need flushing
+ *
+ *  Transports with a "flush" function can queue replies in write(),
+ *  and send them all at once when we call flush().  We do that after
+ *  all of the pending replies have been written.
+ *
+ * @param nr the network
+ * @param s the socket which had data written to it
+ */
+static void fr_network_socket_flush_add(fr_network_t *nr, fr_network_socket_t *s)
+{
+	if (!s->listen->app_io->flush) return;
+
+	if (s->flush_entry.next != &s->flush_entry) return; /* already in the list */
+
+	fr_dlist_insert_tail(&nr->flush, &s->flush_entry);
+}
+
 /** Write packets to the network.
  *
  * @param el the event list
@@ -560,6 +600,8 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 			fr_network_socket_dead(nr, s);
 			return;
 		}
+
+		fr_network_socket_flush_add(nr, s);
 	}
 
 	/*
@@ -583,6 +625,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 
 	fr_event_fd_delete(nr->el, s->fd, FR_EVENT_FILTER_IO);
 
+	fr_dlist_remove(&s->flush_entry);
+
 	rbtree_deletebydata(nr->sockets, s);
 
 	if (s->listen->app_io->close) {
@@ -632,6 +676,7 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 
 	MEM(s->waiting = fr_heap_create(waiting_cmp, offsetof(fr_channel_data_t, channel.heap_id)));
 	FR_DLIST_INIT(s->entry);
+	FR_DLIST_INIT(s->flush_entry);
 
 	talloc_set_destructor(s, _network_socket_free);
 
@@ -701,6 +746,7 @@ static void fr_network_directory_callback(void *ctx, void const *data, size_t da
 
 	MEM(s->waiting = fr_heap_create(waiting_cmp, offsetof(fr_channel_data_t, channel.heap_id)));
 	FR_DLIST_INIT(s->entry);
+	FR_DLIST_INIT(s->flush_entry);
 
 	talloc_set_destructor(s, _network_socket_free);
 
@@ -829,6 +875,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 	nr->lvl = lvl;
 	nr->max_workers = MAX_WORKERS;
 	nr->num_workers = 0;
+	FR_DLIST_INIT(nr->flush);
 
 	nr->kq = fr_event_list_kq(nr->el);
 	rad_assert(nr->kq >= 0);
@@ -972,6 +1019,7 @@ int fr_network_destroy(fr_network_t *nr)
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_dlist_t *entry;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
@@ -1111,7 +1159,32 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 		 *	As a special case, allow write() to return
 		 *	"0", which means "close the socket".
 		 */
-		if (rcode == 0) fr_network_socket_dead(nr, s);
+		if (rcode == 0) {
+			fr_network_socket_dead(nr, s);
+			continue;
+		}
+
+		fr_network_socket_flush_add(nr, s);
+	}
+
+	/*
+	 *	Tell the transports to send any replies which they
+	 *	have batched up.
+	 */
+	while ((entry = FR_DLIST_FIRST(nr->flush)) != NULL) {
+		fr_network_socket_t *s;
+		fr_listen_t const *listen;
+
+		s = fr_ptr_to_type(fr_network_socket_t, flush_entry, entry);
+		fr_dlist_remove(&s->flush_entry);
+
+		listen = s->listen;
+		if (listen->app_io->flush(listen->app_io_instance) < 0) {
+			ERROR("Failed flushing socket %d: %s", s->fd, fr_strerror());
+			if (listen->app_io->error) listen->app_io->error(listen->app_io_instance);
+
+			fr_network_socket_dead(nr, s);
+		}
 	}
 }
 
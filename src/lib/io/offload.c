@@ -0,0 +1,479 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Run CPU-bound jobs on a pool of helper threads.
+ * @file io/offload.c
+ *
+ *  Workers must not block, but some things (PBKDF2, crypt(), etc.)
+ *  are expensive enough that running them inline stalls every other
+ *  request the worker has.  Those jobs are instead queued to a small
+ *  pool of helper threads, and the worker goes back to its event
+ *  loop.
+ *
+ *  Finished jobs are put on the done list of the queue they were
+ *  submitted from, and the owning event list is woken with an
+ *  EVFILT_USER event.  The done callback then runs in the owning
+ *  thread, where it's safe to touch the request.
+ *
+ *  Everything is protected by the pool mutex.  The jobs are
+ *  expected to take far longer than the time spent holding it.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/io/offload.h>
+#include <freeradius-devel/fr_log.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <pthread.h>
+#include <sys/event.h>
+
+typedef enum {
+	OFFLOAD_JOB_INIT = 0,				//!< Allocated, but not submitted.
+	OFFLOAD_JOB_QUEUED,				//!< Waiting for a helper thread.
+	OFFLOAD_JOB_RUNNING,				//!< Being run by a helper thread.
+	OFFLOAD_JOB_DONE				//!< On the done list of its queue.
+} fr_offload_job_state_t;
+
+struct fr_offload_t {
+	pthread_mutex_t		mutex;			//!< Protects everything below, and the queues.
+	pthread_cond_t		work;			//!< Signalled when a job is queued, or on exit.
+	pthread_cond_t		idle;			//!< Signalled when a closing queue has no running jobs.
+
+	fr_dlist_t		queue;			//!< Jobs waiting for a helper thread.
+	uint32_t		queued;			//!< Number of jobs in the queue.
+	uint32_t		max_queued;		//!< Maximum number of jobs in the queue.  0 is no limit.
+
+	pthread_t		*threads;		//!< The helper threads.
+	uint32_t		num_threads;		//!< How many helpers were started.
+
+	bool			exiting;		//!< Tell the helpers to exit.
+};
+
+struct fr_offload_queue_t {
+	fr_offload_t		*offload;		//!< The pool we submit jobs to.
+	fr_event_list_t		*el;			//!< The event list of the owning thread.
+	int			kq;			//!< Of the event list, for sending wakeups.
+	uintptr_t		ident;			//!< For EVFILT_USER wakeups.
+
+	fr_dlist_t		done;			//!< Finished jobs, waiting for the owner.
+	uint32_t		running;		//!< Jobs currently being run by helpers.
+	bool			closing;		//!< Queue is being freed.
+};
+
+struct fr_offload_job_t {
+	fr_dlist_t		entry;			//!< In the pool queue, or the done list.
+	fr_offload_queue_t	*oq;			//!< Queue the job was allocated from.
+	fr_offload_job_state_t	state;			//!< Where the job is.
+	bool			cancelled;		//!< Don't call done.
+
+	fr_offload_func_t	func;			//!< Run in the helper thread.
+	fr_offload_done_t	done;			//!< Run in the owning thread.
+	void			*data;			//!< For func and done.
+	void			*uctx;			//!< For done.
+};
+
+/** Wake up the owner of a queue
+ *
+ *  Called with the pool mutex held.
+ */
+static void offload_signal(fr_offload_queue_t *oq)
+{
+	struct kevent kev;
+
+	EV_SET(&kev, oq->ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
+	(void) kevent(oq->kq, &kev, 1, NULL, 0, NULL);
+}
+
+/** Main loop for helper threads
+ *
+ */
+static void *offload_thread(void *arg)
+{
+	fr_offload_t		*offload = arg;
+	fr_offload_queue_t	*oq;
+	fr_offload_job_t	*job;
+	fr_dlist_t		*entry;
+	bool			signal;
+
+	pthread_mutex_lock(&offload->mutex);
+	while (!offload->exiting) {
+		entry = FR_DLIST_FIRST(offload->queue);
+		if (!entry) {
+			pthread_cond_wait(&offload->work, &offload->mutex);
+			continue;
+		}
+
+		job = fr_ptr_to_type(fr_offload_job_t, entry, entry);
+		fr_dlist_remove(&job->entry);
+		offload->queued--;
+
+		oq = job->oq;
+		oq->running++;
+		job->state = OFFLOAD_JOB_RUNNING;
+		pthread_mutex_unlock(&offload->mutex);
+
+		job->func(job->data);
+
+		pthread_mutex_lock(&offload->mutex);
+		job->state = OFFLOAD_JOB_DONE;
+		oq->running--;
+
+		/*
+		 *	The owner is waiting for us to finish, and
+		 *	will free the job along with the queue.
+		 */
+		if (oq->closing) {
+			if (oq->running == 0) pthread_cond_broadcast(&offload->idle);
+			continue;
+		}
+
+		/*
+		 *	Only wake the owner if it doesn't already
+		 *	have jobs to service.
+		 */
+		signal = (FR_DLIST_FIRST(oq->done) == NULL);
+		fr_dlist_insert_tail(&oq->done, &job->entry);
+		if (signal) offload_signal(oq);
+	}
+	pthread_mutex_unlock(&offload->mutex);
+
+	return NULL;
+}
+
+/** Service the done list of a queue
+ *
+ */
+static void offload_evfilt_user(UNUSED int kq, UNUSED struct kevent const *kev, void *uctx)
+{
+	fr_offload_queue_t	*oq = talloc_get_type_abort(uctx, fr_offload_queue_t);
+	fr_offload_t		*offload = oq->offload;
+	fr_offload_job_t	*job;
+	fr_dlist_t		*entry;
+	fr_dlist_t		done;
+
+	FR_DLIST_INIT(done);
+
+	pthread_mutex_lock(&offload->mutex);
+	while ((entry = FR_DLIST_FIRST(oq->done)) != NULL) {
+		fr_dlist_remove(entry);
+		fr_dlist_insert_tail(&done, entry);
+	}
+	pthread_mutex_unlock(&offload->mutex);
+
+	/*
+	 *	No one else touches the jobs once they're on our
+	 *	list, so the callbacks can run without the lock.
+	 */
+	while ((entry = FR_DLIST_FIRST(done)) != NULL) {
+		job = fr_ptr_to_type(fr_offload_job_t, entry, entry);
+		fr_dlist_remove(&job->entry);
+
+		if (!job->cancelled) job->done(job->data, job->uctx);
+		talloc_free(job);
+	}
+}
+
+static int _offload_free(fr_offload_t *offload)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&offload->mutex);
+	offload->exiting = true;
+	pthread_cond_broadcast(&offload->work);
+	pthread_mutex_unlock(&offload->mutex);
+
+	for (i = 0; i < offload->num_threads; i++) pthread_join(offload->threads[i], NULL);
+
+	pthread_cond_destroy(&offload->idle);
+	pthread_cond_destroy(&offload->work);
+	pthread_mutex_destroy(&offload->mutex);
+
+	return 0;
+}
+
+/** Create a pool of helper threads
+ *
+ *  All queues using the pool must be freed before the pool is.
+ *
+ * @param[in] ctx		the talloc context
+ * @param[in] num_threads	number of helper threads to start.
+ * @param[in] max_queued	maximum number of jobs waiting for a helper.
+ *				Submissions past this fail.  0 means no limit.
+ * @return
+ *	- NULL on error
+ *	- fr_offload_t on success
+ */
+fr_offload_t *fr_offload_create(TALLOC_CTX *ctx, uint32_t num_threads, uint32_t max_queued)
+{
+	fr_offload_t	*offload;
+	uint32_t	i;
+	int		rcode;
+
+	if (!num_threads) {
+		fr_strerror_printf("Must have at least one offload thread");
+		return NULL;
+	}
+
+	offload = talloc_zero(ctx, fr_offload_t);
+	if (!offload) {
+	nomem:
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	offload->threads = talloc_array(offload, pthread_t, num_threads);
+	if (!offload->threads) {
+		talloc_free(offload);
+		goto nomem;
+	}
+
+	FR_DLIST_INIT(offload->queue);
+	offload->max_queued = max_queued;
+
+	if ((pthread_mutex_init(&offload->mutex, NULL) != 0) ||
+	    (pthread_cond_init(&offload->work, NULL) != 0) ||
+	    (pthread_cond_init(&offload->idle, NULL) != 0)) {
+		fr_strerror_printf("Failed initializing mutex");
+		talloc_free(offload);
+		return NULL;
+	}
+	talloc_set_destructor(offload, _offload_free);
+
+	for (i = 0; i < num_threads; i++) {
+		rcode = pthread_create(&offload->threads[i], NULL, offload_thread, offload);
+		if (rcode != 0) {
+			fr_strerror_printf("Failed creating offload thread: %s", fr_syserror(rcode));
+			talloc_free(offload);
+			return NULL;
+		}
+		offload->num_threads++;
+	}
+
+	return offload;
+}
+
+static int _offload_queue_free(fr_offload_queue_t *oq)
+{
+	fr_offload_t		*offload = oq->offload;
+	fr_offload_job_t	*job;
+	fr_dlist_t		*entry, *next;
+	struct kevent		kev;
+
+	pthread_mutex_lock(&offload->mutex);
+
+	/*
+	 *	Pull our jobs out of the pool queue.  They're
+	 *	freed along with the queue.
+	 */
+	for (entry = FR_DLIST_FIRST(offload->queue);
+	     entry != NULL;
+	     entry = next) {
+		next = FR_DLIST_NEXT(offload->queue, entry);
+
+		job = fr_ptr_to_type(fr_offload_job_t, entry, entry);
+		if (job->oq != oq) continue;
+
+		fr_dlist_remove(&job->entry);
+		offload->queued--;
+	}
+
+	/*
+	 *	The helpers still have pointers to the jobs they're
+	 *	running.  Wait for them to finish.
+	 */
+	oq->closing = true;
+	while (oq->running > 0) pthread_cond_wait(&offload->idle, &offload->mutex);
+
+	pthread_mutex_unlock(&offload->mutex);
+
+	EV_SET(&kev, oq->ident, EVFILT_USER, EV_DELETE, NOTE_FFNOP, 0, NULL);
+	(void) kevent(oq->kq, &kev, 1, NULL, 0, NULL);
+	(void) fr_event_user_delete(oq->el, offload_evfilt_user, oq);
+
+	return 0;
+}
+
+/** Create a queue for submitting jobs from a thread
+ *
+ *  The queue must only be used from the thread which runs the
+ *  event list.
+ *
+ * @param[in] ctx	the talloc context
+ * @param[in] offload	the pool of helper threads.
+ * @param[in] el	the event list of the thread which will submit jobs.
+ * @return
+ *	- NULL on error
+ *	- fr_offload_queue_t on success
+ */
+fr_offload_queue_t *fr_offload_queue_create(TALLOC_CTX *ctx, fr_offload_t *offload, fr_event_list_t *el)
+{
+	fr_offload_queue_t	*oq;
+	struct kevent		kev;
+
+	oq = talloc_zero(ctx, fr_offload_queue_t);
+	if (!oq) {
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	oq->offload = offload;
+	oq->el = el;
+	oq->kq = fr_event_list_kq(el);
+	FR_DLIST_INIT(oq->done);
+
+	oq->ident = fr_event_user_insert(el, offload_evfilt_user, oq);
+	if (!oq->ident) {
+		fr_strerror_printf("Failed updating event list: %s", fr_strerror());
+		talloc_free(oq);
+		return NULL;
+	}
+
+	EV_SET(&kev, oq->ident, EVFILT_USER, EV_ADD | EV_CLEAR, NOTE_FFNOP, 0, NULL);
+	if (kevent(oq->kq, &kev, 1, NULL, 0, NULL) < 0) {
+		fr_strerror_printf("Failed adding offload event to KQ: %s", fr_syserror(errno));
+		(void) fr_event_user_delete(el, offload_evfilt_user, oq);
+		talloc_free(oq);
+		return NULL;
+	}
+	talloc_set_destructor(oq, _offload_queue_free);
+
+	return oq;
+}
+
+/** Allocate a job
+ *
+ *  The job data should be allocated in the context of the job,
+ *  so that it's freed along with the job.  Jobs which are never
+ *  submitted may be freed with talloc_free().  Once submitted,
+ *  they must only be freed with #fr_offload_job_cancel.
+ *
+ * @param[in] oq	the queue the job will be submitted to.
+ * @return
+ *	- NULL on error
+ *	- fr_offload_job_t on success
+ */
+fr_offload_job_t *fr_offload_job_alloc(fr_offload_queue_t *oq)
+{
+	fr_offload_job_t *job;
+
+	job = talloc_zero(oq, fr_offload_job_t);
+	if (!job) {
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	job->oq = oq;
+	FR_DLIST_INIT(job->entry);
+
+	return job;
+}
+
+/** Hand a job to the helper threads
+ *
+ * @param[in] job	to submit.
+ * @param[in] func	to run in a helper thread.
+ * @param[in] done	to run in the owning thread, once func has returned.
+ * @param[in] data	for func and done.  Should be allocated in the
+ *			context of the job.
+ * @param[in] uctx	for done.
+ * @return
+ *	- <0 if too many jobs are queued.  The job is still owned by the caller.
+ *	- 0 on success
+ */
+int fr_offload_job_submit(fr_offload_job_t *job, fr_offload_func_t func, fr_offload_done_t done,
+			  void *data, void *uctx)
+{
+	fr_offload_t *offload = job->oq->offload;
+
+	rad_assert(job->state == OFFLOAD_JOB_INIT);
+
+	job->func = func;
+	job->done = done;
+	job->data = data;
+	job->uctx = uctx;
+
+	pthread_mutex_lock(&offload->mutex);
+	if (offload->max_queued && (offload->queued >= offload->max_queued)) {
+		pthread_mutex_unlock(&offload->mutex);
+		fr_strerror_printf("Too many offloaded jobs queued (%u)", offload->max_queued);
+		return -1;
+	}
+
+	fr_dlist_insert_tail(&offload->queue, &job->entry);
+	offload->queued++;
+	job->state = OFFLOAD_JOB_QUEUED;
+
+	pthread_cond_signal(&offload->work);
+	pthread_mutex_unlock(&offload->mutex);
+
+	return 0;
+}
+
+/** Cancel a job
+ *
+ *  The done callback will not be called.  If the job is being run,
+ *  it's freed when the helper finishes it, otherwise it's freed
+ *  immediately.  It must not be called from the done callback for
+ *  the same job.
+ *
+ * @param[in] job	to cancel.
+ */
+void fr_offload_job_cancel(fr_offload_job_t *job)
+{
+	fr_offload_t *offload = job->oq->offload;
+
+	pthread_mutex_lock(&offload->mutex);
+	switch (job->state) {
+	case OFFLOAD_JOB_RUNNING:
+		job->cancelled = true;
+		pthread_mutex_unlock(&offload->mutex);
+		return;
+
+	case OFFLOAD_JOB_QUEUED:
+		offload->queued--;
+		/* FALL-THROUGH */
+
+	case OFFLOAD_JOB_DONE:
+		fr_dlist_remove(&job->entry);
+		break;
+
+	case OFFLOAD_JOB_INIT:
+		break;
+	}
+	pthread_mutex_unlock(&offload->mutex);
+
+	talloc_free(job);
+}
+
+/** Return the number of jobs waiting for a helper thread
+ *
+ */
+uint32_t fr_offload_queued(fr_offload_t *offload)
+{
+	uint32_t queued;
+
+	pthread_mutex_lock(&offload->mutex);
+	queued = offload->queued;
+	pthread_mutex_unlock(&offload->mutex);
+
+	return queued;
+}
@@ -0,0 +1,81 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_OFFLOAD_H
+#define _FR_OFFLOAD_H
+/**
+ * $Id$
+ *
+ * @file io/offload.h
+ * @brief Run CPU-bound jobs on a pool of helper threads.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(offload_h, "$Id$")
+
+#include <talloc.h>
+#include <stdint.h>
+
+#include <freeradius-devel/event.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	One pool of helper threads is shared by many queues.  Each
+ *	queue belongs to a single event list (i.e. worker thread),
+ *	and is where that thread's finished jobs are returned.
+ */
+typedef struct fr_offload_t fr_offload_t;
+typedef struct fr_offload_queue_t fr_offload_queue_t;
+typedef struct fr_offload_job_t fr_offload_job_t;
+
+/** Do the work
+ *
+ * Called from a helper thread.  It MUST NOT touch anything other
+ * than the job data, and MUST NOT allocate from, or free, any
+ * talloc chunk belonging to the job.
+ *
+ * @param[in] data	passed to #fr_offload_job_submit.
+ */
+typedef void (*fr_offload_func_t)(void *data);
+
+/** Receive a finished job
+ *
+ * Called from the event loop of the thread which submitted the job.
+ * The job (and its data) are freed when the callback returns.
+ *
+ * @param[in] data	passed to #fr_offload_job_submit.
+ * @param[in] uctx	passed to #fr_offload_job_submit.
+ */
+typedef void (*fr_offload_done_t)(void *data, void *uctx);
+
+fr_offload_t		*fr_offload_create(TALLOC_CTX *ctx, uint32_t num_threads, uint32_t max_queued);
+
+fr_offload_queue_t	*fr_offload_queue_create(TALLOC_CTX *ctx, fr_offload_t *offload, fr_event_list_t *el);
+
+fr_offload_job_t	*fr_offload_job_alloc(fr_offload_queue_t *oq) CC_HINT(nonnull);
+int			fr_offload_job_submit(fr_offload_job_t *job, fr_offload_func_t func, fr_offload_done_t done,
+					      void *data, void *uctx) CC_HINT(nonnull(1,2,3));
+void			fr_offload_job_cancel(fr_offload_job_t *job) CC_HINT(nonnull);
+
+uint32_t		fr_offload_queued(fr_offload_t *offload) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FR_OFFLOAD_H */
@@ -0,0 +1,256 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Allocate REQUESTs from a cache of talloc pools.
+ * @file io/request_slab.c
+ *
+ *  Each REQUEST is allocated in its own talloc pool, so decoding,
+ *  processing and encoding a packet allocates from the pool instead
+ *  of calling malloc() for every VALUE_PAIR and string.  When the
+ *  request is freed, the pool is empty again, and is put back on the
+ *  free list for the next request.
+ *
+ *  When measuring is enabled, the size of new pools follows the
+ *  memory used by recent requests.  It grows as soon as a request
+ *  needs more, and shrinks back to what the largest request in the
+ *  last REQUEST_SLAB_WINDOW needed.  Pools which are smaller than the
+ *  current size are freed instead of being reused.  Measuring walks
+ *  every chunk of the request, so it is off by default, and the pools
+ *  stay at their initial size.
+ *
+ *  Anything allocated outside of the request (e.g. the session-state
+ *  context) still uses malloc().
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/request_slab.h>
+#include <freeradius-devel/rad_assert.h>
+
+/*
+ *	Number of requests over which we track the largest one.
+ */
+#define REQUEST_SLAB_WINDOW		(1024)
+
+/*
+ *	Approximately what talloc adds to each chunk.  talloc doesn't
+ *	tell us how much of a pool has been used, so we estimate it.
+ */
+#define REQUEST_SLAB_CHUNK_OVERHEAD	(96)
+
+#define REQUEST_SLAB_POOL_MAX		(1024 * 1024)
+
+typedef struct {
+	size_t			size;			//!< Of the pool.
+	TALLOC_CTX		*pool;			//!< Holds one REQUEST.
+} fr_request_slab_pool_t;
+
+struct fr_request_slab_t {
+	fr_request_slab_pool_t	**free;			//!< Pools waiting to be reused.
+	uint32_t		num_free;		//!< Number of pools in the free list.
+	uint32_t		max_free;		//!< Size of the free list.
+
+	size_t			min_size;		//!< Smallest pool we allocate.
+	size_t			pool_size;		//!< Size of new pools.
+
+	bool			measure;		//!< Track the memory used by requests.
+	size_t			window_max;		//!< Largest request in this window.
+	uint32_t		window_count;		//!< Requests freed in this window.
+
+	fr_request_slab_stats_t	stats;
+};
+
+/** Create a slab
+ *
+ * @param[in] ctx	to allocate the slab in.
+ * @param[in] pool_size	the initial, and minimum, size of each pool.
+ * @param[in] max_free	maximum number of empty pools to keep.
+ * @return
+ *	- NULL on error.
+ *	- fr_request_slab_t on success.
+ */
+fr_request_slab_t *fr_request_slab_create(TALLOC_CTX *ctx, size_t pool_size, uint32_t max_free)
+{
+	fr_request_slab_t *slab;
+
+	if (pool_size > REQUEST_SLAB_POOL_MAX) pool_size = REQUEST_SLAB_POOL_MAX;
+
+	slab = talloc_zero(ctx, fr_request_slab_t);
+	if (!slab) {
+	nomem:
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	slab->free = talloc_array(slab, fr_request_slab_pool_t *, max_free);
+	if (!slab->free) {
+		talloc_free(slab);
+		goto nomem;
+	}
+
+	slab->max_free = max_free;
+	slab->min_size = slab->pool_size = pool_size;
+
+	return slab;
+}
+
+/** Allocate a REQUEST
+ *
+ * The request should be freed with #fr_request_slab_free, so that
+ * its pool can be reused.
+ *
+ * @param[in] slab	to allocate the request from.
+ * @return
+ *	- NULL on error.
+ *	- A new REQUEST on success.
+ */
+REQUEST *fr_request_slab_alloc(fr_request_slab_t *slab)
+{
+	fr_request_slab_pool_t	*sp;
+	REQUEST			*request;
+	bool			reused = false;
+
+	if (slab->num_free > 0) {
+		sp = slab->free[--slab->num_free];
+		reused = true;
+	} else {
+		sp = talloc(slab, fr_request_slab_pool_t);
+		if (!sp) return NULL;
+
+		sp->size = slab->pool_size;
+		sp->pool = talloc_pool(sp, sp->size);
+		if (!sp->pool) {
+			talloc_free(sp);
+			return NULL;
+		}
+	}
+
+	request = request_alloc(sp->pool);
+	if (!request) {
+		talloc_free(sp);
+		return NULL;
+	}
+
+	slab->stats.alloced++;
+	if (reused) slab->stats.reused++;
+
+	return request;
+}
+
+/** Work out the size of new pools, from the memory a request used
+ *
+ */
+static size_t request_slab_size(fr_request_slab_t const *slab, size_t used)
+{
+	size_t size;
+
+	/*
+	 *	Memory freed in the middle of a request isn't
+	 *	reused by the pool, so leave some headroom.
+	 */
+	size = used + (used / 2);
+	size = (size + 1023) & ~((size_t) 1023);
+
+	if (size < slab->min_size) return slab->min_size;
+	if (size > REQUEST_SLAB_POOL_MAX) return REQUEST_SLAB_POOL_MAX;
+
+	return size;
+}
+
+/** Track the memory used by a request, and resize new pools to match
+ *
+ */
+static void request_slab_measure(fr_request_slab_t *slab, fr_request_slab_pool_t const *sp, REQUEST *request)
+{
+	size_t used;
+
+	used = talloc_total_size(request) + (talloc_total_blocks(request) * REQUEST_SLAB_CHUNK_OVERHEAD);
+	if (used > sp->size) slab->stats.overflows++;
+
+	/*
+	 *	Grow as soon as we need to, and shrink once per
+	 *	window.
+	 */
+	if (used > slab->window_max) slab->window_max = used;
+	if (used > slab->pool_size) slab->pool_size = request_slab_size(slab, used);
+
+	if (++slab->window_count >= REQUEST_SLAB_WINDOW) {
+		slab->pool_size = request_slab_size(slab, slab->window_max);
+		slab->window_max = 0;
+		slab->window_count = 0;
+	}
+}
+
+/** Free a REQUEST, and cache its pool
+ *
+ * Requests which weren't allocated from this slab (e.g. detached
+ * subrequests) are just freed.
+ *
+ * @param[in] slab	the request was allocated from.
+ * @param[in] request	to free.
+ */
+void fr_request_slab_free(fr_request_slab_t *slab, REQUEST *request)
+{
+	fr_request_slab_pool_t	*sp;
+
+	sp = talloc_get_type(talloc_parent(talloc_parent(request)), fr_request_slab_pool_t);
+	if (!sp || (talloc_parent(sp) != slab)) {
+		talloc_free(request);
+		return;
+	}
+
+	if (slab->measure) request_slab_measure(slab, sp, request);
+
+	talloc_free(request);
+
+	if ((sp->size < slab->pool_size) || (slab->num_free >= slab->max_free)) {
+		talloc_free(sp);
+		return;
+	}
+
+	slab->free[slab->num_free++] = sp;
+}
+
+/** Enable or disable measuring the memory used by requests
+ *
+ * Measuring walks every chunk of each request as it is freed, so it
+ * should only be enabled when debugging, or when benchmarking.
+ *
+ * @param[in] slab	to change.
+ * @param[in] measure	whether to resize new pools to match recent requests.
+ */
+void fr_request_slab_measure(fr_request_slab_t *slab, bool measure)
+{
+	slab->measure = measure;
+	slab->window_max = 0;
+	slab->window_count = 0;
+}
+
+/** Get the slab statistics
+ *
+ * @param[out] stats	where to write the statistics.
+ * @param[in] slab	to get the statistics for.
+ */
+void fr_request_slab_stats(fr_request_slab_stats_t *stats, fr_request_slab_t const *slab)
+{
+	*stats = slab->stats;
+	stats->pool_size = slab->pool_size;
+	stats->num_free = slab->num_free;
+}
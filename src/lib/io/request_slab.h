@@ -0,0 +1,64 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_REQUEST_SLAB_H
+#define _FR_REQUEST_SLAB_H
+/**
+ * $Id$
+ *
+ * @file io/request_slab.h
+ * @brief Allocate REQUESTs from a cache of talloc pools.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(request_slab_h, "$Id$")
+
+#include <talloc.h>
+#include <stdint.h>
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	A slab is owned by one thread.  It is NOT thread-safe.
+ */
+typedef struct fr_request_slab_t fr_request_slab_t;
+
+typedef struct {
+	uint64_t		alloced;		//!< Requests allocated.
+	uint64_t		reused;			//!< Requests allocated from a cached pool.
+	uint64_t		overflows;		//!< Measured requests which used more memory than their pool.
+	size_t			pool_size;		//!< Size of new pools.
+	uint32_t		num_free;		//!< Pools waiting to be reused.
+} fr_request_slab_stats_t;
+
+fr_request_slab_t	*fr_request_slab_create(TALLOC_CTX *ctx, size_t pool_size, uint32_t max_free);
+
+REQUEST			*fr_request_slab_alloc(fr_request_slab_t *slab) CC_HINT(nonnull);
+void			fr_request_slab_free(fr_request_slab_t *slab, REQUEST *request) CC_HINT(nonnull);
+
+void			fr_request_slab_measure(fr_request_slab_t *slab, bool measure) CC_HINT(nonnull);
+
+void			fr_request_slab_stats(fr_request_slab_stats_t *stats, fr_request_slab_t const *slab)
+					      CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FR_REQUEST_SLAB_H */
@@ -29,6 +29,9 @@ RCSID("$Id$")
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/rbtree.h>
 
+#include <ctype.h>
+#include <unistd.h>
+
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
 #endif
@@ -61,6 +64,12 @@ RCSID("$Id$")
 
 #define SEM_WAIT_INTR(_x) do {if (sem_wait(_x) == 0) break;} while (errno == EINTR)
 
+/*
+ *	Limits for CPU lists, and NUMA nodes.
+ */
+#define SCHEDULE_MAX_CPUS	(1024)
+#define SCHEDULE_MAX_NODES	(64)
+
 /**
  *  Track the child thread status.
  */
@@ -90,6 +99,10 @@ typedef struct fr_schedule_worker_t {
 
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_worker_t	*worker;		//!< the worker data structure
+
+	int		cpu;			//!< CPU we're pinned to, or -1 for "any"
+	int		node;			//!< NUMA node of that CPU
+	fr_worker_group_t *group;		//!< the workers we steal work from, if any
 } fr_schedule_worker_t;
 
 /**
@@ -104,6 +117,10 @@ typedef struct fr_schedule_network_t {
 
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_network_t	*rc;			//!< the receive data structure
+
+	int		cpu;			//!< CPU we're pinned to, or -1 for "any"
+	int		node;			//!< NUMA node of that CPU
+	bool		local_workers;		//!< whether any workers are on the same node
 } fr_schedule_network_t;
 
 
@@ -121,11 +138,15 @@ struct fr_schedule_t {
 	int		max_networks;		//!< number of network threads
 	int		max_workers;		//!< max number of worker threads
 
+	int		num_networks;		//!< number of network threads
 	int		num_workers;		//!< number of worker threads
 	int		num_workers_exited;	//!< number of exited workers
 
+	int		next_network;		//!< network which gets the next socket
+
 #ifdef HAVE_PTHREAD_H
 	sem_t		semaphore;		//!< for inter-thread signaling
+	sem_t		stopped;		//!< all workers have stopped running
 #endif
 
 	fr_schedule_thread_instantiate_t	worker_thread_instantiate;	//!< thread instantiation callback
@@ -136,10 +157,141 @@ struct fr_schedule_t {
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
 
-	fr_schedule_network_t *sn;		//!< pointer to the (one) network thread
+	fr_schedule_network_t **sn;		//!< array of network threads
+
+	bool		numa;			//!< networks only use workers on the same NUMA node
+	int		*network_cpus;		//!< CPUs to pin network threads to
+	int		num_network_cpus;	//!< number of entries in network_cpus
+	int		*worker_cpus;		//!< CPUs to pin worker threads to
+	int		num_worker_cpus;	//!< number of entries in worker_cpus
+
+	fr_worker_group_t *group[SCHEDULE_MAX_NODES];	//!< workers which steal work from each other
+
+	fr_time_t	max_request_time;	//!< how long messages can wait to be processed, 0 for the default
 };
 
 
+/** Parse a list of CPUs
+ *
+ *  e.g. "0-3,8,10-11"
+ *
+ * @param[in] ctx to allocate the array in.
+ * @param[out] out the array of CPUs, in the order given.
+ * @param[in] str the CPU list.
+ * @return
+ *	- <0 on error
+ *	- the number of CPUs in the list
+ */
+static int schedule_cpu_list(TALLOC_CTX *ctx, int **out, char const *str)
+{
+	int		num = 0;
+	int		cpus[SCHEDULE_MAX_CPUS];
+	char const	*p = str;
+	char		*q;
+	unsigned long	first, last;
+
+	while (*p) {
+		while (isspace((int) *p) || (*p == ',')) p++;
+		if (!*p) break;
+
+		if (!isdigit((int) *p)) goto invalid;
+
+		first = last = strtoul(p, &q, 10);
+		p = q;
+
+		if (*p == '-') {
+			p++;
+			if (!isdigit((int) *p)) goto invalid;
+
+			last = strtoul(p, &q, 10);
+			p = q;
+		}
+
+		if ((last < first) || (last >= SCHEDULE_MAX_CPUS)) {
+		invalid:
+			fr_strerror_printf("Invalid CPU list \"%s\"", str);
+			return -1;
+		}
+
+		while (first <= last) {
+			if (num == SCHEDULE_MAX_CPUS) goto invalid;
+			cpus[num++] = first++;
+		}
+
+		if (*p && (*p != ',') && !isspace((int) *p)) goto invalid;
+	}
+
+	if (!num) {
+		fr_strerror_printf("Empty CPU list");
+		return -1;
+	}
+
+	*out = talloc_memdup(ctx, cpus, num * sizeof(cpus[0]));
+	if (!*out) {
+		fr_strerror_printf("Failed allocating memory");
+		return -1;
+	}
+
+	return num;
+}
+
+
+/** Find the NUMA node for a CPU
+ *
+ *  There's no portable API for this, and we don't want to depend on
+ *  libnuma just for this.  So we ask sysfs.
+ *
+ * @param[in] cpu to look up.
+ * @return the NUMA node, or 0 if unknown.
+ */
+static int schedule_cpu_node(int cpu)
+{
+#ifdef __linux__
+	int	node;
+	char	path[64];
+
+	for (node = 0; node < SCHEDULE_MAX_NODES; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+		if (access(path, F_OK) == 0) return node;
+	}
+#endif
+
+	return 0;
+}
+
+
+/** Pin the calling thread to a CPU
+ *
+ *  This is done before the thread allocates anything, so that the
+ *  memory it uses is allocated on the local NUMA node.
+ */
+static void schedule_pin(fr_schedule_t *sc, char const *type, int id, int cpu)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	int		rcode;
+	cpu_set_t	cpuset;
+
+	if (cpu < 0) return;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+
+	rcode = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if (rcode != 0) {
+		fr_log(sc->log, L_WARN, "%s %d - Failed pinning thread to CPU %d: %s",
+		       type, id, cpu, fr_syserror(rcode));
+		return;
+	}
+
+	fr_log(sc->log, L_INFO, "%s %d pinned to CPU %d", type, id, cpu);
+#else
+	if (cpu < 0) return;
+
+	fr_log(sc->log, L_WARN, "%s %d - CPU pinning is not supported on this system", type, id);
+#endif
+}
+
+
 /** Initialize and run the worker thread.
  *
  * @param[in] arg the fr_schedule_worker_t
@@ -147,12 +299,15 @@ struct fr_schedule_t {
  */
 static void *fr_schedule_worker_thread(void *arg)
 {
+	int i;
 	TALLOC_CTX *ctx;
 	fr_schedule_worker_t *sw = arg;
 	fr_schedule_t *sc = sw->sc;
 	fr_schedule_child_status_t status = FR_CHILD_FAIL;
 	char buffer[32];
 
+	schedule_pin(sc, "Worker", sw->id, sw->cpu);
+
 	sw->ctx = ctx = talloc_init("worker %d", sw->id);
 	if (!ctx) {
 		fr_log(sc->log, L_ERR, "Worker %d - Failed allocating memory", sw->id);
@@ -173,6 +328,7 @@ static void *fr_schedule_worker_thread(void *arg)
 		fr_log(sc->log, L_ERR, "Worker %d - Failed creating worker: %s", sw->id, fr_strerror());
 		goto fail;
 	}
+	if (sc->max_request_time) fr_worker_max_request_time_set(sw->worker, sc->max_request_time);
 
 	snprintf(buffer, sizeof(buffer), "thread %d - ", sw->id);
 	fr_worker_name(sw->worker, buffer);
@@ -186,9 +342,26 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	if (sw->group && (fr_worker_group_join(sw->group, sw->worker) < 0)) {
+		fr_log(sc->log, L_ERR, "Worker %d - Failed joining worker group: %s", sw->id, fr_strerror());
+		goto fail;
+	}
+
 	sw->status = FR_CHILD_RUNNING;
 
-	(void) fr_network_worker_add(sc->sn->rc, sw->worker);
+	/*
+	 *	Every network thread can send packets to every
+	 *	worker.  Unless we're keeping traffic on one NUMA
+	 *	node, in which case networks only use local workers.
+	 *	If there are no local workers, they use all of them.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		fr_schedule_network_t *sn = sc->sn[i];
+
+		if (sc->numa && sn->local_workers && (sn->node != sw->node)) continue;
+
+		(void) fr_network_worker_add(sn->rc, sw->worker);
+	}
 
 	fr_log(sc->log, L_INFO, "Spawned async worker %d", sw->id);
 
@@ -206,6 +379,15 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	fr_log(sc->log, L_INFO, "Worker %d finished\n", sw->id);
 
+	/*
+	 *	Other workers may still be looking at our work deque.
+	 *	Wait until they've all stopped before we free it.
+	 */
+	if (sw->group) {
+		sem_post(&sc->semaphore);
+		SEM_WAIT_INTR(&sc->stopped);
+	}
+
 	status = FR_CHILD_EXITED;
 
 fail:
@@ -242,6 +424,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	fr_log(sc->log, L_INFO, "Network %d starting\n", sn->id);
 
+	schedule_pin(sc, "Network", sn->id, sn->cpu);
+
 	sn->ctx = ctx = talloc_init("network %d", sn->id);
 	if (!ctx) {
 		fr_log(sc->log, L_ERR, "Network %d - Failed allocating memory", sn->id);
@@ -268,7 +452,7 @@ static void *fr_schedule_network_thread(void *arg)
 	 */
 	sem_post(&sc->semaphore);
 
-	fr_log(sc->log, L_INFO, "Spawned asycn network 0");
+	fr_log(sc->log, L_INFO, "Spawned async network %d", sn->id);
 
 	/*
 	 *	Do all of the work.
@@ -280,7 +464,7 @@ static void *fr_schedule_network_thread(void *arg)
 fail:
 	sn->status = status;
 
-	fr_log(sc->log, L_INFO, "Network exiting");
+	fr_log(sc->log, L_INFO, "Network %d exiting", sn->id);
 
 	/*
 	 *	Tell the scheduler we're done.
@@ -299,6 +483,7 @@ fail:
  * @param[in] lvl the log level
  * @param[in] max_networks the number of network threads
  * @param[in] max_workers the number of worker threads
+ * @param[in] config where the threads run.  May be NULL.
  * @param[in] worker_thread_instantiate callback for new worker threads
  * @param[in] worker_thread_ctx context for callback
  * @return
@@ -307,7 +492,7 @@ fail:
  */
 fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 				  fr_log_t *logger, fr_log_lvl_t lvl,
-				  int max_networks, int max_workers,
+				  int max_networks, int max_workers, fr_schedule_config_t const *config,
 				  fr_schedule_thread_instantiate_t worker_thread_instantiate,
 				  void *worker_thread_ctx)
 {
@@ -316,6 +501,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	int rcode;
 	pthread_attr_t attr;
 	fr_dlist_t *entry, *next;
+	int num_node_workers[SCHEDULE_MAX_NODES];
 #endif
 	fr_schedule_t *sc;
 
@@ -353,6 +539,8 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	sc->worker_thread_instantiate = worker_thread_instantiate;
 	sc->worker_instantiate_ctx = worker_thread_ctx;
 
+	if (config && config->max_request_time) sc->max_request_time = (fr_time_t) config->max_request_time * NANOSEC;
+
 	sc->running = true;
 
 	/*
@@ -372,6 +560,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 			talloc_free(sc);
 			return NULL;
 		}
+		if (sc->max_request_time) fr_worker_max_request_time_set(sc->single_worker, sc->max_request_time);
 
 		(void) fr_network_worker_add(sc->single_network, sc->single_worker);
 		fr_log(sc->log, L_DBG, "Scheduler created in single-threaded mode");
@@ -379,6 +568,51 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	}
 
 #ifdef HAVE_PTHREAD_H
+	/*
+	 *	Figure out where the threads run.
+	 */
+	if (config) {
+		if (config->network_cpus) {
+			sc->num_network_cpus = schedule_cpu_list(sc, &sc->network_cpus, config->network_cpus);
+			if (sc->num_network_cpus < 0) {
+				talloc_free(sc);
+				return NULL;
+			}
+		}
+
+		if (config->worker_cpus) {
+			sc->num_worker_cpus = schedule_cpu_list(sc, &sc->worker_cpus, config->worker_cpus);
+			if (sc->num_worker_cpus < 0) {
+				talloc_free(sc);
+				return NULL;
+			}
+		}
+
+		/*
+		 *	We can only tell which node a thread is on if
+		 *	we pinned it there.
+		 */
+		if (config->numa) {
+			if (!sc->num_network_cpus || !sc->num_worker_cpus) {
+				fr_strerror_printf("NUMA pairing requires both network and worker CPU lists");
+				talloc_free(sc);
+				return NULL;
+			}
+
+			sc->numa = true;
+		}
+	}
+
+	memset(num_node_workers, 0, sizeof(num_node_workers));
+	for (i = 0; i < sc->max_workers; i++) {
+		if (!sc->numa) {
+			num_node_workers[0]++;
+			continue;
+		}
+
+		num_node_workers[schedule_cpu_node(sc->worker_cpus[i % sc->num_worker_cpus])]++;
+	}
+
 	(void) pthread_attr_init(&attr);
 	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
@@ -394,29 +628,79 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	memset(&sc->stopped, 0, sizeof(sc->stopped));
+	if (sem_init(&sc->stopped, 0, SEMAPHORE_LOCKED) != 0) {
+		fr_strerror_printf("Failed creating semaphore: %s", fr_syserror(errno));
+		sem_destroy(&sc->semaphore);
+		talloc_free(sc);
+		return NULL;
+	}
+
 	/*
-	 *	Create the network thread first.
-	 *	@todo - create multiple network threads
+	 *	Idle workers steal work from busy ones.  When traffic
+	 *	is kept on one NUMA node, each node has its own group.
 	 */
-	sc->sn = talloc_zero(sc, fr_schedule_network_t);
-	sc->sn->sc = sc;
-	sc->sn->id = 0;
+	for (i = 0; i < SCHEDULE_MAX_NODES; i++) {
+		if (num_node_workers[i] < 2) continue;
 
-	rcode = pthread_create(&sc->sn->pthread_id, &attr, fr_schedule_network_thread, sc->sn);
-	if (rcode != 0) {
-		fr_strerror_printf("Failed creating network thread: %s", fr_syserror(errno));
-		goto fail;
+		sc->group[i] = fr_worker_group_create(sc, num_node_workers[i]);
+		if (!sc->group[i]) {
+			sem_destroy(&sc->stopped);
+			sem_destroy(&sc->semaphore);
+			talloc_free(sc);
+			return NULL;
+		}
 	}
 
-	SEM_WAIT_INTR(&sc->semaphore);
-	if (sc->sn->status != FR_CHILD_RUNNING) {
-	fail:
-		if (sc->sn->ctx) TALLOC_FREE(sc->sn->ctx);
-		TALLOC_FREE(sc->sn);
-		fr_schedule_destroy(sc);
+	/*
+	 *	Create the network threads first, so that the workers
+	 *	can be added to all of them.
+	 */
+	sc->sn = talloc_zero_array(sc, fr_schedule_network_t *, sc->max_networks);
+	if (!sc->sn) {
+		fr_strerror_printf("Failed allocating memory");
+		sem_destroy(&sc->stopped);
+		sem_destroy(&sc->semaphore);
+		talloc_free(sc);
 		return NULL;
 	}
 
+	for (i = 0; i < sc->max_networks; i++) {
+		fr_schedule_network_t *sn;
+
+		fr_log(sc->log, L_DBG, "Creating %d/%d networks\n", i, sc->max_networks);
+
+		sn = talloc_zero(sc, fr_schedule_network_t);
+		if (!sn) {
+			fr_strerror_printf("Failed allocating memory");
+			goto fail;
+		}
+
+		sn->sc = sc;
+		sn->id = i;
+		sn->cpu = sc->num_network_cpus ? sc->network_cpus[i % sc->num_network_cpus] : -1;
+		sn->node = sc->numa ? schedule_cpu_node(sn->cpu) : 0;
+		sn->local_workers = (num_node_workers[sn->node] > 0);
+
+		rcode = pthread_create(&sn->pthread_id, &attr, fr_schedule_network_thread, sn);
+		if (rcode != 0) {
+			fr_strerror_printf("Failed creating network thread %d: %s", i, fr_syserror(errno));
+			talloc_free(sn);
+			goto fail;
+		}
+
+		SEM_WAIT_INTR(&sc->semaphore);
+		if (sn->status != FR_CHILD_RUNNING) {
+			if (sn->ctx) TALLOC_FREE(sn->ctx);
+			talloc_free(sn);
+		fail:
+			fr_schedule_destroy(sc);
+			return NULL;
+		}
+
+		sc->sn[sc->num_networks++] = sn;
+	}
+
 	/*
 	 *	Create all of the workers.
 	 */
@@ -437,6 +721,9 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		sw->id = i;
 		sw->sc = sc;
 		sw->status = FR_CHILD_INITIALIZING;
+		sw->cpu = sc->num_worker_cpus ? sc->worker_cpus[i % sc->num_worker_cpus] : -1;
+		sw->node = sc->numa ? schedule_cpu_node(sw->cpu) : 0;
+		sw->group = sc->group[sw->node];
 		fr_dlist_insert_head(&sc->workers, &sw->entry);
 
 		rcode = pthread_create(&sw->pthread_id, &attr, fr_schedule_worker_thread, sw);
@@ -507,6 +794,7 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 	sc->running = false;
 
 #ifdef HAVE_PTHREAD_H
+	int		num_stealing;
 	fr_dlist_t	*entry;
 
 	/*
@@ -522,18 +810,20 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		goto done;
 	}
 
-	rad_assert(sc->num_workers > 0);
-
 	/*
-	 *	If the network thread is running, tell it to exit, and
-	 *	wait for it to do so.  Once it's exited, we know that
-	 *	this thread can use the network channels to tell the
-	 *	workers that the network side is going away.
+	 *	If the network threads are running, tell them to exit,
+	 *	and wait for them to do so.  Once they've exited, we
+	 *	know that this thread can use the network channels to
+	 *	tell the workers that the network side is going away.
 	 */
-	if (sc->sn->status == FR_CHILD_RUNNING) {
-		fr_network_exit(sc->sn->rc);
+	for (i = 0; i < sc->num_networks; i++) {
+		fr_schedule_network_t *sn = sc->sn[i];
+
+		if (sn->status != FR_CHILD_RUNNING) continue;
+
+		fr_network_exit(sn->rc);
 		SEM_WAIT_INTR(&sc->semaphore);
-		fr_network_destroy(sc->sn->rc);
+		fr_network_destroy(sn->rc);
 	}
 
 	/*
@@ -546,6 +836,27 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		fr_worker_exit(sw->worker);
 	}
 
+	/*
+	 *	Workers which steal work from each other first wait
+	 *	for everyone to stop, and only then clean up.
+	 */
+	num_stealing = 0;
+	for (entry = FR_DLIST_FIRST(sc->workers);
+	     entry != NULL;
+	     entry = FR_DLIST_NEXT(sc->workers, entry)) {
+		sw = fr_ptr_to_type(fr_schedule_worker_t, entry, entry);
+		if (sw->group) num_stealing++;
+	}
+
+	for (i = 0; i < num_stealing; i++) {
+		fr_log(sc->log, L_DBG, "Wait for semaphore indicating stop %d/%d\n", i, num_stealing);
+		SEM_WAIT_INTR(&sc->semaphore);
+	}
+
+	for (i = 0; i < num_stealing; i++) {
+		sem_post(&sc->stopped);
+	}
+
 	/*
 	 *	Wait for all worker threads to finish.  THEN clean up
 	 *	modules.  Otherwise, the modules will be removed from
@@ -575,8 +886,11 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 //		talloc_free(sw->ctx);
 	}
 
-	TALLOC_FREE(sc->sn->ctx);
+	for (i = 0; i < sc->num_networks; i++) {
+		TALLOC_FREE(sc->sn[i]->ctx);
+	}
 
+	sem_destroy(&sc->stopped);
 	sem_destroy(&sc->semaphore);
 #endif	/* HAVE_PTHREAD_H */
 
@@ -591,7 +905,27 @@ done:
 	return 0;
 }
 
+/** Get the number of network threads
+ *
+ *  Listeners which open one socket per network thread use this to
+ *  decide how many sockets to open.
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads.  Single-threaded mode has one.
+ */
+int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return sc->num_networks;
+}
+
 /** Add a socket to a scheduler.
+ *
+ *  Sockets are spread across the network threads in round-robin
+ *  order.  So a listener which adds N sockets in a row, where N is
+ *  no more than the number of network threads, gets each socket
+ *  serviced by a different thread.
  *
  * @param[in] sc the scheduler
  * @param[in] io the ctx and callbacks for the transport.
@@ -608,7 +942,8 @@ fr_network_t *fr_schedule_socket_add(fr_schedule_t *sc, fr_listen_t const *io)
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->rc;
+		nr = sc->sn[sc->next_network]->rc;
+		sc->next_network = (sc->next_network + 1) % sc->num_networks;
 	}
 
 	if (fr_network_socket_add(nr, io) < 0) return NULL;
@@ -633,7 +968,7 @@ fr_network_t *fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t const *io
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->rc;
+		nr = sc->sn[0]->rc;
 	}
 
 	if (fr_network_directory_add(nr, io) < 0) return NULL;
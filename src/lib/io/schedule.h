@@ -36,13 +36,29 @@ extern "C" {
 typedef struct fr_schedule_t fr_schedule_t;
 typedef int (*fr_schedule_thread_instantiate_t)(void *ctx, fr_event_list_t *el);
 
+/**
+ *  Where the threads run, and how they share work.  All fields are optional.
+ *
+ *  CPU lists are in the same format as /sys/devices/system/cpu/online,
+ *  e.g. "0-3,8,10-11".  Each thread is pinned to one CPU, which is
+ *  taken from the list in order.
+ */
+typedef struct fr_schedule_config_t {
+	char const	*network_cpus;		//!< CPUs for the network threads
+	char const	*worker_cpus;		//!< CPUs for the worker threads
+	bool		numa;			//!< networks only use workers on the same NUMA node
+	uint32_t	max_request_time;	//!< seconds a message can wait to be processed
+} fr_schedule_config_t;
+
 fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t *log, fr_log_lvl_t lvl,
-					    int max_inputs, int max_workers,
+					    int max_inputs, int max_workers, fr_schedule_config_t const *config,
 					    fr_schedule_thread_instantiate_t worker_thread_instantiate,
 					    void *worker_thread_ctx) CC_HINT(nonnull(3));
 /* schedulers are async, so there's no fr_schedule_run() */
 int			fr_schedule_destroy(fr_schedule_t *sc);
 
+int			fr_schedule_num_networks(fr_schedule_t const *sc) CC_HINT(nonnull);
+
 fr_network_t		*fr_schedule_socket_add(fr_schedule_t *sc, fr_listen_t const *io) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t const *io) CC_HINT(nonnull);
 #ifdef __cplusplus
@@ -0,0 +1,232 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Work-stealing deques.
+ * @file io/work_deque.c
+ *
+ *  A fixed-size Chase-Lev deque.  The owner pushes and pops at the
+ *  bottom without any atomic read-modify-write operations.  Other
+ *  threads steal from the top, and compete with each other (and with
+ *  the owner, for the last entry) via CAS.
+ *
+ *  The memory orderings are taken from "Correct and Efficient
+ *  Work-Stealing for Weak Memory Models", Lê et al, PPoPP 2013.
+ *
+ *  Unlike the paper, the deque doesn't grow.  When it's full, the
+ *  push fails, and the caller keeps the work for itself.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <stdint.h>
+#include <stdalign.h>
+#include <inttypes.h>
+
+#include <freeradius-devel/autoconf.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#include <freeradius-devel/io/work_deque.h>
+
+/*
+ *	Some macros to make our life easier.
+ */
+#define atomic_int64_t _Atomic(int64_t)
+
+#define cas_incr(_store, _var)    atomic_compare_exchange_strong_explicit(&_store, &_var, _var + 1, memory_order_seq_cst, memory_order_relaxed)
+#define load(_var)           atomic_load_explicit(&_var, memory_order_relaxed)
+#define aquire(_var)         atomic_load_explicit(&_var, memory_order_acquire)
+#define relaxed(_store, _var)  atomic_store_explicit(&_store, _var, memory_order_relaxed)
+
+struct fr_work_deque_t {
+	alignas(128) atomic_int64_t top;	//!< thieves take from here
+	alignas(128) atomic_int64_t bottom;	//!< the owner pushes and pops here
+
+	int64_t		mask;			//!< size - 1
+
+	_Atomic(void *)	entry[];
+};
+
+/** Create a fixed-size work-stealing deque
+ *
+ * @param[in] ctx	The talloc ctx to allocate the deque in.
+ * @param[in] size	The number of entries in the deque.  It is
+ *			rounded up to a power of 2.
+ * @return
+ *     - NULL on error.
+ *     - fr_work_deque_t *, a pointer to the allocated and initialized deque.
+ */
+fr_work_deque_t *fr_work_deque_create(TALLOC_CTX *ctx, int size)
+{
+	int i, entries;
+	fr_work_deque_t *wd;
+
+	if (size <= 0) return NULL;
+
+	for (entries = 1; entries < size; entries <<= 1) {
+		if (entries >= (1 << 24)) return NULL;
+	}
+
+	wd = talloc_size(ctx, sizeof(*wd) + entries * sizeof(wd->entry[0]));
+	if (!wd) return NULL;
+
+	talloc_set_name(wd, "fr_work_deque_t");
+
+	for (i = 0; i < entries; i++) {
+		atomic_init(&wd->entry[i], NULL);
+	}
+
+	wd->mask = entries - 1;
+
+	atomic_init(&wd->top, 0);
+	atomic_init(&wd->bottom, 0);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	return wd;
+}
+
+/** Push a pointer onto the bottom of the deque
+ *
+ *  May only be called by the owner of the deque.
+ *
+ * @param[in] wd	The deque to add data to.
+ * @param[in] data	to push.
+ * @return
+ *	- true on successful push
+ *	- false on deque full
+ */
+bool fr_work_deque_push(fr_work_deque_t *wd, void *data)
+{
+	int64_t top, bottom;
+
+	if (!data) return false;
+
+	bottom = load(wd->bottom);
+	top = aquire(wd->top);
+
+	if ((bottom - top) > wd->mask) return false;
+
+	relaxed(wd->entry[bottom & wd->mask], data);
+
+	/*
+	 *	The entry has to be visible before the new bottom is.
+	 */
+	atomic_thread_fence(memory_order_release);
+	relaxed(wd->bottom, bottom + 1);
+
+	return true;
+}
+
+/** Pop the most recently pushed pointer from the bottom of the deque
+ *
+ *  May only be called by the owner of the deque.
+ *
+ * @param[in] wd	the deque to retrieve data from.
+ * @param[out] p_data	where to write the data.
+ * @return
+ *	- true on successful pop
+ *	- false on deque empty
+ */
+bool fr_work_deque_pop(fr_work_deque_t *wd, void **p_data)
+{
+	int64_t top, bottom;
+	void *data;
+
+	bottom = load(wd->bottom) - 1;
+	relaxed(wd->bottom, bottom);
+
+	/*
+	 *	Thieves have to see the new bottom before we look at
+	 *	top, otherwise we may both take the last entry.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	top = load(wd->top);
+
+	if (top > bottom) {
+		relaxed(wd->bottom, bottom + 1);
+		return false;
+	}
+
+	data = load(wd->entry[bottom & wd->mask]);
+
+	/*
+	 *	This is the last entry.  Race any thieves for it.
+	 */
+	if (top == bottom) {
+		bool won;
+
+		won = cas_incr(wd->top, top);
+		relaxed(wd->bottom, bottom + 1);
+
+		if (!won) return false;
+	}
+
+	*p_data = data;
+	return true;
+}
+
+/** Steal the oldest pointer from the top of the deque
+ *
+ *  May be called by any thread.
+ *
+ * @param[in] wd	the deque to retrieve data from.
+ * @param[out] p_data	where to write the data.
+ * @return
+ *	- true on successful steal
+ *	- false on deque empty, or when another thread took the entry first.
+ */
+bool fr_work_deque_steal(fr_work_deque_t *wd, void **p_data)
+{
+	int64_t top, bottom;
+	void *data;
+
+	top = aquire(wd->top);
+	atomic_thread_fence(memory_order_seq_cst);
+	bottom = aquire(wd->bottom);
+
+	if (top >= bottom) return false;
+
+	data = load(wd->entry[top & wd->mask]);
+
+	if (!cas_incr(wd->top, top)) return false;
+
+	*p_data = data;
+	return true;
+}
+
+/** Return the approximate number of entries in the deque
+ *
+ *  The result may be stale by the time the caller looks at it.
+ */
+int fr_work_deque_size(fr_work_deque_t *wd)
+{
+	int64_t top, bottom;
+
+	top = aquire(wd->top);
+	bottom = aquire(wd->bottom);
+
+	if (bottom <= top) return 0;
+
+	return (int) (bottom - top);
+}
@@ -0,0 +1,52 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_WORK_DEQUE_H
+#define _FR_WORK_DEQUE_H
+/**
+ * $Id$
+ *
+ * @file io/work_deque.h
+ * @brief Work-stealing deques.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(work_deque_h, "$Id$")
+
+#include <talloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	Only the owner of the deque may push and pop.  Any thread
+ *	(including the owner) may steal.
+ */
+typedef struct fr_work_deque_t fr_work_deque_t;
+
+fr_work_deque_t		*fr_work_deque_create(TALLOC_CTX *ctx, int size);
+bool			fr_work_deque_push(fr_work_deque_t *wd, void *data);
+bool			fr_work_deque_pop(fr_work_deque_t *wd, void **p_data);
+bool			fr_work_deque_steal(fr_work_deque_t *wd, void **p_data);
+int			fr_work_deque_size(fr_work_deque_t *wd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FR_WORK_DEQUE_H */
@@ -57,6 +57,25 @@
  *  yeilded, it is placed onto the yielded list in the worker
  *  "tracking" data structure.
  *
+ *  When there are multiple workers, they may steal work from each
+ *  other.  A worker which has a backlog of messages moves the next
+ *  few of them from the "to_decode" heap to a work-stealing deque.
+ *  Idle workers take messages from the deques of their peers, and
+ *  process them as normal.  Only undecoded messages are stolen, so
+ *  a REQUEST is only ever touched by one thread.
+ *
+ *  Channels are single producer / single consumer, so a worker which
+ *  steals a message never writes to the original channel.  Instead,
+ *  it encodes the reply into a buffer, and sends that to the owner
+ *  of the channel via the owners control plane.  The owner then
+ *  sends the reply on the channel.
+ *
+ *  Duplicates always arrive on the owners channel.  So when the owner
+ *  offers a message which tracks duplicates, it remembers the message
+ *  in its "offered" tree until the result comes back.  Duplicates of
+ *  an offered message are discarded by the owner, as the worker which
+ *  took the original will reply to it.
+ *
  * @copyright 2016 Alan DeKok <aland@freeradius.org>
  */
 RCSID("$Id$")
@@ -65,6 +84,27 @@ RCSID("$Id$")
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/work_deque.h>
+#include <freeradius-devel/io/request_slab.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+/*
+ *	How many messages we make available for other workers to
+ *	steal.  The deque is larger, so that we can push without
+ *	checking for races with thieves.
+ */
+#define WORKER_OFFER_MAX	(16)
+#define WORKER_DEQUE_SIZE	(WORKER_OFFER_MAX * 2)
+
+/*
+ *	How many empty REQUEST pools we keep for reuse.
+ */
+#define WORKER_SLAB_MAX_FREE	(256)
 
 /**
  *  Track things by priority and time.
@@ -125,7 +165,8 @@ struct fr_worker_t {
 	int                     message_set_size; //!< default start number of messages
 	int                     ring_buffer_size; //!< default start size for the ring buffers
 
-	size_t			talloc_pool_size; //!< for each REQUEST
+	size_t			talloc_pool_size; //!< initial size of the pool for each REQUEST
+	fr_request_slab_t	*slab;		//!< REQUESTs and their pools
 
 	fr_time_t		checked_timeout; //!< when we last checked the tails of the queues
 
@@ -144,15 +185,66 @@ struct fr_worker_t {
 
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
-	bool			was_sleeping;	//!< used to suppress multiple sleep signals in a row
 	bool			exiting;	//!< are we exiting?
 
+	fr_time_t		max_request_time; //!< how long messages can wait in the work deque
 	fr_time_t		next_cleanup;	//!< when we next do the max_request_time checks
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
 
 	fr_channel_t		**channel;	//!< list of channels
+
+	fr_worker_group_t	*group;		//!< workers we share work with, if any
+	fr_work_deque_t		*stealable;	//!< messages which other workers may steal
+	rbtree_t		*offered;	//!< messages we offered which track duplicates
+	fr_ring_buffer_t	*rb;		//!< for control-plane messages we send to other workers
+	fr_dlist_t		stolen;		//!< replies to stolen requests which we couldn't send yet
+	int			next_peer;	//!< which peer we try to steal from first
+	int			num_stolen;	//!< number of messages we stole from other workers
+	atomic_bool		sleeping;	//!< whether we're waiting for events
+};
+
+/**
+ *  Workers which steal work from each other.
+ */
+struct fr_worker_group_t {
+	int			max_workers;	//!< size of the array
+	_Atomic(fr_worker_t *)	worker[];	//!< workers which have joined the group
 };
 
+/**
+ *  The result of processing a stolen message.  The thief sends this
+ *  to the owner of the channel, which sends the reply or NAK.
+ */
+typedef struct fr_worker_stolen_t {
+	fr_dlist_t		entry;		//!< in the thief's list of replies waiting to be sent
+	fr_worker_t		*owner;		//!< the worker which owns the channel
+
+	fr_channel_data_t	*cd;		//!< if set, NAK this message instead of sending a reply
+
+	fr_channel_t		*ch;		//!< the channel to send the reply on
+	fr_listen_t const	*listen;	//!< copied from the request
+	void			*packet_ctx;	//!< copied from the request
+
+	fr_time_t		when;		//!< when the request was done
+	fr_time_t		processing_time; //!< how long the request took
+	fr_time_t		request_time;	//!< when the request was received
+
+	size_t			size;		//!< zero for "no reply"
+	size_t			data_size;	//!< the encoded reply
+	uint8_t			data[];
+} fr_worker_stolen_t;
+
+/**
+ *  A message which tracks duplicates, and which we offered to other
+ *  workers.  Kept in the "offered" tree, which has the same key as
+ *  the "dedup" tree.
+ */
+typedef struct fr_worker_offered_t {
+	fr_listen_t const	*listen;	//!< from the message
+	void			*packet_ctx;	//!< from the message
+	fr_time_t		recv_time;	//!< when the message was received
+} fr_worker_offered_t;
+
 static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void *uctx);
 
 /*
@@ -222,19 +314,12 @@ static bool fr_worker_drain_input(fr_worker_t *worker, fr_channel_t *ch, fr_chan
 static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_size, fr_time_t now)
 {
 	int i;
-	bool ok, was_sleeping;
+	bool ok;
 	fr_channel_t *ch;
 	fr_message_set_t *ms;
 	fr_channel_event_t ce;
 	fr_worker_t *worker = ctx;
 
-	was_sleeping = worker->was_sleeping;
-	worker->was_sleeping = false;
-
-	/*
-	 *	We were woken up by a signal to do something.  We're
-	 *	not sleeping.
-	 */
 	ce = fr_channel_service_message(now, &ch, data, data_size);
 	switch (ce) {
 	case FR_CHANNEL_ERROR:
@@ -257,9 +342,7 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 	case FR_CHANNEL_DATA_READY_WORKER:
 		rad_assert(ch != NULL);
 		DEBUG3("\t--> data");
-		if (!fr_worker_drain_input(worker, ch, NULL)) {
-			worker->was_sleeping = was_sleeping;
-		}
+		(void) fr_worker_drain_input(worker, ch, NULL);
 		break;
 
 	case FR_CHANNEL_OPEN:
@@ -429,6 +512,440 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	if (cd) (void) fr_worker_drain_input(worker, ch, cd);
 }
 
+
+/**
+ *  Track an offered message in the "offered" tree
+ */
+static int worker_offered_cmp(void const *one, void const *two)
+{
+	int ret;
+	fr_worker_offered_t const *a = one, *b = two;
+
+	ret = (a->listen > b->listen) - (a->listen < b->listen);
+	if (ret) return ret;
+
+	return (a->packet_ctx > b->packet_ctx) - (a->packet_ctx < b->packet_ctx);
+}
+
+/** Find an offered message
+ *
+ * @param[in] worker the worker which offered the message
+ * @param[in] listen the message was received on
+ * @param[in] packet_ctx of the message
+ * @return
+ *	- NULL if we haven't offered a message with this key
+ *	- the offered message
+ */
+static fr_worker_offered_t *worker_offered_find(fr_worker_t *worker, fr_listen_t const *listen, void *packet_ctx)
+{
+	fr_worker_offered_t my_offered;
+
+	if (!worker->offered) return NULL;
+
+	my_offered.listen = listen;
+	my_offered.packet_ctx = packet_ctx;
+
+	return rbtree_finddata(worker->offered, &my_offered);
+}
+
+/** Forget an offered message, because it has been taken back, or the result has arrived
+ *
+ * @param[in] worker the worker which offered the message
+ * @param[in] listen the message was received on
+ * @param[in] packet_ctx of the message
+ * @param[in] recv_time of the message
+ * @return
+ *	- false if a newer packet has replaced the message
+ *	- true if the message was still current
+ */
+static bool worker_offered_done(fr_worker_t *worker, fr_listen_t const *listen, void *packet_ctx, fr_time_t recv_time)
+{
+	fr_worker_offered_t *offered;
+
+	offered = worker_offered_find(worker, listen, packet_ctx);
+	if (!offered || (offered->recv_time != recv_time)) return false;
+
+	(void) rbtree_deletebydata(worker->offered, offered);
+	talloc_free(offered);
+
+	return true;
+}
+
+/** Check if we're processing, or have offered, a message with the same key
+ *
+ *  Duplicates of those messages have to stay with us, so that they
+ *  can be checked against the original.
+ *
+ * @param[in] worker the worker
+ * @param[in] cd the message
+ */
+static bool worker_has_original(fr_worker_t *worker, fr_channel_data_t const *cd)
+{
+	REQUEST		my_request;
+	fr_async_t	my_async;
+
+	if (worker_offered_find(worker, cd->listen, cd->packet_ctx)) return true;
+
+	my_async.listen = cd->listen;
+	my_async.packet_ctx = cd->packet_ctx;
+	my_request.async = &my_async;
+
+	return (rbtree_finddata(worker->dedup, &my_request) != NULL);
+}
+
+/** Send the result of a stolen message to the worker which owns the channel
+ *
+ *  If the owners control plane is full, the result is kept, and
+ *  we try again later.
+ *
+ * @param[in] worker the worker which stole the message
+ * @param[in] stolen the result to send
+ */
+static void worker_stolen_send(fr_worker_t *worker, fr_worker_stolen_t *stolen)
+{
+	fr_control_t *control = stolen->owner->control;
+
+	/*
+	 *	Once the message is pushed, the owner can free it at
+	 *	any time.  So we can't touch it after that.
+	 */
+	if (fr_control_message_push(control, worker->rb, FR_CONTROL_ID_PEER, &stolen, sizeof(stolen)) < 0) {
+		DEBUG2("	%sfails sending reply to owner of channel, will retry", worker->name);
+		fr_dlist_insert_tail(&worker->stolen, &stolen->entry);
+		return;
+	}
+
+	(void) fr_control_signal(control);
+}
+
+
+/** Retry sending results of stolen messages
+ *
+ * @param[in] worker the worker which stole the messages
+ */
+static void worker_stolen_flush(fr_worker_t *worker)
+{
+	fr_dlist_t *entry;
+
+	while ((entry = FR_DLIST_FIRST(worker->stolen)) != NULL) {
+		fr_control_t *control;
+		fr_worker_stolen_t *stolen;
+
+		stolen = fr_ptr_to_type(fr_worker_stolen_t, entry, entry);
+		control = stolen->owner->control;
+
+		fr_dlist_remove(entry);
+		if (fr_control_message_push(control, worker->rb, FR_CONTROL_ID_PEER, &stolen, sizeof(stolen)) < 0) {
+			fr_dlist_insert_head(&worker->stolen, entry);
+			break;
+		}
+
+		(void) fr_control_signal(control);
+	}
+}
+
+
+/** NAK a message, which may have been stolen from another worker
+ *
+ * @param[in] worker the worker
+ * @param[in] owner the worker which owns the channel, or NULL for "us"
+ * @param[in] cd the message to NAK
+ * @param[in] now when the message is NAKd
+ */
+static void worker_nak(fr_worker_t *worker, fr_worker_t *owner, fr_channel_data_t *cd, fr_time_t now)
+{
+	fr_worker_stolen_t *stolen;
+
+	if (!owner) {
+		fr_worker_nak(worker, cd, now);
+		return;
+	}
+
+	stolen = talloc_zero(NULL, fr_worker_stolen_t);
+	if (!stolen) {
+		ERROR("Failed allocating memory for NAK");
+		fr_message_done(&cd->m);
+		return;
+	}
+
+	stolen->owner = owner;
+	stolen->cd = cd;
+	stolen->ch = cd->channel.ch;
+
+	worker->num_timeouts++;
+
+	worker_stolen_send(worker, stolen);
+}
+
+
+/** Handle a control message from another worker
+ *
+ *  The message is either the result of a request which the other
+ *  worker stole from us, or NULL, which means that there is work to
+ *  steal.
+ *
+ * @param[in] ctx the worker
+ * @param[in] data the message
+ * @param[in] data_size size of the data
+ * @param[in] now the current time
+ */
+static void fr_worker_peer_callback(void *ctx, void const *data, size_t data_size, fr_time_t now)
+{
+	int i;
+	fr_worker_t *worker = ctx;
+	fr_worker_stolen_t *stolen;
+	fr_channel_data_t *reply, *cd;
+	fr_channel_t *ch;
+	fr_message_set_t *ms;
+
+	rad_assert(data_size == sizeof(stolen));
+	memcpy(&stolen, data, sizeof(stolen));
+
+	if (!stolen) {
+		DEBUG3("	--> work to steal");
+		return;
+	}
+
+	(void) talloc_get_type_abort(stolen, fr_worker_stolen_t);
+	rad_assert(stolen->owner == worker);
+
+	/*
+	 *	A newer packet has replaced the one which was stolen.
+	 *	The result is stale, so we discard it, the same as
+	 *	when we stop a request which we're processing.
+	 */
+	if (stolen->cd && stolen->cd->listen->app_io->track_duplicates &&
+	    !worker_offered_done(worker, stolen->cd->listen, stolen->cd->packet_ctx,
+				 *stolen->cd->request.recv_time)) {
+		DEBUG2("	%sdiscarding NAK for replaced message", worker->name);
+		fr_message_done(&stolen->cd->m);
+		talloc_free(stolen);
+		return;
+	}
+
+	if (!stolen->cd && stolen->listen->app_io->track_duplicates &&
+	    !worker_offered_done(worker, stolen->listen, stolen->packet_ctx, stolen->request_time)) {
+		DEBUG2("	%sdiscarding stolen reply for replaced message", worker->name);
+		talloc_free(stolen);
+		return;
+	}
+
+	/*
+	 *	The channel may have been closed while the other
+	 *	worker was running the request.
+	 */
+	ch = stolen->ch;
+	for (i = 0; i < worker->max_channels; i++) {
+		if (worker->channel[i] == ch) break;
+	}
+
+	if (i == worker->max_channels) {
+		DEBUG2("	%sdiscarding stolen reply for closed channel", worker->name);
+		talloc_free(stolen);
+		return;
+	}
+
+	if (stolen->cd) {
+		fr_worker_nak(worker, stolen->cd, now);
+		talloc_free(stolen);
+		return;
+	}
+
+	ms = fr_channel_worker_ctx_get(ch);
+	rad_assert(ms != NULL);
+
+	reply = (fr_channel_data_t *) fr_message_reserve(ms, stolen->size);
+	rad_assert(reply != NULL);
+
+	if (stolen->size) {
+		rad_assert(stolen->data_size <= reply->m.rb_size);
+		memcpy(reply->m.data, stolen->data, stolen->data_size);
+
+		cd = (fr_channel_data_t *) fr_message_alloc(ms, &reply->m, stolen->data_size);
+		rad_assert(cd == reply);
+	}
+
+	reply->m.when = stolen->when;
+	reply->reply.cpu_time = worker->tracking.running;
+	reply->reply.processing_time = stolen->processing_time;
+	reply->reply.request_time = stolen->request_time;
+
+	reply->listen = stolen->listen;
+	reply->packet_ctx = stolen->packet_ctx;
+
+	talloc_free(stolen);
+
+	/*
+	 *	Send the reply, which also polls the request queue.
+	 */
+	if (fr_channel_send_reply(ch, reply, &cd) < 0) {
+		DEBUG2("	%sfails sending reply", worker->name);
+		cd = NULL;
+	}
+
+	worker->num_replies++;
+
+	if (cd) (void) fr_worker_drain_input(worker, ch, cd);
+}
+
+
+/** Wake up one sleeping worker, so that it can steal work from us
+ *
+ * @param[in] worker the worker which has work to steal
+ */
+static void worker_wake_peer(fr_worker_t *worker)
+{
+	int i, j;
+	void *wake = NULL;
+	fr_worker_group_t *wg = worker->group;
+
+	/*
+	 *	The new deque entries have to be visible before we
+	 *	look at the "sleeping" flags.  See fr_worker_pre_event().
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	for (i = 0; i < wg->max_workers; i++) {
+		fr_worker_t *peer;
+
+		j = (worker->next_peer + i) % wg->max_workers;
+
+		peer = atomic_load_explicit(&wg->worker[j], memory_order_acquire);
+		if (!peer || (peer == worker)) continue;
+
+		if (!atomic_exchange(&peer->sleeping, false)) continue;
+
+		DEBUG3("	%swaking up idle worker %s", worker->name, peer->name);
+		(void) fr_control_message_send(peer->control, worker->rb, FR_CONTROL_ID_PEER, &wake, sizeof(wake));
+		return;
+	}
+}
+
+
+/** Make some of our backlog available to other workers
+ *
+ *  The messages are taken from the front of the "to_decode" heap, so
+ *  the deque holds the next messages which we would process.
+ *  Duplicates of messages which we're processing, or have already
+ *  offered, are kept here.
+ *
+ * @param[in] worker the worker
+ */
+static void worker_offer(fr_worker_t *worker)
+{
+	int i, offered = 0, num_kept = 0;
+	fr_channel_data_t *cd, *kept[WORKER_OFFER_MAX];
+
+	/*
+	 *	We only offer work if we have more than we're about to
+	 *	do ourselves.
+	 */
+	if ((fr_heap_num_elements(worker->to_decode.heap) + fr_work_deque_size(worker->stealable)) < 2) return;
+
+	while ((fr_work_deque_size(worker->stealable) < WORKER_OFFER_MAX) && (num_kept < WORKER_OFFER_MAX)) {
+		fr_worker_offered_t *wo = NULL;
+
+		WORKER_HEAP_POP(to_decode, cd, request.list);
+		if (!cd) break;
+
+		/*
+		 *	Duplicates arrive on our channel.  We remember
+		 *	the message, so that we can recognize them
+		 *	after another worker takes it.
+		 */
+		if (cd->listen->app_io->track_duplicates) {
+			if (worker_has_original(worker, cd)) {
+				kept[num_kept++] = cd;
+				continue;
+			}
+
+			wo = talloc(worker->offered, fr_worker_offered_t);
+			if (!wo) {
+				WORKER_HEAP_INSERT(to_decode, cd, request.list);
+				break;
+			}
+
+			wo->listen = cd->listen;
+			wo->packet_ctx = cd->packet_ctx;
+			wo->recv_time = *cd->request.recv_time;
+			(void) rbtree_insert(worker->offered, wo);
+		}
+
+		if (!fr_work_deque_push(worker->stealable, cd)) {
+			if (wo) {
+				(void) rbtree_deletebydata(worker->offered, wo);
+				talloc_free(wo);
+			}
+			WORKER_HEAP_INSERT(to_decode, cd, request.list);
+			break;
+		}
+
+		offered++;
+	}
+
+	for (i = 0; i < num_kept; i++) WORKER_HEAP_INSERT(to_decode, kept[i], request.list);
+
+	if (offered) worker_wake_peer(worker);
+}
+
+
+/** Steal a message from another worker
+ *
+ * @param[in] worker the worker
+ * @param[out] p_owner the worker which owns the channel for the message
+ * @return
+ *	- NULL on nothing to steal
+ *	- the stolen message
+ */
+static fr_channel_data_t *worker_steal(fr_worker_t *worker, fr_worker_t **p_owner)
+{
+	int i, j;
+	fr_worker_group_t *wg = worker->group;
+
+	for (i = 0; i < wg->max_workers; i++) {
+		void *data;
+		fr_worker_t *peer;
+
+		j = (worker->next_peer + i) % wg->max_workers;
+
+		peer = atomic_load_explicit(&wg->worker[j], memory_order_acquire);
+		if (!peer || (peer == worker)) continue;
+
+		if (!fr_work_deque_steal(peer->stealable, &data)) continue;
+
+		DEBUG3("	%sstole message from %s", worker->name, peer->name);
+
+		worker->next_peer = (j + 1) % wg->max_workers;
+		worker->num_stolen++;
+		*p_owner = peer;
+		return data;
+	}
+
+	return NULL;
+}
+
+
+/** Check if any worker in the group has work to steal
+ *
+ * @param[in] worker the worker
+ */
+static bool worker_group_has_work(fr_worker_t *worker)
+{
+	int i;
+	fr_worker_group_t *wg = worker->group;
+
+	for (i = 0; i < wg->max_workers; i++) {
+		fr_worker_t *peer;
+
+		peer = atomic_load_explicit(&wg->worker[i], memory_order_acquire);
+		if (!peer) continue;
+
+		if (fr_work_deque_size(peer->stealable) > 0) return true;
+	}
+
+	return false;
+}
+
 static void worker_reset_timer(fr_worker_t *worker);
 
 
@@ -442,9 +959,12 @@ static void worker_reset_timer(fr_worker_t *worker);
  */
 static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t size)
 {
-	fr_channel_data_t *reply, *cd;
+	fr_channel_data_t *reply = NULL, *cd;
 	fr_channel_t *ch;
 	fr_message_set_t *ms;
+	fr_worker_stolen_t *stolen = NULL;
+	uint8_t *data;
+	size_t data_size;
 
 	/*
 	 *	If we're sending a reply, then it's no longer runnable.
@@ -458,7 +978,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	if (request->async->detached) {
 		fr_time_tracking_end(&request->async->tracking, fr_time(), &worker->tracking);
 		RDEBUG("finished request.");
-		talloc_free(request);
+		fr_request_slab_free(worker->slab, request);
 		return;
 	}
 
@@ -468,11 +988,30 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	ch = request->async->channel;
 	rad_assert(ch != NULL);
 
-	ms = fr_channel_worker_ctx_get(ch);
-	rad_assert(ms != NULL);
+	/*
+	 *	We stole the request from another worker.  Encode the
+	 *	reply into our own buffer, and the owner of the
+	 *	channel will send it.
+	 */
+	if (request->async->owner) {
+		stolen = talloc_zero_size(NULL, sizeof(*stolen) + size);
+		rad_assert(stolen != NULL);
+		talloc_set_name_const(stolen, "fr_worker_stolen_t");
 
-	reply = (fr_channel_data_t *) fr_message_reserve(ms, size);
-	rad_assert(reply != NULL);
+		data = stolen->data;
+		data_size = size;
+		ms = NULL;
+
+	} else {
+		ms = fr_channel_worker_ctx_get(ch);
+		rad_assert(ms != NULL);
+
+		reply = (fr_channel_data_t *) fr_message_reserve(ms, size);
+		rad_assert(reply != NULL);
+
+		data = reply->m.data;
+		data_size = reply->m.rb_size;
+	}
 
 	/*
 	 *	Encode it, if required.
@@ -483,10 +1022,10 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 
 		if (listen->app->encode) {
 			slen = listen->app->encode(listen->app_instance, request,
-						   reply->m.data, reply->m.rb_size);
+						   data, data_size);
 		} else if (listen->app_io->encode) {
 			slen = listen->app_io->encode(listen->app_io_instance, request,
-						      reply->m.data, reply->m.rb_size);
+						      data, data_size);
 		}
 		if (slen < 0) {
 			DEBUG2("\t%sfails encode", worker->name);
@@ -497,8 +1036,12 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 		/*
 		 *	Resize the buffer to the actual packet size.
 		 */
-		cd = (fr_channel_data_t *) fr_message_alloc(ms, &reply->m, slen);
-		rad_assert(cd == reply);
+		if (stolen) {
+			stolen->data_size = slen;
+		} else {
+			cd = (fr_channel_data_t *) fr_message_alloc(ms, &reply->m, slen);
+			rad_assert(cd == reply);
+		}
 	}
 
 	/*
@@ -508,6 +1051,23 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	rad_assert(worker->num_active > 0);
 	worker->num_active--;
 
+	if (stolen) {
+		stolen->owner = request->async->owner;
+		stolen->ch = ch;
+		stolen->listen = request->async->listen;
+		stolen->packet_ctx = request->async->packet_ctx;
+		stolen->when = request->async->tracking.when;
+		stolen->processing_time = request->async->tracking.running;
+		stolen->request_time = request->async->recv_time;
+		stolen->size = size;
+
+		RDEBUG("finished stolen request.");
+
+		worker_stolen_send(worker, stolen);
+		worker->num_replies++;
+		goto done;
+	}
+
 	/*
 	 *	Fill in the rest of the fields in the channel message.
 	 *
@@ -539,10 +1099,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	 */
 	if (cd) (void) fr_worker_drain_input(worker, ch, cd);
 
-	/*
-	 *	@todo Use a talloc pool for the request.  Clean it up,
-	 *	and insert it back into a slab allocator.
-	 */
+done:
 	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
 	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
 
@@ -556,7 +1113,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	request->async->listen = NULL;
 #endif
 
-	talloc_free(request);
+	fr_request_slab_free(worker->slab, request);
 
 	if (!worker->num_active) worker_reset_timer(worker);
 }
@@ -577,7 +1134,7 @@ static void worker_stop_request(fr_worker_t *worker, REQUEST *request, fr_time_t
 	 */
 	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
 	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
-	(void) rbtree_deletebydata(worker->dedup, request);
+	if (!request->async->owner) (void) rbtree_deletebydata(worker->dedup, request);
 
 #ifndef NDEBUG
 	request->async->process = NULL;
@@ -762,12 +1319,11 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 {
 	int			ret = -1;
+	bool			from_deque = false;
 	fr_channel_data_t	*cd;
 	REQUEST			*request;
 	fr_listen_t const	*listen;
-#ifndef HAVE_TALLOC_POOLED_OBJECT
-	TALLOC_CTX		*ctx;
-#endif
+	fr_worker_t		*owner = NULL;
 
 	/*
 	 *	Grab a runnable request, and resume it.
@@ -786,15 +1342,53 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	 */
 	do {
 		WORKER_HEAP_POP(localized, cd, request.list);
+
+		/*
+		 *	Our deque holds the messages from the front
+		 *	of the "to_decode" heap, so they go first.
+		 *	If there's nothing there, try to steal work
+		 *	from another worker.
+		 */
+		if (!cd && worker->group) {
+			void *data;
+
+			worker_offer(worker);
+			if (fr_work_deque_steal(worker->stealable, &data)) {
+				cd = data;
+				from_deque = true;
+
+				if (cd->listen->app_io->track_duplicates) {
+					(void) worker_offered_done(worker, cd->listen, cd->packet_ctx,
+								   *cd->request.recv_time);
+				}
+			}
+		}
 		if (!cd) {
 			WORKER_HEAP_POP(to_decode, cd, request.list);
 		}
+		if (!cd && worker->group) {
+			cd = worker_steal(worker, &owner);
+			if (cd) from_deque = true;
+		}
 		if (!cd) return NULL;
 
 		worker->num_decoded++;
 	} while (!cd);
 
-	ctx = request = request_alloc(NULL);
+	/*
+	 *	Messages in a deque aren't seen by
+	 *	fr_worker_check_timeouts(), so we check them here.
+	 */
+	if (from_deque && ((now - cd->m.when) > worker->max_request_time)) {
+		DEBUG3("TIMEOUT: Message from work deque is too old");
+		goto nak;
+	}
+
+	/*
+	 *	The request, its packets, and everything decoded into
+	 *	them come from a pool which is reused.
+	 */
+	request = fr_request_slab_alloc(worker->slab);
 	if (!request) goto nak;
 
 	request->el = worker->el;
@@ -824,6 +1418,7 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	 *	processing this message.
 	 */
 	request->async->channel = cd->channel.ch;
+	request->async->owner = owner;
 
 	request->async->original_recv_time = cd->request.recv_time;
 	request->async->recv_time = *request->async->original_recv_time;
@@ -848,9 +1443,9 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 
 	if (ret < 0) {
 		RDEBUG("\t%s FAILED decoding packet", worker->name);
-		talloc_free(ctx);
+		fr_request_slab_free(worker->slab, request);
 nak:
-		fr_worker_nak(worker, cd, now);
+		worker_nak(worker, owner, cd, now);
 		return NULL;
 	}
 
@@ -862,7 +1457,7 @@ nak:
 
 	if (!request->async->process) {
 		ERROR("Protocol failed to set 'process' function");
-		fr_worker_nak(worker, cd, now);
+		worker_nak(worker, owner, cd, now);
 		return NULL;
 	}
 
@@ -873,13 +1468,39 @@ nak:
 
 	/*
 	 *	Look for conflicting / duplicate packets, but only if
-	 *	requested to do so.
+	 *	requested to do so.  Duplicates arrive on the owners
+	 *	channel, so stolen requests aren't tracked here.  The
+	 *	owner checks them against its "offered" tree instead.
 	 */
-	if (request->async->listen->app_io->track_duplicates) {
+	if (!owner && request->async->listen->app_io->track_duplicates) {
 		REQUEST *old;
+		fr_worker_offered_t *wo;
 
 		old = rbtree_finddata(worker->dedup, request);
-		if (!old) goto insert_new;
+		if (!old) {
+			wo = worker_offered_find(worker, request->async->listen, request->async->packet_ctx);
+			if (!wo) goto insert_new;
+
+			/*
+			 *	Another worker took the original.  It
+			 *	will reply, so we eat the duplicate.
+			 */
+			if (wo->recv_time == request->async->recv_time) {
+				RDEBUG("received duplicate of request taken by another worker.");
+				fr_channel_null_reply(request->async->channel);
+				fr_request_slab_free(worker->slab, request);
+				return NULL;
+			}
+
+			/*
+			 *	A new packet replaces the one which the
+			 *	other worker took.  Its result will be
+			 *	discarded when it arrives.
+			 */
+			(void) rbtree_deletebydata(worker->offered, wo);
+			talloc_free(wo);
+			goto insert_new;
+		}
 
 		rad_assert(old->async->listen == request->async->listen);
 		rad_assert(old->async->channel == request->async->channel);
@@ -903,7 +1524,7 @@ nak:
 		 */
 		if (old->async->recv_time == request->async->recv_time) {
 			fr_channel_null_reply(request->async->channel);
-			talloc_free(request);
+			fr_request_slab_free(worker->slab, request);
 
 			/*
 			 *	Signal there's a dup, and ignore the
@@ -1032,7 +1653,7 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 
 	RDEBUG("done request");
 
-	(void) rbtree_deletebydata(worker->dedup, request);
+	if (!request->async->owner) (void) rbtree_deletebydata(worker->dedup, request);
 
 	fr_worker_send_reply(worker, request, size);
 }
@@ -1071,15 +1692,31 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->localized.heap) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->to_decode.heap) == 0);
 
+	/*
+	 *	Check if we can steal work from another worker.  The
+	 *	flag is set BEFORE we look at the deques, so that a
+	 *	worker which adds work after we look will see that
+	 *	we're sleeping, and wake us up.
+	 */
+	if (sleeping && worker->group) {
+		sleeping = (FR_DLIST_FIRST(worker->stolen) == NULL);
+
+		if (sleeping) {
+			atomic_store(&worker->sleeping, true);
+
+			if (worker_group_has_work(worker)) {
+				atomic_store(&worker->sleeping, false);
+				sleeping = false;
+			}
+		}
+	}
+
 	/*
 	 *	Tell the event loop that there is new work to do.  We
 	 *	don't want to wait for events, but instead check them,
 	 *	and start processing packets immediately.
 	 */
-	if (!sleeping) {
-		worker->was_sleeping = false;
-		return 1;
-	}
+	if (!sleeping) return 1;
 
 	DEBUG3("\t%ssleeping running %zd, localized %zd, to_decode %zd",
 	       worker->name,
@@ -1090,28 +1727,18 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	       worker->name, worker->num_requests, worker->num_decoded,
 	       worker->num_replies, worker->num_active);
 
-	/*
-	 *	We were sleeping, don't send another signal that we
-	 *	are still sleeping.
-	 */
-	if (worker->was_sleeping) {
-		DEBUG3("\tworker was sleeping, not re-signaling");
-		return 0;
-	}
-
 	/*
 	 *	Nothing more to do, and the event loop has us sleeping
 	 *	for a period of time.  Signal the producers that we're
 	 *	sleeping.  The fr_channel_worker_sleeping() function
-	 *	will take care of skipping the signal if there are no
-	 *	outstanding requests for it.
+	 *	will take care of skipping the signal if the producer
+	 *	already knows that we're sleeping.
 	 */
 	for (i = 0; i < worker->max_channels; i++) {
 		if (!worker->channel[i]) continue;
 
 		(void) fr_channel_worker_sleeping(worker->channel[i]);
 	}
-	worker->was_sleeping = true;
 
 	return 0;
 }
@@ -1199,6 +1826,15 @@ void fr_worker_destroy(fr_worker_t *worker)
 		fr_message_done(&cd->m);
 	}
 
+	if (worker->stealable) {
+		void *data;
+
+		while (fr_work_deque_pop(worker->stealable, &data)) {
+			cd = data;
+			fr_message_done(&cd->m);
+		}
+	}
+
 	/*
 	 *	Destroy all of the active requests.  These are ones
 	 *	which are still waiting for timers or file descriptor
@@ -1207,7 +1843,7 @@ void fr_worker_destroy(fr_worker_t *worker)
 	while ((request = fr_heap_peek(worker->time_order)) != NULL) {
 		RDEBUG("server is exiting - telling request to stop.");
 		worker_stop_request(worker, request, now);
-		talloc_free(request);
+		fr_request_slab_free(worker->slab, request);
 	}
 	talloc_free(worker->time_order);
 
@@ -1272,6 +1908,9 @@ nomem:
 	worker->log = logger;
 	worker->lvl = lvl;
 
+	FR_DLIST_INIT(worker->stolen);
+	atomic_init(&worker->sleeping, false);
+
 	/*
 	 *	@todo make these configurable
 	 */
@@ -1279,6 +1918,7 @@ nomem:
 	worker->talloc_pool_size = 4096; /* at least enough for a REQUEST */
 	worker->message_set_size = 1024;
 	worker->ring_buffer_size = (1 << 16);
+	worker->max_request_time = NANOSEC;
 
 	if (fr_event_pre_insert(worker->el, fr_worker_pre_event, worker) < 0) {
 		fr_strerror_printf("Failed adding pre-check to event list");
@@ -1345,6 +1985,18 @@ nomem:
 		goto fail;
 	}
 
+	worker->slab = fr_request_slab_create(worker, worker->talloc_pool_size, WORKER_SLAB_MAX_FREE);
+	if (!worker->slab) {
+		fr_strerror_printf("Failed creating request slab");
+		goto fail;
+	}
+
+	/*
+	 *	Measuring requests walks all of their memory when
+	 *	they're freed, so only do it when debugging.
+	 */
+	if (worker->lvl >= L_DBG_LVL_3) fr_request_slab_measure(worker->slab, true);
+
 	if (fr_event_post_insert(worker->el, fr_worker_post_event, worker) < 0) {
 		fr_strerror_printf("Failed inserting post-processing event");
 		talloc_free(worker->runnable);
@@ -1403,6 +2055,11 @@ static void fr_worker_post_event(UNUSED fr_event_list_t *el, UNUSED struct timev
 
 	now = fr_time();
 
+	if (worker->group) {
+		atomic_store_explicit(&worker->sleeping, false, memory_order_relaxed);
+		worker_stolen_flush(worker);
+	}
+
 	/*
 	 *      Ten times a second, check for timeouts on incoming packets.
 	 *
@@ -1488,15 +2145,23 @@ void fr_worker(fr_worker_t *worker)
  */
 void fr_worker_debug(fr_worker_t *worker, FILE *fp)
 {
+	fr_request_slab_stats_t stats;
+
 	WORKER_VERIFY;
 
 	fprintf(fp, "\tkq = %d\n", worker->kq);
 	fprintf(fp, "\tnum_channels = %d\n", worker->num_channels);
 	fprintf(fp, "\tnum_requests = %d\n", worker->num_requests);
+	if (worker->group) fprintf(fp, "\tnum_stolen = %d\n", worker->num_stolen);
 
 	fprintf(fp, "\tcalculated (predicted) total CPU time = %zd\n", worker->tracking.predicted * worker->num_requests);
 	fprintf(fp, "\tcalculated (counted) per request time = %zd\n", worker->tracking.running / worker->num_requests);
 
+	fr_request_slab_stats(&stats, worker->slab);
+	fprintf(fp, "\trequest pool size = %zu\n", stats.pool_size);
+	fprintf(fp, "\trequest pools reused = %" PRIu64 " of %" PRIu64 "\n", stats.reused, stats.alloced);
+	fprintf(fp, "\trequest pool overflows = %" PRIu64 "\n", stats.overflows);
+
 	fr_time_tracking_debug(&worker->tracking, fp);
 
 }
@@ -1548,6 +2213,122 @@ void fr_worker_name(fr_worker_t *worker, char const *name)
 }
 
 
+/** Set how long messages can wait to be processed
+ *
+ *  Messages which have waited longer in the work deque are discarded,
+ *  rather than being processed by this worker, or stolen by another.
+ *
+ * @param[in] worker the worker
+ * @param[in] max_request_time in nanoseconds.
+ */
+void fr_worker_max_request_time_set(fr_worker_t *worker, fr_time_t max_request_time)
+{
+	WORKER_VERIFY;
+
+	worker->max_request_time = max_request_time;
+}
+
+
+/** Create a group of workers which steal work from each other
+ *
+ *  The group must not be freed until all of the workers in it have
+ *  stopped running.
+ *
+ * @param[in] ctx the talloc context
+ * @param[in] max_workers the maximum number of workers in the group
+ * @return
+ *	- NULL on error
+ *	- fr_worker_group_t on success
+ */
+fr_worker_group_t *fr_worker_group_create(TALLOC_CTX *ctx, int max_workers)
+{
+	int i;
+	fr_worker_group_t *wg;
+
+	if (max_workers <= 0) {
+		fr_strerror_printf("Invalid number of workers");
+		return NULL;
+	}
+
+	wg = talloc_zero_size(ctx, sizeof(*wg) + max_workers * sizeof(wg->worker[0]));
+	if (!wg) {
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+	talloc_set_name_const(wg, "fr_worker_group_t");
+
+	wg->max_workers = max_workers;
+	for (i = 0; i < max_workers; i++) {
+		atomic_init(&wg->worker[i], NULL);
+	}
+
+	return wg;
+}
+
+
+/** Add a worker to a group
+ *
+ *  Called from the worker thread, before fr_worker() is run.  Once
+ *  the worker has joined, other workers may steal messages from it,
+ *  and it may steal messages from them.
+ *
+ * @param[in] wg the group
+ * @param[in] worker the worker
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_worker_group_join(fr_worker_group_t *wg, fr_worker_t *worker)
+{
+	int i;
+
+	WORKER_VERIFY;
+
+	rad_assert(worker->group == NULL);
+
+	worker->stealable = fr_work_deque_create(worker, WORKER_DEQUE_SIZE);
+	if (!worker->stealable) {
+		fr_strerror_printf("Failed creating work deque");
+		return -1;
+	}
+
+	worker->offered = rbtree_create(worker, worker_offered_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!worker->offered) {
+		fr_strerror_printf("Failed creating offered tree");
+		return -1;
+	}
+
+	worker->rb = fr_ring_buffer_create(worker, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
+	if (!worker->rb) {
+		fr_strerror_printf("Failed creating ring buffer: %s", fr_strerror());
+		return -1;
+	}
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_PEER, worker, fr_worker_peer_callback) < 0) {
+		fr_strerror_printf("Failed adding control channel: %s", fr_strerror());
+		return -1;
+	}
+
+	/*
+	 *	Publish the worker.  Everything the other workers
+	 *	look at has to be initialized before this.
+	 */
+	for (i = 0; i < wg->max_workers; i++) {
+		fr_worker_t *empty = NULL;
+
+		if (!atomic_compare_exchange_strong(&wg->worker[i], &empty, worker)) continue;
+
+		worker->group = wg;
+		worker->next_peer = (i + 1) % wg->max_workers;
+		return 0;
+	}
+
+	(void) fr_control_callback_delete(worker->control, FR_CONTROL_ID_PEER);
+	fr_strerror_printf("Too many workers in group");
+	return -1;
+}
+
+
 #ifndef NDEBUG
 /** Verify the worker data structures.
  *
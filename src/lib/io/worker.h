@@ -44,6 +44,11 @@ extern "C" {
  */
 typedef struct fr_worker_t fr_worker_t;
 
+/**
+ *  Workers which steal work from each other.
+ */
+typedef struct fr_worker_group_t fr_worker_group_t;
+
 fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t const *logger, fr_log_lvl_t lvl) CC_HINT(nonnull(2,3));
 void fr_worker_destroy(fr_worker_t *worker) CC_HINT(nonnull);
 int fr_worker_kq(fr_worker_t *worker) CC_HINT(nonnull);
@@ -52,8 +57,12 @@ void fr_worker(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker_exit(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker_debug(fr_worker_t *worker, FILE *fp) CC_HINT(nonnull);
 void fr_worker_name(fr_worker_t *worker, char const *name) CC_HINT(nonnull);
+void fr_worker_max_request_time_set(fr_worker_t *worker, fr_time_t max_request_time) CC_HINT(nonnull);
 fr_channel_t *fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_control_t *master) CC_HINT(nonnull);
 
+fr_worker_group_t *fr_worker_group_create(TALLOC_CTX *ctx, int max_workers);
+int fr_worker_group_join(fr_worker_group_t *wg, fr_worker_t *worker) CC_HINT(nonnull);
+
 #ifdef __cplusplus
 }
 #endif
@@ -150,6 +150,8 @@ static int fr_ldap_rebind(LDAP *handle, LDAP_CONST char *url,
  */
 static int fr_ldap_connection_reset(fr_ldap_connection_t *c)
 {
+	fr_ldap_mux_clear(c);		/* Fail any operations still waiting for results */
+
 	talloc_free_children(c);	/* Force inverted free order */
 
 	fr_ldap_control_clear(c);
@@ -449,6 +451,7 @@ fr_ldap_connection_t *fr_ldap_connection_alloc(TALLOC_CTX *ctx)
 	 */
 	c = talloc_zero(ctx, fr_ldap_connection_t);
 	if (!c) return NULL;
+	c->fd = -1;
 
 	talloc_set_destructor(c, fr_ldap_connection_reset);
 
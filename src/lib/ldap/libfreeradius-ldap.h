@@ -300,6 +300,10 @@ typedef struct fr_ldap_connection {
 
 	fr_ldap_state_t		state;			//!< LDAP connection state machine.
 
+	fr_event_list_t		*el;			//!< Results are being read in, if muxed.
+	int			fd;			//!< libldap's file descriptor, if muxed.
+	rbtree_t		*queries;		//!< Outstanding asynchronous operations, by msgid.
+
 	void			*uctx;			//!< User data associated with the handle.
 } fr_ldap_connection_t;
 
@@ -534,6 +538,40 @@ int		fr_ldap_bind_async(fr_ldap_connection_t *c,
 				   LDAPControl **serverctrls, LDAPControl **clientctrls);
 
 
+/*
+ *	query.c - Async searches and binds, multiplexed over a connection
+ */
+typedef struct fr_ldap_query fr_ldap_query_t;
+
+/** Process the result of an asynchronous operation
+ *
+ * Called from the event loop.  Must not send new operations on the same connection.
+ *
+ * @param[in] request	the operation was performed for.
+ * @param[in] status	of the operation.  Anything other than LDAP_PROC_SUCCESS
+ *			is a failure, with the reason available via fr_strerror().
+ * @param[in] result	of a successful search.  Must be freed with ldap_msgfree.
+ *			NULL for binds, and failed operations.
+ * @param[in] uctx	passed when the operation was sent.
+ */
+typedef void (*fr_ldap_query_cb_t)(REQUEST *request, fr_ldap_rcode_t status, LDAPMessage *result, void *uctx);
+
+int		fr_ldap_mux_async(fr_ldap_connection_t *c, fr_event_list_t *el);
+
+void		fr_ldap_mux_clear(fr_ldap_connection_t *c);
+
+fr_ldap_query_t	*fr_ldap_query_search(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_connection_t *c,
+				      char const *dn, int scope, char const *filter, char const * const *attrs,
+				      LDAPControl **serverctrls, LDAPControl **clientctrls,
+				      fr_ldap_query_cb_t callback, void *uctx);
+
+fr_ldap_query_t	*fr_ldap_query_bind(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_connection_t *c,
+				    char const *dn, char const *password,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls,
+				    fr_ldap_query_cb_t callback, void *uctx);
+
+fr_ldap_rcode_t	fr_ldap_query_wait(fr_ldap_query_t *query, LDAPMessage **result);
+
 /*
  *	uti.c - Utility functions
  */
@@ -0,0 +1,508 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/ldap/query.c
+ * @brief Asynchronous searches and binds, multiplexed over a single connection.
+ *
+ * Operations are sent with the non-blocking libldap functions, and tracked by
+ * msgid.  When the connection's file descriptor becomes readable, all complete
+ * results are read with a zero timeout, and passed to the callback of the
+ * operation they belong to.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX "%s - "
+#define LOG_PREFIX_ARGS c->config->name
+
+#include "libfreeradius-ldap.h"
+#include <freeradius-devel/rad_assert.h>
+
+/** An operation we're waiting for the result of
+ *
+ */
+struct fr_ldap_query {
+	fr_ldap_connection_t	*c;			//!< The operation was sent on.  NULL once complete.
+	REQUEST			*request;		//!< The operation is being performed for.
+
+	int			msgid;			//!< libldap message id.
+	int			type;			//!< LDAP_REQ_SEARCH or LDAP_REQ_BIND.
+	char const		*dn;			//!< Search base, or bind DN.  Used for error messages.
+
+	fr_event_timer_t const	*ev;			//!< res_timeout.
+
+	fr_ldap_query_cb_t	callback;		//!< Called when the result is complete.
+	void			*uctx;			//!< Passed to callback.
+};
+
+static int _ldap_query_cmp(void const *one, void const *two)
+{
+	fr_ldap_query_t const *a = one, *b = two;
+
+	return (a->msgid > b->msgid) - (a->msgid < b->msgid);
+}
+
+/** Remove a query from its connection, so it won't be called again
+ *
+ */
+static void ldap_query_unlink(fr_ldap_query_t *query)
+{
+	fr_ldap_connection_t *c = query->c;
+
+	if (!c) return;
+
+	if (query->ev) fr_event_timer_delete(c->el, &query->ev);
+	if (c->queries) rbtree_deletebydata(c->queries, query);
+	query->c = NULL;
+}
+
+/** Abandon an operation if it's freed before the result arrives
+ *
+ */
+static int _ldap_query_free(fr_ldap_query_t *query)
+{
+	fr_ldap_connection_t *c = query->c;
+
+	if (!c) return 0;
+
+	ldap_query_unlink(query);
+	if (c->handle) (void) ldap_abandon_ext(c->handle, query->msgid, NULL, NULL);
+
+	return 0;
+}
+
+/** Pass a result, or an error, to the query's callback
+ *
+ */
+static void ldap_query_done(fr_ldap_query_t *query, fr_ldap_rcode_t status, LDAPMessage *result)
+{
+	ldap_query_unlink(query);
+
+	if (query->callback) query->callback(query->request, status, result, query->uctx);
+}
+
+/** Check a complete result for errors
+ *
+ * @return One of the LDAP_PROC_* (#fr_ldap_rcode_t) values.
+ */
+static fr_ldap_rcode_t ldap_query_result(fr_ldap_query_t *query, LDAPMessage **result)
+{
+	fr_ldap_connection_t	*c = query->c;
+	REQUEST			*request = query->request;
+	fr_ldap_rcode_t		status = LDAP_PROC_SUCCESS;
+	LDAPMessage		*msg;
+	int			count;
+
+	for (msg = ldap_first_message(c->handle, *result);
+	     msg;
+	     msg = ldap_next_message(c->handle, msg)) {
+		status = fr_ldap_error_check(NULL, c, msg, query->dn);
+		if (status != LDAP_PROC_SUCCESS) break;
+	}
+
+	if ((status == LDAP_PROC_SUCCESS) && (query->type == LDAP_REQ_SEARCH)) {
+		count = ldap_count_entries(c->handle, *result);
+		if (count < 0) {
+			REDEBUG("Error counting results: %s", fr_ldap_error_str(c));
+			status = LDAP_PROC_ERROR;
+		} else if (count == 0) {
+			RDEBUG("Search returned no results");
+			status = LDAP_PROC_NO_RESULT;
+		}
+	}
+
+	if ((status != LDAP_PROC_SUCCESS) || (query->type != LDAP_REQ_SEARCH)) {
+		ldap_msgfree(*result);
+		*result = NULL;
+	}
+
+	return status;
+}
+
+static int _ldap_query_fail(void *ctx, void *data)
+{
+	fr_ldap_query_t	*query = talloc_get_type_abort(data, fr_ldap_query_t);
+	fr_ldap_rcode_t	status = *((fr_ldap_rcode_t *)ctx);
+
+	/*
+	 *	The node is deleted by the walker, so
+	 *	just stop the query being unlinked again.
+	 */
+	if (query->ev) fr_event_timer_delete(query->c->el, &query->ev);
+	query->c = NULL;
+
+	if (query->callback) query->callback(query->request, status, NULL, query->uctx);
+
+	return 2;
+}
+
+/** Fail all outstanding operations on a connection, and stop listening for results
+ *
+ * Called when the connection is closed, or when the caller no longer wants
+ * the connection to be muxed.
+ *
+ * @param[in] c		to stop muxing.
+ */
+void fr_ldap_mux_clear(fr_ldap_connection_t *c)
+{
+	fr_ldap_rcode_t	status = LDAP_PROC_BAD_CONN;
+
+	if (!c->el) return;
+
+	if (c->fd >= 0) {
+		(void) fr_event_fd_delete(c->el, c->fd, FR_EVENT_FILTER_IO);
+		c->fd = -1;
+	}
+
+	if (c->queries) {
+		if (rbtree_num_elements(c->queries) > 0) {
+			fr_strerror_printf("Connection closed with operation outstanding");
+			(void) rbtree_walk(c->queries, RBTREE_DELETE_ORDER, _ldap_query_fail, &status);
+		}
+		TALLOC_FREE(c->queries);
+	}
+
+	c->el = NULL;
+}
+
+/** Handle the connection failing
+ *
+ * If the connection is part of a connection state machine, it's reconnected,
+ * and the state machine calls #fr_ldap_mux_clear when the old connection is
+ * closed.  Otherwise we stop muxing, and leave the caller to close it.
+ */
+static void ldap_mux_error(fr_ldap_connection_t *c)
+{
+	if (c->conn) {
+		fr_ldap_state_error(c);
+		return;
+	}
+
+	fr_ldap_mux_clear(c);
+}
+
+/** Error reading from or writing to the file descriptor
+ *
+ * @param[in] el	the event occurred in.
+ * @param[in] fd	the event occurred on.
+ * @param[in] flags	from kevent.
+ * @param[in] fd_errno	The error that ocurred.
+ * @param[in] uctx	Connection config and handle.
+ */
+static void _ldap_mux_io_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			       int fd_errno, void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(uctx, fr_ldap_connection_t);
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+	ldap_mux_error(c);
+}
+
+/** Read all complete results, and pass them to the operations they belong to
+ *
+ * @param[in] el	the event occurred in.
+ * @param[in] fd	the event occurred on.
+ * @param[in] flags	from kevent.
+ * @param[in] uctx	Connection config and handle.
+ */
+static void _ldap_mux_io_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(uctx, fr_ldap_connection_t);
+
+	for (;;) {
+		struct timeval	tv = { 0, 0 };	/* We're I/O driven, don't wait for anything */
+		LDAPMessage	*result = NULL;
+		fr_ldap_query_t	*query, find;
+		fr_ldap_rcode_t	status;
+		int		ret;
+
+		/*
+		 *	With LDAP_RES_ANY and LDAP_MSG_ALL, libldap
+		 *	only returns the messages for an operation
+		 *	once its final message has been received.
+		 */
+		ret = ldap_result(c->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &tv, &result);
+		if (ret == 0) return;				/* Nothing more, or an incomplete result */
+		if (ret < 0) {
+			ERROR("Failed reading result: %s", fr_ldap_error_str(c));
+			ldap_mux_error(c);
+			return;
+		}
+
+		find.msgid = ldap_msgid(result);
+		query = rbtree_finddata(c->queries, &find);
+		if (!query) {
+			DEBUG3("Discarding result for msgid %i, operation was abandoned", find.msgid);
+			ldap_msgfree(result);
+			continue;
+		}
+
+		status = ldap_query_result(query, &result);
+		ldap_query_done(query, status, result);
+	}
+}
+
+/** Start passing results from a connection to the operations which are waiting for them
+ *
+ * @param[in] c		A connection which has been bound.
+ * @param[in] el	To insert the connection's file descriptor into.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_mux_async(fr_ldap_connection_t *c, fr_event_list_t *el)
+{
+	int fd = -1;
+
+	rad_assert(!c->el);
+
+	if ((ldap_get_option(c->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) || (fd < 0)) {
+		fr_strerror_printf("Connection has no file descriptor");
+		return -1;
+	}
+
+	if (!c->queries) {
+		c->queries = rbtree_create(c, _ldap_query_cmp, NULL, RBTREE_FLAG_NONE);
+		if (!c->queries) return -1;
+	}
+
+	if (fr_event_fd_insert(c, el, fd, _ldap_mux_io_read, NULL, _ldap_mux_io_error, c) < 0) {
+		TALLOC_FREE(c->queries);
+		return -1;
+	}
+	c->el = el;
+	c->fd = fd;
+
+	return 0;
+}
+
+/** The result didn't arrive within res_timeout
+ *
+ */
+static void _ldap_query_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(uctx, fr_ldap_query_t);
+	fr_ldap_connection_t	*c = query->c;
+
+	query->ev = NULL;
+
+	fr_strerror_printf("Timeout waiting for result");
+	(void) ldap_abandon_ext(c->handle, query->msgid, NULL, NULL);
+	ldap_query_done(query, LDAP_PROC_TIMEOUT, NULL);
+}
+
+/** Start tracking an operation that has been sent
+ *
+ */
+static fr_ldap_query_t *ldap_query_alloc(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_connection_t *c,
+					 int type, int msgid, char const *dn,
+					 fr_ldap_query_cb_t callback, void *uctx)
+{
+	fr_ldap_query_t	*query;
+	struct timeval	now, when;
+
+	MEM(query = talloc_zero(ctx, fr_ldap_query_t));
+	query->c = c;
+	query->request = request;
+	query->msgid = msgid;
+	query->type = type;
+	query->dn = talloc_typed_strdup(query, dn);
+	query->callback = callback;
+	query->uctx = uctx;
+
+	if (!rbtree_insert(c->queries, query)) {
+		fr_strerror_printf("Duplicate msgid %i", msgid);
+		(void) ldap_abandon_ext(c->handle, msgid, NULL, NULL);
+		query->c = NULL;
+		talloc_free(query);
+		return NULL;
+	}
+	talloc_set_destructor(query, _ldap_query_free);
+
+	if (c->config->res_timeout.tv_sec || c->config->res_timeout.tv_usec) {
+		gettimeofday(&now, NULL);
+		fr_timeval_add(&when, &now, &c->config->res_timeout);
+		if (fr_event_timer_insert(query, c->el, &query->ev, &when, _ldap_query_timeout, query) < 0) {
+			RWARN("Failed inserting result timeout: %s", fr_strerror());
+		}
+	}
+
+	return query;
+}
+
+/** Send a search, calling the callback when the result is available
+ *
+ * The search is performed as whatever identity the connection is bound as.
+ *
+ * @param[in] ctx		to allocate the query in.  Freeing the query before
+ *				the callback is called abandons the search.
+ * @param[in] request		Current request.
+ * @param[in] c			to send the search on.  Must be muxed with #fr_ldap_mux_async.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.
+ * @param[in] serverctrls	Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Search controls for ldap_search.  May be NULL.
+ * @param[in] callback		to pass the result to.  On LDAP_PROC_SUCCESS it
+ *				receives the result, and must free it with ldap_msgfree.
+ *				May be NULL if the result is collected with #fr_ldap_query_wait.
+ * @param[in] uctx		to pass to the callback.
+ * @return
+ *	- The new query on success.
+ *	- NULL if the search could not be sent.
+ */
+fr_ldap_query_t *fr_ldap_query_search(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_connection_t *c,
+				      char const *dn, int scope, char const *filter, char const * const *attrs,
+				      LDAPControl **serverctrls, LDAPControl **clientctrls,
+				      fr_ldap_query_cb_t callback, void *uctx)
+{
+	int	msgid;
+
+	if (!c->el) {
+		fr_strerror_printf("Connection is not ready");
+		return NULL;
+	}
+
+	if (fr_ldap_search_async(&msgid, request, &c, dn, scope, filter, attrs,
+				 serverctrls, clientctrls) != LDAP_PROC_SUCCESS) return NULL;
+
+	return ldap_query_alloc(ctx, request, c, LDAP_REQ_SEARCH, msgid, dn, callback, uctx);
+}
+
+/** Send a simple bind, calling the callback when the result is available
+ *
+ * No other operations may be outstanding on the connection while the bind is
+ * in progress, so this should only be used on connections which are not shared.
+ *
+ * @param[in] ctx		to allocate the query in.  Freeing the query before
+ *				the callback is called abandons the bind.
+ * @param[in] request		Current request.
+ * @param[in] c			to send the bind on.  Must be muxed with #fr_ldap_mux_async.
+ * @param[in] dn		of the user, may be NULL to bind anonymously.
+ * @param[in] password		of the user, may be NULL if no password is specified.
+ * @param[in] serverctrls	Controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Controls to pass to libldap.  May be NULL.
+ * @param[in] callback		to pass the result to.
+ * @param[in] uctx		to pass to the callback.
+ * @return
+ *	- The new query on success.
+ *	- NULL if the bind could not be sent.
+ */
+fr_ldap_query_t *fr_ldap_query_bind(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_connection_t *c,
+				    char const *dn, char const *password,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls,
+				    fr_ldap_query_cb_t callback, void *uctx)
+{
+	LDAPControl	*our_serverctrls[LDAP_MAX_CONTROLS];
+	LDAPControl	*our_clientctrls[LDAP_MAX_CONTROLS];
+	struct berval	cred;
+	int		msgid, ret;
+
+	if (!c->el) {
+		fr_strerror_printf("Connection is not ready");
+		return NULL;
+	}
+
+	fr_ldap_control_merge(our_serverctrls, our_clientctrls,
+			      sizeof(our_serverctrls) / sizeof(*our_serverctrls),
+			      sizeof(our_clientctrls) / sizeof(*our_clientctrls),
+			      c, serverctrls, clientctrls);
+
+	if (!dn) dn = "";
+
+	if (password) {
+		memcpy(&cred.bv_val, &password, sizeof(cred.bv_val));
+		cred.bv_len = strlen(password);
+	} else {
+		cred.bv_val = NULL;
+		cred.bv_len = 0;
+	}
+
+	ret = ldap_sasl_bind(c->handle, dn, LDAP_SASL_SIMPLE, &cred,
+			     our_serverctrls, our_clientctrls, &msgid);
+	if (ret != LDAP_SUCCESS) {
+		fr_strerror_printf("%s", ldap_err2string(ret));
+		return NULL;
+	}
+
+	return ldap_query_alloc(ctx, request, c, LDAP_REQ_BIND, msgid, dn, callback, uctx);
+}
+
+/** Wait for the result of a single query
+ *
+ * For callers which can't yield, such as paircompare callbacks.  Only this
+ * query's result is read, the results of other operations on the connection
+ * are passed to their callbacks once it has arrived.
+ *
+ * @param[in] query		to wait for.  The callback isn't called.
+ * @param[out] result		On LDAP_PROC_SUCCESS, the result of a search.
+ *				Must be freed with ldap_msgfree.
+ * @return One of the LDAP_PROC_* (#fr_ldap_rcode_t) values.
+ */
+fr_ldap_rcode_t fr_ldap_query_wait(fr_ldap_query_t *query, LDAPMessage **result)
+{
+	fr_ldap_connection_t	*c = query->c;
+	REQUEST			*request = query->request;
+	struct timeval		tv, *tvp = NULL;
+	fr_ldap_rcode_t		status;
+	int			ret;
+
+	*result = NULL;
+
+	if (!c) {
+		fr_strerror_printf("Operation is not in progress");
+		return LDAP_PROC_ERROR;
+	}
+
+	if (c->config->res_timeout.tv_sec || c->config->res_timeout.tv_usec) {
+		tv = c->config->res_timeout;
+		tvp = &tv;
+	}
+
+	ret = ldap_result(c->handle, query->msgid, LDAP_MSG_ALL, tvp, result);
+	if (ret == 0) {
+		REDEBUG("Timeout waiting for result");
+		(void) ldap_abandon_ext(c->handle, query->msgid, NULL, NULL);
+		ldap_query_unlink(query);
+
+		return LDAP_PROC_TIMEOUT;
+	}
+
+	if (ret < 0) {
+		ERROR("Failed reading result: %s", fr_ldap_error_str(c));
+		ldap_query_unlink(query);
+		ldap_mux_error(c);
+
+		return LDAP_PROC_BAD_CONN;
+	}
+
+	status = ldap_query_result(query, result);
+	ldap_query_unlink(query);
+
+	/*
+	 *	Results for other operations may have been read
+	 *	from the socket while we were waiting.  The fd
+	 *	won't become readable again for them, so pass
+	 *	them on now.
+	 */
+	if (c->el) _ldap_mux_io_read(c->el, c->fd, 0, c);
+
+	return status;
+}
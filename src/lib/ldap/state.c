@@ -107,12 +107,20 @@ again:
 	 */
 	case FR_LDAP_STATE_BIND:
 		STATE_TRANSITION(FR_LDAP_STATE_RUN);
-	/*
-		if (fr_ldap_mux_async(c) < 0) {
+
+		if (fr_ldap_mux_async(c, fr_connection_get_el(c->conn)) < 0) {
+			PERROR("Failed inserting connection into event loop");
 			STATE_TRANSITION(FR_LDAP_STATE_ERROR);
 			goto again;
 		}
-	 */
+
+		/*
+		 *	libldap opened the connection itself, so
+		 *	we have to tell the connection state machine
+		 *	which fd it's using, and that it's open.
+		 */
+		fr_connection_set_fd(c->conn, c->fd);
+		fr_connection_signal_open(c->conn);
 		break;
 
 	/*
@@ -29,6 +29,7 @@ SOURCES		:= base64.c \
 		   net.c \
 		   pair.c \
 		   pair_cursor.c \
+		   pair_head.c \
 		   pcap.c \
 		   print.c \
 		   proto.c \
@@ -44,6 +45,7 @@ SOURCES		:= base64.c \
 		   socket.c \
 		   talloc.c \
 		   token.c \
+		   trie.c \
 		   udpfromto.c \
 		   udp.c \
 		   value.c \
@@ -34,6 +34,9 @@ RCSID("$Id$")
 #  include <sys/stat.h>
 #endif
 
+#include <fcntl.h>
+#include <sys/mman.h>
+
 #define MAX_ARGV (16)
 
 /** Magic internal dictionary
@@ -67,6 +70,39 @@ typedef struct dict_enum_fixup_t {
 	struct dict_enum_fixup_t *next;	//!< Next in the linked list of fixups.
 } dict_enum_fixup_t;
 
+/** An entry in a name index
+ *
+ */
+typedef struct dict_name_slot_t {
+	uint32_t		hash;		//!< Of the case folded name.
+	uint32_t		len;		//!< Of the name.
+	char const		*name;		//!< Attribute name or enum alias.
+	void			*data;		//!< fr_dict_attr_t or fr_dict_enum_t.
+} dict_name_slot_t;
+
+/** A read-only open addressing index of names
+ *
+ * Built by #fr_dict_freeze once all attributes and enums have been defined.
+ * It's at most half full, and has no per-entry allocations, so lookups
+ * usually touch one slot, and never call through function pointers.
+ */
+typedef struct dict_name_index_t {
+	uint32_t		mask;		//!< Number of slots - 1.
+	dict_name_slot_t	*slots;
+} dict_name_index_t;
+
+/** Records the definitions made while reading a dictionary, so they can be cached
+ *
+ */
+typedef struct dict_cache_t {
+	uint8_t			*buff;		//!< Records written so far.
+	size_t			len;		//!< Of data in buff.
+	uint32_t		num_records;
+	uint32_t		num_attrs;	//!< Attribute ids handed out.  0 is the root.
+	rbtree_t		*refs;		//!< fr_dict_attr_t -> id.
+	bool			failed;		//!< Something happened which we can't record.
+} dict_cache_t;
+
 /** Vendors and attribute names
  *
  * It's very likely that the same vendors will operate in multiple
@@ -77,6 +113,7 @@ typedef struct dict_enum_fixup_t {
  */
 struct fr_dict {
 	dict_enum_fixup_t	*enum_fixup;
+	fr_dict_attr_t const	*last_value_attr;	//!< Of the last VALUE we read.
 
 	dict_stat_t		*stat_head;
 	dict_stat_t		*stat_tail;
@@ -91,8 +128,13 @@ struct fr_dict {
 	fr_hash_table_t		*values_by_da;		//!< Lookup an attribute enum by its value.
 	fr_hash_table_t		*values_by_alias;	//!< Lookup an attribute enum by its alias name.
 
+	dict_name_index_t	*attributes_by_name_index;	//!< Frozen copy of attributes_by_name.
+	dict_name_index_t	*values_by_alias_index;		//!< Frozen copy of values_by_alias.
+
 	fr_dict_attr_t		*root;			//!< Root attribute of this dictionary.
 	TALLOC_CTX		*pool;			//!< Talloc memory pool to reduce allocs.
+
+	dict_cache_t		*cache;			//!< Only set while dictionary files are being read.
 };
 
 /** Map data types to names representing those types
@@ -424,6 +466,197 @@ static int dict_enum_value_cmp(void const *one, void const *two)
 	return fr_value_box_cmp(a->value, b->value);
 }
 
+/*
+ *	Names only contain ASCII, so we don't need the locale
+ *	aware (and much slower) tolower().
+ */
+#define DICT_NAME_FOLD(_c) ((((_c) >= 'A') && ((_c) <= 'Z')) ? ((_c) | 0x20) : (_c))
+
+/** Hash a name for a name index
+ *
+ */
+static inline uint32_t dict_name_index_hash(char const *name, size_t len)
+{
+	uint8_t const	*p = (uint8_t const *)name, *end = p + len;
+	uint32_t	hash = FNV_MAGIC_INIT;
+
+	while (p < end) {
+		hash *= FNV_MAGIC_PRIME;
+		hash ^= (uint32_t)DICT_NAME_FOLD(*p);
+		p++;
+	}
+
+	return hash;
+}
+
+/** Compare two names of the same length, ignoring case
+ *
+ */
+static inline bool dict_name_index_eq(char const *a, char const *b, size_t len)
+{
+	size_t i;
+
+	/*
+	 *	Names are usually written the same way as in the
+	 *	dictionaries, and memcmp() is vectorised.
+	 */
+	if (memcmp(a, b, len) == 0) return true;
+
+	for (i = 0; i < len; i++) {
+		if (DICT_NAME_FOLD((uint8_t)a[i]) != DICT_NAME_FOLD((uint8_t)b[i])) return false;
+	}
+
+	return true;
+}
+
+/** Allocate a name index with room for num names
+ *
+ */
+static dict_name_index_t *dict_name_index_alloc(TALLOC_CTX *ctx, int num)
+{
+	dict_name_index_t	*index;
+	uint32_t		size;
+
+	for (size = 64; size < (uint32_t)(num * 2); size <<= 1);
+
+	index = talloc_zero(ctx, dict_name_index_t);
+	if (!index) return NULL;
+
+	index->slots = talloc_zero_array(index, dict_name_slot_t, size);
+	if (!index->slots) {
+		talloc_free(index);
+		return NULL;
+	}
+	index->mask = size - 1;
+
+	return index;
+}
+
+/** Add a name to a name index
+ *
+ * The index is sized so that it's never more than half full.
+ */
+static void dict_name_index_insert(dict_name_index_t *index, uint32_t hash,
+				   char const *name, size_t len, void *data)
+{
+	uint32_t i;
+
+	for (i = hash & index->mask; index->slots[i].name; i = (i + 1) & index->mask);
+
+	index->slots[i].hash = hash;
+	index->slots[i].len = len;
+	index->slots[i].name = name;
+	index->slots[i].data = data;
+}
+
+static int _dict_attr_index_insert(void *ctx, void *data)
+{
+	fr_dict_attr_t const	*da = data;
+	size_t			len = strlen(da->name);
+
+	dict_name_index_insert(ctx, dict_name_index_hash(da->name, len), da->name, len, data);
+
+	return 0;
+}
+
+static int _dict_enum_index_insert(void *ctx, void *data)
+{
+	fr_dict_enum_t const	*enumv = data;
+	size_t			len = strlen(enumv->alias);
+	uint32_t		hash;
+
+	hash = dict_name_index_hash(enumv->alias, len);
+	hash = fr_hash_update(&enumv->da, sizeof(enumv->da), hash);		//-V568
+
+	dict_name_index_insert(ctx, hash, enumv->alias, len, data);
+
+	return 0;
+}
+
+/** Find an attribute in a name index
+ *
+ */
+static fr_dict_attr_t const *dict_attr_index_find(dict_name_index_t const *index, char const *name, size_t len)
+{
+	uint32_t		i, hash;
+	dict_name_slot_t const	*slot;
+
+	hash = dict_name_index_hash(name, len);
+
+	for (i = hash & index->mask; index->slots[i].name; i = (i + 1) & index->mask) {
+		slot = &index->slots[i];
+
+		if ((slot->hash == hash) && (slot->len == len) && dict_name_index_eq(slot->name, name, len)) {
+			return slot->data;
+		}
+	}
+
+	return NULL;
+}
+
+/** Find an enum in a name index
+ *
+ */
+static fr_dict_enum_t *dict_enum_index_find(dict_name_index_t const *index,
+					    fr_dict_attr_t const *da, char const *alias)
+{
+	uint32_t		i, hash;
+	size_t			len = strlen(alias);
+	dict_name_slot_t const	*slot;
+
+	hash = dict_name_index_hash(alias, len);
+	hash = fr_hash_update(&da, sizeof(da), hash);				//-V568
+
+	for (i = hash & index->mask; index->slots[i].name; i = (i + 1) & index->mask) {
+		slot = &index->slots[i];
+
+		if ((slot->hash == hash) && (slot->len == len) &&
+		    (((fr_dict_enum_t const *)slot->data)->da == da) &&
+		    dict_name_index_eq(slot->name, alias, len)) {
+			return slot->data;
+		}
+	}
+
+	return NULL;
+}
+
+/** Find an enum by its alias, using the name index if the dictionary is frozen
+ *
+ */
+static fr_dict_enum_t *dict_enum_find_by_alias(fr_dict_t const *dict, fr_dict_attr_t const *da, char const *alias)
+{
+	fr_dict_enum_t find;
+
+	if (dict->values_by_alias_index) return dict_enum_index_find(dict->values_by_alias_index, da, alias);
+
+	memset(&find, 0, sizeof(find));
+	find.da = da;
+	find.alias = alias;
+
+	return fr_hash_table_finddata(dict->values_by_alias, &find);
+}
+
+/** Check that a dictionary can still be modified
+ *
+ * Once a dictionary has been frozen, worker threads look up names in the
+ * indexes without any locking, so the indexes can't be discarded or
+ * rebuilt under them.
+ *
+ * @param[in] dict	being modified.
+ * @return
+ *	- 0 if the dictionary isn't frozen.
+ *	- -1 if it is.
+ */
+static int dict_modifiable(fr_dict_t const *dict)
+{
+	if (!fr_cond_assert(!dict->attributes_by_name_index)) {
+		fr_strerror_printf("Dictionary is frozen, no more definitions can be added");
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Add an entry to the list of stat buffers.
  */
 static void dict_stat_add(fr_dict_t *dict, struct stat const *stat_buf)
@@ -490,6 +723,297 @@ static int dict_stat_check(fr_dict_t *dict, char const *dir, char const *file)
 	return 0;
 }
 
+/*
+ *	Precompiled dictionary cache
+ *
+ *	Reading the dictionaries means opening, tokenising and parsing
+ *	hundreds of files.  Instead, while fr_dict_from_file() reads them,
+ *	we record every file, vendor, attribute and enum it defines, in
+ *	order, in a compact binary format.  The next time, if none of the
+ *	files have changed, the cache is mmapped, and the definitions are
+ *	replayed directly, without looking at the files.
+ *
+ *	Attributes are referred to by the order they were defined in,
+ *	so records don't contain pointers.
+ */
+#define DICT_CACHE_MAGIC	"FRDICT1"
+#define DICT_CACHE_VERSION	(1)
+
+typedef enum {
+	DICT_CACHE_OP_FILE = 1,			//!< A dictionary file, and its stat info.
+	DICT_CACHE_OP_VENDOR,			//!< fr_dict_vendor_add() and the vendor format.
+	DICT_CACHE_OP_ATTR,			//!< fr_dict_attr_add().
+	DICT_CACHE_OP_CHILD,			//!< An attribute which was added to its parent directly.
+	DICT_CACHE_OP_ENUM			//!< fr_dict_enum_add_alias().
+} dict_cache_op_t;
+
+typedef struct {
+	char			magic[8];
+	uint64_t		lib_magic;	//!< RADIUSD_MAGIC_NUMBER of the library which wrote the cache.
+	uint32_t		version;
+	uint32_t		flags_size;	//!< sizeof(fr_dict_attr_flags_t).
+	uint32_t		num_records;
+	uint32_t		num_attrs;
+	uint64_t		len;		//!< Of the records after the header.
+	uint32_t		checksum;	//!< fr_hash() of the records.
+	uint32_t		pad;
+} dict_cache_header_t;
+
+typedef struct {
+	fr_dict_attr_t const	*da;
+	uint32_t		id;
+} dict_cache_ref_t;
+
+static int dict_cache_ref_cmp(void const *one, void const *two)
+{
+	dict_cache_ref_t const *a = one, *b = two;
+
+	return (a->da > b->da) - (a->da < b->da);
+}
+
+/** Start recording definitions
+ *
+ */
+static dict_cache_t *dict_cache_alloc(TALLOC_CTX *ctx)
+{
+	dict_cache_t *cache;
+
+	cache = talloc_zero(ctx, dict_cache_t);
+	if (!cache) return NULL;
+
+	cache->buff = talloc_array(cache, uint8_t, 65536);
+	cache->refs = rbtree_create(cache, dict_cache_ref_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!cache->buff || !cache->refs) {
+		talloc_free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void dict_cache_put(dict_cache_t *cache, void const *data, size_t len)
+{
+	size_t size;
+
+	if (cache->failed) return;
+
+	size = talloc_array_length(cache->buff);
+	if ((cache->len + len) > size) {
+		uint8_t *buff;
+
+		while ((cache->len + len) > size) size *= 2;
+
+		buff = talloc_realloc(cache, cache->buff, uint8_t, size);
+		if (!buff) {
+			cache->failed = true;
+			return;
+		}
+		cache->buff = buff;
+	}
+
+	memcpy(cache->buff + cache->len, data, len);
+	cache->len += len;
+}
+
+static inline void dict_cache_put_u8(dict_cache_t *cache, uint8_t value)
+{
+	dict_cache_put(cache, &value, sizeof(value));
+}
+
+static inline void dict_cache_put_u32(dict_cache_t *cache, uint32_t value)
+{
+	dict_cache_put(cache, &value, sizeof(value));
+}
+
+static inline void dict_cache_put_u64(dict_cache_t *cache, uint64_t value)
+{
+	dict_cache_put(cache, &value, sizeof(value));
+}
+
+/** Write a string, including the trailing '\0', so it can be used directly from the cache
+ *
+ */
+static void dict_cache_put_str(dict_cache_t *cache, char const *str)
+{
+	size_t		len = strlen(str);
+	uint16_t	len16;
+
+	if (len > UINT16_MAX) {
+		cache->failed = true;
+		return;
+	}
+	len16 = len;
+
+	dict_cache_put(cache, &len16, sizeof(len16));
+	dict_cache_put(cache, str, len + 1);
+}
+
+/** Write the id of an attribute which was defined earlier
+ *
+ */
+static void dict_cache_put_ref(fr_dict_t *dict, fr_dict_attr_t const *da)
+{
+	dict_cache_ref_t find, *ref;
+
+	if (da == dict->root) {
+		dict_cache_put_u32(dict->cache, 0);
+		return;
+	}
+
+	find.da = da;
+	ref = rbtree_finddata(dict->cache->refs, &find);
+	if (!ref) {
+		dict->cache->failed = true;
+		return;
+	}
+
+	dict_cache_put_u32(dict->cache, ref->id);
+}
+
+/** Give a newly defined attribute the next id
+ *
+ */
+static void dict_cache_add_ref(dict_cache_t *cache, fr_dict_attr_t const *da)
+{
+	dict_cache_ref_t *ref;
+
+	if (cache->failed) return;
+
+	ref = talloc(cache, dict_cache_ref_t);
+	if (!ref) {
+		cache->failed = true;
+		return;
+	}
+	ref->da = da;
+	ref->id = ++cache->num_attrs;
+
+	/*
+	 *	The same attribute can't be defined twice.
+	 */
+	if (!rbtree_insert(cache->refs, ref)) {
+		talloc_free(ref);
+		cache->failed = true;
+	}
+}
+
+/** Record a dictionary file we read, or tried to read
+ *
+ * @param[in] dict	being read.
+ * @param[in] filename	of the dictionary file.
+ * @param[in] stat_buf	of the file, or NULL if it doesn't exist.
+ */
+static void dict_cache_file(fr_dict_t *dict, char const *filename, struct stat const *stat_buf)
+{
+	if (!dict->cache) return;
+
+	dict_cache_put_u8(dict->cache, DICT_CACHE_OP_FILE);
+	dict_cache_put_u8(dict->cache, stat_buf != NULL);
+	dict_cache_put_str(dict->cache, filename);
+	dict_cache_put_u64(dict->cache, stat_buf ? (uint64_t)stat_buf->st_dev : 0);
+	dict_cache_put_u64(dict->cache, stat_buf ? (uint64_t)stat_buf->st_ino : 0);
+	dict_cache_put_u64(dict->cache, stat_buf ? (uint64_t)stat_buf->st_mtime : 0);
+	dict_cache_put_u64(dict->cache, stat_buf ? (uint64_t)stat_buf->st_size : 0);
+	dict->cache->num_records++;
+}
+
+/** Record a vendor, and its format
+ *
+ */
+static void dict_cache_vendor(fr_dict_t *dict, fr_dict_vendor_t const *dv)
+{
+	if (!dict->cache) return;
+
+	dict_cache_put_u8(dict->cache, DICT_CACHE_OP_VENDOR);
+	dict_cache_put_str(dict->cache, dv->name);
+	dict_cache_put_u32(dict->cache, dv->vendorpec);
+	dict_cache_put_u32(dict->cache, dv->type);
+	dict_cache_put_u32(dict->cache, dv->length);
+	dict_cache_put_u32(dict->cache, dv->flags);
+	dict->cache->num_records++;
+}
+
+/** Record a call to fr_dict_attr_add()
+ *
+ */
+static void dict_cache_attr(fr_dict_t *dict, fr_dict_attr_t const *parent, fr_dict_attr_t const *da,
+			    int attr, fr_type_t type, fr_dict_attr_flags_t const *flags)
+{
+	if (!dict->cache) return;
+
+	dict_cache_put_u8(dict->cache, DICT_CACHE_OP_ATTR);
+	dict_cache_put_ref(dict, parent);
+	dict_cache_put_str(dict->cache, da->name);
+	dict_cache_put_u32(dict->cache, (uint32_t)attr);
+	dict_cache_put_u32(dict->cache, type);
+	dict_cache_put(dict->cache, flags, sizeof(*flags));
+	dict_cache_add_ref(dict->cache, da);
+	dict->cache->num_records++;
+}
+
+/** Record an attribute which was allocated and added to its parent directly
+ *
+ * @param[in] dict	being read.
+ * @param[in] container	the attribute was added to.  This may not be the
+ *			same as da->parent.
+ * @param[in] da	the new attribute.
+ */
+static void dict_cache_child(fr_dict_t *dict, fr_dict_attr_t const *container, fr_dict_attr_t const *da)
+{
+	if (!dict->cache) return;
+
+	dict_cache_put_u8(dict->cache, DICT_CACHE_OP_CHILD);
+	dict_cache_put_ref(dict, container);
+	dict_cache_put_ref(dict, da->parent);
+	dict_cache_put_str(dict->cache, da->name);
+	dict_cache_put_u32(dict->cache, da->vendor);
+	dict_cache_put_u32(dict->cache, da->attr);
+	dict_cache_put_u32(dict->cache, da->type);
+	dict_cache_put(dict->cache, &da->flags, sizeof(da->flags));
+	dict_cache_add_ref(dict->cache, da);
+	dict->cache->num_records++;
+}
+
+/** Record a call to fr_dict_enum_add_alias()
+ *
+ * The value is stored in network format.  If it doesn't survive the
+ * round trip unchanged, we don't write the cache.
+ */
+static void dict_cache_enum(fr_dict_t *dict, fr_dict_attr_t const *da, char const *alias,
+			    fr_value_box_t const *value, bool coerce, bool takes_precedence)
+{
+	uint8_t		buffer[256];
+	ssize_t		len;
+	size_t		need = 0;
+	fr_value_box_t	check;
+
+	if (!dict->cache || dict->cache->failed) return;
+
+	/*
+	 *	fr_value_box_from_network() byte swaps integers in
+	 *	place, using the type already in the box.
+	 */
+	check = (fr_value_box_t){ .type = value->type };
+
+	len = fr_value_box_to_network(&need, buffer, sizeof(buffer), value);
+	if ((len < 0) || (need > 0) ||
+	    (fr_value_box_from_network(NULL, &check, value->type, NULL, buffer, len, false) < 0)) {
+		dict->cache->failed = true;
+		return;
+	}
+	if (fr_value_box_cmp(value, &check) != 0) dict->cache->failed = true;
+	fr_value_box_clear(&check);
+
+	dict_cache_put_u8(dict->cache, DICT_CACHE_OP_ENUM);
+	dict_cache_put_ref(dict, da);
+	dict_cache_put_str(dict->cache, alias);
+	dict_cache_put_u8(dict->cache, coerce);
+	dict_cache_put_u8(dict->cache, takes_precedence);
+	dict_cache_put_u32(dict->cache, value->type);
+	dict_cache_put_u32(dict->cache, len);
+	dict_cache_put(dict->cache, buffer, len);
+	dict->cache->num_records++;
+}
+
 static void _fr_dict_dump(fr_dict_attr_t const *da, unsigned int lvl)
 {
 	unsigned int		i;
@@ -844,6 +1368,8 @@ static fr_dict_attr_t *fr_dict_attr_add_by_name(fr_dict_t *dict, fr_dict_attr_t
 
 	if (!fr_cond_assert(parent)) return NULL;
 
+	if (dict_modifiable(dict) < 0) return NULL;
+
 	namelen = strlen(name);
 	if (namelen >= FR_DICT_ATTR_MAX_NAME_LEN) {
 		fr_strerror_printf("Attribute name too long");
@@ -1506,6 +2032,8 @@ int fr_dict_attr_add(fr_dict_t *dict, fr_dict_attr_t const *parent,
 	fr_dict_attr_t *n;
 	fr_dict_attr_t *mutable;
 
+	INTERNAL_IF_NULL(dict);
+
 	n = fr_dict_attr_add_by_name(dict, parent, name, attr, type, flags);
 	if (!n) return -1;
 
@@ -1516,6 +2044,8 @@ int fr_dict_attr_add(fr_dict_t *dict, fr_dict_attr_t const *parent,
 
 	if (fr_dict_attr_child_add(mutable, n) < 0) return -1;
 
+	dict_cache_attr(dict, parent, n, attr, type, &flags);
+
 	return 0;
 }
 
@@ -1565,6 +2095,9 @@ int fr_dict_enum_add_alias(fr_dict_attr_t const *da, char const *alias,
 	}
 
 	dict = fr_dict_by_da(da);
+	if (dict_modifiable(dict) < 0) return -1;
+
+	dict_cache_enum(dict, da, alias, value, coerce, takes_precedence);
 
 	enumv = talloc_zero(dict->pool, fr_dict_enum_t);
 	if (!enumv) {
@@ -1981,7 +2514,6 @@ static int dict_read_process_named_attribute(fr_dict_t *dict, fr_dict_attr_t con
  */
 static int dict_read_process_value(fr_dict_t *dict, char **argv, int argc)
 {
-	static fr_dict_attr_t const	*last_attr = NULL;
 	fr_dict_attr_t const		*da;
 	fr_value_box_t			value;
 
@@ -1993,13 +2525,14 @@ static int dict_read_process_value(fr_dict_t *dict, char **argv, int argc)
 	/*
 	 *	Most VALUEs are bunched together by ATTRIBUTE.  We can
 	 *	save a lot of lookups on dictionary initialization by
-	 *	caching the last attribute.
+	 *	caching the last attribute.  It's per dictionary, as
+	 *	each dictionary has its own copy of the attribute.
 	 */
-	if (last_attr && (strcasecmp(argv[0], last_attr->name) == 0)) {
-		da = last_attr;
+	if (dict->last_value_attr && (strcasecmp(argv[0], dict->last_value_attr->name) == 0)) {
+		da = dict->last_value_attr;
 	} else {
 		da = fr_dict_attr_by_name(dict, argv[0]);
-		last_attr = da;
+		dict->last_value_attr = da;
 	}
 
 	/*
@@ -2211,6 +2744,8 @@ static int dict_read_process_vendor(fr_dict_t *dict, char **argv, int argc)
 	mutable->length = length;
 	mutable->flags = continuation;
 
+	dict_cache_vendor(dict, dv);
+
 	return 0;
 }
 
@@ -2307,6 +2842,8 @@ static int _dict_from_file(dict_from_file_ctx_t *ctx,
 	}
 
 	if ((fp = fopen(fn, "r")) == NULL) {
+		dict_cache_file(ctx->dict, fn, NULL);
+
 		if (!src_file) {
 			fr_strerror_printf_push("%s: Couldn't open dictionary '%s': %s",
 					   "Error reading dictionary", fn, fr_syserror(errno));
@@ -2345,6 +2882,7 @@ static int _dict_from_file(dict_from_file_ctx_t *ctx,
 #endif
 
 	dict_stat_add(ctx->dict, &statbuf);
+	dict_cache_file(ctx->dict, fn, &statbuf);
 
 	/*
 	 *	Seed the random pool with data.
@@ -2583,6 +3121,7 @@ static int _dict_from_file(dict_from_file_ctx_t *ctx,
 					new = fr_dict_attr_alloc(mutable, fr_dict_root(ctx->dict), "Vendor-Specific", 0,
 								 FR_VENDOR_SPECIFIC, FR_TYPE_VSA, &flags);
 					fr_dict_attr_child_add(mutable, new);
+					dict_cache_child(ctx->dict, mutable, new);
 					vsa_da = new;
 				}
 			}
@@ -2617,6 +3156,7 @@ static int _dict_from_file(dict_from_file_ctx_t *ctx,
 				new = fr_dict_attr_alloc(mutable, ctx->parent,
 							 argv[1], 0, vendor, FR_TYPE_VENDOR, &flags);
 				fr_dict_attr_child_add(mutable, new);
+				dict_cache_child(ctx->dict, mutable, new);
 
 				vendor_da = new;
 			}
@@ -2673,6 +3213,357 @@ static int dict_from_file(fr_dict_t *dict,
 	return _dict_from_file(&ctx, dir_name, filename, src_file, src_line);
 }
 
+/** Reads records from a dictionary cache
+ *
+ */
+typedef struct {
+	uint8_t const		*p;
+	uint8_t const		*end;
+} dict_cache_reader_t;
+
+static inline bool dict_cache_get(dict_cache_reader_t *r, void *out, size_t len)
+{
+	if ((size_t)(r->end - r->p) < len) return false;
+
+	memcpy(out, r->p, len);
+	r->p += len;
+
+	return true;
+}
+
+static char const *dict_cache_get_str(dict_cache_reader_t *r)
+{
+	uint16_t	len;
+	char const	*str;
+
+	if (!dict_cache_get(r, &len, sizeof(len))) return NULL;
+	if ((size_t)(r->end - r->p) < ((size_t)len + 1)) return NULL;
+	if (r->p[len] != '\0') return NULL;
+
+	str = (char const *)r->p;
+	r->p += len + 1;
+
+	return str;
+}
+
+/** Read the id of an attribute, and check that it has already been defined
+ *
+ */
+static inline bool dict_cache_get_ref(dict_cache_reader_t *r, uint32_t num_attrs,
+				      fr_dict_attr_t const **das, fr_dict_attr_t const **out)
+{
+	uint32_t id;
+
+	if (!dict_cache_get(r, &id, sizeof(id))) return false;
+	if (id > num_attrs) return false;
+
+	if (das) *out = das[id];
+
+	return true;
+}
+
+/** Check the records in a dictionary cache, or replay them
+ *
+ * @param[in] dict	to add the definitions to.
+ * @param[in] data	records from the cache.
+ * @param[in] len	of the records.
+ * @param[in] das	NULL to check that the records are well formed, and that
+ *			none of the dictionary files have changed.  Otherwise,
+ *			where to put the attributes, by id.
+ * @param[out] out_attrs	the number of attributes the records define.  May be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the cache is invalid, or a definition failed.
+ */
+static int dict_cache_replay(fr_dict_t *dict, uint8_t const *data, size_t len, fr_dict_attr_t const **das,
+			     uint32_t *out_attrs)
+{
+	dict_cache_reader_t	r = { .p = data, .end = data + len };
+	uint32_t		num_attrs = 0;
+	uint8_t			op;
+
+	while (r.p < r.end) {
+		fr_dict_attr_t const	*parent = NULL, *container = NULL;
+		fr_dict_attr_t		*n, *mutable;
+		char const		*name;
+		uint32_t		vendor, attr, type;
+		fr_dict_attr_flags_t	flags;
+
+		if (!dict_cache_get(&r, &op, sizeof(op))) return -1;
+
+		switch (op) {
+		case DICT_CACHE_OP_FILE:
+		{
+			uint8_t		present;
+			uint64_t	dev, ino, mtime, size;
+			struct stat	stat_buf;
+
+			if (!dict_cache_get(&r, &present, sizeof(present)) ||
+			    !(name = dict_cache_get_str(&r)) ||
+			    !dict_cache_get(&r, &dev, sizeof(dev)) ||
+			    !dict_cache_get(&r, &ino, sizeof(ino)) ||
+			    !dict_cache_get(&r, &mtime, sizeof(mtime)) ||
+			    !dict_cache_get(&r, &size, sizeof(size))) return -1;
+
+			/*
+			 *	Same rules as dict_stat_check(), but the
+			 *	file must also not have appeared, or
+			 *	changed size.
+			 */
+			if (stat(name, &stat_buf) < 0) {
+				if (present) return -1;
+				break;
+			}
+			if (!present ||
+			    ((uint64_t)stat_buf.st_dev != dev) ||
+			    ((uint64_t)stat_buf.st_ino != ino) ||
+			    ((uint64_t)stat_buf.st_mtime != mtime) ||
+			    ((uint64_t)stat_buf.st_size != size)) return -1;
+
+			if (das) dict_stat_add(dict, &stat_buf);
+		}
+			break;
+
+		case DICT_CACHE_OP_VENDOR:
+		{
+			uint32_t		pen, vtype, vlength, vflags;
+			fr_dict_vendor_t const	*dv;
+			fr_dict_vendor_t	*mutable_dv;
+
+			if (!(name = dict_cache_get_str(&r)) ||
+			    !dict_cache_get(&r, &pen, sizeof(pen)) ||
+			    !dict_cache_get(&r, &vtype, sizeof(vtype)) ||
+			    !dict_cache_get(&r, &vlength, sizeof(vlength)) ||
+			    !dict_cache_get(&r, &vflags, sizeof(vflags))) return -1;
+
+			if (!das) break;
+
+			if (fr_dict_vendor_add(dict, name, pen) < 0) return -1;
+
+			dv = fr_dict_vendor_by_num(dict, pen);
+			if (!dv) return -1;
+
+			memcpy(&mutable_dv, &dv, sizeof(mutable_dv));
+			mutable_dv->type = vtype;
+			mutable_dv->length = vlength;
+			mutable_dv->flags = vflags;
+		}
+			break;
+
+		case DICT_CACHE_OP_ATTR:
+			if (!dict_cache_get_ref(&r, num_attrs, das, &parent) ||
+			    !(name = dict_cache_get_str(&r)) ||
+			    !dict_cache_get(&r, &attr, sizeof(attr)) ||
+			    !dict_cache_get(&r, &type, sizeof(type)) ||
+			    !dict_cache_get(&r, &flags, sizeof(flags)) ||
+			    (type >= FR_TYPE_MAX)) return -1;
+
+			num_attrs++;
+			if (!das) break;
+
+			n = fr_dict_attr_add_by_name(dict, parent, name, (int)attr, type, flags);
+			if (!n) return -1;
+
+			memcpy(&mutable, &parent, sizeof(mutable));
+			if (fr_dict_attr_child_add(mutable, n) < 0) return -1;
+
+			das[num_attrs] = n;
+			break;
+
+		case DICT_CACHE_OP_CHILD:
+			if (!dict_cache_get_ref(&r, num_attrs, das, &container) ||
+			    !dict_cache_get_ref(&r, num_attrs, das, &parent) ||
+			    !(name = dict_cache_get_str(&r)) ||
+			    !dict_cache_get(&r, &vendor, sizeof(vendor)) ||
+			    !dict_cache_get(&r, &attr, sizeof(attr)) ||
+			    !dict_cache_get(&r, &type, sizeof(type)) ||
+			    !dict_cache_get(&r, &flags, sizeof(flags)) ||
+			    (type >= FR_TYPE_MAX)) return -1;
+
+			num_attrs++;
+			if (!das) break;
+
+			memcpy(&mutable, &container, sizeof(mutable));
+			n = fr_dict_attr_alloc(mutable, parent, name, vendor, attr, type, &flags);
+			if (!n) return -1;
+
+			if (fr_dict_attr_child_add(mutable, n) < 0) return -1;
+
+			das[num_attrs] = n;
+			break;
+
+		case DICT_CACHE_OP_ENUM:
+		{
+			fr_dict_attr_t const	*da = NULL;
+			uint8_t			coerce, takes_precedence;
+			uint32_t		value_len;
+			fr_value_box_t		value;
+			int			ret;
+
+			if (!dict_cache_get_ref(&r, num_attrs, das, &da) ||
+			    !(name = dict_cache_get_str(&r)) ||
+			    !dict_cache_get(&r, &coerce, sizeof(coerce)) ||
+			    !dict_cache_get(&r, &takes_precedence, sizeof(takes_precedence)) ||
+			    !dict_cache_get(&r, &type, sizeof(type)) ||
+			    !dict_cache_get(&r, &value_len, sizeof(value_len)) ||
+			    (type >= FR_TYPE_MAX) ||
+			    ((size_t)(r.end - r.p) < value_len)) return -1;
+
+			r.p += value_len;
+			if (!das) break;
+
+			value = (fr_value_box_t){ .type = type };
+			if (fr_value_box_from_network(NULL, &value, type, NULL,
+						      r.p - value_len, value_len, false) < 0) return -1;
+
+			ret = fr_dict_enum_add_alias(da, name, &value, coerce, takes_precedence);
+			fr_value_box_clear(&value);
+			if (ret < 0) return -1;
+		}
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	if (out_attrs) *out_attrs = num_attrs;
+
+	return 0;
+}
+
+/** Work out where the cache for a dictionary lives
+ *
+ */
+static char *dict_cache_filename(TALLOC_CTX *ctx, char const *cache_dir,
+				 char const *dir, char const *fn, char const *name)
+{
+	char		*key;
+	uint32_t	hash;
+
+	key = talloc_typed_asprintf(ctx, "%s/%s/%s", dir, fn, name);
+	if (!key) return NULL;
+
+	hash = fr_hash_string(key);
+	talloc_free(key);
+
+	return talloc_typed_asprintf(ctx, "%s/%s.%08x.dict", cache_dir, name, hash);
+}
+
+/** Load a dictionary from its cache
+ *
+ * @param[in] dict	to load the definitions into.  Must be empty.
+ * @param[in] filename	of the cache.
+ * @return
+ *	- 1 if the dictionary was loaded from the cache.
+ *	- 0 if there's no cache, or it's out of date.  The dictionary hasn't been modified.
+ *	- -1 if replaying the cache failed.  The dictionary should be discarded.
+ */
+static int dict_cache_load(fr_dict_t *dict, char const *filename)
+{
+	int			fd, ret;
+	struct stat		stat_buf;
+	uint8_t			*data;
+	dict_cache_header_t	hdr;
+	fr_dict_attr_t const	**das;
+	uint32_t		num_attrs;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return 0;
+
+	if ((fstat(fd, &stat_buf) < 0) || ((size_t)stat_buf.st_size < sizeof(hdr))) {
+		close(fd);
+		return 0;
+	}
+
+	/*
+	 *	Map the cache read-only, so the records are read
+	 *	straight from the page cache, without copying them.
+	 *	The mapping is released once they've been replayed.
+	 */
+	data = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return 0;
+
+	memcpy(&hdr, data, sizeof(hdr));
+
+	if ((memcmp(hdr.magic, DICT_CACHE_MAGIC, sizeof(hdr.magic)) != 0) ||
+	    (hdr.lib_magic != RADIUSD_MAGIC_NUMBER) ||
+	    (hdr.version != DICT_CACHE_VERSION) ||
+	    (hdr.flags_size != sizeof(fr_dict_attr_flags_t)) ||
+	    (hdr.len != ((uint64_t)stat_buf.st_size - sizeof(hdr))) ||
+	    (hdr.checksum != fr_hash(data + sizeof(hdr), hdr.len)) ||
+	    (dict_cache_replay(dict, data + sizeof(hdr), hdr.len, NULL, &num_attrs) < 0) ||
+	    (num_attrs != hdr.num_attrs)) {
+		ret = 0;
+		goto finish;
+	}
+
+	das = talloc_array(NULL, fr_dict_attr_t const *, hdr.num_attrs + 1);
+	if (!das) {
+		ret = 0;
+		goto finish;
+	}
+	das[0] = dict->root;
+
+	ret = 1;
+	if (dict_cache_replay(dict, data + sizeof(hdr), hdr.len, das, NULL) < 0) {
+		fr_strerror_printf_push("%s: Failed loading dictionary cache '%s'.  Delete it, and try again",
+					"Error reading dictionary", filename);
+		ret = -1;
+	}
+	talloc_free(das);
+
+finish:
+	munmap(data, stat_buf.st_size);
+
+	return ret;
+}
+
+/** Write the definitions recorded while reading a dictionary to its cache
+ *
+ * The cache is written to a temporary file, which is then renamed, so
+ * other processes never see a partial cache.  Failures are ignored, we
+ * just read the dictionary files again next time.
+ */
+static void dict_cache_save(dict_cache_t *cache, char const *filename)
+{
+	dict_cache_header_t	hdr;
+	char			*tmp;
+	int			fd;
+	FILE			*fp;
+	bool			ok;
+
+	if (cache->failed) return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DICT_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.lib_magic = RADIUSD_MAGIC_NUMBER;
+	hdr.version = DICT_CACHE_VERSION;
+	hdr.flags_size = sizeof(fr_dict_attr_flags_t);
+	hdr.num_records = cache->num_records;
+	hdr.num_attrs = cache->num_attrs;
+	hdr.len = cache->len;
+	hdr.checksum = fr_hash(cache->buff, cache->len);
+
+	tmp = talloc_typed_asprintf(cache, "%s.XXXXXX", filename);
+	if (!tmp) return;
+
+	fd = mkstemp(tmp);
+	if (fd < 0) return;
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1) &&
+	     (fwrite(cache->buff, cache->len, 1, fp) == 1) &&
+	     (fchmod(fd, 0644) == 0);
+	if ((fclose(fp) != 0) || !ok || (rename(tmp, filename) < 0)) unlink(tmp);
+}
 
 static bool defined_cast_types = false;
 
@@ -2694,7 +3585,9 @@ static bool defined_cast_types = false;
  */
 int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char const *fn, char const *name)
 {
-	fr_dict_t *dict;
+	fr_dict_t	*dict;
+	char const	*cache_dir;
+	char		*cache_file = NULL;
 
 	if (!*out) {
 		/* Pre-Allocate 5MB of pool memory for rapid startup */
@@ -2751,7 +3644,12 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 	dict->values_by_alias = fr_hash_table_create(dict, dict_enum_alias_hash, dict_enum_alias_cmp, hash_pool_free);
 	if (!dict->values_by_alias) goto error;
 
-	dict->values_by_da = fr_hash_table_create(dict, dict_enum_value_hash, dict_enum_value_cmp, hash_pool_free);
+	/*
+	 *	The enums are owned by values_by_alias.  When a newer
+	 *	alias takes precedence, the old one is replaced here,
+	 *	but must still be found by its alias.
+	 */
+	dict->values_by_da = fr_hash_table_create(dict, dict_enum_value_hash, dict_enum_value_cmp, NULL);
 	if (!dict->values_by_da) goto error;
 
 	/*
@@ -2805,6 +3703,28 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 		defined_cast_types = true;
 	}
 
+	/*
+	 *	Load the dictionary from the precompiled cache if
+	 *	none of the files have changed.  Otherwise, record
+	 *	the definitions as we read the files, and write a
+	 *	new cache.
+	 */
+	cache_dir = getenv("FR_DICT_CACHE_DIR");
+	if (cache_dir && *cache_dir) {
+		cache_file = dict_cache_filename(dict, cache_dir, dir, fn, name);
+		if (cache_file) switch (dict_cache_load(dict, cache_file)) {
+		case 1:
+			goto done;
+
+		case 0:
+			dict->cache = dict_cache_alloc(dict);
+			break;
+
+		default:
+			goto error;
+		}
+	}
+
 	if (dict_from_file(dict, dir, fn, NULL, 0) < 0) goto error;
 
 	/*
@@ -2843,6 +3763,12 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 		}
 	}
 
+	if (dict->cache) {
+		dict_cache_save(dict->cache, cache_file);
+		TALLOC_FREE(dict->cache);
+	}
+
+done:
 	/*
 	 *	Walk over all of the hash tables to ensure they're
 	 *	initialized.  We do this because the threads may perform
@@ -2860,6 +3786,50 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 	return 0;
 }
 
+/** Index attribute names and enum aliases for fast lookups
+ *
+ * Must be called once all attributes and enums have been defined, and
+ * before any threads are started.  The indexes are read without locking,
+ * so a frozen dictionary is read-only.  Adding attributes or enums to it
+ * is an error.  Calling this function again rebuilds the indexes, so
+ * it's only safe while there's a single thread.
+ *
+ * @param[in] dict	to freeze.  If NULL the internal dictionary will be used.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_freeze(fr_dict_t *dict)
+{
+	dict_name_index_t *attributes, *values;
+
+	INTERNAL_IF_NULL(dict);
+
+	TALLOC_FREE(dict->attributes_by_name_index);
+	TALLOC_FREE(dict->values_by_alias_index);
+
+	attributes = dict_name_index_alloc(dict, fr_hash_table_num_elements(dict->attributes_by_name));
+	if (!attributes) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	values = dict_name_index_alloc(dict, fr_hash_table_num_elements(dict->values_by_alias));
+	if (!values) {
+		talloc_free(attributes);
+		goto oom;
+	}
+
+	fr_hash_table_walk(dict->attributes_by_name, _dict_attr_index_insert, attributes);
+	fr_hash_table_walk(dict->values_by_alias, _dict_enum_index_insert, values);
+
+	dict->attributes_by_name_index = attributes;
+	dict->values_by_alias_index = values;
+
+	return 0;
+}
+
 int fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename)
 {
 	INTERNAL_IF_NULL(dict);
@@ -3988,6 +4958,17 @@ fr_dict_attr_t const *fr_dict_attr_by_name_substr(fr_dict_t const *dict, char co
 		fr_strerror_printf("Attribute name too long");
 		return NULL;
 	}
+	if (dict->attributes_by_name_index) {
+		da = dict_attr_index_find(dict->attributes_by_name_index, *name, len);
+		if (!da) {
+			fr_strerror_printf("Unknown attribute '%.*s'", (int)len, *name);
+			return NULL;
+		}
+		*name = p;
+
+		return da;
+	}
+
 	strlcpy(find->name, *name, len + 1);
 
 	da = fr_hash_table_finddata(dict->attributes_by_name, find);
@@ -4019,6 +5000,10 @@ fr_dict_attr_t const *fr_dict_attr_by_name(fr_dict_t const *dict, char const *na
 	if (!name) return NULL;
 	INTERNAL_IF_NULL(dict);
 
+	if (dict->attributes_by_name_index) {
+		return dict_attr_index_find(dict->attributes_by_name_index, name, strlen(name));
+	}
+
 	da = (fr_dict_attr_t *)buffer;
 	strlcpy(da->name, name, FR_DICT_ATTR_MAX_NAME_LEN + 1);
 
@@ -4182,13 +5167,12 @@ fr_dict_enum_t *fr_dict_enum_by_value(fr_dict_t *dict, fr_dict_attr_t const *da,
 	 *	First, look up aliases.
 	 */
 	enumv.da = da;
-	enumv.alias = "";
 
 	/*
 	 *	Look up the attribute alias target, and use
 	 *	the correct attribute number if found.
 	 */
-	dv = fr_hash_table_finddata(dict->values_by_alias, &enumv);
+	dv = dict_enum_find_by_alias(dict, da, "");
 	if (dv) enumv.da = dv->da;
 
 	enumv.value = value;
@@ -4225,25 +5209,20 @@ char const *fr_dict_enum_alias_by_value(fr_dict_t *dict, fr_dict_attr_t const *d
  */
 fr_dict_enum_t *fr_dict_enum_by_alias(fr_dict_t *dict, fr_dict_attr_t const *da, char const *alias)
 {
-	fr_dict_enum_t find, *found;
-
-	memset(&find, 0, sizeof(find));
+	fr_dict_enum_t *found;
 
 	if (!alias) return NULL;
 
 	INTERNAL_IF_NULL(dict);
 
-	find.da = da;
-	find.alias = alias;
-
 	/*
 	 *	Look up the attribute alias target, and use
 	 *	the correct attribute number if found.
 	 */
-	found = fr_hash_table_finddata(dict->values_by_alias, &find);
-	if (found) find.da = found->da;
+	found = dict_enum_find_by_alias(dict, da, alias);
+	if (found) da = found->da;
 
-	return fr_hash_table_finddata(dict->values_by_alias, &find);
+	return dict_enum_find_by_alias(dict, da, alias);
 }
 
 /*
@@ -0,0 +1,329 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/util/pair_head.c
+ * @brief A VALUE_PAIR list head with O(1) append, and an attribute index.
+ *
+ *  fr_pair_add() has to walk the whole list to find the end, and
+ *  fr_pair_find_by_da() has to walk it to find the attribute.  Adding
+ *  and then looking up many attributes in a large list is therefore
+ *  quadratic.
+ *
+ *  The list head remembers the last VALUE_PAIR, so appending is O(1).
+ *  The first time the list is searched, we build a small open
+ *  addressing hash table of da -> first VALUE_PAIR with that da, so
+ *  searches are O(1), too.  Appending keeps the index up to date.
+ *  Anything else which modifies the list discards the tail and the
+ *  index, and they're found again when they're next needed.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/pair_head.h>
+
+/*
+ *	Lists shorter than this are just scanned.
+ */
+#define PAIR_INDEX_MIN		(8)
+
+typedef struct {
+	fr_dict_attr_t const	*da;
+	VALUE_PAIR		*vp;		//!< The first VALUE_PAIR with this da.
+} fr_pair_index_entry_t;
+
+struct fr_pair_index_s {
+	bool			valid;		//!< Whether the index matches the list.
+	uint32_t		size;		//!< Number of slots, always a power of 2.
+	uint32_t		used;		//!< Number of slots in use.
+	fr_pair_index_entry_t	*slots;
+};
+
+/** Hash a da
+ *
+ * The da is a pointer, so the low bits are always zero, and the
+ * high bits rarely change.  A multiplicative hash mixes the rest.
+ */
+static inline uint32_t pair_index_hash(fr_dict_attr_t const *da)
+{
+	return (uint32_t)(((uintptr_t) da >> 4) * 2654435761U);
+}
+
+/** Add the first VALUE_PAIR with a da to the index
+ *
+ * @return
+ *	- 0 on success, or if the da is already in the index.
+ *	- -1 if the index is too full.
+ */
+static int pair_index_insert(fr_pair_index_t *index, VALUE_PAIR *vp)
+{
+	uint32_t mask = index->size - 1;
+	uint32_t i;
+
+	for (i = pair_index_hash(vp->da) & mask;
+	     index->slots[i].da;
+	     i = (i + 1) & mask) {
+		if (index->slots[i].da == vp->da) return 0;
+	}
+
+	/*
+	 *	Keep at least half the slots free, so that
+	 *	collisions don't turn into long scans.
+	 */
+	if (((index->used + 1) * 2) > index->size) return -1;
+
+	index->slots[i].da = vp->da;
+	index->slots[i].vp = vp;
+	index->used++;
+
+	return 0;
+}
+
+/** Find the first VALUE_PAIR with a da in the index
+ *
+ */
+static inline VALUE_PAIR *pair_index_find(fr_pair_index_t const *index, fr_dict_attr_t const *da)
+{
+	uint32_t mask = index->size - 1;
+	uint32_t i;
+
+	for (i = pair_index_hash(da) & mask;
+	     index->slots[i].da;
+	     i = (i + 1) & mask) {
+		if (index->slots[i].da == da) return index->slots[i].vp;
+	}
+
+	return NULL;
+}
+
+/** Find the last VALUE_PAIR in the list, and count them
+ *
+ */
+static void pair_head_find_tail(fr_pair_head_t *list)
+{
+	VALUE_PAIR	*vp;
+	uint32_t	num = 1;
+
+	if (!list->head) {
+		list->num = 0;
+		return;
+	}
+
+	for (vp = list->head; vp->next; vp = vp->next) num++;
+
+	list->tail = vp;
+	list->num = num;
+}
+
+/** (Re)build the index for a list
+ *
+ * @return
+ *	- true if the list is indexed.
+ *	- false if the list is too short to bother, or we couldn't allocate memory.
+ */
+static bool pair_index_build(fr_pair_head_t *list)
+{
+	fr_pair_index_t	*index = list->index;
+	VALUE_PAIR	*vp;
+	uint32_t	size;
+
+	if (!list->tail) pair_head_find_tail(list);
+
+	if (list->num < PAIR_INDEX_MIN) return false;
+
+	/*
+	 *	Every VALUE_PAIR may have a different da, and the
+	 *	list may grow, so leave plenty of room.
+	 */
+	for (size = 16; size < (list->num * 4); size <<= 1);
+
+	if (!index) {
+		index = list->index = talloc_zero(list->ctx, fr_pair_index_t);
+		if (!index) return false;
+	}
+
+	if (index->size < size) {
+		talloc_free(index->slots);
+		index->slots = talloc_array(index, fr_pair_index_entry_t, size);
+		if (!index->slots) {
+			index->size = 0;
+			return false;
+		}
+		index->size = size;
+	}
+
+	memset(index->slots, 0, sizeof(index->slots[0]) * index->size);
+	index->used = 0;
+
+	for (vp = list->head; vp; vp = vp->next) {
+		VP_VERIFY(vp);
+		if (pair_index_insert(index, vp) < 0) {
+			index->valid = false;
+			return false;
+		}
+	}
+
+	index->valid = true;
+
+	return true;
+}
+
+/** Initialise a list head
+ *
+ * @param[in] ctx	to allocate the index in.  Usually the ctx the VALUE_PAIRs
+ *			are allocated in.
+ * @param[out] list	to initialise.
+ * @param[in] vps	existing list of VALUE_PAIRs, may be NULL.
+ */
+void fr_pair_head_init(TALLOC_CTX *ctx, fr_pair_head_t *list, VALUE_PAIR *vps)
+{
+	memset(list, 0, sizeof(*list));
+	list->ctx = ctx;
+	list->head = vps;
+}
+
+/** Get the list, so that it can be modified
+ *
+ * The tail and index are discarded, as we don't know what the caller
+ * will do with the list.
+ *
+ * @param[in] list	to return the VALUE_PAIRs of.
+ * @return a pointer to the first VALUE_PAIR in the list.
+ */
+VALUE_PAIR **fr_pair_head_list(fr_pair_head_t *list)
+{
+	list->tail = NULL;
+	list->num = 0;
+	if (list->index) list->index->valid = false;
+
+	return &list->head;
+}
+
+/** Initialise a cursor to iterate over, and modify the list
+ *
+ * @param[in] cursor	to initialise.
+ * @param[in] list	to iterate over.
+ * @return
+ *	- The first VALUE_PAIR in the list.
+ *	- NULL if the list is empty.
+ */
+VALUE_PAIR *fr_pair_head_cursor_init(fr_cursor_t *cursor, fr_pair_head_t *list)
+{
+	return fr_cursor_talloc_init(cursor, fr_pair_head_list(list), VALUE_PAIR);
+}
+
+/** Add a VALUE_PAIR, or a list of VALUE_PAIRs, to the end of the list
+ *
+ * @param[in] list	to add the VALUE_PAIR to.
+ * @param[in] vp	to add.
+ */
+void fr_pair_head_add(fr_pair_head_t *list, VALUE_PAIR *vp)
+{
+	bool indexed;
+
+	if (!vp) return;
+
+	VP_VERIFY(vp);
+
+	if (!list->head) {
+		list->head = vp;
+		list->num = 0;
+	} else {
+		if (!list->tail) pair_head_find_tail(list);
+		list->tail->next = vp;
+	}
+
+	indexed = list->index && list->index->valid;
+
+	for (;;) {
+		list->num++;
+
+		if (indexed && (pair_index_insert(list->index, vp) < 0)) {
+			list->index->valid = indexed = false;
+		}
+
+		if (!vp->next) break;
+		vp = vp->next;
+	}
+
+	list->tail = vp;
+}
+
+/** Find the first VALUE_PAIR with a matching da
+ *
+ * @param[in] list	to search.
+ * @param[in] da	to search for.
+ * @param[in] tag	to match. Either a tag number or TAG_ANY to match any tagged or
+ *			untagged attribute, TAG_NONE to match attributes without tags.
+ * @return
+ *	- The first matching VALUE_PAIR.
+ *	- NULL if no VALUE_PAIRs match.
+ */
+VALUE_PAIR *fr_pair_head_find_by_da(fr_pair_head_t *list, fr_dict_attr_t const *da, int8_t tag)
+{
+	VALUE_PAIR *vp;
+
+	if ((!list->index || !list->index->valid) && !pair_index_build(list)) {
+		return fr_pair_find_by_da(list->head, da, tag);
+	}
+
+	vp = pair_index_find(list->index, da);
+	if (!vp) return NULL;
+
+	if (!da->flags.has_tag) return vp;
+
+	/*
+	 *	The index only has the first VALUE_PAIR
+	 *	with the da, look for one with the tag.
+	 */
+	for (; vp; vp = vp->next) {
+		if ((vp->da == da) && TAG_EQ(tag, vp->tag)) return vp;
+	}
+
+	return NULL;
+}
+
+/** Take the VALUE_PAIRs out of the list, and free the index
+ *
+ * Used once the caller has finished adding to, and searching the list,
+ * to hand the VALUE_PAIRs on to something which expects a plain list.
+ *
+ * @param[in] list	to take the VALUE_PAIRs from.  It's empty afterwards.
+ * @return the first VALUE_PAIR in the list.
+ */
+VALUE_PAIR *fr_pair_head_release(fr_pair_head_t *list)
+{
+	VALUE_PAIR *vps = list->head;
+
+	TALLOC_FREE(list->index);
+	fr_pair_head_init(list->ctx, list, NULL);
+
+	return vps;
+}
+
+/** Free all VALUE_PAIRs in the list, and the index
+ *
+ * @param[in] list	to free.
+ */
+void fr_pair_head_free(fr_pair_head_t *list)
+{
+	fr_pair_list_free(fr_pair_head_list(list));
+	TALLOC_FREE(list->index);
+}
@@ -0,0 +1,376 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file util/trie.c
+ * @brief Path compressed binary trie, for longest prefix matches.
+ *
+ *  Each node holds a key prefix, and two children.  Runs of bits
+ *  where there is no branching are skipped, so a lookup visits at
+ *  most one node per branching point, and never more than (keylen + 1)
+ *  nodes.  For IPv4 that is at most 33 nodes, no matter how many
+ *  entries there are.
+ *
+ *  Readers don't take any locks.  The writer fully initializes new
+ *  nodes before linking them into the trie with a single release
+ *  store, so a reader sees either the old structure or the new one.
+ *  Nodes are never freed while the trie exists.  Removing an entry
+ *  just clears its data pointer, and the node is re-used if the same
+ *  prefix is inserted again.  The memory used is therefore bounded by
+ *  the number of distinct prefixes ever inserted, which is fine for
+ *  things like client lists.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/trie.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#define aquire(_var)		atomic_load_explicit(&_var, memory_order_acquire)
+#define store(_store, _var)	atomic_store_explicit(&_store, _var, memory_order_release)
+
+typedef struct fr_trie_node_t fr_trie_node_t;
+
+struct fr_trie_node_t {
+	_Atomic(fr_trie_node_t *) child[2];	//!< 0 and 1 branches.
+	_Atomic(void *)		data;		//!< user data, or NULL for branch-only nodes.
+	size_t			keylen;		//!< number of bits of "key" which are used.
+	uint8_t			key[];		//!< the prefix this node represents.
+};
+
+struct fr_trie_t {
+	fr_trie_node_t		*root;		//!< the zero length prefix.  Always exists.
+	uint32_t		num_elements;	//!< number of nodes with data.
+};
+
+/** Get one bit from a key
+ *
+ */
+static inline int trie_bit(uint8_t const *key, size_t bit)
+{
+	return (key[bit >> 3] >> (7 - (bit & 0x07))) & 0x01;
+}
+
+/** Return how many leading bits of two keys are the same
+ *
+ * @param[in] a		first key.
+ * @param[in] b		second key.
+ * @param[in] max	the maximum number of bits to compare.
+ * @return the number of matching bits, which is never more than max.
+ */
+static size_t trie_common(uint8_t const *a, uint8_t const *b, size_t max)
+{
+	size_t		bytes, i;
+	uint8_t		diff;
+
+	bytes = max >> 3;
+	for (i = 0; i < bytes; i++) {
+		if (a[i] != b[i]) break;
+	}
+
+	if (i == bytes) {
+		if (!(max & 0x07)) return max;
+	}
+
+	diff = a[i] ^ b[i];
+	if (!diff) return max;	/* remaining bits of a partial byte are the same */
+
+	i <<= 3;
+	while (!(diff & 0x80)) {
+		diff <<= 1;
+		i++;
+	}
+
+	if (i > max) return max;
+	return i;
+}
+
+/** Check whether a node's prefix matches the first bits of a key
+ *
+ */
+static inline bool trie_match(fr_trie_node_t const *node, uint8_t const *key)
+{
+	return (trie_common(node->key, key, node->keylen) == node->keylen);
+}
+
+/** Allocate a node
+ *
+ *  Only the first keylen bits of the key are copied.  The rest of the
+ *  bits in the last byte are set to zero.
+ */
+static fr_trie_node_t *trie_node_alloc(fr_trie_t *ft, uint8_t const *key, size_t keylen, void *data)
+{
+	fr_trie_node_t	*node;
+	size_t		bytes = (keylen + 7) >> 3;
+
+	node = talloc_zero_size(ft, sizeof(*node) + bytes);
+	if (!node) return NULL;
+	talloc_set_name_const(node, "fr_trie_node_t");
+
+	if (bytes) {
+		memcpy(node->key, key, bytes);
+		if (keylen & 0x07) node->key[bytes - 1] &= (uint8_t) (0xff << (8 - (keylen & 0x07)));
+	}
+	node->keylen = keylen;
+
+	atomic_init(&node->child[0], NULL);
+	atomic_init(&node->child[1], NULL);
+	atomic_init(&node->data, data);
+
+	return node;
+}
+
+/** Create a trie
+ *
+ * @param[in] ctx	to allocate the trie in.
+ * @return
+ *	- NULL on error.
+ *	- a new trie.
+ */
+fr_trie_t *fr_trie_create(TALLOC_CTX *ctx)
+{
+	fr_trie_t *ft;
+
+	ft = talloc_zero(ctx, fr_trie_t);
+	if (!ft) return NULL;
+
+	ft->root = trie_node_alloc(ft, NULL, 0, NULL);
+	if (!ft->root) {
+		talloc_free(ft);
+		return NULL;
+	}
+
+	return ft;
+}
+
+/** Insert a key and data into a trie
+ *
+ * @param[in] ft	the trie.
+ * @param[in] key	the key.
+ * @param[in] keylen	the number of bits of the key to use.
+ * @param[in] data	to associate with the key.  Must not be NULL.
+ * @return
+ *	- <0 on error, including when the key already exists.
+ *	- 0 on success.
+ */
+int fr_trie_insert(fr_trie_t *ft, void const *key, size_t keylen, void *data)
+{
+	uint8_t const		*k = key;
+	fr_trie_node_t		*node, *next, *new, *branch;
+	_Atomic(fr_trie_node_t *) *slot = NULL;
+	size_t			common;
+
+	if (!data) {
+		fr_strerror_printf("Cannot insert NULL data");
+		return -1;
+	}
+
+	node = ft->root;
+
+	while (true) {
+		common = trie_common(node->key, k, (node->keylen < keylen) ? node->keylen : keylen);
+
+		/*
+		 *	The key diverges from this node part way
+		 *	through the node's prefix.  Split the edge
+		 *	leading to the node.
+		 */
+		if (common < node->keylen) {
+			rad_assert(slot != NULL);
+
+			new = trie_node_alloc(ft, k, keylen, data);
+			if (!new) {
+			oom:
+				fr_strerror_printf("Out of memory");
+				return -1;
+			}
+
+			/*
+			 *	The new key is a prefix of this node.
+			 *	It goes in front of it.
+			 */
+			if (common == keylen) {
+				atomic_init(&new->child[trie_bit(node->key, keylen)], node);
+				store(*slot, new);
+				goto done;
+			}
+
+			/*
+			 *	Otherwise we need a branch node, with
+			 *	the new key on one side, and the old
+			 *	node on the other.
+			 */
+			branch = trie_node_alloc(ft, k, common, NULL);
+			if (!branch) {
+				talloc_free(new);
+				goto oom;
+			}
+
+			atomic_init(&branch->child[trie_bit(k, common)], new);
+			atomic_init(&branch->child[trie_bit(node->key, common)], node);
+			store(*slot, branch);
+			goto done;
+		}
+
+		/*
+		 *	This node is an exact match.  We re-use nodes
+		 *	which had their data removed.
+		 */
+		if (node->keylen == keylen) {
+			if (aquire(node->data) != NULL) {
+				fr_strerror_printf("Key already exists");
+				return -1;
+			}
+
+			store(node->data, data);
+			goto done;
+		}
+
+		/*
+		 *	This node is a prefix of the key.  Go down the
+		 *	correct branch, or add the key there.
+		 */
+		slot = &node->child[trie_bit(k, node->keylen)];
+		next = aquire(*slot);
+		if (!next) {
+			new = trie_node_alloc(ft, k, keylen, data);
+			if (!new) goto oom;
+
+			store(*slot, new);
+			goto done;
+		}
+
+		node = next;
+	}
+
+done:
+	ft->num_elements++;
+	return 0;
+}
+
+/** Find the node which exactly matches a key
+ *
+ */
+static fr_trie_node_t *trie_node_find(fr_trie_t const *ft, uint8_t const *key, size_t keylen)
+{
+	fr_trie_node_t *node = ft->root;
+
+	while (node && (node->keylen < keylen)) {
+		node = aquire(node->child[trie_bit(key, node->keylen)]);
+	}
+
+	if (!node || (node->keylen != keylen) || !trie_match(node, key)) return NULL;
+
+	return node;
+}
+
+/** Remove a key from a trie
+ *
+ * @param[in] ft	the trie.
+ * @param[in] key	the key.
+ * @param[in] keylen	the number of bits of the key to use.
+ * @return
+ *	- NULL if the key wasn't found.
+ *	- the data which was associated with the key.
+ */
+void *fr_trie_remove(fr_trie_t *ft, void const *key, size_t keylen)
+{
+	fr_trie_node_t	*node;
+	void		*data;
+
+	node = trie_node_find(ft, key, keylen);
+	if (!node) return NULL;
+
+	data = aquire(node->data);
+	if (!data) return NULL;
+
+	store(node->data, NULL);
+	ft->num_elements--;
+
+	return data;
+}
+
+/** Find the data for an exact key
+ *
+ * @param[in] ft	the trie.
+ * @param[in] key	the key.
+ * @param[in] keylen	the number of bits of the key to use.
+ * @return
+ *	- NULL if the key wasn't found.
+ *	- the data which is associated with the key.
+ */
+void *fr_trie_find(fr_trie_t const *ft, void const *key, size_t keylen)
+{
+	fr_trie_node_t *node;
+
+	node = trie_node_find(ft, key, keylen);
+	if (!node) return NULL;
+
+	return aquire(node->data);
+}
+
+/** Find the data for the longest prefix which matches a key
+ *
+ * @param[in] ft	the trie.
+ * @param[in] key	the key.
+ * @param[in] keylen	the number of bits of the key to use.  Only
+ *			prefixes of this length or shorter are matched.
+ * @return
+ *	- NULL if no prefix of the key was found.
+ *	- the data which is associated with the longest matching prefix.
+ */
+void *fr_trie_lookup(fr_trie_t const *ft, void const *key, size_t keylen)
+{
+	uint8_t const	*k = key;
+	fr_trie_node_t	*node = ft->root;
+	void		*data, *found = NULL;
+
+	while (node && (node->keylen <= keylen)) {
+		/*
+		 *	Nodes skip bits which don't branch, so we have
+		 *	to check that the skipped bits match.  If they
+		 *	don't, no longer prefix can match, either.
+		 */
+		if (!trie_match(node, k)) break;
+
+		data = aquire(node->data);
+		if (data) found = data;
+
+		if (node->keylen == keylen) break;
+
+		node = aquire(node->child[trie_bit(k, node->keylen)]);
+	}
+
+	return found;
+}
+
+/** Return the number of entries in the trie
+ *
+ */
+uint32_t fr_trie_num_elements(fr_trie_t const *ft)
+{
+	return ft->num_elements;
+}
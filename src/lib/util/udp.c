@@ -255,3 +255,242 @@ done:
 
 	return received;
 }
+
+/** Read a batch of UDP packets
+ *
+ * Where recvmmsg() is available, all of the datagrams are read with a
+ * single system call.  Otherwise we fall back to calling udp_recv()
+ * until the socket is drained, or the batch is full.
+ *
+ * Datagrams which can't be parsed (e.g. unknown address family) are
+ * returned with packet_len set to zero, and should be skipped by the
+ * caller.
+ *
+ * @param[in] sockfd	we're reading from.  MUST be non-blocking.
+ * @param[in,out] msgs	array of datagrams.  "data" and "data_len" must
+ *			be set by the caller.
+ * @param[in] num	number of entries in msgs.  Is limited to #UDP_MMSG_MAX,
+ *			or to one if #UDP_FLAGS_PEEK is set.
+ * @param[in] flags	for things.
+ * @return
+ *	- >= 0 the number of datagrams read.
+ *	- < 0 on failure.
+ */
+int udp_recv_mmsg(int sockfd, udp_mmsg_t *msgs, unsigned int num, int flags)
+{
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr		mmsg[UDP_MMSG_MAX];
+	struct iovec		iov[UDP_MMSG_MAX];
+	struct sockaddr_storage	src[UDP_MMSG_MAX];
+#  ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_MMSG_MAX][128];
+#  endif
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst = sizeof(dst);
+	struct timeval		now = { 0, 0 };
+	int			sock_flags = MSG_DONTWAIT;
+	int			received, i;
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	/*
+	 *	Every entry would get a copy of the same datagram.
+	 */
+	if ((flags & UDP_FLAGS_PEEK) != 0) {
+		sock_flags |= MSG_PEEK;
+		num = 1;
+	}
+
+	memset(mmsg, 0, sizeof(mmsg[0]) * num);
+	for (i = 0; i < (int) num; i++) {
+		iov[i].iov_base = msgs[i].data;
+		iov[i].iov_len = msgs[i].data_len;
+
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+
+		/*
+		 *	Connected sockets already know src/dst IP/port
+		 */
+		if ((flags & UDP_FLAGS_CONNECTED) != 0) continue;
+
+		mmsg[i].msg_hdr.msg_name = &src[i];
+		mmsg[i].msg_hdr.msg_namelen = sizeof(src[i]);
+#  ifdef WITH_UDPFROMTO
+		mmsg[i].msg_hdr.msg_control = cbuf[i];
+		mmsg[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+#  endif
+	}
+
+	received = recvmmsg(sockfd, mmsg, num, sock_flags, NULL);
+	if (received < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	The control messages don't give us the destination
+	 *	port, so get the bound address once for the whole batch.
+	 */
+	if (((flags & UDP_FLAGS_CONNECTED) == 0) &&
+	    (getsockname(sockfd, (struct sockaddr *)&dst, &sizeof_dst) < 0)) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < received; i++) {
+		udp_mmsg_t *m = &msgs[i];
+
+		m->packet_len = mmsg[i].msg_len;
+		m->if_index = 0;
+		m->when.tv_sec = 0;
+		m->when.tv_usec = 0;
+
+		if ((flags & UDP_FLAGS_CONNECTED) == 0) {
+			struct sockaddr_storage	to = dst;
+			socklen_t		sizeof_to = sizeof_dst;
+
+			if (fr_ipaddr_from_sockaddr(&src[i], mmsg[i].msg_hdr.msg_namelen,
+						    &m->src_ipaddr, &m->src_port) < 0) {
+				FR_DEBUG_STRERROR_PRINTF("Unknown address family");
+				m->packet_len = 0;
+				continue;
+			}
+
+#  ifdef WITH_UDPFROMTO
+			udpfromto_cmsg_get(&mmsg[i].msg_hdr, (struct sockaddr *)&to, &sizeof_to,
+					   &m->if_index, &m->when);
+#  endif
+			fr_ipaddr_from_sockaddr(&to, sizeof_to, &m->dst_ipaddr, &m->dst_port);
+		}
+
+		if (!m->when.tv_sec) {
+			if (!now.tv_sec) gettimeofday(&now, NULL);
+			m->when = now;
+		}
+	}
+
+	return received;
+#else
+	int i;
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+	if ((flags & UDP_FLAGS_PEEK) != 0) num = 1;
+
+	for (i = 0; i < (int) num; i++) {
+		ssize_t received;
+		udp_mmsg_t *m = &msgs[i];
+
+		received = udp_recv(sockfd, m->data, m->data_len, flags,
+				    &m->src_ipaddr, &m->src_port,
+				    &m->dst_ipaddr, &m->dst_port,
+				    &m->if_index, &m->when);
+		if (received < 0) {
+			if (i > 0) break;	/* return what we have */
+			return -1;
+		}
+		if (received == 0) break;
+
+		m->packet_len = received;
+	}
+
+	return i;
+#endif
+}
+
+/** Write a batch of UDP packets
+ *
+ * Where sendmmsg() is available, all of the datagrams are written with
+ * a single system call.  Otherwise we fall back to calling udp_send()
+ * for each packet.
+ *
+ * @param[in] sockfd	we're writing to.
+ * @param[in] msgs	array of datagrams to write.
+ * @param[in] num	number of entries in msgs.  Is limited to #UDP_MMSG_MAX.
+ * @param[in] flags	for things.
+ * @return
+ *	- >= 0 the number of datagrams written.  This may be less than num
+ *	  if the socket buffer is full.
+ *	- < 0 on failure.
+ */
+int udp_send_mmsg(int sockfd, udp_mmsg_t *msgs, unsigned int num, int flags)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr		mmsg[UDP_MMSG_MAX];
+	struct iovec		iov[UDP_MMSG_MAX];
+	struct sockaddr_storage	dst[UDP_MMSG_MAX];
+#  ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_MMSG_MAX][128];
+#  endif
+	int			sent, i;
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	memset(mmsg, 0, sizeof(mmsg[0]) * num);
+	for (i = 0; i < (int) num; i++) {
+		udp_mmsg_t *m = &msgs[i];
+
+		iov[i].iov_base = m->data;
+		iov[i].iov_len = m->data_len;
+
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+
+		if ((flags & UDP_FLAGS_CONNECTED) != 0) continue;
+
+		if (fr_ipaddr_to_sockaddr(&m->dst_ipaddr, m->dst_port,
+					  &dst[i], &mmsg[i].msg_hdr.msg_namelen) < 0) return -1;
+		mmsg[i].msg_hdr.msg_name = &dst[i];
+
+#  ifdef WITH_UDPFROMTO
+		/*
+		 *	And if they don't specify a source IP address, don't
+		 *	use udpfromto.
+		 */
+		if ((m->src_ipaddr.af != AF_UNSPEC) && (m->dst_ipaddr.af != AF_UNSPEC) &&
+		    !fr_ipaddr_is_inaddr_any(&m->src_ipaddr)) {
+			struct sockaddr_storage	src;
+			socklen_t		sizeof_src;
+
+			fr_ipaddr_to_sockaddr(&m->src_ipaddr, m->src_port, &src, &sizeof_src);
+
+			if (udpfromto_cmsg_set(sockfd, &mmsg[i].msg_hdr, cbuf[i], sizeof(cbuf[i]),
+					       (struct sockaddr *)&src, sizeof_src, m->if_index) < 0) {
+				fr_strerror_printf("udp_sendmmsg failed: %s", fr_syserror(errno));
+				return -1;
+			}
+		}
+#  endif
+	}
+
+	sent = sendmmsg(sockfd, mmsg, num, 0);
+	if (sent < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("udp_sendmmsg failed: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return sent;
+#else
+	int i;
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	for (i = 0; i < (int) num; i++) {
+		udp_mmsg_t *m = &msgs[i];
+
+		if (udp_send(sockfd, m->data, m->data_len, flags,
+			     &m->src_ipaddr, m->src_port, m->if_index,
+			     &m->dst_ipaddr, m->dst_port) < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) break;
+			if (i > 0) break;	/* report what we've written */
+			return -1;
+		}
+	}
+
+	return i;
+#endif
+}
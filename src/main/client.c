@@ -30,19 +30,30 @@ RCSID("$Id$")
 #include <freeradius-devel/cf_parse.h>
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/modules.h>
+#include <freeradius-devel/trie.h>
 
 #include <sys/stat.h>
 
 #include <ctype.h>
 #include <fcntl.h>
 
+#ifdef WITH_TCP
+#  define CLIENT_TRIE_MAX	(3)		//!< IPPROTO_IP (any), IPPROTO_UDP, IPPROTO_TCP
+#else
+#  define CLIENT_TRIE_MAX	(1)
+#endif
+
 /** Group of clients
  *
+ *  Clients are kept in longest prefix match tries, one for each
+ *  address family and protocol.  Lookups don't need locks, so the
+ *  network threads can search a list while dynamic clients are being
+ *  added to, or removed from it.
  */
 struct radclient_list {
 	char const	*name;			//!< Name of the client list.
-	rbtree_t	*trees[129];		//!< For 0..128, inclusive.
-	uint32_t       	min_prefix;
+	fr_trie_t	*v4[CLIENT_TRIE_MAX];	//!< IPv4 clients, by protocol.
+	fr_trie_t	*v6[CLIENT_TRIE_MAX];	//!< IPv6 clients, by protocol.
 };
 
 #ifdef WITH_STATS
@@ -68,30 +79,102 @@ void client_free(RADCLIENT *client)
 	talloc_free(client);
 }
 
-/** Compare clients by IP address
+/** Return which trie holds clients for a protocol
  *
  */
-static int client_ipaddr_cmp(void const *one, void const *two)
+static inline int client_trie_index(UNUSED int proto)
 {
-	RADCLIENT const *a = one;
-	RADCLIENT const *b = two;
-#ifndef WITH_TCP
+#ifdef WITH_TCP
+	switch (proto) {
+	case IPPROTO_UDP:
+		return 1;
 
-	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-#else
-	int rcode;
+	case IPPROTO_TCP:
+		return 2;
 
-	rcode = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-	if (rcode != 0) return rcode;
+	default:
+		break;
+	}
+#endif
 
-	/*
-	 *	Wildcard match
-	 */
-	if ((a->proto == IPPROTO_IP) ||
-	    (b->proto == IPPROTO_IP)) return 0;
+	return 0;
+}
 
-	return (a->proto - b->proto);
-#endif
+/** Return the tries and key for an IP address
+ *
+ * @param[in] clients	to search.
+ * @param[in] ipaddr	to get the key from.
+ * @param[out] key	the address, in network byte order.
+ * @return
+ *	- NULL if the address family isn't supported.
+ *	- the array of tries for the address family.
+ */
+static fr_trie_t **client_tries(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, uint8_t const **key)
+{
+	RADCLIENT_LIST *list;
+
+	memcpy(&list, &clients, sizeof(list)); /* const issues */
+
+	switch (ipaddr->af) {
+	case AF_INET:
+		*key = (uint8_t const *) &ipaddr->addr.v4.s_addr;
+		return list->v4;
+
+	case AF_INET6:
+		*key = ipaddr->addr.v6.s6_addr;
+		return list->v6;
+
+	default:
+		return NULL;
+	}
+}
+
+/** Search the tries which can hold clients for a protocol
+ *
+ *  Clients with proto IPPROTO_IP match any protocol, and a search for
+ *  IPPROTO_IP matches clients of any protocol.  Where more than one
+ *  trie has a match, the longest prefix wins.
+ *
+ *  IPv6 scope IDs are not part of the key.
+ *
+ * @param[in] clients	to search.
+ * @param[in] ipaddr	to search for.
+ * @param[in] prefix	the maximum prefix length to match.
+ * @param[in] proto	the protocol of the client.
+ * @param[in] exact	only return clients with exactly "prefix" bits.
+ * @return
+ *	- NULL if no client was found.
+ *	- the client.
+ */
+static RADCLIENT *client_trie_search(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
+				     uint8_t prefix, int proto, bool exact)
+{
+	fr_trie_t	**tries;
+	uint8_t const	*key;
+	RADCLIENT	*client, *found = NULL;
+	int		i, want;
+
+	tries = client_tries(clients, ipaddr, &key);
+	if (!tries) return NULL;
+
+	want = client_trie_index(proto);
+
+	for (i = 0; i < CLIENT_TRIE_MAX; i++) {
+		if ((i != 0) && (want != 0) && (i != want)) continue;
+
+		if (!tries[i]) continue;
+
+		if (exact) {
+			client = fr_trie_find(tries[i], key, prefix);
+		} else {
+			client = fr_trie_lookup(tries[i], key, prefix);
+		}
+		if (!client) continue;
+
+		if (!found || (client->ipaddr.prefix > found->ipaddr.prefix)) found = client;
+	}
+
+	return found;
 }
 
 #ifdef WITH_STATS
@@ -121,7 +204,6 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 	if (!clients) return NULL;
 
 	clients->name = talloc_strdup(clients, cs ? cf_section_name1(cs) : "root");
-	clients->min_prefix = 128;
 
 	return clients;
 }
@@ -137,6 +219,9 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
 	RADCLIENT *old;
+	fr_trie_t **tries;
+	uint8_t const *key;
+	int i;
 	char buffer[FR_IPADDR_PREFIX_STRLEN];
 
 	if (!client) return false;
@@ -220,11 +305,15 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	}
 
 	/*
-	 *	Create a tree for it.
+	 *	Create a trie for it.
 	 */
-	if (!clients->trees[client->ipaddr.prefix]) {
-		clients->trees[client->ipaddr.prefix] = rbtree_create(clients, client_ipaddr_cmp, NULL, 0);
-		if (!clients->trees[client->ipaddr.prefix]) {
+	tries = client_tries(clients, &client->ipaddr, &key);
+	if (!tries) return false;
+
+	i = client_trie_index(client->proto);
+	if (!tries[i]) {
+		tries[i] = fr_trie_create(clients);
+		if (!tries[i]) {
 			return false;
 		}
 	}
@@ -234,7 +323,7 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	/*
 	 *	Cannot insert the same client twice.
 	 */
-	old = rbtree_finddata(clients->trees[client->ipaddr.prefix], client);
+	old = client_trie_search(clients, &client->ipaddr, client->ipaddr.prefix, client->proto, true);
 	if (old) {
 		/*
 		 *	If it's a complete duplicate, then free the new
@@ -259,7 +348,7 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	/*
 	 *	Other error adding client: likely is fatal.
 	 */
-	if (!rbtree_insert(clients->trees[client->ipaddr.prefix], client)) {
+	if (fr_trie_insert(tries[i], key, client->ipaddr.prefix, client) < 0) {
 		return false;
 	}
 
@@ -273,10 +362,6 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	if (tree_num) rbtree_insert(tree_num, client);
 #endif
 
-	if (client->ipaddr.prefix < clients->min_prefix) {
-		clients->min_prefix = client->ipaddr.prefix;
-	}
-
 	(void) talloc_steal(clients, client); /* reparent it */
 
 	return true;
@@ -286,6 +371,10 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_DYNAMIC_CLIENTS
 void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
+	fr_trie_t **tries;
+	uint8_t const *key;
+	int i;
+
 	if (!client) return;
 
 	if (!clients) clients = root_clients;
@@ -295,7 +384,18 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_STATS
 	rbtree_deletebydata(tree_num, client);
 #endif
-	rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
+	tries = client_tries(clients, &client->ipaddr, &key);
+	if (!tries) return;
+
+	i = client_trie_index(client->proto);
+	if (!tries[i]) return;
+
+	/*
+	 *	Only remove it if it's the client we were given.
+	 */
+	if (fr_trie_find(tries[i], key, client->ipaddr.prefix) != client) return;
+
+	(void) fr_trie_remove(tries[i], key, client->ipaddr.prefix);
 }
 #endif
 
@@ -335,8 +435,7 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
  */
 RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
-	int32_t i, max_prefix;
-	RADCLIENT myclient;
+	int32_t max_prefix;
 
 	if (!clients) clients = root_clients;
 
@@ -361,20 +460,7 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 	 */
 	if (ipaddr->prefix < max_prefix) max_prefix = ipaddr->prefix;
 
-	for (i = max_prefix; i >= (int32_t) clients->min_prefix; i--) {
-		void *data;
-
-		if (!clients->trees[i]) continue;
-
-		myclient.ipaddr = *ipaddr;
-		myclient.proto = proto;
-		fr_ipaddr_mask(&myclient.ipaddr, i);
-
-		data = rbtree_finddata(clients->trees[i], &myclient);
-		if (data) return data;
-	}
-
-	return NULL;
+	return client_trie_search(clients, ipaddr, max_prefix, proto, false);
 }
 
 static fr_ipaddr_t cl_ipaddr;
@@ -512,6 +512,7 @@ void fr_connection_signal_open(fr_connection_t *conn)
 
 	switch (conn->state) {
 	case FR_CONNECTION_STATE_CONNECTING:
+		fr_event_timer_delete(conn->el, &conn->connection_timer);
 		DEBUG2("Connection established");
 		STATE_TRANSITION(FR_CONNECTION_STATE_CONNECTED);
 		return;
@@ -147,6 +147,9 @@ static const CONF_PARSER log_config[] = {
 static const CONF_PARSER thread_config[] = {
 	{ FR_CONF_POINTER("num_networks", FR_TYPE_UINT32, &main_config.num_networks), .dflt = STRINGIFY(1) },
 	{ FR_CONF_POINTER("num_workers", FR_TYPE_UINT32, &main_config.num_workers), .dflt = STRINGIFY(4) },
+	{ FR_CONF_POINTER("network_cpus", FR_TYPE_STRING, &main_config.network_cpus) },
+	{ FR_CONF_POINTER("worker_cpus", FR_TYPE_STRING, &main_config.worker_cpus) },
+	{ FR_CONF_POINTER("numa", FR_TYPE_BOOL, &main_config.numa), .dflt = "no" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -895,10 +898,8 @@ do {\
 
 	FR_TIMEVAL_BOUND_CHECK("reject_delay", &main_config.reject_delay, <=, main_config.cleanup_delay, 0);
 
-	/*
-	 *	For now we don't do connected sockets.
-	 */
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", main_config.num_networks, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", main_config.num_networks, >, 0);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", main_config.num_networks, <=, 64);
 	FR_INTEGER_BOUND_CHECK("thread.num_workers", main_config.num_workers, >, 0);
 	FR_INTEGER_BOUND_CHECK("thread.num_workers", main_config.num_workers, <, 1024);
 
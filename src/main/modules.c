@@ -542,6 +542,7 @@ static int _module_thread_instantiate(void *instance, void *ctx)
 	module_instance_t		*mod_inst = talloc_get_type_abort(instance, module_instance_t);
 	module_thread_instance_t	*thread_inst;
 	_thread_intantiate_ctx_t	*thread_inst_ctx = ctx;
+	CONF_SECTION			*pool_cs;
 	int				ret;
 
 	MEM(thread_inst = talloc_zero(NULL, module_thread_instance_t));
@@ -562,6 +563,22 @@ static int _module_thread_instantiate(void *instance, void *ctx)
 
 	}
 
+	/*
+	 *	If the module has a thread_local connection pool,
+	 *	give this thread its own slice of it.
+	 */
+	pool_cs = cf_section_find(mod_inst->dl_inst->conf, "pool", NULL);
+	if (pool_cs) {
+		fr_pool_t *pool;
+
+		pool = cf_data_value(cf_data_find(pool_cs, fr_pool_t, NULL));
+		if (pool && (fr_pool_thread_instantiate(thread_inst, pool) < 0)) {
+			PERROR("Failed creating thread slice of connection pool for module \"%s\"",
+			       mod_inst->name);
+			return -1;
+		}
+	}
+
 	if (mod_inst->module->thread_instantiate) {
 		ret = mod_inst->module->thread_instantiate(mod_inst->dl_inst->conf, mod_inst->dl_inst->data,
 							   thread_inst_ctx->el, thread_inst->data);
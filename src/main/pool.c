@@ -32,8 +32,16 @@ RCSID("$Id$")
 #include <freeradius-devel/heap.h>
 #include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/io/time.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
 
 typedef struct fr_pool_connection fr_pool_connection_t;
+typedef struct fr_pool_thread fr_pool_thread_t;
 
 static int connection_check(fr_pool_t *pool, REQUEST *request);
 
@@ -65,11 +73,50 @@ struct fr_pool_connection {
 
 	bool		needs_reconnecting;	//!< Reconnect this connection before use.
 
+	fr_pool_thread_t	*owner;		//!< Thread slice the connection belongs to.  NULL if
+						//!< the connection is shared, and lives in the heap.
+	fr_pool_thread_t	*holder;	//!< Thread slice which has the connection reserved.
+	fr_dlist_t	entry;			//!< Entry in the owner's free list, or the holder's
+						//!< reserved list.
+
 #ifdef PTHREAD_DEBUG
 	pthread_t	pthread_id;		//!< When 'in_use == true'.
 #endif
 };
 
+/** A thread's slice of a connection pool
+ *
+ * In thread_local mode each worker owns the connections it opened, and
+ * reserves and releases them without touching the pool mutex.  The slice
+ * mutex is only contended when another thread borrows from us.
+ *
+ * @see fr_pool_t
+ */
+struct fr_pool_thread {
+	fr_pool_t	*pool;			//!< Pool this slice belongs to.  NULL if the pool
+						//!< was freed before the thread exited.
+	fr_dlist_t	entry;			//!< Entry in the pool's list of slices.
+	fr_dlist_t	thread_entry;		//!< Entry in the thread's list of slices.
+
+	pthread_mutex_t	mutex;			//!< Protects the free list, and the in_use flag
+						//!< of owned connections.
+	fr_dlist_t	free;			//!< Idle connections owned by this slice.
+	fr_dlist_t	reserved;		//!< Connections reserved by this thread.  Only
+						//!< ever touched by the thread itself.
+
+	uint32_t	num;			//!< Connections owned by this slice.  Protected by
+						//!< the pool mutex.
+	_Atomic(uint32_t) active;		//!< Connections reserved by this thread.
+
+	struct timeval	last_released;		//!< Last time an owned connection was released.
+	time_t		last_held_min;		//!< Last time we warned about a low latency event.
+	time_t		last_held_max;		//!< Last time we warned about a high latency event.
+
+#ifdef WITH_STATS
+	fr_stats_t	held_stats;		//!< How long owned connections were held for.
+#endif
+};
+
 /** A connection pool
  *
  * Defines the configuration of the connection pool, all the counters and
@@ -106,6 +153,8 @@ struct fr_pool {
 	bool		spread;			//!< If true we spread requests over the connections,
 						//!< using the connection released longest ago, first.
 
+	bool		thread_local;		//!< Give each thread its own slice of the pool.
+
 	fr_heap_t	*heap;			//!< For the next connection heap
 
 	fr_pool_connection_t	*head;		//!< Start of the connection list.
@@ -140,8 +189,12 @@ struct fr_pool {
 	fr_pool_reconnect_t	reconnect;	//!< Called during connection pool reconnect.
 
 	fr_pool_state_t	state;			//!< Stats and state of the connection pool.
+
+	fr_dlist_t	slices;			//!< Thread slices, in thread_local mode.
 };
 
+fr_thread_local_setup(fr_dlist_t *, pool_thread_slices)	/* macro */
+
 static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("start", FR_TYPE_UINT32, fr_pool_t, start), .dflt = "5" },
 	{ FR_CONF_OFFSET("min", FR_TYPE_UINT32, fr_pool_t, min), .dflt = "5" },
@@ -158,6 +211,7 @@ static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", FR_TYPE_TIMEVAL, fr_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", FR_TYPE_UINT32, fr_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", FR_TYPE_BOOL, fr_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("thread_local", FR_TYPE_BOOL, fr_pool_t, thread_local), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -246,6 +300,123 @@ static void connection_link_head(fr_pool_t *pool, fr_pool_connection_t *this)
 	}
 }
 
+/** Find the calling thread's slice of a connection pool
+ *
+ * @param[in] pool	to find the slice for.
+ * @return
+ *	- The thread's slice.
+ *	- NULL if the pool isn't thread local, or this thread has no slice.
+ */
+static fr_pool_thread_t *connection_thread_find(fr_pool_t *pool)
+{
+	fr_dlist_t *head = pool_thread_slices, *entry;
+
+	if (!pool->thread_local || !head) return NULL;
+
+	/*
+	 *	Threads only have slices for the handful of pools
+	 *	their modules use, so a linear search is fine.
+	 */
+	for (entry = FR_DLIST_FIRST((*head)); entry; entry = FR_DLIST_NEXT((*head), entry)) {
+		fr_pool_thread_t *slice = fr_ptr_to_type(fr_pool_thread_t, thread_entry, entry);
+
+		if (slice->pool == pool) return slice;
+	}
+
+	return NULL;
+}
+
+/** Mark a connection as reserved by a thread
+ *
+ * @note Must be called with the mutex protecting the connection's
+ *	in_use flag held, i.e. the owner's mutex, or the pool mutex
+ *	for shared connections.
+ *
+ * @param[in] slice	of the thread reserving the connection.
+ * @param[in] this	Connection to reserve.
+ */
+static void connection_hold(fr_pool_thread_t *slice, fr_pool_connection_t *this)
+{
+	this->in_use = true;
+	this->holder = slice;
+	fr_dlist_insert_tail(&slice->reserved, &this->entry);
+	atomic_fetch_add_explicit(&slice->active, 1, memory_order_relaxed);
+}
+
+/** Remove the first idle connection from a slice's free list, and reserve it
+ *
+ * @note Must be called with the slice mutex held.
+ *
+ * @param[in] slice	to take the connection from.
+ * @param[in] holder	slice of the thread reserving the connection.
+ * @return
+ *	- A connection.
+ *	- NULL if the slice has no idle connections.
+ */
+static fr_pool_connection_t *connection_pop(fr_pool_thread_t *slice, fr_pool_thread_t *holder)
+{
+	fr_dlist_t		*entry;
+	fr_pool_connection_t	*this;
+
+	entry = FR_DLIST_FIRST(slice->free);
+	if (!entry) return NULL;
+
+	this = fr_ptr_to_type(fr_pool_connection_t, entry, entry);
+	fr_dlist_remove(entry);
+	connection_hold(holder, this);
+
+	return this;
+}
+
+/** Return a released connection to its owner's free list
+ *
+ * Recently released connections go to the head of the list, so busy
+ * threads keep reusing the same few connections, and the rest age out
+ * via idle_timeout.  With spread, they go to the tail, so the
+ * connection released longest ago is used first.
+ *
+ * @note Must be called with the slice mutex held.
+ *
+ * @param[in] pool	the slice belongs to.
+ * @param[in] slice	owning the connection.
+ * @param[in] this	Connection to return.
+ */
+static void connection_push(fr_pool_t *pool, fr_pool_thread_t *slice, fr_pool_connection_t *this)
+{
+	this->in_use = false;
+
+	slice->last_released = this->last_released;
+	fr_stats_bins(&slice->held_stats, &this->last_reserved, &this->last_released);
+
+	if (pool->spread) {
+		fr_dlist_insert_tail(&slice->free, &this->entry);
+	} else {
+		fr_dlist_insert_head(&slice->free, &this->entry);
+	}
+}
+
+/** Count the connections currently reserved
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	to count reserved connections in.
+ * @return the number of reserved connections, including those reserved
+ *	by threads from their slices.
+ */
+static uint32_t connection_active(fr_pool_t *pool)
+{
+	uint32_t	active = pool->state.active;
+	fr_dlist_t	*entry;
+
+	for (entry = FR_DLIST_FIRST(pool->slices); entry; entry = FR_DLIST_NEXT(pool->slices, entry)) {
+		fr_pool_thread_t *slice = fr_ptr_to_type(fr_pool_thread_t, entry, entry);
+
+		active += atomic_load_explicit(&slice->active, memory_order_relaxed);
+	}
+
+	return active;
+}
+
 /** Send a connection pool trigger.
  *
  * @param[in] pool	to send trigger for.
@@ -312,6 +483,34 @@ static fr_pool_connection_t *connection_find(fr_pool_t *pool, void *conn)
 	return NULL;
 }
 
+/** Find a connection handle in the calling thread's reserved list
+ *
+ * @note Must be called by the thread owning the slice.
+ *
+ * @param[in] slice	of the calling thread.
+ * @param[in] conn	handle to search for.
+ * @return
+ *	- Connection containing the specified handle.
+ *	- NULL if the connection wasn't reserved from the slice.
+ */
+static fr_pool_connection_t *connection_find_reserved(fr_pool_thread_t *slice, void *conn)
+{
+	fr_dlist_t *entry;
+
+	if (!conn) return NULL;
+
+	for (entry = FR_DLIST_FIRST(slice->reserved); entry; entry = FR_DLIST_NEXT(slice->reserved, entry)) {
+		fr_pool_connection_t *this = fr_ptr_to_type(fr_pool_connection_t, entry, entry);
+
+		if (this->connection == conn) {
+			rad_assert(this->in_use == true);
+			return this;
+		}
+	}
+
+	return NULL;
+}
+
 /** Spawns a new connection
  *
  * Spawns a new connection using the create callback, and returns it for
@@ -475,6 +674,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	this->created = now;
 	this->connection = conn;
 	this->in_use = in_use;
+	FR_DLIST_INIT(this->entry);
 
 	this->number = number;
 	gettimeofday(&this->last_reserved, NULL);
@@ -525,6 +725,67 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	return this;
 }
 
+/** Free a connection which has already been removed from the heap and slice lists
+ *
+ * @note Will call the 'close' trigger.
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	to modify.
+ * @param[in] request	The current request.
+ * @param[in] this	Connection to free.
+ */
+static void connection_free(fr_pool_t *pool, REQUEST *request, fr_pool_connection_t *this)
+{
+	fr_pool_trigger_exec(pool, request, "close");
+
+	connection_unlink(pool, this);
+
+	if (this->owner) {
+		rad_assert(this->owner->num > 0);
+		this->owner->num--;
+	}
+
+	rad_assert(pool->state.num > 0);
+	pool->state.num--;
+	talloc_free(this);
+}
+
+/** Close an idle connection
+ *
+ * Connections owned by a thread slice may be reserved by their owner
+ * without the pool mutex, so we check again under the slice mutex.
+ *
+ * @note Will call the 'close' trigger.
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	to modify.
+ * @param[in] request	The current request.
+ * @param[in] this	Connection to close.
+ * @return
+ *	- true if the connection was closed.
+ *	- false if the connection was in use.
+ */
+static bool connection_close_idle(fr_pool_t *pool, REQUEST *request, fr_pool_connection_t *this)
+{
+	if (this->owner) {
+		pthread_mutex_lock(&this->owner->mutex);
+		if (this->in_use) {
+			pthread_mutex_unlock(&this->owner->mutex);
+			return false;
+		}
+		fr_dlist_remove(&this->entry);
+		pthread_mutex_unlock(&this->owner->mutex);
+	} else {
+		if (this->in_use) return false;
+
+		fr_heap_extract(pool->heap, this);
+	}
+
+	connection_free(pool, request, this);
+
+	return true;
+}
+
 /** Close an existing connection.
  *
  * Removes the connection from the list, calls the delete callback to close
@@ -532,6 +793,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
  *
  * @note Will call the 'close' trigger.
  * @note Must be called with the mutex held.
+ * @note In use connections may only be closed by the thread which reserved them.
  *
  * @param[in] pool	to modify.
  * @param[in] request	The current request.
@@ -550,23 +812,65 @@ static void connection_close_internal(fr_pool_t *pool, REQUEST *request, fr_pool
 
 		this->in_use = false;
 
-		rad_assert(pool->state.active != 0);
-		pool->state.active--;
+		if (this->holder) {
+			fr_dlist_remove(&this->entry);
+			atomic_fetch_sub_explicit(&this->holder->active, 1, memory_order_relaxed);
+			this->holder = NULL;
+		} else {
+			rad_assert(pool->state.active != 0);
+			pool->state.active--;
+		}
 
-	} else {
-		/*
-		 *	Connection isn't used, remove it from the heap.
-		 */
-		fr_heap_extract(pool->heap, this);
+		connection_free(pool, request, this);
+		return;
 	}
 
-	fr_pool_trigger_exec(pool, request, "close");
+	(void) connection_close_idle(pool, request, this);
+}
 
-	connection_unlink(pool, this);
+/** Check whether a connection has hit any of its limits
+ *
+ * Checks that the connection is within idle_timeout, max_uses, and
+ * lifetime values.
+ *
+ * @param[in] pool	the connection belongs to.
+ * @param[in] request	The current request.
+ * @param[in] this	Connection to check.
+ * @param[in] now	Current time.
+ * @return
+ *	- true if the connection should be closed.
+ *	- false if the connection is still usable.
+ */
+static bool connection_expired(fr_pool_t *pool, REQUEST *request, fr_pool_connection_t *this, time_t now)
+{
+	if (this->needs_reconnecting) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): Needs reconnecting",
+			  this->number);
+		return true;
+	}
 
-	rad_assert(pool->state.num > 0);
-	pool->state.num--;
-	talloc_free(this);
+	if ((pool->max_uses > 0) &&
+	    (this->num_uses >= pool->max_uses)) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): Hit max_uses limit",
+			  this->number);
+		return true;
+	}
+
+	if ((pool->lifetime > 0) &&
+	    ((this->created + pool->lifetime) < now)) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): Hit lifetime limit",
+			  this->number);
+		return true;
+	}
+
+	if ((pool->idle_timeout > 0) &&
+	    ((this->last_released.tv_sec + pool->idle_timeout) < now)) {
+		ROPTIONAL(RINFO, INFO, "Closing connection (%" PRIu64 "): Hit idle_timeout, was idle for %u seconds",
+		     	  this->number, (int) (now - this->last_released.tv_sec));
+		return true;
+	}
+
+	return false;
 }
 
 /** Check whether a connection needs to be removed from the pool
@@ -595,39 +899,13 @@ static int connection_manage(fr_pool_t *pool, REQUEST *request, fr_pool_connecti
 	 */
 	if (this->in_use) return 1;
 
-	if (this->needs_reconnecting) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): Needs reconnecting",
-			  this->number);
-	do_delete:
-		if (pool->state.num <= pool->min) {
-			ROPTIONAL(RDEBUG2, DEBUG2, "You probably need to lower \"min\"");
-		}
-		connection_close_internal(pool, request, this);
-		return 0;
-	}
-
-	if ((pool->max_uses > 0) &&
-	    (this->num_uses >= pool->max_uses)) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): Hit max_uses limit",
-			  this->number);
-		goto do_delete;
-	}
-
-	if ((pool->lifetime > 0) &&
-	    ((this->created + pool->lifetime) < now)) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): Hit lifetime limit",
-			  this->number);
-		goto do_delete;
-	}
+	if (!connection_expired(pool, request, this, now)) return 1;
 
-	if ((pool->idle_timeout > 0) &&
-	    ((this->last_released.tv_sec + pool->idle_timeout) < now)) {
-		ROPTIONAL(RINFO, INFO, "Closing connection (%" PRIu64 "): Hit idle_timeout, was idle for %u seconds",
-		     	  this->number, (int) (now - this->last_released.tv_sec));
-		goto do_delete;
+	if (pool->state.num <= pool->min) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "You probably need to lower \"min\"");
 	}
 
-	return 1;
+	return connection_close_idle(pool, request, this) ? 0 : 1;
 }
 
 
@@ -647,7 +925,7 @@ static int connection_manage(fr_pool_t *pool, REQUEST *request, fr_pool_connecti
  */
 static int connection_check(fr_pool_t *pool, REQUEST *request)
 {
-	uint32_t spawn, idle, extra;
+	uint32_t spawn, idle, extra, active;
 	time_t now = time(NULL);
 	fr_pool_connection_t *this, *next;
 
@@ -661,7 +939,8 @@ static int connection_check(fr_pool_t *pool, REQUEST *request)
 	 *	configured "spare" range.  Any extra connections
 	 *	outside of that range can be closed.
 	 */
-	idle = pool->state.num - pool->state.active;
+	active = connection_active(pool);
+	idle = (pool->state.num > active) ? pool->state.num - active : 0;
 	if (idle <= pool->spare) {
 		extra = 0;
 	} else {
@@ -771,7 +1050,7 @@ static int connection_check(fr_pool_t *pool, REQUEST *request)
 
 		ROPTIONAL(RDEBUG, DEBUG, "Closing connection (%" PRIu64 "), from %d unused connections",
 			  found->number, extra);
-		connection_close_internal(pool, request, found);
+		if (!connection_close_idle(pool, request, found)) goto done;	/* Reserved by its owner */
 
 		/*
 		 *	Decrease the delay for the next time we clean up.
@@ -797,6 +1076,148 @@ done:
 	return 1;
 }
 
+/** Get a connection from the calling thread's slice of the pool
+ *
+ * Tries, in order:
+ *	- An idle connection owned by this thread, without the pool mutex.
+ *	- A shared connection from the heap, which this thread then adopts.
+ *	- A new connection, if the slice is below its share of "max".
+ *	- An idle connection borrowed from another thread's slice.
+ *	- A new connection, if the pool is below "max".
+ *
+ * @note Must be called with the mutex free.
+ *
+ * @param[in] pool	to reserve the connection from.
+ * @param[in] slice	of the calling thread.
+ * @param[in] request	The current request.
+ * @param[in] spawn	whether to spawn a new connection
+ * @return
+ *	- A pointer to the connection handle.
+ *	- NULL on error.
+ */
+static void *connection_get_thread(fr_pool_t *pool, fr_pool_thread_t *slice, REQUEST *request, bool spawn)
+{
+	time_t			now = time(NULL);
+	fr_pool_connection_t	*this;
+	fr_dlist_t		*entry;
+	uint32_t		share;
+
+	for (;;) {
+		pthread_mutex_lock(&slice->mutex);
+		this = connection_pop(slice, slice);
+		pthread_mutex_unlock(&slice->mutex);
+
+		if (!this) break;
+		if (!connection_expired(pool, request, this, now)) goto do_return;
+
+		pthread_mutex_lock(&pool->mutex);
+		connection_close_internal(pool, request, this);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
+	/*
+	 *	Connections opened before any threads existed, or
+	 *	spawned as spares, are shared.  Adopt one.
+	 */
+	do {
+		this = fr_heap_peek(pool->heap);
+		if (!this) break;
+	} while (!connection_manage(pool, request, this, now));
+
+	if (this) {
+		fr_heap_extract(pool->heap, this);
+		this->owner = slice;
+		slice->num++;
+		connection_hold(slice, this);
+		pthread_mutex_unlock(&pool->mutex);
+		goto do_return;
+	}
+
+	/*
+	 *	Only borrow once we've used up our share of "max".
+	 */
+	share = (pool->max + pool->state.threads - 1) / pool->state.threads;
+	if (spawn && (slice->num < share) && ((pool->state.num + pool->state.pending) < pool->max)) goto do_spawn;
+
+	for (entry = FR_DLIST_FIRST(pool->slices); entry; entry = FR_DLIST_NEXT(pool->slices, entry)) {
+		fr_pool_thread_t *other = fr_ptr_to_type(fr_pool_thread_t, entry, entry);
+
+		if (other == slice) continue;
+
+		/*
+		 *	If the other thread is using its slice,
+		 *	leave it alone.
+		 */
+		if (pthread_mutex_trylock(&other->mutex) != 0) continue;
+		this = connection_pop(other, slice);
+		pthread_mutex_unlock(&other->mutex);
+
+		if (!this) continue;
+
+		if (connection_expired(pool, request, this, now)) {
+			connection_close_internal(pool, request, this);
+			continue;
+		}
+
+		pool->state.borrowed++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		ROPTIONAL(RDEBUG3, DEBUG3, "No idle connections in local slice, borrowed connection (%" PRIu64 ")",
+			  this->number);
+		goto do_return;
+	}
+
+	if (pool->state.num == pool->max) {
+		bool complain = false;
+
+		/*
+		 *	Rate-limit complaints.
+		 */
+		if (pool->state.last_at_max != now) {
+			complain = true;
+			pool->state.last_at_max = now;
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+		if (!RATE_LIMIT_ENABLED || complain) {
+			ROPTIONAL(RERROR, ERROR, "No connections available and at max connection limit");
+			fr_pool_trigger_exec(pool, request, "none");
+		}
+
+		return NULL;
+	}
+
+do_spawn:
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!spawn) return NULL;
+
+	/*
+	 *	Returns unlocked on failure, or locked on success
+	 */
+	this = connection_spawn(pool, request, now, true, false);
+	if (!this) return NULL;
+
+	this->owner = slice;
+	slice->num++;
+	connection_hold(slice, this);
+	pthread_mutex_unlock(&pool->mutex);
+
+do_return:
+	this->num_uses++;
+	gettimeofday(&this->last_reserved, NULL);
+
+#ifdef PTHREAD_DEBUG
+	this->pthread_id = pthread_self();
+#endif
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
+
+	return this->connection;
+}
+
 /** Get a connection from the connection pool
  *
  * @note Must be called with the mutex free.
@@ -812,9 +1233,13 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 {
 	time_t now;
 	fr_pool_connection_t *this;
+	fr_pool_thread_t *slice;
 
 	if (!pool) return NULL;
 
+	slice = connection_thread_find(pool);
+	if (slice) return connection_get_thread(pool, slice, request, spawn);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	now = time(NULL);
@@ -981,6 +1406,7 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	pool->alive = a;
 
 	pool->head = pool->tail = NULL;
+	FR_DLIST_INIT(pool->slices);
 
 	/*
 	 *	We keep a heap of connections, sorted by the last time
@@ -1001,7 +1427,7 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	 *	https://code.facebook.com/posts/1499322996995183/solving-the-mystery-of-link-imbalance-a-metastable-failure-state-at-scale/
 	 */
 	if (!pool->spread) {
-		pool->heap = fr_heap_create(last_reserved_cmp, offsetof(fr_pool_t, heap));
+		pool->heap = fr_heap_create(last_reserved_cmp, offsetof(fr_pool_connection_t, heap));
 	/*
 	 *	For some types of connections we need to used a different
 	 *	algorithm, because load balancing benefits are secondary
@@ -1021,7 +1447,7 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	 *	That way we maximise time between connection use.
 	 */
 	} else {
-		pool->heap = fr_heap_create(last_released_cmp, offsetof(fr_pool_t, heap));
+		pool->heap = fr_heap_create(last_released_cmp, offsetof(fr_pool_connection_t, heap));
 	}
 	if (!pool->heap) {
 		ERROR("%s: Failed creating connection heap", __FUNCTION__);
@@ -1134,14 +1560,166 @@ fr_pool_t *fr_pool_copy(TALLOC_CTX *ctx, fr_pool_t *pool, void *opaque)
 	return copy;
 }
 
-/** Get the number of connections currently in the pool
+/** Free a thread's list of pool slices on thread exit
  *
- * @param[in] pool to count connections for.
- * @return the number of connections in the pool
+ * The slices themselves are freed with the thread's module instance data,
+ * possibly after this list, so just unlink them.
  */
-fr_pool_state_t const *fr_pool_state(fr_pool_t *pool)
+static void _pool_thread_slices_free(void *to_free)
 {
-	return &pool->state;
+	fr_dlist_t *head = to_free, *entry;
+
+	while ((entry = FR_DLIST_FIRST((*head))) != NULL) fr_dlist_remove(entry);
+
+	talloc_free(head);
+}
+
+/** Hand a slice's connections back to the pool when its thread exits
+ *
+ * Idle connections go back into the heap, where other threads can adopt
+ * them.  Connections other threads have borrowed go back into the heap
+ * when they're released.
+ */
+static int _pool_thread_free(fr_pool_thread_t *slice)
+{
+	fr_pool_t		*pool = slice->pool;
+	fr_pool_connection_t	*this;
+
+	fr_dlist_remove(&slice->thread_entry);
+
+	if (pool) {
+		pthread_mutex_lock(&pool->mutex);
+		fr_dlist_remove(&slice->entry);
+		pool->state.threads--;
+
+		pthread_mutex_lock(&slice->mutex);
+		for (this = pool->head; this != NULL; this = this->next) {
+			rad_assert(this->holder != slice);
+
+			if (this->owner != slice) continue;
+
+			this->owner = NULL;
+			if (this->in_use) continue;
+
+			fr_dlist_remove(&this->entry);
+			fr_heap_insert(pool->heap, this);
+		}
+		slice->num = 0;
+		pthread_mutex_unlock(&slice->mutex);
+
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	pthread_mutex_destroy(&slice->mutex);
+
+	return 0;
+}
+
+/** Give the calling thread its own slice of a connection pool
+ *
+ * Should be called from a module's thread_instantiate callback.  Does
+ * nothing if the pool isn't configured with thread_local, or if the
+ * thread already has a slice of the pool (pools can be shared between
+ * modules).
+ *
+ * Connections the thread opens are owned by its slice, and can be
+ * reserved and released without locking the pool.  Other threads only
+ * borrow them when their own slice is exhausted.
+ *
+ * @param[in] ctx	to allocate the slice in.  Should be freed before
+ *			the thread exits.
+ * @param[in] pool	to create the slice for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_pool_thread_instantiate(TALLOC_CTX *ctx, fr_pool_t *pool)
+{
+	fr_dlist_t		*head;
+	fr_pool_thread_t	*slice;
+
+	if (!pool->thread_local) return 0;
+	if (connection_thread_find(pool)) return 0;
+
+	head = pool_thread_slices;
+	if (!head) {
+		head = talloc(NULL, fr_dlist_t);
+		if (!head) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		FR_DLIST_INIT((*head));
+		fr_thread_local_set_destructor(pool_thread_slices, _pool_thread_slices_free, head);
+	}
+
+	slice = talloc_zero(ctx, fr_pool_thread_t);
+	if (!slice) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	slice->pool = pool;
+	pthread_mutex_init(&slice->mutex, NULL);
+	FR_DLIST_INIT(slice->free);
+	FR_DLIST_INIT(slice->reserved);
+	atomic_init(&slice->active, 0);
+	talloc_set_destructor(slice, _pool_thread_free);
+
+	fr_dlist_insert_tail(head, &slice->thread_entry);
+
+	pthread_mutex_lock(&pool->mutex);
+	fr_dlist_insert_tail(&pool->slices, &slice->entry);
+	pool->state.threads++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+/** Get a snapshot of the pool's state
+ *
+ * The state is copied under the pool mutex, so it's consistent even if
+ * other threads are using the pool.  In thread_local mode the counters
+ * of all the thread slices are aggregated into the copy.
+ *
+ * @param[out] out	Where to write the pool's state.
+ * @param[in] pool	to get the state of.
+ */
+void fr_pool_state(fr_pool_state_t *out, fr_pool_t *pool)
+{
+	fr_dlist_t *entry;
+
+	pthread_mutex_lock(&pool->mutex);
+	*out = pool->state;
+	if (!pool->thread_local) {
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+
+	/*
+	 *	Fold the counters kept by each thread's slice
+	 *	into the copy.
+	 */
+	for (entry = FR_DLIST_FIRST(pool->slices); entry; entry = FR_DLIST_NEXT(pool->slices, entry)) {
+		fr_pool_thread_t *slice = fr_ptr_to_type(fr_pool_thread_t, entry, entry);
+
+		out->active += atomic_load_explicit(&slice->active, memory_order_relaxed);
+
+		pthread_mutex_lock(&slice->mutex);
+		if (fr_timeval_cmp(&slice->last_released, &out->last_released) > 0) {
+			out->last_released = slice->last_released;
+		}
+#ifdef WITH_STATS
+		{
+			size_t i;
+
+			for (i = 0; i < (sizeof(slice->held_stats.elapsed) / sizeof(*slice->held_stats.elapsed)); i++) {
+				out->held_stats.elapsed[i] += slice->held_stats.elapsed[i];
+			}
+		}
+#endif
+		pthread_mutex_unlock(&slice->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
 }
 
 /** Connection pool get timeout
@@ -1288,6 +1866,7 @@ int fr_pool_reconnect(fr_pool_t *pool, REQUEST *request)
 void fr_pool_free(fr_pool_t *pool)
 {
 	fr_pool_connection_t *this;
+	fr_dlist_t *entry;
 
 	if (!pool) return;
 
@@ -1314,6 +1893,17 @@ void fr_pool_free(fr_pool_t *pool)
 		connection_close_internal(pool, NULL, this);
 	}
 
+	/*
+	 *	Threads which haven't exited yet still have slices,
+	 *	stop them referencing the pool.
+	 */
+	while ((entry = FR_DLIST_FIRST(pool->slices)) != NULL) {
+		fr_pool_thread_t *slice = fr_ptr_to_type(fr_pool_thread_t, entry, entry);
+
+		fr_dlist_remove(entry);
+		slice->pool = NULL;
+	}
+
 	talloc_free(pool->heap);
 
 	fr_pool_trigger_exec(pool, NULL, "stop");
@@ -1354,6 +1944,82 @@ void *fr_pool_connection_get(fr_pool_t *pool, REQUEST *request)
 	return connection_get_internal(pool, request, true);
 }
 
+/** Release a connection reserved from a thread's slice
+ *
+ * Connections owned by the calling thread go back on its free list
+ * without touching the pool mutex.  Borrowed connections, or those
+ * whose owner has exited, need the pool mutex to stop the owning
+ * slice being freed under us.
+ *
+ * @param[in] pool	to release the connection in.
+ * @param[in] slice	of the calling thread.
+ * @param[in] request	The current request.
+ * @param[in] this	Connection to release.
+ */
+static void connection_release_thread(fr_pool_t *pool, fr_pool_thread_t *slice, REQUEST *request,
+				      fr_pool_connection_t *this)
+{
+	struct timeval	held;
+	bool		trigger_min = false, trigger_max = false;
+
+	fr_dlist_remove(&this->entry);
+	this->holder = NULL;
+	atomic_fetch_sub_explicit(&slice->active, 1, memory_order_relaxed);
+
+	gettimeofday(&this->last_released, NULL);
+	fr_timeval_subtract(&held, &this->last_released, &this->last_reserved);
+
+	/*
+	 *	Check we've not exceeded out trigger limits
+	 */
+	if ((pool->held_trigger_min.tv_sec || pool->held_trigger_min.tv_usec) &&
+	    (fr_timeval_cmp(&held, &pool->held_trigger_min) < 0) &&
+	    (slice->last_held_min != this->last_released.tv_sec)) {
+		trigger_min = true;
+		slice->last_held_min = this->last_released.tv_sec;
+	}
+
+	if ((pool->held_trigger_max.tv_sec || pool->held_trigger_max.tv_usec) &&
+	    (fr_timeval_cmp(&held, &pool->held_trigger_max) > 0) &&
+	    (slice->last_held_max != this->last_released.tv_sec)) {
+		trigger_max = true;
+		slice->last_held_max = this->last_released.tv_sec;
+	}
+
+	if (this->owner == slice) {
+		pthread_mutex_lock(&slice->mutex);
+		connection_push(pool, slice, this);
+		pthread_mutex_unlock(&slice->mutex);
+	} else {
+		pthread_mutex_lock(&pool->mutex);
+		if (this->owner) {
+			pthread_mutex_lock(&this->owner->mutex);
+			connection_push(pool, this->owner, this);
+			pthread_mutex_unlock(&this->owner->mutex);
+		} else {
+			this->in_use = false;
+			pool->state.last_released = this->last_released;
+			fr_stats_bins(&pool->state.held_stats, &this->last_reserved, &this->last_released);
+			fr_heap_insert(pool->heap, this);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
+
+	/*
+	 *	connection_check() only does work once a second, so
+	 *	don't take the mutex to find that out.
+	 */
+	if (pool->state.last_checked != this->last_released.tv_sec) {
+		pthread_mutex_lock(&pool->mutex);
+		connection_check(pool, request);
+	}
+
+	if (trigger_min) fr_pool_trigger_exec(pool, request, "min");
+	if (trigger_max) fr_pool_trigger_exec(pool, request, "max");
+}
+
 /** Release a connection
  *
  * Will mark a connection as unused and decrement the number of active
@@ -1367,9 +2033,19 @@ void *fr_pool_connection_get(fr_pool_t *pool, REQUEST *request)
 void fr_pool_connection_release(fr_pool_t *pool, REQUEST *request, void *conn)
 {
 	fr_pool_connection_t *this;
+	fr_pool_thread_t *slice;
 	struct timeval	held;
 	bool trigger_min = false, trigger_max = false;
 
+	slice = connection_thread_find(pool);
+	if (slice) {
+		this = connection_find_reserved(slice, conn);
+		if (this) {
+			connection_release_thread(pool, slice, request, this);
+			return;
+		}
+	}
+
 	this = connection_find(pool, conn);
 	if (!this) return;
 
@@ -1361,6 +1361,11 @@ int main(int argc, char **argv)
 		fr_log_perror(&default_log, L_ERR, "Failed to initialize the dictionaries");
 		return 1;
 	}
+
+	if (fr_dict_freeze(dict) < 0) {
+		fr_perror("radclient");
+		return 1;
+	}
 	fr_strerror();	/* Clear the error buffer */
 
 	/*
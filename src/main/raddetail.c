@@ -0,0 +1,392 @@
+/*
+ * raddetail.c	Convert text detail files to binary detail files.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+#include <freeradius-devel/radius/radius.h>
+
+#include <fcntl.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	Text detail entries are printed one attribute per line, so
+ *	lines are never very long.
+ */
+#define MAX_LINE_LEN	(16384)
+
+/** An entry read from a text detail file
+ *
+ */
+typedef struct {
+	fr_radius_detail_t	detail;
+	VALUE_PAIR		*vps;
+	bool			done;		//!< The detail file reader has already processed it.
+	int			lineno;		//!< Of the entry header.
+} rd_entry_t;
+
+typedef struct {
+	uint64_t		converted;
+	uint64_t		skipped;
+} rd_stats_t;
+
+static char const *raddetail_version = RADIUSD_VERSION_STRING_BUILD("raddetail");
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "Usage: raddetail [options] <input> <output>\n");
+
+	fprintf(stderr, "  <input>                Text detail file to read, or '-' for stdin.\n");
+	fprintf(stderr, "  <output>               Binary detail file to create.  It must not exist.\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -h                     Print usage help information.\n");
+	fprintf(stderr, "  -t <type>              Packet-Type of entries which don't have one (defaults to Accounting-Request).\n");
+	fprintf(stderr, "  -v                     Show program version information.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+/** Parse one attribute line of an entry
+ *
+ * Lines which we don't understand are ignored, the same as the detail
+ * file reader does.
+ */
+static void entry_add_line(rd_entry_t *entry, char const *line, int lineno)
+{
+	VALUE_PAIR *vp = NULL;
+
+	/*
+	 *	Skip this for backwards compatability.
+	 */
+	if (strncasecmp(line, "Request-Authenticator", 21) == 0) return;
+
+	/*
+	 *	When we wrote the entry.  The detail file reader
+	 *	uses this to update Acct-Delay-Time.
+	 */
+	if (strncasecmp(line, "Timestamp = ", 12) == 0) {
+		entry->detail.timestamp.tv_sec = strtoul(line + 12, NULL, 10);
+		return;
+	}
+
+	/*
+	 *	The detail file reader overwrites "Timestamp" with
+	 *	"Done" once the entry has been processed.
+	 */
+	if (strncasecmp(line, "Donestamp", 9) == 0) {
+		entry->done = true;
+		return;
+	}
+
+	if ((fr_pair_list_afrom_str(entry, line, &vp) <= 0) || !vp) {
+		fprintf(stderr, "raddetail: Ignoring line %d: %s\n", lineno, line);
+		fr_pair_list_free(&vp);
+		return;
+	}
+
+	/*
+	 *	Packet-Type and the original src/dst ip/port go in
+	 *	the record header.
+	 */
+	if ((vp->da->vendor == 0) && !vp->next) switch (vp->da->attr) {
+	case FR_PACKET_TYPE:
+		entry->detail.code = vp->vp_uint32;
+		goto free;
+
+	case FR_PACKET_SRC_IP_ADDRESS:
+	case FR_PACKET_SRC_IPV6_ADDRESS:
+		entry->detail.src_ipaddr = vp->vp_ip;
+		goto free;
+
+	case FR_PACKET_DST_IP_ADDRESS:
+	case FR_PACKET_DST_IPV6_ADDRESS:
+		entry->detail.dst_ipaddr = vp->vp_ip;
+		goto free;
+
+	case FR_PACKET_SRC_PORT:
+		entry->detail.src_port = vp->vp_uint16;
+		goto free;
+
+	case FR_PACKET_DST_PORT:
+		entry->detail.dst_port = vp->vp_uint16;
+	free:
+		fr_pair_list_free(&vp);
+		return;
+
+	default:
+		break;
+	}
+
+	fr_pair_add(&entry->vps, vp);
+}
+
+/** Write an entry to the binary detail file, and free it
+ *
+ */
+static int entry_write(rd_entry_t **entry_p, int fd, unsigned int default_code,
+		       uint8_t *buffer, rd_stats_t *stats)
+{
+	rd_entry_t	*entry = *entry_p;
+	ssize_t		len;
+
+	if (!entry) return 0;
+	*entry_p = NULL;
+
+	if (entry->done || !entry->vps) {
+		if (fr_debug_lvl > 0) {
+			printf("Skipping %s entry at line %d\n", entry->done ? "processed" : "empty", entry->lineno);
+		}
+		stats->skipped++;
+		talloc_free(entry);
+		return 0;
+	}
+
+	if (!entry->detail.code) entry->detail.code = default_code;
+
+	len = fr_radius_detail_encode(buffer, FR_RADIUS_DETAIL_MAX_LEN, &entry->detail, entry->vps);
+	if (len < 0) {
+		fr_perror("raddetail: Failed encoding entry at line %d", entry->lineno);
+		talloc_free(entry);
+		return -1;
+	}
+
+	if (write(fd, buffer, len) != len) {
+		fprintf(stderr, "raddetail: Failed writing entry at line %d: %s\n", entry->lineno, fr_syserror(errno));
+		talloc_free(entry);
+		return -1;
+	}
+
+	if (fr_debug_lvl > 0) printf("Converted entry at line %d (%zd bytes)\n", entry->lineno, len);
+
+	stats->converted++;
+	talloc_free(entry);
+
+	return 0;
+}
+
+/** Read a text detail file, and write each entry as a binary record
+ *
+ */
+static int detail_convert(TALLOC_CTX *ctx, FILE *in, int fd, unsigned int default_code, rd_stats_t *stats)
+{
+	char		line[MAX_LINE_LEN];
+	int		lineno = 0;
+	rd_entry_t	*entry = NULL;
+	uint8_t		*buffer;
+
+	buffer = talloc_array(ctx, uint8_t, FR_RADIUS_DETAIL_MAX_LEN);
+	if (!buffer) {
+		fprintf(stderr, "raddetail: Out of memory\n");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		char *p;
+
+		lineno++;
+
+		p = strchr(line, '\n');
+		if (!p) {
+			if (!feof(in)) {
+				fprintf(stderr, "raddetail: Line %d is too long\n", lineno);
+			error:
+				talloc_free(entry);
+				talloc_free(buffer);
+				return -1;
+			}
+		} else {
+			*p = '\0';
+		}
+
+		/*
+		 *	A blank line ends the entry.
+		 */
+		if (!line[0]) {
+			if (entry_write(&entry, fd, default_code, buffer, stats) < 0) goto error;
+			continue;
+		}
+
+		/*
+		 *	Anything which doesn't start with a tab is
+		 *	the header of the next entry.
+		 */
+		if (line[0] != '\t') {
+			if (entry_write(&entry, fd, default_code, buffer, stats) < 0) goto error;
+
+			entry = talloc_zero(ctx, rd_entry_t);
+			if (!entry) {
+				fprintf(stderr, "raddetail: Out of memory\n");
+				goto error;
+			}
+			entry->lineno = lineno;
+			continue;
+		}
+
+		if (!entry) {
+			fprintf(stderr, "raddetail: Malformed line %d, expected an entry header\n", lineno);
+			goto error;
+		}
+
+		entry_add_line(entry, line + 1, lineno);
+	}
+
+	if (ferror(in)) {
+		fprintf(stderr, "raddetail: Failed reading input: %s\n", fr_syserror(errno));
+		goto error;
+	}
+
+	if (entry_write(&entry, fd, default_code, buffer, stats) < 0) goto error;
+
+	talloc_free(buffer);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, fd;
+	char const		*radius_dir = RADDBDIR;
+	char const		*dict_dir = DICTDIR;
+	char const		*type = "Accounting-Request";
+	fr_dict_t		*dict = NULL;
+	fr_dict_attr_t const	*da;
+	fr_dict_enum_t const	*type_enum;
+	FILE			*in;
+	rd_stats_t		stats;
+	int			ret;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	fr_debug_lvl = 0;
+	fr_log_fp = stdout;
+
+	talloc_set_log_stderr();
+
+	while ((c = getopt(argc, argv, "d:D:ht:vx")) != EOF) switch (c) {
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 't':
+			type = optarg;
+			break;
+
+		case 'v':
+			printf("%s\n", raddetail_version);
+			exit(0);
+
+		case 'x':
+			fr_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= (optind - 1);
+	argv += (optind - 1);
+
+	if (argc != 3) usage();
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_from_file(NULL, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_read(dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("raddetail: Failed to initialize the dictionaries");
+		return 1;
+	}
+
+	if (fr_dict_freeze(dict) < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	da = fr_dict_attr_by_num(NULL, 0, FR_PACKET_TYPE);
+	if (!da) {
+		fprintf(stderr, "raddetail: Missing definition for Packet-Type\n");
+		return 1;
+	}
+
+	type_enum = fr_dict_enum_by_alias(NULL, da, type);
+	if (!type_enum || !is_radius_code(type_enum->value->vb_uint32)) {
+		fprintf(stderr, "raddetail: Invalid Packet-Type '%s'\n", type);
+		return 1;
+	}
+
+	if (strcmp(argv[1], "-") == 0) {
+		in = stdin;
+	} else {
+		in = fopen(argv[1], "r");
+		if (!in) {
+			fprintf(stderr, "raddetail: Failed opening %s: %s\n", argv[1], fr_syserror(errno));
+			return 1;
+		}
+	}
+
+	/*
+	 *	Detail files often contain private information,
+	 *	so use the same permissions as rlm_detail.
+	 */
+	fd = open(argv[2], O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "raddetail: Failed creating %s: %s\n", argv[2], fr_syserror(errno));
+		if (in != stdin) fclose(in);
+		return 1;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	ret = detail_convert(autofree, in, fd, type_enum->value->vb_uint32, &stats);
+
+	if (in != stdin) fclose(in);
+	if (close(fd) < 0) {
+		fprintf(stderr, "raddetail: Failed writing %s: %s\n", argv[2], fr_syserror(errno));
+		ret = -1;
+	}
+
+	if (ret < 0) {
+		unlink(argv[2]);
+		return 1;
+	}
+
+	printf("Converted %" PRIu64 " entries, skipped %" PRIu64 "\n", stats.converted, stats.skipped);
+
+	return 0;
+}
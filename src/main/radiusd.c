@@ -558,6 +558,17 @@ int main(int argc, char *argv[])
 	 */
 	if (modules_instantiate(main_config.config) < 0) exit(EXIT_FAILURE);
 
+	/*
+	 *	All attributes and enum values have now been defined,
+	 *	so index their names for the text based decoders.
+	 *	This must happen before any threads are started, and
+	 *	nothing can be added to the dictionary afterwards.
+	 */
+	if (fr_dict_freeze(main_config.dict) < 0) {
+		PERROR("Failed freezing dictionary");
+		exit(EXIT_FAILURE);
+	}
+
 	/*
 	 *  Everything seems to have loaded OK, exit gracefully.
 	 */
@@ -598,6 +609,12 @@ int main(int argc, char *argv[])
 		int networks = main_config.num_networks;
 		int workers = main_config.num_workers;
 		fr_event_list_t *el = NULL;
+		fr_schedule_config_t schedule_config = {
+			.network_cpus = main_config.network_cpus,
+			.worker_cpus = main_config.worker_cpus,
+			.numa = main_config.numa,
+			.max_request_time = main_config.max_request_time
+		};
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -611,10 +628,11 @@ int main(int argc, char *argv[])
 		}
 
 		sc = fr_schedule_create(NULL, el, &default_log, rad_debug_lvl,
-					networks, workers,
+					networks, workers, &schedule_config,
 					(fr_schedule_thread_instantiate_t) modules_thread_instantiate,
 					main_config.config);
 		if (!sc) {
+			PERROR("Failed starting threads");
 			exit(EXIT_FAILURE);
 		}
 
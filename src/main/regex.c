@@ -27,6 +27,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/io/time.h>
 
 #ifdef HAVE_REGEX
 
@@ -39,6 +40,31 @@ typedef struct regcapture {
 	size_t		nmatch;		//!< Number of match vectors.
 } regcapture_t;
 
+/** A pattern compiled at runtime, and kept for reuse
+ *
+ */
+typedef struct regex_cache_entry {
+	fr_dlist_t	entry;		//!< In the LRU list, most recently used first.
+	char		*pattern;	//!< Pattern text.  May contain embedded \0s.
+	size_t		len;		//!< Length of the pattern.
+	bool		ignore_case;	//!< Compilation flags.
+	bool		multiline;
+	bool		subcaptures;
+	regex_t		*preg;		//!< Compiled pattern.
+} regex_cache_entry_t;
+
+/** A thread's cache of compiled patterns
+ *
+ */
+typedef struct regex_cache {
+	rbtree_t	*tree;		//!< Entries, keyed by pattern and flags.
+	fr_dlist_t	lru;		//!< Entries, most recently used first.
+	uint64_t	hits;		//!< Patterns found in the cache.
+	uint64_t	misses;		//!< Patterns which had to be compiled.
+} regex_cache_t;
+
+fr_thread_local_setup(regex_cache_t *, regex_cache)	/* macro */
+
 /** Adds subcapture values to request data
  *
  * Allows use of %{n} expansions.
@@ -94,6 +120,13 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value, s
 	if (!(*preg)->precompiled) {
 		new_sc->preg = talloc_steal(new_sc, *preg);
 		*preg = NULL;
+	/*
+	 *	The cache may evict the pattern while the captures
+	 *	still need it, so they hold a reference.  If the
+	 *	entry is freed, the pattern is passed to us.
+	 */
+	} else if (talloc_get_type(talloc_parent(*preg), regex_cache_entry_t)) {
+		new_sc->preg = talloc_reference(new_sc, *preg);
 	} else
 #endif
 	{
@@ -103,6 +136,149 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value, s
 	request_data_add(request, request, REQUEST_DATA_REGEX, new_sc, true, false, false);
 }
 
+static int regex_cache_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->ignore_case > b->ignore_case) - (a->ignore_case < b->ignore_case);
+	if (ret != 0) return ret;
+
+	ret = (a->multiline > b->multiline) - (a->multiline < b->multiline);
+	if (ret != 0) return ret;
+
+	ret = (a->subcaptures > b->subcaptures) - (a->subcaptures < b->subcaptures);
+	if (ret != 0) return ret;
+
+	ret = (a->len > b->len) - (a->len < b->len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->pattern, b->pattern, a->len);
+}
+
+/** Free the thread's regex cache when the thread exits
+ *
+ */
+static void _regex_cache_free(void *to_free)
+{
+	talloc_free(to_free);
+}
+
+/** Compile a pattern, or find it in this thread's regex cache
+ *
+ * Patterns produced by expansions at runtime are usually drawn from a
+ * small set, i.e. a list of realms, so there's no need to compile them
+ * for every request.  Each thread keeps up to #REGEX_CACHE_MAX of the
+ * patterns it has compiled, and discards the least recently used ones
+ * to make room for new patterns.
+ *
+ * Cached patterns are studied (and with PCRE, JIT compiled) as
+ * if they'd been compiled at startup.
+ *
+ * @note The compiled pattern is owned by the cache, and MUST NOT be freed.
+ *	It's only valid until the next call to this function.
+ *
+ * @param[out] out		Where to write the compiled pattern.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] ignore_case	Whether to do case insensitive matching.
+ * @param[in] multiline		If true $ matches newlines.
+ * @param[in] subcaptures	Whether to store subcapture data.
+ * @return as #regex_compile.
+ */
+ssize_t regex_cache_compile(regex_t **out, char const *pattern, size_t len,
+			    bool ignore_case, bool multiline, bool subcaptures)
+{
+	regex_cache_t		*cache = regex_cache;
+	regex_cache_entry_t	find, *found;
+	fr_dlist_t		*entry;
+	ssize_t			slen;
+
+	if (!cache) {
+		MEM(cache = talloc_zero(NULL, regex_cache_t));
+		MEM(cache->tree = rbtree_create(cache, regex_cache_cmp, NULL, RBTREE_FLAG_NONE));
+		FR_DLIST_INIT(cache->lru);
+		fr_thread_local_set_destructor(regex_cache, _regex_cache_free, cache);
+	}
+
+	memcpy(&find.pattern, &pattern, sizeof(find.pattern));
+	find.len = len;
+	find.ignore_case = ignore_case;
+	find.multiline = multiline;
+	find.subcaptures = subcaptures;
+
+	found = rbtree_finddata(cache->tree, &find);
+	if (found) {
+		cache->hits++;
+
+		fr_dlist_remove(&found->entry);
+		fr_dlist_insert_head(&cache->lru, &found->entry);
+
+		*out = found->preg;
+		return len;
+	}
+	cache->misses++;
+
+	MEM(found = talloc_zero(cache, regex_cache_entry_t));
+	slen = regex_compile(found, &found->preg, pattern, len, ignore_case, multiline, subcaptures, false);
+	if (slen <= 0) {
+		talloc_free(found);
+		return slen;
+	}
+
+	MEM(found->pattern = talloc_memdup(found, pattern, len));
+	found->len = len;
+	found->ignore_case = ignore_case;
+	found->multiline = multiline;
+	found->subcaptures = subcaptures;
+
+	/*
+	 *	Make room by discarding the least recently used pattern.
+	 */
+	if (rbtree_num_elements(cache->tree) >= REGEX_CACHE_MAX) {
+		regex_cache_entry_t *lru;
+
+		entry = FR_DLIST_TAIL(cache->lru);
+		rad_assert(entry != NULL);
+
+		lru = fr_ptr_to_type(regex_cache_entry_t, entry, entry);
+		rbtree_deletebydata(cache->tree, lru);
+		fr_dlist_remove(&lru->entry);
+		talloc_free(lru);
+	}
+
+	if (!rbtree_insert(cache->tree, found)) {
+		talloc_free(found);
+		fr_strerror_printf("Failed inserting pattern into regex cache");
+		return 0;
+	}
+	fr_dlist_insert_head(&cache->lru, &found->entry);
+
+	*out = found->preg;
+	return slen;
+}
+
+/** Return the hit and miss counters for this thread's regex cache
+ *
+ * @param[out] hits	Patterns found in the cache.
+ * @param[out] misses	Patterns which had to be compiled.
+ * @return the number of patterns in the cache.
+ */
+uint32_t regex_cache_stats(uint64_t *hits, uint64_t *misses)
+{
+	regex_cache_t *cache = regex_cache;
+
+	if (!cache) {
+		*hits = *misses = 0;
+		return 0;
+	}
+
+	*hits = cache->hits;
+	*misses = cache->misses;
+
+	return rbtree_num_elements(cache->tree);
+}
+
 #  ifdef HAVE_PCRE
 /** Extract a subcapture value from the request
  *
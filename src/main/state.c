@@ -106,16 +106,28 @@ typedef struct state_entry {
 	request_data_t		*data;				//!< Persistable request data, also parented ctx.
 } fr_state_entry_t;
 
-struct fr_state_tree_t {
+
+/** A partition of the state tree
+ *
+ * Each shard has its own lock, lookup table and expiry list, so threads
+ * working on different sessions don't contend with each other.
+ */
+typedef struct {
 	uint64_t		id;				//!< Next ID to assign.
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
-	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	rbtree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_hash_table_t		*ht;				//!< Hash table used to lookup state value.
 
 	fr_state_entry_t	*head, *tail;			//!< Entries to expire.
-	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+} fr_state_shard_t;
+
+struct fr_state_tree_t {
+	uint32_t		max_sessions;			//!< Maximum number of sessions we track, per shard.
+	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
+
+	uint32_t		num_shards;			//!< Number of shards.  Always a power of 2.
+	fr_state_shard_t	*shard;				//!< Array of shards.
 };
 
 fr_state_tree_t *global_state = NULL;
@@ -123,7 +135,24 @@ fr_state_tree_t *global_state = NULL;
 #define PTHREAD_MUTEX_LOCK if (main_config.spawn_workers) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (main_config.spawn_workers) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+/*
+ *	The shard is chosen from the top bits of the hash, and the
+ *	hash table bucket from the bottom bits, so entries in one
+ *	shard are still spread over all of its buckets.
+ */
+#define STATE_SHARDS_MAX	(256)
+
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
+
+/** Hash a fr_state_entry_t based on its state value
+ *
+ */
+static uint32_t state_entry_hash(void const *data)
+{
+	fr_state_entry_t const *entry = data;
+
+	return fr_hash(entry->state, sizeof(entry->state));
+}
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -135,34 +164,47 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+/** Return the shard an entry belongs in
+ *
+ * The entry must have the server hash already applied.
+ */
+static inline fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shard[(state_entry_hash(entry) >> 24) & (state->num_shards - 1)];
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *this;
-
-	if (main_config.spawn_workers) pthread_mutex_destroy(&state->mutex);
+	uint32_t		i;
+	fr_state_shard_t	*shard;
+	fr_state_entry_t	*this;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while (state->head) {
-		this = state->head;
-		state_entry_unlink(state, this);
-		talloc_free(this);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		shard = &state->shard[i];
 
-	for (this = state->head; this; this = this->next) DEBUG4("State %" PRIu64 " needs freeing prev was %" PRIu64 "", this->id, this->prev ? this->prev->id : 100000);
+		if (main_config.spawn_workers) pthread_mutex_destroy(&shard->mutex);
 
-	/*
-	 *	Ensure we got *all* the entries
-	 */
-	rad_assert(!state->head);
+		while (shard->head) {
+			this = shard->head;
+			state_entry_unlink(shard, this);
+			talloc_free(this);
+		}
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		/*
+		 *	Ensure we got *all* the entries
+		 */
+		rad_assert(!shard->head);
+
+		/*
+		 *	Free the hash table
+		 */
+		talloc_free(shard->ht);
+	}
 
 	if (state == global_state) global_state = NULL;
 
@@ -170,6 +212,10 @@ static int _state_tree_free(fr_state_tree_t *state)
 }
 
 /** Initialise a new state tree
+ *
+ * The tree is split into shards, each with its own lock.  With worker
+ * threads, there are at least two shards per worker, so that contention
+ * for any one lock is low.
  *
  * @param ctx to link the lifecycle of the state tree to.
  * @param max_sessions we track state for.
@@ -178,12 +224,23 @@ static int _state_tree_free(fr_state_tree_t *state)
  */
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint32_t timeout)
 {
-	fr_state_tree_t *state;
+	uint32_t		i;
+	uint32_t		num_shards = 1;
+	fr_state_tree_t		*state;
+	fr_state_shard_t	*shard;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
-	state->max_sessions = max_sessions;
+	if (main_config.spawn_workers) {
+		while ((num_shards < (main_config.num_workers * 2)) && (num_shards < STATE_SHARDS_MAX)) num_shards <<= 1;
+	}
+
+	/*
+	 *	Entries are spread evenly over the shards, so each
+	 *	one gets an equal share of the sessions.
+	 */
+	state->max_sessions = (max_sessions + num_shards - 1) / num_shards;
 	state->timeout = timeout;
 
 	/*
@@ -195,31 +252,48 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint
 	 */
 	fr_talloc_link_ctx(ctx, state);
 
-	if (main_config.spawn_workers && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	state->shard = talloc_zero_array(state, fr_state_shard_t, num_shards);
+	if (!state->shard) {
 		talloc_free(state);
 		return NULL;
 	}
 
 	/*
 	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	hash tables, so that all the state entries
+	 *	are freed before they're destroyed.  Hence
+	 *	them being parented from the NULL ctx.
+	 *
+	 *	num_shards only counts the shards which have
+	 *	been initialised, so the destructor can clean
+	 *	up after a partial failure.
 	 */
-	state->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
-	}
 	talloc_set_destructor(state, _state_tree_free);
 
+	for (i = 0; i < num_shards; i++) {
+		shard = &state->shard[i];
+
+		if (main_config.spawn_workers && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		shard->ht = fr_hash_table_create(NULL, state_entry_hash, state_entry_cmp, NULL);
+		if (!shard->ht) {
+			if (main_config.spawn_workers) pthread_mutex_destroy(&shard->mutex);
+			talloc_free(state);
+			return NULL;
+		}
+		state->num_shards++;
+	}
+
 	return state;
 }
 
-/** Unlink an entry and remove if from the tree
+/** Unlink an entry and remove if from the shard
  *
  */
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	fr_state_entry_t *prev, *next;
 
@@ -227,24 +301,24 @@ static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 	next = entry->next;
 
 	if (prev) {
-		rad_assert(state->head != entry);
+		rad_assert(shard->head != entry);
 		prev->next = next;
-	} else if (state->head) {
-		rad_assert(state->head == entry);
-		state->head = next;
+	} else if (shard->head) {
+		rad_assert(shard->head == entry);
+		shard->head = next;
 	}
 
 	if (next) {
-		rad_assert(state->tail != entry);
+		rad_assert(shard->tail != entry);
 		next->prev = prev;
-	} else if (state->tail) {
-		rad_assert(state->tail == entry);
-		state->tail = prev;
+	} else if (shard->tail) {
+		rad_assert(shard->tail == entry);
+		shard->tail = prev;
 	}
 	entry->next = NULL;
 	entry->prev = NULL;
 
-	rbtree_deletebydata(state->tree, entry);
+	(void) fr_hash_table_yank(shard->ht, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -287,27 +361,23 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Unlink expired entries from a shard
+ *
+ * @note Called with the shard mutex held.
  *
- * @note Called with the mutex held.
+ * @param[in] shard	to clean up.
+ * @param[in] now	the current time.
+ * @param[in] old	entry to skip, as the caller is still using it.
+ * @param[in,out] free_next	where to add the unlinked entries, so that
+ *			they can be freed once the mutex is released.
+ * @return where to add the next entry to free.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+static fr_state_entry_t **state_shard_expire(fr_state_shard_t *shard, time_t now,
+					     fr_state_entry_t *old, fr_state_entry_t **free_next)
 {
-	size_t			i;
-	uint32_t		x;
-	time_t			now = time(NULL);
-	VALUE_PAIR		*vp;
-	fr_state_entry_t	*entry, *next;
-	fr_state_entry_t	*free_head = NULL, **free_next = &free_head;
-
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
+	fr_state_entry_t *entry, *next;
 
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = state->head; entry != NULL; entry = next) {
+	for (entry = shard->head; entry != NULL; entry = next) {
 		next = entry->next;
 
 		if (entry == old) continue;
@@ -316,54 +386,105 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		 *	Too old, we can delete it.
 		 */
 		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
+			state_entry_unlink(shard, entry);
 			*free_next = entry;
 			free_next = &(entry->next);
-			state->timed_out++;
+			shard->timed_out++;
 			continue;
 		}
 
 		break;
 	}
 
-	if (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions) return NULL;
+	return free_next;
+}
+
+/** Free a list of unlinked entries
+ *
+ * We do it outside of the mutex as freeing may involve significantly
+ * more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed
+ * also, and it may have complex destructors associated with it.
+ */
+static void state_entries_free(fr_state_entry_t *head)
+{
+	fr_state_entry_t *entry, *next;
+
+	for (next = head; next;) {
+		entry = next;
+		next = entry->next;
+		talloc_free(entry);
+	}
+}
+
+/** Create a new state entry
+ *
+ * The old entry and the new one will usually be in different shards,
+ * so the old shard is released before the new one is locked.  We never
+ * hold two shard locks at the same time.
+ *
+ * @note Called with the mutex for the old entry's shard held, if there
+ *	is an old entry.  Returns with the mutex for *shard_p held, if
+ *	*shard_p is not NULL.
+ *
+ * @param[in] state		tree to insert the entry into.
+ * @param[in,out] shard_p	the locked shard.
+ * @param[in] request		the current request.
+ * @param[in] packet		the reply, which gets the State attribute.
+ * @param[in] old		entry which this one replaces, if any.
+ * @param[out] expired		entries which were unlinked from the new
+ *				entry's shard.  The caller should free them
+ *				once the mutex is released.
+ * @return
+ *	- NULL on error.
+ *	- the new entry.
+ */
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, fr_state_shard_t **shard_p,
+					    REQUEST *request, RADIUS_PACKET *packet, fr_state_entry_t *old,
+					    fr_state_entry_t **expired)
+{
+	size_t			i;
+	uint32_t		x;
+	time_t			now = time(NULL);
+	VALUE_PAIR		*vp;
+	fr_state_shard_t	*shard;
+	fr_state_entry_t	*entry;
+	fr_state_entry_t	*free_head = NULL, **free_next = &free_head;
+
+	uint8_t			old_state[sizeof(entry->state)];
+	int			old_tries = 0;
+
+	*expired = NULL;
 
 	/*
-	 *	Record the information from the old state, we may base the
-	 *	new state off the old one.
+	 *	Clean up old entries, and record the information
+	 *	from the old state, we may base the new state off
+	 *	the old one.
 	 *
-	 *	Once we release the mutex, the state of old becomes indeterminate
-	 *	so we have to grab the values now.
+	 *	Once we release the mutex, the state of old becomes
+	 *	indeterminate so we have to grab the values now.
 	 */
-	if (old) {
-		old_tries = old->tries;
+	if (*shard_p) {
+		free_next = state_shard_expire(*shard_p, now, old, free_next);
 
-		memcpy(old_state, old->state, sizeof(old_state));
+		if (old) {
+			old_tries = old->tries;
 
-		/*
-		 *	The old one isn't used any more, so we can free it.
-		 */
-		if (!old->data) {
-			state_entry_unlink(state, old);
-			*free_next = old;
+			memcpy(old_state, old->state, sizeof(old_state));
+
+			/*
+			 *	The old one isn't used any more, so we can free it.
+			 */
+			if (!old->data) {
+				state_entry_unlink(*shard_p, old);
+				*free_next = old;
+			}
 		}
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&(*shard_p)->mutex);
+		*shard_p = NULL;
 
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	for (next = free_head; next;) {
-		entry = next;
-		next = entry->next;
-		talloc_free(entry);
+		state_entries_free(free_head);
 	}
 
 	/*
@@ -374,12 +495,8 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 *	we can't do it now due to thread safety issues with talloc.
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
-	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+	if (!entry) return NULL;
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -442,30 +559,37 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		fr_pair_add(&packet->vps, vp);
 	}
 
-	if (DEBUG_ENABLED4) {
-		char hex[(sizeof(entry->state) * 2) + 1];
+	/*
+	 *	XOR the server hash with four bytes of random data.
+	 *	We XOR is again before resolving, to ensure state lookups
+	 *	only succeed in the virtual server that created the state
+	 *	value.
+	 */
+	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-		fr_bin2hex(hex, entry->state, sizeof(entry->state));
+	/*
+	 *	The shard depends on the final value, so we can
+	 *	only pick it now.
+	 */
+	shard = state_shard(state, entry);
 
-		DEBUG4("State ID %" PRIu64 " created, value 0x%s, expires %" PRIu64 "s",
-		       entry->id, hex, (uint64_t)entry->cleanup - now);
-	}
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	*shard_p = shard;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (rbtree_num_elements(state->tree) >= (uint32_t)state->max_sessions) {
+	*expired = NULL;
+	(void) state_shard_expire(shard, now, NULL, expired);
+
+	if ((uint32_t) fr_hash_table_num_elements(shard->ht) >= state->max_sessions) {
 		talloc_free(entry);
 		return NULL;
 	}
 
 	/*
-	 *	XOR the server hash with four bytes of random data.
-	 *	We XOR is again before resolving, to ensure state lookups
-	 *	only succeed in the virtual server that created the state
-	 *	value.
+	 *	IDs are unique across the whole tree.
 	 */
-	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
+	entry->id = (shard->id++ * state->num_shards) + (uint64_t) (shard - state->shard);
 
-	if (!rbtree_insert(state->tree, entry)) {
+	if (!fr_hash_table_insert(shard->ht, entry)) {
 		talloc_free(entry);
 		return NULL;
 	}
@@ -474,17 +598,26 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	if (!state->head) {
+	if (!shard->head) {
 		entry->prev = entry->next = NULL;
-		state->head = state->tail = entry;
+		shard->head = shard->tail = entry;
 	} else {
-		rad_assert(state->tail != NULL);
+		rad_assert(shard->tail != NULL);
 
-		entry->prev = state->tail;
-		state->tail->next = entry;
+		entry->prev = shard->tail;
+		shard->tail->next = entry;
 
 		entry->next = NULL;
-		state->tail = entry;
+		shard->tail = entry;
+	}
+
+	if (DEBUG_ENABLED4) {
+		char hex[(sizeof(entry->state) * 2) + 1];
+
+		fr_bin2hex(hex, entry->state, sizeof(entry->state));
+
+		DEBUG4("State ID %" PRIu64 " created, value 0x%s, expires %" PRIu64 "s",
+		       entry->id, hex, (uint64_t)entry->cleanup - now);
 	}
 
 	return entry;
@@ -492,12 +625,18 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 
 /** Find the entry, based on the State attribute
  *
+ * @note If the packet has a valid State attribute, returns with the mutex
+ *	for *shard_p held, whether or not an entry was found.  Otherwise
+ *	*shard_p is set to NULL.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
+static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, fr_state_shard_t **shard_p,
+					  REQUEST *request, RADIUS_PACKET *packet)
 {
 	VALUE_PAIR *vp;
 	fr_state_entry_t *entry, my_entry;
 
+	*shard_p = NULL;
+
 	vp = fr_pair_find_by_num(packet->vps, 0, FR_STATE, TAG_ANY);
 	if (!vp) return NULL;
 
@@ -510,7 +649,10 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *reque
 	 */
 	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	*shard_p = state_shard(state, &my_entry);
+	PTHREAD_MUTEX_LOCK(&(*shard_p)->mutex);
+
+	entry = fr_hash_table_finddata((*shard_p)->ht, &my_entry);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
@@ -522,16 +664,16 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *reque
  */
 void fr_state_discard(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *original)
 {
+	fr_state_shard_t *shard;
 	fr_state_entry_t *entry;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, original);
+	entry = state_entry_find(state, &shard, request, original);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		if (shard) PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_unlink(shard, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	/*
 	 *	The state and request must be in the same state
@@ -560,6 +702,7 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *o
  */
 void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
 {
+	fr_state_shard_t *shard;
 	fr_state_entry_t *entry;
 	TALLOC_CTX *old_ctx = NULL;
 
@@ -574,9 +717,7 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
-	entry = state_entry_find(state, request, packet);
+	entry = state_entry_find(state, &shard, request, packet);
 	if (entry) {
 		if (request->state_ctx) old_ctx = request->state_ctx;
 
@@ -590,7 +731,7 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		entry->data = NULL;
 	}
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (shard) PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -618,7 +759,8 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *original, RADIUS_PACKET *packet)
 {
-	fr_state_entry_t *entry, *old;
+	fr_state_shard_t *shard = NULL;
+	fr_state_entry_t *entry, *old = NULL, *expired;
 	request_data_t *data;
 
 	request_data_by_persistance(&data, request, true);
@@ -630,14 +772,12 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		rdebug_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
+	if (original) old = state_entry_find(state, &shard, request, original);
 
-	old = original ? state_entry_find(state, request, original) :
-			 NULL;
-
-	entry = state_entry_create(state, request, packet, old);
+	entry = state_entry_create(state, &shard, request, packet, old, &expired);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		if (shard) PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+		state_entries_free(expired);
 		return false;
 	}
 
@@ -652,7 +792,9 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 	request->state_ctx = NULL;
 	request->state = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	state_entries_free(expired);
 
 	RDEBUG3("RADIUS State - saved");
 	REQUEST_VERIFY(request);
@@ -665,7 +807,12 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	uint32_t	i;
+	uint64_t	total = 0;
+
+	for (i = 0; i < state->num_shards; i++) total += state->shard[i].id;
+
+	return total;
 }
 
 /** Return number of entries that timed out
@@ -673,7 +820,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint32_t	i;
+	uint64_t	total = 0;
+
+	for (i = 0; i < state->num_shards; i++) total += state->shard[i].timed_out;
+
+	return total;
 }
 
 /** Return number of entries we're currently tracking
@@ -681,5 +833,14 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	uint32_t	i;
+	uint32_t	total = 0;
+
+	for (i = 0; i < state->num_shards; i++) {
+		PTHREAD_MUTEX_LOCK(&state->shard[i].mutex);
+		total += (uint32_t) fr_hash_table_num_elements(state->shard[i].ht);
+		PTHREAD_MUTEX_UNLOCK(&state->shard[i].mutex);
+	}
+
+	return total;
 }
@@ -1807,6 +1807,105 @@ static unlang_t *compile_group(unlang_t *parent, unlang_compile_t *unlang_ctx, C
 	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
 }
 
+static int _switch_case_cmp(void const *one, void const *two)
+{
+	unlang_switch_case_t const *a = one, *b = two;
+
+	return fr_value_box_cmp(a->value, b->value);
+}
+
+/** Build a dispatch table for a switch statement
+ *
+ * If we're switching over an attribute, and every case statement is
+ * a literal of the attribute's type, then the matching case can be
+ * found with one lookup, instead of by comparing against each case
+ * in turn.
+ *
+ * Any other switch statement is left alone, and the interpreter
+ * falls back to a linear scan.
+ *
+ * @param[in] g		the switch statement, with its case statements compiled.
+ * @return
+ *	- true on success.
+ *	- false on error.
+ */
+static bool compile_switch_cases(unlang_group_t *g)
+{
+	fr_dict_attr_t const	*da;
+	unlang_t		*this;
+	unlang_group_t		*h;
+	unlang_switch_case_t	*sc;
+	int			position = 0;
+
+	if (g->vpt->type != TMPL_TYPE_ATTR) return true;
+
+	da = g->vpt->tmpl_da;
+
+	/*
+	 *	Only types where equality is the same as
+	 *	fr_value_box_cmp() returning 0.
+	 */
+	switch (da->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+	case FR_TYPE_BOOL:
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_UINT64:
+	case FR_TYPE_INT8:
+	case FR_TYPE_INT16:
+	case FR_TYPE_INT32:
+	case FR_TYPE_INT64:
+	case FR_TYPE_DATE:
+	case FR_TYPE_ETHERNET:
+	case FR_TYPE_IPV4_ADDR:
+	case FR_TYPE_IPV6_ADDR:
+	case FR_TYPE_IFID:
+		break;
+
+	default:
+		return true;
+	}
+
+	for (this = g->children; this; this = this->next) {
+		h = unlang_generic_to_group(this);
+		if (!h->vpt) continue;
+
+		if ((h->vpt->type != TMPL_TYPE_DATA) || (h->vpt->tmpl_value_type != da->type)) return true;
+	}
+
+	g->cases = rbtree_create(g, _switch_case_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!g->cases) {
+		cf_log_err(g->cs, "Failed creating switch table");
+		return false;
+	}
+
+	for (this = g->children; this; this = this->next) {
+		h = unlang_generic_to_group(this);
+		if (!h->vpt) {
+			g->default_case = this;
+			continue;
+		}
+
+		MEM(sc = talloc(g->cases, unlang_switch_case_t));
+		sc->value = &h->vpt->tmpl_value;
+		sc->instruction = this;
+		sc->position = position++;
+
+		/*
+		 *	The first matching case wins, so a duplicate
+		 *	can never be reached.
+		 */
+		if (!rbtree_insert(g->cases, sc)) {
+			cf_log_warn(h->cs, "Ignoring duplicate case statement \"%s\"", this->name);
+			talloc_free(sc);
+		}
+	}
+
+	return true;
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				   unlang_group_type_t group_type, unlang_group_type_t parentgroup_type, unlang_type_t mod_type)
 {
@@ -1903,7 +2002,15 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		return NULL;
 	}
 
-	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	c = compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	if (!c) return NULL;
+
+	if (!compile_switch_cases(g)) {
+		talloc_free(c);
+		return NULL;
+	}
+
+	return c;
 }
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
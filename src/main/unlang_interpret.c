@@ -1670,6 +1670,34 @@ static unlang_action_t unlang_switch(REQUEST *request,
 	null_case = found = NULL;
 	data.datum.ptr = NULL;
 
+	/*
+	 *	All of the case statements are literals, so we can
+	 *	look up the value of each instance of the attribute.
+	 *	The earliest matching case wins, as it would with a
+	 *	linear scan.
+	 */
+	if (g->cases) {
+		VALUE_PAIR		*vp;
+		fr_cursor_t		cursor;
+		int			rcode;
+		unlang_switch_case_t	my_case, *sc, *best = NULL;
+
+		for (vp = tmpl_cursor_init(&rcode, &cursor, request, g->vpt);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) {
+			my_case.value = &vp->data;
+
+			sc = rbtree_finddata(g->cases, &my_case);
+			if (!sc) continue;
+
+			if (!best || (sc->position < best->position)) best = sc;
+			if (best->position == 0) break;
+		}
+
+		found = best ? best->instruction : g->default_case;
+		goto do_null_case;
+	}
+
 	/*
 	 *	The attribute doesn't exist.  We can skip
 	 *	directly to the default 'case' statement.
@@ -96,6 +96,7 @@ struct xlat_exp {
 		int		regex_index;	//!< for %{1} and friends.
 	};
 	xlat_t const	*xlat;		//!< The xlat expansion to expand format with.
+	void		*inst;		//!< Instance data for the xlat function, or NULL.
 };
 
 typedef struct xlat_out {
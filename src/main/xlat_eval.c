@@ -535,7 +535,7 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_cursor_t *out,
 				   node->fmt, result_str);
 
 			slen = node->xlat->func.sync(ctx, &str, node->xlat->buf_len,
-						     node->xlat->mod_inst, NULL, request, result_str);
+						     node->xlat->mod_inst, node->inst, request, result_str);
 			if (slen < 0) {
 				talloc_free(result_str);
 				talloc_free(str);
@@ -567,8 +567,8 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_cursor_t *out,
 		{
 			xlat_action_t action;
 
-			/* Fixme - Pass in instance and thread instance */
-			action = node->xlat->func.async(ctx, out, request, NULL, NULL, result);
+			/* Fixme - Pass in thread instance */
+			action = node->xlat->func.async(ctx, out, request, node->inst, NULL, result);
 			switch (action) {
 			case XLAT_ACTION_PUSH_CHILD:
 			case XLAT_ACTION_YIELD:
@@ -964,7 +964,8 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 			str = talloc_array(ctx, char, node->xlat->buf_len);
 			str[0] = '\0';	/* Be sure the string is \0 terminated */
 		}
-		slen = node->xlat->func.sync(ctx, &str, node->xlat->buf_len, node->xlat->mod_inst, NULL, request, child);
+		slen = node->xlat->func.sync(ctx, &str, node->xlat->buf_len, node->xlat->mod_inst, node->inst,
+					     request, child);
 		talloc_free(child);
 		if (slen < 0) {
 			talloc_free(str);
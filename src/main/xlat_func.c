@@ -422,6 +422,37 @@ static ssize_t xlat_regex(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 }
 #endif
 
+#ifdef HAVE_REGEX
+/** Print the counters of this thread's regex cache
+ *
+ * One of "hits", "misses" or "entries".
+ */
+static ssize_t xlat_regex_cache(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
+				UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
+				REQUEST *request, char const *fmt)
+{
+	uint64_t	hits, misses;
+	uint32_t	entries;
+
+	while (isspace((int) *fmt)) fmt++;
+
+	entries = regex_cache_stats(&hits, &misses);
+
+	if (strcmp(fmt, "hits") == 0) {
+		snprintf(*out, outlen, "%" PRIu64, hits);
+	} else if (strcmp(fmt, "misses") == 0) {
+		snprintf(*out, outlen, "%" PRIu64, misses);
+	} else if (strcmp(fmt, "entries") == 0) {
+		snprintf(*out, outlen, "%u", entries);
+	} else {
+		REDEBUG("Unknown regex cache counter \"%s\", expected hits, misses or entries", fmt);
+		return -1;
+	}
+
+	return strlen(*out);
+}
+#endif
+
 #ifdef WITH_UNLANG
 /** Implements the Foreach-Variable-X
  *
@@ -614,7 +645,8 @@ xlat_t *xlat_find(char const *name)
  * @param[in] name		xlat name.
  * @param[in] func 		xlat function to be called.
  * @param[in] escape		function to sanitize any sub expansions passed to the xlat function.
- * @param[in] instantiate	function to pre-parse any xlat specific data.
+ * @param[in] instantiate	function to pre-parse any xlat specific data.  Called with
+ *				mod_inst whenever a call to the xlat function is tokenized.
  * @param[in] inst_size		sizeof() this xlat's instance data.
  * @param[in] buf_len		Size of the output buffer to allocate when calling the function.
  *				May be 0 if the function allocates its own buffer.
@@ -671,6 +703,7 @@ int xlat_register(void *mod_inst, char const *name,
 	c->mod_inst = mod_inst;
 	c->instantiate = instantiate;
 	c->inst_size = inst_size;
+	c->uctx = mod_inst;
 	c->async_safe = async_safe;
 
 	DEBUG3("%s: %s", c->name, __FUNCTION__);
@@ -1130,6 +1163,9 @@ int xlat_init(void)
 #if defined(HAVE_REGEX) && defined(HAVE_PCRE)
 	XLAT_REGISTER(regex);
 #endif
+#ifdef HAVE_REGEX
+	XLAT_REGISTER(regex_cache);
+#endif
 
 	xlat_register(&xlat_foreach_inst[0], "debug", xlat_debug, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
 	c = xlat_find("debug");
@@ -279,6 +279,22 @@ static ssize_t xlat_tokenize_expansion(TALLOC_CTX *ctx, char *fmt, xlat_exp_t **
 			p += slen;
 
 			node->async_safe = (node->xlat->async_safe && node->child->async_safe);
+
+			/*
+			 *	Let the function pre-parse its arguments.
+			 */
+			if (node->xlat->instantiate) {
+				if (node->xlat->inst_size > 0) {
+					MEM(node->inst = talloc_zero_array(node, uint8_t, node->xlat->inst_size));
+				}
+
+				if (node->xlat->instantiate(node->inst, node, node->xlat->uctx) < 0) {
+					talloc_free(node);
+					*error = "Failed instantiating expansion";
+					return -2;
+				}
+			}
+
 			*head = node;
 			rad_assert(node->next == NULL);
 
@@ -826,3 +842,27 @@ ssize_t xlat_tokenize(TALLOC_CTX *ctx, char *fmt, xlat_exp_t **head, char const
 	return xlat_tokenize_literal(ctx, fmt, head, false, error);
 }
 
+/** Get the arguments of an xlat function call, if they're a plain literal
+ *
+ * For use by #xlat_instantiate_t callbacks which want to pre-parse their
+ * arguments.
+ *
+ * @param[in] node	passed to the instantiate callback.
+ * @return
+ *	- The arguments.
+ *	- NULL if the arguments contain expansions or escapes, and have to be
+ *	  evaluated at run time.
+ */
+char const *xlat_func_literal(xlat_exp_t const *node)
+{
+	xlat_exp_t const *child;
+
+	if (node->type != XLAT_FUNC) return NULL;
+
+	child = node->child;
+	if (!child || child->next || (child->type != XLAT_LITERAL)) return NULL;
+
+	if (strchr(child->fmt, '\\')) return NULL;
+
+	return child->fmt;
+}
@@ -184,6 +184,51 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, CONF_ITEM *ci, UNUSED CON
 	return dl_instance(ctx, out, transport_cs, parent_inst, name, DL_TYPE_SUBMODULE);
 }
 
+/** Decode a binary detail record
+ *
+ * The record contains a RADIUS packet, which we hand to the RADIUS
+ * decoder, instead of parsing attributes from text.
+ */
+static int decode_binary(REQUEST *request, uint8_t *const data, size_t data_len, time_t *timestamp)
+{
+	fr_radius_detail_t	detail;
+	VALUE_PAIR		*vp;
+
+	if (fr_radius_detail_decode(&detail, data, data_len) < 0) {
+		RPEDEBUG("Malformed binary detail record");
+		return -1;
+	}
+
+	/*
+	 *	Set the original src/dst ip/port
+	 */
+	if (detail.src_ipaddr.af != AF_UNSPEC) request->packet->src_ipaddr = detail.src_ipaddr;
+	if (detail.dst_ipaddr.af != AF_UNSPEC) request->packet->dst_ipaddr = detail.dst_ipaddr;
+	request->packet->src_port = detail.src_port;
+	request->packet->dst_port = detail.dst_port;
+
+	if (fr_radius_detail_decode_pairs(request->packet, &request->packet->vps, &detail) < 0) {
+		RPEDEBUG("Failed decoding packet in binary detail record");
+		return -1;
+	}
+
+	/*
+	 *	The original time at which we received the
+	 *	packet.  We need this to properly calculate
+	 *	Acct-Delay-Time.
+	 */
+	*timestamp = detail.timestamp.tv_sec;
+
+	vp = fr_pair_afrom_num(request->packet, 0, FR_PACKET_ORIGINAL_TIMESTAMP);
+	if (vp) {
+		vp->vp_date = (uint32_t) *timestamp;
+		vp->type = VT_DATA;
+		fr_pair_add(&request->packet->vps, vp);
+	}
+
+	return 0;
+}
+
 /** Decode the packet, and set the request->process function
  *
  */
@@ -214,6 +259,13 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 	request->reply->src_ipaddr = request->packet->src_ipaddr;
 	request->reply->dst_ipaddr = request->packet->src_ipaddr;
 
+	if (fr_radius_detail_is_binary(data, data_len)) {
+		if (decode_binary(request, data, data_len, &timestamp) < 0) return -1;
+
+		fr_pair_cursor_init(&cursor, &request->packet->vps);
+		goto accounting;
+	}
+
 	end = data + data_len;
 
 	MPRINT("HEADER %s", data);
@@ -334,6 +386,7 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 		while ((p < end) && (*p)) p++;
 	}
 
+accounting:
 	/*
 	 *	Create / update accounting attributes.
 	 */
@@ -109,6 +109,7 @@ typedef struct proto_detail_work_t {
 	bool				retransmit;		//!< are we retransmitting on error?
 	bool				paused;			//!< Is reading paused?
 	bool				free_on_close;		//!< free the worker on close
+	bool				binary;			//!< file contains binary records
 
 	int				mode;			//!< O_RDWR or O_RDONLY
 
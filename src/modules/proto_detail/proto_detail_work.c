@@ -218,6 +218,43 @@ redo:
 	next = NULL;
 	stopped_search = end;
 
+	/*
+	 *	Binary records start with their length, so we don't
+	 *	need to search for the end of the record.
+	 */
+	if (inst->binary) {
+		ssize_t record_len;
+
+		record_len = fr_radius_detail_record_len(buffer, end - buffer);
+		if (record_len < 0) {
+			ERROR("proto_detail (%s): Malformed record found at offset %zd in file %s: %s",
+			      inst->name, (size_t) inst->header_offset, inst->filename_work, fr_strerror());
+			return -1;
+		}
+
+		/*
+		 *	The record won't fit in the buffer.  Skip it
+		 *	in the file, instead of in the buffer.
+		 */
+		if ((size_t) record_len > buffer_len) {
+			DEBUG("Ignoring 'too large' entry at offset %zu of %s",
+			      (size_t) inst->header_offset, inst->filename_work);
+			DEBUG("Entry size %zd is greater than allowed maximum %u",
+			      record_len, inst->parent->max_packet_size);
+
+			inst->header_offset += record_len;
+			inst->read_offset = inst->header_offset;
+			(void) lseek(inst->fd, inst->read_offset, SEEK_SET);
+			inst->eof = false;
+			inst->last_search = 0;
+			*leftover = 0;
+			return 0;
+		}
+
+		if ((record_len > 0) && (record_len <= (end - buffer))) next = buffer + record_len;
+		goto found;
+	}
+
 	/*
 	 *	Look for "end of record" marker, starting from the
 	 *	beginning of the buffer.
@@ -316,6 +353,7 @@ redo:
 
 	inst->last_search = (stopped_search - buffer);
 
+found:
 	/*
 	 *	If there is a next record, remember how large this
 	 *	record is, and update "leftover" bytes.
@@ -362,6 +400,7 @@ redo:
 	skip_record:
 		MPRINT("Skipping record");
 		if (next) {
+			inst->header_offset += (next - buffer);
 			memmove(buffer, next, (end - next));
 			data_size = (end - next);
 			*leftover = 0;
@@ -387,7 +426,19 @@ redo:
 	p = buffer;
 	done_offset = 0;
 
-	while (p < end) {
+	/*
+	 *	Binary records have a fixed place for the "Done"
+	 *	marker.  Truncated records are left for the decoder
+	 *	to complain about.
+	 */
+	if (inst->binary) {
+		if (packet_len >= FR_RADIUS_DETAIL_HDR_LEN) {
+			if (memcmp(buffer + FR_RADIUS_DETAIL_DONE_OFFSET, "Done", 4) == 0) goto skip_record;
+
+			done_offset = inst->header_offset + FR_RADIUS_DETAIL_DONE_OFFSET;
+		}
+
+	} else while (p < end) {
 		if (*p != '\0') {
 			p++;
 			continue;
@@ -650,6 +701,16 @@ static int mod_open(void *instance)
 		inst->file_size = 1;
 	}
 
+	/*
+	 *	Binary detail files start with a magic number.
+	 */
+	{
+		uint8_t magic[4];
+
+		inst->binary = (pread(inst->fd, magic, sizeof(magic), 0) == sizeof(magic)) &&
+			       fr_radius_detail_is_binary(magic, sizeof(magic));
+	}
+
 	rad_assert(inst->name == NULL);
 	rad_assert(inst->filename_work != NULL);
 	inst->name = talloc_typed_asprintf(inst, "detail working file %s", inst->filename_work);
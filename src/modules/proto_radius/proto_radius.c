@@ -24,6 +24,7 @@
  */
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/udp.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/io/application.h>
@@ -53,6 +54,8 @@ static CONF_PARSER const proto_radius_config[] = {
 	 */
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_t, max_packet_size) } ,
 	{ FR_CONF_OFFSET("num_messages", FR_TYPE_UINT32, proto_radius_t, num_messages) } ,
+	{ FR_CONF_OFFSET("max_batch", FR_TYPE_UINT32, proto_radius_t, max_batch) } ,
+	{ FR_CONF_OFFSET("num_sockets", FR_TYPE_UINT32, proto_radius_t, num_sockets) } ,
 	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
 	CONF_PARSER_TERMINATOR
@@ -331,6 +334,7 @@ static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
 	 */
 	listen->default_message_size = inst->max_packet_size;
 	listen->num_messages = inst->num_messages;
+	listen->max_batch = inst->max_batch;
 
 	/*
 	 *	Open the socket, and add it to the scheduler.
@@ -350,6 +354,43 @@ static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
 
 	inst->listen = listen;	/* Probably won't need it, but doesn't hurt */
 
+	/*
+	 *	Open the additional sockets.  They share the address
+	 *	and port of the first one, and the scheduler gives
+	 *	each one to a different network thread.
+	 */
+	if (inst->num_sockets > 1) {
+		uint32_t	i;
+
+		if ((uint32_t) fr_schedule_num_networks(sc) < inst->num_sockets) {
+			WARN("%s - 'num_sockets = %u' is larger than the number of network threads (%d)",
+			     inst->app_io->name, inst->num_sockets, fr_schedule_num_networks(sc));
+		}
+
+		for (i = 1; i < inst->num_sockets; i++) {
+			fr_listen_t *shard;
+
+			shard = talloc_zero(inst, fr_listen_t);
+			memcpy(shard, listen, sizeof(*shard));
+
+			shard->app_io_instance = inst->app_io_private->clone(shard, inst->app_io_instance, shard);
+			if (!shard->app_io_instance) {
+				cf_log_err(conf, "Failed creating %s interface %u: %s",
+					   inst->app_io->name, i, fr_strerror());
+			error:
+				talloc_free(shard);
+				return -1;
+			}
+
+			if (inst->app_io->open(shard->app_io_instance) < 0) {
+				cf_log_err(conf, "Failed opening %s interface %u", inst->app_io->name, i);
+				goto error;
+			}
+
+			if (!fr_schedule_socket_add(sc, shard)) goto error;
+		}
+	}
+
 	return 0;
 }
 
@@ -431,6 +472,30 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 1024);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	if (!inst->max_batch) inst->max_batch = 1;
+
+	FR_INTEGER_BOUND_CHECK("max_batch", inst->max_batch, <=, UDP_MMSG_MAX);
+
+	/*
+	 *	The network side reserves room for a full batch of
+	 *	packets, which has to fit into half of the ring
+	 *	buffer.
+	 */
+	if ((inst->max_batch * 2) > inst->num_messages) {
+		cf_log_err(conf, "'max_batch = %u' is too large for 'num_messages = %u'",
+			   inst->max_batch, inst->num_messages);
+		return -1;
+	}
+
+	if (!inst->num_sockets) inst->num_sockets = 1;
+
+	FR_INTEGER_BOUND_CHECK("num_sockets", inst->num_sockets, <=, 64);
+
+	if ((inst->num_sockets > 1) && (!inst->app_io || !inst->app_io_private->clone)) {
+		cf_log_err(conf, "'num_sockets' is not supported by this transport");
+		return -1;
+	}
+
 	return 0;
 }
 
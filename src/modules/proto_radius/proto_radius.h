@@ -43,6 +43,21 @@ typedef RADCLIENT *(*proto_radius_client_get_t)(void const *instance, void const
 typedef int (*proto_radius_addr_get_t)(fr_socket_addr_t *sockaddr,
 				       void const *instance, void const *packet_ctx);
 
+/** Create a copy of an instantiated #fr_app_io_t instance
+ *
+ * Used when a listener opens more than one socket.  Each socket
+ * needs its own instance, as it may be serviced by a different
+ * network thread.
+ *
+ * @param[in] ctx		to allocate the new instance in.
+ * @param[in] instance		#fr_app_io_t instance to copy.
+ * @param[in] listen		which will use the new instance.
+ * @return
+ *	- The new instance on success.
+ *	- NULL on failure.
+ */
+typedef void *(*proto_radius_instance_clone_t)(TALLOC_CTX *ctx, void const *instance, fr_listen_t const *listen);
+
 /** Semi-private functions exported by proto_radius #fr_app_io_t modules
  *
  * Should only be used by the proto_radius module, and submodules.
@@ -53,6 +68,8 @@ typedef struct {
 
 	proto_radius_addr_get_t		src;				//!< Retrieve the src address of the packet.
 	proto_radius_addr_get_t		dst;				//!< Retrieve the dst address of the packet.
+
+	proto_radius_instance_clone_t	clone;				//!< Copy the instance, for additional sockets.
 } proto_radius_app_io_t;
 
 /** An instance of a proto_radius listen section
@@ -76,6 +93,10 @@ typedef struct {
 
 	uint32_t			max_packet_size;		//!< for message ring buffer.
 	uint32_t			num_messages;			//!< for message ring buffer.
+	uint32_t			max_batch;			//!< maximum number of packets read or
+									///< written per system call.
+	uint32_t			num_sockets;			//!< number of sockets to open, each
+									///< serviced by a different network thread.
 	uint32_t			max_attributes;			//!< Limit maximum decodable attributes.
 
 	bool				tunnel_password_zeros;
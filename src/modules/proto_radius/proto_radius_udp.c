@@ -71,6 +71,8 @@ typedef struct dynamic_client_t {
 
 typedef struct {
 	proto_radius_t	const		*parent;		//!< The module that spawned us!
+	fr_listen_t const		*listen;		//!< for additional sockets, the listener which
+								//!< uses this instance.  NULL for the first one.
 	char const			*name;			//!< socket name
 
 	int				sockfd;
@@ -93,6 +95,14 @@ typedef struct {
 
 	fr_stats_t			stats;			//!< statistics for this socket
 
+	udp_mmsg_t			*recv;			//!< datagrams read by the last udp_recv_mmsg()
+	uint32_t			recv_num;		//!< number of datagrams in the current batch
+	uint32_t			recv_next;		//!< next datagram to process
+
+	udp_mmsg_t			*send;			//!< replies queued for udp_send_mmsg()
+	uint8_t				*send_buffer;		//!< copies of the queued replies
+	uint32_t			send_num;		//!< number of queued replies
+
 	bool				dynamic_clients_is_set;	//!< set if we have dynamic clients
 	dynamic_client_t		dynamic_clients;	//!< dynamic client infromation
 
@@ -617,54 +627,24 @@ static void dynamic_client_timer(proto_radius_udp_t *inst, RADCLIENT *client, ui
 	}
 }
 
-static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority)
+/** Validate a received packet, and track it
+ *
+ * @param[in] inst		the UDP instance.
+ * @param[in] buffer		containing the packet.
+ * @param[in] data_size		size of the received datagram.
+ * @param[in] address		where the packet came from.
+ * @param[out] track		tracking table entry for the packet.
+ * @return
+ *	- <0 on fatal error.
+ *	- 0 if the packet was discarded, or saved for later processing.
+ *	- >0 the length of the RADIUS packet.
+ */
+static ssize_t mod_read_packet(proto_radius_udp_t *inst, uint8_t *buffer, size_t data_size,
+			       proto_radius_udp_address_t *address, fr_tracking_entry_t **track)
 {
-	proto_radius_udp_t		*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
-
-	ssize_t				data_size;
 	size_t				packet_len;
 	decode_fail_t			reason;
-
-	struct timeval			timestamp;
 	fr_tracking_status_t		tracking_status;
-	fr_tracking_entry_t		*track = NULL;
-	proto_radius_udp_address_t	address;
-	fr_dlist_t			*entry;
-
-	/*
-	 *	There are saved packets.  Go read them.
-	 */
-	entry = FR_DLIST_FIRST(inst->dynamic_clients.packets);
-	if (entry) {
-		data_size = dynamic_client_packet_restore(inst, buffer, buffer_len, &track);
-		if (data_size < 0) {
-			rad_assert(0 == 1);
-			return 0;
-		}
-
-		packet_len = data_size;
-
-		rad_assert(track != NULL);
-		rad_assert(track->src_dst != NULL);
-		address.client = ((proto_radius_udp_address_t *)track->src_dst)->client;
-		goto received_packet;
-	}
-
-	*leftover = 0;
-
-	data_size = udp_recv(inst->sockfd, buffer, buffer_len, 0,
-			     &address.src_ipaddr, &address.src_port,
-			     &address.dst_ipaddr, &address.dst_port,
-			     &address.if_index, &timestamp);
-	if (data_size < 0) {
-		DEBUG2("proto_radius_udp got read error %zd: %s", data_size, fr_strerror());
-		return data_size;
-	}
-
-	if (!data_size) {
-		DEBUG2("proto_radius_udp got no data: ignoring");
-		return 0;
-	}
 
 	packet_len = data_size;
 
@@ -701,21 +681,21 @@ static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time
 	/*
 	 *	Track the packet ID.
 	 */
-	address.code = buffer[0];
-	address.id = buffer[1];
+	address->code = buffer[0];
+	address->id = buffer[1];
 
 	/*
 	 *	Look up the client.  It either exists, or we create
 	 *	it.
 	 */
-	address.client = client_find(NULL, &address.src_ipaddr, IPPROTO_UDP);
-	if (!address.client) {
+	address->client = client_find(NULL, &address->src_ipaddr, IPPROTO_UDP);
+	if (!address->client) {
 		size_t i, num;
 
 		if (!inst->dynamic_clients_is_set) {
 		unknown:
 			ERROR("Packet from unknown client at address %pV:%u - ignoring.",
-			      fr_box_ipaddr(address.src_ipaddr), address.src_port);
+			      fr_box_ipaddr(address->src_ipaddr), address->src_port);
 			inst->stats.total_invalid_requests++;
 			return 0;
 		}
@@ -724,11 +704,11 @@ static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time
 		 *	We have dynamic clients.  Try to find the
 		 *	client in the dynamic client set.
 		 */
-		address.client = client_find(inst->dynamic_clients.clients, &address.src_ipaddr, IPPROTO_UDP);
-		if (address.client) {
-			if (!address.client->dynamic || address.client->active) goto found;
+		address->client = client_find(inst->dynamic_clients.clients, &address->src_ipaddr, IPPROTO_UDP);
+		if (address->client) {
+			if (!address->client->dynamic || address->client->active) goto found;
 
-			if (address.client->negative) {
+			if (address->client->negative) {
 				goto unknown;
 			}
 
@@ -740,7 +720,7 @@ static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time
 			 *	packet will be removed from the list,
 			 *	and sent to the network side.
 			 */
-			if (dynamic_client_packet_save(inst, buffer, packet_len, &address, &track) < 0) {
+			if (dynamic_client_packet_save(inst, buffer, packet_len, address, track) < 0) {
 				goto unknown;
 			}
 
@@ -765,12 +745,12 @@ static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time
 			 *	too.  So we have to mask the source
 			 *	IP.
 			 */
-			ipaddr = address.src_ipaddr;
+			ipaddr = address->src_ipaddr;
 			fr_ipaddr_mask(&ipaddr, inst->dynamic_clients.network[i].prefix);
 
 			if (fr_ipaddr_cmp(&ipaddr, &inst->dynamic_clients.network[i]) == 0) {
 				DEBUG("Found matching network.  Checking for dynamic client definition.");
-				if (dynamic_client_alloc(inst, buffer, packet_len, &address, &track,
+				if (dynamic_client_alloc(inst, buffer, packet_len, address, track,
 							 &inst->dynamic_clients.network[i]) < 0) {
 					DEBUG("Failed allocating dynamic client");
 					goto unknown;
@@ -781,7 +761,7 @@ static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time
 				 *	ALREADY been inserted into the
 				 *	tracking table.
 				 */
-				goto return_packet;
+				return packet_len;
 			}
 		}
 
@@ -796,14 +776,14 @@ found:
 	 *	If the signature fails validation, ignore it.
 	 */
 	if (fr_radius_verify(buffer, NULL,
-			     (uint8_t const *)address.client->secret,
-			     talloc_array_length(address.client->secret) - 1) < 0) {
+			     (uint8_t const *)address->client->secret,
+			     talloc_array_length(address->client->secret) - 1) < 0) {
 		DEBUG2("proto_radius_udp packet failed verification: %s", fr_strerror());
 		inst->stats.total_bad_authenticators++;
 		return 0;
 	}
 
-	tracking_status = fr_radius_tracking_entry_insert(&track, inst->ft, buffer, fr_time(), &address);
+	tracking_status = fr_radius_tracking_entry_insert(track, inst->ft, buffer, fr_time(), address);
 	switch (tracking_status) {
 	case FR_TRACKING_ERROR:
 	case FR_TRACKING_UNUSED:
@@ -818,15 +798,15 @@ found:
 		 */
 	case FR_TRACKING_SAME:
 		DEBUG3("SAME packet");
-		if (track->ev) {
+		if ((*track)->ev) {
 			struct timeval tv;
 
 			gettimeofday(&tv, NULL);
 			tv.tv_sec += inst->cleanup_delay;
 
 			DEBUG3("SAME packet - cleanup");
-			(void) fr_event_timer_insert(NULL, inst->el, &track->ev,
-						     &tv, mod_cleanup_delay, track);
+			(void) fr_event_timer_insert(NULL, inst->el, &(*track)->ev,
+						     &tv, mod_cleanup_delay, *track);
 		}
 
 		inst->stats.total_dup_requests++;
@@ -834,7 +814,7 @@ found:
 		/*
 		 *	We are intentionally not responding.
 		 */
-		if (track->reply_len == 1) {
+		if ((*track)->reply_len == 1) {
 			return 0;
 		}
 
@@ -852,7 +832,7 @@ found:
 	 */
 	case FR_TRACKING_UPDATED:
 		DEBUG3("UPDATED packet");
-		if (track->ev) (void) fr_event_timer_delete(inst->el, &track->ev);
+		if ((*track)->ev) (void) fr_event_timer_delete(inst->el, &(*track)->ev);
 		break;
 
 	case FR_TRACKING_CONFLICTING:
@@ -864,10 +844,204 @@ found:
 		break;
 	}
 
-received_packet:
 	inst->stats.total_requests++;
-	rad_assert(address.client != NULL);
-	address.client->outstanding++;
+	rad_assert(address->client != NULL);
+	address->client->outstanding++;
+
+	return packet_len;
+}
+
+/** Read a batch of packets with one system call
+ *
+ *  The datagrams are packed one after the other at the start of the
+ *  buffer.  We then return them one at a time, with "leftover"
+ *  telling the network side how much data remains in the buffer.
+ *
+ * @param[in] inst		the UDP instance.
+ * @param[in] buffer		to read the packets into.
+ * @param[in] buffer_len	the length of the buffer.
+ * @param[in,out] leftover	size of the packets remaining in the buffer.
+ * @param[out] address		where the returned packet came from.
+ * @param[out] track		tracking table entry for the returned packet.
+ * @return
+ *	- <0 on error.
+ *	- 0 if there are no more packets.
+ *	- >0 the length of the RADIUS packet at the start of the buffer.
+ */
+static ssize_t mod_read_batch(proto_radius_udp_t *inst, uint8_t *buffer, size_t buffer_len, size_t *leftover,
+			      proto_radius_udp_address_t *address, fr_tracking_entry_t **track)
+{
+	udp_mmsg_t	*m;
+	ssize_t		packet_len;
+
+	/*
+	 *	Nothing left from the previous batch.  Read a new one.
+	 */
+	if (!*leftover) {
+		uint32_t	i, num;
+		int		received;
+		size_t		slot_size;
+		uint8_t		*p;
+
+		inst->recv_num = inst->recv_next = 0;
+
+		slot_size = inst->parent->max_packet_size;
+		num = buffer_len / slot_size;
+		if (num > inst->parent->max_batch) num = inst->parent->max_batch;
+		if (!num) {
+			num = 1;
+			slot_size = buffer_len;
+		}
+
+		for (i = 0; i < num; i++) {
+			inst->recv[i].data = buffer + (i * slot_size);
+			inst->recv[i].data_len = slot_size;
+		}
+
+		received = udp_recv_mmsg(inst->sockfd, inst->recv, num, 0);
+		if (received < 0) {
+			DEBUG2("proto_radius_udp got read error %d: %s", received, fr_strerror());
+			return received;
+		}
+
+		if (!received) {
+			DEBUG2("proto_radius_udp got no data: ignoring");
+			return 0;
+		}
+
+		DEBUG3("proto_radius_udp read %d packets in one batch", received);
+
+		/*
+		 *	Pack the datagrams together, so that the ones
+		 *	after the first are "leftover" data.
+		 */
+		p = buffer;
+		for (i = 0; i < (uint32_t) received; i++) {
+			m = &inst->recv[i];
+
+			if (m->data != p) memmove(p, m->data, m->packet_len);
+			p += m->packet_len;
+		}
+
+		*leftover = p - buffer;
+		inst->recv_num = received;
+	}
+
+	/*
+	 *	Process packets from the start of the buffer until we
+	 *	find one which should go to a worker.
+	 */
+	while (inst->recv_next < inst->recv_num) {
+		m = &inst->recv[inst->recv_next++];
+
+		rad_assert(*leftover >= m->packet_len);
+		*leftover -= m->packet_len;
+
+		/*
+		 *	udp_recv_mmsg() couldn't parse the addresses.
+		 */
+		if (!m->packet_len) continue;
+
+		address->src_ipaddr = m->src_ipaddr;
+		address->src_port = m->src_port;
+		address->dst_ipaddr = m->dst_ipaddr;
+		address->dst_port = m->dst_port;
+		address->if_index = m->if_index;
+
+		packet_len = mod_read_packet(inst, buffer, m->packet_len, address, track);
+		if (packet_len < 0) {
+			*leftover = 0;
+			return packet_len;
+		}
+
+		/*
+		 *	Discard the packet, and move the rest of the
+		 *	batch down to the start of the buffer.
+		 */
+		if (!packet_len) {
+			memmove(buffer, buffer + m->packet_len, *leftover);
+			continue;
+		}
+
+		/*
+		 *	fr_radius_ok() may have trimmed trailing junk
+		 *	from the datagram.  The next packet has to
+		 *	start immediately after this one.
+		 */
+		if ((size_t) packet_len < m->packet_len) {
+			memmove(buffer + packet_len, buffer + m->packet_len, *leftover);
+		}
+
+		return packet_len;
+	}
+
+	rad_assert(*leftover == 0);
+	*leftover = 0;
+	return 0;
+}
+
+static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority)
+{
+	proto_radius_udp_t		*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+
+	ssize_t				data_size;
+	ssize_t				packet_len;
+
+	struct timeval			timestamp;
+	fr_tracking_entry_t		*track = NULL;
+	proto_radius_udp_address_t	address;
+	fr_dlist_t			*entry;
+
+	/*
+	 *	There are saved packets.  Go read them.
+	 *
+	 *	But not if we're part way through a batch, as the
+	 *	remaining packets are still in the buffer.
+	 */
+	entry = FR_DLIST_FIRST(inst->dynamic_clients.packets);
+	if (entry && !*leftover) {
+		data_size = dynamic_client_packet_restore(inst, buffer, buffer_len, &track);
+		if (data_size < 0) {
+			rad_assert(0 == 1);
+			return 0;
+		}
+
+		packet_len = data_size;
+
+		rad_assert(track != NULL);
+		rad_assert(track->src_dst != NULL);
+		address.client = ((proto_radius_udp_address_t *)track->src_dst)->client;
+
+		inst->stats.total_requests++;
+		rad_assert(address.client != NULL);
+		address.client->outstanding++;
+		goto return_packet;
+	}
+
+	if (inst->recv) {
+		packet_len = mod_read_batch(inst, buffer, buffer_len, leftover, &address, &track);
+		if (packet_len <= 0) return packet_len;
+		goto return_packet;
+	}
+
+	*leftover = 0;
+
+	data_size = udp_recv(inst->sockfd, buffer, buffer_len, 0,
+			     &address.src_ipaddr, &address.src_port,
+			     &address.dst_ipaddr, &address.dst_port,
+			     &address.if_index, &timestamp);
+	if (data_size < 0) {
+		DEBUG2("proto_radius_udp got read error %zd: %s", data_size, fr_strerror());
+		return data_size;
+	}
+
+	if (!data_size) {
+		DEBUG2("proto_radius_udp got no data: ignoring");
+		return 0;
+	}
+
+	packet_len = mod_read_packet(inst, buffer, data_size, &address, &track);
+	if (packet_len <= 0) return packet_len;
 
 return_packet:
 	*packet_ctx = track;
@@ -877,6 +1051,91 @@ return_packet:
 	return packet_len;
 }
 
+/** Send all of the queued replies
+ *
+ * @param[in] instance of the RADIUS UDP I/O path.
+ * @return
+ *	- <0 on error.
+ *	- 0 on success.
+ */
+static int mod_flush(void const *instance)
+{
+	proto_radius_udp_t	*inst;
+	uint32_t		sent = 0;
+	int			rcode;
+
+	memcpy(&inst, &instance, sizeof(inst)); /* const issues */
+
+	while (sent < inst->send_num) {
+		rcode = udp_send_mmsg(inst->sockfd, inst->send + sent, inst->send_num - sent, 0);
+		if (rcode < 0) {
+			inst->send_num = 0;
+			return -1;
+		}
+
+		/*
+		 *	The socket buffer is full.  Drop the rest of
+		 *	the replies, just as udp_send() would.
+		 */
+		if (rcode == 0) {
+			DEBUG3("proto_radius_udp socket is full, dropping %u replies", inst->send_num - sent);
+			inst->stats.total_packets_dropped += inst->send_num - sent;
+			break;
+		}
+
+		sent += rcode;
+	}
+
+	inst->send_num = 0;
+	return 0;
+}
+
+/** Queue a reply for udp_send_mmsg()
+ *
+ *  The reply is copied, as the network side frees the buffer as soon
+ *  as we return.
+ *
+ * @return
+ *	- <0 on error.
+ *	- buffer_len on success.
+ */
+static ssize_t mod_write_queue(proto_radius_udp_t *inst, proto_radius_udp_address_t const *address,
+			       uint8_t *buffer, size_t buffer_len)
+{
+	udp_mmsg_t	*m;
+
+	/*
+	 *	Too large to queue, send it now.
+	 */
+	if (buffer_len > inst->parent->max_packet_size) {
+		return udp_send(inst->sockfd, buffer, buffer_len, 0,
+				&address->dst_ipaddr, address->dst_port,
+				address->if_index,
+				&address->src_ipaddr, address->src_port);
+	}
+
+	if ((inst->send_num == inst->parent->max_batch) && (mod_flush(inst) < 0)) return -1;
+
+	m = &inst->send[inst->send_num];
+	m->data = inst->send_buffer + (inst->send_num * inst->parent->max_packet_size);
+	m->data_len = buffer_len;
+	memcpy(m->data, buffer, buffer_len);
+
+	/*
+	 *	Replies go from where the request was sent to, back to
+	 *	where it came from.
+	 */
+	m->src_ipaddr = address->dst_ipaddr;
+	m->src_port = address->dst_port;
+	m->dst_ipaddr = address->src_ipaddr;
+	m->dst_port = address->src_port;
+	m->if_index = address->if_index;
+
+	inst->send_num++;
+
+	return buffer_len;
+}
+
 
 static ssize_t mod_write(void *instance, void *packet_ctx,
 			 fr_time_t request_time, uint8_t *buffer, size_t buffer_len)
@@ -1063,7 +1322,7 @@ static ssize_t mod_write(void *instance, void *packet_ctx,
 		entry = FR_DLIST_FIRST(inst->dynamic_clients.packets);
 		if (entry) {
 			DEBUG3("Emptying pending queue");
-			fr_network_listen_read(inst->nr, inst->parent->listen);
+			fr_network_listen_read(inst->nr, inst->listen ? inst->listen : inst->parent->listen);
 		}
 
 		return buffer_len;
@@ -1101,10 +1360,14 @@ static ssize_t mod_write(void *instance, void *packet_ctx,
 	 *	sometimes we want to NOT send a reply...
 	 */
 	if (buffer_len >= 20) {
-		data_size = udp_send(inst->sockfd, buffer, buffer_len, 0,
-				     &address->dst_ipaddr, address->dst_port,
-				     address->if_index,
-				     &address->src_ipaddr, address->src_port);
+		if (inst->send) {
+			data_size = mod_write_queue(inst, address, buffer, buffer_len);
+		} else {
+			data_size = udp_send(inst->sockfd, buffer, buffer_len, 0,
+					     &address->dst_ipaddr, address->dst_port,
+					     address->if_index,
+					     &address->src_ipaddr, address->src_port);
+		}
 		if (data_size < 0) {
 		done:
 			if (track->ev) (void) fr_event_timer_delete(inst->el, &track->ev);
@@ -1192,6 +1455,27 @@ static int mod_open(void *instance)
 		return -1;
 	}
 
+	/*
+	 *	Multiple sockets share the same address and port.  The
+	 *	kernel hashes the source IP / port of each packet to
+	 *	pick a socket, so duplicate detection still works.
+	 */
+	if (inst->parent->num_sockets > 1) {
+#ifdef SO_REUSEPORT
+		int on = 1;
+
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			ERROR("Failed setting SO_REUSEPORT: %s", fr_syserror(errno));
+			close(sockfd);
+			goto error;
+		}
+#else
+		ERROR("Multiple sockets are not supported on this system - SO_REUSEPORT is not defined");
+		close(sockfd);
+		goto error;
+#endif
+	}
+
 	if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
 		ERROR("Failed binding socket: %s", fr_strerror());
 		goto error;
@@ -1213,6 +1497,21 @@ static int mod_open(void *instance)
 				     src_buf, port);
 	inst->sockfd = sockfd;
 
+	/*
+	 *	Read and write packets in batches.  Each packet gets
+	 *	a slot of "max_packet_size" bytes.
+	 */
+	if (inst->parent->max_batch > 1) {
+		inst->recv = talloc_zero_array(inst, udp_mmsg_t, inst->parent->max_batch);
+		inst->send = talloc_zero_array(inst, udp_mmsg_t, inst->parent->max_batch);
+		inst->send_buffer = talloc_array(inst, uint8_t, inst->parent->max_batch * inst->parent->max_packet_size);
+		if (!inst->recv || !inst->send || !inst->send_buffer) {
+			ERROR("Failed allocating batch buffers");
+			close(sockfd);
+			goto error;
+		}
+	}
+
 	// @todo - also print out auth / acct / coa, etc.
 	DEBUG("Listening on radius address %s bound to virtual server %s",
 	      inst->name, cf_section_name2(inst->parent->server_cs));
@@ -1423,10 +1722,89 @@ static int mod_detach(void *instance)
 
 	if (inst->dynamic_clients.clients) TALLOC_FREE(inst->dynamic_clients.clients);
 
+	if (inst->send_num) (void) mod_flush(inst);
+
 	close(inst->sockfd);
 	return 0;
 }
 
+static int _mod_clone_free(proto_radius_udp_t *inst)
+{
+	if (inst->dynamic_clients.clients) TALLOC_FREE(inst->dynamic_clients.clients);
+
+	if (inst->sockfd >= 0) close(inst->sockfd);
+	return 0;
+}
+
+/** Create an instance for an additional socket
+ *
+ *  The configuration is shared with the original instance.  Everything
+ *  to do with packets (tracking table, dynamic clients, statistics) is
+ *  local to the new instance, as it is used by a different network
+ *  thread.
+ *
+ * @param[in] ctx	to allocate the new instance in.
+ * @param[in] instance	of the RADIUS UDP I/O path.
+ * @param[in] listen	which will use the new instance.
+ * @return
+ *	- NULL on error.
+ *	- the new instance.
+ */
+static void *mod_clone(TALLOC_CTX *ctx, void const *instance, fr_listen_t const *listen)
+{
+	proto_radius_udp_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+	proto_radius_udp_t		*clone;
+
+	clone = talloc(ctx, proto_radius_udp_t);
+	if (!clone) {
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	memcpy(clone, inst, sizeof(*clone));
+
+	clone->listen = listen;
+	clone->name = NULL;
+	clone->sockfd = -1;
+	clone->el = NULL;
+	clone->nr = NULL;
+
+	memset(&clone->stats, 0, sizeof(clone->stats));
+
+	clone->recv = clone->send = NULL;
+	clone->send_buffer = NULL;
+	clone->recv_num = clone->recv_next = clone->send_num = 0;
+
+	clone->dynamic_clients.clients = NULL;
+	clone->dynamic_clients.expired = NULL;
+	talloc_set_destructor(clone, _mod_clone_free);
+
+	clone->ft = fr_radius_tracking_create(clone, sizeof(proto_radius_udp_address_t), inst->parent->code_allowed);
+	if (!clone->ft) {
+	error:
+		talloc_free(clone);
+		return NULL;
+	}
+
+	if (clone->dynamic_clients_is_set) {
+		FR_DLIST_INIT(clone->dynamic_clients.pending);
+		FR_DLIST_INIT(clone->dynamic_clients.packets);
+
+		clone->dynamic_clients.clients = client_list_init(NULL);
+		clone->dynamic_clients.expired = client_list_init(NULL);
+		if (!clone->dynamic_clients.clients || !clone->dynamic_clients.expired) {
+			fr_strerror_printf("Failed allocating client lists");
+			goto error;
+		}
+
+		clone->dynamic_clients.num_clients = 0;
+		clone->dynamic_clients.num_pending_clients = 0;
+		clone->dynamic_clients.num_pending_packets = 0;
+	}
+
+	return clone;
+}
+
 
 /** Private interface for use by proto_radius
  *
@@ -1435,7 +1813,8 @@ extern proto_radius_app_io_t proto_radius_app_io_private;
 proto_radius_app_io_t proto_radius_app_io_private = {
 	.client			= mod_client,
 	.src			= mod_src_address,
-	.dst			= mod_dst_address
+	.dst			= mod_dst_address,
+	.clone			= mod_clone
 };
 
 extern fr_app_io_t proto_radius_udp;
@@ -1456,6 +1835,7 @@ fr_app_io_t proto_radius_udp = {
 	.decode			= mod_decode,
 	.encode			= mod_encode, /* only for dynamic client creation */
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd			= mod_fd,
 	.event_list_set		= mod_event_list_set,
 };
@@ -0,0 +1,3 @@
+TARGET		:= rlm_cache_htrie.a
+SOURCES		:= rlm_cache_htrie.c
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,677 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_htrie.c
+ * @brief Sharded in memory cache.
+ *
+ *  Entries are spread over a power of 2 number of shards, by the hash
+ *  of their key.  Each shard has its own hash table and read/write lock,
+ *  so workers looking up different keys don't serialise, and workers
+ *  looking up the same key only take a shared lock.
+ *
+ *  Nothing is written to a shard on a cache hit, other than the CLOCK
+ *  "referenced" bit (and only when it isn't already set).  Expired
+ *  entries are reclaimed when the CLOCK hand passes over them on insert.
+ *
+ *  When max_size is set, each shard is limited to its share of the
+ *  memory, and inserts evict entries using the CLOCK algorithm.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+#define LOG_PREFIX "rlm_cache_htrie - "
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/threads.h>
+#include <freeradius-devel/io/time.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#include "../../rlm_cache.h"
+
+/*
+ *	How many entries the CLOCK hand looks at on each insert,
+ *	to reclaim expired entries when we're not short of memory.
+ */
+#define HTRIE_SWEEP		(2)
+
+#define HTRIE_MAX_SHARDS	(1024)
+
+#define load(_var)		atomic_load_explicit(&_var, memory_order_relaxed)
+#define store(_var, _val)	atomic_store_explicit(&_var, _val, memory_order_relaxed)
+#define incr(_var)		atomic_fetch_add_explicit(&_var, 1, memory_order_relaxed)
+#define decr(_var)		atomic_fetch_sub_explicit(&_var, 1, memory_order_relaxed)
+
+typedef struct rlm_cache_htrie_entry {
+	rlm_cache_entry_t	fields;		//!< Entry data.  Must be first.
+
+	uint32_t		hash;		//!< Of the key.
+	size_t			size;		//!< Approximate memory used by the entry.
+	atomic_bool		referenced;	//!< Set on every hit, cleared by the CLOCK hand.
+	fr_dlist_t		clock;		//!< Entry in the shard's CLOCK ring.
+} rlm_cache_htrie_entry_t;
+
+typedef struct rlm_cache_htrie_shard {
+	pthread_rwlock_t	lock;		//!< Shared for lookups, exclusive for updates.
+
+	fr_hash_table_t		*ht;		//!< For looking up cache keys.
+
+	fr_dlist_t		clock;		//!< Ring of entries, in insertion order.
+	fr_dlist_t		*hand;		//!< The next entry to consider for eviction.
+
+	size_t			size;		//!< Memory used by entries in this shard.
+	size_t			max_size;	//!< Maximum memory entries in this shard may use.
+
+	_Atomic(uint32_t)	num_entries;	//!< So we can count entries without locking.
+
+	_Atomic(uint64_t)	hits;		//!< Lookups which found an entry.
+	_Atomic(uint64_t)	misses;		//!< Lookups which didn't find an entry.
+	_Atomic(uint64_t)	evictions;	//!< Live entries removed to make space.
+} rlm_cache_htrie_shard_t;
+
+typedef struct rlm_cache_htrie {
+	uint32_t		num_shards;	//!< How many shards to spread the entries over.
+	size_t			max_size;	//!< Maximum memory all entries may use.  0 means no limit.
+
+	uint32_t		mask;		//!< num_shards - 1.
+	rlm_cache_htrie_shard_t	*shard;		//!< Array of shards.
+} rlm_cache_htrie_t;
+
+/** The locks held by a thread for a single operation
+ *
+ * rlm_cache holds the handle from acquire to release, and only
+ * operates on one key while it does so.  So we lock at most one
+ * shard at a time.
+ */
+typedef struct rlm_cache_htrie_handle {
+	rlm_cache_htrie_t	*driver;	//!< The shard belongs to.
+	rlm_cache_htrie_shard_t	*shard;		//!< Currently locked, or NULL.
+	bool			write;		//!< Whether the shard is locked exclusively.
+
+	uint8_t const		*key;		//!< Of the last lookup.
+	size_t			key_len;	//!< Of the last lookup.
+} rlm_cache_htrie_handle_t;
+
+fr_thread_local_setup(rlm_cache_htrie_handle_t *, htrie_handle)	/* macro */
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_htrie_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_size", FR_TYPE_SIZE, rlm_cache_htrie_t, max_size), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_htrie_entry_t const *c = data;
+
+	return c->hash;
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static void _cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static void _htrie_handle_free(void *handle)
+{
+	talloc_free(handle);
+}
+
+/** Find the shard a key belongs to
+ *
+ * The hash tables use the low bits of the hash, so we use the high
+ * ones to pick the shard.
+ */
+static inline rlm_cache_htrie_shard_t *htrie_shard(rlm_cache_htrie_t *driver, uint32_t hash)
+{
+	return &driver->shard[(hash >> 16) & driver->mask];
+}
+
+static void htrie_unlock(rlm_cache_htrie_handle_t *h)
+{
+	if (!h->shard) return;
+
+	pthread_rwlock_unlock(&h->shard->lock);
+	h->shard = NULL;
+	h->write = false;
+}
+
+/** Lock the shard a key belongs to
+ *
+ * If we already hold a shared lock on the shard, and need an
+ * exclusive one, the shared lock is released first.  Any entry
+ * found under the shared lock may be freed by another thread
+ * before we get the exclusive lock, so callers have to look the
+ * entry up again.
+ *
+ * @return
+ *	- true if the shard was already locked in a suitable mode.
+ *	- false if the lock was (re)acquired.
+ */
+static bool htrie_lock(rlm_cache_htrie_handle_t *h, rlm_cache_htrie_shard_t *shard, bool write)
+{
+	if ((h->shard == shard) && (h->write || !write)) return true;
+
+	htrie_unlock(h);
+
+	if (write) {
+		pthread_rwlock_wrlock(&shard->lock);
+	} else {
+		pthread_rwlock_rdlock(&shard->lock);
+	}
+	h->shard = shard;
+	h->write = write;
+
+	return false;
+}
+
+/** Unlink an entry from its shard, and free it
+ *
+ * Shard must be locked exclusively.
+ */
+static void htrie_remove(rlm_cache_htrie_shard_t *shard, rlm_cache_htrie_entry_t *c)
+{
+	if (shard->hand == &c->clock) shard->hand = c->clock.next;
+
+	fr_hash_table_yank(shard->ht, c);
+	fr_dlist_remove(&c->clock);
+
+	shard->size -= c->size;
+	decr(shard->num_entries);
+
+	talloc_free(c);
+}
+
+/** Return the entry under the CLOCK hand, and advance the hand
+ *
+ * Shard must be locked exclusively, and must not be empty.
+ */
+static rlm_cache_htrie_entry_t *htrie_tick(rlm_cache_htrie_shard_t *shard)
+{
+	fr_dlist_t *entry = shard->hand;
+
+	if (entry == &shard->clock) entry = entry->next;
+	rad_assert(entry != &shard->clock);
+
+	shard->hand = entry->next;
+
+	return (rlm_cache_htrie_entry_t *)(((uint8_t *) entry) - offsetof(rlm_cache_htrie_entry_t, clock));
+}
+
+/** Make space in a shard for a new entry
+ *
+ * Expired entries are always removed.  Live ones get a second chance
+ * if they've been used since the hand last passed them.
+ *
+ * Shard must be locked exclusively.
+ */
+static void htrie_evict(rlm_cache_htrie_shard_t *shard, size_t needed, time_t now)
+{
+	rlm_cache_htrie_entry_t	*c;
+	int			i;
+
+	/*
+	 *	Reclaim a few expired entries, even if we're not
+	 *	short of memory.
+	 */
+	for (i = 0; (i < HTRIE_SWEEP) && (load(shard->num_entries) > 0); i++) {
+		c = htrie_tick(shard);
+		if (c->fields.expires < now) htrie_remove(shard, c);
+	}
+
+	if (!shard->max_size) return;
+
+	/*
+	 *	Every live entry is skipped at most once, so this
+	 *	terminates after two trips around the ring.
+	 */
+	while (((shard->size + needed) > shard->max_size) && (load(shard->num_entries) > 0)) {
+		c = htrie_tick(shard);
+
+		if (c->fields.expires >= now) {
+			if (load(c->referenced)) {
+				store(c->referenced, false);
+				continue;
+			}
+			incr(shard->evictions);
+		}
+
+		htrie_remove(shard, c);
+	}
+}
+
+/** Cleanup a cache_htrie instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	uint32_t		i;
+
+	if (!driver->shard) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htrie_shard_t *shard = &driver->shard[i];
+
+		if (!shard->ht) continue;
+
+		fr_hash_table_free(shard->ht);
+		pthread_rwlock_destroy(&shard->lock);
+	}
+	talloc_free(driver->shard);
+
+	return 0;
+}
+
+/** Create a new cache_htrie instance
+ *
+ * @copydetails cache_instantiate_t
+ */
+static int mod_instantiate(UNUSED rlm_cache_config_t const *config, void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	uint32_t		i;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, HTRIE_MAX_SHARDS);
+
+	if ((driver->num_shards & (driver->num_shards - 1)) != 0) {
+		cf_log_err(conf, "shards must be a power of 2");
+		return -1;
+	}
+	driver->mask = driver->num_shards - 1;
+
+	/*
+	 *	The instance data is read only once we return, so
+	 *	everything has to be allocated outside of it.
+	 */
+	driver->shard = talloc_zero_array(NULL, rlm_cache_htrie_shard_t, driver->num_shards);
+	if (!driver->shard) {
+		ERROR("Failed allocating shards");
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htrie_shard_t *shard = &driver->shard[i];
+
+		shard->ht = fr_hash_table_create(NULL, cache_entry_hash, cache_entry_cmp, _cache_entry_free);
+		if (!shard->ht) {
+			ERROR("Failed to create cache");
+			return -1;
+		}
+
+		if (pthread_rwlock_init(&shard->lock, NULL) != 0) {
+			ERROR("Failed initializing lock: %s", fr_syserror(errno));
+			fr_hash_table_free(shard->ht);
+			shard->ht = NULL;
+			return -1;
+		}
+
+		FR_DLIST_INIT(shard->clock);
+		shard->hand = &shard->clock;
+		shard->max_size = driver->max_size / driver->num_shards;
+
+		atomic_init(&shard->num_entries, 0);
+		atomic_init(&shard->hits, 0);
+		atomic_init(&shard->misses, 0);
+		atomic_init(&shard->evictions, 0);
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_htrie_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_htrie_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+	atomic_init(&c->referenced, false);
+	FR_DLIST_INIT(c->clock);
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * Takes a shared lock on the shard, which is held until the handle
+ * is released, so the entry can't be freed while rlm_cache uses it.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htrie_t		*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_handle_t	*h = handle;
+	rlm_cache_htrie_shard_t		*shard;
+	rlm_cache_htrie_entry_t		*c, my_c;
+
+	rad_assert(h && (h->driver == driver));
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	shard = htrie_shard(driver, my_c.hash);
+	htrie_lock(h, shard, false);
+
+	h->key = key;
+	h->key_len = key_len;
+
+	c = fr_hash_table_finddata(shard->ht, &my_c);
+	if (!c) {
+		incr(shard->misses);
+		*out = NULL;
+		return CACHE_MISS;
+	}
+	incr(shard->hits);
+
+	/*
+	 *	Avoid dirtying the cache line if we can.
+	 */
+	if (!load(c->referenced)) store(c->referenced, true);
+
+	RDEBUG3("Found entry in shard %u", (unsigned int) (shard - driver->shard));
+
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htrie_t		*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_handle_t	*h = handle;
+	rlm_cache_htrie_shard_t		*shard;
+	rlm_cache_htrie_entry_t		*c, my_c;
+	uint8_t				*copy = NULL;
+
+	if (!request) return CACHE_ERROR;
+
+	rad_assert(h && (h->driver == driver));
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	shard = htrie_shard(driver, my_c.hash);
+
+	/*
+	 *	rlm_cache may pass us the key of an entry it found,
+	 *	which another thread can free while we wait for the
+	 *	exclusive lock.
+	 */
+	if ((h->shard == shard) && !h->write && (key != h->key)) {
+		copy = talloc_memdup(NULL, key, key_len);
+		if (!copy) return CACHE_ERROR;
+		my_c.fields.key = copy;
+	}
+
+	htrie_lock(h, shard, true);
+
+	c = fr_hash_table_finddata(shard->ht, &my_c);
+	talloc_free(copy);
+	if (!c) return CACHE_MISS;
+
+	htrie_remove(shard, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_htrie_t		*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_handle_t	*h = handle;
+	rlm_cache_htrie_shard_t		*shard;
+	rlm_cache_htrie_entry_t		*my_c, *old;
+
+	if (!request) return CACHE_ERROR;
+
+	rad_assert(h && (h->driver == driver));
+
+	memcpy(&my_c, &c, sizeof(my_c));
+
+	my_c->hash = fr_hash(c->key, c->key_len);
+	my_c->size = talloc_total_size(my_c);
+
+	shard = htrie_shard(driver, my_c->hash);
+	if (shard->max_size && (my_c->size > shard->max_size)) {
+		RERROR("Entry is %zu bytes, which is larger than the per-shard limit of %zu bytes",
+		       my_c->size, shard->max_size);
+		return CACHE_ERROR;
+	}
+
+	htrie_lock(h, shard, true);
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = fr_hash_table_finddata(shard->ht, my_c);
+	if (old) htrie_remove(shard, old);
+
+	htrie_evict(shard, my_c->size, request->packet->timestamp.tv_sec);
+
+	if (!fr_hash_table_insert(shard->ht, my_c)) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	/*
+	 *	New entries go just behind the hand, so they're
+	 *	the last to be considered for eviction.
+	 */
+	fr_dlist_insert_tail(shard->hand, &my_c->clock);
+
+	shard->size += my_c->size;
+	incr(shard->num_entries);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * rlm_cache writes the new expiry time into the entry it found.  We
+ * look the key up again under the exclusive lock, in case that entry
+ * was replaced while we were waiting for it.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  REQUEST *request, void *handle,
+					  rlm_cache_entry_t *c)
+{
+	rlm_cache_htrie_t		*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_handle_t	*h = handle;
+	rlm_cache_htrie_shard_t		*shard;
+	rlm_cache_htrie_entry_t		*found, my_c;
+	time_t				expires = c->expires;
+
+	if (!request) return CACHE_ERROR;
+
+	rad_assert(h && (h->driver == driver) && h->key);
+
+	my_c.fields.key = h->key;
+	my_c.fields.key_len = h->key_len;
+	my_c.hash = fr_hash(h->key, h->key_len);
+
+	shard = htrie_shard(driver, my_c.hash);
+	if (htrie_lock(h, shard, true)) return CACHE_OK;
+
+	found = fr_hash_table_finddata(shard->ht, &my_c);
+	if (!found) {
+		RDEBUG2("Entry was removed before its TTL could be updated");
+		return CACHE_OK;
+	}
+	found->fields.expires = expires;
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * The caller may hold a lock on one of the shards, so we don't lock any.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	uint32_t		i, count = 0;
+
+	if (!request) return CACHE_ERROR;
+
+	for (i = 0; i < driver->num_shards; i++) count += load(driver->shard[i].num_entries);
+
+	return count;
+}
+
+/** Sum the counters of all the shards
+ *
+ * @copydetails cache_stats_t
+ */
+static void cache_stats(rlm_cache_stats_t *out, UNUSED rlm_cache_config_t const *config, void *instance)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	uint32_t		i;
+
+	memset(out, 0, sizeof(*out));
+
+	for (i = 0; i < driver->num_shards; i++) {
+		out->hits += load(driver->shard[i].hits);
+		out->misses += load(driver->shard[i].misses);
+		out->evictions += load(driver->shard[i].evictions);
+	}
+}
+
+/** Get this thread's handle
+ *
+ * No shards are locked until we know which key is being operated on.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 REQUEST *request)
+{
+	rlm_cache_htrie_t		*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_handle_t	*h;
+
+	h = htrie_handle;
+	if (!h) {
+		h = talloc_zero(NULL, rlm_cache_htrie_handle_t);
+		if (!h) {
+			RERROR("Failed allocating handle");
+			return -1;
+		}
+		fr_thread_local_set_destructor(htrie_handle, _htrie_handle_free, h);
+	}
+
+	rad_assert(!h->shard);
+
+	h->driver = driver;
+	h->key = NULL;
+	h->key_len = 0;
+
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the handle, unlocking any shard it holds
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, void *instance, REQUEST *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_htrie_t		*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_handle_t	*h = handle;
+
+	if (!h) return;
+
+	rad_assert(h->driver == driver);
+
+	if (h->shard) RDEBUG3("Shard %u released", (unsigned int) (h->shard - driver->shard));
+
+	htrie_unlock(h);
+	h->key = NULL;
+}
+
+extern cache_driver_t rlm_cache_htrie;
+cache_driver_t rlm_cache_htrie = {
+	.name		= "rlm_cache_htrie",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_htrie_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+	.stats		= cache_stats,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
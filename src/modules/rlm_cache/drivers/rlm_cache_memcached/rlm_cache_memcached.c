@@ -39,11 +39,14 @@ typedef struct rlm_cache_memcached_handle {
 
 typedef struct rlm_cache_memcached {
 	char const 		*options;	//!< Connection options
+	char const		*format_name;	//!< How entries are serialized.
+	cache_format_t		format;		//!< How entries are serialized.
 	fr_pool_t	*pool;
 } rlm_cache_memcached_t;
 
 static const CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("options", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_cache_memcached_t, options), .dflt = "--SERVER=localhost" },
+	{ FR_CONF_OFFSET("format", FR_TYPE_STRING, rlm_cache_memcached_t, format_name), .dflt = "text" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -108,6 +111,12 @@ static int mod_instantiate(rlm_cache_config_t const *config, void *instance, CON
 
 	char			buffer[256];
 
+	driver->format = fr_str2int(cache_format_table, driver->format_name, -1);
+	if (driver->format == (cache_format_t) -1) {
+		cf_log_err(conf, "Invalid format \"%s\", expected \"text\" or \"binary\"", driver->format_name);
+		return -1;
+	}
+
 	snprintf(buffer, sizeof(buffer), "rlm_cache (%s)", config->name);
 
 	ret = libmemcached_check_configuration(driver->options, talloc_array_length(driver->options) -1,
@@ -174,10 +183,18 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
 
+	/*
+	 *	Entries written in either format can be read,
+	 *	whatever the current format is.
+	 */
 	c = talloc_zero(NULL, rlm_cache_entry_t);
-	ret = cache_deserialize(c, from_store, len);
+	if (cache_serialized_is_binary((uint8_t const *)from_store, len)) {
+		ret = cache_deserialize_binary(c, (uint8_t const *)from_store, len);
+	} else {
+		RDEBUG2("%s", from_store);
+		ret = cache_deserialize(c, from_store, len);
+	}
 	free(from_store);
 	if (ret < 0) {
 		RERROR("%s", fr_strerror());
@@ -194,28 +211,43 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
 					 REQUEST *request, void *handle, const rlm_cache_entry_t *c)
 {
+	rlm_cache_memcached_t *driver = instance;
 	rlm_cache_memcached_handle_t *mandle = handle;
 
 	memcached_return_t ret;
 
 	TALLOC_CTX *pool;
-	char *to_store;
+	char *to_store = NULL;
+	size_t len = 0;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
-		talloc_free(pool);
+	if (driver->format == CACHE_FORMAT_BINARY) {
+		uint8_t *binary;
 
-		return CACHE_ERROR;
+		if (cache_serialize_binary(pool, &binary, c) == 0) {
+			to_store = (char *)binary;
+			len = talloc_array_length(binary);
+		} else {
+			RWDEBUG("Failed serializing entry in binary format, using text: %s", fr_strerror());
+		}
+	}
+
+	if (!to_store) {
+		if (cache_serialize(pool, &to_store, c) < 0) {
+			talloc_free(pool);
+
+			return CACHE_ERROR;
+		}
+		if (to_store) len = talloc_array_length(to_store) - 1;
 	}
 
 	ret = memcached_set(mandle->handle, (char const *)c->key, c->key_len,
-		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, c->expires, 0);
+		            to_store ? to_store : "", len, c->expires, 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
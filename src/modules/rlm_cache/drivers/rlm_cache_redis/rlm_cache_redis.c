@@ -27,24 +27,29 @@
 #include <freeradius-devel/rad_assert.h>
 
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
 #include "../../../rlm_redis/redis.h"
 #include "../../../rlm_redis/cluster.h"
 
-static CONF_PARSER driver_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
-
 typedef struct rlm_cache_redis {
 	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
 						//!< Must be first field in this struct.
 
+	char const		*format_name;	//!< How entries are stored.
+	cache_format_t		format;		//!< How entries are stored.
+
 	vp_tmpl_t		*created_attr;	//!< LHS of the Cache-Created map.
 	vp_tmpl_t		*expires_attr;	//!< LHS of the Cache-Expires map.
 
 	fr_redis_cluster_t	*cluster;
 } rlm_cache_redis_t;
 
+static CONF_PARSER driver_config[] = {
+	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("format", FR_TYPE_STRING, rlm_cache_redis_t, format_name), .dflt = "text" },
+	CONF_PARSER_TERMINATOR
+};
+
 /** Create a new rlm_cache_redis instance
  *
  * @copydetails cache_instantiate_t
@@ -59,6 +64,12 @@ static int mod_instantiate(rlm_cache_config_t const *config, void *instance, CON
 	if (cf_section_rules_push(conf, driver_config) < 0) return -1;
 	if (cf_section_parse(driver, driver, conf) < 0) return -1;
 
+	driver->format = fr_str2int(cache_format_table, driver->format_name, -1);
+	if (driver->format == (cache_format_t) -1) {
+		cf_log_err(conf, "Invalid format \"%s\", expected \"text\" or \"binary\"", driver->format_name);
+		return -1;
+	}
+
 	snprintf(buffer, sizeof(buffer), "rlm_cache (%s)", config->name);
 
 	driver->cluster = fr_redis_cluster_alloc(driver, conf, &driver->conf, true,
@@ -97,6 +108,159 @@ static void cache_entry_free(rlm_cache_entry_t *c)
 	talloc_free(c);
 }
 
+/** Locate a binary serialized cache entry in redis
+ *
+ * The entry is stored as a single string value, instead of a list of
+ * attribute, operator and value triplets.
+ */
+static cache_status_t cache_entry_find_binary(rlm_cache_entry_t **out, rlm_cache_redis_t *driver,
+					      REQUEST *request, uint8_t const *key, size_t key_len)
+{
+	fr_redis_cluster_state_t	state;
+	fr_redis_conn_t			*conn;
+	fr_redis_rcode_t		status;
+	redisReply			*reply = NULL;
+	int				s_ret;
+
+	rlm_cache_entry_t		*c;
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, key, key_len, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
+		if (RDEBUG_ENABLED3) {
+			char *p;
+
+			p = fr_asprint(NULL, (char const *)key, key_len, '"');
+			RDEBUG3("GET %s", p);
+			talloc_free(p);
+		}
+		reply = redisCommand(conn->handle, "GET %b", key, key_len);
+		status = fr_redis_command_status(conn, reply);
+	}
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		char *p;
+
+		/*
+		 *	Entries written in the text format are lists.
+		 *	Treat them as missing, and they'll be overwritten.
+		 */
+		if (reply && (reply->type == REDIS_REPLY_ERROR) &&
+		    (strncmp(reply->str, "WRONGTYPE", 9) == 0)) {
+			RDEBUG2("Ignoring entry stored in the text format");
+			fr_redis_reply_free(reply);
+			return CACHE_MISS;
+		}
+
+		p = fr_asprint(NULL, (char const *)key, key_len, '"');
+		RERROR("Failed retrieving entry for key \"%s\"", p);
+		talloc_free(p);
+
+	error:
+		fr_redis_reply_free(reply);
+		return CACHE_ERROR;
+	}
+
+	if (!rad_cond_assert(reply)) goto error;
+
+	switch (reply->type) {
+	case REDIS_REPLY_NIL:
+		fr_redis_reply_free(reply);
+		return CACHE_MISS;
+
+	case REDIS_REPLY_STRING:
+		break;
+
+	default:
+		REDEBUG("Bad result type, expected string, got %s",
+			fr_int2str(redis_reply_types, reply->type, "<UNKNOWN>"));
+		goto error;
+	}
+
+	RDEBUG3("Entry is %zu bytes", (size_t)reply->len);
+
+	c = talloc_zero(NULL, rlm_cache_entry_t);
+	if (cache_deserialize_binary(c, (uint8_t const *)reply->str, reply->len) < 0) {
+		RPEDEBUG("Failed deserializing entry");
+		talloc_free(c);
+		goto error;
+	}
+	fr_redis_reply_free(reply);
+
+	c->key = talloc_memdup(c, key, key_len);
+	c->key_len = key_len;
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Insert a binary serialized entry into redis
+ *
+ * SET replaces entries of any type, so we don't need to DEL the old
+ * entry first, even if it was stored in the text format.
+ */
+static cache_status_t cache_entry_insert_binary(rlm_cache_redis_t *driver, REQUEST *request,
+						rlm_cache_entry_t const *c, uint8_t const *data, size_t data_len)
+{
+	fr_redis_conn_t		*conn;
+	fr_redis_cluster_state_t	state;
+	fr_redis_rcode_t	status;
+	redisReply		*reply = NULL;
+	int			s_ret;
+
+	unsigned int		pipelined = 0;	/* How many commands pending in the pipeline */
+	redisReply		*replies[4];	/* Should have the same number of elements as pipelined commands */
+	size_t			reply_num = 0, i;
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, c->key, c->key_len, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
+		if (c->expires > 0) {
+			RDEBUG3("MULTI");
+			if (redisAppendCommand(conn->handle, "MULTI") != REDIS_OK) {
+			append_error:
+				RERROR("Failed appending Redis command to output buffer: %s", conn->handle->errstr);
+				return CACHE_ERROR;
+			}
+			pipelined++;
+		}
+
+		RDEBUG3("SET <key> <%zu bytes>", data_len);
+		if (redisAppendCommand(conn->handle, "SET %b %b", c->key, c->key_len,
+				       data, data_len) != REDIS_OK) goto append_error;
+		pipelined++;
+
+		if (c->expires > 0) {
+			RDEBUG3("EXPIREAT <key> %li", (long)c->expires);
+			if (redisAppendCommand(conn->handle, "EXPIREAT %b %i", c->key,
+					       c->key_len, c->expires) != REDIS_OK) goto append_error;
+			pipelined++;
+			RDEBUG3("EXEC");
+			if (redisAppendCommand(conn->handle, "EXEC") != REDIS_OK) goto append_error;
+			pipelined++;
+		}
+
+		reply_num = fr_redis_pipeline_result(&pipelined, &status,
+						     replies, sizeof(replies) / sizeof(*replies),
+						     conn);
+		reply = replies[0];
+	}
+
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		RPERROR("Failed inserting entry");
+		return CACHE_ERROR;
+	}
+
+	RDEBUG3("Command results");
+	RINDENT();
+	for (i = 0; i < reply_num; i++) {
+		fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
+		fr_redis_reply_free(replies[i]);
+	}
+	REXDENT();
+
+	return CACHE_OK;
+}
+
 /** Locate a cache entry in redis
  *
  * @copydetails cache_entry_find_t
@@ -120,6 +284,8 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 #endif
 	rlm_cache_entry_t		*c;
 
+	if (driver->format == CACHE_FORMAT_BINARY) return cache_entry_find_binary(out, driver, request, key, key_len);
+
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, key, key_len, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
@@ -285,6 +451,19 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 					.next	= &expires
 				};
 
+	if (driver->format == CACHE_FORMAT_BINARY) {
+		uint8_t		*data;
+		cache_status_t	ret;
+
+		if (cache_serialize_binary(NULL, &data, c) == 0) {
+			ret = cache_entry_insert_binary(driver, request, c, data, talloc_array_length(data));
+			talloc_free(data);
+			return ret;
+		}
+		RPEDEBUG("Failed serializing entry");
+		return CACHE_ERROR;
+	}
+
 	/*
 	 *	Encode the entry created date
 	 */
@@ -171,6 +171,43 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, REQUEST *request, rlm_ca
 		RLM_MODULE_OK;
 }
 
+/** Add a driver's counters to the request
+ *
+ */
+static void cache_stats(rlm_cache_t const *inst, REQUEST *request)
+{
+	rlm_cache_stats_t	stats;
+	VALUE_PAIR		*vp;
+	unsigned int		i;
+
+	struct {
+		unsigned int	attr;
+		uint64_t	value;
+	} counters[3];
+
+	if (!inst->config.stats || !inst->driver->stats) return;
+
+	inst->driver->stats(&stats, &inst->config, inst->driver_inst->data);
+
+	counters[0].attr = FR_CACHE_HITS;
+	counters[0].value = stats.hits;
+	counters[1].attr = FR_CACHE_MISSES;
+	counters[1].value = stats.misses;
+	counters[2].attr = FR_CACHE_EVICTIONS;
+	counters[2].value = stats.evictions;
+
+	rad_assert(request->packet != NULL);
+	for (i = 0; i < (sizeof(counters) / sizeof(counters[0])); i++) {
+		vp = fr_pair_find_by_num(request->packet->vps, 0, counters[i].attr, TAG_ANY);
+		if (!vp) {
+			vp = fr_pair_afrom_num(request->packet, 0, counters[i].attr);
+			rad_assert(vp != NULL);
+			fr_pair_add(&request->packet->vps, vp);
+		}
+		vp->vp_uint64 = counters[i].value;
+	}
+}
+
 /** Find a cached entry.
  *
  * @return
@@ -348,6 +385,9 @@ static rlm_rcode_t cache_insert(rlm_cache_t const *inst, REQUEST *request, rlm_c
 			case FR_CACHE_STATUS_ONLY:
 			case FR_CACHE_MERGE_NEW:
 			case FR_CACHE_ENTRY_HITS:
+			case FR_CACHE_HITS:
+			case FR_CACHE_MISSES:
+			case FR_CACHE_EVICTIONS:
 				RDEBUG2("Skipping %s", vp->da->name);
 				continue;
 
@@ -759,6 +799,8 @@ finish:
 	cache_free(inst, &c);
 	cache_release(inst, request, &handle);
 
+	cache_stats(inst, request);
+
 	/*
 	 *	Clear control attributes
 	 */
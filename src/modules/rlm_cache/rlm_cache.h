@@ -83,6 +83,16 @@ typedef struct rlm_cache_entry_t {
 	vp_map_t		*maps;			//!< Head of the maps list.
 } rlm_cache_entry_t;
 
+/** Counters maintained by drivers which keep entries locally
+ *
+ */
+typedef struct rlm_cache_stats_t {
+	uint64_t		hits;			//!< Lookups which found an entry.
+	uint64_t		misses;			//!< Lookups which didn't find an entry.
+	uint64_t		evictions;		//!< Entries removed before they expired,
+							//!< to make space for new ones.
+} rlm_cache_stats_t;
+
 /** Instantiate a driver
  *
  * Function to handle any driver specific instantiation.
@@ -232,6 +242,17 @@ typedef cache_status_t	(*cache_entry_set_ttl_t)(rlm_cache_config_t const *config
 typedef uint32_t	(*cache_entry_count_t)(rlm_cache_config_t const *config, void *instance,
 					       REQUEST *request, void *handle);
 
+/** Get the driver's hit/miss/eviction counters
+ *
+ * @note This callback is optional.  If it's not provided add_stats will only
+ *	add the per entry statistics.
+ *
+ * @param[out] out Where to write the counters.
+ * @param[in] config for this instance of the rlm_cache module.
+ * @param[in] instance Driver specific instance data.
+ */
+typedef void		(*cache_stats_t)(rlm_cache_stats_t *out, rlm_cache_config_t const *config, void *instance);
+
 /** Acquire a handle to access the cache
  *
  * @note This callback is optional. If it's not provided the handle argument to other callbacks
@@ -289,6 +310,7 @@ struct cache_driver {
 	cache_entry_set_ttl_t		set_ttl;		//!< (Optional) Update the TTL of an entry.
 	cache_entry_count_t		count;			//!< (Optional) Number of entries currently in
 								//!< the cache.
+	cache_stats_t			stats;			//!< (optional) Driver wide counters.
 
 	cache_acquire_t			acquire;		//!< (optional) Acquire exclusive access to a resource
 								//!< used to retrieve the cache entry.
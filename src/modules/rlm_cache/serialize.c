@@ -28,6 +28,12 @@ RCSID("$Id$")
 #include "rlm_cache.h"
 #include "serialize.h"
 
+const FR_NAME_NUMBER cache_format_table[] = {
+	{ "text",	CACHE_FORMAT_TEXT },
+	{ "binary",	CACHE_FORMAT_BINARY },
+	{  NULL , -1 }
+};
+
 /** Serialize a cache entry as a humanly readable string
  *
  * @param ctx to alloc new string in. Should be a talloc pool a little bigger
@@ -64,8 +70,9 @@ int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c)
 	}
 
 	for (map = c->maps; map; map = map->next) {
-		char	*value;
-		size_t	len;
+		char		*value;
+		char const	*quote;
+		size_t		len;
 
 		len = tmpl_snprint(attr, sizeof(attr), map->lhs);
 		if (is_truncated(len, sizeof(attr))) {
@@ -77,9 +84,16 @@ int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c)
 		value = fr_value_box_asprint(value_pool, &map->rhs->tmpl_value, '\'');
 		if (!value) goto error;
 
-		to_store = talloc_asprintf_append_buffer(to_store, "%s %s %s\n", attr,
+		/*
+		 *	Strings are escaped, but not quoted, and
+		 *	would otherwise be split at the first space
+		 *	when they're read back.
+		 */
+		quote = (map->rhs->tmpl_value_type == FR_TYPE_STRING) ? "'" : "";
+
+		to_store = talloc_asprintf_append_buffer(to_store, "%s %s %s%s%s\n", attr,
 							 fr_int2str(fr_tokens_table, map->op, "<INVALID>"),
-							 value);
+							 quote, value, quote);
 		if (!to_store) goto error;
 	}
 finish:
@@ -131,7 +145,11 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 			goto error;
 		}
 
-		if (map->rhs->type != TMPL_TYPE_UNPARSED) {
+		/*
+		 *	Octets values are printed as bare hex strings,
+		 *	which are parsed as data, not as literals.
+		 */
+		if ((map->rhs->type != TMPL_TYPE_UNPARSED) && (map->rhs->type != TMPL_TYPE_DATA)) {
 			fr_strerror_printf("Pair right hand side \"%s\" parsed as %s, needed literal.  "
 					   "Check serialized data quoting", map->rhs->name,
 					   fr_int2str(tmpl_names, map->rhs->type, "<INVALID>"));
@@ -172,3 +190,289 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 
 	return 0;
 }
+
+/*
+ *	Binary format
+ *
+ *	Header:
+ *
+ *	  magic (1) | version (1) | created (8) | expires (8)
+ *
+ *	Followed by zero or more maps:
+ *
+ *	  op (1) | request (1) | list (1) | tag (1) | num (4) | type (1) |
+ *	  depth (1) | attr (4) * depth | length (4) | value (length)
+ *
+ *	The attribute is identified by the attribute numbers on the path
+ *	from the root of the internal dictionary, so vendor and TLV
+ *	attributes don't need to be looked up by name.  The value is in
+ *	the format produced by fr_value_box_to_network().  All integers
+ *	are big endian.
+ */
+#define CACHE_BINARY_HDR_LEN	18
+#define CACHE_BINARY_MAP_LEN	14	/* Fixed length fields in each map, including the value length */
+
+static inline uint8_t *cache_put_uint32(uint8_t *p, uint32_t num)
+{
+	p[0] = (num >> 24) & 0xff;
+	p[1] = (num >> 16) & 0xff;
+	p[2] = (num >> 8) & 0xff;
+	p[3] = num & 0xff;
+
+	return p + 4;
+}
+
+static inline uint32_t cache_get_uint32(uint8_t const *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static inline uint8_t *cache_put_uint64(uint8_t *p, uint64_t num)
+{
+	p = cache_put_uint32(p, (uint32_t) (num >> 32));
+	return cache_put_uint32(p, (uint32_t) num);
+}
+
+static inline uint64_t cache_get_uint64(uint8_t const *p)
+{
+	return ((uint64_t) cache_get_uint32(p) << 32) | (uint64_t) cache_get_uint32(p + 4);
+}
+
+/** Check whether a serialized cache entry is in the binary format
+ *
+ * Text entries always start with an attribute reference, so the two
+ * formats can be stored side by side.
+ *
+ * @param in Serialized cache entry.
+ * @param inlen Length of the serialized entry.
+ * @return true if the entry is in the binary format.
+ */
+bool cache_serialized_is_binary(uint8_t const *in, size_t inlen)
+{
+	return (inlen >= 2) && (in[0] == CACHE_BINARY_MAGIC);
+}
+
+/** Serialize a cache entry in the compact binary format
+ *
+ * @param ctx to alloc the buffer in.
+ * @param out Where to write pointer to the serialized cache entry.  The
+ *	length of the entry is the length of the talloced array.
+ * @param c Cache entry to serialize.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, e.g. if the entry contains values which can't be
+ *	  encoded.  Callers may fall back to #cache_serialize.
+ */
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c)
+{
+	uint8_t		*buff, *p;
+	size_t		len, used;
+	vp_map_t	*map;
+
+	len = CACHE_BINARY_HDR_LEN;
+	for (map = c->maps; map; map = map->next) len += CACHE_BINARY_MAP_LEN + 32;
+
+	buff = talloc_array(ctx, uint8_t, len);
+	if (!buff) return -1;
+
+	p = buff;
+	*p++ = CACHE_BINARY_MAGIC;
+	*p++ = CACHE_BINARY_VERSION;
+	p = cache_put_uint64(p, (uint64_t) c->created);
+	p = cache_put_uint64(p, (uint64_t) c->expires);
+
+	for (map = c->maps; map; map = map->next) {
+		fr_dict_attr_t const	*da;
+		uint8_t			*length;
+		ssize_t			slen;
+		size_t			need = 0;
+		unsigned int		depth, i;
+
+		if (map->lhs->type != TMPL_TYPE_ATTR) {
+			fr_strerror_printf("Can't serialize map with left hand side of type %s",
+					   fr_int2str(tmpl_names, map->lhs->type, "<INVALID>"));
+		error:
+			talloc_free(buff);
+			return -1;
+		}
+
+		if (map->rhs->type != TMPL_TYPE_DATA) {
+			fr_strerror_printf("Can't serialize map with right hand side of type %s",
+					   fr_int2str(tmpl_names, map->rhs->type, "<INVALID>"));
+			goto error;
+		}
+
+		da = map->lhs->tmpl_da;
+		if (da->flags.is_unknown || (da->depth == 0) || (da->depth > FR_DICT_MAX_TLV_STACK)) {
+			fr_strerror_printf("Can't serialize attribute \"%s\"", da->name);
+			goto error;
+		}
+		depth = da->depth;
+
+		/*
+		 *	Make sure we've got space for the fixed
+		 *	length fields.
+		 */
+		used = p - buff;
+		if ((len - used) < (CACHE_BINARY_MAP_LEN + (depth * 4))) {
+			len += CACHE_BINARY_MAP_LEN + (depth * 4) + 32;
+		grow:
+			buff = talloc_realloc(ctx, buff, uint8_t, len);
+			if (!buff) return -1;
+			p = buff + used;
+		}
+
+		p[0] = map->op;
+		p[1] = map->lhs->tmpl_request;
+		p[2] = map->lhs->tmpl_list;
+		p[3] = (uint8_t) map->lhs->tmpl_tag;
+		cache_put_uint32(p + 4, (uint32_t) map->lhs->tmpl_num);
+		p[8] = map->rhs->tmpl_value_type;
+		p[9] = depth;
+
+		/*
+		 *	Attribute numbers, from the root down.
+		 */
+		for (i = depth; i > 0; i--, da = da->parent) cache_put_uint32(p + 10 + ((i - 1) * 4), da->attr);
+
+		length = p + 10 + (depth * 4);
+
+		slen = fr_value_box_to_network(&need, length + 4, len - used - CACHE_BINARY_MAP_LEN - (depth * 4),
+					       &map->rhs->tmpl_value);
+		if (slen < 0) goto error;
+		if (need > 0) {
+			len += need;
+			goto grow;
+		}
+		cache_put_uint32(length, (uint32_t) slen);
+
+		p = length + 4 + slen;
+	}
+
+	/*
+	 *	Trim the buffer, so the array length is the length
+	 *	of the entry.
+	 */
+	used = p - buff;
+	if (used < len) {
+		buff = talloc_realloc(ctx, buff, uint8_t, used);
+		if (!buff) return -1;
+	}
+	*out = buff;
+
+	return 0;
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param c Cache entry to populate (should already be allocated)
+ * @param in Binary representation of cache entry.
+ * @param inlen Length of the binary data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen)
+{
+	vp_map_t		**last = &c->maps;
+	uint8_t const		*p = in, *end = in + inlen;
+	fr_dict_attr_t const	*root = fr_dict_root(fr_dict_internal);
+
+	if (!cache_serialized_is_binary(in, inlen)) {
+		fr_strerror_printf("Entry is not in the binary format");
+		return -1;
+	}
+
+	if (in[1] != CACHE_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported binary format version %u, expected %u",
+				   in[1], CACHE_BINARY_VERSION);
+		return -1;
+	}
+
+	if (inlen < CACHE_BINARY_HDR_LEN) {
+	truncated:
+		fr_strerror_printf("Binary entry truncated at offset %zu", (size_t) (p - in));
+		return -1;
+	}
+	c->created = (time_t) cache_get_uint64(in + 2);
+	c->expires = (time_t) cache_get_uint64(in + 10);
+	p += CACHE_BINARY_HDR_LEN;
+
+	while (p < end) {
+		vp_map_t		*map;
+		fr_dict_attr_t const	*da = root;
+		fr_type_t		type;
+		unsigned int		depth, i;
+		uint32_t		length;
+
+		if ((size_t) (end - p) < CACHE_BINARY_MAP_LEN) goto truncated;
+
+		depth = p[9];
+		if ((size_t) (end - p) < (CACHE_BINARY_MAP_LEN + (depth * 4))) goto truncated;
+
+		for (i = 0; i < depth; i++) {
+			da = fr_dict_attr_child_by_num(da, cache_get_uint32(p + 10 + (i * 4)));
+			if (!da) {
+				fr_strerror_printf("Unknown attribute in binary entry.  Check local dictionaries");
+				return -1;
+			}
+		}
+		if (da == root) {
+			fr_strerror_printf("Binary entry contains an empty attribute reference");
+			return -1;
+		}
+
+		type = p[8];
+		if ((type == FR_TYPE_INVALID) || (type >= FR_TYPE_MAX)) {
+			fr_strerror_printf("Invalid value type %u in binary entry", type);
+			return -1;
+		}
+
+		length = cache_get_uint32(p + 10 + (depth * 4));
+		if ((size_t) (end - p) < (CACHE_BINARY_MAP_LEN + (depth * 4) + length)) goto truncated;
+
+		MEM(map = talloc_zero(c, vp_map_t));
+		map->op = p[0];
+
+		MEM(map->lhs = tmpl_alloc(map, TMPL_TYPE_ATTR, NULL, 0, T_BARE_WORD));
+		map->lhs->name = da->name;
+		map->lhs->len = strlen(da->name);
+		map->lhs->quote = T_BARE_WORD;
+		map->lhs->tmpl_da = da;
+		map->lhs->tmpl_request = p[1];
+		map->lhs->tmpl_list = p[2];
+		map->lhs->tmpl_tag = (int8_t) p[3];
+		map->lhs->tmpl_num = (int32_t) cache_get_uint32(p + 4);
+
+		MEM(map->rhs = tmpl_alloc(map, TMPL_TYPE_DATA, NULL, 0, T_BARE_WORD));
+		map->rhs->name = "";
+		map->rhs->quote = T_BARE_WORD;
+		p += CACHE_BINARY_MAP_LEN + (depth * 4);
+
+		/*
+		 *	fr_value_box_from_network() byte swaps fixed
+		 *	length values in place before it sets the
+		 *	type, so the type has to be set first.
+		 */
+		map->rhs->tmpl_value.type = type;
+		if (fr_value_box_from_network(map->rhs, &map->rhs->tmpl_value, type, da,
+					      p, length, true) < 0) {
+		error:
+			talloc_free(map);
+			return -1;
+		}
+		map->rhs->tmpl_value_type = type;
+
+		/*
+		 *	The attribute's type may have changed since
+		 *	the entry was written.
+		 */
+		if (tmpl_cast_in_place(map->rhs, da->type, da) < 0) goto error;
+		p += length;
+
+		*last = map;
+		last = &(*last)->next;
+	}
+
+	return 0;
+}
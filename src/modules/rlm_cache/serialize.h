@@ -25,5 +25,19 @@
  */
 RCSIDH(serialize_h, "$Id$")
 
+typedef enum {
+	CACHE_FORMAT_TEXT = 0,				//!< One "attr op value" line per map.
+	CACHE_FORMAT_BINARY				//!< Attribute numbers and network encoded values.
+} cache_format_t;
+
+extern const FR_NAME_NUMBER cache_format_table[];
+
+#define CACHE_BINARY_MAGIC	0xca		//!< First byte of binary serialized entries.
+#define CACHE_BINARY_VERSION	1		//!< Bump when the binary format changes.
+
 int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c);
 int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen);
+
+bool cache_serialized_is_binary(uint8_t const *in, size_t inlen);
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c);
+int cache_deserialize_binary(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen);
@@ -1,2 +1,4 @@
 TARGET		:= rlm_detail.a
 SOURCES		:= rlm_detail.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
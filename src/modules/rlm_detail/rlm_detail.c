@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/exfile.h>
+#include <freeradius-devel/radius/radius.h>
 
 #include <ctype.h>
 #include <fcntl.h>
@@ -60,6 +61,8 @@ typedef struct detail_instance {
 
 	bool		log_srcdst;	//!< Add IP src/dst attributes to entries.
 
+	bool		binary;		//!< Write binary records instead of text.
+
 	bool		escape;		//!< do filename escaping, yes / no
 
 	xlat_escape_t	escape_func; //!< escape function
@@ -77,6 +80,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", FR_TYPE_BOOL, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", FR_TYPE_BOOL, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("binary", FR_TYPE_BOOL, rlm_detail_t, binary), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -185,6 +189,21 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/** Whether an attribute should be left out of the detail file
+ *
+ */
+static bool detail_suppress(rlm_detail_t const *inst, VALUE_PAIR const *vp, bool compat)
+{
+	if (inst->ht && fr_hash_table_finddata(inst->ht, vp->da)) return true;
+
+	/*
+	 *	Don't print passwords in old format...
+	 */
+	if (compat && !vp->da->vendor && (vp->da->attr == FR_USER_PASSWORD)) return true;
+
+	return false;
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
@@ -302,12 +321,7 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 		     vp = fr_cursor_next(&cursor)) {
 			FR_TOKEN op;
 
-			if (inst->ht && fr_hash_table_finddata(inst->ht, vp->da)) continue;
-
-			/*
-			 *	Don't print passwords in old format...
-			 */
-			if (compat && !vp->da->vendor && (vp->da->attr == FR_USER_PASSWORD)) continue;
+			if (detail_suppress(inst, vp, compat)) continue;
 
 			/*
 			 *	Print all of the attributes, operator should always be '='.
@@ -340,6 +354,98 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 	return 0;
 }
 
+/** Write a single binary detail record to a file descriptor
+ *
+ * The packet is encoded as a RADIUS packet, which proto_detail can
+ * decode directly.  Internal attributes are not written, the packet
+ * addresses and timestamp are written in the record header instead.
+ *
+ * @param[in] outfd Where to write the record.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
+ * @param[in] compat Leave out the same attributes as a text entry in compatibility mode.
+ */
+static int detail_write_binary(int outfd, rlm_detail_t const *inst, REQUEST *request,
+			       RADIUS_PACKET *packet, bool compat)
+{
+	fr_radius_detail_t	detail;
+	VALUE_PAIR		*vp, *vps = packet->vps, *copy = NULL;
+	fr_cursor_t		cursor;
+	uint8_t			*buffer;
+	ssize_t			len;
+	int			ret = -1;
+
+	if (!packet->vps) {
+		RWDEBUG("Skipping empty packet");
+		return 0;
+	}
+
+	/*
+	 *	Only copy the list if we have to leave some
+	 *	attributes out.
+	 */
+	for (vp = fr_cursor_init(&cursor, &packet->vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (detail_suppress(inst, vp, compat)) break;
+	}
+
+	if (vp) {
+		fr_cursor_t out;
+
+		fr_cursor_init(&out, &copy);
+		for (vp = fr_cursor_head(&cursor);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) {
+			VALUE_PAIR *new;
+
+			if (detail_suppress(inst, vp, compat)) continue;
+
+			MEM(new = fr_pair_copy(request, vp));
+			fr_cursor_append(&out, new);
+		}
+		vps = copy;
+	}
+
+	memset(&detail, 0, sizeof(detail));
+	detail.code = packet->code;
+	detail.timestamp = request->packet->timestamp;
+	detail.src_ipaddr = packet->src_ipaddr;
+	detail.src_port = packet->src_port;
+	detail.dst_ipaddr = packet->dst_ipaddr;
+	detail.dst_port = packet->dst_port;
+	if (request->client) detail.client_ipaddr = request->client->ipaddr;
+
+	buffer = talloc_array(request, uint8_t, FR_RADIUS_DETAIL_MAX_LEN);
+	if (!buffer) {
+		RERROR("Out of memory");
+		goto finish;
+	}
+
+	len = fr_radius_detail_encode(buffer, FR_RADIUS_DETAIL_MAX_LEN, &detail, vps);
+	if (len < 0) {
+		RPERROR("Failed encoding detail record");
+		goto finish;
+	}
+
+	/*
+	 *	One write() per record, so that records from
+	 *	different requests aren't interleaved.
+	 */
+	if (write(outfd, buffer, len) != len) {
+		RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+		goto finish;
+	}
+	ret = 0;
+
+finish:
+	talloc_free(buffer);
+	fr_pair_list_free(&copy);
+
+	return ret;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -391,6 +497,16 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 	}
 
 skip_group:
+	if (inst->binary) {
+		if (detail_write_binary(outfd, inst, request, packet, compat) < 0) {
+			exfile_close(inst->ef, request, outfd);
+			return RLM_MODULE_FAIL;
+		}
+
+		exfile_close(inst->ef, request, outfd);
+		return RLM_MODULE_OK;
+	}
+
 	outfp = NULL;
 	dupfd = dup(outfd);
 	if (dupfd < 0) {
@@ -179,15 +179,52 @@ static expr_map_t map[] =
 	{0,	TOKEN_LAST}
 };
 
-static bool get_expression(REQUEST *request, char const **string, int64_t *answer, expr_token_t prev);
+/*
+ *	Expressions are parsed into a tree, so that an expression
+ *	without any dynamic expansions only has to be parsed once,
+ *	when the xlat is tokenized.
+ */
+typedef enum expr_node_type_t {
+	EXPR_NODE_INTEGER = 0,				//!< Integer literal.
+	EXPR_NODE_ATTRIBUTE,				//!< Sum of the values of an attribute.
+	EXPR_NODE_BRACKETS,				//!< Sub-expression in brackets.
+	EXPR_NODE_OPERATOR				//!< lhs <op> rhs.
+} expr_node_type_t;
+
+typedef struct expr_node_t expr_node_t;
+struct expr_node_t {
+	expr_node_type_t	type;
+	bool			invert;			//!< Apply ~ to the value of the node.
+	bool			negative;		//!< Apply - to the value of the node.
+
+	union {
+		int64_t		value;			//!< #EXPR_NODE_INTEGER.
+		vp_tmpl_t	*vpt;			//!< #EXPR_NODE_ATTRIBUTE.
+		expr_node_t	*child;			//!< #EXPR_NODE_BRACKETS.
+		struct {
+			expr_token_t	op;		//!< #EXPR_NODE_OPERATOR.
+			expr_node_t	*lhs;
+			expr_node_t	*rhs;
+		};
+	};
+};
+
+/*
+ *	Instance data for each call to the expr xlat.
+ */
+typedef struct rlm_expr_xlat_inst_t {
+	expr_node_t		*tree;			//!< Parsed expression, or NULL if it has to
+							//!< be parsed at run time.
+} rlm_expr_xlat_inst_t;
+
+static bool get_expression(TALLOC_CTX *ctx, char const **string, expr_node_t **out, expr_token_t prev);
 
-static bool get_number(REQUEST *request, char const **string, int64_t *answer)
+static bool get_number(TALLOC_CTX *ctx, char const **string, expr_node_t **out)
 {
-	int64_t x;
-	bool invert = false;
-	bool negative = false;
-	char const *p = *string;
-	vp_tmpl_t *vpt = NULL;
+	bool		invert = false;
+	bool		negative = false;
+	char const	*p = *string;
+	expr_node_t	*node;
 
 	/*
 	 *	Look for a number.
@@ -202,6 +239,8 @@ static bool get_number(REQUEST *request, char const **string, int64_t *answer)
 		p++;
 	}
 
+	MEM(node = talloc_zero(ctx, expr_node_t));
+
 	/*
 	 *  No algrebraic operator found, the next thing
 	 *  MUST be a number.
@@ -211,7 +250,8 @@ static bool get_number(REQUEST *request, char const **string, int64_t *answer)
 	if ((*p == '0') && (p[1] == 'x')) {
 		char *end;
 
-		x = strtoul(p, &end, 16);
+		node->type = EXPR_NODE_INTEGER;
+		node->value = strtoul(p, &end, 16);
 		p = end;
 		goto done;
 	}
@@ -225,78 +265,25 @@ static bool get_number(REQUEST *request, char const **string, int64_t *answer)
 	 *	Look for an attribute.
 	 */
 	if (*p == '&') {
-		int		i, max, err;
 		ssize_t		slen;
-		VALUE_PAIR	*vp;
-		fr_cursor_t	cursor;
 
 		p += 1;
 
-		slen = tmpl_afrom_attr_substr(request, &vpt, p, REQUEST_CURRENT, PAIR_LIST_REQUEST, false, false);
+		node->type = EXPR_NODE_ATTRIBUTE;
+
+		slen = tmpl_afrom_attr_substr(node, &node->vpt, p, REQUEST_CURRENT, PAIR_LIST_REQUEST, false, false);
 		if (slen <= 0) {
-			REDEBUG("Failed parsing attribute name '%s': %s", p, fr_strerror());
+			fr_strerror_printf("Failed parsing attribute name '%s': %s", p, fr_strerror());
 			return false;
 		}
 
 		p += slen;
 
-		if (vpt->tmpl_num == NUM_COUNT) {
-			REDEBUG("Attribute count is not supported");
+		if (node->vpt->tmpl_num == NUM_COUNT) {
+			fr_strerror_printf("Attribute count is not supported");
 			return false;
 		}
 
-		if (vpt->tmpl_num == NUM_ALL) {
-			max = 65535;
-		} else {
-			max = 1;
-		}
-
-		x = 0;
-		for (i = 0, vp = tmpl_cursor_init(&err, &cursor, request, vpt);
-		     (i < max) && (vp != NULL);
-		     i++, vp = fr_cursor_next(&cursor)) {
-			int64_t y;
-
-			if (vp->vp_type != FR_TYPE_UINT64) {
-				fr_value_box_t	value;
-
-				if (fr_value_box_cast(vp, &value, FR_TYPE_UINT64, NULL, &vp->data) < 0) {
-					REDEBUG("Failed converting &%.*s to an integer value: %s", (int) vpt->len,
-						vpt->name, fr_strerror());
-					return false;
-				}
-				if (value.vb_uint64 > INT64_MAX) {
-				overflow:
-					talloc_free(vpt);
-					REDEBUG("Value of &%.*s (%"PRIu64 ") would overflow a signed 64bit integer "
-						"(our internal arithmetic type)", (int)vpt->len, vpt->name, value.vb_uint64);
-					return false;
-				}
-				y = (int64_t)value.vb_uint64;
-
-				RINDENT();
-				RDEBUG3("&%.*s --> %" PRIu64, (int)vpt->len, vpt->name, y);
-				REXDENT();
-			} else {
-				if (vp->vp_uint64 > INT64_MAX) goto overflow;
-				y = (int64_t)vp->vp_uint64;
-			}
-
-			/*
-			 *	Check for overflow without actually overflowing.
-			 */
-			if ((y > 0) && (x > (int64_t) INT64_MAX - y)) goto overflow;
-
-			if ((y < 0) && (x < (int64_t) INT64_MIN - y)) goto overflow;
-
-			x += y;
-		} /* loop over all found VPs */
-
-		if (err != 0) {
-			RWDEBUG("Can't find &%.*s.  Using 0 as operand value", (int)vpt->len, vpt->name);
-			goto done;
-		}
-
 		goto done;
 	}
 
@@ -305,10 +292,13 @@ static bool get_number(REQUEST *request, char const **string, int64_t *answer)
 	 */
 	if (*p == '(') {
 		p++;
-		if (!get_expression(request, &p, &x, TOKEN_NONE)) return false;
+
+		node->type = EXPR_NODE_BRACKETS;
+
+		if (!get_expression(node, &p, &node->child, TOKEN_NONE)) return false;
 
 		if (*p != ')') {
-			RDEBUG("No trailing ')'");
+			fr_strerror_printf("No trailing ')'");
 			return false;
 		}
 		p++;
@@ -316,7 +306,7 @@ static bool get_number(REQUEST *request, char const **string, int64_t *answer)
 	}
 
 	if ((*p < '0') || (*p > '9')) {
-		RDEBUG2("Not a number at \"%s\"", p);
+		fr_strerror_printf("Not a number at \"%s\"", p);
 		return false;
 	}
 
@@ -324,22 +314,29 @@ static bool get_number(REQUEST *request, char const **string, int64_t *answer)
 	 *  This is doing it the hard way, but it also allows
 	 *  us to increment 'p'.
 	 */
-	x = 0;
+	node->type = EXPR_NODE_INTEGER;
 	while ((*p >= '0') && (*p <= '9')) {
-		x *= 10;
-		x += (*p - '0');
+		node->value *= 10;
+		node->value += (*p - '0');
 		p++;
 	}
 
 done:
-	if (vpt) talloc_free(vpt);
-
-	if (invert) x = ~x;
+	/*
+	 *	Literals can be inverted / negated now, everything
+	 *	else has to wait until it's evaluated.
+	 */
+	if (node->type == EXPR_NODE_INTEGER) {
+		if (invert) node->value = ~node->value;
 
-	if (negative) x = -x;
+		if (negative) node->value = -node->value;
+	} else {
+		node->invert = invert;
+		node->negative = negative;
+	}
 
 	*string = p;
-	*answer = x;
+	*out = node;
 	return true;
 }
 
@@ -429,7 +426,7 @@ static bool calc_result(REQUEST *request, int64_t lhs, expr_token_t op, int64_t
 	return true;
 }
 
-static bool get_operator(REQUEST *request, char const **string, expr_token_t *op)
+static bool get_operator(char const **string, expr_token_t *op)
 {
 	int		i;
 	char const	*p = *string;
@@ -457,20 +454,20 @@ static bool get_operator(REQUEST *request, char const **string, expr_token_t *op
 		return true;
 	}
 
-	RDEBUG("Expected operator at \"%s\"", p);
+	fr_strerror_printf("Expected operator at \"%s\"", p);
 	return false;
 }
 
 
-static bool get_expression(REQUEST *request, char const **string, int64_t *answer, expr_token_t prev)
+static bool get_expression(TALLOC_CTX *ctx, char const **string, expr_node_t **out, expr_token_t prev)
 {
-	int64_t		lhs, rhs;
+	expr_node_t	*lhs, *rhs, *node;
 	char const 	*p, *op_p;
 	expr_token_t	this;
 
 	p = *string;
 
-	if (!get_number(request, &p, &lhs)) return false;
+	if (!get_number(ctx, &p, &lhs)) return false;
 
 redo:
 	while (isspace((int) *p)) p++;
@@ -479,7 +476,7 @@ redo:
 	 *	A number by itself is OK.
 	 */
 	if (!*p || (*p == ')')) {
-		*answer = lhs;
+		*out = lhs;
 		*string = p;
 		return true;
 	}
@@ -488,7 +485,7 @@ redo:
 	 *	Peek at the operator.
 	 */
 	op_p = p;
-	if (!get_operator(request, &p, &this)) return false;
+	if (!get_operator(&p, &this)) return false;
 
 	/*
 	 *	a + b + c ... = (a + b) + c ...
@@ -498,7 +495,7 @@ redo:
 	 *	care of continuing.
 	 */
 	if (precedence[this] <= precedence[prev]) {
-		*answer = lhs;
+		*out = lhs;
 		*string = op_p;
 		return true;
 	}
@@ -506,42 +503,196 @@ redo:
 	/*
 	 *	a + b * c ... = a + (b * c) ...
 	 */
-	if (!get_expression(request, &p, &rhs, this)) return false;
+	if (!get_expression(ctx, &p, &rhs, this)) return false;
 
-	if (!calc_result(request, lhs, this, rhs, answer)) return false;
+	MEM(node = talloc_zero(ctx, expr_node_t));
+	node->type = EXPR_NODE_OPERATOR;
+	node->op = this;
+	node->lhs = lhs;
+	node->rhs = rhs;
 
 	/*
-	 *	There may be more to calculate.  The answer we
-	 *	calculated here is now the LHS of the lower priority
+	 *	There may be more to calculate.  The expression we
+	 *	parsed here is now the LHS of the lower priority
 	 *	operation which follows the current expression.  e.g.
 	 *
 	 *	a * b + c ... = (a * b) + c ...
 	 *	              =       d + c ...
 	 */
-	lhs = *answer;
+	lhs = node;
 	goto redo;
 }
 
+/** Parse an expression
+ *
+ * @param[in] ctx	to allocate the tree in.
+ * @param[in] fmt	the expression.
+ * @return
+ *	- The root of the tree.
+ *	- NULL on error, with the error in fr_strerror().
+ */
+static expr_node_t *expr_parse(TALLOC_CTX *ctx, char const *fmt)
+{
+	char const	*p = fmt;
+	expr_node_t	*tree;
+
+	if (!get_expression(ctx, &p, &tree, TOKEN_NONE)) return NULL;
+
+	if (*p) {
+		fr_strerror_printf("Invalid text after expression: %s", p);
+		return NULL;
+	}
+
+	return tree;
+}
+
+/** Sum the values of an attribute
+ *
+ */
+static bool expr_eval_attribute(REQUEST *request, vp_tmpl_t const *vpt, int64_t *answer)
+{
+	int		i, max, err;
+	int64_t		x = 0;
+	VALUE_PAIR	*vp;
+	fr_cursor_t	cursor;
+
+	if (vpt->tmpl_num == NUM_ALL) {
+		max = 65535;
+	} else {
+		max = 1;
+	}
+
+	for (i = 0, vp = tmpl_cursor_init(&err, &cursor, request, vpt);
+	     (i < max) && (vp != NULL);
+	     i++, vp = fr_cursor_next(&cursor)) {
+		int64_t		y;
+		uint64_t	value;
+
+		if (vp->vp_type != FR_TYPE_UINT64) {
+			fr_value_box_t	cast;
+
+			if (fr_value_box_cast(vp, &cast, FR_TYPE_UINT64, NULL, &vp->data) < 0) {
+				REDEBUG("Failed converting &%.*s to an integer value: %s", (int) vpt->len,
+					vpt->name, fr_strerror());
+				return false;
+			}
+			value = cast.vb_uint64;
+
+			RINDENT();
+			RDEBUG3("&%.*s --> %" PRIu64, (int)vpt->len, vpt->name, value);
+			REXDENT();
+		} else {
+			value = vp->vp_uint64;
+		}
+
+		if (value > INT64_MAX) {
+		overflow:
+			REDEBUG("Value of &%.*s (%"PRIu64 ") would overflow a signed 64bit integer "
+				"(our internal arithmetic type)", (int)vpt->len, vpt->name, value);
+			return false;
+		}
+		y = (int64_t)value;
+
+		/*
+		 *	Check for overflow without actually overflowing.
+		 */
+		if ((y > 0) && (x > (int64_t) INT64_MAX - y)) goto overflow;
+
+		x += y;
+	} /* loop over all found VPs */
+
+	if (err != 0) RWDEBUG("Can't find &%.*s.  Using 0 as operand value", (int)vpt->len, vpt->name);
+
+	*answer = x;
+	return true;
+}
+
+/** Evaluate a parsed expression
+ *
+ */
+static bool expr_eval(REQUEST *request, expr_node_t const *node, int64_t *answer)
+{
+	int64_t		x = 0, lhs, rhs;
+
+	switch (node->type) {
+	case EXPR_NODE_INTEGER:
+		*answer = node->value;
+		return true;
+
+	case EXPR_NODE_ATTRIBUTE:
+		if (!expr_eval_attribute(request, node->vpt, &x)) return false;
+		break;
+
+	case EXPR_NODE_BRACKETS:
+		if (!expr_eval(request, node->child, &x)) return false;
+		break;
+
+	case EXPR_NODE_OPERATOR:
+		if (!expr_eval(request, node->lhs, &lhs)) return false;
+		if (!expr_eval(request, node->rhs, &rhs)) return false;
+
+		return calc_result(request, lhs, node->op, rhs, answer);
+	}
+
+	if (node->invert) x = ~x;
+
+	if (node->negative) x = -x;
+
+	*answer = x;
+	return true;
+}
+
+/** Pre-parse expressions which don't contain any dynamic expansions
+ *
+ * Anything we can't parse is left to be parsed, and the error
+ * reported, at run time.
+ */
+static int expr_xlat_instantiate(void *xlat_inst, xlat_exp_t const *exp, UNUSED void *uctx)
+{
+	rlm_expr_xlat_inst_t	*inst = xlat_inst;
+	char const		*fmt;
+	TALLOC_CTX		*tree_ctx;
+
+	fmt = xlat_func_literal(exp);
+	if (!fmt) return 0;
+
+	MEM(tree_ctx = talloc_new(inst));
+
+	inst->tree = expr_parse(tree_ctx, fmt);
+	if (!inst->tree) talloc_free(tree_ctx);
+
+	return 0;
+}
+
 /*
  *  Do xlat of strings!
  */
-static ssize_t expr_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-			 UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
+static ssize_t expr_xlat(TALLOC_CTX *ctx, char **out, size_t outlen,
+			 UNUSED void const *mod_inst, void const *xlat_inst,
 			 REQUEST *request, char const *fmt)
 {
-	int64_t		result;
-	char const 	*p;
-
-	p = fmt;
+	rlm_expr_xlat_inst_t const	*inst = xlat_inst;
+	expr_node_t const		*tree;
+	TALLOC_CTX			*tree_ctx = NULL;
+	int64_t				result;
+	bool				ret;
+
+	if (inst && inst->tree) {
+		tree = inst->tree;
+	} else {
+		MEM(tree_ctx = talloc_new(ctx));
 
-	if (!get_expression(request, &p, &result, TOKEN_NONE)) {
-		return -1;
+		tree = expr_parse(tree_ctx, fmt);
+		if (!tree) {
+			REDEBUG("%s", fr_strerror());
+			talloc_free(tree_ctx);
+			return -1;
+		}
 	}
 
-	if (*p) {
-		RDEBUG("Invalid text after expression: %s", p);
-		return -1;
-	}
+	ret = expr_eval(request, tree, &result);
+	talloc_free(tree_ctx);
+	if (!ret) return -1;
 
 	snprintf(*out, outlen, "%lld", (long long int) result);
 	return strlen(*out);
@@ -1811,7 +1962,8 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		inst->xlat_name = cf_section_name1(conf);
 	}
 
-	xlat_register(inst, inst->xlat_name, expr_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_register(inst, inst->xlat_name, expr_xlat, NULL,
+		      expr_xlat_instantiate, sizeof(rlm_expr_xlat_inst_t), XLAT_DEFAULT_BUF_LEN, true);
 
 	xlat_register(inst, "rand", rand_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
 	xlat_register(inst, "randstr", randstr_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
@@ -520,16 +520,57 @@ finish:
 	return rcode;
 }
 
+/** Perform a search for a dynamic group comparison
+ *
+ * Comparisons can't yield, so when the thread's connection is up, the
+ * search is sent on it, and we wait for just that result.  That way group
+ * checks don't need a pooled connection.  Otherwise the search is performed
+ * on the pooled connection.
+ *
+ * @param[out] result Where to write the result, may be NULL in which case result is discarded.
+ * @param[in] request Current request.
+ * @param[in] conn the thread's connection, or NULL to use pconn.
+ * @param[in,out] pconn to use if conn is NULL. May change as this function calls functions which auto re-connect.
+ * @param[in] dn to use as base for the search.
+ * @param[in] scope to use.
+ * @param[in] filter to use, should be pre-escaped.
+ * @param[in] attrs to retrieve.
+ * @return One of the LDAP_PROC_* (#fr_ldap_rcode_t) values.
+ */
+static fr_ldap_rcode_t rlm_ldap_group_search(LDAPMessage **result, REQUEST *request,
+					     fr_ldap_connection_t *conn, fr_ldap_connection_t **pconn,
+					     char const *dn, int scope, char const *filter, char const * const *attrs)
+{
+	fr_ldap_query_t	*query;
+	fr_ldap_rcode_t	status;
+	LDAPMessage	*tmp_msg = NULL;
+
+	if (!conn) return fr_ldap_search(result, request, pconn, dn, scope, filter, attrs, NULL, NULL);
+
+	query = fr_ldap_query_search(request, request, conn, dn, scope, filter, attrs, NULL, NULL, NULL, NULL);
+	if (!query) {
+		RPEDEBUG("Failed sending search");
+		return LDAP_PROC_ERROR;
+	}
+
+	status = fr_ldap_query_wait(query, result ? result : &tmp_msg);
+	talloc_free(query);
+	if (tmp_msg) ldap_msgfree(tmp_msg);
+
+	return status;
+}
+
 /** Query the LDAP directory to check if a group object includes a user object as a member
  *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
- * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] t thread instance.  The search is sent on its connection, if it's up.
+ * @param[in,out] pconn to use otherwise. May change as this function calls functions which auto re-connect.
  * @param[in] check vp containing the group value (name or dn).
  * @return One of the RLM_MODULE_* values.
  */
-rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
-					    VALUE_PAIR *check)
+rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, rlm_ldap_thread_t *t,
+					    fr_ldap_connection_t **pconn, VALUE_PAIR *check)
 
 {
 	fr_ldap_rcode_t	status;
@@ -604,7 +645,8 @@ rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *req
 	}
 
 	RINDENT();
-	status = fr_ldap_search(NULL, request, pconn, base_dn, inst->groupobj_scope, filter, NULL, NULL, NULL);
+	status = rlm_ldap_group_search(NULL, request, rlm_ldap_async_enabled(inst, t) ? t->conn : NULL, pconn,
+				       base_dn, inst->groupobj_scope, filter, NULL);
 	REXDENT();
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
@@ -625,13 +667,15 @@ rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *req
  *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
- * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] t thread instance.  The user object is retrieved using its connection, if it's up.
+ * @param[in,out] pconn to use otherwise, and for resolving group names. May change as this function
+ *	calls functions which auto re-connect.
  * @param[in] dn of user object.
  * @param[in] check vp containing the group value (name or dn).
  * @return One of the RLM_MODULE_* values.
  */
-rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
-					   char const *dn, VALUE_PAIR *check)
+rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, rlm_ldap_thread_t *t,
+					   fr_ldap_connection_t **pconn, char const *dn, VALUE_PAIR *check)
 {
 	rlm_rcode_t	rcode = RLM_MODULE_NOTFOUND, ret;
 	fr_ldap_rcode_t	status;
@@ -644,9 +688,12 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 	char const	*attrs[] = { inst->userobj_membership_attr, NULL };
 	int		i, count, ldap_errno;
 
+	fr_ldap_connection_t	*conn = rlm_ldap_async_enabled(inst, t) ? t->conn : NULL;
+	LDAP			*handle;
+
 	RDEBUG2("Checking user object's %s attributes", inst->userobj_membership_attr);
 	RINDENT();
-	status = fr_ldap_search(&result, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
+	status = rlm_ldap_group_search(&result, request, conn, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs);
 	REXDENT();
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
@@ -662,9 +709,15 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 		goto finish;
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, result);
+	/*
+	 *	The result must be parsed with the handle
+	 *	of the connection it was retrieved on.
+	 */
+	handle = conn ? conn->handle : (*pconn)->handle;
+
+	entry = ldap_first_entry(handle, result);
 	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
 
 		rcode = RLM_MODULE_FAIL;
@@ -672,7 +725,7 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 		goto finish;
 	}
 
-	values = ldap_get_values_len((*pconn)->handle, entry, inst->userobj_membership_attr);
+	values = ldap_get_values_len(handle, entry, inst->userobj_membership_attr);
 	if (!values) {
 		RDEBUG("No group membership attribute(s) found in user object");
 
@@ -166,6 +166,9 @@ static CONF_PARSER option_config[] = {
 	/* timeout for search results */
 	{ FR_CONF_OFFSET("res_timeout", FR_TYPE_TIMEVAL, rlm_ldap_t, handle_config.res_timeout), .dflt = "20" },
 
+	/* delay between attempts to re-open a worker's connection */
+	{ FR_CONF_OFFSET("reconnection_delay", FR_TYPE_TIMEVAL, rlm_ldap_t, handle_config.reconnection_delay), .dflt = "10" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -538,6 +541,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 			     UNUSED VALUE_PAIR *check_pairs, UNUSED VALUE_PAIR **reply_pairs)
 {
 	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = module_thread_instance_find(instance);
 	rlm_rcode_t		rcode;
 
 	bool			found = false;
@@ -603,7 +607,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 	 *	Check groupobj user membership
 	 */
 	if (inst->groupobj_membership_filter) {
-		switch (rlm_ldap_check_groupobj_dynamic(inst, request, &conn, check)) {
+		switch (rlm_ldap_check_groupobj_dynamic(inst, request, t, &conn, check)) {
 		case RLM_MODULE_NOTFOUND:
 			break;
 
@@ -621,7 +625,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 	 *	Check userobj group membership
 	 */
 	if (inst->userobj_membership_attr) {
-		switch (rlm_ldap_check_userobj_dynamic(inst, request, &conn, user_dn, check)) {
+		switch (rlm_ldap_check_userobj_dynamic(inst, request, t, &conn, user_dn, check)) {
 		case RLM_MODULE_NOTFOUND:
 			break;
 
@@ -647,8 +651,215 @@ finish:
 	return 0;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** Convert the result of binding as a user to a module rcode
+ *
+ */
+static rlm_rcode_t ldap_bind_rcode(fr_ldap_rcode_t status)
+{
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		return RLM_MODULE_OK;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		return RLM_MODULE_USERLOCK;
+
+	case LDAP_PROC_REJECT:
+		return RLM_MODULE_REJECT;
+
+	case LDAP_PROC_BAD_DN:
+		return RLM_MODULE_INVALID;
+
+	case LDAP_PROC_NO_RESULT:
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+}
+
+/** State of an asynchronous authentication
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance we're authenticating for.
+	rlm_ldap_thread_t	*thread;		//!< Thread we're authenticating in.
+
+	fr_ldap_query_t		*query;			//!< Search or bind in progress.
+	fr_ldap_rcode_t		status;			//!< Of the last search or bind.
+	LDAPMessage		*result;		//!< Of the user search.
+
+	fr_ldap_connection_t	*conn;			//!< Pooled connection the bind is performed on.
+	char const		*dn;			//!< To bind as.
+} ldap_auth_ctx_t;
+
+static int _ldap_auth_ctx_free(ldap_auth_ctx_t *rctx)
+{
+	if (rctx->result) ldap_msgfree(rctx->result);
+
+	return 0;
+}
+
+static void _mod_authenticate_result(REQUEST *request, fr_ldap_rcode_t status, LDAPMessage *result, void *uctx)
+{
+	ldap_auth_ctx_t	*rctx = talloc_get_type_abort(uctx, ldap_auth_ctx_t);
+
+	rctx->status = status;
+	rctx->result = result;
+	unlang_resumable(request);
+}
+
+static void mod_authenticate_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				    fr_state_action_t action)
+{
+	ldap_auth_ctx_t	*rctx = talloc_get_type_abort(ctx, ldap_auth_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	TALLOC_FREE(rctx->query);			/* Abandons the operation */
+
+	/*
+	 *	The connection may be half way through a bind
+	 *	so it can't be reused.
+	 */
+	if (rctx->conn) {
+		fr_ldap_mux_clear(rctx->conn);
+		fr_pool_connection_close(rctx->inst->pool, request, rctx->conn);
+	}
+
+	talloc_free(rctx);
+}
+
+static rlm_rcode_t mod_authenticate_bind_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	ldap_auth_ctx_t		*rctx = talloc_get_type_abort(ctx, ldap_auth_ctx_t);
+	rlm_rcode_t		rcode;
+
+	fr_ldap_mux_clear(rctx->conn);
+
+	switch (rctx->status) {
+	case LDAP_PROC_SUCCESS:
+		RDEBUG("Bind as user \"%s\" was successful", rctx->dn);
+		break;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		RPEDEBUG("Bind as \"%s\" to \"%s\" not permitted", rctx->dn, inst->handle_config.server);
+		break;
+
+	default:
+		RPEDEBUG("Bind as \"%s\" to \"%s\" failed", rctx->dn, inst->handle_config.server);
+		break;
+	}
+	rcode = ldap_bind_rcode(rctx->status);
+
+	mod_conn_release(inst, request, rctx->conn);
+	talloc_free(rctx);
+
+	return rcode;
+}
+
+/** Send a bind as the user, on a pooled connection
+ *
+ * Binds can't be sent on the thread's shared connection, as they change its
+ * identity, and no other operations can be outstanding while a bind is in
+ * progress.
+ */
+static rlm_rcode_t mod_authenticate_bind(rlm_ldap_t const *inst, REQUEST *request, ldap_auth_ctx_t *rctx)
+{
+	if (!rctx->conn) {
+		rctx->conn = mod_conn_get(inst, request);
+		if (!rctx->conn) {
+			talloc_free(rctx);
+			return RLM_MODULE_FAIL;
+		}
+	}
+
+	if (fr_ldap_mux_async(rctx->conn, rctx->thread->el) < 0) {
+		RPEDEBUG("Failed inserting connection into event loop");
+	error:
+		mod_conn_release(inst, request, rctx->conn);
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	rctx->conn->rebound = true;
+	rctx->query = fr_ldap_query_bind(rctx, request, rctx->conn, rctx->dn, request->password->vp_strvalue,
+					 NULL, NULL, _mod_authenticate_result, rctx);
+	if (!rctx->query) {
+		RPEDEBUG("Bind as \"%s\" to \"%s\" failed", rctx->dn, inst->handle_config.server);
+		fr_ldap_mux_clear(rctx->conn);
+		goto error;
+	}
+
+	RDEBUG2("Waiting for bind result...");
+
+	return unlang_module_yield(request, mod_authenticate_bind_resume, mod_authenticate_signal, rctx);
+}
+
+static rlm_rcode_t mod_authenticate_user_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	ldap_auth_ctx_t		*rctx = talloc_get_type_abort(ctx, ldap_auth_ctx_t);
+	rlm_rcode_t		rcode;
+
+	TALLOC_FREE(rctx->query);
+
+	if ((rctx->status != LDAP_PROC_SUCCESS) && (rctx->status != LDAP_PROC_NO_RESULT)) {
+		RPEDEBUG("Failed performing search");
+	}
+
+	rctx->conn = mod_conn_get(inst, request);
+	if (!rctx->conn) {
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	rctx->dn = rlm_ldap_find_user_result(inst, request, rctx->conn, rctx->status, &rctx->result, false, &rcode);
+	if (!rctx->dn) {
+		mod_conn_release(inst, request, rctx->conn);
+		talloc_free(rctx);
+		return rcode;
+	}
+
+	return mod_authenticate_bind(inst, request, rctx);
+}
+
+/** Find the user's DN, and bind as them, without blocking
+ *
+ */
+static rlm_rcode_t mod_authenticate_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request)
+{
+	ldap_auth_ctx_t		*rctx;
+	VALUE_PAIR		*vp;
+	rlm_rcode_t		rcode;
+
+	MEM(rctx = talloc_zero(request, ldap_auth_ctx_t));
+	talloc_set_destructor(rctx, _ldap_auth_ctx_free);
+	rctx->inst = inst;
+	rctx->thread = t;
+
+	RDEBUG("Login attempt by \"%s\"", request->username->vp_strvalue);
+
+	vp = fr_pair_find_by_num(request->control, 0, FR_LDAP_USERDN, TAG_ANY);
+	if (vp) {
+		RDEBUG("Using user DN from request \"%s\"", vp->vp_strvalue);
+		rctx->dn = vp->vp_strvalue;
+
+		return mod_authenticate_bind(inst, request, rctx);
+	}
+
+	rctx->query = rlm_ldap_find_user_async(rctx, inst, request, t->conn, NULL,
+					       _mod_authenticate_result, rctx, &rcode);
+	if (!rctx->query) {
+		talloc_free(rctx);
+		return rcode;
+	}
+
+	return unlang_module_yield(request, mod_authenticate_user_resume, mod_authenticate_signal, rctx);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rcode_t		rcode;
 	fr_ldap_rcode_t		status;
@@ -691,6 +902,14 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		return RLM_MODULE_INVALID;
 	}
 
+	/*
+	 *	SASL binds can take multiple round trips,
+	 *	so they're still performed synchronously.
+	 */
+	if (!inst->user_sasl.mech && rlm_ldap_async_enabled(inst, thread)) {
+		return mod_authenticate_async(inst, thread, request);
+	}
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
 
@@ -744,32 +963,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 			      inst->user_sasl.mech ? &sasl : NULL,
 			      NULL,
 			      NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG("Bind as user \"%s\" was successful", dn);
-		break;
-
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_USERLOCK;
-		break;
-
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
-
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
-
-	default:
-		rcode = RLM_MODULE_FAIL;
-		break;
-	};
+	rcode = ldap_bind_rcode(status);
+	if (rcode == RLM_MODULE_OK) RDEBUG("Bind as user \"%s\" was successful", dn);
 
 finish:
 	mod_conn_release(inst, request, conn);
@@ -851,58 +1046,53 @@ free_result:
 	return rcode;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+/** Add the attributes needed for checking access, memberships, and profiles to the user search
+ *
+ */
+static void ldap_authorize_attrs(rlm_ldap_t const *inst, fr_ldap_map_exp_t *expanded)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	int			ldap_errno;
-	int			i;
-	rlm_ldap_t const	*inst = instance;
-	struct berval		**values;
-	fr_ldap_connection_t	*conn;
-	LDAPMessage		*result, *entry;
-	char const 		*dn = NULL;
-	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
-#ifdef WITH_EDIR
-	fr_ldap_rcode_t		status;
-#endif
-
-	/*
-	 *	Don't be tempted to add a check for request->username
-	 *	or request->password here. rlm_ldap.authorize can be used for
-	 *	many things besides searching for users.
-	 */
-
-	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
-
-	conn = mod_conn_get(inst, request);
-	if (!conn) return RLM_MODULE_FAIL;
-
-	/*
-	 *	Add any additional attributes we need for checking access, memberships, and profiles
-	 */
 	if (inst->userobj_access_attr) {
-		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
+		expanded->attrs[expanded->count++] = inst->userobj_access_attr;
 	}
 
 	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
-		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
+		expanded->attrs[expanded->count++] = inst->userobj_membership_attr;
 	}
 
 	if (inst->profile_attr) {
-		expanded.attrs[expanded.count++] = inst->profile_attr;
+		expanded->attrs[expanded->count++] = inst->profile_attr;
 	}
 
 	if (inst->valuepair_attr) {
-		expanded.attrs[expanded.count++] = inst->valuepair_attr;
+		expanded->attrs[expanded->count++] = inst->valuepair_attr;
 	}
 
-	expanded.attrs[expanded.count] = NULL;
+	expanded->attrs[expanded->count] = NULL;
+}
 
-	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
-	if (!dn) {
-		goto finish;
-	}
+/** Process the user object found by the authorize search
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn of the user object.
+ * @param[in] result of the user search.
+ * @param[in] expanded Structure containing a list of xlat expanded attribute names and mapping
+information.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t mod_authorize_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
+				      char const *dn, LDAPMessage *result, fr_ldap_map_exp_t const *expanded)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	int			ldap_errno;
+	int			i;
+	struct berval		**values;
+	fr_ldap_connection_t	*conn = *pconn;
+	LDAPMessage		*entry;
+#ifdef WITH_EDIR
+	fr_ldap_rcode_t		status;
+#endif
 
 	entry = ldap_first_entry(conn->handle, result);
 	if (!entry) {
@@ -1033,7 +1223,7 @@ skip_edir:
 			goto finish;
 		}
 
-		switch (rlm_ldap_map_profile(inst, request, &conn, profile, &expanded)) {
+		switch (rlm_ldap_map_profile(inst, request, &conn, profile, expanded)) {
 		case RLM_MODULE_INVALID:
 			rcode = RLM_MODULE_INVALID;
 			goto finish;
@@ -1061,7 +1251,7 @@ skip_edir:
 				char *value;
 
 				value = fr_ldap_berval_to_string(request, values[i]);
-				ret = rlm_ldap_map_profile(inst, request, &conn, value, &expanded);
+				ret = rlm_ldap_map_profile(inst, request, &conn, value, expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
 					ldap_value_free_len(values);
@@ -1078,11 +1268,148 @@ skip_edir:
 		RDEBUG("Processing user attributes");
 		RINDENT();
 		if (fr_ldap_map_do(request, conn, inst->valuepair_attr,
-				   &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+				   expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
 		rlm_ldap_check_reply(inst, request, conn);
 	}
 
+finish:
+	*pconn = conn;
+
+	return rcode;
+}
+
+/** State of an asynchronous authorization
+ *
+ */
+typedef struct {
+	fr_ldap_map_exp_t	expanded;		//!< Attributes to retrieve, and how to map them.
+	fr_ldap_query_t		*query;			//!< User search in progress.
+	fr_ldap_rcode_t		status;			//!< Of the user search.
+	LDAPMessage		*result;		//!< Of the user search.
+} ldap_authorize_ctx_t;
+
+static int _ldap_authorize_ctx_free(ldap_authorize_ctx_t *rctx)
+{
+	talloc_free(rctx->query);
+	if (rctx->result) ldap_msgfree(rctx->result);
+	talloc_free(rctx->expanded.ctx);
+
+	return 0;
+}
+
+static void _mod_authorize_user_result(REQUEST *request, fr_ldap_rcode_t status, LDAPMessage *result, void *uctx)
+{
+	ldap_authorize_ctx_t	*rctx = talloc_get_type_abort(uctx, ldap_authorize_ctx_t);
+
+	rctx->status = status;
+	rctx->result = result;
+	unlang_resumable(request);
+}
+
+static void mod_authorize_signal(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				 fr_state_action_t action)
+{
+	if (action != FR_ACTION_DONE) return;
+
+	talloc_free(ctx);			/* Abandons the search */
+}
+
+static rlm_rcode_t mod_authorize_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	ldap_authorize_ctx_t	*rctx = talloc_get_type_abort(ctx, ldap_authorize_ctx_t);
+	fr_ldap_connection_t	*conn;
+	char const		*dn;
+	rlm_rcode_t		rcode;
+
+	if ((rctx->status != LDAP_PROC_SUCCESS) && (rctx->status != LDAP_PROC_NO_RESULT)) {
+		RPEDEBUG("Failed performing search");
+	}
+
+	/*
+	 *	The rest of the processing (access checks, group
+	 *	caching, profiles) may need further searches, which
+	 *	are performed on a pooled connection.
+	 */
+	conn = mod_conn_get(inst, request);
+	if (!conn) {
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	dn = rlm_ldap_find_user_result(inst, request, conn, rctx->status, &rctx->result, true, &rcode);
+	if (dn) rcode = mod_authorize_user(inst, request, &conn, dn, rctx->result, &rctx->expanded);
+
+	mod_conn_release(inst, request, conn);
+	talloc_free(rctx);
+
+	return rcode;
+}
+
+/** Search for the user without blocking, then process the result
+ *
+ */
+static rlm_rcode_t mod_authorize_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request)
+{
+	ldap_authorize_ctx_t	*rctx;
+	rlm_rcode_t		rcode;
+
+	MEM(rctx = talloc_zero(request, ldap_authorize_ctx_t));
+
+	if (fr_ldap_map_expand(&rctx->expanded, request, inst->user_map) < 0) {
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
+	talloc_set_destructor(rctx, _ldap_authorize_ctx_free);
+
+	ldap_authorize_attrs(inst, &rctx->expanded);
+
+	rctx->query = rlm_ldap_find_user_async(rctx, inst, request, t->conn, rctx->expanded.attrs,
+					       _mod_authorize_user_result, rctx, &rcode);
+	if (!rctx->query) {
+		talloc_free(rctx);
+		return rcode;
+	}
+
+	return unlang_module_yield(request, mod_authorize_resume, mod_authorize_signal, rctx);
+}
+
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	rlm_ldap_t const	*inst = instance;
+	fr_ldap_connection_t	*conn;
+	LDAPMessage		*result = NULL;
+	char const 		*dn = NULL;
+	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
+
+	/*
+	 *	Don't be tempted to add a check for request->username
+	 *	or request->password here. rlm_ldap.authorize can be used for
+	 *	many things besides searching for users.
+	 */
+
+	if (rlm_ldap_async_enabled(inst, thread)) return mod_authorize_async(inst, thread, request);
+
+	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
+
+	conn = mod_conn_get(inst, request);
+	if (!conn) return RLM_MODULE_FAIL;
+
+	/*
+	 *	Add any additional attributes we need for checking access, memberships, and profiles
+	 */
+	ldap_authorize_attrs(inst, &expanded);
+
+	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
+	if (!dn) {
+		goto finish;
+	}
+
+	rcode = mod_authorize_user(inst, request, &conn, dn, result, &expanded);
+
 finish:
 	talloc_free(expanded.ctx);
 	if (result) ldap_msgfree(result);
@@ -1361,6 +1688,41 @@ static int mod_detach(void *instance)
 	return 0;
 }
 
+/** Open the connection this thread sends its searches on
+ *
+ * The connection re-establishes itself if it fails.  Until it's bound,
+ * requests fall back to using the connection pool.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_ldap_t		*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+	char			*log_prefix;
+
+	t->el = el;
+
+	log_prefix = talloc_asprintf(t, "rlm_ldap (%s)", inst->name);
+	t->conn = fr_ldap_connection_state_alloc(t, el, &inst->handle_config, log_prefix);
+	talloc_free(log_prefix);
+	if (!t->conn) {
+		ERROR("Failed allocating connection");
+		return -1;
+	}
+	fr_connection_signal_init(t->conn->conn);
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_ldap_thread_t	*t = thread;
+
+	TALLOC_FREE(t->conn);
+
+	return 0;
+}
+
 /** Parse an accounting sub section.
  *
  * Allocate a new ldap_acct_section_t and write the config data into it.
@@ -1941,7 +2303,10 @@ rad_module_t rlm_ldap = {
 	.unload		= mod_unload,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
 	.detach		= mod_detach,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
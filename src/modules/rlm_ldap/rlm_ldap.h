@@ -150,12 +150,44 @@ struct ldap_inst_s {
 	uint32_t	ldap_debug;			//!< Debug flag for the SDK.
 };
 
+/** Thread specific instance data
+ *
+ */
+typedef struct {
+	fr_event_list_t		*el;			//!< Thread event list, for muxing.
+	fr_ldap_connection_t	*conn;			//!< Shared by all requests in this thread.  Used for
+							///< searches which can be run asynchronously.
+} rlm_ldap_thread_t;
+
+/** Whether searches and binds can be performed on the thread's connection
+ *
+ */
+static inline bool rlm_ldap_async_enabled(UNUSED rlm_ldap_t const *inst, rlm_ldap_thread_t const *t)
+{
+#ifdef LDAP_CONTROL_X_SESSION_TRACKING
+	/*
+	 *	Session tracking controls are added to pooled
+	 *	connections, for the duration of a single request.
+	 */
+	if (inst->session_tracking) return false;
+#endif
+
+	return t && t->conn && (t->conn->state == FR_LDAP_STATE_RUN);
+}
+
 /*
  *	user.c - User lookup functions
  */
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+char const *rlm_ldap_find_user_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t const *conn,
+				      fr_ldap_rcode_t status, LDAPMessage **result, bool keep, rlm_rcode_t *rcode);
+
+fr_ldap_query_t *rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+					  fr_ldap_connection_t *conn, char const *attrs[],
+					  fr_ldap_query_cb_t callback, void *uctx, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request,
 				  fr_ldap_connection_t const *conn, LDAPMessage *entry);
 
@@ -169,11 +201,11 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 
 rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn);
 
-rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
-					    VALUE_PAIR *check);
+rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, rlm_ldap_thread_t *t,
+					    fr_ldap_connection_t **pconn, VALUE_PAIR *check);
 
-rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
-					   char const *dn, VALUE_PAIR *check);
+rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, rlm_ldap_thread_t *t,
+					   fr_ldap_connection_t **pconn, char const *dn, VALUE_PAIR *check);
 
 rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALUE_PAIR *check);
 
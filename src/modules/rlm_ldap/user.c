@@ -32,6 +32,149 @@
 
 #include "rlm_ldap.h"
 
+/** Expand the base DN and filter used to search for user objects
+ *
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[out] base_dn		Where to write the expanded base DN.
+ * @param[in] base_dn_buff	to expand the base DN into.
+ * @param[out] filter		Where to write the expanded filter.  Will be NULL if there's no filter.
+ * @param[in] filter_buff	to expand the filter into.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rlm_ldap_user_search_expand(rlm_ldap_t const *inst, REQUEST *request,
+				       char const **base_dn, char base_dn_buff[LDAP_MAX_DN_STR_LEN],
+				       char const **filter, char filter_buff[LDAP_MAX_FILTER_STR_LEN])
+{
+	*filter = NULL;
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(filter, filter_buff, LDAP_MAX_FILTER_STR_LEN, request, inst->userobj_filter,
+				fr_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			return -1;
+		}
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Retrieve the DN of a user object from the result of a user search
+ *
+ * Adds the DN to the control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn to use for processing the result.
+ * @param[in] status of the search.
+ * @param[in,out] result of the search.  Freed, and set to NULL, unless keep is true,
+ *	and the DN was found.
+ * @param[in] keep the result for the caller.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_find_user_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t const *conn,
+				      fr_ldap_rcode_t status, LDAPMessage **result, bool keep, rlm_rcode_t *rcode)
+{
+	VALUE_PAIR	*vp = NULL;
+	LDAPMessage	*entry = NULL;
+	int		ldap_errno;
+	int		cnt;
+	char		*dn = NULL;
+
+	*rcode = RLM_MODULE_FAIL;
+
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_BAD_DN:
+	case LDAP_PROC_NO_RESULT:
+		*rcode = RLM_MODULE_NOTFOUND;
+		return NULL;
+
+	default:
+		return NULL;
+	}
+
+	rad_assert(*result);
+
+	/*
+	 *	Forbid the use of unsorted search results that
+	 *	contain multiple entries, as it's a potential
+	 *	security issue, and likely non deterministic.
+	 */
+	if (!inst->userobj_sort_ctrl) {
+		cnt = ldap_count_entries(conn->handle, *result);
+		if (cnt > 1) {
+			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
+				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
+			REDEBUG("The following entries were returned:");
+			RINDENT();
+			for (entry = ldap_first_entry(conn->handle, *result);
+			     entry;
+			     entry = ldap_next_entry(conn->handle, entry)) {
+				dn = ldap_get_dn(conn->handle, entry);
+				REDEBUG("%s", dn);
+				ldap_memfree(dn);
+			}
+			REXDENT();
+			*rcode = RLM_MODULE_INVALID;
+			goto finish;
+		}
+	}
+
+	entry = ldap_first_entry(conn->handle, *result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s",
+			ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+
+	dn = ldap_get_dn(conn->handle, entry);
+	if (!dn) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+	fr_ldap_util_normalise_dn(dn, dn);
+
+	/*
+	 *	We can't use fr_pair_make here to copy the value into the
+	 *	attribute, as the dn must be copied into the attribute
+	 *	verbatim (without de-escaping).
+	 *
+	 *	Special chars are pre-escaped by libldap, and because
+	 *	we pass the string back to libldap we must not alter it.
+	 */
+	RDEBUG("User object found at DN \"%s\"", dn);
+	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
+	if (vp) {
+		fr_pair_value_strcpy(vp, dn);
+		*rcode = RLM_MODULE_OK;
+	}
+	ldap_memfree(dn);
+
+finish:
+	if ((!keep || (*rcode != RLM_MODULE_OK)) && *result) {
+		ldap_msgfree(*result);
+		*result = NULL;
+	}
+
+	return vp ? vp->vp_strvalue : NULL;
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -57,10 +200,7 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 
 	fr_ldap_rcode_t	status;
 	VALUE_PAIR	*vp = NULL;
-	LDAPMessage	*tmp_msg = NULL, *entry = NULL;
-	int		ldap_errno;
-	int		cnt;
-	char		*dn = NULL;
+	LDAPMessage	*tmp_msg = NULL;
 	char const	*filter = NULL;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
@@ -111,108 +251,60 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 		(*pconn)->rebound = false;
 	}
 
-	if (inst->userobj_filter) {
-		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
-				fr_ldap_escape_func, NULL) < 0) {
-			REDEBUG("Unable to create filter");
-			*rcode = RLM_MODULE_INVALID;
-
-			return NULL;
-		}
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Unable to create base_dn");
+	if (rlm_ldap_user_search_expand(inst, request, &base_dn, base_dn_buff, &filter, filter_buff) < 0) {
 		*rcode = RLM_MODULE_INVALID;
-
 		return NULL;
 	}
 
 	status = fr_ldap_search(result, request, pconn, base_dn,
 				inst->userobj_scope, filter, attrs, serverctrls, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		break;
 
-	case LDAP_PROC_BAD_DN:
-	case LDAP_PROC_NO_RESULT:
-		*rcode = RLM_MODULE_NOTFOUND;
-		return NULL;
+	return rlm_ldap_find_user_result(inst, request, *pconn, status, result, !freeit, rcode);
+}
 
-	default:
-		*rcode = RLM_MODULE_FAIL;
+/** Start searching for a user object, without waiting for the result
+ *
+ * The search is sent on the thread's shared connection, and the result should
+ * be passed to #rlm_ldap_find_user_result when the callback is called.
+ *
+ * @param[in] ctx to allocate the query in.  Freeing it abandons the search.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn to send the search on.  Must be muxed.
+ * @param[in] attrs Additional attributes to retrieve, may be NULL.
+ * @param[in] callback to call with the result.
+ * @param[in] uctx to pass to the callback.
+ * @param[out] rcode The status of the operation if the search couldn't be sent.
+ * @return
+ *	- The query on success.
+ *	- NULL on failure.
+ */
+fr_ldap_query_t *rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+					  fr_ldap_connection_t *conn, char const *attrs[],
+					  fr_ldap_query_cb_t callback, void *uctx, rlm_rcode_t *rcode)
+{
+	static char const	*no_attrs[] = { NULL };
+	fr_ldap_query_t		*query;
+	char const		*filter = NULL;
+	char			filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const		*base_dn;
+	char			base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl		*serverctrls[] = { inst->userobj_sort_ctrl, NULL };
+
+	if (rlm_ldap_user_search_expand(inst, request, &base_dn, base_dn_buff, &filter, filter_buff) < 0) {
+		*rcode = RLM_MODULE_INVALID;
 		return NULL;
 	}
 
-	rad_assert(*pconn);
-
-	/*
-	 *	Forbid the use of unsorted search results that
-	 *	contain multiple entries, as it's a potential
-	 *	security issue, and likely non deterministic.
-	 */
-	if (!inst->userobj_sort_ctrl) {
-		cnt = ldap_count_entries((*pconn)->handle, *result);
-		if (cnt > 1) {
-			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
-				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
-			REDEBUG("The following entries were returned:");
-			RINDENT();
-			for (entry = ldap_first_entry((*pconn)->handle, *result);
-			     entry;
-			     entry = ldap_next_entry((*pconn)->handle, entry)) {
-				dn = ldap_get_dn((*pconn)->handle, entry);
-				REDEBUG("%s", dn);
-				ldap_memfree(dn);
-			}
-			REXDENT();
-			*rcode = RLM_MODULE_INVALID;
-			goto finish;
-		}
-	}
-
-	entry = ldap_first_entry((*pconn)->handle, *result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s",
-			ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
-
-	dn = ldap_get_dn((*pconn)->handle, entry);
-	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
-	fr_ldap_util_normalise_dn(dn, dn);
-
-	/*
-	 *	We can't use fr_pair_make here to copy the value into the
-	 *	attribute, as the dn must be copied into the attribute
-	 *	verbatim (without de-escaping).
-	 *
-	 *	Special chars are pre-escaped by libldap, and because
-	 *	we pass the string back to libldap we must not alter it.
-	 */
-	RDEBUG("User object found at DN \"%s\"", dn);
-	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
-	if (vp) {
-		fr_pair_value_strcpy(vp, dn);
-		*rcode = RLM_MODULE_OK;
-	}
-	ldap_memfree(dn);
-
-finish:
-	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
-		ldap_msgfree(*result);
-		*result = NULL;
+	query = fr_ldap_query_search(ctx, request, conn, base_dn, inst->userobj_scope, filter,
+				     attrs ? attrs : no_attrs, serverctrls, NULL, callback, uctx);
+	if (!query) {
+		RPEDEBUG("Failed sending search");
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
 	}
 
-	return vp ? vp->vp_strvalue : NULL;
+	return query;
 }
 
 /** Check for presence of access attribute in result
@@ -704,11 +704,14 @@ build_vector:
 
 	case LINELOG_DST_TCP:
 	{
-		int i, num;
+		int		i, num;
+		fr_pool_state_t	state;
+
 		if (inst->tcp.timeout.tv_sec || inst->tcp.timeout.tv_usec) timeout = &inst->tcp.timeout;
 
 	do_write:
-		num = fr_pool_state(inst->pool)->num;
+		fr_pool_state(&state, inst->pool);
+		num = state.num;
 		conn = fr_pool_connection_get(inst->pool, request);
 		if (!conn) {
 			rcode = RLM_MODULE_FAIL;
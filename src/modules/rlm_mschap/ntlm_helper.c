@@ -0,0 +1,633 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ntlm_helper.c
+ * @brief Authenticate using persistent ntlm_auth helper processes
+ *
+ * Each worker thread starts its own set of ntlm_auth processes, running
+ * the ntlm-server-1 helper protocol.  Authentications are written to an
+ * idle helper's stdin, and the reply is read from its stdout when the
+ * event loop says it's readable.  If all the helpers are busy, the
+ * authentication waits in a queue.
+ *
+ * A helper handles one authentication at a time.  Helpers which exit, or
+ * which don't reply within ntlm_auth_timeout, are killed and restarted.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/base64.h>
+#include <freeradius-devel/io/time.h>
+
+#include <sys/wait.h>
+
+#include "rlm_mschap.h"
+#include "mschap.h"
+#include "ntlm_helper.h"
+
+/*
+ *	How long to wait before restarting a helper which failed.
+ */
+#define HELPER_RESTART_DELAY	1
+
+typedef struct mschap_helper mschap_helper_t;
+
+/** An ntlm_auth process
+ *
+ */
+struct mschap_helper {
+	mschap_helper_pool_t	*pool;		//!< Pool this helper belongs to.
+	uint32_t		id;		//!< Used in log messages.
+
+	pid_t			pid;		//!< Of the ntlm_auth process.  -1 if not running.
+	int			to_child;	//!< Helper's stdin.
+	int			from_child;	//!< Helper's stdout.
+	fr_event_timer_t const	*ev;		//!< Restart timer.
+
+	bool			busy;		//!< Writing a reply, even if the authentication was cancelled.
+	mschap_helper_auth_t	*auth;		//!< Authentication being processed.  NULL if cancelled.
+
+	bool			authenticated;	//!< Helper said "Authenticated: Yes".
+	bool			have_key;	//!< Helper sent the User-Session-Key.
+	uint8_t			nthashhash[NT_DIGEST_LENGTH];	//!< From the User-Session-Key.
+	char			error[256];	//!< Why authentication failed.
+
+	char			buff[1024];	//!< Partial reply.
+	size_t			used;		//!< How much of buff contains data.
+};
+
+/** A thread's ntlm_auth helpers
+ *
+ */
+struct mschap_helper_pool {
+	rlm_mschap_t const	*inst;		//!< Module instance.
+	fr_event_list_t		*el;		//!< Event list of the worker thread.
+
+	mschap_helper_t		**helpers;	//!< Array of helpers.
+	uint32_t		num_helpers;	//!< How many helpers there are.
+
+	fr_dlist_t		queue;		//!< Authentications waiting for an idle helper.
+	uint32_t		queued;		//!< Number of authentications in the queue.
+
+	uint64_t		latency;	//!< Moving average of helper response times, in microseconds.
+};
+
+/** An authentication sent by a request
+ *
+ */
+struct mschap_helper_auth {
+	mschap_helper_pool_t	*pool;		//!< Pool the authentication was sent to.
+	mschap_helper_t		*helper;	//!< Processing the authentication.  NULL if not sent.
+	fr_dlist_t		entry;		//!< Entry in the pool's queue.
+	REQUEST			*request;	//!< Which sent the authentication.
+
+	char			*msg;		//!< To write to the helper.
+	size_t			msg_len;	//!< Length of msg.
+
+	fr_time_t		sent;		//!< When the authentication was written to a helper.
+	fr_event_timer_t const	*ev;		//!< ntlm_auth_timeout.
+
+	mschap_helper_cb_t	callback;	//!< Called with the result.
+	void			*uctx;		//!< Passed to the callback.
+};
+
+static void helper_start(mschap_helper_t *helper);
+static void helper_dispatch(mschap_helper_pool_t *pool);
+
+/** Pass the result of an authentication to the request that sent it
+ *
+ */
+static void helper_auth_done(mschap_helper_auth_t *auth, uint8_t const *nthashhash, char const *error)
+{
+	if (auth->ev) fr_event_timer_delete(auth->pool->el, &auth->ev);
+
+	fr_dlist_remove(&auth->entry);
+	auth->helper = NULL;
+
+	auth->callback(auth->request, nthashhash, error, auth->uctx);
+}
+
+static void _helper_restart(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	mschap_helper_t *helper = talloc_get_type_abort(uctx, mschap_helper_t);
+
+	helper_start(helper);
+	helper_dispatch(helper->pool);
+}
+
+/** Stop a helper, failing any authentication it's processing
+ *
+ * @param[in] helper	to stop.
+ * @param[in] restart	whether to start a new process after #HELPER_RESTART_DELAY.
+ */
+static void helper_stop(mschap_helper_t *helper, bool restart)
+{
+	mschap_helper_pool_t	*pool = helper->pool;
+	mschap_helper_auth_t	*auth = helper->auth;
+
+	if (helper->from_child >= 0) {
+		fr_event_fd_delete(pool->el, helper->from_child, FR_EVENT_FILTER_IO);
+		close(helper->from_child);
+		helper->from_child = -1;
+	}
+
+	if (helper->to_child >= 0) {
+		close(helper->to_child);
+		helper->to_child = -1;
+	}
+
+	/*
+	 *	SIGKILL can't be ignored, so the wait
+	 *	won't block for any length of time.
+	 */
+	if (helper->pid > 0) {
+		kill(helper->pid, SIGKILL);
+		(void) waitpid(helper->pid, NULL, 0);
+		helper->pid = -1;
+	}
+
+	helper->busy = false;
+	helper->auth = NULL;
+	helper->used = 0;
+
+	if (restart) {
+		struct timeval now, when;
+
+		gettimeofday(&now, NULL);
+		when = now;
+		when.tv_sec += HELPER_RESTART_DELAY;
+
+		if (fr_event_timer_insert(helper, pool->el, &helper->ev, &when, _helper_restart, helper) < 0) {
+			ERROR("%s: Failed inserting restart timer for ntlm_auth helper %u: %s",
+			      pool->inst->xlat_name, helper->id, fr_strerror());
+		}
+	}
+
+	if (auth) helper_auth_done(auth, NULL, "ntlm_auth helper failed");
+}
+
+/** Process a complete reply from a helper
+ *
+ */
+static void helper_reply(mschap_helper_t *helper)
+{
+	mschap_helper_pool_t	*pool = helper->pool;
+	mschap_helper_auth_t	*auth = helper->auth;
+
+	helper->busy = false;
+	helper->auth = NULL;
+
+	if (auth) {
+		REQUEST		*request = auth->request;
+		uint64_t	latency = (fr_time() - auth->sent) / 1000;
+
+		/*
+		 *	Exponentially weighted, so it tracks
+		 *	recent changes in the domain controller's
+		 *	response time.
+		 */
+		pool->latency = pool->latency ? ((pool->latency * 7) + latency) / 8 : latency;
+
+		RDEBUG2("ntlm_auth helper %u replied in %" PRIu64 " us (%u queued)",
+			helper->id, latency, pool->queued);
+
+		if (helper->authenticated && helper->have_key) {
+			helper_auth_done(auth, helper->nthashhash, NULL);
+
+		} else if (helper->authenticated) {
+			helper_auth_done(auth, NULL, "ntlm_auth helper didn't send a User-Session-Key");
+
+		} else {
+			helper_auth_done(auth, NULL, helper->error[0] ? helper->error : "Authentication failed");
+		}
+	}
+
+	helper->authenticated = false;
+	helper->have_key = false;
+	helper->error[0] = '\0';
+}
+
+/** Process a line of a reply from a helper
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the line was invalid.
+ */
+static int helper_line(mschap_helper_t *helper, char *line)
+{
+	char *value;
+
+	if (strcmp(line, ".") == 0) {
+		if (!helper->busy) {
+			fr_strerror_printf("Unexpected reply");
+			return -1;
+		}
+
+		helper_reply(helper);
+		return 0;
+	}
+
+	/*
+	 *	ntlm_auth writes "BH <reason>" if it
+	 *	couldn't parse what we sent.
+	 */
+	if (strncmp(line, "BH", 2) == 0) {
+		fr_strerror_printf("Helper rejected request: %s", line);
+		return -1;
+	}
+
+	value = strchr(line, ':');
+	if (!value) {
+		fr_strerror_printf("Invalid reply line \"%s\"", line);
+		return -1;
+	}
+	*value++ = '\0';
+	while (*value == ' ') value++;
+
+	if (strcasecmp(line, "Authenticated") == 0) {
+		helper->authenticated = (strcasecmp(value, "Yes") == 0);
+
+	} else if (strcasecmp(line, "User-Session-Key") == 0) {
+		helper->have_key = (fr_hex2bin(helper->nthashhash, sizeof(helper->nthashhash),
+					       value, strlen(value)) == sizeof(helper->nthashhash));
+
+	} else if ((strcasecmp(line, "Authentication-Error") == 0) || (strcasecmp(line, "Error") == 0)) {
+		strlcpy(helper->error, value, sizeof(helper->error));
+	}
+
+	/*
+	 *	Anything else, we don't care about.
+	 */
+	return 0;
+}
+
+static void _helper_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	mschap_helper_t		*helper = talloc_get_type_abort(uctx, mschap_helper_t);
+	mschap_helper_pool_t	*pool = helper->pool;
+	char			*p, *eol;
+	ssize_t			len;
+
+	for (;;) {
+		if (helper->used == (sizeof(helper->buff) - 1)) {
+			ERROR("%s: ntlm_auth helper %u sent a reply line that was too long",
+			      pool->inst->xlat_name, helper->id);
+			goto error;
+		}
+
+		len = read(helper->from_child, helper->buff + helper->used, sizeof(helper->buff) - helper->used - 1);
+		if (len == 0) {
+			ERROR("%s: ntlm_auth helper %u exited", pool->inst->xlat_name, helper->id);
+			goto error;
+		}
+
+		if (len < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+			if (errno == EINTR) continue;
+
+			ERROR("%s: Failed reading from ntlm_auth helper %u: %s",
+			      pool->inst->xlat_name, helper->id, fr_syserror(errno));
+			goto error;
+		}
+		helper->used += len;
+		helper->buff[helper->used] = '\0';
+
+		/*
+		 *	Process complete lines
+		 */
+		p = helper->buff;
+		while ((eol = strchr(p, '\n'))) {
+			*eol = '\0';
+			if (helper_line(helper, p) < 0) {
+				PERROR("%s: ntlm_auth helper %u", pool->inst->xlat_name, helper->id);
+				goto error;
+			}
+			p = eol + 1;
+		}
+
+		helper->used -= p - helper->buff;
+		memmove(helper->buff, p, helper->used);
+	}
+
+	helper_dispatch(pool);
+	return;
+
+error:
+	helper_stop(helper, true);
+	helper_dispatch(pool);
+}
+
+static void _helper_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	mschap_helper_t		*helper = talloc_get_type_abort(uctx, mschap_helper_t);
+	mschap_helper_pool_t	*pool = helper->pool;
+
+	ERROR("%s: ntlm_auth helper %u failed: %s", pool->inst->xlat_name, helper->id, fr_syserror(fd_errno));
+
+	helper_stop(helper, true);
+	helper_dispatch(pool);
+}
+
+/** Start an ntlm_auth process
+ *
+ */
+static void helper_start(mschap_helper_t *helper)
+{
+	mschap_helper_pool_t	*pool = helper->pool;
+	pid_t			pid;
+
+	pid = radius_start_program(pool->inst->ntlm_helper, NULL, true,
+				   &helper->to_child, &helper->from_child, NULL, false);
+	if (pid < 0) {
+		ERROR("%s: Failed starting ntlm_auth helper %u", pool->inst->xlat_name, helper->id);
+		helper->to_child = helper->from_child = -1;
+		helper_stop(helper, true);
+		return;
+	}
+	helper->pid = pid;
+
+	if ((fr_nonblock(helper->from_child) < 0) ||
+	    (fr_event_fd_insert(helper, pool->el, helper->from_child,
+				_helper_read, NULL, _helper_error, helper) < 0)) {
+		PERROR("%s: Failed inserting ntlm_auth helper %u into event loop",
+		       pool->inst->xlat_name, helper->id);
+		helper_stop(helper, true);
+		return;
+	}
+
+	DEBUG2("%s: Started ntlm_auth helper %u (pid %u)", pool->inst->xlat_name, helper->id, (unsigned int) pid);
+}
+
+/** Write queued authentications to idle helpers
+ *
+ */
+static void helper_dispatch(mschap_helper_pool_t *pool)
+{
+	uint32_t i;
+
+	for (i = 0; (i < pool->num_helpers) && pool->queued; i++) {
+		mschap_helper_t		*helper = pool->helpers[i];
+		mschap_helper_auth_t	*auth;
+		fr_dlist_t		*entry;
+		size_t			written = 0;
+		ssize_t			len;
+
+		if ((helper->pid < 0) || helper->busy) continue;
+
+		entry = FR_DLIST_FIRST(pool->queue);
+		auth = fr_ptr_to_type(mschap_helper_auth_t, entry, entry);
+
+		/*
+		 *	The helper is idle, so the pipe is
+		 *	empty, and the write won't block.
+		 */
+		while (written < auth->msg_len) {
+			len = write(helper->to_child, auth->msg + written, auth->msg_len - written);
+			if (len < 0) {
+				if (errno == EINTR) continue;
+
+				ERROR("%s: Failed writing to ntlm_auth helper %u: %s",
+				      pool->inst->xlat_name, helper->id, fr_syserror(errno));
+				break;
+			}
+			written += len;
+		}
+
+		/*
+		 *	Leave the authentication in the queue
+		 *	for the next helper.
+		 */
+		if (written < auth->msg_len) {
+			helper_stop(helper, true);
+			continue;
+		}
+
+		fr_dlist_remove(&auth->entry);
+		pool->queued--;
+
+		auth->helper = helper;
+		auth->sent = fr_time();
+		helper->auth = auth;
+		helper->busy = true;
+	}
+}
+
+static void _helper_auth_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	mschap_helper_auth_t	*auth = talloc_get_type_abort(uctx, mschap_helper_auth_t);
+	mschap_helper_pool_t	*pool = auth->pool;
+	REQUEST			*request = auth->request;
+
+	auth->ev = NULL;
+
+	/*
+	 *	The helper is stuck, replace it.
+	 */
+	if (auth->helper) {
+		RERROR("ntlm_auth helper %u timed out", auth->helper->id);
+		helper_stop(auth->helper, true);	/* Fails the authentication */
+		helper_dispatch(pool);
+		return;
+	}
+
+	RERROR("Timed out waiting for an ntlm_auth helper (%u queued)", pool->queued);
+	pool->queued--;
+	helper_auth_done(auth, NULL, "Timed out waiting for an ntlm_auth helper");
+}
+
+static int _helper_auth_free(mschap_helper_auth_t *auth)
+{
+	/*
+	 *	Being processed, the helper will discard the reply.
+	 */
+	if (auth->helper) {
+		auth->helper->auth = NULL;
+		return 0;
+	}
+
+	/*
+	 *	Still in the queue.
+	 */
+	if (auth->entry.next != &auth->entry) {
+		fr_dlist_remove(&auth->entry);
+		auth->pool->queued--;
+	}
+
+	return 0;
+}
+
+/** Send an MS-CHAP authentication to a helper
+ *
+ * @param[in] ctx		to allocate the authentication in.  Freeing it
+ *				cancels the authentication.
+ * @param[in] pool		of the current thread.
+ * @param[in] request		to authenticate.
+ * @param[in] username		to authenticate as.
+ * @param[in] domain		the user belongs to.  May be NULL.
+ * @param[in] challenge		MS-CHAPv1 challenge.
+ * @param[in] response		NT-Response or LM-Response.
+ * @param[in] nt_response	whether response is an NT-Response.
+ * @param[in] callback		called with the result.
+ * @param[in] uctx		passed to the callback.
+ * @return
+ *	- The authentication on success.
+ *	- NULL on failure.
+ */
+mschap_helper_auth_t *mschap_helper_auth(TALLOC_CTX *ctx, mschap_helper_pool_t *pool, REQUEST *request,
+					 char const *username, char const *domain,
+					 uint8_t const challenge[8], uint8_t const response[24], bool nt_response,
+					 mschap_helper_cb_t callback, void *uctx)
+{
+	mschap_helper_auth_t	*auth;
+	char			username_b64[FR_BASE64_ENC_LENGTH(256) + 1];
+	char			domain_b64[FR_BASE64_ENC_LENGTH(256) + 1];
+	char			challenge_hex[(8 * 2) + 1];
+	char			response_hex[(24 * 2) + 1];
+	struct timeval		now, when;
+
+	if ((strlen(username) > 256) || (domain && (strlen(domain) > 256))) {
+		REDEBUG("User-Name or NT-Domain too long for ntlm_auth helper");
+		return NULL;
+	}
+
+	/*
+	 *	Base64 encoding means we don't have to worry
+	 *	about embedded newlines, or character sets.
+	 */
+	fr_base64_encode(username_b64, sizeof(username_b64), (uint8_t const *)username, strlen(username));
+	if (domain) fr_base64_encode(domain_b64, sizeof(domain_b64), (uint8_t const *)domain, strlen(domain));
+	fr_bin2hex(challenge_hex, challenge, 8);
+	fr_bin2hex(response_hex, response, 24);
+
+	MEM(auth = talloc_zero(ctx, mschap_helper_auth_t));
+	auth->pool = pool;
+	auth->request = request;
+	auth->callback = callback;
+	auth->uctx = uctx;
+	auth->entry.prev = auth->entry.next = &auth->entry;
+
+	auth->msg = talloc_typed_asprintf(auth,
+					  "Username:: %s\n"
+					  "%s%s%s"
+					  "LANMAN-Challenge: %s\n"
+					  "%s: %s\n"
+					  "Request-User-Session-Key: Yes\n"
+					  ".\n",
+					  username_b64,
+					  domain ? "NT-Domain:: " : "", domain ? domain_b64 : "", domain ? "\n" : "",
+					  challenge_hex,
+					  nt_response ? "NT-Response" : "LANMAN-Response", response_hex);
+	auth->msg_len = talloc_array_length(auth->msg) - 1;
+
+	gettimeofday(&now, NULL);
+	when = now;
+	when.tv_sec += pool->inst->ntlm_auth_timeout;
+	if (fr_event_timer_insert(auth, pool->el, &auth->ev, &when, _helper_auth_timeout, auth) < 0) {
+		RPERROR("Failed inserting ntlm_auth timeout");
+		talloc_free(auth);
+		return NULL;
+	}
+
+	fr_dlist_insert_tail(&pool->queue, &auth->entry);
+	pool->queued++;
+	talloc_set_destructor(auth, _helper_auth_free);
+
+	RDEBUG2("Sending authentication to ntlm_auth helper (%u queued)", pool->queued);
+
+	helper_dispatch(pool);
+
+	return auth;
+}
+
+/** Average time taken by the helpers to reply, in microseconds
+ *
+ */
+uint64_t mschap_helper_latency(mschap_helper_pool_t const *pool)
+{
+	return pool->latency;
+}
+
+/** Number of authentications waiting for an idle helper
+ *
+ */
+uint32_t mschap_helper_queued(mschap_helper_pool_t const *pool)
+{
+	return pool->queued;
+}
+
+static int _helper_free(mschap_helper_t *helper)
+{
+	helper_stop(helper, false);
+
+	return 0;
+}
+
+static int _helper_pool_free(mschap_helper_pool_t *pool)
+{
+	uint32_t i;
+
+	/*
+	 *	Stop the helpers before the pool
+	 *	they reference is freed.
+	 */
+	for (i = 0; i < pool->num_helpers; i++) talloc_free(pool->helpers[i]);
+
+	return 0;
+}
+
+/** Start a thread's ntlm_auth helpers
+ *
+ * @param[in] ctx	to allocate the pool in.  Freeing it stops the helpers.
+ * @param[in] el	of the worker thread.
+ * @param[in] inst	of rlm_mschap.
+ * @return
+ *	- The pool on success.
+ *	- NULL on failure.
+ */
+mschap_helper_pool_t *mschap_helper_pool_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, rlm_mschap_t const *inst)
+{
+	mschap_helper_pool_t	*pool;
+	uint32_t		i;
+
+	MEM(pool = talloc_zero(ctx, mschap_helper_pool_t));
+	pool->inst = inst;
+	pool->el = el;
+	FR_DLIST_INIT(pool->queue);
+
+	pool->num_helpers = inst->ntlm_helper_processes;
+	MEM(pool->helpers = talloc_zero_array(pool, mschap_helper_t *, pool->num_helpers));
+	talloc_set_destructor(pool, _helper_pool_free);
+
+	for (i = 0; i < pool->num_helpers; i++) {
+		mschap_helper_t *helper;
+
+		MEM(helper = talloc_zero(pool->helpers, mschap_helper_t));
+		helper->pool = pool;
+		helper->id = i;
+		helper->pid = -1;
+		helper->to_child = helper->from_child = -1;
+		talloc_set_destructor(helper, _helper_free);
+		pool->helpers[i] = helper;
+
+		helper_start(helper);
+	}
+
+	return pool;
+}
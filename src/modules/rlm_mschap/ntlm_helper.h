@@ -0,0 +1,37 @@
+/* Copyright 2018 The FreeRADIUS server project */
+
+#ifndef _NTLM_HELPER_H
+#define _NTLM_HELPER_H
+
+RCSIDH(ntlm_helper_h, "$Id$")
+
+#include <freeradius-devel/event.h>
+
+typedef struct mschap_helper_pool mschap_helper_pool_t;
+typedef struct mschap_helper_auth mschap_helper_auth_t;
+
+/** Receive the result of an authentication
+ *
+ * Called from the event loop, before the request is marked as resumable.
+ *
+ * @param[in] request		which sent the authentication.
+ * @param[in] nthashhash	User-Session-Key sent by ntlm_auth.  NULL if
+ *				authentication failed.
+ * @param[in] error		Why authentication failed.  Only valid for the
+ *				duration of the callback.
+ * @param[in] uctx		passed to #mschap_helper_auth.
+ */
+typedef void (*mschap_helper_cb_t)(REQUEST *request, uint8_t const *nthashhash, char const *error, void *uctx);
+
+mschap_helper_pool_t	*mschap_helper_pool_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, rlm_mschap_t const *inst);
+
+mschap_helper_auth_t	*mschap_helper_auth(TALLOC_CTX *ctx, mschap_helper_pool_t *pool, REQUEST *request,
+					    char const *username, char const *domain,
+					    uint8_t const challenge[8], uint8_t const response[24], bool nt_response,
+					    mschap_helper_cb_t callback, void *uctx);
+
+uint64_t		mschap_helper_latency(mschap_helper_pool_t const *pool);
+
+uint32_t		mschap_helper_queued(mschap_helper_pool_t const *pool);
+
+#endif /*_NTLM_HELPER_H*/
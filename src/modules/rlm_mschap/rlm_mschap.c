@@ -37,6 +37,8 @@ RCSID("$Id$")
 #include "mschap.h"
 #include "smbdes.h"
 
+#include "ntlm_helper.h"
+
 #ifdef WITH_AUTH_WINBIND
 #include "auth_wbclient.h"
 #endif
@@ -50,6 +52,10 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 int od_mschap_auth(REQUEST *request, VALUE_PAIR *challenge, VALUE_PAIR * usernamepair);
 #endif
 
+typedef struct {
+	mschap_helper_pool_t	*helpers;		//!< ntlm_auth helpers.  NULL if not configured.
+} rlm_mschap_thread_t;
+
 /* Allowable account control bits */
 #define ACB_DISABLED	0x00010000	//!< User account disabled.
 #define ACB_HOMDIRREQ	0x00020000	//!< Home directory required.
@@ -472,6 +478,32 @@ static ssize_t mschap_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 		(*out)[32] = '\0';
 		RDEBUG("LM-Hash of %s = %s", p, *out);
 		return 32;
+
+	/*
+	 *	Statistics for this thread's ntlm_auth helpers.
+	 */
+	} else if ((strncasecmp(fmt, "Helper-Latency", 14) == 0) ||
+		   (strncasecmp(fmt, "Helper-Queue", 12) == 0)) {
+		rlm_mschap_thread_t	*t;
+		void			*instance;
+
+		memcpy(&instance, &mod_inst, sizeof(instance));
+		t = module_thread_instance_find(instance);
+		if (!t || !t->helpers) {
+			REDEBUG("ntlm_auth_helper is not configured");
+			return -1;
+		}
+
+		/*
+		 *	Average reply time in microseconds,
+		 *	or the number of authentications
+		 *	waiting for a helper.
+		 */
+		if (strncasecmp(fmt, "Helper-Latency", 14) == 0) {
+			return snprintf(*out, outlen, "%" PRIu64, mschap_helper_latency(t->helpers));
+		}
+
+		return snprintf(*out, outlen, "%u", mschap_helper_queued(t->helpers));
 	} else {
 		REDEBUG("Unknown expansion string '%s'", fmt);
 		return -1;
@@ -548,6 +580,14 @@ static const CONF_PARSER passchange_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER ntlm_helper_config[] = {
+	{ FR_CONF_OFFSET("program", FR_TYPE_STRING, rlm_mschap_t, ntlm_helper) },
+	{ FR_CONF_OFFSET("username", FR_TYPE_TMPL, rlm_mschap_t, ntlm_helper_username) },
+	{ FR_CONF_OFFSET("domain", FR_TYPE_TMPL, rlm_mschap_t, ntlm_helper_domain) },
+	{ FR_CONF_OFFSET("processes", FR_TYPE_UINT32, rlm_mschap_t, ntlm_helper_processes), .dflt = "2" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	/*
 	 *	Cache the password by default.
@@ -558,6 +598,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("with_ntdomain_hack", FR_TYPE_BOOL, rlm_mschap_t, with_ntdomain_hack), .dflt = "yes" },
 	{ FR_CONF_OFFSET("ntlm_auth", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_mschap_t, ntlm_auth) },
 	{ FR_CONF_OFFSET("ntlm_auth_timeout", FR_TYPE_UINT32, rlm_mschap_t, ntlm_auth_timeout) },
+	{ FR_CONF_POINTER("ntlm_auth_helper", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) ntlm_helper_config },
 	{ FR_CONF_POINTER("passchange", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) passchange_config },
 	{ FR_CONF_OFFSET("allow_retry", FR_TYPE_BOOL, rlm_mschap_t, allow_retry), .dflt = "yes" },
 	{ FR_CONF_OFFSET("retry_msg", FR_TYPE_STRING, rlm_mschap_t, retry_msg) },
@@ -631,6 +672,25 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		inst->method = AUTH_NTLMAUTH_EXEC;
 	}
 
+	if (inst->ntlm_helper) {
+		if (inst->ntlm_auth) {
+			cf_log_err(conf, "Only one of 'ntlm_auth' and 'ntlm_auth_helper' may be set");
+			return -1;
+		}
+
+		if (!inst->ntlm_helper_username) {
+			cf_log_err(conf, "ntlm_auth_helper.username must be set");
+			return -1;
+		}
+
+		if (!inst->ntlm_helper_processes) {
+			cf_log_err(conf, "ntlm_auth_helper.processes must be greater than 0");
+			return -1;
+		}
+
+		inst->method = AUTH_NTLMAUTH_HELPER;
+	}
+
 	switch (inst->method) {
 	case AUTH_INTERNAL:
 		DEBUG("%s: using internal authentication", inst->xlat_name);
@@ -638,6 +698,10 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	case AUTH_NTLMAUTH_EXEC:
 		DEBUG("%s : authenticating by calling 'ntlm_auth'", inst->xlat_name);
 		break;
+	case AUTH_NTLMAUTH_HELPER:
+		DEBUG("%s : authenticating with %u 'ntlm_auth' helpers per thread", inst->xlat_name,
+		      inst->ntlm_helper_processes);
+		break;
 #ifdef WITH_AUTH_WINBIND
 	case AUTH_WBCLIENT:
 		DEBUG("%s : authenticating directly to winbind", inst->xlat_name);
@@ -665,6 +729,32 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/*
+ *	Start this thread's ntlm_auth helpers
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_mschap_t		*inst = instance;
+	rlm_mschap_thread_t	*t = thread;
+
+	if (inst->method != AUTH_NTLMAUTH_HELPER) return 0;
+
+	t->helpers = mschap_helper_pool_alloc(t, el, inst);
+	if (!t->helpers) return -1;
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_mschap_thread_t	*t = thread;
+
+	TALLOC_FREE(t->helpers);
+
+	return 0;
+}
+
 /*
  *	Tidy up instance
  */
@@ -1100,6 +1190,47 @@ ntlm_auth_err:
 	return -1;
 }
 
+/** Map an error from ntlm_auth to a do_mschap() result
+ *
+ * @param[in] request	The current request.
+ * @param[in] msg	Output of ntlm_auth, or the Authentication-Error
+ *			sent by an ntlm_auth helper.
+ * @return
+ *	- -648 if the password has expired.
+ *	- -647 if the account is locked out.
+ *	- -691 if the account is disabled.
+ *	- -1 for any other error.
+ */
+static int mschap_ntlm_auth_error(REQUEST *request, char const *msg)
+{
+	/*
+	 *	look for "Password expired", or "Must change password".
+	 */
+	if (strcasestr(msg, "Password expired") ||
+	    strcasestr(msg, "Must change password") ||
+	    strcasestr(msg, "NT_STATUS_PASSWORD_EXPIRED") ||
+	    strcasestr(msg, "NT_STATUS_PASSWORD_MUST_CHANGE")) {
+		REDEBUG2("%s", msg);
+		return -648;
+	}
+
+	if (strcasestr(msg, "Account locked out") ||
+	    strcasestr(msg, "0xC0000234") ||
+	    strcasestr(msg, "NT_STATUS_ACCOUNT_LOCKED_OUT")) {
+		REDEBUG2("%s", msg);
+		return -647;
+	}
+
+	if (strcasestr(msg, "Account disabled") ||
+	    strcasestr(msg, "0xC0000072") ||
+	    strcasestr(msg, "NT_STATUS_ACCOUNT_DISABLED")) {
+		REDEBUG2("%s", msg);
+		return -691;
+	}
+
+	return -1;
+}
+
 /*
  *	Do the MS-CHAP stuff.
  *
@@ -1163,26 +1294,8 @@ static int CC_HINT(nonnull (1, 2, 4, 5 , 6)) do_mschap(rlm_mschap_t const *inst,
 		if (result != 0) {
 			char *p;
 
-			/*
-			 *	look for "Password expired", or "Must change password".
-			 */
-			if (strcasestr(buffer, "Password expired") ||
-			    strcasestr(buffer, "Must change password")) {
-				REDEBUG2("%s", buffer);
-				return -648;
-			}
-
-			if (strcasestr(buffer, "Account locked out") ||
-			    strcasestr(buffer, "0xC0000234")) {
-				REDEBUG2("%s", buffer);
-				return -647;
-			}
-
-			if (strcasestr(buffer, "Account disabled") ||
-			    strcasestr(buffer, "0xC0000072")) {
-				REDEBUG2("%s", buffer);
-				return -691;
-			}
+			result = mschap_ntlm_auth_error(request, buffer);
+			if (result != -1) return result;
 
 			RDEBUG2("External script failed");
 			p = strchr(buffer, '\n');
@@ -1751,6 +1864,204 @@ static rlm_rcode_t CC_HINT(nonnull) process_cpw_request(rlm_mschap_t const *inst
 }
 
 
+/** State needed to finish an authentication
+ *
+ * Filled in by mod_authenticate(), and kept while we wait for an
+ * ntlm_auth helper to reply.
+ */
+typedef struct {
+	int			version;		//!< Of MS-CHAP, 1 or 2.
+	VALUE_PAIR		*response;		//!< MS-CHAP-Response or MS-CHAP2-Response.
+	VALUE_PAIR		*challenge;		//!< MS-CHAP-Challenge.  MS-CHAPv2 only.
+	uint8_t const		*peer_challenge;	//!< MS-CHAPv2 only.
+	char const		*username;		//!< Without the domain.  MS-CHAPv2 only.
+	VALUE_PAIR		*lm_password;		//!< For the MS-CHAPv1 MPPE keys.
+	VALUE_PAIR		*smb_ctrl;		//!< Account control bits.
+	uint8_t			nthashhash[NT_DIGEST_LENGTH];
+} mschap_auth_t;
+
+/** Check the result of authentication, and add the reply attributes
+ *
+ * @param[in] inst		rlm_mschap configuration.
+ * @param[in] request		The current request.
+ * @param[in] auth		state of the authentication.
+ * @param[in] mschap_result	from do_mschap(), or an ntlm_auth helper.
+ * @return one of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t mschap_finish(rlm_mschap_t const *inst, REQUEST *request, mschap_auth_t *auth, int mschap_result)
+{
+	rlm_rcode_t	rcode;
+	VALUE_PAIR	*response = auth->response;
+	char		msch2resp[42];
+
+	/*
+	 *	Check for errors, and add MSCHAP-Error if necessary.
+	 */
+	rcode = mschap_error(inst, request, *response->vp_octets,
+			     mschap_result, auth->version, auth->smb_ctrl);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	if (auth->version == 2) {
+#ifdef WITH_AUTH_WINBIND
+		VALUE_PAIR	*response_name;
+
+		if (inst->wb_retry_with_normalised_username) {
+			if ((response_name = fr_pair_find_by_num(request->packet->vps, 0, FR_MS_CHAP_USER_NAME, TAG_ANY))) {
+				if (strcmp(auth->username, response_name->vp_strvalue)) {
+					RDEBUG2("Changing username %s to %s", auth->username, response_name->vp_strvalue);
+					auth->username = response_name->vp_strvalue;
+				}
+			}
+		}
+#endif
+
+		mschap_auth_response(auth->username,		/* without the domain */
+				     auth->nthashhash,		/* nt-hash-hash */
+				     response->vp_octets + 26,	/* peer response */
+				     auth->peer_challenge,	/* peer challenge */
+				     auth->challenge->vp_octets,	/* our challenge */
+				     msch2resp);		/* calculated MPPE key */
+		mschap_add_reply(request, *response->vp_octets, "MS-CHAP2-Success", msch2resp, 42);
+	}
+
+	/* now create MPPE attributes */
+	if (inst->use_mppe) {
+		uint8_t mppe_sendkey[34];
+		uint8_t mppe_recvkey[34];
+
+		switch (auth->version) {
+		case 1:
+			RDEBUG2("Adding MS-CHAPv1 MPPE keys");
+			memset(mppe_sendkey, 0, 32);
+			if (auth->lm_password) memcpy(mppe_sendkey, auth->lm_password->vp_octets, 8);	//-V512
+
+			/*
+			 *	According to RFC 2548 we
+			 *	should send NT hash.  But in
+			 *	practice it doesn't work.
+			 *	Instead, we should send nthashhash
+			 *
+			 *	This is an error in RFC 2548.
+			 */
+			/*
+			 *	do_mschap cares to zero nthashhash if NT hash
+			 *	is not available.
+			 */
+			memcpy(mppe_sendkey + 8, auth->nthashhash, NT_DIGEST_LENGTH);
+			mppe_add_reply(request, "MS-CHAP-MPPE-Keys", mppe_sendkey, 24);	//-V666
+			break;
+
+		case 2:
+			RDEBUG2("Adding MS-CHAPv2 MPPE keys");
+			mppe_chap2_gen_keys128(auth->nthashhash, response->vp_octets + 26, mppe_sendkey, mppe_recvkey);
+
+			mppe_add_reply(request, "MS-MPPE-Recv-Key", mppe_recvkey, 16);
+			mppe_add_reply(request, "MS-MPPE-Send-Key", mppe_sendkey, 16);
+			break;
+
+		default:
+			rad_assert(0);
+			break;
+		}
+
+		pair_make_reply("MS-MPPE-Encryption-Policy",
+			       (inst->require_encryption) ? "0x00000002":"0x00000001", T_OP_EQ);
+		pair_make_reply("MS-MPPE-Encryption-Types",
+			       (inst->require_strong) ? "0x00000004":"0x00000006", T_OP_EQ);
+	} /* else we weren't asked to use MPPE */
+
+	return RLM_MODULE_OK;
+}
+
+/** State of an authentication sent to an ntlm_auth helper
+ *
+ */
+typedef struct {
+	mschap_auth_t		auth;			//!< To finish the authentication.
+	mschap_helper_auth_t	*helper_auth;		//!< Waiting for a reply.
+	int			result;			//!< As returned by do_mschap().
+} mschap_helper_ctx_t;
+
+static void _mschap_helper_reply(REQUEST *request, uint8_t const *nthashhash, char const *error, void *uctx)
+{
+	mschap_helper_ctx_t	*rctx = talloc_get_type_abort(uctx, mschap_helper_ctx_t);
+
+	if (nthashhash) {
+		memcpy(rctx->auth.nthashhash, nthashhash, NT_DIGEST_LENGTH);
+		rctx->result = 0;
+	} else {
+		rctx->result = mschap_ntlm_auth_error(request, error);
+		if (rctx->result == -1) REDEBUG("ntlm_auth helper says: %s", error);
+	}
+
+	unlang_resumable(request);
+}
+
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_mschap_t const	*inst = instance;
+	mschap_helper_ctx_t	*rctx = talloc_get_type_abort(ctx, mschap_helper_ctx_t);
+	rlm_rcode_t		rcode;
+
+	rcode = mschap_finish(inst, request, &rctx->auth, rctx->result);
+	talloc_free(rctx);
+
+	return rcode;
+}
+
+static void mod_authenticate_signal(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+				    void *ctx, fr_state_action_t action)
+{
+	if (action != FR_ACTION_DONE) return;
+
+	talloc_free(ctx);	/* Cancels the authentication */
+}
+
+/** Send an authentication to one of this thread's ntlm_auth helpers, and yield
+ *
+ * @param[in] inst		rlm_mschap configuration.
+ * @param[in] t			thread instance holding the helpers.
+ * @param[in] request		The current request.
+ * @param[in] auth		state of the authentication, copied.
+ * @param[in] challenge		MS-CHAPv1 challenge.
+ * @param[in] response		NT-Response or LM-Response.
+ * @param[in] nt_response	whether response is an NT-Response.
+ * @return one of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t mschap_helper_send(rlm_mschap_t const *inst, rlm_mschap_thread_t *t, REQUEST *request,
+				      mschap_auth_t const *auth, uint8_t const *challenge,
+				      uint8_t const *response, bool nt_response)
+{
+	mschap_helper_ctx_t	*rctx;
+	char const		*username, *domain = NULL;
+	char			username_buff[256], domain_buff[256];
+
+	if (tmpl_expand(&username, username_buff, sizeof(username_buff),
+			request, inst->ntlm_helper_username, NULL, NULL) < 0) {
+		RPEDEBUG("Failed expanding ntlm_auth_helper.username");
+		return RLM_MODULE_FAIL;
+	}
+
+	if (inst->ntlm_helper_domain &&
+	    (tmpl_expand(&domain, domain_buff, sizeof(domain_buff),
+			 request, inst->ntlm_helper_domain, NULL, NULL) < 0)) {
+		RPEDEBUG("Failed expanding ntlm_auth_helper.domain");
+		return RLM_MODULE_FAIL;
+	}
+
+	MEM(rctx = talloc_zero(request, mschap_helper_ctx_t));
+	rctx->auth = *auth;
+
+	rctx->helper_auth = mschap_helper_auth(rctx, t->helpers, request, username, domain,
+					       challenge, response, nt_response, _mschap_helper_reply, rctx);
+	if (!rctx->helper_auth) {
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, mod_authenticate_resume, mod_authenticate_signal, rctx);
+}
+
 /*
  *	mod_authenticate() - authenticate user based on given
  *	attributes and configuration.
@@ -1768,7 +2079,7 @@ static rlm_rcode_t CC_HINT(nonnull) process_cpw_request(rlm_mschap_t const *inst
  *	If MS-CHAP2 succeeds we MUST return
  *	FR_MSCHAP2_SUCCESS
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_mschap_t const *inst = instance;
 	VALUE_PAIR *challenge = NULL;
@@ -1777,12 +2088,10 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 	VALUE_PAIR *password = NULL;
 	VALUE_PAIR *lm_password, *nt_password, *smb_ctrl;
 	VALUE_PAIR *username;
-	uint8_t nthashhash[NT_DIGEST_LENGTH];
-	char msch2resp[42];
 	char const *username_string;
-	int mschap_version = 0;
 	int mschap_result;
 	MSCHAP_AUTH_METHOD auth_method;
+	mschap_auth_t auth;
 
 	/*
 	 *	If we have ntlm_auth configured, use it unless told
@@ -1907,8 +2216,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 	 */
 	if (response) {
 		int		offset;
-		rlm_rcode_t	rcode;
-		mschap_version = 1;
+
+		memset(&auth, 0, sizeof(auth));
+		auth.version = 1;
+		auth.response = response;
+		auth.lm_password = lm_password;
+		auth.smb_ctrl = smb_ctrl;
 
 		/*
 		 *	MS-CHAPv1 challenges are 8 octets.
@@ -1940,26 +2253,26 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 			offset = 2;
 		}
 
+		if (auth_method == AUTH_NTLMAUTH_HELPER) {
+			return mschap_helper_send(inst, thread, request, &auth, challenge->vp_octets,
+						  response->vp_octets + offset, (offset == 26));
+		}
+
 		/*
 		 *	Do the MS-CHAP authentication.
 		 */
 		mschap_result = do_mschap(inst, request, password, challenge->vp_octets,
-					  response->vp_octets + offset, nthashhash, auth_method);
-		/*
-		 *	Check for errors, and add MSCHAP-Error if necessary.
-		 */
-		rcode = mschap_error(inst, request, *response->vp_octets,
-				     mschap_result, mschap_version, smb_ctrl);
-		if (rcode != RLM_MODULE_OK) return rcode;
-	} else if ((response = fr_pair_find_by_num(request->packet->vps, VENDORPEC_MICROSOFT, FR_MSCHAP2_RESPONSE,
+					  response->vp_octets + offset, auth.nthashhash, auth_method);
+
+		return mschap_finish(inst, request, &auth, mschap_result);
+	}
+
+	if ((response = fr_pair_find_by_num(request->packet->vps, VENDORPEC_MICROSOFT, FR_MSCHAP2_RESPONSE,
 						   TAG_ANY)) != NULL) {
 		uint8_t		mschapv1_challenge[16];
 		VALUE_PAIR	*name_attr, *response_name, *peer_challenge_attr;
-		rlm_rcode_t	rcode;
 		uint8_t const *peer_challenge;
 
-		mschap_version = 2;
-
 		/*
 		 *	MS-CHAPv2 challenges are 16 octets.
 		 */
@@ -2055,89 +2368,30 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 				      username_string,		/* user name */
 				      mschapv1_challenge);	/* resulting challenge */
 
-		RDEBUG2("Client is using MS-CHAPv2");
-		mschap_result = do_mschap(inst, request, nt_password, mschapv1_challenge,
-					  response->vp_octets + 26, nthashhash, auth_method);
+		memset(&auth, 0, sizeof(auth));
+		auth.version = 2;
+		auth.response = response;
+		auth.challenge = challenge;
+		auth.peer_challenge = peer_challenge;
+		auth.username = username_string;
+		auth.lm_password = lm_password;
+		auth.smb_ctrl = smb_ctrl;
 
-		/*
-		 *	Check for errors, and add MSCHAP-Error if necessary.
-		 */
-		rcode = mschap_error(inst, request, *response->vp_octets,
-				     mschap_result, mschap_version, smb_ctrl);
-		if (rcode != RLM_MODULE_OK) return rcode;
-
-#ifdef WITH_AUTH_WINBIND
-		if (inst->wb_retry_with_normalised_username) {
-			if ((response_name = fr_pair_find_by_num(request->packet->vps, 0, FR_MS_CHAP_USER_NAME, TAG_ANY))) {
-				if (strcmp(username_string, response_name->vp_strvalue)) {
-					RDEBUG2("Changing username %s to %s", username_string, response_name->vp_strvalue);
-					username_string = response_name->vp_strvalue;
-				}
-			}
+		RDEBUG2("Client is using MS-CHAPv2");
+		if (auth_method == AUTH_NTLMAUTH_HELPER) {
+			return mschap_helper_send(inst, thread, request, &auth, mschapv1_challenge,
+						  response->vp_octets + 26, true);
 		}
-#endif
-
-		mschap_auth_response(username_string,		/* without the domain */
-				     nthashhash,		/* nt-hash-hash */
-				     response->vp_octets + 26,	/* peer response */
-				     peer_challenge,		/* peer challenge */
-				     challenge->vp_octets,	/* our challenge */
-				     msch2resp);		/* calculated MPPE key */
-		mschap_add_reply(request, *response->vp_octets, "MS-CHAP2-Success", msch2resp, 42);
 
+		mschap_result = do_mschap(inst, request, nt_password, mschapv1_challenge,
+					  response->vp_octets + 26, auth.nthashhash, auth_method);
 
-	} else {		/* Neither CHAPv1 or CHAPv2 response: die */
-		REDEBUG("You set 'Auth-Type = MS-CHAP' for a request that does not contain any MS-CHAP attributes!");
-		return RLM_MODULE_INVALID;
+		return mschap_finish(inst, request, &auth, mschap_result);
 	}
 
-	/* now create MPPE attributes */
-	if (inst->use_mppe) {
-		uint8_t mppe_sendkey[34];
-		uint8_t mppe_recvkey[34];
-
-		switch (mschap_version) {
-		case 1:
-			RDEBUG2("Adding MS-CHAPv1 MPPE keys");
-			memset(mppe_sendkey, 0, 32);
-			if (lm_password) memcpy(mppe_sendkey, lm_password->vp_octets, 8);	//-V512
-
-			/*
-			 *	According to RFC 2548 we
-			 *	should send NT hash.  But in
-			 *	practice it doesn't work.
-			 *	Instead, we should send nthashhash
-			 *
-			 *	This is an error in RFC 2548.
-			 */
-			/*
-			 *	do_mschap cares to zero nthashhash if NT hash
-			 *	is not available.
-			 */
-			memcpy(mppe_sendkey + 8, nthashhash, NT_DIGEST_LENGTH);
-			mppe_add_reply(request, "MS-CHAP-MPPE-Keys", mppe_sendkey, 24);	//-V666
-			break;
-
-		case 2:
-			RDEBUG2("Adding MS-CHAPv2 MPPE keys");
-			mppe_chap2_gen_keys128(nthashhash, response->vp_octets + 26, mppe_sendkey, mppe_recvkey);
-
-			mppe_add_reply(request, "MS-MPPE-Recv-Key", mppe_recvkey, 16);
-			mppe_add_reply(request, "MS-MPPE-Send-Key", mppe_sendkey, 16);
-			break;
-
-		default:
-			rad_assert(0);
-			break;
-		}
-
-		pair_make_reply("MS-MPPE-Encryption-Policy",
-			       (inst->require_encryption) ? "0x00000002":"0x00000001", T_OP_EQ);
-		pair_make_reply("MS-MPPE-Encryption-Types",
-			       (inst->require_strong) ? "0x00000004":"0x00000006", T_OP_EQ);
-	} /* else we weren't asked to use MPPE */
-
-	return RLM_MODULE_OK;
+	/* Neither CHAPv1 or CHAPv2 response: die */
+	REDEBUG("You set 'Auth-Type = MS-CHAP' for a request that does not contain any MS-CHAP attributes!");
+	return RLM_MODULE_INVALID;
 #undef inst
 }
 
@@ -2150,7 +2404,10 @@ rad_module_t rlm_mschap = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_mschap_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
 	.detach		= mod_detach,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize
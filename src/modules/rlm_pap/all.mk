@@ -1,2 +1,3 @@
 SOURCES		:= rlm_pap.c
 TARGET		:= rlm_pap.a
+TGT_PREREQS	:= libfreeradius-io.a
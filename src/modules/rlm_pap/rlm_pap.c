@@ -30,6 +30,7 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/base64.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/io/offload.h>
 
 #include <ctype.h>
 
@@ -51,10 +52,20 @@ typedef struct rlm_pap_t {
 	char const	*name;
 	int		auth_type;
 	bool		normify;
+
+	uint32_t	offload_threads;	//!< Number of threads for calculating slow hashes.
+	uint32_t	offload_max_queued;	//!< Maximum number of hashes waiting for a thread.
+	fr_offload_t	*offload;		//!< Threads shared by all workers.
 } rlm_pap_t;
 
+typedef struct rlm_pap_thread_t {
+	fr_offload_queue_t	*offload;	//!< Where this worker submits slow hashes.
+} rlm_pap_thread_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("normalise", FR_TYPE_BOOL, rlm_pap_t, normify), .dflt = "yes" },
+	{ FR_CONF_OFFSET("offload_threads", FR_TYPE_UINT32, rlm_pap_t, offload_threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("offload_max_queued", FR_TYPE_UINT32, rlm_pap_t, offload_max_queued), .dflt = "1024" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -142,6 +153,40 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		inst->auth_type = 0;
 	}
 
+	if (inst->offload_threads) {
+		inst->offload = fr_offload_create(inst, inst->offload_threads, inst->offload_max_queued);
+		if (!inst->offload) {
+			cf_log_err(conf, "Failed starting offload threads: %s", fr_strerror());
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_pap_t		*inst = instance;
+	rlm_pap_thread_t	*t = thread;
+
+	if (!inst->offload) return 0;
+
+	t->offload = fr_offload_queue_create(t, inst->offload, el);
+	if (!t->offload) {
+		PERROR("%s: Failed creating offload queue", inst->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_pap_thread_t	*t = thread;
+
+	TALLOC_FREE(t->offload);
+
 	return 0;
 }
 
@@ -590,7 +635,116 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_clear(UNUSED rlm_pap_t const *inst,
 	return RLM_MODULE_OK;
 }
 
-static rlm_rcode_t CC_HINT(nonnull) pap_auth_crypt(UNUSED rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
+/** State for the slow hashes
+ *
+ *  These may be calculated by an offload thread, so they're split
+ *  into three stages.  Preparing and logging the result happen in
+ *  the worker, with access to the request.  The hash itself only
+ *  uses what's in this structure.
+ */
+typedef struct pap_hash_t {
+	int			attr;			//!< Of the "known good" password.
+	uint8_t const		*password;		//!< User-Password.
+	size_t			password_len;		//!< Length of the User-Password.
+
+	char const		*crypt;			//!< "known good" Crypt-Password.
+
+#ifdef HAVE_OPENSSL_EVP_H
+	EVP_MD const		*evp_md;		//!< PBKDF2 digest.
+	size_t			digest_len;		//!< Length of the PBKDF2 digest.
+	uint32_t		iterations;		//!< PBKDF2 iterations.
+	uint8_t			*salt;			//!< PBKDF2 salt.
+	size_t			salt_len;		//!< Length of the PBKDF2 salt.
+	uint8_t			hash[EVP_MAX_MD_SIZE];	//!< "known good" PBKDF2 digest.
+	uint8_t			digest[EVP_MAX_MD_SIZE];	//!< Calculated PBKDF2 digest.
+#endif
+
+	rlm_rcode_t		rcode;			//!< Result of the comparison.
+} pap_hash_t;
+
+typedef rlm_rcode_t (*pap_prep_t)(TALLOC_CTX *ctx, REQUEST *request, pap_hash_t *h, VALUE_PAIR *vp);
+
+/** Calculate a slow hash, and compare it with the "known good" one
+ *
+ *  May be called from an offload thread, so MUST NOT touch
+ *  the request, or log anything.
+ *
+ * @param[in] data	the #pap_hash_t to calculate.
+ */
+static void pap_hash(void *data)
+{
+	pap_hash_t	*h = data;
+
+	switch (h->attr) {
+	case FR_CRYPT_PASSWORD:
+		h->rcode = (fr_crypt_check((char const *)h->password, h->crypt) == 0) ?
+			   RLM_MODULE_OK : RLM_MODULE_REJECT;
+		break;
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case FR_PBKDF2_PASSWORD:
+		if (PKCS5_PBKDF2_HMAC((char const *)h->password, (int)h->password_len,
+				      (unsigned char const *)h->salt, (int)h->salt_len,
+				      (int)h->iterations,
+				      h->evp_md,
+				      (int)h->digest_len, (unsigned char *)h->digest) == 0) {
+			h->rcode = RLM_MODULE_INVALID;
+			break;
+		}
+
+		h->rcode = (fr_digest_cmp(h->digest, h->hash, h->digest_len) == 0) ?
+			   RLM_MODULE_OK : RLM_MODULE_REJECT;
+		break;
+#endif
+
+	default:
+		h->rcode = RLM_MODULE_INVALID;
+		break;
+	}
+}
+
+/** Log the result of a slow hash
+ *
+ * @param[in] request	The current request.
+ * @param[in] h		the hash which was calculated.
+ * @return the result of the comparison.
+ */
+static rlm_rcode_t pap_hash_result(REQUEST *request, pap_hash_t const *h)
+{
+	switch (h->attr) {
+	case FR_CRYPT_PASSWORD:
+		if (h->rcode != RLM_MODULE_OK) REDEBUG("Crypt digest does not match \"known good\" digest");
+		break;
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case FR_PBKDF2_PASSWORD:
+		switch (h->rcode) {
+		case RLM_MODULE_INVALID:
+			REDEBUG("PBKDF2 digest failure");
+			break;
+
+		case RLM_MODULE_REJECT:
+			REDEBUG("PBKDF2 digest does not match \"known good\" digest");
+			RHEXDUMP(L_DBG_LVL_3, h->salt, h->salt_len, "salt");
+			RHEXDUMP(L_DBG_LVL_3, h->hash, h->digest_len, "\"known good\" digest");
+			RHEXDUMP(L_DBG_LVL_3, h->digest, h->digest_len, "computed digest");
+			break;
+
+		default:
+			break;
+		}
+		break;
+#endif
+
+	default:
+		break;
+	}
+
+	return h->rcode;
+}
+
+static rlm_rcode_t CC_HINT(nonnull) pap_prep_crypt(UNUSED TALLOC_CTX *ctx, REQUEST *request,
+						   pap_hash_t *h, VALUE_PAIR *vp)
 {
 	if (RDEBUG_ENABLED3) {
 		RDEBUG3("Comparing with \"known good\" Crypt-Password \"%s\"", vp->vp_strvalue);
@@ -598,14 +752,24 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_crypt(UNUSED rlm_pap_t const *inst,
 		RDEBUG("Comparing with \"known-good\" Crypt-password");
 	}
 
-	if (fr_crypt_check(request->password->vp_strvalue,
-			   vp->vp_strvalue) != 0) {
-		REDEBUG("Crypt digest does not match \"known good\" digest");
-		return RLM_MODULE_REJECT;
-	}
+	h->attr = FR_CRYPT_PASSWORD;
+	h->password = request->password->vp_octets;
+	h->password_len = request->password->vp_length;
+	h->crypt = vp->vp_strvalue;
+
 	return RLM_MODULE_OK;
 }
 
+static rlm_rcode_t CC_HINT(nonnull) pap_auth_crypt(UNUSED rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
+{
+	pap_hash_t	h = { .attr = 0 };
+
+	(void) pap_prep_crypt(request, request, &h, vp);
+	pap_hash(&h);
+
+	return pap_hash_result(request, &h);
+}
+
 static rlm_rcode_t CC_HINT(nonnull) pap_auth_md5(rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
 {
 	FR_MD5_CTX md5_context;
@@ -936,20 +1100,21 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_ssha_evp(rlm_pap_t const *inst, REQ
 
 /** Validates Crypt::PBKDF2 LDAP format strings
  *
+ * @param[in] ctx	to allocate the salt in.
  * @param[in] request	The current request.
+ * @param[out] h	Where to write the parsed PBKDF2 parameters.
  * @param[in] str	Raw PBKDF2 string.
  * @param[in] len	Length of string.
  * @return
- *	- RLM_MODULE_REJECT
+ *	- RLM_MODULE_INVALID
  *	- RLM_MODULE_OK
  */
-static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(REQUEST *request, const uint8_t *str, size_t len,
+static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(TALLOC_CTX *ctx, REQUEST *request, pap_hash_t *h,
+								 const uint8_t *str, size_t len,
 								 FR_NAME_NUMBER const hash_names[],
 								 char scheme_sep, char iter_sep, char salt_sep,
 								 bool iter_is_base64)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
-
 	uint8_t const		*p, *q, *end;
 	ssize_t			slen;
 
@@ -959,16 +1124,11 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(REQUEST *reques
 
 	uint32_t		iterations;
 
-	uint8_t			*salt = NULL;
-	size_t			salt_len;
-	uint8_t			hash[EVP_MAX_MD_SIZE];
-	uint8_t			digest[EVP_MAX_MD_SIZE];
-
 	RDEBUG("Comparing with \"known-good\" PBKDF2-Password");
 
 	if (len <= 1) {
 		REDEBUG("PBKDF2-Password is too short");
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	/*
@@ -980,7 +1140,7 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(REQUEST *reques
 	q = memchr(p, scheme_sep, end - p);
 	if (!q) {
 		REDEBUG("PBKDF2-Password has no component separators");
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	digest_type = fr_substr2int(hash_names, (char const *)p, -1, q - p);
@@ -1034,19 +1194,19 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(REQUEST *reques
 
 	default:
 		REDEBUG("Unknown PBKDF2 hash method \"%.*s\"", (int)(q - p), p);
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	p = q + 1;
 
 	if (((end - p) < 1) || !(q = memchr(p, iter_sep, end - p))) {
 		REDEBUG("PBKDF2-Password missing iterations component");
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	if ((q - p) == 0) {
 		REDEBUG("PBKDF2-Password iterations component too short");
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	/*
@@ -1063,7 +1223,7 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(REQUEST *reques
 			REMARKER(iterations_buff, qq - iterations_buff,
 				 "PBKDF2-Password iterations field contains an invalid character");
 
-			goto finish;
+			return RLM_MODULE_INVALID;
 		}
 		p = q + 1;
 	/*
@@ -1075,7 +1235,7 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(REQUEST *reques
 		if (slen < 0) {
 			REDEBUG("Failed decoding PBKDF2-Password iterations component (%.*s): %s", (int)(q - p), p,
 				fr_strerror());
-			goto finish;
+			return RLM_MODULE_INVALID;
 		}
 		if (slen != sizeof(iterations)) {
 			REDEBUG("Decoded PBKDF2-Password iterations component is wrong size");
@@ -1088,78 +1248,60 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2_parse(REQUEST *reques
 
 	if (((end - p) < 1) || !(q = memchr(p, salt_sep, end - p))) {
 		REDEBUG("PBKDF2-Password missing salt component");
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	if ((q - p) == 0) {
 		REDEBUG("PBKDF2-Password salt component too short");
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
-	MEM(salt = talloc_array(request, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
-	slen = fr_base64_decode(salt, talloc_array_length(salt), (char const *) p, q - p);
+	MEM(h->salt = talloc_array(ctx, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
+	slen = fr_base64_decode(h->salt, talloc_array_length(h->salt), (char const *) p, q - p);
 	if (slen < 0) {
 		REDEBUG("Failed decoding PBKDF2-Password salt component: %s", fr_strerror());
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
-	salt_len = (size_t)slen;
+	h->salt_len = (size_t)slen;
 
 	p = q + 1;
 
 	if ((q - p) == 0) {
 		REDEBUG("PBKDF2-Password hash component too short");
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
-	slen = fr_base64_decode(hash, sizeof(hash), (char const *)p, end - p);
+	slen = fr_base64_decode(h->hash, sizeof(h->hash), (char const *)p, end - p);
 	if (slen < 0) {
 		REDEBUG("Failed decoding PBKDF2-Password hash component: %s", fr_strerror());
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	if ((size_t)slen != digest_len) {
 		REDEBUG("PBKDF2-Password hash component length is incorrect for hash type, expected %zu, got %zd",
 			digest_len, slen);
 
-		RHEXDUMP(L_DBG_LVL_2, hash, slen, "hash component");
+		RHEXDUMP(L_DBG_LVL_2, h->hash, slen, "hash component");
 
-		goto finish;
+		return RLM_MODULE_INVALID;
 	}
 
 	RDEBUG2("PBKDF2 %s: Iterations %u, salt length %zu, hash length %zd",
 		fr_int2str(pbkdf2_crypt_names, digest_type, "<UNKNOWN>"),
-		iterations, salt_len, slen);
-
-	/*
-	 *	Hash and compare
-	 */
-	if (PKCS5_PBKDF2_HMAC((char const *)request->password->vp_octets, (int)request->password->vp_length,
-			      (unsigned char const *)salt, (int)salt_len,
-			      (int)iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		REDEBUG("PBKDF2 digest failure");
-		goto finish;
-	}
-
-	if (fr_digest_cmp(digest, hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
-		rcode = RLM_MODULE_REJECT;
-		RHEXDUMP(L_DBG_LVL_3, salt, salt_len, "salt");
-		RHEXDUMP(L_DBG_LVL_3, hash, slen, "\"known good\" digest");
-		RHEXDUMP(L_DBG_LVL_3, digest, digest_len, "computed digest");
-	} else {
-		rcode = RLM_MODULE_OK;
-	}
+		iterations, h->salt_len, slen);
 
-finish:
-	talloc_free(salt);
+	h->attr = FR_PBKDF2_PASSWORD;
+	h->password = request->password->vp_octets;
+	h->password_len = request->password->vp_length;
+	h->evp_md = evp_md;
+	h->digest_len = digest_len;
+	h->iterations = iterations;
 
-	return rcode;
+	return RLM_MODULE_OK;
 }
 
-static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2(UNUSED rlm_pap_t const *inst,
-							   REQUEST *request, VALUE_PAIR *vp)
+static rlm_rcode_t CC_HINT(nonnull) pap_prep_pbkdf2(TALLOC_CTX *ctx, REQUEST *request,
+						    pap_hash_t *h, VALUE_PAIR *vp)
 {
 	uint8_t const *p = vp->vp_octets, *q, *end = p + vp->vp_length;
 
@@ -1182,7 +1324,7 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2(UNUSED rlm_pap_t cons
 			q = memchr(p, '}', end - p);
 			p = q + 1;
 		}
-		return pap_auth_pbkdf2_parse(request, p, end - p,
+		return pap_auth_pbkdf2_parse(ctx, request, h, p, end - p,
 					     pbkdf2_crypt_names, ':', ':', ':', true);
 	}
 
@@ -1193,7 +1335,7 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2(UNUSED rlm_pap_t cons
 	 */
 	if ((size_t)(end - p) >= sizeof("$PBKDF2$") && (memcmp(p, "$PBKDF2$", sizeof("$PBKDF2$") - 1) == 0)) {
 		p += sizeof("$PBKDF2$") - 1;
-		return pap_auth_pbkdf2_parse(request, p, end - p,
+		return pap_auth_pbkdf2_parse(ctx, request, h, p, end - p,
 					     pbkdf2_crypt_names, ':', ':', '$', false);
 	}
 
@@ -1206,7 +1348,7 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2(UNUSED rlm_pap_t cons
 	 */
 	if ((size_t)(end - p) >= sizeof("$pbkdf2-") && (memcmp(p, "$pbkdf2-", sizeof("$pbkdf2-") - 1) == 0)) {
 		p += sizeof("$pbkdf2-") - 1;
-		return pap_auth_pbkdf2_parse(request, p, end - p,
+		return pap_auth_pbkdf2_parse(ctx, request, h, p, end - p,
 					     pbkdf2_passlib_names, '$', '$', '$', false);
 	}
 
@@ -1214,6 +1356,21 @@ static inline rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2(UNUSED rlm_pap_t cons
 
 	return RLM_MODULE_INVALID;
 }
+
+static rlm_rcode_t CC_HINT(nonnull) pap_auth_pbkdf2(UNUSED rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
+{
+	pap_hash_t	h = { .attr = 0 };
+	rlm_rcode_t	rcode;
+
+	rcode = pap_prep_pbkdf2(request, request, &h, vp);
+	if (rcode == RLM_MODULE_OK) {
+		pap_hash(&h);
+		rcode = pap_hash_result(request, &h);
+	}
+	talloc_free(h.salt);
+
+	return rcode;
+}
 #endif
 
 static rlm_rcode_t CC_HINT(nonnull) pap_auth_nt(rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
@@ -1344,16 +1501,124 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_ns_mta_md5(UNUSED rlm_pap_t const *
 }
 
 
+static rlm_rcode_t pap_auth_done(REQUEST *request, rlm_rcode_t rc)
+{
+	if (rc == RLM_MODULE_REJECT) {
+		RDEBUG("Passwords don't match");
+	}
+
+	if (rc == RLM_MODULE_OK) {
+		RDEBUG("User authenticated successfully");
+	}
+
+	return rc;
+}
+
+/** State of a hash being calculated by an offload thread
+ *
+ */
+typedef struct {
+	REQUEST			*request;		//!< The current request.
+	fr_offload_job_t	*job;			//!< Being calculated.
+	rlm_rcode_t		rcode;			//!< Result of the comparison.
+} pap_offload_ctx_t;
+
+static void _pap_offload_done(void *data, void *uctx)
+{
+	pap_offload_ctx_t	*rctx = talloc_get_type_abort(uctx, pap_offload_ctx_t);
+	REQUEST			*request = rctx->request;
+
+	rctx->job = NULL;
+	rctx->rcode = pap_hash_result(request, data);
+
+	unlang_resumable(request);
+}
+
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx)
+{
+	pap_offload_ctx_t	*rctx = talloc_get_type_abort(ctx, pap_offload_ctx_t);
+	rlm_rcode_t		rcode = rctx->rcode;
+
+	talloc_free(rctx);
+
+	return pap_auth_done(request, rcode);
+}
+
+static void mod_authenticate_signal(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+				    void *ctx, fr_state_action_t action)
+{
+	pap_offload_ctx_t	*rctx = talloc_get_type_abort(ctx, pap_offload_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	if (rctx->job) fr_offload_job_cancel(rctx->job);
+	talloc_free(rctx);
+}
+
+/** Hand a slow hash to the offload threads, and yield
+ *
+ *  If too many hashes are already waiting, the hash is calculated
+ *  inline instead.
+ *
+ * @param[in] t		thread instance holding the offload queue.
+ * @param[in] request	The current request.
+ * @param[in] prep	function to parse the "known good" password.
+ * @param[in] vp	the "known good" password.
+ * @return one of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t pap_offload(rlm_pap_thread_t *t, REQUEST *request, pap_prep_t prep, VALUE_PAIR *vp)
+{
+	fr_offload_job_t	*job;
+	pap_hash_t		*h;
+	pap_offload_ctx_t	*rctx;
+	rlm_rcode_t		rcode;
+
+	MEM(job = fr_offload_job_alloc(t->offload));
+	MEM(h = talloc_zero(job, pap_hash_t));
+
+	rcode = prep(h, request, h, vp);
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(job);
+		return rcode;
+	}
+
+	/*
+	 *	The request may be freed before the hash is
+	 *	finished, so the hash gets its own copies.
+	 */
+	MEM(h->password = (uint8_t const *)talloc_bstrndup(h, (char const *)h->password, h->password_len));
+	if (h->crypt) MEM(h->crypt = talloc_strdup(h, h->crypt));
+
+	MEM(rctx = talloc_zero(request, pap_offload_ctx_t));
+	rctx->request = request;
+
+	if (fr_offload_job_submit(job, pap_hash, _pap_offload_done, h, rctx) < 0) {
+		RDEBUG2("%s, calculating hash inline", fr_strerror());
+		talloc_free(rctx);
+
+		pap_hash(h);
+		rcode = pap_hash_result(request, h);
+		talloc_free(job);
+
+		return pap_auth_done(request, rcode);
+	}
+	rctx->job = job;
+
+	return unlang_module_yield(request, mod_authenticate_resume, mod_authenticate_signal, rctx);
+}
+
 /*
  *	Authenticate the user via one of any well-known password.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_pap_t const *inst = instance;
+	rlm_pap_thread_t *t = thread;
 	VALUE_PAIR	*vp;
 	rlm_rcode_t	rc = RLM_MODULE_INVALID;
 	fr_cursor_t	cursor;
 	rlm_rcode_t	(*auth_func)(rlm_pap_t const *, REQUEST *, VALUE_PAIR *) = NULL;
+	pap_prep_t	prep_func = NULL;
 
 	if (!request->password ||
 	    (request->password->da->vendor != 0) ||
@@ -1392,6 +1657,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 
 		case FR_CRYPT_PASSWORD:
 			auth_func = &pap_auth_crypt;
+			prep_func = &pap_prep_crypt;
 			break;
 
 		case FR_MD5_PASSWORD:
@@ -1425,6 +1691,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 
 		case FR_PBKDF2_PASSWORD:
 			auth_func = &pap_auth_pbkdf2;
+			prep_func = &pap_prep_pbkdf2;
 			break;
 #endif
 
@@ -1463,20 +1730,18 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		return RLM_MODULE_FAIL;
 	}
 
+	/*
+	 *	Slow hashes are calculated by the offload threads,
+	 *	so the worker can get on with other requests.
+	 */
+	if (prep_func && t->offload) return pap_offload(t, request, prep_func, vp);
+
 	/*
 	 *	Authenticate, and return.
 	 */
 	rc = auth_func(inst, request, vp);
 
-	if (rc == RLM_MODULE_REJECT) {
-		RDEBUG("Passwords don't match");
-	}
-
-	if (rc == RLM_MODULE_OK) {
-		RDEBUG("User authenticated successfully");
-	}
-
-	return rc;
+	return pap_auth_done(request, rc);
 }
 
 
@@ -1496,6 +1761,9 @@ rad_module_t rlm_pap = {
 	.inst_size	= sizeof(rlm_pap_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_pap_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize
@@ -193,7 +193,7 @@ typedef enum {
 typedef struct cluster_nodes_live {
 	struct {
 		uint8_t					id;		//!< Node ID.
-		fr_pool_state_t const	*pool_state;	//!< Connection pool stats.
+		fr_pool_state_t				pool_state;	//!< Connection pool stats.
 		unsigned int				cumulative;	//!< Cumulative weight.
 	} node[UINT8_MAX - 1];				//!< Array of live node IDs (and weights).
 	uint8_t next;					//!< Next index in live.
@@ -1190,7 +1190,7 @@ static int _cluster_pool_walk(void *context, void *data)
 
 	if (live->skip == node->id) return 0;	/* Skip the dead node */
 
-	live->node[live->next].pool_state = fr_pool_state(node->pool);
+	fr_pool_state(&live->node[live->next].pool_state, node->pool);
 	live->node[live->next++].id = node->id;
 
 	return 0;
@@ -1364,7 +1364,7 @@ static int cluster_node_find_live(cluster_node_t **live_node, fr_redis_conn_t **
 		for (j = 0; j < live->next; j++) {
 			int weight;
 
-			weight = cluster_node_pool_health(&now, live->node[j].pool_state);
+			weight = cluster_node_pool_health(&now, &live->node[j].pool_state);
 			RDEBUG3("Node %i weight: %i", live->node[j].id, weight);
 			live->node[j].cumulative = (cumulative += weight);
 		}
@@ -1904,7 +1904,8 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	 */
 	case REDIS_RCODE_ASK:
 	{
-		cluster_node_t *new;
+		cluster_node_t	*new;
+		fr_pool_state_t	pool_state;
 
 		fr_pool_connection_release(state->node->pool, request, *conn);	/* Always release the old connection */
 
@@ -1937,7 +1938,8 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 			 */
 			state->reconnects = 0;
 			state->retries = 0;
-			state->in_pool = fr_pool_state(state->node->pool)->num;
+			fr_pool_state(&pool_state, state->node->pool);
+			state->in_pool = pool_state.num;
 			goto try_again;
 
 		case CLUSTER_OP_NO_CONNECTION:
@@ -2025,6 +2027,112 @@ int fr_redis_cluster_pool_by_node_addr(fr_pool_t **pool, fr_redis_cluster_t *clu
 	return 0;
 }
 
+/** Resolve a key to the address of the node which should handle it
+ *
+ * Used by the async client, which maintains its own connections to
+ * each node, instead of reserving them from the node's pool.
+ *
+ * @param[out] out	Where to write the node's address.
+ * @param[in] cluster	to resolve the key in.
+ * @param[in] request	The current request.
+ * @param[in] key	to resolve.  If NULL or key_len is 0, a random slot will be chosen.
+ * @param[in] key_len	Length of the key.
+ * @param[in] read_only	If true, will use a random slave in preference to the master.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there are no nodes in the cluster.
+ */
+int fr_redis_cluster_node_addr_by_key(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				      uint8_t const *key, size_t key_len, bool read_only)
+{
+	cluster_key_slot_t	*key_slot;
+	cluster_node_t		*node;
+
+	if (rbtree_num_elements(cluster->used_nodes) == 0) {
+		fr_strerror_printf("No nodes in cluster");
+		return -1;
+	}
+
+	key_slot = cluster_slot_by_key(cluster, request, key, key_len);
+	if (read_only && (key_slot->slave_num > 0)) {
+		node = &cluster->node[key_slot->slave[fr_rand() % key_slot->slave_num]];
+	} else {
+		node = &cluster->node[key_slot->master];
+	}
+
+	*out = node->addr;
+
+	return 0;
+}
+
+/** Get the address of the node in a -MOVED or -ASK redirect
+ *
+ * A -MOVED redirect means our key slot map is stale, so the cluster is
+ * marked as needing a remap.  The async client should then call
+ * #fr_redis_cluster_remap to perform it.
+ *
+ * @param[out] out	Where to write the node's address.
+ * @param[in] cluster	the redirect was received from.
+ * @param[in] reply	containing the redirect.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the redirect was malformed.
+ */
+int fr_redis_cluster_node_addr_by_redirect(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, redisReply *reply)
+{
+	if (cluster_node_conf_from_redirect(NULL, out, reply) < 0) return -1;
+
+	if (strncmp(REDIS_ERROR_MOVED_STR, reply->str, sizeof(REDIS_ERROR_MOVED_STR) - 1) == 0) {
+		cluster->remap_needed = true;
+	}
+
+	return 0;
+}
+
+/** Remap the cluster, if a redirect or connection failure showed the map is stale
+ *
+ * Used by the async client, which doesn't reserve connections from the
+ * node pools, so never reaches the remap in #fr_redis_cluster_state_init.
+ *
+ * The remap is done with a connection from the node we were redirected to,
+ * as it's known to be up.  #cluster_remap limits remaps to one a second,
+ * across all threads.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[in] request	The current request.
+ * @param[in] cluster	to remap.
+ * @param[in] node_addr	of the node to retrieve the new map from.
+ * @return
+ *	- 0 on success, or if no remap was needed.
+ *	- -1 on failure.
+ */
+int fr_redis_cluster_remap(REQUEST *request, fr_redis_cluster_t *cluster, fr_socket_addr_t *node_addr)
+{
+	fr_pool_t	*pool;
+	fr_redis_conn_t	*conn;
+	cluster_rcode_t	ret;
+
+	if (!cluster->remap_needed) return 0;
+
+	if (fr_redis_cluster_pool_by_node_addr(&pool, cluster, node_addr, true) < 0) return -1;
+
+	conn = fr_pool_connection_get(pool, request);
+	if (!conn) {
+		fr_strerror_printf("No connections available");
+		return -1;
+	}
+
+	ret = cluster_remap(request, cluster, conn);
+	if (ret == CLUSTER_OP_NO_CONNECTION) {
+		fr_pool_connection_close(pool, request, conn);
+		return -1;
+	}
+	fr_pool_connection_release(pool, request, conn);
+
+	return (ret < 0) ? -1 : 0;
+}
+
 /** Private ctx structure to pass to _cluster_role_walk
  *
  */
@@ -84,6 +84,15 @@ int fr_redis_cluster_pool_by_node_addr(fr_pool_t **pool, fr_redis_cluster_t *clu
 ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *out[],
 					   fr_redis_cluster_t *cluster, bool is_master, bool is_slave);
 
+/*
+ *	For the async client, which manages its own connections.
+ */
+int fr_redis_cluster_node_addr_by_key(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				      uint8_t const *key, size_t key_len, bool read_only);
+int fr_redis_cluster_node_addr_by_redirect(fr_socket_addr_t *out, fr_redis_cluster_t *cluster,
+					   redisReply *reply);
+int fr_redis_cluster_remap(REQUEST *request, fr_redis_cluster_t *cluster, fr_socket_addr_t *node_addr);
+
 /*
  *	Initialise a new cluster connection, and perform initial mapping.
  */
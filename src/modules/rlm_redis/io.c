@@ -0,0 +1,654 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file io.c
+ * @brief Asynchronous Redis client, driven by a worker's event loop
+ *
+ * Each worker thread gets one hiredis async context per cluster node, with
+ * the hiredis event hooks mapped onto the worker's fr_event_list_t.
+ *
+ * Commands from all the requests a worker is processing are written to
+ * the same connection.  hiredis appends them to its output buffer, and
+ * they go out in a single write when the socket becomes writable, so
+ * commands issued in the same pass of the event loop are pipelined
+ * without any extra work.  Replies come back in order, and each one
+ * resumes the request that issued the command.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/io/time.h>
+#include <hiredis/async.h>
+
+#include "io.h"
+
+/** An async connection to a single node
+ *
+ * Persists for the life of the thread.  The hiredis context is replaced
+ * if the connection is lost.
+ */
+typedef struct fr_redis_io_conn {
+	fr_redis_io_t		*io;		//!< Thread's client this connection belongs to.
+	fr_dlist_t		entry;		//!< Entry in the client's list of connections.
+
+	fr_socket_addr_t	addr;		//!< Address of the node.
+	char			name[INET6_ADDRSTRLEN];	//!< Node's address as text, for hiredis and logging.
+
+	redisAsyncContext	*ac;		//!< hiredis async context.  NULL if not connected.
+	bool			connected;	//!< Whether the connection was ever established.
+	time_t			last_failed;	//!< Last time we failed to connect.
+
+	bool			reading;	//!< hiredis wants read events.
+	bool			writing;	//!< hiredis wants write events.
+	int			fd;		//!< We registered with the event loop.
+
+	uint32_t		pending;	//!< Commands sent, and waiting for a reply.
+} fr_redis_io_conn_t;
+
+/** A thread's async client
+ *
+ */
+struct fr_redis_io {
+	fr_event_list_t		*el;		//!< Event list of the worker thread.
+	fr_redis_cluster_t	*cluster;	//!< Used to map keys to nodes.
+	fr_redis_conf_t const	*conf;		//!< Database, password, redirect limits etc...
+	char const		*log_prefix;	//!< What to prepend to log messages.
+
+	fr_dlist_t		conns;		//!< Connections to the nodes we've sent commands to.
+
+	bool			freeing;	//!< Thread is exiting, don't resume requests.
+};
+
+/** A command waiting for a reply
+ *
+ */
+struct fr_redis_io_cmd {
+	fr_redis_io_t		*io;		//!< Client the command was sent with.
+	REQUEST			*request;	//!< which issued the command.  NULL if cancelled.
+
+	fr_redis_io_reply_t	reply;		//!< Called with the reply.
+	void			*uctx;		//!< Passed to the reply callback.
+
+	int			argc;		//!< Number of arguments.
+	char const		**argv;		//!< Copy of the command, for redirects and retries.
+	size_t			*argv_len;	//!< Lengths of the arguments.
+
+	fr_socket_addr_t	addr;		//!< Node the command was last sent to.
+	uint32_t		redirects;	//!< How many redirects we've followed.
+	uint32_t		retries;	//!< How many times we've received -TRYAGAIN.
+	fr_event_timer_t const	*ev;		//!< Retry timer.
+	fr_event_timer_t const	*remap_ev;	//!< Cluster remap timer.
+};
+
+static int redis_io_send(fr_redis_io_cmd_t *cmd, fr_socket_addr_t const *addr, bool asking);
+
+/** Register the events hiredis is interested in with the event loop
+ *
+ * @param[in] conn	to update events for.
+ */
+static void redis_io_events_update(fr_redis_io_conn_t *conn);
+
+static void _redis_io_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_redis_io_conn_t *conn = talloc_get_type_abort(uctx, fr_redis_io_conn_t);
+
+	redisAsyncHandleRead(conn->ac);
+}
+
+static void _redis_io_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_redis_io_conn_t *conn = talloc_get_type_abort(uctx, fr_redis_io_conn_t);
+
+	redisAsyncHandleWrite(conn->ac);
+}
+
+static void _redis_io_errored(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_redis_io_conn_t	*conn = talloc_get_type_abort(uctx, fr_redis_io_conn_t);
+	fr_redis_io_t		*io = conn->io;
+
+	ERROR("%s: Connection to %s:%i failed on FD %i: %s", io->log_prefix,
+	      conn->name, conn->addr.port, fd, fr_syserror(fd_errno));
+
+	/*
+	 *	Fails any commands waiting for replies.
+	 */
+	redisAsyncFree(conn->ac);
+}
+
+static void redis_io_events_update(fr_redis_io_conn_t *conn)
+{
+	fr_redis_io_t	*io = conn->io;
+
+	if (!conn->reading && !conn->writing) {
+		if (conn->fd >= 0) {
+			(void) fr_event_fd_delete(io->el, conn->fd, FR_EVENT_FILTER_IO);
+			conn->fd = -1;
+		}
+		return;
+	}
+
+	if (fr_event_fd_insert(conn, io->el, conn->ac->c.fd,
+			       conn->reading ? _redis_io_readable : NULL,
+			       conn->writing ? _redis_io_writable : NULL,
+			       _redis_io_errored,
+			       conn) < 0) {
+		PERROR("%s: Failed registering events for connection to %s:%i", io->log_prefix,
+		       conn->name, conn->addr.port);
+		return;
+	}
+	conn->fd = conn->ac->c.fd;
+}
+
+/*
+ *	The hiredis event hooks.  privdata is the fr_redis_io_conn_t.
+ */
+static void _redis_io_add_read(void *privdata)
+{
+	fr_redis_io_conn_t *conn = privdata;
+
+	conn->reading = true;
+	redis_io_events_update(conn);
+}
+
+static void _redis_io_del_read(void *privdata)
+{
+	fr_redis_io_conn_t *conn = privdata;
+
+	conn->reading = false;
+	redis_io_events_update(conn);
+}
+
+static void _redis_io_add_write(void *privdata)
+{
+	fr_redis_io_conn_t *conn = privdata;
+
+	conn->writing = true;
+	redis_io_events_update(conn);
+}
+
+static void _redis_io_del_write(void *privdata)
+{
+	fr_redis_io_conn_t *conn = privdata;
+
+	conn->writing = false;
+	redis_io_events_update(conn);
+}
+
+/** Called by hiredis just before it frees the async context
+ *
+ * Any commands which were waiting for replies have already been failed.
+ */
+static void _redis_io_cleanup(void *privdata)
+{
+	fr_redis_io_conn_t *conn = privdata;
+
+	conn->reading = conn->writing = false;
+	redis_io_events_update(conn);
+
+	/*
+	 *	If we never managed to connect, don't try again
+	 *	for a bit, otherwise every request would hammer
+	 *	the node with connection attempts.
+	 */
+	if (!conn->connected) conn->last_failed = time(NULL);
+
+	conn->ac = NULL;
+	conn->connected = false;
+	conn->pending = 0;
+}
+
+static void _redis_io_connected(redisAsyncContext const *ac, int status)
+{
+	fr_redis_io_conn_t	*conn = ac->ev.data;
+	fr_redis_io_t		*io = conn->io;
+
+	if (status != REDIS_OK) {
+		ERROR("%s: Connection to %s:%i failed: %s", io->log_prefix, conn->name, conn->addr.port, ac->errstr);
+		return;
+	}
+
+	DEBUG2("%s: Connected to %s:%i", io->log_prefix, conn->name, conn->addr.port);
+	conn->connected = true;
+}
+
+static void _redis_io_disconnected(redisAsyncContext const *ac, int status)
+{
+	fr_redis_io_t *io = ac->data;
+
+	if (status != REDIS_OK) {
+		ERROR("%s: Connection lost: %s", io->log_prefix, ac->errstr);
+		return;
+	}
+
+	DEBUG2("%s: Disconnected", io->log_prefix);
+}
+
+/** Check the replies to AUTH and SELECT
+ *
+ * If either fails, commands queued behind them would run with the wrong
+ * credentials or against the wrong database, so drop the connection.
+ */
+static void _redis_io_setup_reply(redisAsyncContext *ac, void *r, UNUSED void *privdata)
+{
+	fr_redis_io_conn_t	*conn = ac->ev.data;
+	fr_redis_io_t		*io = conn->io;
+	redisReply		*reply = r;
+
+	if (!reply) return;	/* Connection failed, already logged */
+
+	if ((reply->type == REDIS_REPLY_STATUS) && (strcmp(reply->str, "OK") == 0)) return;
+
+	ERROR("%s: Setting up connection to %s:%i failed: %s", io->log_prefix, conn->name, conn->addr.port,
+	      (reply->type == REDIS_REPLY_ERROR) ? reply->str :
+	      fr_int2str(redis_reply_types, reply->type, "<UNKNOWN>"));
+
+	redisAsyncDisconnect(ac);
+}
+
+/** Open an async connection to a node
+ *
+ * The connection completes in the background.  Commands can be sent
+ * immediately, and will be written once it's up.
+ *
+ * @param[in] conn	to connect.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int redis_io_connect(fr_redis_io_conn_t *conn)
+{
+	fr_redis_io_t		*io = conn->io;
+	redisAsyncContext	*ac;
+
+	DEBUG2("%s: Connecting to %s:%i", io->log_prefix, conn->name, conn->addr.port);
+
+	ac = redisAsyncConnect(conn->name, conn->addr.port);
+	if (!ac) {
+		fr_strerror_printf("Connection to %s:%i failed", conn->name, conn->addr.port);
+	error:
+		conn->last_failed = time(NULL);
+		return -1;
+	}
+	if (ac->err) {
+		fr_strerror_printf("Connection to %s:%i failed: %s", conn->name, conn->addr.port, ac->errstr);
+		redisAsyncFree(ac);
+		goto error;
+	}
+
+	conn->ac = ac;
+	conn->fd = -1;
+
+	ac->data = io;
+	ac->ev.data = conn;
+	ac->ev.addRead = _redis_io_add_read;
+	ac->ev.delRead = _redis_io_del_read;
+	ac->ev.addWrite = _redis_io_add_write;
+	ac->ev.delWrite = _redis_io_del_write;
+	ac->ev.cleanup = _redis_io_cleanup;
+
+	redisAsyncSetConnectCallback(ac, _redis_io_connected);
+	redisAsyncSetDisconnectCallback(ac, _redis_io_disconnected);
+
+	/*
+	 *	These go out ahead of anything else written
+	 *	to the connection.
+	 */
+	if (io->conf->password) {
+		DEBUG3("%s: Executing: AUTH %s", io->log_prefix, io->conf->password);
+		redisAsyncCommand(ac, _redis_io_setup_reply, NULL, "AUTH %s", io->conf->password);
+	}
+
+	if (io->conf->database) {
+		DEBUG3("%s: Executing: SELECT %i", io->log_prefix, io->conf->database);
+		redisAsyncCommand(ac, _redis_io_setup_reply, NULL, "SELECT %i", io->conf->database);
+	}
+
+	return 0;
+}
+
+/** Find, or create, the connection to a node
+ *
+ * @param[in] io	Thread's client.
+ * @param[in] addr	of the node.
+ * @return
+ *	- A connected, or connecting, connection.
+ *	- NULL if we couldn't connect.
+ */
+static fr_redis_io_conn_t *redis_io_conn_by_addr(fr_redis_io_t *io, fr_socket_addr_t const *addr)
+{
+	fr_dlist_t		*entry;
+	fr_redis_io_conn_t	*conn = NULL;
+
+	/*
+	 *	There are at most max_nodes of these.
+	 */
+	for (entry = FR_DLIST_FIRST(io->conns); entry; entry = FR_DLIST_NEXT(io->conns, entry)) {
+		fr_redis_io_conn_t *this = fr_ptr_to_type(fr_redis_io_conn_t, entry, entry);
+
+		if ((this->addr.port == addr->port) && (fr_ipaddr_cmp(&this->addr.ipaddr, &addr->ipaddr) == 0)) {
+			conn = this;
+			break;
+		}
+	}
+
+	if (!conn) {
+		MEM(conn = talloc_zero(io, fr_redis_io_conn_t));
+		conn->io = io;
+		conn->addr = *addr;
+		conn->fd = -1;
+		fr_inet_ntop(conn->name, sizeof(conn->name), &addr->ipaddr);
+		fr_dlist_insert_tail(&io->conns, &conn->entry);
+	}
+
+	if (conn->ac) return conn;
+
+	if (conn->last_failed && (time(NULL) < (conn->last_failed + 1))) {
+		fr_strerror_printf("Connection to %s:%i failed recently, not retrying", conn->name, conn->addr.port);
+		return NULL;
+	}
+
+	if (redis_io_connect(conn) < 0) return NULL;
+
+	return conn;
+}
+
+/** Pass the result of a command back to the request, and resume it
+ *
+ */
+static void redis_io_cmd_done(fr_redis_io_cmd_t *cmd, fr_redis_rcode_t status, redisReply *reply)
+{
+	REQUEST *request = cmd->request;
+
+	if (request && !cmd->io->freeing) {
+		cmd->reply(request, status, reply, cmd->uctx);
+		unlang_resumable(request);
+	}
+
+	talloc_free(cmd);
+}
+
+static void _redis_io_retry(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	fr_redis_io_cmd_t *cmd = talloc_get_type_abort(uctx, fr_redis_io_cmd_t);
+
+	if (redis_io_send(cmd, &cmd->addr, false) < 0) redis_io_cmd_done(cmd, REDIS_RCODE_RECONNECT, NULL);
+}
+
+static void _redis_io_remap(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	fr_redis_io_cmd_t	*cmd = talloc_get_type_abort(uctx, fr_redis_io_cmd_t);
+	REQUEST			*request = cmd->request;
+
+	if (!request || cmd->io->freeing) return;
+
+	if (fr_redis_cluster_remap(request, cmd->io->cluster, &cmd->addr) < 0) RPEDEBUG2("Cluster remap failed");
+}
+
+/** Process the reply to a command
+ *
+ * Follows -MOVED and -ASK redirects, and retries on -TRYAGAIN, the
+ * same as the synchronous cluster code.  A -MOVED redirect also
+ * schedules a remap of the cluster, once the redirected command has
+ * been sent.
+ */
+static void _redis_io_reply(redisAsyncContext *ac, void *r, void *privdata)
+{
+	fr_redis_io_conn_t	*conn = ac->ev.data;
+	fr_redis_io_cmd_t	*cmd = talloc_get_type_abort(privdata, fr_redis_io_cmd_t);
+	fr_redis_io_t		*io = cmd->io;
+	REQUEST			*request = cmd->request;
+	redisReply		*reply = r;
+	fr_redis_rcode_t	status;
+	fr_socket_addr_t	addr;
+
+	if (conn->pending > 0) conn->pending--;
+
+	if (!reply) {
+		fr_strerror_printf("Connection error: %s", ac->errstr);
+		redis_io_cmd_done(cmd, REDIS_RCODE_RECONNECT, NULL);
+		return;
+	}
+
+	status = fr_redis_command_status(NULL, reply);
+	if (!request || io->freeing) goto done;
+
+	switch (status) {
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		if (cmd->redirects++ >= io->conf->max_redirects) {
+			REDEBUG("Too many redirects (%u)", io->conf->max_redirects);
+			break;
+		}
+
+		if (fr_redis_cluster_node_addr_by_redirect(&addr, io->cluster, reply) < 0) {
+			REDEBUG("Received invalid redirect \"%s\"", reply->str);
+			break;
+		}
+
+		RDEBUG2("Following %s redirect", reply->str);
+		if (redis_io_send(cmd, &addr, (status == REDIS_RCODE_ASK)) < 0) {
+			redis_io_cmd_done(cmd, REDIS_RCODE_RECONNECT, NULL);
+			return;
+		}
+
+		/*
+		 *	Our map is stale.  Remap on the next pass of
+		 *	the event loop, so the redirected command
+		 *	isn't held up by it.
+		 */
+		if ((status == REDIS_RCODE_MOVE) && !cmd->remap_ev) {
+			struct timeval now;
+
+			gettimeofday(&now, NULL);
+			if (fr_event_timer_insert(cmd, io->el, &cmd->remap_ev, &now, _redis_io_remap, cmd) < 0) {
+				RPEDEBUG("Failed inserting remap timer");
+			}
+		}
+		return;
+
+	case REDIS_RCODE_TRY_AGAIN:
+	{
+		struct timeval now, when;
+
+		if (cmd->retries++ >= io->conf->max_retries) {
+			REDEBUG("Hit maximum retry attempts");
+			break;
+		}
+
+		RDEBUG2("Server told us to try again in %u.%06u seconds",
+			(unsigned int)io->conf->retry_delay.tv_sec, (unsigned int)io->conf->retry_delay.tv_usec);
+
+		gettimeofday(&now, NULL);
+		fr_timeval_add(&when, &now, &io->conf->retry_delay);
+		if (fr_event_timer_insert(cmd, io->el, &cmd->ev, &when, _redis_io_retry, cmd) < 0) {
+			RPEDEBUG("Failed inserting retry timer");
+			break;
+		}
+	}
+		return;
+
+	default:
+		break;
+	}
+
+done:
+	redis_io_cmd_done(cmd, status, reply);
+}
+
+/** Write a command to the connection for a node
+ *
+ */
+static int redis_io_send(fr_redis_io_cmd_t *cmd, fr_socket_addr_t const *addr, bool asking)
+{
+	fr_redis_io_conn_t	*conn;
+
+	conn = redis_io_conn_by_addr(cmd->io, addr);
+	if (!conn) return -1;
+
+	/*
+	 *	-ASK redirects are only valid for the next
+	 *	command, which must be preceded by ASKING.
+	 */
+	if (asking && (redisAsyncCommand(conn->ac, NULL, NULL, "ASKING") != REDIS_OK)) {
+		fr_strerror_printf("Failed sending ASKING to %s:%i", conn->name, conn->addr.port);
+		return -1;
+	}
+
+	if (redisAsyncCommandArgv(conn->ac, _redis_io_reply, cmd,
+				  cmd->argc, cmd->argv, cmd->argv_len) != REDIS_OK) {
+		fr_strerror_printf("Failed sending command to %s:%i", conn->name, conn->addr.port);
+		return -1;
+	}
+
+	cmd->addr = *addr;
+	conn->pending++;
+
+	return 0;
+}
+
+/** Send a command to the node responsible for a key
+ *
+ * The command is queued on the thread's connection to the node, and
+ * written out along with any other commands queued in this pass of the
+ * event loop.  When the reply arrives, the reply callback is called, and
+ * the request is marked as resumable.
+ *
+ * The caller should return unlang_module_yield() after a successful call,
+ * with a signal callback that calls #fr_redis_io_command_cancel.
+ *
+ * @param[in] io	Thread's client.
+ * @param[in] request	The current request.
+ * @param[in] key	Used to pick the node.  If NULL or key_len is 0, a random
+ *			node will be picked.
+ * @param[in] key_len	Length of the key.
+ * @param[in] read_only	If true, a slave may be picked.
+ * @param[in] reply	callback to process the reply.
+ * @param[in] uctx	to pass to the reply callback.
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Command and arguments.  Copied.
+ * @param[in] argv_len	Lengths of the arguments.  If NULL, strlen is used.
+ * @return
+ *	- The command.  Only valid until the request is resumed.
+ *	- NULL on error.
+ */
+fr_redis_io_cmd_t *fr_redis_io_command(fr_redis_io_t *io, REQUEST *request,
+				       uint8_t const *key, size_t key_len, bool read_only,
+				       fr_redis_io_reply_t reply, void *uctx,
+				       int argc, char const **argv, size_t const *argv_len)
+{
+	fr_redis_io_cmd_t	*cmd;
+	fr_socket_addr_t	addr;
+	int			i;
+
+	if (fr_redis_cluster_node_addr_by_key(&addr, io->cluster, request, key, key_len, read_only) < 0) {
+		return NULL;
+	}
+
+	MEM(cmd = talloc_zero(io, fr_redis_io_cmd_t));
+	cmd->io = io;
+	cmd->request = request;
+	cmd->reply = reply;
+	cmd->uctx = uctx;
+	cmd->argc = argc;
+	MEM(cmd->argv = talloc_array(cmd, char const *, argc));
+	MEM(cmd->argv_len = talloc_array(cmd, size_t, argc));
+
+	for (i = 0; i < argc; i++) {
+		cmd->argv_len[i] = argv_len ? argv_len[i] : strlen(argv[i]);
+		MEM(cmd->argv[i] = talloc_memdup(cmd->argv, argv[i], cmd->argv_len[i]));
+	}
+
+	if (redis_io_send(cmd, &addr, false) < 0) {
+		talloc_free(cmd);
+		return NULL;
+	}
+
+	return cmd;
+}
+
+/** Stop a request from being resumed when a command completes
+ *
+ * The command may already have been written, so it's left to complete,
+ * and its reply is discarded.
+ *
+ * @param[in] cmd	to cancel.
+ */
+void fr_redis_io_command_cancel(fr_redis_io_cmd_t *cmd)
+{
+	cmd->request = NULL;
+
+	/*
+	 *	Waiting to retry, nothing to wait for.
+	 */
+	if (cmd->ev) talloc_free(cmd);
+}
+
+/** Close all the thread's connections
+ *
+ */
+static int _redis_io_free(fr_redis_io_t *io)
+{
+	fr_dlist_t *entry;
+
+	io->freeing = true;
+
+	for (entry = FR_DLIST_FIRST(io->conns); entry; entry = FR_DLIST_NEXT(io->conns, entry)) {
+		fr_redis_io_conn_t *conn = fr_ptr_to_type(fr_redis_io_conn_t, entry, entry);
+
+		if (conn->ac) redisAsyncFree(conn->ac);
+	}
+
+	return 0;
+}
+
+/** Allocate an async client for a worker thread
+ *
+ * Should be called from a module's thread_instantiate callback.
+ * Connections to the cluster's nodes are opened as they're needed.
+ *
+ * @param[in] ctx		to allocate the client in.
+ * @param[in] el		Event list of the worker thread.
+ * @param[in] cluster		to map keys to nodes with.
+ * @param[in] conf		Connection configuration for the nodes.
+ * @param[in] log_prefix	What to prepend to log messages.
+ * @return
+ *	- A new async client.
+ *	- NULL on error.
+ */
+fr_redis_io_t *fr_redis_io_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_redis_cluster_t *cluster,
+				 fr_redis_conf_t const *conf, char const *log_prefix)
+{
+	fr_redis_io_t *io;
+
+	io = talloc_zero(ctx, fr_redis_io_t);
+	if (!io) return NULL;
+
+	io->el = el;
+	io->cluster = cluster;
+	io->conf = conf;
+	io->log_prefix = talloc_typed_strdup(io, log_prefix);
+	FR_DLIST_INIT(io->conns);
+
+	talloc_set_destructor(io, _redis_io_free);
+
+	return io;
+}
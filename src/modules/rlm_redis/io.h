@@ -0,0 +1,61 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file io.h
+ * @brief Asynchronous Redis client, driven by a worker's event loop
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+
+#ifndef LIBFREERADIUS_REDIS_IO_H
+#define	LIBFREERADIUS_REDIS_IO_H
+
+RCSIDH(redis_io_h, "$Id$")
+
+#include <freeradius-devel/event.h>
+#include "redis.h"
+#include "cluster.h"
+
+typedef struct fr_redis_io fr_redis_io_t;
+typedef struct fr_redis_io_cmd fr_redis_io_cmd_t;
+
+/** Process the reply to an asynchronous command
+ *
+ * Called from the event loop, before the request is marked as resumable.
+ * The reply is freed once the callback returns, so anything the module
+ * needs must be copied out of it.
+ *
+ * @param[in] request	which issued the command.
+ * @param[in] status	of the command.  Anything other than REDIS_RCODE_SUCCESS
+ *			is a failure, with the reason available via fr_strerror().
+ * @param[in] reply	from the server.  May be NULL if the connection failed.
+ * @param[in] uctx	passed to #fr_redis_io_command.
+ */
+typedef void (*fr_redis_io_reply_t)(REQUEST *request, fr_redis_rcode_t status, redisReply *reply, void *uctx);
+
+fr_redis_io_t		*fr_redis_io_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_redis_cluster_t *cluster,
+					   fr_redis_conf_t const *conf, char const *log_prefix);
+
+fr_redis_io_cmd_t	*fr_redis_io_command(fr_redis_io_t *io, REQUEST *request,
+					     uint8_t const *key, size_t key_len, bool read_only,
+					     fr_redis_io_reply_t reply, void *uctx,
+					     int argc, char const **argv, size_t const *argv_len);
+
+void			fr_redis_io_command_cancel(fr_redis_io_cmd_t *cmd);
+
+#endif	/* LIBFREERADIUS_REDIS_IO_H */
@@ -35,6 +35,7 @@ RCSID("$Id$")
 
 #include "../rlm_redis/redis.h"
 #include "../rlm_redis/cluster.h"
+#include "../rlm_redis/io.h"
 
 typedef struct rlm_rediswho {
 	fr_redis_conf_t		*conf;		//!< Connection parameters for the Redis server.
@@ -76,20 +77,71 @@ static CONF_PARSER module_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
-/*
- *	Query the database executing a command with no result rows
+typedef struct rlm_rediswho_thread {
+	fr_redis_io_t		*io;		//!< Async client, with a connection per cluster node.
+} rlm_rediswho_thread_t;
+
+/** Where we are in the sequence of accounting commands
+ *
+ */
+typedef enum {
+	REDISWHO_STATE_INSERT = 0,		//!< Waiting for the insert reply.
+	REDISWHO_STATE_TRIM,			//!< Waiting for the trim reply.
+	REDISWHO_STATE_EXPIRE,			//!< Waiting for the expire reply.
+	REDISWHO_STATE_DONE			//!< All commands complete.
+} rlm_rediswho_state_t;
+
+/** Tracks the commands issued for a single request
+ *
+ */
+typedef struct rlm_rediswho_rctx {
+	char const		*insert;	//!< Command for inserting session data.
+	char const		*trim;		//!< Command for trimming the session list.
+	char const		*expire;	//!< Command for expiring entries.
+
+	rlm_rediswho_state_t	state;		//!< Which command we're waiting on.
+	fr_redis_io_cmd_t	*cmd;		//!< Command in progress.
+	int			ret;		//!< Result of the last command.
+} rlm_rediswho_rctx_t;
+
+/** Process the reply to a command
+ *
+ * Sets the result to the value of integer replies, which for the insert
+ * command is the length of the session list.
  */
-static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char const *fmt)
+static void _rediswho_reply(REQUEST *request, fr_redis_rcode_t status, redisReply *reply, void *uctx)
 {
-	fr_redis_conn_t		*conn;
+	rlm_rediswho_rctx_t	*rctx = talloc_get_type_abort(uctx, rlm_rediswho_rctx_t);
 
-	int 			ret = -1;
+	rctx->cmd = NULL;
+	rctx->ret = -1;
 
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		status;
-	redisReply		*reply = NULL;
-	int			s_ret;
+	if (status != REDIS_RCODE_SUCCESS) {
+		RPERROR("Failed inserting accounting data");
+		return;
+	}
+	if (!rad_cond_assert(reply)) return;
+
+	switch (reply->type) {
+	case REDIS_REPLY_INTEGER:
+		RDEBUG2("Query response %lld", reply->integer);
+		if (reply->integer > 0) rctx->ret = reply->integer;
+		break;
 
+	case REDIS_REPLY_STRING:
+		REDEBUG2("Query response %s", reply->str);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/*
+ *	Query the database executing a command with no result rows
+ */
+static int rediswho_command(rlm_rediswho_thread_t *t, REQUEST *request, rlm_rediswho_rctx_t *rctx, char const *fmt)
+{
 	uint8_t	const		*key = NULL;
 	size_t			key_len = 0;
 
@@ -97,8 +149,6 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 	char const		*argv[MAX_REDIS_ARGS];
 	char			argv_buf[MAX_REDIS_COMMAND_LEN];
 
-	if (!fmt || !*fmt) return 0;
-
 	argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
  	if (argc < 0) return -1;
 
@@ -114,65 +164,107 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 	 	key_len = strlen((char const *)key);
 	}
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, false);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
-		reply = redisCommandArgv(conn->handle, argc, argv, NULL);
-		status = fr_redis_command_status(conn, reply);
-	}
-	if (s_ret != REDIS_RCODE_SUCCESS) {
-		RERROR("Failed inserting accounting data");
-	error:
-		fr_redis_reply_free(reply);
+	/*
+	 *	argv is copied, so the stack buffer can go.
+	 */
+	rctx->cmd = fr_redis_io_command(t->io, request, key, key_len, false, _rediswho_reply, rctx,
+					argc, argv, NULL);
+	if (!rctx->cmd) {
+		RPERROR("Failed inserting accounting data");
 		return -1;
 	}
-	if (!rad_cond_assert(reply)) goto error;
 
-	switch (reply->type) {
-	case REDIS_REPLY_INTEGER:
-		RDEBUG2("Query response %lld", reply->integer);
-		if (reply->integer > 0) ret = reply->integer;
-		break;
+	return 0;
+}
 
-	case REDIS_REPLY_STRING:
-		REDEBUG2("Query response %s", reply->str);
-		break;
+static rlm_rcode_t mod_accounting_resume(REQUEST *request, void *instance, void *thread, void *ctx);
 
-	default:
-		break;
-	}
-	fr_redis_reply_free(reply);
+/** Stop waiting for a reply if the request is cancelled
+ *
+ */
+static void mod_accounting_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+				  void *ctx, fr_state_action_t action)
+{
+	rlm_rediswho_rctx_t	*rctx = talloc_get_type_abort(ctx, rlm_rediswho_rctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending Redis command");
 
-	return ret;
+	if (rctx->cmd) fr_redis_io_command_cancel(rctx->cmd);
+	talloc_free(rctx);
 }
 
-static rlm_rcode_t mod_accounting_all(rlm_rediswho_t const *inst, REQUEST *request,
-				      char const *insert,
-				      char const *trim,
-				      char const *expire)
+/** Issue the next command in the sequence, or finish
+ *
+ * Commands with an empty format string are skipped, as are trims
+ * if the session list is shorter than trim_count.
+ */
+static rlm_rcode_t mod_accounting_next(rlm_rediswho_t const *inst, rlm_rediswho_thread_t *t,
+				       REQUEST *request, rlm_rediswho_rctx_t *rctx)
 {
-	int ret;
+	char const *fmt;
+
+	for (;;) {
+		switch (rctx->state) {
+		case REDISWHO_STATE_INSERT:
+			fmt = rctx->insert;
+			break;
+
+		case REDISWHO_STATE_TRIM:
+			/* Only trim if necessary */
+			if ((inst->trim_count < 0) || (rctx->ret <= inst->trim_count)) {
+				rctx->state = REDISWHO_STATE_EXPIRE;
+				continue;
+			}
+			fmt = rctx->trim;
+			break;
+
+		case REDISWHO_STATE_EXPIRE:
+			fmt = rctx->expire;
+			break;
+
+		case REDISWHO_STATE_DONE:
+		default:
+			talloc_free(rctx);
+			return RLM_MODULE_OK;
+		}
+
+		if (fmt && *fmt) break;
+
+		rctx->ret = 0;
+		rctx->state++;
+	}
 
-	ret = rediswho_command(inst, request, insert);
-	if (ret < 0) return RLM_MODULE_FAIL;
+	if (rediswho_command(t, request, rctx, fmt) < 0) {
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
 
-	/* Only trim if necessary */
-	if ((inst->trim_count >= 0) && (ret > inst->trim_count)) {
-		if (rediswho_command(inst, request, trim) < 0) return RLM_MODULE_FAIL;
+	return unlang_module_yield(request, mod_accounting_resume, mod_accounting_signal, rctx);
+}
+
+static rlm_rcode_t mod_accounting_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_rediswho_rctx_t	*rctx = talloc_get_type_abort(ctx, rlm_rediswho_rctx_t);
+
+	if (rctx->ret < 0) {
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
 	}
 
-	if (rediswho_command(inst, request, expire) < 0) return RLM_MODULE_FAIL;
-	return RLM_MODULE_OK;
+	rctx->state++;
+
+	return mod_accounting_next(instance, thread, request, rctx);
 }
 
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rediswho_t const	*inst = instance;
-	rlm_rcode_t		rcode;
+	rlm_rediswho_rctx_t	*rctx;
 	VALUE_PAIR		*vp;
 	fr_dict_enum_t		*dv;
 	CONF_SECTION		*cs;
-	char const		*insert, *trim, *expire;
 
 	vp = fr_pair_find_by_num(request->packet->vps, 0, FR_ACCT_STATUS_TYPE, TAG_ANY);
 	if (!vp) {
@@ -192,13 +284,13 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *
 		return RLM_MODULE_NOOP;
 	}
 
-	insert = cf_pair_value(cf_pair_find(cs, "insert"));
-	trim = cf_pair_value(cf_pair_find(cs, "trim"));
-	expire = cf_pair_value(cf_pair_find(cs, "expire"));
-
-	rcode = mod_accounting_all(inst, request, insert, trim, expire);
+	MEM(rctx = talloc_zero(request, rlm_rediswho_rctx_t));
+	rctx->insert = cf_pair_value(cf_pair_find(cs, "insert"));
+	rctx->trim = cf_pair_value(cf_pair_find(cs, "trim"));
+	rctx->expire = cf_pair_value(cf_pair_find(cs, "expire"));
+	rctx->state = REDISWHO_STATE_INSERT;
 
-	return rcode;
+	return mod_accounting_next(inst, thread, request, rctx);
 }
 
 static int mod_bootstrap(void *instance, CONF_SECTION *conf)
@@ -222,6 +314,34 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/** Allocate the thread's async client
+ *
+ * Connections to the cluster nodes are opened as commands are sent to them.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_rediswho_t		*inst = instance;
+	rlm_rediswho_thread_t	*t = thread;
+
+	t->io = fr_redis_io_alloc(NULL, el, inst->cluster, inst->conf, inst->name);
+	if (!t->io) {
+		ERROR("Failed allocating async Redis client");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_rediswho_thread_t	*t = thread;
+
+	TALLOC_FREE(t->io);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -235,10 +355,13 @@ rad_module_t rlm_rediswho = {
 	.name		= "rediswho",
 	.type		= RLM_TYPE_THREAD_SAFE,
 	.inst_size	= sizeof(rlm_rediswho_t),
+	.thread_inst_size	= sizeof(rlm_rediswho_thread_t),
 	.config		= module_config,
 	.load		= mod_load,
 	.instantiate	= mod_instantiate,
 	.bootstrap	= mod_bootstrap,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting
 	},
@@ -66,10 +66,30 @@ static const FR_NAME_NUMBER server_warnings_table[] = {
 	{ NULL, 0 }
 };
 
+/*
+ *	Prepared statements were added in 4.1
+ */
+#if (MYSQL_VERSION_ID >= 40100)
+#  define HAVE_MYSQL_STMT 1
+#endif
+
 typedef struct rlm_sql_mysql_conn {
 	MYSQL		db;
 	MYSQL		*sock;
 	MYSQL_RES	*result;
+
+#ifdef HAVE_MYSQL_STMT
+	MYSQL_STMT	**stmts;		//!< Prepared statements, indexed by sql_stmt_t id.
+	bool		*prepared;		//!< Whether each of stmts has been prepared.
+	int		num_stmts;		//!< Number of elements in stmts.
+
+	MYSQL_STMT	*stmt;			//!< Statement last executed, whose result is being read.
+	MYSQL_RES	*stmt_meta;		//!< Field information for stmt's result.
+	MYSQL_BIND	*stmt_bind;		//!< Bindings for stmt's result columns.
+	unsigned long	*stmt_lengths;		//!< Lengths of the columns in the current row.
+	my_bool		*stmt_is_null;		//!< Whether each column in the current row is NULL.
+	unsigned int	stmt_fields;		//!< Number of columns in stmt's result.
+#endif
 } rlm_sql_mysql_conn_t;
 
 typedef struct rlm_sql_mysql_config {
@@ -112,6 +132,18 @@ static int _sql_socket_destructor(rlm_sql_mysql_conn_t *conn)
 {
 	DEBUG2("Socket destructor called, closing socket");
 
+#ifdef HAVE_MYSQL_STMT
+	if (conn->stmt_meta) mysql_free_result(conn->stmt_meta);
+
+	if (conn->stmts) {
+		int i;
+
+		for (i = 0; i < conn->num_stmts; i++) {
+			if (conn->stmts[i]) mysql_stmt_close(conn->stmts[i]);
+		}
+	}
+#endif
+
 	if (conn->sock){
 		mysql_close(conn->sock);
 	}
@@ -335,6 +367,10 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 		return RLM_SQL_RECONNECT;
 	}
 
+#ifdef HAVE_MYSQL_STMT
+	conn->stmt = NULL;
+#endif
+
 	mysql_query(conn->sock, query);
 	rcode = sql_check_error(conn->sock, 0);
 	if (rcode != RLM_SQL_OK) {
@@ -381,6 +417,10 @@ static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *con
 	int num = 0;
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+#ifdef HAVE_MYSQL_STMT
+	if (conn->stmt) return mysql_stmt_field_count(conn->stmt);
+#endif
+
 #if MYSQL_VERSION_ID >= 32224
 	/*
 	 *	Count takes a connection handle
@@ -423,6 +463,10 @@ static int sql_num_rows(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *confi
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+#ifdef HAVE_MYSQL_STMT
+	if (conn->stmt) return mysql_stmt_num_rows(conn->stmt);
+#endif
+
 	if (conn->result) {
 		return mysql_num_rows(conn->result);
 	}
@@ -450,6 +494,14 @@ static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, rlm_
 	 *	https://bugs.mysql.com/bug.php?id=32318
 	 * 	Hints that we don't have to free field_info.
 	 */
+#ifdef HAVE_MYSQL_STMT
+	if (conn->stmt) {
+		if (!conn->stmt_meta) conn->stmt_meta = mysql_stmt_result_metadata(conn->stmt);
+		if (!conn->stmt_meta) return RLM_SQL_ERROR;
+
+		field_info = mysql_fetch_fields(conn->stmt_meta);
+	} else
+#endif
 	field_info = mysql_fetch_fields(conn->result);
 	if (!field_info) return RLM_SQL_ERROR;
 
@@ -461,6 +513,181 @@ static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, rlm_
 	return RLM_SQL_OK;
 }
 
+#ifdef HAVE_MYSQL_STMT
+/** Prepare a statement on the server
+ *
+ * The statement exists until the connection is closed.
+ */
+static sql_rcode_t sql_prepare(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, sql_stmt_t const *stmt)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	MYSQL_STMT		*mstmt;
+	sql_rcode_t		rcode;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!conn->stmts) {
+		conn->num_stmts = handle->inst->num_stmts;
+		MEM(conn->stmts = talloc_zero_array(conn, MYSQL_STMT *, conn->num_stmts));
+		MEM(conn->prepared = talloc_zero_array(conn, bool, conn->num_stmts));
+	}
+	rad_assert(stmt->id < conn->num_stmts);
+
+	if (conn->prepared[stmt->id]) return RLM_SQL_OK;
+
+	mstmt = conn->stmts[stmt->id];
+	if (!mstmt) {
+		mstmt = conn->stmts[stmt->id] = mysql_stmt_init(conn->sock);
+		if (!mstmt) {
+			ERROR("Failed allocating statement");
+			return RLM_SQL_ERROR;
+		}
+	}
+
+	if (mysql_stmt_prepare(mstmt, stmt->text, strlen(stmt->text)) != 0) {
+		conn->stmt = mstmt;	/* So sql_error can find the error */
+
+		rcode = sql_check_error(NULL, mysql_stmt_errno(mstmt));
+		return (rcode == RLM_SQL_OK) ? RLM_SQL_ERROR : rcode;
+	}
+	conn->prepared[stmt->id] = true;
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t sql_execute(rlm_sql_handle_t *handle, rlm_sql_config_t *config, sql_stmt_t const *stmt,
+			       char const **values, bool select)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	MYSQL_STMT		*mstmt;
+	MYSQL_BIND		*params = NULL;
+	unsigned long		*lengths;
+	sql_rcode_t		rcode;
+	unsigned int		i;
+	int			ret;
+
+	rcode = sql_prepare(handle, config, stmt);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	mstmt = conn->stmt = conn->stmts[stmt->id];
+
+	/*
+	 *	The values are copied when the statement is
+	 *	executed, so the bindings can be freed after.
+	 */
+	if (stmt->num_params > 0) {
+		MEM(params = talloc_zero_array(conn, MYSQL_BIND, stmt->num_params));
+		MEM(lengths = talloc_array(params, unsigned long, stmt->num_params));
+
+		for (i = 0; i < (unsigned int) stmt->num_params; i++) {
+			lengths[i] = strlen(values[i]);
+
+			params[i].buffer_type = MYSQL_TYPE_STRING;
+			memcpy(&params[i].buffer, &values[i], sizeof(params[i].buffer));
+			params[i].buffer_length = lengths[i];
+			params[i].length = &lengths[i];
+		}
+
+		if (mysql_stmt_bind_param(mstmt, params) != 0) {
+			talloc_free(params);
+			goto error;
+		}
+	}
+
+	ret = mysql_stmt_execute(mstmt);
+	talloc_free(params);
+	if (ret != 0) goto error;
+
+	if (!select) return RLM_SQL_OK;
+
+	/*
+	 *	Read the whole result, as mysql_store_result does
+	 *	for text queries, so the connection can be used
+	 *	for other things while the rows are processed.
+	 */
+	if (mysql_stmt_store_result(mstmt) != 0) goto error;
+
+	conn->stmt_fields = mysql_stmt_field_count(mstmt);
+	if (conn->stmt_fields == 0) return RLM_SQL_OK;
+
+	/*
+	 *	Bind zero length buffers, so each fetch tells us
+	 *	how long the columns are, and which are NULL.  They're
+	 *	then retrieved one at a time with mysql_stmt_fetch_column.
+	 */
+	MEM(conn->stmt_bind = talloc_zero_array(conn, MYSQL_BIND, conn->stmt_fields));
+	MEM(conn->stmt_lengths = talloc_zero_array(conn->stmt_bind, unsigned long, conn->stmt_fields));
+	MEM(conn->stmt_is_null = talloc_zero_array(conn->stmt_bind, my_bool, conn->stmt_fields));
+	for (i = 0; i < conn->stmt_fields; i++) {
+		conn->stmt_bind[i].buffer_type = MYSQL_TYPE_STRING;
+		conn->stmt_bind[i].length = &conn->stmt_lengths[i];
+		conn->stmt_bind[i].is_null = &conn->stmt_is_null[i];
+	}
+
+	if (mysql_stmt_bind_result(mstmt, conn->stmt_bind) != 0) goto error;
+
+	return RLM_SQL_OK;
+
+error:
+	rcode = sql_check_error(NULL, mysql_stmt_errno(mstmt));
+	return (rcode == RLM_SQL_OK) ? RLM_SQL_ERROR : rcode;
+}
+
+/** Fetch a row from the result of a prepared statement
+ *
+ * SQL NULLs are returned as NULL pointers, as they are for text queries,
+ * so callers can tell them apart from empty strings.
+ */
+static sql_rcode_t sql_stmt_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	unsigned int		i;
+	int			ret;
+
+	TALLOC_FREE(handle->row);		/* Clear previous row set */
+
+	if (conn->stmt_fields == 0) return RLM_SQL_NO_MORE_ROWS;
+
+	ret = mysql_stmt_fetch(conn->stmt);
+	if (ret == MYSQL_NO_DATA) return RLM_SQL_NO_MORE_ROWS;
+	if ((ret != 0) && (ret != MYSQL_DATA_TRUNCATED)) {
+		sql_rcode_t rcode;
+
+		rcode = sql_check_error(NULL, mysql_stmt_errno(conn->stmt));
+		return (rcode == RLM_SQL_OK) ? RLM_SQL_ERROR : rcode;
+	}
+
+	MEM(*out = handle->row = talloc_zero_array(handle, char *, conn->stmt_fields + 1));
+	for (i = 0; i < conn->stmt_fields; i++) {
+		MYSQL_BIND	column;
+		unsigned long	len = conn->stmt_lengths[i];
+
+		if (conn->stmt_is_null[i]) continue;
+
+		MEM(handle->row[i] = talloc_zero_array(handle->row, char, len + 1));
+		if (len == 0) continue;
+
+		memset(&column, 0, sizeof(column));
+		column.buffer_type = MYSQL_TYPE_STRING;
+		column.buffer = handle->row[i];
+		column.buffer_length = len + 1;
+		column.length = &len;
+
+		if (mysql_stmt_fetch_column(conn->stmt, &column, i, 0) != 0) {
+			sql_rcode_t rcode;
+
+			rcode = sql_check_error(NULL, mysql_stmt_errno(conn->stmt));
+			return (rcode == RLM_SQL_OK) ? RLM_SQL_ERROR : rcode;
+		}
+	}
+
+	return RLM_SQL_OK;
+}
+#endif
+
 static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, rlm_sql_config_t *config)
 {
 	rlm_sql_mysql_conn_t	*conn = handle->conn;
@@ -472,6 +699,10 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, r
 
 	*out = NULL;
 
+#ifdef HAVE_MYSQL_STMT
+	if (conn->stmt) return sql_stmt_fetch_row(out, handle);
+#endif
+
 	/*
 	 *  Check pointer before de-referencing it.
 	 */
@@ -507,6 +738,8 @@ retry_fetch_row:
 
 	MEM(*out = handle->row = talloc_zero_array(handle, char *, num_fields + 1));
 	for (i = 0; i < num_fields; i++) {
+		if (!row[i]) continue;	/* SQL NULL */
+
 		MEM(handle->row[i] = talloc_bstrndup(handle->row, row[i], field_lens[i]));
 	}
 
@@ -517,6 +750,21 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_conf
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+#ifdef HAVE_MYSQL_STMT
+	if (conn->stmt) {
+		(void) mysql_stmt_free_result(conn->stmt);
+		if (conn->stmt_meta) {
+			mysql_free_result(conn->stmt_meta);
+			conn->stmt_meta = NULL;
+		}
+		TALLOC_FREE(conn->stmt_bind);
+		conn->stmt_lengths = NULL;
+		conn->stmt_is_null = NULL;
+		conn->stmt_fields = 0;
+		conn->stmt = NULL;
+	}
+#endif
+
 	if (conn->result) {
 		mysql_free_result(conn->result);
 		conn->result = NULL;
@@ -627,6 +875,15 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 	if (error && (error[0] != '\0')) {
 		error = talloc_typed_asprintf(ctx, "ERROR %u (%s): %s", mysql_errno(conn->sock), error,
 					mysql_sqlstate(conn->sock));
+#ifdef HAVE_MYSQL_STMT
+	/*
+	 *	Errors from prepared statements are stored
+	 *	in the statement, not the connection.
+	 */
+	} else if (conn->stmt && (mysql_stmt_errno(conn->stmt) != 0)) {
+		error = talloc_typed_asprintf(ctx, "ERROR %u (%s): %s", mysql_stmt_errno(conn->stmt),
+					      mysql_stmt_error(conn->stmt), mysql_stmt_sqlstate(conn->stmt));
+#endif
 	}
 
 	/*
@@ -685,6 +942,11 @@ static sql_rcode_t sql_finish_query(rlm_sql_handle_t *handle, rlm_sql_config_t *
 	int			ret;
 	MYSQL_RES		*result;
 
+	/*
+	 *	Prepared statements only return a single result.
+	 */
+	if (conn->stmt) return sql_free_result(handle, config);
+
 	/*
 	 *	If there's no result associated with the
 	 *	connection handle, assume the first result in the
@@ -728,6 +990,10 @@ static int sql_affected_rows(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+#ifdef HAVE_MYSQL_STMT
+	if (conn->stmt) return mysql_stmt_affected_rows(conn->stmt);
+#endif
+
 	return mysql_affected_rows(conn->sock);
 }
 
@@ -771,5 +1037,9 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
 	.sql_finish_select_query	= sql_finish_query,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+#ifdef HAVE_MYSQL_STMT
+	.sql_prepare			= sql_prepare,
+	.sql_execute			= sql_execute,
+#endif
 };
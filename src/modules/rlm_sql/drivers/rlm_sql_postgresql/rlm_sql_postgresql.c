@@ -69,8 +69,15 @@ typedef struct rlm_sql_postgres_conn {
 	int		num_fields;
 	int		affected_rows;
 	char		**row;
+
+	bool		*prepared;		//!< Which statements have been prepared, indexed by sql_stmt_t id.
 } rlm_sql_postgres_conn_t;
 
+/*
+ *	Name of the prepared statement on the server.
+ */
+#define STMT_NAME(_buff, _stmt) snprintf(_buff, sizeof(_buff), "rlm_sql_%i", (_stmt)->id)
+
 static CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("send_application_name", FR_TYPE_BOOL, rlm_sql_postgres_t, send_application_name), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
@@ -185,6 +192,17 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 		return -1;
 	}
 
+	/*
+	 *	Only affects the asynchronous interface, PQexec
+	 *	always blocks.
+	 */
+	if (PQsetnonblocking(conn->db, 1) != 0) {
+		ERROR("Failed setting connection to non-blocking: %s", PQerrorMessage(conn->db));
+		PQfinish(conn->db);
+		conn->db = NULL;
+		return -1;
+	}
+
 	DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
 	       PQdb(conn->db), PQhost(conn->db), PQserverVersion(conn->db), PQprotocolVersion(conn->db),
 	       PQbackendPID(conn->db));
@@ -192,38 +210,15 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
-					      char const *query)
+/** Process the status of a query's result
+ *
+ * Shared by the blocking and non-blocking interfaces.
+ */
+static sql_rcode_t sql_result_status(rlm_sql_postgres_conn_t *conn)
 {
-	rlm_sql_postgres_conn_t *conn = handle->conn;
 	ExecStatusType status;
 	int numfields = 0;
 
-	if (!conn->db) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQexec(conn->db, query);
-
-	/*
-	 *  As this error COULD be a connection error OR an out-of-memory
-	 *  condition return value WILL be wrong SOME of the time
-	 *  regardless! Pick your poison...
-	 */
-	if (!conn->result) {
-		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
 	status = PQresultStatus(conn->result);
 	DEBUG("Status: %s", PQresStatus(status));
 
@@ -283,6 +278,213 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED r
 	return RLM_SQL_ERROR;
 }
 
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQexec(conn->db, query);
+
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn);
+}
+
+static int sql_socket_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) return -1;
+
+	return PQsocket(conn->db);
+}
+
+/** Send a query without waiting for the result
+ *
+ * @param handle to send the query on.
+ * @param config rlm_sql config.
+ * @param query to send, or NULL to continue sending the previous query.
+ * @return
+ *	- #RLM_SQL_OK if the query was written.
+ *	- #RLM_SQL_YIELD if we need to wait for the socket to become writable.
+ *	- #RLM_SQL_RECONNECT if the connection failed.
+ */
+static sql_rcode_t sql_query_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (query && !PQsendQuery(conn->db, query)) {
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	switch (PQflush(conn->db)) {
+	case 0:
+		return RLM_SQL_OK;
+
+	case 1:
+		return RLM_SQL_YIELD;
+
+	default:
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+}
+
+/** Read any data available on the socket, and process the result once it's complete
+ *
+ */
+static sql_rcode_t sql_query_recv(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	PGresult *result;
+
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *  Keep the last result, there's only one unless
+	 *  the query contained multiple statements.  We
+	 *  have to read until PQgetResult returns NULL
+	 *  before another query can be sent.
+	 */
+	for (;;) {
+		if (PQisBusy(conn->db)) return RLM_SQL_YIELD;
+
+		result = PQgetResult(conn->db);
+		if (!result) break;
+
+		if (conn->result) PQclear(conn->result);
+		conn->result = result;
+	}
+
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn);
+}
+
+/** Prepare a statement on the server
+ *
+ * The statement exists until the connection is closed.
+ */
+static sql_rcode_t sql_prepare(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, sql_stmt_t const *stmt)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	PGresult		*result;
+	sql_rcode_t		rcode = RLM_SQL_OK;
+	char			name[32];
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!conn->prepared) MEM(conn->prepared = talloc_zero_array(conn, bool, handle->inst->num_stmts));
+	rad_assert(stmt->id < handle->inst->num_stmts);
+
+	if (conn->prepared[stmt->id]) return RLM_SQL_OK;
+
+	STMT_NAME(name, stmt);
+	result = PQprepare(conn->db, name, stmt->text_numbered, stmt->num_params, NULL);
+	if (!result) {
+		ERROR("Failed preparing statement: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+		rcode = sql_classify_error(result);
+		if (rcode == RLM_SQL_OK) rcode = RLM_SQL_ERROR;
+	}
+	PQclear(result);
+
+	if (rcode == RLM_SQL_OK) conn->prepared[stmt->id] = true;
+
+	return rcode;
+}
+
+static sql_rcode_t sql_execute(rlm_sql_handle_t *handle, rlm_sql_config_t *config, sql_stmt_t const *stmt,
+			       char const **values, UNUSED bool select)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	sql_rcode_t		rcode;
+	char			name[32];
+
+	rcode = sql_prepare(handle, config, stmt);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	STMT_NAME(name, stmt);
+	conn->result = PQexecPrepared(conn->db, name, stmt->num_params, values, NULL, NULL, 0);
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn);
+}
+
+/** Send a prepared statement without waiting for the result
+ *
+ * If the statement couldn't be prepared when the connection was opened,
+ * it's sent with its parameters as an unnamed statement, so we don't
+ * have to wait for the server to prepare it.
+ */
+static sql_rcode_t sql_execute_send(rlm_sql_handle_t *handle, rlm_sql_config_t *config, sql_stmt_t const *stmt,
+				    char const **values)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	char			name[32];
+	int			ret;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (conn->prepared && conn->prepared[stmt->id]) {
+		STMT_NAME(name, stmt);
+		ret = PQsendQueryPrepared(conn->db, name, stmt->num_params, values, NULL, NULL, 0);
+	} else {
+		ret = PQsendQueryParams(conn->db, stmt->text_numbered, stmt->num_params, NULL, values, NULL, NULL, 0);
+	}
+	if (!ret) {
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_query_send(handle, config, NULL);
+}
+
 static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t *config, char const *query)
 {
 	return sql_query(handle, config, query);
@@ -542,5 +744,11 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.sql_socket_fd			= sql_socket_fd,
+	.sql_query_send			= sql_query_send,
+	.sql_query_recv			= sql_query_recv,
+	.sql_prepare			= sql_prepare,
+	.sql_execute			= sql_execute,
+	.sql_execute_send		= sql_execute_send
 };
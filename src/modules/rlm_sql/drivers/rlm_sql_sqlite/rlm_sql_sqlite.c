@@ -53,6 +53,10 @@ typedef struct rlm_sql_sqlite_conn {
 	sqlite3 *db;
 	sqlite3_stmt *statement;
 	int col_count;
+
+	sqlite3_stmt **stmts;		//!< Prepared statements, indexed by sql_stmt_t id.
+	int num_stmts;			//!< Number of elements in stmts.
+	bool prepared;			//!< statement is one of stmts, so must be reset, not finalized.
 } rlm_sql_sqlite_conn_t;
 
 typedef struct rlm_sql_sqlite {
@@ -384,6 +388,14 @@ static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 
 	DEBUG2("Socket destructor called, closing socket");
 
+	if (conn->stmts) {
+		int i;
+
+		for (i = 0; i < conn->num_stmts; i++) {
+			if (conn->stmts[i]) (void) sqlite3_finalize(conn->stmts[i]);
+		}
+	}
+
 	if (conn->db) {
 		status = sqlite3_close(conn->db);
 		if (status != SQLITE_OK) WARN("Got SQLite error when closing socket: %s",
@@ -500,6 +512,58 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return sql_check_error(conn->db, status);
 }
 
+static sql_rcode_t sql_prepare(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, sql_stmt_t const *stmt)
+{
+	rlm_sql_sqlite_conn_t	*conn = handle->conn;
+	int			status;
+
+	if (!conn->stmts) {
+		conn->num_stmts = handle->inst->num_stmts;
+		MEM(conn->stmts = talloc_zero_array(conn, sqlite3_stmt *, conn->num_stmts));
+	}
+	rad_assert(stmt->id < conn->num_stmts);
+
+	if (conn->stmts[stmt->id]) return RLM_SQL_OK;
+
+#ifdef HAVE_SQLITE3_PREPARE_V2
+	status = sqlite3_prepare_v2(conn->db, stmt->text, -1, &conn->stmts[stmt->id], NULL);
+#else
+	status = sqlite3_prepare(conn->db, stmt->text, -1, &conn->stmts[stmt->id], NULL);
+#endif
+
+	return sql_check_error(conn->db, status);
+}
+
+static sql_rcode_t sql_execute(rlm_sql_handle_t *handle, rlm_sql_config_t *config, sql_stmt_t const *stmt,
+			       char const **values, bool select)
+{
+	rlm_sql_sqlite_conn_t	*conn = handle->conn;
+	sql_rcode_t		rcode;
+	int			status, i;
+
+	rcode = sql_prepare(handle, config, stmt);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	conn->statement = conn->stmts[stmt->id];
+	conn->prepared = true;
+	conn->col_count = 0;
+
+	/*
+	 *	The values remain valid until the query is
+	 *	finished, when the statement is reset.
+	 */
+	for (i = 0; i < stmt->num_params; i++) {
+		status = sqlite3_bind_text(conn->statement, i + 1, values[i], -1, SQLITE_STATIC);
+		rcode = sql_check_error(conn->db, status);
+		if (rcode != RLM_SQL_OK) return rcode;
+	}
+
+	if (select) return RLM_SQL_OK;
+
+	status = sqlite3_step(conn->statement);
+	return sql_check_error(conn->db, status);
+}
+
 static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_sqlite_conn_t *conn = handle->conn;
@@ -620,7 +684,17 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_conf
 	if (conn->statement) {
 		TALLOC_FREE(handle->row);
 
-		(void) sqlite3_finalize(conn->statement);
+		/*
+		 *	Prepared statements are kept for
+		 *	the lifetime of the connection.
+		 */
+		if (conn->prepared) {
+			(void) sqlite3_reset(conn->statement);
+			(void) sqlite3_clear_bindings(conn->statement);
+			conn->prepared = false;
+		} else {
+			(void) sqlite3_finalize(conn->statement);
+		}
 		conn->statement = NULL;
 		conn->col_count = 0;
 	}
@@ -819,5 +893,7 @@ rlm_sql_driver_t rlm_sql_sqlite = {
 	.sql_free_result		= sql_free_result,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
-	.sql_finish_select_query	= sql_finish_query
+	.sql_finish_select_query	= sql_finish_query,
+	.sql_prepare			= sql_prepare,
+	.sql_execute			= sql_execute
 };
@@ -37,6 +37,7 @@ RCSID("$Id$")
 #include <freeradius-devel/token.h>
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/exfile.h>
+#include <freeradius-devel/io/time.h>
 
 #include <sys/stat.h>
 
@@ -68,6 +69,8 @@ static const CONF_PARSER type_config[] = {
 static const CONF_PARSER acct_config[] = {
 	{ FR_CONF_OFFSET("reference", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.reference), .dflt = ".query" },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.logfile) },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, rlm_sql_config_t, accounting.batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_delay", FR_TYPE_TIMEVAL, rlm_sql_config_t, accounting.batch_delay), .dflt = "0.1" },
 
 	{ FR_CONF_POINTER("type", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) type_config },
 	CONF_PARSER_TERMINATOR
@@ -76,6 +79,8 @@ static const CONF_PARSER acct_config[] = {
 static const CONF_PARSER postauth_config[] = {
 	{ FR_CONF_OFFSET("reference", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, postauth.reference), .dflt = ".query" },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, postauth.logfile) },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, rlm_sql_config_t, postauth.batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_delay", FR_TYPE_TIMEVAL, rlm_sql_config_t, postauth.batch_delay), .dflt = "0.1" },
 
 	{ FR_CONF_OFFSET("query", FR_TYPE_STRING | FR_TYPE_XLAT | FR_TYPE_MULTI, rlm_sql_config_t, postauth.query) },
 	CONF_PARSER_TERMINATOR
@@ -97,6 +102,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("default_user_profile", FR_TYPE_STRING, rlm_sql_config_t, default_profile), .dflt = "" },
 	{ FR_CONF_OFFSET("client_query", FR_TYPE_STRING, rlm_sql_config_t, client_query), .dflt = "SELECT id,nasname,shortname,type,secret FROM nas" },
 	{ FR_CONF_OFFSET("open_query", FR_TYPE_STRING, rlm_sql_config_t, connect_query) },
+	{ FR_CONF_OFFSET("prepared_statements", FR_TYPE_BOOL, rlm_sql_config_t, prepare), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("authorize_check_query", FR_TYPE_STRING | FR_TYPE_XLAT | FR_TYPE_NOT_EMPTY, rlm_sql_config_t, authorize_check_query) },
 	{ FR_CONF_OFFSET("authorize_reply_query", FR_TYPE_STRING | FR_TYPE_XLAT | FR_TYPE_NOT_EMPTY, rlm_sql_config_t, authorize_reply_query) },
@@ -724,15 +730,10 @@ int sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username)
 	return 0;
 }
 
-/*
- *	Do a set/unset user, so it's a bit clearer what's going on.
- */
-#define sql_unset_user(_i, _r) fr_pair_delete_by_num(&_r->packet->vps, _i->sql_user->vendor, _i->sql_user->attr, TAG_ANY)
-
 static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, REQUEST *request,
 			     rlm_sql_grouplist_t **phead)
 {
-	char    *expanded = NULL;
+	sql_query_t	*query;
 	int     num_groups = 0;
 	rlm_sql_row_t row;
 	rlm_sql_grouplist_t *entry;
@@ -743,11 +744,11 @@ static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, R
 	entry = *phead = NULL;
 
 	if (!inst->config->groupmemb_query || !*inst->config->groupmemb_query) return 0;
-	if (xlat_aeval(request, &expanded, request, inst->config->groupmemb_query,
-			 inst->sql_escape_func, *handle) < 0) return -1;
+	query = sql_query_alloc(request, inst, request, *handle, NULL, inst->config->groupmemb_query);
+	if (!query) return -1;
 
-	ret = rlm_sql_select_query(inst, request, handle, expanded);
-	talloc_free(expanded);
+	ret = rlm_sql_execute(inst, request, handle, query, true);
+	talloc_free(query);
 	if (ret != RLM_SQL_OK) return -1;
 
 	while (rlm_sql_fetch_row(&row, inst, request, handle) == RLM_SQL_OK) {
@@ -859,7 +860,7 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 	VALUE_PAIR		*check_tmp = NULL, *reply_tmp = NULL, *sql_group = NULL;
 	rlm_sql_grouplist_t	*head = NULL, *entry = NULL;
 
-	char			*expanded = NULL;
+	sql_query_t		*query;
 	int			rows;
 
 	rad_assert(request->packet != NULL);
@@ -918,15 +919,19 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 			/*
 			 *	Expand the group query
 			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_check_query,
-					 inst->sql_escape_func, *handle) < 0) {
+			query = sql_query_alloc(request, inst, request, *handle, NULL,
+						inst->config->authorize_group_check_query);
+			if (!query) {
 				REDEBUG("Error generating query");
 				rcode = RLM_MODULE_FAIL;
 				goto finish;
 			}
 
-			rows = sql_getvpdata(request, inst, request, handle, &check_tmp, expanded);
-			TALLOC_FREE(expanded);
+			rows = -1;
+			if (rlm_sql_execute(inst, request, handle, query, true) == RLM_SQL_OK) {
+				rows = sql_getvpdata_result(request, inst, request, handle, &check_tmp);
+			}
+			talloc_free(query);
 			if (rows < 0) {
 				REDEBUG("Error retrieving check pairs for group %s", entry->name);
 				rcode = RLM_MODULE_FAIL;
@@ -970,15 +975,19 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 			/*
 			 *	Now get the reply pairs since the paircompare matched
 			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_reply_query,
-					 inst->sql_escape_func, *handle) < 0) {
+			query = sql_query_alloc(request, inst, request, *handle, NULL,
+						inst->config->authorize_group_reply_query);
+			if (!query) {
 				REDEBUG("Error generating query");
 				rcode = RLM_MODULE_FAIL;
 				goto finish;
 			}
 
-			rows = sql_getvpdata(request->reply, inst, request, handle, &reply_tmp, expanded);
-			TALLOC_FREE(expanded);
+			rows = -1;
+			if (rlm_sql_execute(inst, request, handle, query, true) == RLM_SQL_OK) {
+				rows = sql_getvpdata_result(request->reply, inst, request, handle, &reply_tmp);
+			}
+			talloc_free(query);
 			if (rows < 0) {
 				REDEBUG("Error retrieving reply pairs for group %s", entry->name);
 				rcode = RLM_MODULE_FAIL;
@@ -1020,6 +1029,35 @@ finish:
 }
 
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_sql_t		*inst = instance;
+	rlm_sql_thread_t	*t = thread;
+
+	t->el = el;
+
+	if (inst->config->accounting.batch_size) {
+		t->accounting_batch = sql_batch_alloc(inst, t, &inst->config->accounting);
+	}
+
+	if (inst->config->postauth.batch_size) {
+		t->postauth_batch = sql_batch_alloc(inst, t, &inst->config->postauth);
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_sql_thread_t	*t = thread;
+
+	TALLOC_FREE(t->accounting_batch);
+	TALLOC_FREE(t->postauth_batch);
+
+	return 0;
+}
+
 static int mod_detach(void *instance)
 {
 	rlm_sql_t	*inst = talloc_get_type_abort(instance, rlm_sql_t);
@@ -1150,6 +1188,32 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 }
 
 
+/** Compile the queries in an accounting or post-auth section
+ *
+ */
+static void sql_stmt_register_section(rlm_sql_t *inst, CONF_SECTION *cs)
+{
+	CONF_ITEM *ci;
+
+	if (!cs) return;
+
+	for (ci = cf_item_next(cs, NULL); ci; ci = cf_item_next(cs, ci)) {
+		CONF_PAIR *cp;
+
+		if (cf_item_is_section(ci)) {
+			sql_stmt_register_section(inst, cf_item_to_section(ci));
+			continue;
+		}
+
+		if (!cf_item_is_pair(ci)) continue;
+
+		cp = cf_item_to_pair(ci);
+		if (strcmp(cf_pair_attr(cp), "query") != 0) continue;
+
+		sql_stmt_register(inst, cf_pair_value(cp));
+	}
+}
+
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	rlm_sql_t *inst = instance;
@@ -1228,6 +1292,26 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	/*
+	 *	Statements are prepared as each connection is
+	 *	opened, so they must be compiled first.
+	 */
+	if (inst->config->prepare) {
+		if (!inst->driver->sql_prepare || !inst->driver->sql_execute) {
+			WARN("Ignoring prepared_statements, %s does not support them", inst->config->sql_driver_name);
+		} else {
+			sql_stmt_register(inst, inst->config->authorize_check_query);
+			sql_stmt_register(inst, inst->config->authorize_reply_query);
+			sql_stmt_register(inst, inst->config->authorize_group_check_query);
+			sql_stmt_register(inst, inst->config->authorize_group_reply_query);
+			sql_stmt_register(inst, inst->config->groupmemb_query);
+			sql_stmt_register_section(inst, inst->config->accounting.cs);
+			sql_stmt_register_section(inst, inst->config->postauth.cs);
+
+			DEBUG("Compiled %i queries into prepared statements", inst->num_stmts);
+		}
+	}
+
 	/*
 	 *	Initialise the connection pool for this instance
 	 */
@@ -1246,182 +1330,111 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return RLM_MODULE_OK;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
-{
-	rlm_rcode_t rcode = RLM_MODULE_NOOP;
-
-	rlm_sql_t const *inst = instance;
-	rlm_sql_handle_t  *handle;
-
-	VALUE_PAIR *check_tmp = NULL;
-	VALUE_PAIR *reply_tmp = NULL;
-	VALUE_PAIR *user_profile = NULL;
-
-	bool	user_found = false;
-
-	sql_fall_through_t do_fall_through = FALL_THROUGH_DEFAULT;
-
-	int	rows;
+/** State of an authorize call
+ *
+ */
+typedef struct sql_authorize_rctx {
+	rlm_sql_handle_t	*handle;		//!< Connection the queries are run on.
+	rlm_rcode_t		rcode;			//!< To return.
 
-	char	*expanded = NULL;
+	VALUE_PAIR		*check_tmp;		//!< Check items from the database.
+	VALUE_PAIR		*reply_tmp;		//!< Reply items from the database.
 
-	rad_assert(request->packet != NULL);
-	rad_assert(request->reply != NULL);
-
-	if (!inst->config->authorize_check_query && !inst->config->authorize_reply_query &&
-	    !inst->config->read_groups && !inst->config->read_profiles) {
-		RWDEBUG("No authorization checks configured, returning noop");
+	bool			user_found;		//!< Whether any of the queries found the user.
+	sql_fall_through_t	do_fall_through;	//!< Whether to process groups and profiles.
 
-		return RLM_MODULE_NOOP;
-	}
+	sql_query_t		*query;			//!< Query being run, after expansion.
+	sql_rcode_t		sql_ret;		//!< Result of the query.
+} sql_authorize_rctx_t;
 
-	/*
-	 *	Set, escape, and check the user attr here
-	 */
-	if (sql_set_user(inst, request, NULL) < 0) {
-		return RLM_MODULE_FAIL;
-	}
+/*
+ *	At this point the key (user) hasn't be found in the check table, the reply table
+ *	or the group mapping table, and there was no matching profile.
+ */
+static rlm_rcode_t mod_authorize_release(rlm_sql_t const *inst, REQUEST *request, sql_authorize_rctx_t *rctx)
+{
+	rlm_rcode_t rcode = rctx->rcode;
 
-	/*
-	 *	Reserve a socket
-	 *
-	 *	After this point use goto error or goto release to cleanup socket temporary pairlists and
-	 *	temporary attributes.
-	 */
-	handle = fr_pool_connection_get(inst->pool, request);
-	if (!handle) {
-		rcode = RLM_MODULE_FAIL;
-		goto error;
+	if (!rctx->user_found) {
+		rcode = RLM_MODULE_NOTFOUND;
 	}
 
-	/*
-	 *	Query the check table to find any conditions associated with this user/realm/whatever...
-	 */
-	if (inst->config->authorize_check_query) {
-		fr_cursor_t	cursor;
-		VALUE_PAIR	*vp;
-
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_check_query,
-				 inst->sql_escape_func, handle) < 0) {
-			REDEBUG("Failed generating query");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
-
-		rows = sql_getvpdata(request, inst, request, &handle, &check_tmp, expanded);
-		TALLOC_FREE(expanded);
-		if (rows < 0) {
-			REDEBUG("Failed getting check attributes");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
-
-		if (rows == 0) goto skipreply;	/* Don't need to free VPs we don't have */
-
-		/*
-		 *	Only do this if *some* check pairs were returned
-		 */
-		RDEBUG2("User found in radcheck table");
-		user_found = true;
-		if (paircompare(request, request->packet->vps, check_tmp, &request->reply->vps) != 0) {
-			fr_pair_list_free(&check_tmp);
-			check_tmp = NULL;
-			goto skipreply;
-		}
-
-		RDEBUG2("Conditional check items matched, merging assignment check items");
-		RINDENT();
-		for (vp = fr_cursor_init(&cursor, &check_tmp);
-		     vp;
-		     vp = fr_cursor_next(&cursor)) {
-			if (!fr_assignment_op[vp->op]) continue;
-
-			rdebug_pair(2, request, vp, NULL);
-		}
-		REXDENT();
-		radius_pairmove(request, &request->control, check_tmp, true);
-
-		rcode = RLM_MODULE_OK;
-		check_tmp = NULL;
-	}
+	fr_pool_connection_release(inst->pool, request, rctx->handle);
+	sql_unset_user(inst, request);
+	talloc_free(rctx);
 
-	if (inst->config->authorize_reply_query) {
-		/*
-		 *	Now get the reply pairs since the paircompare matched
-		 */
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_reply_query,
-				 inst->sql_escape_func, handle) < 0) {
-			REDEBUG("Error generating query");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
+	return rcode;
+}
 
-		rows = sql_getvpdata(request->reply, inst, request, &handle, &reply_tmp, expanded);
-		TALLOC_FREE(expanded);
-		if (rows < 0) {
-			REDEBUG("SQL query error getting reply attributes");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
+static rlm_rcode_t mod_authorize_error(rlm_sql_t const *inst, REQUEST *request, sql_authorize_rctx_t *rctx)
+{
+	rlm_rcode_t rcode = rctx->rcode;
 
-		if (rows == 0) goto skipreply;
+	fr_pair_list_free(&rctx->check_tmp);
+	fr_pair_list_free(&rctx->reply_tmp);
+	sql_unset_user(inst, request);
 
-		do_fall_through = fall_through(reply_tmp);
+	fr_pool_connection_release(inst->pool, request, rctx->handle);
+	talloc_free(rctx);
 
-		RDEBUG2("User found in radreply table, merging reply items");
-		user_found = true;
+	return rcode;
+}
 
-		rdebug_pair_list(L_DBG_LVL_2, request, reply_tmp, NULL);
+static void mod_authorize_signal(REQUEST *request, void *instance, UNUSED void *thread, void *ctx,
+				 fr_state_action_t action)
+{
+	rlm_sql_t const		*inst = instance;
+	sql_authorize_rctx_t	*rctx = talloc_get_type_abort(ctx, sql_authorize_rctx_t);
 
-		radius_pairmove(request, &request->reply->vps, reply_tmp, true);
+	if (action != FR_ACTION_DONE) return;
 
-		rcode = RLM_MODULE_OK;
-		reply_tmp = NULL;
-	}
+	rctx->rcode = RLM_MODULE_FAIL;
+	(void) mod_authorize_error(inst, request, rctx);
+}
 
-	/*
-	 *	Neither group checks or profiles will work without
-	 *	a group membership query.
-	 */
-	if (!inst->config->groupmemb_query) goto release;
+/** Process groups and profiles
+ *
+ * @note Group and profile queries are still run synchronously.
+ */
+static rlm_rcode_t mod_authorize_groups(rlm_sql_t const *inst, REQUEST *request, sql_authorize_rctx_t *rctx)
+{
+	VALUE_PAIR	*user_profile = NULL;
 
-skipreply:
-	if ((do_fall_through == FALL_THROUGH_YES) ||
-	    (inst->config->read_groups && (do_fall_through == FALL_THROUGH_DEFAULT))) {
+	if ((rctx->do_fall_through == FALL_THROUGH_YES) ||
+	    (inst->config->read_groups && (rctx->do_fall_through == FALL_THROUGH_DEFAULT))) {
 		rlm_rcode_t ret;
 
 		RDEBUG3("... falling-through to group processing");
-		ret = rlm_sql_process_groups(inst, request, &handle, &do_fall_through);
+		ret = rlm_sql_process_groups(inst, request, &rctx->handle, &rctx->do_fall_through);
 		switch (ret) {
 		/*
 		 *	Nothing bad happened, continue...
 		 */
 		case RLM_MODULE_UPDATED:
-			rcode = RLM_MODULE_UPDATED;
+			rctx->rcode = RLM_MODULE_UPDATED;
 			/* FALL-THROUGH */
 		case RLM_MODULE_OK:
-			if (rcode != RLM_MODULE_UPDATED) rcode = RLM_MODULE_OK;
+			if (rctx->rcode != RLM_MODULE_UPDATED) rctx->rcode = RLM_MODULE_OK;
 
 			/* FALL-THROUGH */
 		case RLM_MODULE_NOOP:
-			user_found = true;
+			rctx->user_found = true;
 			break;
 
 		case RLM_MODULE_NOTFOUND:
 			break;
 
 		default:
-			rcode = ret;
-			goto release;
+			rctx->rcode = ret;
+			return mod_authorize_release(inst, request, rctx);
 		}
 	}
 
 	/*
 	 *	Repeat the above process with the default profile or User-Profile
 	 */
-	if ((do_fall_through == FALL_THROUGH_YES) ||
-	    (inst->config->read_profiles && (do_fall_through == FALL_THROUGH_DEFAULT))) {
+	if ((rctx->do_fall_through == FALL_THROUGH_YES) ||
+	    (inst->config->read_profiles && (rctx->do_fall_through == FALL_THROUGH_DEFAULT))) {
 		rlm_rcode_t ret;
 
 		/*
@@ -1435,64 +1448,360 @@ skipreply:
 				      inst->config->default_profile;
 
 		if (!profile || !*profile) {
-			goto release;
+			return mod_authorize_release(inst, request, rctx);
 		}
 
 		RDEBUG2("Checking profile %s", profile);
 
 		if (sql_set_user(inst, request, profile) < 0) {
 			REDEBUG("Error setting profile");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
+			rctx->rcode = RLM_MODULE_FAIL;
+			return mod_authorize_error(inst, request, rctx);
 		}
 
-		ret = rlm_sql_process_groups(inst, request, &handle, &do_fall_through);
+		ret = rlm_sql_process_groups(inst, request, &rctx->handle, &rctx->do_fall_through);
 		switch (ret) {
 		/*
 		 *	Nothing bad happened, continue...
 		 */
 		case RLM_MODULE_UPDATED:
-			rcode = RLM_MODULE_UPDATED;
+			rctx->rcode = RLM_MODULE_UPDATED;
 			/* FALL-THROUGH */
 		case RLM_MODULE_OK:
-			if (rcode != RLM_MODULE_UPDATED) rcode = RLM_MODULE_OK;
+			if (rctx->rcode != RLM_MODULE_UPDATED) rctx->rcode = RLM_MODULE_OK;
 
 			/* FALL-THROUGH */
 		case RLM_MODULE_NOOP:
-			user_found = true;
+			rctx->user_found = true;
 			break;
 
 		case RLM_MODULE_NOTFOUND:
 			break;
 
 		default:
-			rcode = ret;
-			goto release;
+			rctx->rcode = ret;
+			return mod_authorize_release(inst, request, rctx);
 		}
 	}
 
+	return mod_authorize_release(inst, request, rctx);
+}
+
+static rlm_rcode_t mod_authorize_reply_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_sql_t const		*inst = instance;
+	sql_authorize_rctx_t	*rctx = talloc_get_type_abort(ctx, sql_authorize_rctx_t);
+	int			rows = -1;
+
+	TALLOC_FREE(rctx->query);
+
+	/* errors handled by rlm_sql_select_query */
+	if (rctx->sql_ret == RLM_SQL_OK) {
+		rows = sql_getvpdata_result(request->reply, inst, request, &rctx->handle, &rctx->reply_tmp);
+	}
+	if (rows < 0) {
+		REDEBUG("SQL query error getting reply attributes");
+		rctx->rcode = RLM_MODULE_FAIL;
+		return mod_authorize_error(inst, request, rctx);
+	}
+
+	if (rows == 0) return mod_authorize_groups(inst, request, rctx);
+
+	rctx->do_fall_through = fall_through(rctx->reply_tmp);
+
+	RDEBUG2("User found in radreply table, merging reply items");
+	rctx->user_found = true;
+
+	rdebug_pair_list(L_DBG_LVL_2, request, rctx->reply_tmp, NULL);
+
+	radius_pairmove(request, &request->reply->vps, rctx->reply_tmp, true);
+
+	rctx->rcode = RLM_MODULE_OK;
+	rctx->reply_tmp = NULL;
+
 	/*
-	 *	At this point the key (user) hasn't be found in the check table, the reply table
-	 *	or the group mapping table, and there was no matching profile.
+	 *	Neither group checks or profiles will work without
+	 *	a group membership query.
 	 */
-release:
-	if (!user_found) {
-		rcode = RLM_MODULE_NOTFOUND;
+	if (!inst->config->groupmemb_query) return mod_authorize_release(inst, request, rctx);
+
+	return mod_authorize_groups(inst, request, rctx);
+}
+
+static rlm_rcode_t mod_authorize_reply(rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+				       sql_authorize_rctx_t *rctx)
+{
+	if (!inst->config->authorize_reply_query) {
+		/*
+		 *	Neither group checks or profiles will work without
+		 *	a group membership query.
+		 */
+		if (!inst->config->groupmemb_query) return mod_authorize_release(inst, request, rctx);
+
+		return mod_authorize_groups(inst, request, rctx);
 	}
 
-	fr_pool_connection_release(inst->pool, request, handle);
+	/*
+	 *	Now get the reply pairs since the paircompare matched
+	 */
+	rctx->query = sql_query_alloc(rctx, inst, request, rctx->handle, NULL, inst->config->authorize_reply_query);
+	if (!rctx->query) {
+		REDEBUG("Error generating query");
+		rctx->rcode = RLM_MODULE_FAIL;
+		return mod_authorize_error(inst, request, rctx);
+	}
+
+	return rlm_sql_query_yield(inst, thread, request, &rctx->handle, rctx->query, true, &rctx->sql_ret,
+				   mod_authorize_reply_resume, mod_authorize_signal, rctx);
+}
+
+static rlm_rcode_t mod_authorize_check_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_sql_t		*inst = instance;
+	sql_authorize_rctx_t	*rctx = talloc_get_type_abort(ctx, sql_authorize_rctx_t);
+	fr_cursor_t		cursor;
+	VALUE_PAIR		*vp;
+	int			rows = -1;
+
+	TALLOC_FREE(rctx->query);
+
+	/* errors handled by rlm_sql_select_query */
+	if (rctx->sql_ret == RLM_SQL_OK) {
+		rows = sql_getvpdata_result(request, inst, request, &rctx->handle, &rctx->check_tmp);
+	}
+	if (rows < 0) {
+		REDEBUG("Failed getting check attributes");
+		rctx->rcode = RLM_MODULE_FAIL;
+		return mod_authorize_error(inst, request, rctx);
+	}
+
+	if (rows == 0) return mod_authorize_groups(inst, request, rctx);	/* Don't need to free VPs we don't have */
+
+	/*
+	 *	Only do this if *some* check pairs were returned
+	 */
+	RDEBUG2("User found in radcheck table");
+	rctx->user_found = true;
+	if (paircompare(request, request->packet->vps, rctx->check_tmp, &request->reply->vps) != 0) {
+		fr_pair_list_free(&rctx->check_tmp);
+		rctx->check_tmp = NULL;
+		return mod_authorize_groups(inst, request, rctx);
+	}
+
+	RDEBUG2("Conditional check items matched, merging assignment check items");
+	RINDENT();
+	for (vp = fr_cursor_init(&cursor, &rctx->check_tmp);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (!fr_assignment_op[vp->op]) continue;
+
+		rdebug_pair(2, request, vp, NULL);
+	}
+	REXDENT();
+	radius_pairmove(request, &request->control, rctx->check_tmp, true);
+
+	rctx->rcode = RLM_MODULE_OK;
+	rctx->check_tmp = NULL;
+
+	return mod_authorize_reply(inst, thread, request, rctx);
+}
+
+/*
+ *	The check and reply queries are run asynchronously if the
+ *	driver supports it.
+ */
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_sql_t		*inst = instance;
+	rlm_sql_handle_t	*handle;
+	sql_authorize_rctx_t	*rctx;
+
+	rad_assert(request->packet != NULL);
+	rad_assert(request->reply != NULL);
+
+	if (!inst->config->authorize_check_query && !inst->config->authorize_reply_query &&
+	    !inst->config->read_groups && !inst->config->read_profiles) {
+		RWDEBUG("No authorization checks configured, returning noop");
+
+		return RLM_MODULE_NOOP;
+	}
+
+	/*
+	 *	Set, escape, and check the user attr here
+	 */
+	if (sql_set_user(inst, request, NULL) < 0) {
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Reserve a socket
+	 *
+	 *	After this point use mod_authorize_error or mod_authorize_release to cleanup
+	 *	the socket, temporary pairlists and temporary attributes.
+	 */
+	handle = fr_pool_connection_get(inst->pool, request);
+	if (!handle) {
+		sql_unset_user(inst, request);
+		return RLM_MODULE_FAIL;
+	}
+
+	MEM(rctx = talloc_zero(request, sql_authorize_rctx_t));
+	rctx->handle = handle;
+	rctx->rcode = RLM_MODULE_NOOP;
+	rctx->do_fall_through = FALL_THROUGH_DEFAULT;
+
+	/*
+	 *	Query the check table to find any conditions associated with this user/realm/whatever...
+	 */
+	if (!inst->config->authorize_check_query) return mod_authorize_reply(inst, thread, request, rctx);
+
+	rctx->query = sql_query_alloc(rctx, inst, request, rctx->handle, NULL, inst->config->authorize_check_query);
+	if (!rctx->query) {
+		REDEBUG("Failed generating query");
+		rctx->rcode = RLM_MODULE_FAIL;
+		return mod_authorize_error(inst, request, rctx);
+	}
+
+	return rlm_sql_query_yield(inst, thread, request, &rctx->handle, rctx->query, true, &rctx->sql_ret,
+				   mod_authorize_check_resume, mod_authorize_signal, rctx);
+}
+
+/** State of an accounting or post-auth query set
+ *
+ */
+typedef struct sql_acct_rctx {
+	sql_acct_section_t	*section;	//!< Section the queries come from.
+	rlm_sql_handle_t	*handle;	//!< Connection the queries are run on.
+	CONF_PAIR		*pair;		//!< Query being run.
+	char const		*attr;		//!< Name of the query set.
+	sql_query_t		*query;		//!< Query being run, after expansion.
+	sql_rcode_t		sql_ret;	//!< Result of the query.
+} sql_acct_rctx_t;
+
+static rlm_rcode_t acct_redundant_resume(REQUEST *request, void *instance, void *thread, void *ctx);
+
+/** Release the connection, and return the final rcode
+ *
+ */
+static rlm_rcode_t acct_redundant_finish(rlm_sql_t const *inst, REQUEST *request, sql_acct_rctx_t *rctx,
+					 rlm_rcode_t rcode)
+{
+	fr_pool_connection_release(inst->pool, request, rctx->handle);
 	sql_unset_user(inst, request);
+	talloc_free(rctx);
 
 	return rcode;
+}
 
-error:
-	fr_pair_list_free(&check_tmp);
-	fr_pair_list_free(&reply_tmp);
-	sql_unset_user(inst, request);
+static void acct_redundant_signal(REQUEST *request, void *instance, UNUSED void *thread, void *ctx,
+				  fr_state_action_t action)
+{
+	rlm_sql_t const		*inst = instance;
+	sql_acct_rctx_t		*rctx = talloc_get_type_abort(ctx, sql_acct_rctx_t);
 
-	fr_pool_connection_release(inst->pool, request, handle);
+	if (action != FR_ACTION_DONE) return;
 
-	return rcode;
+	(void) acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
+}
+
+/** Expand and run the current query in the set
+ *
+ */
+static rlm_rcode_t acct_redundant_query(rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+					sql_acct_rctx_t *rctx)
+{
+	char const *value;
+
+	value = cf_pair_value(rctx->pair);
+	if (!value) {
+		RDEBUG("Ignoring null query");
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_NOOP);
+	}
+
+	rctx->query = sql_query_alloc(rctx, inst, request, rctx->handle, rctx->section, value);
+	if (!rctx->query) return acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
+
+	if (!*rctx->query->text) {
+		RDEBUG("Ignoring null query");
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_NOOP);
+	}
+
+	if (!rctx->query->stmt) rlm_sql_query_log(inst, request, rctx->section, rctx->query->text);
+
+	return rlm_sql_query_yield(inst, thread, request, &rctx->handle, rctx->query, false, &rctx->sql_ret,
+				   acct_redundant_resume, acct_redundant_signal, rctx);
+}
+
+static rlm_rcode_t acct_redundant_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_sql_t		*inst = instance;
+	sql_acct_rctx_t		*rctx = talloc_get_type_abort(ctx, sql_acct_rctx_t);
+	int			numaffected = 0;
+
+	TALLOC_FREE(rctx->query);
+	RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, rctx->sql_ret, "<INVALID>"));
+
+	switch (rctx->sql_ret) {
+	/*
+	 *  Query was a success! Now we just need to check if it did anything.
+	 */
+	case RLM_SQL_OK:
+		break;
+
+	/*
+	 *  A general, unrecoverable server fault.
+	 */
+	case RLM_SQL_ERROR:
+	/*
+	 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
+	 *  were exhausted, and we couldn't create a new connection,
+	 *  so we do not need to call fr_pool_connection_release.
+	 */
+	case RLM_SQL_RECONNECT:
+	default:
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
+
+	/*
+	 *  Query was invalid, this is a terminal error, but we still need
+	 *  to do cleanup, as the connection handle is still valid.
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_INVALID);
+
+	/*
+	 *  Driver found an error (like a unique key constraint violation)
+	 *  that hinted it might be a good idea to try an alternative query.
+	 */
+	case RLM_SQL_ALT_QUERY:
+		goto next;
+	}
+	rad_assert(rctx->handle);
+
+	/*
+	 *  We need to have updated something for the query to have been
+	 *  counted as successful.
+	 */
+	numaffected = (inst->driver->sql_affected_rows)(rctx->handle, inst->config);
+	(inst->driver->sql_finish_query)(rctx->handle, inst->config);
+	RDEBUG("%i record(s) updated", numaffected);
+
+	if (numaffected > 0) return acct_redundant_finish(inst, request, rctx, RLM_MODULE_OK);	/* A query succeeded, were done! */
+
+next:
+	/*
+	 *  We assume all entries with the same name form a redundant
+	 *  set of queries.
+	 */
+	rctx->pair = cf_pair_find_next(rctx->section->cs, rctx->pair, rctx->attr);
+	if (!rctx->pair) {
+		RDEBUG("No additional queries configured");
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_NOOP);
+	}
+
+	RDEBUG("Trying next query...");
+
+	return acct_redundant_query(inst, thread, request, rctx);
 }
 
 /*
@@ -1504,23 +1813,20 @@ error:
  *	If the reference matches multiple config items, and a query fails or
  *	doesn't update any rows, the next matching config item is used.
  *
+ *	Queries are run asynchronously if the driver supports it, or
+ *	written in batches if batch_size is set.
  */
-static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+static rlm_rcode_t acct_redundant(rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+				  sql_acct_section_t *section)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
+	sql_acct_rctx_t		*rctx;
+	rlm_sql_handle_t	*handle;
 
 	CONF_ITEM		*item;
 	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
 
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	rad_assert(section);
 
@@ -1529,9 +1835,8 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	}
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		sql_unset_user(inst, request);
+		return RLM_MODULE_FAIL;
 	}
 
 	/*
@@ -1541,130 +1846,41 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		sql_unset_user(inst, request);
+		return RLM_MODULE_NOOP;
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		sql_unset_user(inst, request);
+		return RLM_MODULE_NOOP;
 	}
 
 	pair = cf_item_to_pair(item);
-	attr = cf_pair_attr(pair);
 
-	RDEBUG2("Using query template '%s'", attr);
+	RDEBUG2("Using query template '%s'", cf_pair_attr(pair));
 
-	handle = fr_pool_connection_get(inst->pool, request);
-	if (!handle) {
-		rcode = RLM_MODULE_FAIL;
+	if (section->batch_size) {
+		sql_batch_t *batch = (section == &inst->config->accounting) ?
+				     thread->accounting_batch : thread->postauth_batch;
 
-		goto finish;
+		return sql_batch_add(batch, request, pair);
 	}
 
-	sql_set_user(inst, request, NULL);
-
-	while (true) {
-		value = cf_pair_value(pair);
-		if (!value) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
-
-			goto finish;
-		}
-
-		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
-			rcode = RLM_MODULE_FAIL;
-
-			goto finish;
-		}
-
-		if (!*expanded) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
-			talloc_free(expanded);
-
-			goto finish;
-		}
-
-		rlm_sql_query_log(inst, request, section, expanded);
-
-		sql_ret = rlm_sql_query(inst, request, &handle, expanded);
-		TALLOC_FREE(expanded);
-		RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, sql_ret, "<INVALID>"));
-
-		switch (sql_ret) {
-		/*
-		 *  Query was a success! Now we just need to check if it did anything.
-		 */
-		case RLM_SQL_OK:
-			break;
-
-		/*
-		 *  A general, unrecoverable server fault.
-		 */
-		case RLM_SQL_ERROR:
-		/*
-		 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
-		 *  were exhausted, and we couldn't create a new connection,
-		 *  so we do not need to call fr_pool_connection_release.
-		 */
-		case RLM_SQL_RECONNECT:
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
-
-		/*
-		 *  Query was invalid, this is a terminal error, but we still need
-		 *  to do cleanup, as the connection handle is still valid.
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
-
-		/*
-		 *  Driver found an error (like a unique key constraint violation)
-		 *  that hinted it might be a good idea to try an alternative query.
-		 */
-		case RLM_SQL_ALT_QUERY:
-			goto next;
-		}
-		rad_assert(handle);
-
-		/*
-		 *  We need to have updated something for the query to have been
-		 *  counted as successful.
-		 */
-		numaffected = (inst->driver->sql_affected_rows)(handle, inst->config);
-		(inst->driver->sql_finish_query)(handle, inst->config);
-		RDEBUG("%i record(s) updated", numaffected);
-
-		if (numaffected > 0) break;	/* A query succeeded, were done! */
-	next:
-		/*
-		 *  We assume all entries with the same name form a redundant
-		 *  set of queries.
-		 */
-		pair = cf_pair_find_next(section->cs, pair, attr);
-
-		if (!pair) {
-			RDEBUG("No additional queries configured");
-			rcode = RLM_MODULE_NOOP;
-
-			goto finish;
-		}
-
-		RDEBUG("Trying next query...");
+	handle = fr_pool_connection_get(inst->pool, request);
+	if (!handle) {
+		sql_unset_user(inst, request);
+		return RLM_MODULE_FAIL;
 	}
 
+	sql_set_user(inst, request, NULL);
 
-finish:
-	talloc_free(expanded);
-	fr_pool_connection_release(inst->pool, request, handle);
-	sql_unset_user(inst, request);
+	MEM(rctx = talloc_zero(request, sql_acct_rctx_t));
+	rctx->section = section;
+	rctx->handle = handle;
+	rctx->pair = pair;
+	rctx->attr = cf_pair_attr(pair);
 
-	return rcode;
+	return acct_redundant_query(inst, thread, request, rctx);
 }
 
 #ifdef WITH_ACCOUNTING
@@ -1672,13 +1888,13 @@ finish:
 /*
  *	Accounting: Insert or update session data in our sql table
  */
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
-	rlm_sql_t const *inst = instance;
+	rlm_sql_t *inst = instance;
 
 	if (inst->config->accounting.reference_cp) {
-		return acct_redundant(inst, request, &inst->config->accounting);
+		return acct_redundant(inst, thread, request, &inst->config->accounting);
 	}
 
 	return RLM_MODULE_NOOP;
@@ -1689,13 +1905,13 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 /*
  *	Postauth: Write a record of the authentication attempt
  */
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
-	rlm_sql_t const *inst = talloc_get_type_abort_const(instance, rlm_sql_t);
+	rlm_sql_t *inst = talloc_get_type_abort(instance, rlm_sql_t);
 
 	if (inst->config->postauth.reference_cp) {
-		return acct_redundant(inst, request, &inst->config->postauth);
+		return acct_redundant(inst, thread, request, &inst->config->postauth);
 	}
 
 	return RLM_MODULE_NOOP;
@@ -1712,10 +1928,13 @@ rad_module_t rlm_sql = {
 	.name		= "sql",
 	.type		= RLM_TYPE_THREAD_SAFE,
 	.inst_size	= sizeof(rlm_sql_t),
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
 	.detach		= mod_detach,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
@@ -51,6 +51,7 @@ typedef enum {
 	RLM_SQL_RECONNECT = 1,		//!< Stale connection, should reconnect.
 	RLM_SQL_ALT_QUERY,		//!< Key constraint violation, use an alternative query.
 	RLM_SQL_NO_MORE_ROWS,		//!< No more rows available
+	RLM_SQL_YIELD			//!< Query in progress, wait for the socket to become ready.
 } sql_rcode_t;
 
 typedef enum {
@@ -82,6 +83,11 @@ typedef struct sql_acct_section {
 	char const		*logfile;
 
 	char const		**query;			/* for xlat parsing */
+
+	uint32_t		batch_size;			//!< Maximum number of requests to write in
+								//!< a single transaction.  0 disables batching.
+	struct timeval		batch_delay;			//!< Maximum time a request waits for its
+								//!< batch to fill.
 } sql_acct_section_t;
 
 typedef struct sql_config {
@@ -128,6 +134,9 @@ typedef struct sql_config {
 	char const		*connect_query;			//!< Query executed after establishing
 								//!< new connection.
 
+	bool			prepare;			//!< Execute queries as prepared statements
+								//!< where possible.
+
 	void			*driver;			//!< Where drivers should write a
 								//!< pointer to their configurations.
 
@@ -153,6 +162,36 @@ typedef struct rlm_sql_handle {
 								//!< when log strings need to be copied.
 } rlm_sql_handle_t;
 
+/** A query compiled into a statement with parameters
+ *
+ * Each string literal in the query containing an expansion is replaced with
+ * a placeholder.  The contents of the literal are expanded, without escaping,
+ * to produce the value bound to the placeholder.
+ */
+typedef struct sql_stmt {
+	int			id;				//!< Unique within the module instance.  Used by
+								//!< drivers to index per-connection state.
+	char const		*query;				//!< Query as configured.
+	char const		*text;				//!< SQL with "?" placeholders.
+	char const		*text_numbered;			//!< SQL with "$1" style placeholders.
+	int			num_params;			//!< Number of placeholders.
+	char const		**params;			//!< Formats producing the value of each parameter.
+} sql_stmt_t;
+
+/** A query ready to be executed
+ *
+ */
+typedef struct sql_query {
+	char const		*text;				//!< Expanded query, or the SQL of the statement.
+	sql_stmt_t const	*stmt;				//!< Statement to execute, or NULL to execute text.
+	char const		**values;			//!< Values to bind to the statement's parameters.
+} sql_query_t;
+
+/** Called when a query started by #rlm_sql_query_async completes
+ *
+ */
+typedef void (*sql_query_done_t)(sql_rcode_t ret, void *uctx);
+
 extern const FR_NAME_NUMBER sql_rcode_table[];
 /*
  *	Capabilities flags for drivers
@@ -210,6 +249,40 @@ typedef struct rlm_sql_driver_t {
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
 	xlat_escape_t	sql_escape_func;
+
+	/*
+	 *	Optional asynchronous interface.  If sql_query_send is NULL
+	 *	queries are run with the blocking functions above.
+	 *
+	 *	sql_query_send returns RLM_SQL_OK once the query has been
+	 *	written, or RLM_SQL_YIELD if it should be called again (with
+	 *	a NULL query) when the socket is writable.
+	 *
+	 *	sql_query_recv is called when the socket is readable, and
+	 *	returns RLM_SQL_YIELD until the result is complete, then
+	 *	the same codes as sql_query.  Once it returns, the result
+	 *	is read with the normal functions.
+	 */
+	int (*sql_socket_fd)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	sql_rcode_t (*sql_query_send)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+	sql_rcode_t (*sql_query_recv)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+
+	/*
+	 *	Optional prepared statement interface.
+	 *
+	 *	sql_prepare is called for each statement when a connection
+	 *	is opened.  If it fails, sql_execute should try to prepare
+	 *	the statement again when it's used.
+	 *
+	 *	sql_execute behaves like sql_select_query if select is true,
+	 *	or sql_query otherwise.  sql_execute_send behaves like
+	 *	sql_query_send.
+	 */
+	sql_rcode_t (*sql_prepare)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, sql_stmt_t const *stmt);
+	sql_rcode_t (*sql_execute)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, sql_stmt_t const *stmt,
+				   char const **values, bool select);
+	sql_rcode_t (*sql_execute_send)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, sql_stmt_t const *stmt,
+					char const **values);
 } rlm_sql_driver_t;
 
 struct sql_inst {
@@ -233,8 +306,22 @@ struct sql_inst {
 
 	char const		*name;			//!< Module instance name.
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
+
+	rbtree_t		*stmts;			//!< Queries compiled into statements, by query.
+						//!< NULL if prepared statements are disabled.
+	int			num_stmts;		//!< Number of compiled statements.
 };
 
+typedef struct sql_batch sql_batch_t;
+typedef struct sql_batch_write sql_batch_write_t;
+
+typedef struct sql_thread {
+	fr_event_list_t		*el;			//!< Event list of the worker thread.
+
+	sql_batch_t		*accounting_batch;	//!< Accounting requests waiting to be written.
+	sql_batch_t		*postauth_batch;	//!< Post-auth requests waiting to be written.
+} rlm_sql_thread_t;
+
 typedef struct sql_grouplist {
 	char			*name;
 	struct sql_grouplist	*next;
@@ -244,12 +331,35 @@ void		*mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *ti
 int		sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **first_pair, rlm_sql_row_t row);
 int		sql_read_realms(rlm_sql_handle_t *handle);
 int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair, char const *query);
+int		sql_getvpdata_result(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair);
 int		sql_read_clients(rlm_sql_handle_t *handle);
 int		sql_dict_init(rlm_sql_handle_t *handle);
 void 		rlm_sql_query_log(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section, char const *query) CC_HINT(nonnull (1, 2, 4));
 sql_rcode_t	rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
 sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
+sql_rcode_t	rlm_sql_execute(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+				sql_query_t const *query, bool select) CC_HINT(nonnull (1, 3, 4));
+int		sql_stmt_register(rlm_sql_t *inst, char const *query);
+sql_query_t	*sql_query_alloc(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle,
+				 sql_acct_section_t const *section, char const *fmt);
+rlm_rcode_t	rlm_sql_query_yield(rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+				    rlm_sql_handle_t **handle, sql_query_t const *query, bool select, sql_rcode_t *out,
+				    fr_unlang_resume_callback_t resume, fr_unlang_action_t signal, void *rctx);
+sql_rcode_t	rlm_sql_query_async(TALLOC_CTX *ctx, rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+				    rlm_sql_handle_t **handle, sql_query_t const *query, bool select,
+				    sql_query_done_t done, void *uctx);
 int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username);
+
+/*
+ *	Do a set/unset user, so it's a bit clearer what's going on.
+ */
+#define sql_unset_user(_i, _r) fr_pair_delete_by_num(&_r->packet->vps, _i->sql_user->vendor, _i->sql_user->attr, TAG_ANY)
+
+/*
+ *	sql_batch.c
+ */
+sql_batch_t	*sql_batch_alloc(rlm_sql_t *inst, rlm_sql_thread_t *thread, sql_acct_section_t *section);
+rlm_rcode_t	sql_batch_add(sql_batch_t *batch, REQUEST *request, CONF_PAIR *pair);
 #endif
@@ -31,6 +31,7 @@ RCSID("$Id$")
 
 #include	<freeradius-devel/radiusd.h>
 #include	<freeradius-devel/rad_assert.h>
+#include	<freeradius-devel/event.h>
 
 #include	<sys/file.h>
 #include	<sys/stat.h>
@@ -50,9 +51,30 @@ const FR_NAME_NUMBER sql_rcode_table[] = {
 	{ "query invalid",	RLM_SQL_QUERY_INVALID	},
 	{ "no connection",	RLM_SQL_RECONNECT	},
 	{ "no more rows",	RLM_SQL_NO_MORE_ROWS	},
+	{ "in progress",	RLM_SQL_YIELD		},
 	{ NULL, 0 }
 };
 
+/** Prepare a statement on a new connection
+ *
+ * Failures aren't fatal, the driver tries again when the statement is used.
+ */
+static int _sql_stmt_prepare(void *ctx, void *data)
+{
+	rlm_sql_handle_t	*handle = talloc_get_type_abort(ctx, rlm_sql_handle_t);
+	sql_stmt_t		*stmt = data;
+	rlm_sql_t const		*inst = handle->inst;
+
+	DEBUG3("Preparing statement %i: %s", stmt->id, stmt->text);
+
+	if ((inst->driver->sql_prepare)(handle, inst->config, stmt) != RLM_SQL_OK) {
+		WARN("Failed preparing statement: %s", stmt->text);
+		rlm_sql_print_error(inst, NULL, handle, false);
+	}
+
+	return 0;
+}
+
 void *mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *timeout)
 {
 	int rcode;
@@ -93,6 +115,8 @@ void *mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *tim
 		(inst->driver->sql_finish_select_query)(handle, inst->config);
 	}
 
+	if (inst->stmts) (void) rbtree_walk(inst->stmts, RBTREE_IN_ORDER, _sql_stmt_prepare, handle);
+
 	return handle;
 }
 
@@ -308,6 +332,339 @@ void rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle
 	talloc_free_children(handle->log_ctx);
 }
 
+/** Log the errors from a failed query, and clean up the result
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.  May be NULL.
+ * @param handle the query was run on.
+ * @param ret the driver returned.
+ * @param select whether the query was a select query.
+ * @return the rcode to return to the caller.
+ */
+static sql_rcode_t sql_query_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle,
+				   sql_rcode_t ret, bool select)
+{
+	if (select) {
+		rlm_sql_print_error(inst, request, handle, false);
+		(inst->driver->sql_finish_select_query)(handle, inst->config);
+		return ret;
+	}
+
+	switch (ret) {
+	/*
+	 *	These are bad and should make rlm_sql return invalid
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		rlm_sql_print_error(inst, request, handle, false);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	/*
+	 *	Server or client errors.
+	 *
+	 *	If the driver claims to be able to distinguish between
+	 *	duplicate row errors and other errors, and we hit a
+	 *	general error treat it as a failure.
+	 *
+	 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
+	 */
+	case RLM_SQL_ERROR:
+		if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
+			rlm_sql_print_error(inst, request, handle, false);
+			(inst->driver->sql_finish_query)(handle, inst->config);
+			break;
+		}
+		ret = RLM_SQL_ALT_QUERY;
+		/* FALL-THROUGH */
+
+	/*
+	 *	Driver suggested using an alternative query
+	 */
+	case RLM_SQL_ALT_QUERY:
+		rlm_sql_print_error(inst, request, handle, true);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+/** Compile a query into a statement with parameters
+ *
+ * Each string literal containing an expansion is replaced with a
+ * placeholder, and its contents become the format used to produce the
+ * value of the parameter.  Expansions anywhere else may produce SQL
+ * (not just values), so queries containing them can't be compiled.
+ *
+ * @param[in] inst	rlm_sql instance, to allocate the statement in.
+ * @param[in] query	to compile.
+ * @return
+ *	- The compiled statement.
+ *	- NULL if the query can't be executed as a prepared statement.
+ */
+static sql_stmt_t *sql_stmt_compile(rlm_sql_t *inst, char const *query)
+{
+	sql_stmt_t	*stmt;
+	char const	*p = query, *q;
+	char		*text, *numbered, *t, *n;
+	size_t		len = strlen(query);
+
+	MEM(stmt = talloc_zero(inst, sql_stmt_t));
+	stmt->query = query;
+
+	/*
+	 *	A literal with an expansion is at least 4 chars, and
+	 *	numbered placeholders won't be longer than that unless
+	 *	there are an absurd number of them.
+	 */
+	MEM(t = text = talloc_array(stmt, char, len + 1));
+	MEM(n = numbered = talloc_array(stmt, char, (len * 2) + 1));
+
+	while (*p) {
+		switch (*p) {
+		case '\'':
+		{
+			bool expand = false;
+
+			/*
+			 *	Find the end of the literal, skipping over
+			 *	expansions, which may contain quotes of
+			 *	their own.
+			 */
+			for (q = p + 1; *q && (*q != '\''); q++) {
+				/*
+				 *	Databases don't agree on escape
+				 *	sequences in literals.
+				 */
+				if (*q == '\\') goto fail;
+
+				if (*q != '%') continue;
+
+				if (q[1] == '%') {
+					q++;
+					continue;
+				}
+
+				if (q[1] == '\'') goto fail;
+
+				expand = true;
+
+				if (q[1] == '{') {
+					int depth = 0;
+
+					for (q++; *q; q++) {
+						if (*q == '{') {
+							depth++;
+						} else if ((*q == '}') && (--depth == 0)) {
+							break;
+						}
+					}
+					if (!*q) goto fail;
+				} else if (q[1]) {
+					q++;
+				}
+			}
+			if (!*q || (q[1] == '\'')) goto fail;	/* Unterminated, or contains '' */
+
+			if (!expand) {
+				for (; p <= q; p++) {
+					if ((p[0] == '%') && (p[1] == '%')) p++;
+					*t++ = *p;
+					*n++ = *p;
+				}
+				continue;
+			}
+
+			MEM(stmt->params = talloc_realloc(stmt, stmt->params, char const *, stmt->num_params + 1));
+			MEM(stmt->params[stmt->num_params++] = talloc_bstrndup(stmt->params, p + 1, q - (p + 1)));
+
+			*t++ = '?';
+			n += sprintf(n, "$%i", stmt->num_params);
+
+			p = q + 1;
+		}
+			continue;
+
+		case '%':
+			if (p[1] != '%') goto fail;
+			p++;
+			break;
+
+		/*
+		 *	Anything which could be mistaken for a
+		 *	placeholder, or hide a literal.
+		 */
+		case '?':
+		case '"':
+		case '`':
+			goto fail;
+
+		case '$':
+			if (isdigit((int) p[1])) goto fail;
+			break;
+
+		case '-':
+			if (p[1] == '-') goto fail;
+			break;
+
+		case '/':
+			if (p[1] == '*') goto fail;
+			break;
+
+		default:
+			break;
+		}
+
+		*t++ = *p;
+		*n++ = *p;
+		p++;
+	}
+	*t = '\0';
+	*n = '\0';
+
+	MEM(stmt->text = talloc_strdup(stmt, text));
+	MEM(stmt->text_numbered = talloc_strdup(stmt, numbered));
+	talloc_free(text);
+	talloc_free(numbered);
+
+	return stmt;
+
+fail:
+	talloc_free(stmt);
+	return NULL;
+}
+
+static int sql_stmt_cmp(void const *one, void const *two)
+{
+	sql_stmt_t const *a = one, *b = two;
+
+	return strcmp(a->query, b->query);
+}
+
+/** Compile a query, so it's executed as a prepared statement
+ *
+ * Must be called before any connections are opened.
+ *
+ * @param[in] inst	rlm_sql instance.
+ * @param[in] query	to compile.
+ * @return
+ *	- 1 if the query was compiled.
+ *	- 0 if it will be executed as text.
+ */
+int sql_stmt_register(rlm_sql_t *inst, char const *query)
+{
+	sql_stmt_t	*stmt, find = { .query = query };
+
+	if (!query || !*query) return 0;
+
+	if (!inst->stmts) {
+		inst->stmts = rbtree_create(inst, sql_stmt_cmp, NULL, RBTREE_FLAG_NONE);
+		if (!inst->stmts) return 0;
+	}
+
+	if (rbtree_finddata(inst->stmts, &find)) return 1;
+
+	stmt = sql_stmt_compile(inst, query);
+	if (!stmt) {
+		DEBUG2("Executing as text, expansions must be inside string literals to use a prepared statement: %s",
+		       query);
+		return 0;
+	}
+	stmt->id = inst->num_stmts++;
+
+	if (!rbtree_insert(inst->stmts, stmt)) {
+		talloc_free(stmt);
+		inst->num_stmts--;
+		return 0;
+	}
+
+	DEBUG3("Compiled statement %i: %s", stmt->id, stmt->text_numbered);
+
+	return 1;
+}
+
+/** Expand a query, ready to be executed
+ *
+ * If the query was compiled into a statement, only the values of its
+ * parameters are expanded, and they're not escaped.  Otherwise the whole
+ * query is expanded, with values escaped.
+ *
+ * @param[in] ctx	to allocate the query in.
+ * @param[in] inst	rlm_sql instance.
+ * @param[in] request	to expand the query for.
+ * @param[in] handle	used to escape values.
+ * @param[in] section	the query is from, or NULL.  Queries which are being
+ *			logged to a file are always expanded in full.
+ * @param[in] fmt	query to expand.
+ * @return
+ *	- The query.  Free it with talloc_free().
+ *	- NULL on error.
+ */
+sql_query_t *sql_query_alloc(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle,
+			     sql_acct_section_t const *section, char const *fmt)
+{
+	sql_query_t		*query;
+	sql_stmt_t const	*stmt = NULL;
+	int			i;
+
+	MEM(query = talloc_zero(ctx, sql_query_t));
+
+	if (inst->stmts) {
+		sql_stmt_t	find = { .query = fmt };
+		char const	*logfile = NULL;
+
+		if (section) logfile = section->logfile ? section->logfile : inst->config->logfile;
+		if (!logfile || !*logfile) stmt = rbtree_finddata(inst->stmts, &find);
+	}
+
+	if (!stmt) {
+		char *expanded;
+
+		if (xlat_aeval(query, &expanded, request, fmt, inst->sql_escape_func, handle) < 0) {
+			talloc_free(query);
+			return NULL;
+		}
+		query->text = expanded;
+
+		return query;
+	}
+
+	query->stmt = stmt;
+	query->text = stmt->text_numbered;
+	if (stmt->num_params) MEM(query->values = talloc_array(query, char const *, stmt->num_params));
+
+	for (i = 0; i < stmt->num_params; i++) {
+		char *value;
+
+		if (xlat_aeval(query, &value, request, stmt->params[i], NULL, NULL) < 0) {
+			talloc_free(query);
+			return NULL;
+		}
+		query->values[i] = value;
+	}
+
+	return query;
+}
+
+/** Print the query, and the values of any parameters
+ *
+ */
+static void sql_query_debug(rlm_sql_t const *inst, REQUEST *request, sql_query_t const *query, bool select)
+{
+	int i;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Executing %squery: %s", select ? "select " : "", query->text);
+
+	if (!query->stmt) return;
+
+	for (i = 0; i < query->stmt->num_params; i++) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "  $%i = '%s'", i + 1, query->values[i]);
+	}
+}
+
 /** Call the driver's sql_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
@@ -325,15 +682,58 @@ void rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle
  *	- #RLM_SQL_ALT_QUERY on constraints violation.
  */
 sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query)
+{
+	sql_query_t q = { .text = query };
+
+	return rlm_sql_execute(inst, request, handle, &q, false);
+}
+
+/** Call the driver's sql_select_query method, reconnecting if necessary.
+ *
+ * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, inst->config);``
+ *	after they're done with the result.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ *	  previous reconnection attempt has failed.
+ * @param query to execute. Should not be zero length.
+ * @return
+ *	- #RLM_SQL_OK on success.
+ *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ */
+sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query)
+{
+	sql_query_t q = { .text = query };
+
+	return rlm_sql_execute(inst, request, handle, &q, true);
+}
+
+/** Execute a query, or a prepared statement, reconnecting if necessary.
+ *
+ * @note Caller must call the driver's sql_finish_query or sql_finish_select_query
+ *	method after they're done with the result.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.  May be NULL.
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ *	  previous reconnection attempt has failed.
+ * @param query to execute, from #sql_query_alloc.
+ * @param select whether the query is a select query.
+ * @return the same codes as #rlm_sql_query or #rlm_sql_select_query.
+ */
+sql_rcode_t rlm_sql_execute(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+			    sql_query_t const *query, bool select)
 {
 	int ret = RLM_SQL_ERROR;
-	int i, count;
+	int i, count = 0;
 
 	/* Caller should check they have a valid handle */
 	rad_assert(*handle);
 
 	/* There's no query to run, return an error */
-	if (query[0] == '\0') {
+	if (query->text[0] == '\0') {
 		if (request) REDEBUG("Zero length query");
 		return RLM_SQL_QUERY_INVALID;
 	}
@@ -341,16 +741,27 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 	/*
 	 *  inst->pool may be NULL is this function is called by mod_conn_create.
 	 */
-	count = inst->pool ? fr_pool_state(inst->pool)->num : 0;
+	if (inst->pool) {
+		fr_pool_state_t state;
+
+		fr_pool_state(&state, inst->pool);
+		count = state.num;
+	}
 
 	/*
 	 *  Here we try with each of the existing connections, then try to create
 	 *  a new connection, then give up.
 	 */
 	for (i = 0; i < (count + 1); i++) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query);
-
-		ret = (inst->driver->sql_query)(*handle, inst->config, query);
+		sql_query_debug(inst, request, query, select);
+
+		if (query->stmt) {
+			ret = (inst->driver->sql_execute)(*handle, inst->config, query->stmt, query->values, select);
+		} else if (select) {
+			ret = (inst->driver->sql_select_query)(*handle, inst->config, query->text);
+		} else {
+			ret = (inst->driver->sql_query)(*handle, inst->config, query->text);
+		}
 		switch (ret) {
 		case RLM_SQL_OK:
 			break;
@@ -366,40 +777,9 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 			/* Reconnection succeeded, try again with the new handle */
 			continue;
 
-		/*
-		 *	These are bad and should make rlm_sql return invalid
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rlm_sql_print_error(inst, request, *handle, false);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
-			break;
-
-		/*
-		 *	Server or client errors.
-		 *
-		 *	If the driver claims to be able to distinguish between
-		 *	duplicate row errors and other errors, and we hit a
-		 *	general error treat it as a failure.
-		 *
-		 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
-		 */
-		case RLM_SQL_ERROR:
-			if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
-				rlm_sql_print_error(inst, request, *handle, false);
-				(inst->driver->sql_finish_query)(*handle, inst->config);
-				break;
-			}
-			ret = RLM_SQL_ALT_QUERY;
-			/* FALL-THROUGH */
-
-		/*
-		 *	Driver suggested using an alternative query
-		 */
-		case RLM_SQL_ALT_QUERY:
-			rlm_sql_print_error(inst, request, *handle, true);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
+		default:
+			ret = sql_query_error(inst, request, *handle, ret, select);
 			break;
-
 		}
 
 		return ret;
@@ -410,79 +790,430 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 	return RLM_SQL_ERROR;
 }
 
-/** Call the driver's sql_select_query method, reconnecting if necessary.
+/** State of a query being run asynchronously
  *
- * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, inst->config);``
- *	after they're done with the result.
+ */
+typedef struct sql_query_yield {
+	rlm_sql_t			*inst;		//!< Instance the query is being run for.
+	rlm_sql_thread_t		*thread;	//!< Thread the query is being run in.
+	REQUEST				*request;	//!< The current request.
+
+	rlm_sql_handle_t		**handle;	//!< Caller's handle, updated if we reconnect.
+	sql_query_t const		*query;		//!< Being run, kept for re-sending after reconnects.
+	bool				select;		//!< Whether the query is a select query.
+	int				tries;		//!< How many more times we can reconnect.
+
+	int				fd;		//!< We're waiting on.  -1 if none.
+	fr_event_timer_t const		*ev;		//!< For query_timeout.
+
+	sql_rcode_t			*out;		//!< Where to write the result.
+	fr_unlang_resume_callback_t	resume;		//!< Caller's resume function.
+	fr_unlang_action_t		signal;		//!< Caller's signal function.
+	void				*rctx;		//!< Caller's resume ctx.
+
+	sql_query_done_t		done;		//!< Called instead of resuming the request.
+	void				*uctx;		//!< Passed to done.
+} sql_query_yield_t;
+
+static void _sql_query_yield_readable(fr_event_list_t *el, int fd, int flags, void *uctx);
+static void _sql_query_yield_writable(fr_event_list_t *el, int fd, int flags, void *uctx);
+static void _sql_query_yield_error(fr_event_list_t *el, int fd, int flags, int fd_errno, void *uctx);
+
+/** Start sending a query, or a prepared statement
  *
- * @param inst #rlm_sql_t instance data.
- * @param request Current request.
- * @param handle to query the database with. *handle should not be NULL, as this indicates
- *	  previous reconnection attempt has failed.
- * @param query to execute. Should not be zero length.
- * @return
- *	- #RLM_SQL_OK on success.
- *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
- *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
  */
-sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query)
+static sql_rcode_t sql_query_send(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle,
+				  sql_query_t const *query, bool select)
 {
-	int ret = RLM_SQL_ERROR;
-	int i, count;
+	sql_query_debug(inst, request, query, select);
 
-	/* Caller should check they have a valid handle */
-	rad_assert(*handle);
+	if (query->stmt) return (inst->driver->sql_execute_send)(handle, inst->config, query->stmt, query->values);
 
-	/* There's no query to run, return an error */
-	if (query[0] == '\0') {
-		if (request) REDEBUG("Zero length query");
+	return (inst->driver->sql_query_send)(handle, inst->config, query->text);
+}
 
-		return RLM_SQL_QUERY_INVALID;
-	}
+/** Stop listening for events on the handle's socket
+ *
+ */
+static void sql_query_yield_events_clear(sql_query_yield_t *yctx)
+{
+	if (yctx->fd < 0) return;
 
-	/*
-	 *  inst->pool may be NULL is this function is called by mod_conn_create.
-	 */
-	count = inst->pool ? fr_pool_state(inst->pool)->num : 0;
+	(void) fr_event_fd_delete(yctx->thread->el, yctx->fd, FR_EVENT_FILTER_IO);
+	yctx->fd = -1;
+}
+
+/** Listen for the socket becoming readable, or writable if there's more of the query to send
+ *
+ */
+static int sql_query_yield_events_set(sql_query_yield_t *yctx, bool write)
+{
+	rlm_sql_t const	*inst = yctx->inst;
+	int		fd;
+
+	fd = (inst->driver->sql_socket_fd)(*yctx->handle, inst->config);
+	if (fd < 0) return -1;
 
 	/*
-	 *  For sanity, for when no connections are viable, and we can't make a new one
+	 *	May be a different socket if we reconnected.
 	 */
-	for (i = 0; i < (count + 1); i++) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Executing select query: %s", query);
+	if ((yctx->fd >= 0) && (yctx->fd != fd)) sql_query_yield_events_clear(yctx);
+
+	if (fr_event_fd_insert(yctx, yctx->thread->el, fd,
+			       write ? NULL : _sql_query_yield_readable,
+			       write ? _sql_query_yield_writable : NULL,
+			       _sql_query_yield_error, yctx) < 0) return -1;
+	yctx->fd = fd;
 
-		ret = (inst->driver->sql_select_query)(*handle, inst->config, query);
+	return 0;
+}
+
+/** Process the rcode from sending a query, or receiving its result
+ *
+ * Sends the query again on a new connection if the old one failed, in the
+ * same way as #rlm_sql_query.
+ *
+ * @return
+ *	- #RLM_SQL_YIELD if we're waiting on the socket.
+ *	- Anything else if the query has completed.
+ */
+static sql_rcode_t sql_query_yield_process(sql_query_yield_t *yctx, sql_rcode_t ret, bool sending)
+{
+	rlm_sql_t const		*inst = yctx->inst;
+	REQUEST			*request = yctx->request;
+
+	for (;;) {
 		switch (ret) {
-		case RLM_SQL_OK:
-			break;
+		case RLM_SQL_YIELD:
+			if (sql_query_yield_events_set(yctx, sending) < 0) {
+				ROPTIONAL(RPERROR, PERROR, "Failed inserting socket into event loop");
+				goto reconnect;
+			}
+			return RLM_SQL_YIELD;
 
 		/*
-		 *	Run through all available sockets until we exhaust all existing
-		 *	sockets in the pool and fail to establish a *new* connection.
+		 *	Query has been written, wait for the result.
 		 */
+		case RLM_SQL_OK:
+			if (sending) {
+				sending = false;
+				ret = RLM_SQL_YIELD;
+				continue;
+			}
+			sql_query_yield_events_clear(yctx);
+			return RLM_SQL_OK;
+
 		case RLM_SQL_RECONNECT:
-			*handle = fr_pool_connection_reconnect(inst->pool, request, *handle);
+		reconnect:
+			sql_query_yield_events_clear(yctx);
+
+			if (--yctx->tries <= 0) {
+				ROPTIONAL(RERROR, ERROR, "Hit reconnection limit");
+				return RLM_SQL_ERROR;
+			}
+
+			*yctx->handle = fr_pool_connection_reconnect(inst->pool, request, *yctx->handle);
 			/* Reconnection failed */
-			if (!*handle) return RLM_SQL_RECONNECT;
-			/* Reconnection succeeded, try again with the new handle */
+			if (!*yctx->handle) return RLM_SQL_RECONNECT;
+
+			ret = sql_query_send(inst, request, *yctx->handle, yctx->query, yctx->select);
+			sending = true;
 			continue;
 
-		case RLM_SQL_QUERY_INVALID:
-		case RLM_SQL_ERROR:
 		default:
-			rlm_sql_print_error(inst, request, *handle, false);
-			(inst->driver->sql_finish_select_query)(*handle, inst->config);
-			break;
+			sql_query_yield_events_clear(yctx);
+			return sql_query_error(inst, request, *yctx->handle, ret, yctx->select);
 		}
+	}
+}
 
+/** Write out the result, and mark the request as resumable
+ *
+ * If the query wasn't run for a yielded request, call the done
+ * function instead.
+ */
+static void sql_query_yield_done(sql_query_yield_t *yctx, sql_rcode_t ret)
+{
+	sql_query_done_t	done = yctx->done;
+	void			*uctx = yctx->uctx;
+
+	if (yctx->ev) fr_event_timer_delete(yctx->thread->el, &yctx->ev);
+
+	if (done) {
+		talloc_free(yctx);
+		done(ret, uctx);
+		return;
+	}
+
+	*yctx->out = ret;
+	unlang_resumable(yctx->request);
+}
+
+static void _sql_query_yield_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	sql_query_yield_t	*yctx = talloc_get_type_abort(uctx, sql_query_yield_t);
+	rlm_sql_t const		*inst = yctx->inst;
+	sql_rcode_t		ret;
+
+	ret = (inst->driver->sql_query_recv)(*yctx->handle, inst->config);
+	if (ret == RLM_SQL_YIELD) return;
+
+	ret = sql_query_yield_process(yctx, ret, false);
+	if (ret == RLM_SQL_YIELD) return;
+
+	sql_query_yield_done(yctx, ret);
+}
+
+static void _sql_query_yield_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	sql_query_yield_t	*yctx = talloc_get_type_abort(uctx, sql_query_yield_t);
+	rlm_sql_t const		*inst = yctx->inst;
+	sql_rcode_t		ret;
+
+	ret = sql_query_yield_process(yctx, (inst->driver->sql_query_send)(*yctx->handle, inst->config, NULL), true);
+	if (ret == RLM_SQL_YIELD) return;
+
+	sql_query_yield_done(yctx, ret);
+}
+
+static void _sql_query_yield_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				   int fd_errno, void *uctx)
+{
+	sql_query_yield_t	*yctx = talloc_get_type_abort(uctx, sql_query_yield_t);
+	rlm_sql_t const		*inst = yctx->inst;
+	REQUEST			*request = yctx->request;
+	sql_rcode_t		ret;
+
+	ROPTIONAL(RERROR, ERROR, "Connection failed: %s", fr_syserror(fd_errno));
+
+	ret = sql_query_yield_process(yctx, RLM_SQL_RECONNECT, false);
+	if (ret == RLM_SQL_YIELD) return;
+
+	sql_query_yield_done(yctx, ret);
+}
+
+/** The query took longer than query_timeout
+ *
+ * The connection is in an unknown state, so we close it.
+ */
+static void _sql_query_yield_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	sql_query_yield_t	*yctx = talloc_get_type_abort(uctx, sql_query_yield_t);
+	rlm_sql_t const		*inst = yctx->inst;
+	REQUEST			*request = yctx->request;
+
+	yctx->ev = NULL;
+
+	ROPTIONAL(RERROR, ERROR, "Query timed out after %u seconds", inst->config->query_timeout);
+
+	sql_query_yield_events_clear(yctx);
+	fr_pool_connection_close(inst->pool, request, *yctx->handle);
+	*yctx->handle = NULL;
+
+	sql_query_yield_done(yctx, RLM_SQL_RECONNECT);
+}
+
+static rlm_rcode_t _sql_query_yield_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	sql_query_yield_t		*yctx = talloc_get_type_abort(ctx, sql_query_yield_t);
+	fr_unlang_resume_callback_t	resume = yctx->resume;
+	void				*rctx = yctx->rctx;
+
+	talloc_free(yctx);
+
+	return resume(request, instance, thread, rctx);
+}
+
+static void _sql_query_yield_signal(REQUEST *request, void *instance, void *thread, void *ctx,
+				    fr_state_action_t action)
+{
+	sql_query_yield_t	*yctx = talloc_get_type_abort(ctx, sql_query_yield_t);
+	rlm_sql_t const		*inst = yctx->inst;
+
+	if (action == FR_ACTION_DONE) {
+		RDEBUG("Cancelling pending SQL query");
+
+		/*
+		 *	There's a query in flight, so the
+		 *	connection can't be reused.
+		 */
+		sql_query_yield_events_clear(yctx);
+		if (*yctx->handle) {
+			fr_pool_connection_close(inst->pool, request, *yctx->handle);
+			*yctx->handle = NULL;
+		}
+	}
+
+	if (yctx->signal) yctx->signal(request, instance, thread, yctx->rctx, action);
+
+	if (action == FR_ACTION_DONE) talloc_free(yctx);
+}
+
+/** Stop listening on the socket if the query is cancelled
+ *
+ */
+static int _sql_query_yield_free(sql_query_yield_t *yctx)
+{
+	sql_query_yield_events_clear(yctx);
+
+	return 0;
+}
+
+/** Whether the query can be sent without blocking
+ *
+ */
+static inline bool sql_query_async_supported(rlm_sql_t const *inst, sql_query_t const *query)
+{
+	return inst->driver->sql_query_send && (!query->stmt || inst->driver->sql_execute_send) &&
+	       (query->text[0] != '\0');
+}
+
+/** Send a query, and start waiting for the result
+ *
+ * @return
+ *	- #RLM_SQL_YIELD if the query is in progress.  *out holds its state.
+ *	- Anything else if the query completed immediately.
+ */
+static sql_rcode_t sql_query_yield_start(sql_query_yield_t **out, TALLOC_CTX *ctx,
+					 rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+					 rlm_sql_handle_t **handle, sql_query_t const *query, bool select)
+{
+	sql_query_yield_t	*yctx;
+	sql_rcode_t		ret;
+	fr_pool_state_t		state;
+
+	MEM(yctx = talloc_zero(ctx, sql_query_yield_t));
+	yctx->inst = inst;
+	yctx->thread = thread;
+	yctx->request = request;
+	yctx->handle = handle;
+	yctx->query = query;
+	yctx->select = select;
+	fr_pool_state(&state, inst->pool);
+	yctx->tries = state.num + 1;
+	yctx->fd = -1;
+	talloc_set_destructor(yctx, _sql_query_yield_free);
+
+	ret = sql_query_yield_process(yctx, sql_query_send(inst, request, *handle, query, select), true);
+	if (ret != RLM_SQL_YIELD) {
+		talloc_free(yctx);
 		return ret;
 	}
 
-	ROPTIONAL(RERROR, ERROR, "Hit reconnection limit");
+	if (inst->config->query_timeout) {
+		struct timeval now, when, timeout = { .tv_sec = inst->config->query_timeout };
 
-	return RLM_SQL_ERROR;
+		gettimeofday(&now, NULL);
+		fr_timeval_add(&when, &now, &timeout);
+		if (fr_event_timer_insert(yctx, thread->el, &yctx->ev, &when, _sql_query_yield_timeout, yctx) < 0) {
+			ROPTIONAL(RWARN, WARN, "Failed inserting query timeout: %s", fr_strerror());
+		}
+	}
+
+	*out = yctx;
+
+	return RLM_SQL_YIELD;
 }
 
+/** Run a query without blocking the worker thread
+ *
+ * Sends the query, yields, and calls the resume function when the result is
+ * available.  The result is then read with the normal driver functions,
+ * exactly as after #rlm_sql_query or #rlm_sql_select_query.
+ *
+ * If the driver doesn't support asynchronous queries, the query is run
+ * synchronously and the resume function is called immediately.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param thread Thread specific data.
+ * @param request Current request.
+ * @param handle to query the database with.  May be replaced, or set to NULL,
+ *	in the same way as #rlm_sql_query.
+ * @param query to execute, from #sql_query_alloc.  Must remain valid until the resume
+ *	function is called.
+ * @param select whether the query is a select query.
+ * @param out Where to write the rcode of the query.
+ * @param resume Called when the query completes.
+ * @param signal Called if the request is signalled while we wait.  If the request is
+ *	cancelled, the handle will already have been closed, and set to NULL.
+ * @param rctx Passed to resume and signal.
+ * @return the rcode to return from the module method.
+ */
+rlm_rcode_t rlm_sql_query_yield(rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+				rlm_sql_handle_t **handle, sql_query_t const *query, bool select, sql_rcode_t *out,
+				fr_unlang_resume_callback_t resume, fr_unlang_action_t signal, void *rctx)
+{
+	sql_query_yield_t	*yctx;
+	sql_rcode_t		ret;
+
+	/* Caller should check they have a valid handle */
+	rad_assert(*handle);
+
+	if (!sql_query_async_supported(inst, query)) {
+		*out = rlm_sql_execute(inst, request, handle, query, select);
+		return resume(request, inst, thread, rctx);
+	}
+
+	ret = sql_query_yield_start(&yctx, request, inst, thread, request, handle, query, select);
+	if (ret != RLM_SQL_YIELD) {
+		*out = ret;
+		return resume(request, inst, thread, rctx);
+	}
+
+	yctx->out = out;
+	yctx->resume = resume;
+	yctx->signal = signal;
+	yctx->rctx = rctx;
+
+	return unlang_module_yield(request, _sql_query_yield_resume, _sql_query_yield_signal, yctx);
+}
+
+/** Run a query without blocking the worker thread, or yielding a request
+ *
+ * Used for queries which aren't run on behalf of a single request, such as
+ * the statements of a batched write.  The result is read in the same way
+ * as for #rlm_sql_query_yield.
+ *
+ * If the driver doesn't support asynchronous queries, the query is run
+ * synchronously.
+ *
+ * @param ctx to allocate the state of the query in.  Freeing it cancels the
+ *	query, after which the caller must close the handle.
+ * @param inst #rlm_sql_t instance data.
+ * @param thread Thread specific data.
+ * @param request to log against.  May be NULL.  Must remain valid until done
+ *	is called, so should be NULL if the request may be freed first.
+ * @param handle to query the database with.  May be replaced, or set to NULL,
+ *	in the same way as #rlm_sql_query.
+ * @param query to execute, from #sql_query_alloc.  Must remain valid until done
+ *	is called.
+ * @param select whether the query is a select query.
+ * @param done Called with the rcode of the query, if it doesn't complete immediately.
+ * @param uctx Passed to done.
+ * @return
+ *	- #RLM_SQL_YIELD if the query is in progress.  done will be called when it completes.
+ *	- Anything else if the query completed immediately.  done is not called.
+ */
+sql_rcode_t rlm_sql_query_async(TALLOC_CTX *ctx, rlm_sql_t *inst, rlm_sql_thread_t *thread, REQUEST *request,
+				rlm_sql_handle_t **handle, sql_query_t const *query, bool select,
+				sql_query_done_t done, void *uctx)
+{
+	sql_query_yield_t	*yctx;
+	sql_rcode_t		ret;
+
+	/* Caller should check they have a valid handle */
+	rad_assert(*handle);
+
+	if (!sql_query_async_supported(inst, query)) return rlm_sql_execute(inst, request, handle, query, select);
+
+	ret = sql_query_yield_start(&yctx, ctx, inst, thread, request, handle, query, select);
+	if (ret != RLM_SQL_YIELD) return ret;
+
+	yctx->done = done;
+	yctx->uctx = uctx;
+
+	return RLM_SQL_YIELD;
+}
 
 /*************************************************************************
  *
@@ -494,8 +1225,6 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sq
 int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
 		  VALUE_PAIR **pair, char const *query)
 {
-	rlm_sql_row_t	row;
-	int		rows = 0;
 	sql_rcode_t	rcode;
 
 	rad_assert(request);
@@ -503,6 +1232,23 @@ int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_
 	rcode = rlm_sql_select_query(inst, request, handle, query);
 	if (rcode != RLM_SQL_OK) return -1; /* error handled by rlm_sql_select_query */
 
+	return sql_getvpdata_result(ctx, inst, request, handle, pair);
+}
+
+/** Convert the rows of a select query's result into VALUE_PAIRs
+ *
+ * Frees the result once all the rows have been read.
+ *
+ * @return
+ *	- The number of rows read.
+ *	- -1 on error.
+ */
+int sql_getvpdata_result(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+			 VALUE_PAIR **pair)
+{
+	rlm_sql_row_t	row;
+	int		rows = 0;
+
 	while (rlm_sql_fetch_row(&row, inst, request, handle) == RLM_SQL_OK) {
 		if (sql_fr_pair_list_afrom_str(ctx, request, pair, row) != 0) {
 			REDEBUG("Error parsing user data from database result");
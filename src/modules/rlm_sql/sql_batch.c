@@ -0,0 +1,636 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file sql_batch.c
+ * @brief Writes accounting and post-auth queries in batches.
+ *
+ * @copyright 2018  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX "rlm_sql (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_sql.h"
+
+/** State of a request waiting in a batch
+ *
+ */
+typedef struct sql_batch_req {
+	sql_acct_section_t	*section;	//!< Section the queries come from.
+	CONF_PAIR		*pair;		//!< First query to run.
+	char const		*attr;		//!< Name of the query set.
+
+	REQUEST			*request;	//!< Request the queries are for.
+	sql_batch_t		*batch;		//!< Batch the request is waiting in.
+	sql_batch_write_t	*write;		//!< Write the request's queries are part of.
+	fr_dlist_t		entry;		//!< Entry in the batch.
+	rlm_rcode_t		rcode;		//!< Result once the batch is written.
+	char const		**queries;	//!< Run in the batch's transaction, to log once it's committed.
+	size_t			num_queries;	//!< Number of queries to log.
+} sql_batch_req_t;
+
+/** Requests waiting to have their queries written in a single transaction
+ *
+ * One per section, per thread, so no locking is needed.
+ */
+struct sql_batch {
+	rlm_sql_t		*inst;		//!< Instance the batch belongs to.
+	rlm_sql_thread_t	*thread;	//!< Thread the batch belongs to.
+	sql_acct_section_t	*section;	//!< Section the queries come from.
+
+	fr_dlist_t		pending;	//!< Requests waiting for the batch to be written.
+	uint32_t		num;		//!< Number of requests in the batch.
+	fr_event_timer_t const	*ev;		//!< When to write the batch.
+};
+
+/** Where a batch write has got to
+ *
+ */
+typedef enum {
+	SQL_BATCH_BEGIN = 0,			//!< Starting the transaction.
+	SQL_BATCH_QUERY,			//!< Running a query for the current request.
+	SQL_BATCH_COMMIT,			//!< Committing the transaction.
+	SQL_BATCH_ROLLBACK			//!< Rolling back the transaction.
+} sql_batch_state_t;
+
+/** A batch being written
+ *
+ * The queries are run one at a time on a single connection, using
+ * #rlm_sql_query_async, so the worker isn't blocked while the batch
+ * is written.
+ */
+struct sql_batch_write {
+	sql_batch_t		*batch;		//!< The requests were taken from.
+	rlm_sql_handle_t	*handle;	//!< Connection the batch is written with.
+	rlm_sql_handle_t	*orig;		//!< Connection the transaction was started on.
+	bool			txn;		//!< Whether the batch is being written in a single transaction.
+	sql_batch_state_t	state;		//!< What the query being run is for.
+
+	fr_dlist_t		todo;		//!< Requests whose queries haven't been run.
+	fr_dlist_t		done;		//!< Requests whose queries have been run.
+	sql_batch_req_t		*current;	//!< Request whose queries are being run.  NULL if it
+						//!< was cancelled while its query was in progress.
+	CONF_PAIR		*pair;		//!< Query being run for the current request.
+	sql_query_t		*query;		//!< Query being run.
+};
+
+static void sql_batch_write_run(sql_batch_write_t *write, sql_rcode_t ret);
+static void sql_batch_write_complete(sql_batch_write_t *write);
+
+/** Called when a batch query completes asynchronously
+ *
+ */
+static void _sql_batch_write_done(sql_rcode_t ret, void *uctx)
+{
+	sql_batch_write_run(talloc_get_type_abort(uctx, sql_batch_write_t), ret);
+}
+
+/** Start running a query for the batch
+ *
+ * The query isn't given a request, as the request it's for may be
+ * cancelled while the query is in progress.  Errors are logged
+ * against the module instance instead.
+ *
+ * @return
+ *	- #RLM_SQL_YIELD if the query is in progress.
+ *	- The result of the query if it completed immediately.
+ */
+static sql_rcode_t sql_batch_write_send(sql_batch_write_t *write, sql_query_t *query)
+{
+	sql_batch_t	*batch = write->batch;
+
+	write->query = query;
+
+	return rlm_sql_query_async(write, batch->inst, batch->thread, NULL, &write->handle, query, false,
+				   _sql_batch_write_done, write);
+}
+
+/** Start running a statement which controls the transaction
+ *
+ */
+static sql_rcode_t sql_batch_write_statement(sql_batch_write_t *write, sql_batch_state_t state, char const *statement)
+{
+	rlm_sql_t const	*inst = write->batch->inst;
+	sql_query_t	*query;
+
+	/*
+	 *	Set the state first, so that a missing connection
+	 *	is processed as a failure of this statement.
+	 */
+	write->state = state;
+	if (!write->handle) return RLM_SQL_RECONNECT;
+
+	MEM(query = talloc_zero(write, sql_query_t));
+	query->text = statement;
+
+	return sql_batch_write_send(write, query);
+}
+
+/** Stop running queries for the current request
+ *
+ */
+static void sql_batch_write_finish(sql_batch_write_t *write, rlm_rcode_t rcode)
+{
+	sql_batch_req_t *rctx = write->current;
+
+	if (!rctx) return;
+
+	rctx->rcode = rcode;
+	sql_unset_user(write->batch->inst, rctx->request);
+	write->current = NULL;
+}
+
+/** Start running the next query
+ *
+ * Works through the redundant queries for each request the same way as
+ * #acct_redundant_resume, then commits the transaction.
+ *
+ * @return
+ *	- #RLM_SQL_YIELD if a query is in progress, or the write is complete.
+ *	- The result of the query if it completed immediately.
+ */
+static sql_rcode_t sql_batch_write_next(sql_batch_write_t *write)
+{
+	rlm_sql_t const	*inst = write->batch->inst;
+	sql_batch_req_t	*rctx;
+	REQUEST		*request;
+	char const	*value;
+	sql_query_t	*query;
+	fr_dlist_t	*entry;
+
+	for (;;) {
+		rctx = write->current;
+		if (!rctx) {
+			entry = FR_DLIST_FIRST(write->todo);
+			if (!entry) break;
+
+			rctx = fr_ptr_to_type(sql_batch_req_t, entry, entry);
+			fr_dlist_remove(entry);
+			fr_dlist_insert_tail(&write->done, entry);
+
+			if (!write->handle) {
+				rctx->rcode = RLM_MODULE_FAIL;
+				continue;
+			}
+
+			write->current = rctx;
+			write->pair = rctx->pair;
+			sql_set_user(inst, rctx->request, NULL);
+		}
+		request = rctx->request;
+
+		value = cf_pair_value(write->pair);
+		if (!value) {
+			RDEBUG("Ignoring null query");
+			sql_batch_write_finish(write, RLM_MODULE_NOOP);
+			continue;
+		}
+
+		query = sql_query_alloc(write, inst, request, write->handle, rctx->section, value);
+		if (!query) {
+			sql_batch_write_finish(write, RLM_MODULE_FAIL);
+			continue;
+		}
+
+		if (!*query->text) {
+			RDEBUG("Ignoring null query");
+			talloc_free(query);
+			sql_batch_write_finish(write, RLM_MODULE_NOOP);
+			continue;
+		}
+
+		/*
+		 *	Queries in a transaction are logged
+		 *	once it's been committed.  Prepared
+		 *	statements are never logged.
+		 */
+		if (!write->txn && !query->stmt) rlm_sql_query_log(inst, request, rctx->section, query->text);
+
+		write->state = SQL_BATCH_QUERY;
+
+		return sql_batch_write_send(write, query);
+	}
+
+	if (write->txn) return sql_batch_write_statement(write, SQL_BATCH_COMMIT, "COMMIT");
+
+	sql_batch_write_complete(write);
+
+	return RLM_SQL_YIELD;
+}
+
+/** Abandon the transaction, and run the queries again individually
+ *
+ * Some databases won't run any more statements in a failed transaction
+ * until it's rolled back, so one bad request would otherwise fail the
+ * rest of the batch.
+ *
+ * Nothing in the transaction was committed, so every request is failed,
+ * and queued to run again.  If the connection has gone, the requests
+ * stay failed.
+ */
+static sql_rcode_t sql_batch_write_rollback(sql_batch_write_t *write)
+{
+	rlm_sql_t const	*inst = write->batch->inst;
+	sql_batch_req_t	*rctx;
+	fr_dlist_t	*entry;
+
+	WARN("Batch transaction failed, running queries individually");
+
+	write->txn = false;
+	if (write->current) sql_batch_write_finish(write, RLM_MODULE_FAIL);
+
+	/*
+	 *	Run everything again, in the original order.
+	 */
+	while ((entry = FR_DLIST_FIRST(write->todo))) {
+		fr_dlist_remove(entry);
+		fr_dlist_insert_tail(&write->done, entry);
+	}
+
+	while ((entry = FR_DLIST_FIRST(write->done))) {
+		rctx = fr_ptr_to_type(sql_batch_req_t, entry, entry);
+
+		TALLOC_FREE(rctx->queries);
+		rctx->num_queries = 0;
+		rctx->rcode = RLM_MODULE_FAIL;
+
+		fr_dlist_remove(entry);
+		fr_dlist_insert_tail(&write->todo, entry);
+	}
+
+	return sql_batch_write_statement(write, SQL_BATCH_ROLLBACK, "ROLLBACK");
+}
+
+/** Process the result of the query, and start the next one
+ *
+ * @return
+ *	- #RLM_SQL_YIELD if a query is in progress, or the write is complete.
+ *	- The result of the next query if it completed immediately.
+ */
+static sql_rcode_t sql_batch_write_process(sql_batch_write_t *write, sql_rcode_t ret)
+{
+	rlm_sql_t const	*inst = write->batch->inst;
+	sql_batch_req_t	*rctx = write->current;
+	REQUEST		*request = rctx ? rctx->request : NULL;
+	sql_query_t	*query = write->query;
+	fr_dlist_t	*entry;
+	int		numaffected;
+
+	write->query = NULL;
+
+	switch (write->state) {
+	case SQL_BATCH_BEGIN:
+		talloc_free(query);
+		if (ret != RLM_SQL_OK) {
+			WARN("Failed starting batch transaction, running queries individually");
+			write->txn = false;
+			return sql_batch_write_next(write);
+		}
+		(inst->driver->sql_finish_query)(write->handle, inst->config);
+		write->orig = write->handle;
+		return sql_batch_write_next(write);
+
+	case SQL_BATCH_COMMIT:
+		talloc_free(query);
+		if (ret != RLM_SQL_OK) return sql_batch_write_rollback(write);
+		(inst->driver->sql_finish_query)(write->handle, inst->config);
+
+		for (entry = FR_DLIST_FIRST(write->done); entry; entry = FR_DLIST_NEXT(write->done, entry)) {
+			size_t i;
+
+			rctx = fr_ptr_to_type(sql_batch_req_t, entry, entry);
+			for (i = 0; i < rctx->num_queries; i++) {
+				rlm_sql_query_log(inst, rctx->request, rctx->section, rctx->queries[i]);
+			}
+		}
+
+		sql_batch_write_complete(write);
+		return RLM_SQL_YIELD;
+
+	/*
+	 *	The requests have already been queued to run
+	 *	again.  Without a connection, they're failed.
+	 */
+	case SQL_BATCH_ROLLBACK:
+		talloc_free(query);
+		if (ret == RLM_SQL_OK) (inst->driver->sql_finish_query)(write->handle, inst->config);
+		return sql_batch_write_next(write);
+
+	case SQL_BATCH_QUERY:
+		break;
+	}
+
+	/*
+	 *	The request was cancelled while its query was in
+	 *	progress.  Clean up, and move on to the next one.
+	 */
+	if (!rctx) {
+		if (ret == RLM_SQL_OK) (inst->driver->sql_finish_query)(write->handle, inst->config);
+		talloc_free(query);
+
+		if (write->txn && ((ret != RLM_SQL_OK) || (write->handle != write->orig))) {
+			return sql_batch_write_rollback(write);
+		}
+		return sql_batch_write_next(write);
+	}
+
+	if (write->txn && !query->stmt) {
+		MEM(rctx->queries = talloc_realloc(rctx, rctx->queries, char const *, rctx->num_queries + 1));
+		rctx->queries[rctx->num_queries++] = talloc_steal(rctx->queries, query->text);
+	}
+	talloc_free(query);
+	RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, ret, "<INVALID>"));
+
+	/*
+	 *	If we reconnected, everything written so far
+	 *	was rolled back with the old connection.
+	 */
+	if (write->txn && (write->handle != write->orig)) return sql_batch_write_rollback(write);
+
+	switch (ret) {
+	case RLM_SQL_OK:
+		break;
+
+	/*
+	 *	Inside a transaction any failed statement (including a
+	 *	constraint violation which would normally mean trying the
+	 *	next query) fails the whole batch.
+	 */
+	case RLM_SQL_ALT_QUERY:
+		if (write->txn) return sql_batch_write_rollback(write);
+		goto next;
+
+	case RLM_SQL_QUERY_INVALID:
+		if (write->txn) return sql_batch_write_rollback(write);
+		sql_batch_write_finish(write, RLM_MODULE_INVALID);
+		return sql_batch_write_next(write);
+
+	default:
+		if (write->txn) return sql_batch_write_rollback(write);
+		sql_batch_write_finish(write, RLM_MODULE_FAIL);
+		return sql_batch_write_next(write);
+	}
+
+	numaffected = (inst->driver->sql_affected_rows)(write->handle, inst->config);
+	(inst->driver->sql_finish_query)(write->handle, inst->config);
+	RDEBUG("%i record(s) updated", numaffected);
+
+	if (numaffected > 0) {
+		sql_batch_write_finish(write, RLM_MODULE_OK);	/* A query succeeded, were done! */
+		return sql_batch_write_next(write);
+	}
+
+next:
+	write->pair = cf_pair_find_next(rctx->section->cs, write->pair, rctx->attr);
+	if (!write->pair) {
+		RDEBUG("No additional queries configured");
+		sql_batch_write_finish(write, RLM_MODULE_NOOP);
+	} else {
+		RDEBUG("Trying next query...");
+	}
+
+	return sql_batch_write_next(write);
+}
+
+/** Process query results until we have to wait for one
+ *
+ * Drivers without asynchronous support complete every query
+ * immediately, so this loops, rather than recursing.
+ */
+static void sql_batch_write_run(sql_batch_write_t *write, sql_rcode_t ret)
+{
+	while (ret != RLM_SQL_YIELD) ret = sql_batch_write_process(write, ret);
+}
+
+/** Release the connection, and resume the requests in the batch
+ *
+ * Requests are only acknowledged once their queries have been
+ * committed.
+ */
+static void sql_batch_write_complete(sql_batch_write_t *write)
+{
+	rlm_sql_t const	*inst = write->batch->inst;
+	fr_dlist_t	*entry, *next;
+
+	if (write->handle) {
+		fr_pool_connection_release(inst->pool, NULL, write->handle);
+		write->handle = NULL;
+	}
+
+	for (entry = FR_DLIST_FIRST(write->done); entry; entry = next) {
+		sql_batch_req_t *rctx = fr_ptr_to_type(sql_batch_req_t, entry, entry);
+
+		next = FR_DLIST_NEXT(write->done, entry);
+		fr_dlist_remove(entry);
+		rctx->write = NULL;
+
+		unlang_resumable(rctx->request);
+	}
+
+	talloc_free(write);
+}
+
+static int _sql_batch_write_free(sql_batch_write_t *write)
+{
+	rlm_sql_t const	*inst = write->batch->inst;
+	fr_dlist_t	*entry, *next;
+
+	/*
+	 *	Only happens if the thread is exiting with
+	 *	a query in progress, so the connection can't
+	 *	be reused.
+	 */
+	if (write->handle) fr_pool_connection_close(inst->pool, NULL, write->handle);
+
+	for (entry = FR_DLIST_FIRST(write->todo); entry; entry = next) {
+		next = FR_DLIST_NEXT(write->todo, entry);
+		(fr_ptr_to_type(sql_batch_req_t, entry, entry))->write = NULL;
+		fr_dlist_remove(entry);
+	}
+
+	for (entry = FR_DLIST_FIRST(write->done); entry; entry = next) {
+		next = FR_DLIST_NEXT(write->done, entry);
+		(fr_ptr_to_type(sql_batch_req_t, entry, entry))->write = NULL;
+		fr_dlist_remove(entry);
+	}
+
+	return 0;
+}
+
+/** Write a batch, and resume the requests in it
+ *
+ * The queries are run in a single transaction.  If the transaction fails,
+ * it's rolled back, and the queries are run again individually, so one bad
+ * request doesn't fail the rest of the batch.
+ */
+static void _sql_batch_flush(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	sql_batch_t		*batch = talloc_get_type_abort(uctx, sql_batch_t);
+	rlm_sql_t const		*inst = batch->inst;
+	sql_batch_write_t	*write;
+	fr_dlist_t		*entry, *next;
+
+	batch->ev = NULL;
+	if (!batch->num) return;
+
+	DEBUG2("Writing batch of %u %s queries", batch->num, cf_section_name1(batch->section->cs));
+
+	MEM(write = talloc_zero(batch, sql_batch_write_t));
+	write->batch = batch;
+	write->txn = true;
+	FR_DLIST_INIT(write->todo);
+	FR_DLIST_INIT(write->done);
+	talloc_set_destructor(write, _sql_batch_write_free);
+
+	/*
+	 *	New requests go into the next batch.
+	 */
+	for (entry = FR_DLIST_FIRST(batch->pending); entry; entry = next) {
+		sql_batch_req_t *rctx = fr_ptr_to_type(sql_batch_req_t, entry, entry);
+
+		next = FR_DLIST_NEXT(batch->pending, entry);
+		fr_dlist_remove(entry);
+		fr_dlist_insert_tail(&write->todo, entry);
+		rctx->write = write;
+	}
+	batch->num = 0;
+
+	/*
+	 *	Without a connection, the requests are failed.
+	 */
+	write->handle = fr_pool_connection_get(inst->pool, NULL);
+	if (!write->handle) {
+		write->txn = false;
+		sql_batch_write_run(write, sql_batch_write_next(write));
+		return;
+	}
+
+	sql_batch_write_run(write, sql_batch_write_statement(write, SQL_BATCH_BEGIN, "BEGIN"));
+}
+
+static rlm_rcode_t sql_batch_resume(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx)
+{
+	sql_batch_req_t		*rctx = talloc_get_type_abort(ctx, sql_batch_req_t);
+	rlm_rcode_t		rcode = rctx->rcode;
+
+	talloc_free(rctx);
+
+	return rcode;
+}
+
+static void sql_batch_signal(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			     fr_state_action_t action)
+{
+	sql_batch_req_t		*rctx = talloc_get_type_abort(ctx, sql_batch_req_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	/*
+	 *	Once the batch has been written, the request
+	 *	is no longer in any list.
+	 */
+	if (rctx->write) {
+		if (rctx->write->current == rctx) rctx->write->current = NULL;
+		fr_dlist_remove(&rctx->entry);
+	} else if (rctx->entry.next && (rctx->entry.next != &rctx->entry)) {
+		fr_dlist_remove(&rctx->entry);
+		rctx->batch->num--;
+	}
+
+	talloc_free(rctx);
+}
+
+/** Add a request to the thread's batch for a section
+ *
+ * The batch is written when it reaches batch_size, or batch_delay after
+ * the first request was added, whichever comes first.
+ */
+rlm_rcode_t sql_batch_add(sql_batch_t *batch, REQUEST *request, CONF_PAIR *pair)
+{
+	rlm_sql_t const		*inst = batch->inst;
+	sql_batch_req_t		*rctx;
+	struct timeval		when;
+
+	MEM(rctx = talloc_zero(request, sql_batch_req_t));
+	rctx->section = batch->section;
+	rctx->pair = pair;
+	rctx->attr = cf_pair_attr(pair);
+	rctx->request = request;
+	rctx->batch = batch;
+	rctx->rcode = RLM_MODULE_FAIL;
+
+	gettimeofday(&when, NULL);
+
+	if ((batch->num + 1) >= batch->section->batch_size) {
+		if (batch->ev) fr_event_timer_delete(batch->thread->el, &batch->ev);
+	} else if (!batch->ev) {
+		fr_timeval_add(&when, &when, &batch->section->batch_delay);
+	}
+
+	if (!batch->ev &&
+	    (fr_event_timer_insert(batch, batch->thread->el, &batch->ev, &when, _sql_batch_flush, batch) < 0)) {
+		RPERROR("Failed scheduling batch write");
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	fr_dlist_insert_tail(&batch->pending, &rctx->entry);
+	batch->num++;
+
+	RDEBUG2("Added to batch (%u/%u)", batch->num, batch->section->batch_size);
+
+	return unlang_module_yield(request, sql_batch_resume, sql_batch_signal, rctx);
+}
+
+static int _sql_batch_free(sql_batch_t *batch)
+{
+	fr_dlist_t *entry, *next;
+
+	/*
+	 *	Requests have already been told to stop,
+	 *	but don't leave them pointing at us.
+	 */
+	for (entry = FR_DLIST_FIRST(batch->pending); entry; entry = next) {
+		next = FR_DLIST_NEXT(batch->pending, entry);
+		fr_dlist_remove(entry);
+	}
+
+	return 0;
+}
+
+/** Allocate a thread's batch for a section
+ *
+ */
+sql_batch_t *sql_batch_alloc(rlm_sql_t *inst, rlm_sql_thread_t *thread, sql_acct_section_t *section)
+{
+	sql_batch_t *batch;
+
+	MEM(batch = talloc_zero(NULL, sql_batch_t));
+	batch->inst = inst;
+	batch->thread = thread;
+	batch->section = section;
+	FR_DLIST_INIT(batch->pending);
+	talloc_set_destructor(batch, _sql_batch_free);
+
+	return batch;
+}
+
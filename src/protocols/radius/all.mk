@@ -7,6 +7,7 @@ TARGET		:= libfreeradius-radius.a
 
 SOURCES		:= base.c \
 		   decode.c \
+		   detail.c \
 		   encode.c \
 		   list.c \
 		   packet.c \
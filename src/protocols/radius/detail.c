@@ -0,0 +1,344 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file protocols/radius/detail.c
+ * @brief Binary detail file records.
+ *
+ *  A binary detail file is a sequence of records.  Each record is a
+ *  fixed size header, followed by a RADIUS packet.  All fields are in
+ *  network byte order.
+ *
+ *	 0 -  3	magic (FR_RADIUS_DETAIL_MAGIC)
+ *	 4	version
+ *	 5	packet code
+ *	 6 -  7	reserved
+ *	 8 - 11	length of the record, including the header
+ *	12 - 15	"Done" once the record has been processed, otherwise zero
+ *	16 - 19	checksum of everything after the checksum
+ *	20 - 27	timestamp (seconds)
+ *	28 - 31	timestamp (microseconds)
+ *	32 - 34	address family of the src, dst and client addresses
+ *	35	reserved
+ *	36 - 51	src address
+ *	52 - 67	dst address
+ *	68 - 83	client address
+ *	84 - 85	src port
+ *	86 - 87	dst port
+ *	88 -	RADIUS packet, no more than MAX_PACKET_LEN bytes
+ *
+ *  The attributes are always encoded as for an Accounting-Request,
+ *  i.e. with a zero authentication vector, so they can be decoded
+ *  without the original packet.  The secret used to encode them is
+ *  fixed, so encrypted attributes are obscured, but not protected.
+ *  They're printed in the clear in text detail files.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#define DETAIL_VERSION		(1)
+
+#define DETAIL_CHECKSUM_OFFSET	(16)
+#define DETAIL_DATA_OFFSET	(20)
+
+/*
+ *	The encoder and decoder get the length of the secret from
+ *	talloc, so it's copied into a talloced buffer before use.
+ */
+static char const detail_secret[] = "detail";
+
+static inline void detail_put_u16(uint8_t *p, uint16_t value)
+{
+	value = htons(value);
+	memcpy(p, &value, sizeof(value));
+}
+
+static inline void detail_put_u32(uint8_t *p, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(p, &value, sizeof(value));
+}
+
+static inline uint16_t detail_get_u16(uint8_t const *p)
+{
+	uint16_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return ntohs(value);
+}
+
+static inline uint32_t detail_get_u32(uint8_t const *p)
+{
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return ntohl(value);
+}
+
+static void detail_put_ipaddr(uint8_t *af, uint8_t *p, fr_ipaddr_t const *ipaddr)
+{
+	memset(p, 0, 16);
+
+	switch (ipaddr->af) {
+	case AF_INET:
+		*af = 4;
+		memcpy(p, &ipaddr->addr.v4, 4);
+		break;
+
+	case AF_INET6:
+		*af = 6;
+		memcpy(p, &ipaddr->addr.v6, 16);
+		break;
+
+	default:
+		*af = 0;
+		break;
+	}
+}
+
+static int detail_get_ipaddr(fr_ipaddr_t *ipaddr, uint8_t af, uint8_t const *p)
+{
+	memset(ipaddr, 0, sizeof(*ipaddr));
+
+	switch (af) {
+	case 0:
+		ipaddr->af = AF_UNSPEC;
+		break;
+
+	case 4:
+		ipaddr->af = AF_INET;
+		ipaddr->prefix = 32;
+		memcpy(&ipaddr->addr.v4, p, 4);
+		break;
+
+	case 6:
+		ipaddr->af = AF_INET6;
+		ipaddr->prefix = 128;
+		memcpy(&ipaddr->addr.v6, p, 16);
+		break;
+
+	default:
+		fr_strerror_printf("Invalid address family %u", af);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Check whether data is the start of a binary detail record
+ *
+ * @param[in] data	to check.
+ * @param[in] data_len	of the data.
+ * @return true if the data starts with the magic number.
+ */
+bool fr_radius_detail_is_binary(uint8_t const *data, size_t data_len)
+{
+	return (data_len >= 4) && (memcmp(data, FR_RADIUS_DETAIL_MAGIC, 4) == 0);
+}
+
+/** Get the length of the binary detail record at the start of a buffer
+ *
+ * Only the header is checked.  Use #fr_radius_detail_decode to check
+ * the rest of the record.
+ *
+ * @param[in] data	the record starts at.
+ * @param[in] data_len	of the data we have.
+ * @return
+ *	- >0 the length of the record.  It may be more than data_len.
+ *	- 0 we need more data to find the length.
+ *	- <0 the header is invalid.
+ */
+ssize_t fr_radius_detail_record_len(uint8_t const *data, size_t data_len)
+{
+	uint32_t len;
+
+	if (data_len < (DETAIL_CHECKSUM_OFFSET)) return 0;
+
+	if (!fr_radius_detail_is_binary(data, data_len)) {
+		fr_strerror_printf("Invalid magic number");
+		return -1;
+	}
+
+	if (data[4] != DETAIL_VERSION) {
+		fr_strerror_printf("Unsupported version %u", data[4]);
+		return -1;
+	}
+
+	len = detail_get_u32(data + 8);
+	if ((len < (FR_RADIUS_DETAIL_HDR_LEN + 20)) || (len > FR_RADIUS_DETAIL_MAX_LEN)) {
+		fr_strerror_printf("Invalid record length %u", len);
+		return -1;
+	}
+
+	return len;
+}
+
+/** Encode a list of VALUE_PAIRs as a binary detail record
+ *
+ * @param[out] buffer		to write the record to.
+ * @param[in] buffer_len	of the buffer.
+ * @param[in] detail		packet code, timestamp and addresses to write.
+ * @param[in] vps		to encode.  Internal attributes are skipped.
+ * @return
+ *	- >0 the length of the record.
+ *	- <0 on error.
+ */
+ssize_t fr_radius_detail_encode(uint8_t *buffer, size_t buffer_len,
+				fr_radius_detail_t const *detail, VALUE_PAIR *vps)
+{
+	ssize_t	slen;
+	uint8_t	*packet = buffer + FR_RADIUS_DETAIL_HDR_LEN;
+	size_t	packet_len;
+	char	*secret;
+
+	if (!is_radius_code(detail->code)) {
+		fr_strerror_printf("Invalid packet code %u", detail->code);
+		return -1;
+	}
+
+	if (buffer_len < (FR_RADIUS_DETAIL_HDR_LEN + RADIUS_HDR_LEN)) {
+		fr_strerror_printf("Insufficient room to encode detail record");
+		return -1;
+	}
+
+	/*
+	 *	The packet is checked the same way as one from the
+	 *	network when it's replayed, so it can't be any
+	 *	larger.  Attributes which don't fit are left out.
+	 */
+	packet_len = buffer_len - FR_RADIUS_DETAIL_HDR_LEN;
+	if (packet_len > MAX_PACKET_LEN) packet_len = MAX_PACKET_LEN;
+
+	secret = talloc_typed_strdup(NULL, detail_secret);
+	if (!secret) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	slen = fr_radius_encode(packet, packet_len, NULL,
+				secret, talloc_array_length(secret) - 1, FR_CODE_ACCOUNTING_REQUEST, 0, vps);
+	talloc_free(secret);
+	if (slen < 0) return slen;
+
+	packet[0] = detail->code;
+
+	memset(buffer, 0, FR_RADIUS_DETAIL_HDR_LEN);
+	memcpy(buffer, FR_RADIUS_DETAIL_MAGIC, 4);
+	buffer[4] = DETAIL_VERSION;
+	buffer[5] = detail->code;
+	detail_put_u32(buffer + 8, FR_RADIUS_DETAIL_HDR_LEN + slen);
+
+	detail_put_u32(buffer + 20, (uint32_t) ((uint64_t) detail->timestamp.tv_sec >> 32));
+	detail_put_u32(buffer + 24, (uint32_t) detail->timestamp.tv_sec);
+	detail_put_u32(buffer + 28, (uint32_t) detail->timestamp.tv_usec);
+
+	detail_put_ipaddr(buffer + 32, buffer + 36, &detail->src_ipaddr);
+	detail_put_ipaddr(buffer + 33, buffer + 52, &detail->dst_ipaddr);
+	detail_put_ipaddr(buffer + 34, buffer + 68, &detail->client_ipaddr);
+	detail_put_u16(buffer + 84, detail->src_port);
+	detail_put_u16(buffer + 86, detail->dst_port);
+
+	detail_put_u32(buffer + DETAIL_CHECKSUM_OFFSET,
+		       fr_hash(buffer + DETAIL_DATA_OFFSET, (FR_RADIUS_DETAIL_HDR_LEN + slen) - DETAIL_DATA_OFFSET));
+
+	return FR_RADIUS_DETAIL_HDR_LEN + slen;
+}
+
+/** Check a binary detail record, and decode its header
+ *
+ * @param[out] detail	the decoded header.  detail->packet points into data.
+ * @param[in] data	the record starts at.
+ * @param[in] data_len	of the data.  Must include the whole record.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the record is invalid.
+ */
+int fr_radius_detail_decode(fr_radius_detail_t *detail, uint8_t *data, size_t data_len)
+{
+	ssize_t		len;
+	uint64_t	sec;
+
+	len = fr_radius_detail_record_len(data, data_len);
+	if (len < 0) return -1;
+
+	if ((len == 0) || ((size_t) len > data_len)) {
+		fr_strerror_printf("Record is truncated");
+		return -1;
+	}
+
+	if (detail_get_u32(data + DETAIL_CHECKSUM_OFFSET) !=
+	    fr_hash(data + DETAIL_DATA_OFFSET, len - DETAIL_DATA_OFFSET)) {
+		fr_strerror_printf("Checksum mismatch");
+		return -1;
+	}
+
+	memset(detail, 0, sizeof(*detail));
+
+	detail->code = data[5];
+	detail->done = (memcmp(data + FR_RADIUS_DETAIL_DONE_OFFSET, "Done", 4) == 0);
+
+	sec = ((uint64_t) detail_get_u32(data + 20) << 32) | detail_get_u32(data + 24);
+	detail->timestamp.tv_sec = sec;
+	detail->timestamp.tv_usec = detail_get_u32(data + 28);
+
+	if ((detail_get_ipaddr(&detail->src_ipaddr, data[32], data + 36) < 0) ||
+	    (detail_get_ipaddr(&detail->dst_ipaddr, data[33], data + 52) < 0) ||
+	    (detail_get_ipaddr(&detail->client_ipaddr, data[34], data + 68) < 0)) return -1;
+
+	detail->src_port = detail_get_u16(data + 84);
+	detail->dst_port = detail_get_u16(data + 86);
+
+	detail->packet = data + FR_RADIUS_DETAIL_HDR_LEN;
+	detail->packet_len = len - FR_RADIUS_DETAIL_HDR_LEN;
+
+	return 0;
+}
+
+/** Decode the attributes of a binary detail record
+ *
+ * @param[in] ctx	to allocate the VALUE_PAIRs in.
+ * @param[out] vps	where to add the VALUE_PAIRs.
+ * @param[in] detail	as returned by #fr_radius_detail_decode.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the packet is malformed.
+ */
+int fr_radius_detail_decode_pairs(TALLOC_CTX *ctx, VALUE_PAIR **vps, fr_radius_detail_t const *detail)
+{
+	size_t		packet_len = detail->packet_len;
+	decode_fail_t	reason;
+	char		*secret;
+	int		ret;
+
+	if (!fr_radius_ok(detail->packet, &packet_len, 0, false, &reason)) return -1;
+
+	secret = talloc_typed_strdup(NULL, detail_secret);
+	if (!secret) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	ret = fr_radius_decode(ctx, detail->packet, packet_len, detail->packet,
+			       secret, talloc_array_length(secret) - 1, vps);
+	talloc_free(secret);
+
+	return (ret < 0) ? -1 : 0;
+}
@@ -98,6 +98,45 @@ ssize_t		fr_radius_decode(TALLOC_CTX *ctx, uint8_t *packet, size_t packet_len, u
 
 void		fr_radius_print_hex(FILE *fp, uint8_t const *packet, size_t packet_len);
 
+/*
+ *	protocols/radius/detail.c
+ */
+#define FR_RADIUS_DETAIL_MAGIC		"\xfd" "DET"
+#define FR_RADIUS_DETAIL_HDR_LEN	(88)
+#define FR_RADIUS_DETAIL_DONE_OFFSET	(12)	//!< Where "Done" is written once a record is processed.
+#define FR_RADIUS_DETAIL_MAX_LEN	(FR_RADIUS_DETAIL_HDR_LEN + MAX_PACKET_LEN)	//!< Packets are replayed, so no larger than we accept.
+
+/** The header of a binary detail record
+ *
+ */
+typedef struct {
+	unsigned int		code;			//!< Of the original packet.
+	struct timeval		timestamp;		//!< When the original packet was received.
+
+	fr_ipaddr_t		src_ipaddr;
+	uint16_t		src_port;
+	fr_ipaddr_t		dst_ipaddr;
+	uint16_t		dst_port;
+	fr_ipaddr_t		client_ipaddr;
+
+	bool			done;			//!< The record has already been processed.
+
+	uint8_t			*packet;		//!< RADIUS packet, only set when decoding.
+	size_t			packet_len;
+} fr_radius_detail_t;
+
+bool		fr_radius_detail_is_binary(uint8_t const *data, size_t data_len);
+
+ssize_t		fr_radius_detail_record_len(uint8_t const *data, size_t data_len);
+
+ssize_t		fr_radius_detail_encode(uint8_t *buffer, size_t buffer_len,
+					fr_radius_detail_t const *detail, VALUE_PAIR *vps) CC_HINT(nonnull(1,3));
+
+int		fr_radius_detail_decode(fr_radius_detail_t *detail, uint8_t *data, size_t data_len) CC_HINT(nonnull);
+
+int		fr_radius_detail_decode_pairs(TALLOC_CTX *ctx, VALUE_PAIR **vps,
+					      fr_radius_detail_t const *detail) CC_HINT(nonnull(2,3));
+
 /*
  *	protocols/radius/packet.c
  */
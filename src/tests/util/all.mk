@@ -1,8 +1,35 @@
-SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk 
+SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk trie_test.mk \
+		cache_serialize_test.mk pair_head_test.mk dict_cache_test.mk \
+		radius_detail_test.mk dict_index_test.mk udp_mmsg_test.mk
 
 #
 #  These require pthread.
 #
 ifneq "$(findstring thread,${CFLAGS})" ""
-SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk
+SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk \
+		work_deque_test.mk schedule_sockets_test.mk worker_steal_test.mk pool_thread_test.mk
+
+#
+#  Benchmarks allocations per request, with and without the request slab.
+#
+SUBMAKEFILES += request_slab_test.mk
+
+#
+#  Benchmarks worker latency with PBKDF2 run inline, and offloaded.
+#
+ifneq "$(OPENSSL_LIBS)" ""
+SUBMAKEFILES += offload_test.mk
+endif
+endif
+
+#
+#  Drives the batched SQL write state machine through failures.
+#
+SUBMAKEFILES += sql_batch_write_test.mk
+
+#
+#  Benchmarks batched accounting inserts against the SQLite driver.
+#
+ifneq "$(findstring rlm_sql_sqlite.la,$(ALL_TGTS))" ""
+SUBMAKEFILES += sql_batch_test.mk
 endif
@@ -0,0 +1,291 @@
+/*
+ * cache_serialize_test.c	Compare the text and binary cache entry formats
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/io/time.h>
+
+#include "../../modules/rlm_cache/rlm_cache.h"
+#include "../../modules/rlm_cache/serialize.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/* Linker hacks */
+char const *get_radius_dir(void)
+{
+	return NULL;
+}
+
+module_instance_t *module_find_with_method(UNUSED rlm_components_t *method,
+					   UNUSED CONF_SECTION *modules, UNUSED char const *name)
+{
+	return NULL;
+}
+
+main_config_t		main_config;				//!< Main server configuration.
+
+void *module_thread_instance_find(UNUSED void *inst)
+{
+	return NULL;
+}
+
+/* Linker hacks */
+
+/*
+ *	A typical authorization entry.
+ */
+static char const *entry_maps[] = {
+	"&reply:Reply-Message := 'Welcome back, your session has been restored from the cache'",
+	"&reply:Session-Timeout := 3600",
+	"&reply:Idle-Timeout := 600",
+	"&reply:Acct-Interim-Interval := 300",
+	"&reply:Framed-IP-Address := 192.0.2.1",
+	"&reply:Framed-IPv6-Prefix := 2001:db8:1234::/48",
+	"&reply:Class := 0x0123456789abcdef0123456789abcdef",
+	"&reply:Filter-Id += 'std.in'",
+	"&reply:Filter-Id += 'std.out'",
+	"&control:Cleartext-Password := 'supersecret'",
+	NULL
+};
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: cache_serialize_test [OPTS]\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <num>               Number of times to encode and decode the entry.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+/** Check that a decoded entry matches the original
+ *
+ */
+static void entry_cmp(char const *format, rlm_cache_entry_t const *a, rlm_cache_entry_t const *b)
+{
+	vp_map_t const *x, *y;
+
+	if ((a->created != b->created) || (a->expires != b->expires)) {
+		fprintf(stderr, "%s: created/expires mismatch\n", format);
+		exit(EXIT_FAILURE);
+	}
+
+	for (x = a->maps, y = b->maps; x && y; x = x->next, y = y->next) {
+		if ((x->op != y->op) ||
+		    (x->lhs->tmpl_da != y->lhs->tmpl_da) ||
+		    (x->lhs->tmpl_list != y->lhs->tmpl_list) ||
+		    (x->lhs->tmpl_tag != y->lhs->tmpl_tag) ||
+		    (fr_value_box_cmp(&x->rhs->tmpl_value, &y->rhs->tmpl_value) != 0)) {
+			char buffer[1024];
+
+			map_snprint(buffer, sizeof(buffer), x);
+			fprintf(stderr, "%s: map \"%s\" didn't survive decoding\n", format, buffer);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (x || y) {
+		fprintf(stderr, "%s: decoded entry has a different number of maps\n", format);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, num = 100000;
+	char const		*radius_dir = RADDBDIR;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	rlm_cache_entry_t	*entry, *out;
+	vp_map_t		**last;
+	char			*text, *copy;
+	uint8_t			*binary;
+	size_t			text_len, binary_len;
+	fr_time_t		start, text_enc, text_dec, binary_enc, binary_dec;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "d:D:n:xh")) != EOF) switch (c) {
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (num <= 0) usage();
+
+	fr_time_start();
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("cache_serialize_test");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_read(dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("cache_serialize_test");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Build the entry the same way rlm_cache does, with
+	 *	the right hand side of each map as data.
+	 */
+	entry = talloc_zero(autofree, rlm_cache_entry_t);
+	entry->created = 1514764800;
+	entry->expires = entry->created + 3600;
+
+	last = &entry->maps;
+	for (i = 0; entry_maps[i]; i++) {
+		vp_map_t *map;
+
+		if ((map_afrom_attr_str(entry, &map, entry_maps[i],
+					REQUEST_CURRENT, PAIR_LIST_REQUEST,
+					REQUEST_CURRENT, PAIR_LIST_REQUEST) < 0) ||
+		    (tmpl_cast_in_place(map->rhs, map->lhs->tmpl_da->type, map->lhs->tmpl_da) < 0)) {
+			fr_perror("cache_serialize_test: Failed parsing \"%s\"", entry_maps[i]);
+			exit(EXIT_FAILURE);
+		}
+
+		*last = map;
+		last = &map->next;
+	}
+
+	/*
+	 *	Check both formats round trip.
+	 */
+	if (cache_serialize(autofree, &text, entry) < 0) {
+		fr_perror("cache_serialize_test: Failed serializing text");
+		exit(EXIT_FAILURE);
+	}
+	text_len = talloc_array_length(text) - 1;
+
+	if (cache_serialize_binary(autofree, &binary, entry) < 0) {
+		fr_perror("cache_serialize_test: Failed serializing binary");
+		exit(EXIT_FAILURE);
+	}
+	binary_len = talloc_array_length(binary);
+
+	if (cache_serialized_is_binary((uint8_t const *)text, text_len) ||
+	    !cache_serialized_is_binary(binary, binary_len)) {
+		fprintf(stderr, "cache_serialize_test: Failed detecting the format of entries\n");
+		exit(EXIT_FAILURE);
+	}
+
+	copy = talloc_array(autofree, char, text_len + 1);
+
+	memcpy(copy, text, text_len + 1);
+	out = talloc_zero(autofree, rlm_cache_entry_t);
+	if (cache_deserialize(out, copy, text_len) < 0) {
+		fr_perror("cache_serialize_test: Failed deserializing text");
+		exit(EXIT_FAILURE);
+	}
+	entry_cmp("text", entry, out);
+	talloc_free(out);
+
+	out = talloc_zero(autofree, rlm_cache_entry_t);
+	if (cache_deserialize_binary(out, binary, binary_len) < 0) {
+		fr_perror("cache_serialize_test: Failed deserializing binary");
+		exit(EXIT_FAILURE);
+	}
+	entry_cmp("binary", entry, out);
+	talloc_free(out);
+
+	/*
+	 *	Truncated binary entries must be rejected.
+	 */
+	out = talloc_zero(autofree, rlm_cache_entry_t);
+	if (cache_deserialize_binary(out, binary, binary_len - 1) == 0) {
+		fprintf(stderr, "cache_serialize_test: Accepted truncated binary entry\n");
+		exit(EXIT_FAILURE);
+	}
+	talloc_free(out);
+
+	if (debug_lvl) printf("%s", text);
+
+	/*
+	 *	And time them.
+	 */
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		char *tmp;
+
+		cache_serialize(NULL, &tmp, entry);
+		talloc_free(tmp);
+	}
+	text_enc = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		memcpy(copy, text, text_len + 1);
+		out = talloc_zero(NULL, rlm_cache_entry_t);
+		cache_deserialize(out, copy, text_len);
+		talloc_free(out);
+	}
+	text_dec = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		uint8_t *tmp;
+
+		cache_serialize_binary(NULL, &tmp, entry);
+		talloc_free(tmp);
+	}
+	binary_enc = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		out = talloc_zero(NULL, rlm_cache_entry_t);
+		cache_deserialize_binary(out, binary, binary_len);
+		talloc_free(out);
+	}
+	binary_dec = fr_time() - start;
+
+	printf("format    size  encode (ns)  decode (ns)\n");
+	printf("text    %6zu  %11" PRIu64 "  %11" PRIu64 "\n", text_len, text_enc / num, text_dec / num);
+	printf("binary  %6zu  %11" PRIu64 "  %11" PRIu64 "\n", binary_len, binary_enc / num, binary_dec / num);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := cache_serialize_test
+
+SOURCES		:= cache_serialize_test.c ../../modules/rlm_cache/serialize.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,292 @@
+/*
+ * dict_cache_test.c	Tests for the precompiled dictionary cache
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	The dictionaries are written to a temporary directory, so we
+ *	can change them underneath the cache.
+ */
+static char const *dictionary =
+	"VENDOR		Cache-Test			32473\n"
+	"ATTRIBUTE	Cache-Test-Integer		1	integer\n"
+	"ATTRIBUTE	Cache-Test-String		2	string\n"
+	"ATTRIBUTE	Cache-Test-TLV			3	tlv\n"
+	"ATTRIBUTE	Cache-Test-TLV-Child		3.1	ipaddr\n"
+	"$INCLUDE dictionary.values\n"
+	"BEGIN-VENDOR	Cache-Test\n"
+	"ATTRIBUTE	Cache-Test-Vendor		1	string\n"
+	"END-VENDOR	Cache-Test\n";
+
+/*
+ *	"Bravo" is replaced with "Delta", which is the same length, so
+ *	only the mtime tells the cache that the file has changed.
+ */
+static char const *values =
+	"VALUE	Cache-Test-Integer		Alpha			1\n"
+	"VALUE	Cache-Test-Integer		Bravo			2\n";
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: dict_cache_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS fail(char const *dir, char const *msg)
+{
+	fprintf(stderr, "dict_cache_test: %s\n", msg);
+	fprintf(stderr, "dict_cache_test: Leaving files in %s\n", dir);
+
+	exit(EXIT_FAILURE);
+}
+
+static void write_file(char const *dir, char const *name, char const *contents)
+{
+	char	path[PATH_MAX];
+	FILE	*fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	/*
+	 *	"r+" if the file exists, so it keeps its inode.
+	 */
+	fp = fopen(path, "r+");
+	if (!fp) fp = fopen(path, "w");
+	if (!fp || (fputs(contents, fp) == EOF) || (fclose(fp) != 0)) {
+		fprintf(stderr, "dict_cache_test: Failed writing %s: %s\n", path, fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Set the mtime of a file
+ *
+ */
+static void set_mtime(char const *dir, char const *name, time_t mtime)
+{
+	char		path[PATH_MAX];
+	struct utimbuf	times = { .actime = mtime, .modtime = mtime };
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	if (utime(path, &times) < 0) {
+		fprintf(stderr, "dict_cache_test: Failed setting mtime of %s: %s\n", path, fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Count the cache files in a directory
+ *
+ */
+static int num_caches(char const *dir)
+{
+	DIR		*d;
+	struct dirent	*de;
+	int		num = 0;
+
+	d = opendir(dir);
+	if (!d) return -1;
+
+	while ((de = readdir(d)) != NULL) {
+		size_t len = strlen(de->d_name);
+
+		if ((len > 5) && (strcmp(de->d_name + len - 5, ".dict") == 0)) num++;
+	}
+	closedir(d);
+
+	return num;
+}
+
+/** Remove the files in a directory, and the directory
+ *
+ */
+static void remove_dir(char const *dir)
+{
+	DIR		*d;
+	struct dirent	*de;
+	char		path[PATH_MAX];
+
+	d = opendir(dir);
+	if (!d) return;
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.') continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		(void) unlink(path);
+	}
+	closedir(d);
+
+	(void) rmdir(dir);
+}
+
+/** Load the test dictionary, and check that it has everything we defined
+ *
+ * @return the alias of Cache-Test-Integer = 2.
+ */
+static char const *dict_check(TALLOC_CTX *ctx, char const *dir)
+{
+	fr_dict_t		*dict = NULL;
+	fr_dict_attr_t const	*da, *child;
+	fr_dict_enum_t		*enumv;
+	fr_value_box_t		value = { .type = FR_TYPE_UINT32, .vb_uint32 = 2 };
+	char const		*alias;
+
+	/*
+	 *	The dictionaries aren't freed, as the first one is
+	 *	used as the internal dictionary.
+	 */
+	if (fr_dict_from_file(ctx, &dict, dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("dict_cache_test");
+		fail(dir, "Failed loading dictionary");
+	}
+
+	da = fr_dict_attr_by_name(dict, "Cache-Test-Integer");
+	if (!da || (da->attr != 1) || (da->type != FR_TYPE_UINT32)) fail(dir, "Cache-Test-Integer is wrong");
+
+	enumv = fr_dict_enum_by_alias(dict, da, "Alpha");
+	if (!enumv || (enumv->value->vb_uint32 != 1)) fail(dir, "Cache-Test-Integer Alpha is wrong");
+
+	alias = fr_dict_enum_alias_by_value(dict, da, &value);
+	if (!alias) fail(dir, "Cache-Test-Integer has no alias for 2");
+	if (fr_dict_enum_by_alias(dict, da, alias) == NULL) fail(dir, "Cache-Test-Integer alias lookup failed");
+
+	da = fr_dict_attr_by_name(dict, "Cache-Test-String");
+	if (!da || (da->attr != 2) || (da->type != FR_TYPE_STRING)) fail(dir, "Cache-Test-String is wrong");
+
+	da = fr_dict_attr_by_name(dict, "Cache-Test-TLV");
+	if (!da || (da->type != FR_TYPE_TLV)) fail(dir, "Cache-Test-TLV is wrong");
+
+	child = fr_dict_attr_child_by_num(da, 1);
+	if (!child || (child != fr_dict_attr_by_name(dict, "Cache-Test-TLV-Child")) ||
+	    (child->type != FR_TYPE_IPV4_ADDR)) fail(dir, "Cache-Test-TLV-Child is wrong");
+
+	if (fr_dict_vendor_by_name(dict, "Cache-Test") != 32473) fail(dir, "Cache-Test vendor is wrong");
+
+	da = fr_dict_attr_by_name(dict, "Cache-Test-Vendor");
+	if (!da || (da->vendor != 32473) || (da->attr != 1)) fail(dir, "Cache-Test-Vendor is wrong");
+
+	if (fr_dict_attr_by_num(dict, 32473, 1) != da) fail(dir, "Cache-Test-Vendor lookup by number failed");
+
+	if (debug_lvl) printf("Cache-Test-Integer 2 is %s\n", alias);
+
+	return alias;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char			dir[] = "/tmp/dict_cache_test.XXXXXX";
+	char			cache_dir[sizeof(dir) + 6];
+	char const		*alias;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "xh")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "dict_cache_test: Failed creating directory: %s\n", fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+	if (mkdir(cache_dir, 0700) < 0) {
+		fprintf(stderr, "dict_cache_test: Failed creating %s: %s\n", cache_dir, fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+	setenv("FR_DICT_CACHE_DIR", cache_dir, 1);
+
+	write_file(dir, FR_DICTIONARY_FILE, dictionary);
+	write_file(dir, "dictionary.values", values);
+
+	/*
+	 *	Well in the past, so the rewrite below can put
+	 *	the mtime back exactly.
+	 */
+	set_mtime(dir, FR_DICTIONARY_FILE, 1000000000);
+	set_mtime(dir, "dictionary.values", 1000000000);
+
+	/*
+	 *	No cache yet.  The files are read, and the cache
+	 *	is written.
+	 */
+	alias = dict_check(autofree, dir);
+	if (strcmp(alias, "Bravo") != 0) fail(dir, "Wrong alias reading the dictionary files");
+	if (num_caches(cache_dir) != 1) fail(dir, "Dictionary cache wasn't written");
+
+	/*
+	 *	Change the contents, but not the size, inode, or
+	 *	mtime.  The cache doesn't notice, so if the old
+	 *	alias comes back, the definitions came from the cache.
+	 */
+	write_file(dir, "dictionary.values", "VALUE	Cache-Test-Integer		Alpha			1\n"
+					     "VALUE	Cache-Test-Integer		Delta			2\n");
+	set_mtime(dir, "dictionary.values", 1000000000);
+
+	alias = dict_check(autofree, dir);
+	if (strcmp(alias, "Bravo") != 0) fail(dir, "Dictionary wasn't loaded from the cache");
+
+	/*
+	 *	Now change the mtime.  The cache is out of date,
+	 *	so the files are read again, and a new cache is
+	 *	written in place of the old one.
+	 */
+	set_mtime(dir, "dictionary.values", 1000000010);
+
+	alias = dict_check(autofree, dir);
+	if (strcmp(alias, "Delta") != 0) fail(dir, "Dictionary cache wasn't invalidated by the mtime changing");
+	if (num_caches(cache_dir) != 1) fail(dir, "Dictionary cache wasn't replaced");
+
+	/*
+	 *	And the new cache has the new definitions.
+	 */
+	alias = dict_check(autofree, dir);
+	if (strcmp(alias, "Delta") != 0) fail(dir, "Replaced dictionary cache has the wrong definitions");
+
+	remove_dir(cache_dir);
+	remove_dir(dir);
+
+	talloc_free(autofree);
+
+	return 0;
+}
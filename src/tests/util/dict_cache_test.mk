@@ -0,0 +1,6 @@
+TARGET := dict_cache_test
+
+SOURCES		:= dict_cache_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,369 @@
+/*
+ * dict_index_test.c	Tests for the name indexes of frozen dictionaries
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Enum values above this aren't looked for.  It covers nearly
+ *	every VALUE in the dictionaries, without taking forever.
+ */
+#define MAX_ENUM_VALUE	(4096)
+
+/*
+ *	Names which aren't defined, but look like ones which are.
+ */
+static char const *unknown_names[] = {
+	"",
+	"User",
+	"User-Nam",
+	"User-Name-",
+	"User-Namex",
+	"xUser-Name",
+	"Vendor-Specific-",
+	"Not-A-Real-Attribute",
+	NULL
+};
+
+typedef enum {
+	LOOKUP_ATTR = 0,				//!< fr_dict_attr_by_name.
+	LOOKUP_ATTR_SUBSTR,				//!< fr_dict_attr_by_name_substr.
+	LOOKUP_ENUM					//!< fr_dict_enum_by_alias.
+} lookup_type_t;
+
+/** A lookup, and what it returned before the dictionary was frozen
+ *
+ */
+typedef struct {
+	lookup_type_t		type;
+	fr_dict_attr_t const	*da;			//!< For enum lookups.
+	char const		*name;
+	void const		*found;			//!< Attribute or enum.
+	size_t			consumed;		//!< By substring lookups.
+} lookup_t;
+
+typedef struct {
+	fr_dict_t		*dict;
+	lookup_t		*lookups;
+	size_t			num;
+	size_t			hits;
+} lookup_list_t;
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: dict_index_test [OPTS]\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "dict_index_test: %s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+/** Do a lookup
+ *
+ */
+static void const *lookup_do(fr_dict_t *dict, lookup_t const *lookup, size_t *consumed)
+{
+	char const		*p = lookup->name;
+	fr_dict_attr_t const	*da;
+
+	*consumed = 0;
+
+	switch (lookup->type) {
+	case LOOKUP_ATTR:
+		return fr_dict_attr_by_name(dict, lookup->name);
+
+	case LOOKUP_ATTR_SUBSTR:
+		da = fr_dict_attr_by_name_substr(dict, &p);
+		*consumed = p - lookup->name;
+		return da;
+
+	case LOOKUP_ENUM:
+		return fr_dict_enum_by_alias(dict, lookup->da, lookup->name);
+	}
+
+	return NULL;
+}
+
+/** Record a lookup, and what it returns now
+ *
+ */
+static void lookup_add(lookup_list_t *list, lookup_type_t type, fr_dict_attr_t const *da, char const *name)
+{
+	lookup_t *lookup;
+
+	if (list->num == talloc_array_length(list->lookups)) {
+		list->lookups = talloc_realloc(NULL, list->lookups, lookup_t, (list->num * 2) + 1024);
+		if (!list->lookups) fail("Out of memory");
+	}
+
+	lookup = &list->lookups[list->num++];
+	lookup->type = type;
+	lookup->da = da;
+	lookup->name = talloc_typed_strdup(list->lookups, name);
+	lookup->found = lookup_do(list->dict, lookup, &lookup->consumed);
+
+	if (lookup->found) list->hits++;
+}
+
+/** Record a lookup of the name as given, folded to upper case, and folded to lower case
+ *
+ */
+static void lookup_add_cases(lookup_list_t *list, lookup_type_t type, fr_dict_attr_t const *da, char const *name)
+{
+	char	buffer[FR_DICT_ATTR_MAX_NAME_LEN + 32];
+	size_t	i;
+
+	lookup_add(list, type, da, name);
+
+	for (i = 0; name[i] && (i < sizeof(buffer) - 1); i++) buffer[i] = toupper((uint8_t) name[i]);
+	buffer[i] = '\0';
+	lookup_add(list, type, da, buffer);
+
+	for (i = 0; name[i] && (i < sizeof(buffer) - 1); i++) buffer[i] = tolower((uint8_t) name[i]);
+	buffer[i] = '\0';
+	lookup_add(list, type, da, buffer);
+}
+
+/** Record lookups of the aliases of an integer attribute
+ *
+ */
+static void lookup_add_enums(lookup_list_t *list, fr_dict_attr_t const *da)
+{
+	fr_value_box_t	value = { .type = da->type };
+	fr_dict_enum_t	*enumv;
+	unsigned int	i, max;
+
+	switch (da->type) {
+	case FR_TYPE_UINT8:
+		max = UINT8_MAX + 1;
+		break;
+
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+		max = MAX_ENUM_VALUE;
+		break;
+
+	default:
+		return;
+	}
+
+	for (i = 0; i < max; i++) {
+		switch (da->type) {
+		case FR_TYPE_UINT8:
+			value.vb_uint8 = i;
+			break;
+
+		case FR_TYPE_UINT16:
+			value.vb_uint16 = i;
+			break;
+
+		default:
+			value.vb_uint32 = i;
+			break;
+		}
+
+		enumv = fr_dict_enum_by_value(list->dict, da, &value);
+		if (!enumv) continue;
+
+		lookup_add_cases(list, LOOKUP_ENUM, da, enumv->alias);
+	}
+
+	/*
+	 *	An alias which belongs to a different attribute,
+	 *	and one which doesn't exist at all.
+	 */
+	lookup_add(list, LOOKUP_ENUM, da, "Access-Request");
+	lookup_add(list, LOOKUP_ENUM, da, "Not-A-Real-Value");
+}
+
+/** Record lookups of an attribute, and all of its children
+ *
+ */
+static void lookup_add_attrs(lookup_list_t *list, fr_dict_attr_t const *da)
+{
+	char		buffer[FR_DICT_ATTR_MAX_NAME_LEN + 32];
+	size_t		i;
+
+	if (da->parent) {
+		lookup_add_cases(list, LOOKUP_ATTR, NULL, da->name);
+
+		/*
+		 *	Substring lookups stop at the first character
+		 *	which can't be part of a name.
+		 */
+		snprintf(buffer, sizeof(buffer), "%s == foo", da->name);
+		lookup_add_cases(list, LOOKUP_ATTR_SUBSTR, NULL, buffer);
+
+		snprintf(buffer, sizeof(buffer), "%sx", da->name);
+		lookup_add(list, LOOKUP_ATTR, NULL, buffer);
+
+		lookup_add_enums(list, da);
+	}
+
+	if (!da->children) return;
+
+	for (i = 0; i < talloc_array_length(da->children); i++) {
+		fr_dict_attr_t const *bin;
+
+		for (bin = da->children[i]; bin; bin = bin->next) lookup_add_attrs(list, bin);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*radius_dir = RADDBDIR;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_attr_t const	*da, *service_type;
+	fr_value_box_t		value = { .type = FR_TYPE_UINT32 };
+	lookup_list_t		list;
+	size_t			i;
+	char const		**p;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "d:D:xh")) != EOF) switch (c) {
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	memset(&list, 0, sizeof(list));
+
+	if (fr_dict_from_file(autofree, &list.dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("dict_index_test");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_read(list.dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("dict_index_test");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Three aliases for one value.  The second doesn't take
+	 *	precedence, and the third replaces the first as the
+	 *	alias which is found by value.  All of them must
+	 *	still be found by alias.  "Start" is also used by
+	 *	another attribute, with a different value.
+	 */
+	service_type = fr_dict_attr_by_name(list.dict, "Service-Type");
+	da = fr_dict_attr_by_name(list.dict, "Acct-Status-Type");
+	if (!service_type || !da) fail("Missing definitions for Service-Type or Acct-Status-Type");
+
+	value.vb_uint32 = 1000;
+	if ((fr_dict_enum_add_alias(service_type, "Index-Test-Primary", &value, false, true) < 0) ||
+	    (fr_dict_enum_add_alias(service_type, "Index-Test-Secondary", &value, false, false) < 0) ||
+	    (fr_dict_enum_add_alias(service_type, "Start", &value, false, true) < 0)) {
+		fr_perror("dict_index_test: Failed adding enums");
+		exit(EXIT_FAILURE);
+	}
+
+	lookup_add_cases(&list, LOOKUP_ENUM, service_type, "Index-Test-Primary");
+	lookup_add_cases(&list, LOOKUP_ENUM, service_type, "Index-Test-Secondary");
+	lookup_add_cases(&list, LOOKUP_ENUM, service_type, "Start");
+	lookup_add_cases(&list, LOOKUP_ENUM, da, "Start");
+
+	if (!fr_dict_enum_by_alias(list.dict, service_type, "Index-Test-Primary")) fail("Replaced alias was lost");
+	if (strcmp(fr_dict_enum_alias_by_value(list.dict, service_type, &value), "Start") != 0) {
+		fail("Alias which takes precedence isn't found by value");
+	}
+
+	lookup_add_attrs(&list, fr_dict_root(list.dict));
+
+	for (p = unknown_names; *p; p++) {
+		lookup_add_cases(&list, LOOKUP_ATTR, NULL, *p);
+		lookup_add(&list, LOOKUP_ATTR_SUBSTR, NULL, *p);
+	}
+
+	if (debug_lvl) printf("Recorded %zu lookups, %zu found something\n", list.num, list.hits);
+
+	/*
+	 *	Sanity check that the walk found what we expect, so
+	 *	the comparisons below mean something.
+	 */
+	if (list.hits < 10000) fail("Too few lookups found anything");
+	if (fr_dict_enum_by_alias(list.dict, service_type, "start") ==
+	    fr_dict_enum_by_alias(list.dict, da, "START")) fail("Enum aliases aren't per attribute");
+
+	if (fr_dict_freeze(list.dict) < 0) {
+		fr_perror("dict_index_test");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	The indexes must give the same answers as the hash
+	 *	tables.  Freezing twice rebuilds them, which must
+	 *	give the same answers again.
+	 */
+	for (c = 0; c < 2; c++) {
+		for (i = 0; i < list.num; i++) {
+			lookup_t const	*lookup = &list.lookups[i];
+			void const	*found;
+			size_t		consumed;
+
+			found = lookup_do(list.dict, lookup, &consumed);
+			if ((found != lookup->found) || (consumed != lookup->consumed)) {
+				fprintf(stderr, "dict_index_test: Lookup of \"%s\"%s%s gave a different result "
+					"once the dictionary was frozen\n", lookup->name,
+					lookup->da ? " in " : "", lookup->da ? lookup->da->name : "");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if (fr_dict_freeze(list.dict) < 0) {
+			fr_perror("dict_index_test");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	talloc_free(list.lookups);
+	talloc_free(autofree);
+
+	return 0;
+}
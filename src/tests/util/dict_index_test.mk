@@ -0,0 +1,6 @@
+TARGET := dict_index_test
+
+SOURCES		:= dict_index_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
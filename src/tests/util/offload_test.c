@@ -0,0 +1,242 @@
+/*
+ * offload_test.c	Compare worker latency with PBKDF2 run inline, and offloaded
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/io/offload.h>
+
+#include <openssl/evp.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Emulates a worker with a backlog of PAP logins.  One in
+ *	"ratio" of them uses a PBKDF2-Password, and the rest use a
+ *	Cleartext-Password.  The latency of a login is the time from
+ *	the start of the run until its result is available to the
+ *	worker.
+ */
+typedef struct {
+	uint64_t		count;
+	fr_time_t		total;
+	fr_time_t		max;
+} latency_t;
+
+typedef struct {
+	uint8_t			password[16];
+	uint8_t			salt[16];
+	uint32_t		iterations;
+	uint8_t			digest[32];
+} pbkdf2_t;
+
+static fr_time_t		start;
+static uint32_t			outstanding;
+static latency_t		clear_latency;
+static latency_t		pbkdf2_latency;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: offload_test [OPTS]\n");
+	fprintf(stderr, "  -i <iterations>        PBKDF2 iterations (defaults to 10000).\n");
+	fprintf(stderr, "  -n <num>               Number of logins for each mode (defaults to 1000).\n");
+	fprintf(stderr, "  -r <ratio>             One in <ratio> logins uses PBKDF2 (defaults to 10).\n");
+	fprintf(stderr, "  -t <threads>           Number of offload threads (defaults to 2).\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void latency_add(latency_t *l)
+{
+	fr_time_t latency = fr_time() - start;
+
+	l->count++;
+	l->total += latency;
+	if (latency > l->max) l->max = latency;
+}
+
+static void pbkdf2_hash(void *data)
+{
+	pbkdf2_t *p = data;
+
+	if (PKCS5_PBKDF2_HMAC((char const *)p->password, sizeof(p->password),
+			      p->salt, sizeof(p->salt), (int)p->iterations,
+			      EVP_sha256(), sizeof(p->digest), p->digest) == 0) {
+		fprintf(stderr, "offload_test: PBKDF2 failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void pbkdf2_done(UNUSED void *data, UNUSED void *uctx)
+{
+	latency_add(&pbkdf2_latency);
+	outstanding--;
+}
+
+static void clear_login(void)
+{
+	uint8_t a[16] = { 0 }, b[16] = { 0 };
+
+	if (fr_digest_cmp(a, b, sizeof(a)) != 0) {
+		fprintf(stderr, "offload_test: Passwords don't match\n");
+		exit(EXIT_FAILURE);
+	}
+	latency_add(&clear_latency);
+}
+
+/** Run num logins, with the PBKDF2 ones offloaded if oq is set
+ *
+ */
+static fr_time_t run(fr_event_list_t *el, fr_offload_queue_t *oq, int num, int ratio, uint32_t iterations)
+{
+	pbkdf2_t		inline_job;
+	fr_offload_job_t	*job;
+	pbkdf2_t		*p;
+	int			i;
+
+	memset(&clear_latency, 0, sizeof(clear_latency));
+	memset(&pbkdf2_latency, 0, sizeof(pbkdf2_latency));
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		if ((i % ratio) != 0) {
+			clear_login();
+			continue;
+		}
+
+		if (!oq) {
+			memset(&inline_job, 0, sizeof(inline_job));
+			inline_job.iterations = iterations;
+			pbkdf2_hash(&inline_job);
+			latency_add(&pbkdf2_latency);
+			continue;
+		}
+
+		job = fr_offload_job_alloc(oq);
+		p = talloc_zero(job, pbkdf2_t);
+		if (!job || !p) {
+			fprintf(stderr, "offload_test: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		p->iterations = iterations;
+
+		if (fr_offload_job_submit(job, pbkdf2_hash, pbkdf2_done, p, NULL) < 0) {
+			fr_perror("offload_test");
+			exit(EXIT_FAILURE);
+		}
+		outstanding++;
+	}
+
+	/*
+	 *	Wait for the offloaded jobs.
+	 */
+	while (outstanding > 0) {
+		if (fr_event_corral(el, true) < 0) {
+			fr_perror("offload_test");
+			exit(EXIT_FAILURE);
+		}
+		fr_event_service(el);
+	}
+
+	return fr_time() - start;
+}
+
+static void print_latency(char const *mode, char const *login, latency_t const *l, fr_time_t total)
+{
+	printf("%-10s %-10s %7" PRIu64 "  %12.3f  %12.3f  %10.3f\n", mode, login, l->count,
+	       l->count ? ((double)l->total / l->count) / 1000000 : 0,
+	       (double)l->max / 1000000,
+	       (double)total / 1000000);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, num = 1000, ratio = 10, threads = 2;
+	uint32_t		iterations = 10000;
+	fr_event_list_t		*el;
+	fr_offload_t		*offload;
+	fr_offload_queue_t	*oq;
+	fr_time_t		total;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "i:n:r:t:h")) != EOF) switch (c) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'r':
+			ratio = atoi(optarg);
+			break;
+
+		case 't':
+			threads = atoi(optarg);
+			break;
+
+		case 'h':
+		default:
+			usage();
+		}
+
+	if ((num <= 0) || (ratio <= 0) || (threads <= 0) || (iterations == 0)) usage();
+
+	fr_time_start();
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "offload_test: Failed to create the event list\n");
+		exit(EXIT_FAILURE);
+	}
+
+	offload = fr_offload_create(autofree, threads, 0);
+	if (!offload) {
+		fr_perror("offload_test");
+		exit(EXIT_FAILURE);
+	}
+
+	oq = fr_offload_queue_create(autofree, offload, el);
+	if (!oq) {
+		fr_perror("offload_test");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("mode       login       logins  avg lat (ms)  max lat (ms)  total (ms)\n");
+
+	total = run(el, NULL, num, ratio, iterations);
+	print_latency("inline", "cleartext", &clear_latency, total);
+	print_latency("inline", "pbkdf2", &pbkdf2_latency, total);
+
+	total = run(el, oq, num, ratio, iterations);
+	print_latency("offload", "cleartext", &clear_latency, total);
+	print_latency("offload", "pbkdf2", &pbkdf2_latency, total);
+
+	talloc_free(oq);
+	talloc_free(autofree);
+
+	return 0;
+}
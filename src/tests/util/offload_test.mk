@@ -0,0 +1,6 @@
+TARGET := offload_test
+
+SOURCES		:= offload_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,355 @@
+/*
+ * pair_head_test.c	Compare building and searching VALUE_PAIR lists, with and without a list head
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/pair_head.h>
+#include <freeradius-devel/io/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/* Linker hacks */
+char const *get_radius_dir(void)
+{
+	return NULL;
+}
+
+module_instance_t *module_find_with_method(UNUSED rlm_components_t *method,
+					   UNUSED CONF_SECTION *modules, UNUSED char const *name)
+{
+	return NULL;
+}
+
+main_config_t		main_config;				//!< Main server configuration.
+
+void *module_thread_instance_find(UNUSED void *inst)
+{
+	return NULL;
+}
+
+/* Linker hacks */
+
+#define MAX_PAIRS	(256)
+#define MAX_LOOKUPS	(MAX_PAIRS + 16)
+
+/*
+ *	An Accounting-Request from a BNG, with 60 attributes.
+ */
+static char const *accounting_request =
+	"User-Name = \"bob@example.com\", "
+	"NAS-IP-Address = 192.0.2.1, "
+	"NAS-IPv6-Address = 2001:db8::1, "
+	"NAS-Identifier = \"bng01.example.com\", "
+	"NAS-Port = 4097, "
+	"NAS-Port-Id = \"ge-1/0/1.100:100-200\", "
+	"NAS-Port-Type = Ethernet, "
+	"Service-Type = Framed-User, "
+	"Framed-Protocol = PPP, "
+	"Framed-IP-Address = 198.51.100.23, "
+	"Framed-IP-Netmask = 255.255.255.255, "
+	"Framed-MTU = 1492, "
+	"Framed-Pool = \"residential\", "
+	"Framed-Interface-Id = 0011:22ff:fe33:4455, "
+	"Framed-IPv6-Prefix = 2001:db8:1000::/64, "
+	"Delegated-IPv6-Prefix = 2001:db8:2000::/56, "
+	"Framed-IPv6-Address = 2001:db8:1000::23, "
+	"Filter-Id = \"residential-in\", "
+	"Filter-Id += \"residential-out\", "
+	"Class = 0x0123456789abcdef, "
+	"Class += 0xfedcba9876543210, "
+	"Class += 0x00112233, "
+	"Calling-Station-Id = \"00-11-22-33-44-55\", "
+	"Called-Station-Id = \"bng01\", "
+	"Connect-Info = \"100BASE-TX\", "
+	"Operator-Name = \"1example.com\", "
+	"Chargeable-User-Identity = \"cui-1234567890\", "
+	"Acct-Status-Type = Interim-Update, "
+	"Acct-Delay-Time = 0, "
+	"Acct-Session-Id = \"0000abcd12345678\", "
+	"Acct-Multi-Session-Id = \"0000abcd00000001\", "
+	"Acct-Authentic = RADIUS, "
+	"Acct-Session-Time = 86400, "
+	"Acct-Input-Octets = 1234567890, "
+	"Acct-Output-Octets = 3456789012, "
+	"Acct-Input-Gigawords = 1, "
+	"Acct-Output-Gigawords = 12, "
+	"Acct-Input-Packets = 12345678, "
+	"Acct-Output-Packets = 23456789, "
+	"Acct-Link-Count = 1, "
+	"Acct-Interim-Interval = 900, "
+	"Event-Timestamp = 1514764800, "
+	"Cisco-AVPair = \"client-mac-address=0011.2233.4455\", "
+	"Cisco-AVPair += \"connect-progress=LAN Ses Up\", "
+	"Cisco-AVPair += \"nas-tx-speed=1000000000\", "
+	"Cisco-AVPair += \"nas-rx-speed=1000000000\", "
+	"Cisco-AVPair += \"ip:vrf-id=residential\", "
+	"Cisco-AVPair += \"ipv6:ipv6_inacl=residential-in-v6\", "
+	"Cisco-AVPair += \"ipv6:ipv6_outacl=residential-out-v6\", "
+	"Cisco-AVPair += \"accounting-list=default\", "
+	"Cisco-AVPair += \"parent-session-id=0000abcd00000001\", "
+	"Cisco-AVPair += \"traffic-class=input access-group name residential-in\", "
+	"Cisco-AVPair += \"traffic-class=output access-group name residential-out\", "
+	"WISPr-Location-Name = \"Example,Example_Street\", "
+	"WISPr-Location-ID = \"isocc=us,cc=1,ac=408,network=Example\", "
+	"Proxy-State = 0x01, "
+	"Proxy-State += 0x02, "
+	"Idle-Timeout = 3600, "
+	"Session-Timeout = 86400, "
+	"Acct-Terminate-Cause = User-Request";
+
+/*
+ *	Attributes a policy typically checks for, but which
+ *	aren't in accounting requests.
+ */
+static char const *missing_attrs[] = {
+	"User-Password",
+	"CHAP-Password",
+	"EAP-Message",
+	"Message-Authenticator",
+	"State",
+	"Reply-Message",
+	"Framed-Route",
+	"Login-IP-Host",
+	NULL
+};
+
+static char const	*secret;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: pair_head_test [OPTS]\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -f <file>              Read packets from a file, in the same format as radclient.\n");
+	fprintf(stderr, "  -n <num>               Number of iterations for each mode (defaults to 100000).\n");
+
+	exit(EXIT_FAILURE);
+}
+
+/** Encode the attributes as an Accounting-Request, and decode them again
+ *
+ * So the list looks exactly like one we received from the network.
+ */
+static RADIUS_PACKET *packet_from_vps(TALLOC_CTX *ctx, VALUE_PAIR *vps)
+{
+	RADIUS_PACKET	*original, *packet;
+
+	original = fr_radius_alloc(ctx, true);
+	original->code = FR_CODE_ACCOUNTING_REQUEST;
+	original->id = 42;
+	original->vps = vps;
+
+	if ((fr_radius_packet_encode(original, NULL, secret) < 0) ||
+	    (fr_radius_packet_sign(original, NULL, secret) < 0)) {
+		fr_perror("pair_head_test: Failed encoding packet");
+		exit(EXIT_FAILURE);
+	}
+
+	packet = fr_radius_alloc(ctx, false);
+	packet->code = original->code;
+	packet->id = original->id;
+	packet->data = talloc_memdup(packet, original->data, original->data_len);
+	packet->data_len = original->data_len;
+
+	if (fr_radius_packet_decode(packet, NULL, MAX_PAIRS, false, secret) < 0) {
+		fr_perror("pair_head_test: Failed decoding packet");
+		exit(EXIT_FAILURE);
+	}
+
+	return packet;
+}
+
+/** Benchmark one packet
+ *
+ * Each iteration adds the attributes to an empty list one at a time, as
+ * the decoder and "update" sections do, then looks up every attribute
+ * in the packet, and a few which aren't there, as a policy would.
+ */
+static void benchmark(TALLOC_CTX *ctx, RADIUS_PACKET *packet, int num)
+{
+	VALUE_PAIR		*vps[MAX_PAIRS];
+	fr_dict_attr_t const	*lookups[MAX_LOOKUPS];
+	int			num_vps = 0, num_lookups = 0;
+	int			i, j, k;
+	VALUE_PAIR		*vp, *head;
+	fr_pair_head_t		list;
+	fr_cursor_t		cursor;
+	uint64_t		found_linear = 0, found_head = 0;
+	fr_time_t		start, linear, indexed;
+
+	for (vp = fr_cursor_init(&cursor, &packet->vps);
+	     vp && (num_vps < MAX_PAIRS);
+	     vp = fr_cursor_next(&cursor)) {
+		vps[num_vps++] = vp;
+
+		for (k = 0; k < num_lookups; k++) if (lookups[k] == vp->da) break;
+		if (k == num_lookups) lookups[num_lookups++] = vp->da;
+	}
+
+	for (k = 0; missing_attrs[k] && (num_lookups < MAX_LOOKUPS); k++) {
+		fr_dict_attr_t const *da;
+
+		da = fr_dict_attr_by_name(NULL, missing_attrs[k]);
+		if (da) lookups[num_lookups++] = da;
+	}
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		head = NULL;
+		for (j = 0; j < num_vps; j++) {
+			vps[j]->next = NULL;
+			fr_pair_add(&head, vps[j]);
+		}
+
+		for (k = 0; k < num_lookups; k++) {
+			if (fr_pair_find_by_da(head, lookups[k], TAG_ANY)) found_linear++;
+		}
+	}
+	linear = fr_time() - start;
+
+	fr_pair_head_init(ctx, &list, NULL);
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		*fr_pair_head_list(&list) = NULL;
+		for (j = 0; j < num_vps; j++) {
+			vps[j]->next = NULL;
+			fr_pair_head_add(&list, vps[j]);
+		}
+
+		for (k = 0; k < num_lookups; k++) {
+			if (fr_pair_head_find_by_da(&list, lookups[k], TAG_ANY)) found_head++;
+		}
+	}
+	indexed = fr_time() - start;
+
+	/*
+	 *	Both must find exactly the same VALUE_PAIRs.
+	 */
+	for (k = 0; k < num_lookups; k++) {
+		if (fr_pair_find_by_da(list.head, lookups[k], TAG_ANY) !=
+		    fr_pair_head_find_by_da(&list, lookups[k], TAG_ANY)) {
+			fprintf(stderr, "pair_head_test: Lookups for %s differ\n", lookups[k]->name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	rad_assert(found_linear == found_head);
+
+	packet->vps = list.head;
+	TALLOC_FREE(list.index);
+
+	printf("linear   %5d  %7d  %14" PRIu64 "\n", num_vps, num_lookups, linear / num);
+	printf("indexed  %5d  %7d  %14" PRIu64 "\n", num_vps, num_lookups, indexed / num);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, num = 100000;
+	char const		*radius_dir = RADDBDIR;
+	char const		*dict_dir = DICTDIR;
+	char const		*filename = NULL;
+	fr_dict_t		*dict = NULL;
+	VALUE_PAIR		*vps;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "d:D:f:n:h")) != EOF) switch (c) {
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'f':
+			filename = optarg;
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (num <= 0) usage();
+
+	fr_time_start();
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("pair_head_test");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_read(dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("pair_head_test");
+		exit(EXIT_FAILURE);
+	}
+
+	secret = talloc_typed_strdup(autofree, "testing123");
+
+	printf("mode     attrs  lookups  time/iter (ns)\n");
+
+	if (!filename) {
+		vps = NULL;
+		if (fr_pair_list_afrom_str(autofree, accounting_request, &vps) == T_INVALID) {
+			fr_perror("pair_head_test: Failed parsing attributes");
+			exit(EXIT_FAILURE);
+		}
+
+		benchmark(autofree, packet_from_vps(autofree, vps), num);
+	} else {
+		FILE	*fp;
+		bool	done = false;
+
+		fp = fopen(filename, "r");
+		if (!fp) {
+			fprintf(stderr, "pair_head_test: Failed opening %s: %s\n", filename, fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		while (!done) {
+			vps = NULL;
+			if (fr_pair_list_afrom_file(autofree, &vps, fp, &done) < 0) {
+				fr_perror("pair_head_test: Failed reading %s", filename);
+				exit(EXIT_FAILURE);
+			}
+			if (!vps) continue;
+
+			benchmark(autofree, packet_from_vps(autofree, vps), num);
+		}
+
+		fclose(fp);
+	}
+
+	talloc_free(autofree);
+
+	return 0;
+}
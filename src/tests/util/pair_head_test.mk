@@ -0,0 +1,6 @@
+TARGET := pair_head_test
+
+SOURCES		:= pair_head_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-radius.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
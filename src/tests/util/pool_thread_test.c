@@ -0,0 +1,299 @@
+/*
+ * pool_thread_test.c	Tests for the thread_local slices of connection pools
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/pool.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <pthread.h>
+
+/*
+ *	Two threads, so each slice's share of "max" is 2.
+ */
+#define MAX_CONNECTIONS		4
+
+/*
+ *	Each thread runs its part of the script when "step" reaches
+ *	the number of that part, so the state of the pool is known
+ *	at every check.
+ */
+static pthread_mutex_t		step_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		step_cond = PTHREAD_COND_INITIALIZER;
+static int			step;
+
+static fr_pool_t		*pool;
+static int			num_created;		//!< Connections opened by the create callback.
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: pool_thread_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "pool_thread_test: step %i: %s\n", step, msg);
+	exit(EXIT_FAILURE);
+}
+
+static void step_wait(int at)
+{
+	pthread_mutex_lock(&step_mutex);
+	while (step != at) pthread_cond_wait(&step_cond, &step_mutex);
+	pthread_mutex_unlock(&step_mutex);
+}
+
+static void step_done(void)
+{
+	pthread_mutex_lock(&step_mutex);
+	step++;
+	pthread_cond_broadcast(&step_cond);
+	pthread_mutex_unlock(&step_mutex);
+}
+
+/*
+ *	Connections are numbered from 1, in the order they're opened.
+ */
+static void *test_create(TALLOC_CTX *ctx, UNUSED void *opaque, UNUSED struct timeval const *timeout)
+{
+	int *conn;
+
+	conn = talloc(ctx, int);
+	if (!conn) return NULL;
+
+	*conn = ++num_created;
+
+	return conn;
+}
+
+static int *conn_get(void)
+{
+	int *conn;
+
+	conn = fr_pool_connection_get(pool, NULL);
+	if (!conn) fail("No connection available");
+
+	return conn;
+}
+
+/*
+ *	Connections are only ever closed when the pool is freed.
+ */
+static void state_check(uint32_t active, uint32_t threads, uint64_t borrowed)
+{
+	fr_pool_state_t state;
+
+	fr_pool_state(&state, pool);
+	if (state.num != (uint32_t) num_created) fail("Connection was closed");
+	if (state.active != active) fail("Wrong number of reserved connections");
+	if (state.threads != threads) fail("Wrong number of thread slices");
+	if (state.borrowed != borrowed) fail("Wrong number of borrowed connections");
+}
+
+static void *thread_a(UNUSED void *arg)
+{
+	TALLOC_CTX	*ctx;
+	int		*conn[2];
+	fr_pool_state_t	before;
+
+	MEM(ctx = talloc_init("thread_a"));
+
+	step_wait(0);
+	if (fr_pool_thread_instantiate(ctx, pool) < 0) fail("Failed creating slice");
+	step_done();
+
+	/*
+	 *	Our slice is empty, so we open our share of the
+	 *	pool, and reuse them.
+	 */
+	step_wait(2);
+	conn[0] = conn_get();
+	conn[1] = conn_get();
+	if ((*conn[0] != 1) || (*conn[1] != 2)) fail("Expected new connections");
+	state_check(2, 2, 0);
+
+	fr_pool_connection_release(pool, NULL, conn[1]);
+	fr_pool_connection_release(pool, NULL, conn[0]);
+	state_check(0, 2, 0);
+
+	conn[0] = conn_get();
+	if ((*conn[0] != 1) && (*conn[0] != 2)) fail("Expected to reuse our own connection");
+	fr_pool_connection_release(pool, NULL, conn[0]);
+	if (num_created != 2) fail("Opened a connection when we had an idle one");
+
+	fr_pool_state(&before, pool);
+	step_done();
+
+	/*
+	 *	B borrowed one of ours, so we have one left.  The
+	 *	pool is at "max", and nothing else is idle.
+	 */
+	step_wait(4);
+	if (before.active != 0) fail("State changed after it was copied");
+
+	conn[0] = conn_get();
+	if ((*conn[0] != 1) && (*conn[0] != 2)) fail("Expected our idle connection");
+	state_check(4, 2, 1);
+
+	if (fr_pool_connection_get(pool, NULL)) fail("Got a connection past \"max\"");
+
+	fr_pool_connection_release(pool, NULL, conn[0]);
+	step_done();
+
+	/*
+	 *	B released the connection it borrowed, which comes
+	 *	back to our slice, so we don't borrow from B.
+	 */
+	step_wait(6);
+	conn[0] = conn_get();
+	conn[1] = conn_get();
+	if ((*conn[0] + *conn[1]) != 3) fail("Expected both our connections back");
+	state_check(2, 2, 1);
+
+	fr_pool_connection_release(pool, NULL, conn[0]);
+	fr_pool_connection_release(pool, NULL, conn[1]);
+
+	/*
+	 *	The thread exits, and gives its connections back
+	 *	to the pool.
+	 */
+	talloc_free(ctx);
+	state_check(0, 1, 1);
+	step_done();
+
+	return NULL;
+}
+
+static void *thread_b(UNUSED void *arg)
+{
+	TALLOC_CTX	*ctx;
+	int		*conn[MAX_CONNECTIONS];
+	int		i, sum;
+
+	MEM(ctx = talloc_init("thread_b"));
+
+	step_wait(1);
+	if (fr_pool_thread_instantiate(ctx, pool) < 0) fail("Failed creating slice");
+	step_done();
+
+	/*
+	 *	We open our share of the pool, then borrow one of
+	 *	A's idle connections.
+	 */
+	step_wait(3);
+	for (i = 0; i < 3; i++) conn[i] = conn_get();
+	if ((*conn[0] != 3) || (*conn[1] != 4)) fail("Expected new connections up to our share");
+	if ((*conn[2] != 1) && (*conn[2] != 2)) fail("Expected to borrow from A");
+	state_check(3, 2, 1);
+	step_done();
+
+	step_wait(5);
+	for (i = 0; i < 3; i++) fr_pool_connection_release(pool, NULL, conn[i]);
+	state_check(0, 2, 1);
+	step_done();
+
+	/*
+	 *	A has exited.  Our share is now the whole pool, and
+	 *	we adopt the connections A left, instead of opening
+	 *	new ones.
+	 */
+	step_wait(7);
+	for (i = 0, sum = 0; i < MAX_CONNECTIONS; i++) {
+		conn[i] = conn_get();
+		sum += *conn[i];
+	}
+	if (sum != (1 + 2 + 3 + 4)) fail("Expected to use every connection in the pool");
+	state_check(MAX_CONNECTIONS, 1, 1);
+
+	for (i = 0; i < MAX_CONNECTIONS; i++) fr_pool_connection_release(pool, NULL, conn[i]);
+
+	talloc_free(ctx);
+	state_check(0, 0, 1);
+	step_done();
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	TALLOC_CTX	*autofree = talloc_init("main");
+	CONF_SECTION	*cs;
+	pthread_t	a, b;
+
+	static char const *config[][2] = {
+		{ "start",		"0" },
+		{ "min",		"0" },
+		{ "max",		STRINGIFY(MAX_CONNECTIONS) },
+		{ "spare",		"0" },
+		{ "idle_timeout",	"0" },
+		{ "thread_local",	"yes" },
+	};
+	size_t		i;
+
+	default_log.dst = L_DST_NULL;
+
+	while ((c = getopt(argc, argv, "xh")) != EOF) switch (c) {
+		case 'x':
+			default_log.dst = L_DST_STDOUT;
+			default_log.fd = STDOUT_FILENO;
+			rad_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	cs = cf_section_alloc(autofree, NULL, "pool", NULL);
+	for (i = 0; i < (sizeof(config) / sizeof(*config)); i++) {
+		cf_pair_add(cs, cf_pair_alloc(cs, config[i][0], config[i][1], T_OP_EQ, T_BARE_WORD, T_BARE_WORD));
+	}
+
+	pool = fr_pool_init(autofree, cs, autofree, test_create, NULL, "pool_thread_test");
+	if (!pool) {
+		fr_perror("pool_thread_test");
+		exit(EXIT_FAILURE);
+	}
+
+	(void) pthread_create(&a, NULL, thread_a, NULL);
+	(void) pthread_create(&b, NULL, thread_b, NULL);
+
+	step_wait(8);
+	(void) pthread_join(a, NULL);
+	(void) pthread_join(b, NULL);
+
+	if (num_created != MAX_CONNECTIONS) fail("Opened more than \"max\" connections");
+
+	fr_pool_free(pool);
+	talloc_free(autofree);
+
+	return 0;
+}
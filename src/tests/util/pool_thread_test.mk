@@ -0,0 +1,6 @@
+TARGET := pool_thread_test
+
+SOURCES		:= pool_thread_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
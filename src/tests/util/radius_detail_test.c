@@ -0,0 +1,320 @@
+/*
+ * radius_detail_test.c	Tests for binary detail file records
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/radius/radius.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	User-Password is obscured with the fixed secret, and must
+ *	come back in the clear.
+ */
+static char const *accounting_request =
+	"User-Name = \"bob@example.com\", "
+	"User-Password = \"hello there\", "
+	"NAS-IP-Address = 192.0.2.1, "
+	"NAS-Port = 4097, "
+	"Framed-IP-Address = 198.51.100.23, "
+	"Acct-Status-Type = Interim-Update, "
+	"Acct-Session-Id = \"0123456789abcdef\", "
+	"Acct-Input-Octets = 123456789, "
+	"Acct-Output-Octets = 987654321, "
+	"Acct-Session-Time = 3600, "
+	"Class = 0x0102030405060708, "
+	"Event-Timestamp = \"Jul 14 2017 02:40:00 UTC\"";
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_detail_test [OPTS]\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "radius_detail_test: %s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+/** Check that decoding a record fails with the expected error
+ *
+ */
+static void decode_fails(uint8_t *data, size_t data_len, char const *error, char const *msg)
+{
+	fr_radius_detail_t	detail;
+	char const		*p;
+
+	fr_strerror();		/* Clear any old errors */
+
+	if (fr_radius_detail_decode(&detail, data, data_len) == 0) fail(msg);
+
+	p = fr_strerror();
+	if (strcmp(p, error) != 0) {
+		fprintf(stderr, "radius_detail_test: %s: expected error \"%s\", got \"%s\"\n", msg, error, p);
+		exit(EXIT_FAILURE);
+	}
+
+	if (debug_lvl) printf("%s: %s\n", msg, p);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*radius_dir = RADDBDIR;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	VALUE_PAIR		*vps = NULL, *decoded = NULL, *a, *b, *vp;
+	fr_radius_detail_t	in, out;
+	uint8_t			*buffer;
+	ssize_t			len;
+	size_t			i;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "d:D:xh")) != EOF) switch (c) {
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("radius_detail_test");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_read(dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("radius_detail_test");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_pair_list_afrom_str(autofree, accounting_request, &vps) == T_INVALID) {
+		fr_perror("radius_detail_test: Failed parsing attributes");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	A timestamp which needs more than 32 bits, and one
+	 *	address of each family.
+	 */
+	memset(&in, 0, sizeof(in));
+	in.code = FR_CODE_ACCOUNTING_REQUEST;
+	in.timestamp.tv_sec = (time_t) 0x123456789;
+	in.timestamp.tv_usec = 654321;
+	if ((fr_inet_pton(&in.src_ipaddr, "192.0.2.1", -1, AF_UNSPEC, false, true) < 0) ||
+	    (fr_inet_pton(&in.dst_ipaddr, "2001:db8::1", -1, AF_UNSPEC, false, true) < 0)) {
+		fr_perror("radius_detail_test");
+		exit(EXIT_FAILURE);
+	}
+	in.src_port = 32768;
+	in.dst_port = 1813;
+	in.client_ipaddr.af = AF_UNSPEC;
+
+	buffer = talloc_array(autofree, uint8_t, FR_RADIUS_DETAIL_MAX_LEN);
+
+	/*
+	 *	Encode
+	 */
+	len = fr_radius_detail_encode(buffer, FR_RADIUS_DETAIL_MAX_LEN, &in, vps);
+	if (len < 0) {
+		fr_perror("radius_detail_test: Failed encoding record");
+		exit(EXIT_FAILURE);
+	}
+	if (debug_lvl) printf("Encoded %zd byte record\n", len);
+
+	if (!fr_radius_detail_is_binary(buffer, len)) fail("Record doesn't start with the magic number");
+	if (fr_radius_detail_record_len(buffer, len) != len) fail("Record length doesn't match what we encoded");
+
+	/*
+	 *	The header is always complete by the time we've
+	 *	seen the length.
+	 */
+	if (fr_radius_detail_record_len(buffer, 15) != 0) fail("Partial header should need more data");
+
+	in.code = 0;
+	if (fr_radius_detail_encode(buffer + len, FR_RADIUS_DETAIL_MAX_LEN - len, &in, vps) >= 0) {
+		fail("Encoding a record with an invalid packet code should fail");
+	}
+	in.code = FR_CODE_ACCOUNTING_REQUEST;
+
+	/*
+	 *	Decode the header
+	 */
+	if (fr_radius_detail_decode(&out, buffer, len) < 0) {
+		fr_perror("radius_detail_test: Failed decoding record");
+		exit(EXIT_FAILURE);
+	}
+
+	if (out.code != in.code) fail("Packet code is wrong");
+	if ((out.timestamp.tv_sec != in.timestamp.tv_sec) ||
+	    (out.timestamp.tv_usec != in.timestamp.tv_usec)) fail("Timestamp is wrong");
+	if (fr_ipaddr_cmp(&out.src_ipaddr, &in.src_ipaddr) != 0) fail("Source address is wrong");
+	if (fr_ipaddr_cmp(&out.dst_ipaddr, &in.dst_ipaddr) != 0) fail("Destination address is wrong");
+	if (out.client_ipaddr.af != AF_UNSPEC) fail("Client address is wrong");
+	if ((out.src_port != in.src_port) || (out.dst_port != in.dst_port)) fail("Ports are wrong");
+	if (out.done) fail("New record is marked \"Done\"");
+	if ((out.packet != buffer + FR_RADIUS_DETAIL_HDR_LEN) ||
+	    (out.packet_len != (size_t)(len - FR_RADIUS_DETAIL_HDR_LEN))) fail("Packet is in the wrong place");
+
+	/*
+	 *	Decode the attributes
+	 */
+	if (fr_radius_detail_decode_pairs(autofree, &decoded, &out) < 0) {
+		fr_perror("radius_detail_test: Failed decoding attributes");
+		exit(EXIT_FAILURE);
+	}
+
+	for (a = vps, b = decoded; a && b; a = a->next, b = b->next) {
+		if ((a->da != b->da) || (fr_value_box_cmp(&a->data, &b->data) != 0)) {
+			fprintf(stderr, "radius_detail_test: Decoded %s doesn't match the %s we encoded\n",
+				b->da->name, a->da->name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (a || b) fail("Decoded a different number of attributes than we encoded");
+	if (debug_lvl) fr_pair_list_fprint(stdout, decoded);
+	fr_pair_list_free(&decoded);
+
+	/*
+	 *	"Done" isn't covered by the checksum, so the detail
+	 *	reader can mark records in place.
+	 */
+	memcpy(buffer + FR_RADIUS_DETAIL_DONE_OFFSET, "Done", 4);
+	if (fr_radius_detail_decode(&out, buffer, len) < 0) {
+		fr_perror("radius_detail_test: Failed decoding record marked \"Done\"");
+		exit(EXIT_FAILURE);
+	}
+	if (!out.done) fail("Record marked \"Done\" wasn't decoded as done");
+
+	/*
+	 *	Checksum mismatch.  Every byte after the checksum
+	 *	is covered, the header as well as the packet.
+	 */
+	for (i = 20; i < (size_t)len; i++) {
+		buffer[i] ^= 0x01;
+		decode_fails(buffer, len, "Checksum mismatch", "Corrupted record");
+		buffer[i] ^= 0x01;
+	}
+
+	/*
+	 *	Truncated records.
+	 */
+	for (i = 0; i < (size_t)len; i++) {
+		decode_fails(buffer, i, "Record is truncated", "Truncated record");
+	}
+
+	/*
+	 *	A length which runs past the end of the data is
+	 *	also truncation, not a checksum error.
+	 */
+	buffer[11]++;
+	decode_fails(buffer, len, "Record is truncated", "Record length past the end of the data");
+	buffer[11]--;
+
+	/*
+	 *	Anything which isn't a binary detail record.
+	 */
+	buffer[0] = 'T';
+	decode_fails(buffer, len, "Invalid magic number", "Text detail file");
+	buffer[0] = FR_RADIUS_DETAIL_MAGIC[0];
+
+	if (fr_radius_detail_decode(&out, buffer, len) < 0) fail("Record doesn't decode after being restored");
+
+	/*
+	 *	More attributes than fit in a RADIUS packet.  The
+	 *	record is no larger than a packet we'd accept, even
+	 *	if the buffer is, so that it can be replayed.
+	 */
+	for (i = 0; i < 20; i++) {
+		uint8_t	class[250];
+
+		memset(class, i, sizeof(class));
+		vp = fr_pair_afrom_num(autofree, 0, FR_CLASS);
+		if (!vp) fail("Failed allocating Class");
+		fr_pair_value_memcpy(vp, class, sizeof(class));
+		fr_pair_add(&vps, vp);
+	}
+
+	buffer = talloc_array(autofree, uint8_t, FR_RADIUS_DETAIL_HDR_LEN + 65535);
+	len = fr_radius_detail_encode(buffer, FR_RADIUS_DETAIL_HDR_LEN + 65535, &in, vps);
+	if (len < 0) {
+		fr_perror("radius_detail_test: Failed encoding large record");
+		exit(EXIT_FAILURE);
+	}
+	if (debug_lvl) printf("Encoded %zd byte large record\n", len);
+
+	if (len > FR_RADIUS_DETAIL_MAX_LEN) fail("Large record is bigger than a RADIUS packet");
+
+	if (fr_radius_detail_decode(&out, buffer, len) < 0) {
+		fr_perror("radius_detail_test: Failed decoding large record");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_radius_detail_decode_pairs(autofree, &decoded, &out) < 0) {
+		fr_perror("radius_detail_test: Failed decoding attributes of large record");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	The encoder truncates the last "octets" attribute to
+	 *	the space which is left, so it only has to be a prefix.
+	 */
+	for (a = vps, b = decoded; a && b; a = a->next, b = b->next) {
+		if (a->da != b->da) break;
+		if (b->next && (fr_value_box_cmp(&a->data, &b->data) != 0)) break;
+		if (!b->next && ((b->vp_length > a->vp_length) ||
+				 (memcmp(a->vp_octets, b->vp_octets, b->vp_length) != 0))) break;
+	}
+	if (b) {
+		fprintf(stderr, "radius_detail_test: Decoded %s doesn't match the %s we encoded\n",
+			b->da->name, a ? a->da->name : "nothing");
+		exit(EXIT_FAILURE);
+	}
+	if (!a) fail("Attributes which don't fit in a RADIUS packet should be left out");
+	fr_pair_list_free(&decoded);
+
+	fr_pair_list_free(&vps);
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := radius_detail_test
+
+SOURCES		:= radius_detail_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,305 @@
+/*
+ * request_slab_test.c	Compare allocations per request with and without the request slab
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/request_slab.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/* Linker hacks */
+char const *get_radius_dir(void)
+{
+	return NULL;
+}
+
+module_instance_t *module_find_with_method(UNUSED rlm_components_t *method,
+					   UNUSED CONF_SECTION *modules, UNUSED char const *name)
+{
+	return NULL;
+}
+
+main_config_t		main_config;				//!< Main server configuration.
+
+void *module_thread_instance_find(UNUSED void *inst)
+{
+	return NULL;
+}
+
+/* Linker hacks */
+
+/*
+ *	Count calls to malloc(), so we can see how many each request
+ *	makes.  Only glibc lets us wrap the real allocator.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t		num_mallocs;
+
+void *malloc(size_t size)
+{
+	num_mallocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	num_mallocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	num_mallocs++;
+	return __libc_realloc(ptr, size);
+}
+#  define MALLOCS	(num_mallocs)
+#else
+#  define MALLOCS	(0)
+#endif
+
+/*
+ *	A typical Access-Request, and the Access-Accept we send back.
+ */
+static char const *request_attrs[] = {
+	"User-Name", "bob@example.com",
+	"User-Password", "supersecret",
+	"NAS-IP-Address", "192.0.2.1",
+	"NAS-Port", "1234",
+	"NAS-Port-Type", "Wireless-802.11",
+	"Service-Type", "Framed-User",
+	"Called-Station-Id", "00-11-22-33-44-55:example",
+	"Calling-Station-Id", "66-77-88-99-AA-BB",
+	"Framed-MTU", "1400",
+	"Connect-Info", "CONNECT 54Mbps 802.11g",
+	NULL
+};
+
+static char const *reply_attrs[] = {
+	"Reply-Message", "Welcome, bob",
+	"Session-Timeout", "3600",
+	"Idle-Timeout", "600",
+	"Framed-IP-Address", "192.0.2.100",
+	"Class", "0x0123456789abcdef",
+	NULL
+};
+
+static char const	*secret;
+static RADIUS_PACKET	*original;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: request_slab_test [OPTS]\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <num>               Number of requests for each mode (defaults to 100000).\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void add_pairs(TALLOC_CTX *ctx, VALUE_PAIR **vps, char const **attrs)
+{
+	int i;
+
+	for (i = 0; attrs[i]; i += 2) {
+		if (!fr_pair_make(ctx, vps, attrs[i], attrs[i + 1], T_OP_EQ)) {
+			fr_perror("request_slab_test: Failed creating %s", attrs[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/** Decode the Access-Request into a request, and encode a reply
+ *
+ * Roughly what the worker and proto_radius do.
+ */
+static void process(REQUEST *request)
+{
+	request->packet = fr_radius_alloc(request, false);
+	request->reply = fr_radius_alloc(request, false);
+	request->async = talloc_zero(request, fr_async_t);
+	request->number = 1;
+	request->name = talloc_typed_asprintf(request, "%" PRIu64, request->number);
+
+	request->packet->code = original->data[0];
+	request->packet->id = original->data[1];
+	memcpy(request->packet->vector, original->data + 4, sizeof(request->packet->vector));
+	request->packet->data = talloc_memdup(request->packet, original->data, original->data_len);
+	request->packet->data_len = original->data_len;
+
+	if (fr_radius_packet_decode(request->packet, NULL, RADIUS_MAX_ATTRIBUTES, false, secret) < 0) {
+		fr_perror("request_slab_test: Failed decoding request");
+		exit(EXIT_FAILURE);
+	}
+
+	add_pairs(request->reply, &request->reply->vps, reply_attrs);
+
+	request->reply->code = FR_CODE_ACCESS_ACCEPT;
+	request->reply->id = request->packet->id;
+	if ((fr_radius_packet_encode(request->reply, request->packet, secret) < 0) ||
+	    (fr_radius_packet_sign(request->reply, request->packet, secret) < 0)) {
+		fr_perror("request_slab_test: Failed encoding reply");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void print_result(char const *mode, int num, uint64_t mallocs, fr_time_t elapsed)
+{
+	printf("%-8s %8d  %13.2f  %12" PRIu64 "\n", mode, num,
+	       (double)mallocs / num, elapsed / num);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, num = 100000;
+	char const		*radius_dir = RADDBDIR;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	fr_request_slab_t	*slab;
+	fr_request_slab_stats_t	stats;
+	REQUEST			*request;
+	uint64_t		mallocs;
+	fr_time_t		start;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "d:D:n:h")) != EOF) switch (c) {
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (num <= 0) usage();
+
+	fr_time_start();
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("request_slab_test");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_read(dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("request_slab_test");
+		exit(EXIT_FAILURE);
+	}
+
+	secret = talloc_typed_strdup(autofree, "testing123");
+
+	original = fr_radius_alloc(autofree, true);
+	original->code = FR_CODE_ACCESS_REQUEST;
+	original->id = 42;
+	add_pairs(original, &original->vps, request_attrs);
+
+	if ((fr_radius_packet_encode(original, NULL, secret) < 0) ||
+	    (fr_radius_packet_sign(original, NULL, secret) < 0)) {
+		fr_perror("request_slab_test: Failed encoding request");
+		exit(EXIT_FAILURE);
+	}
+
+	slab = fr_request_slab_create(autofree, 4096, 16);
+	if (!slab) {
+		fr_perror("request_slab_test");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Requests which didn't come from the slab, such as
+	 *	detached subrequests, are just freed.
+	 */
+	request = request_alloc(NULL);
+	fr_request_slab_free(slab, request);
+
+	request = fr_request_slab_alloc(slab);
+	fr_request_slab_free(fr_request_slab_create(autofree, 4096, 16), request);
+
+	fr_request_slab_stats(&stats, slab);
+	if (stats.num_free != 0) {
+		fprintf(stderr, "request_slab_test: Cached a pool for a request from somewhere else\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("mode     requests  mallocs/req  time/req (ns)\n");
+
+	mallocs = MALLOCS;
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		request = request_alloc(NULL);
+		process(request);
+		talloc_free(request);
+	}
+	print_result("malloc", num, MALLOCS - mallocs, fr_time() - start);
+
+	/*
+	 *	Let the slab find its size before measuring it.  The
+	 *	timed run doesn't measure, as the server doesn't.
+	 */
+	fr_request_slab_measure(slab, true);
+	for (i = 0; i < 2048; i++) {
+		request = fr_request_slab_alloc(slab);
+		process(request);
+		fr_request_slab_free(slab, request);
+	}
+	fr_request_slab_measure(slab, false);
+
+	mallocs = MALLOCS;
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		request = fr_request_slab_alloc(slab);
+		if (!request) {
+			fr_perror("request_slab_test");
+			exit(EXIT_FAILURE);
+		}
+		process(request);
+		fr_request_slab_free(slab, request);
+	}
+	print_result("slab", num, MALLOCS - mallocs, fr_time() - start);
+
+	fr_request_slab_stats(&stats, slab);
+	printf("\npool size %zu, reused %" PRIu64 " of %" PRIu64 ", overflows %" PRIu64 "\n",
+	       stats.pool_size, stats.reused, stats.alloced, stats.overflows);
+
+	talloc_free(autofree);
+
+	return 0;
+}
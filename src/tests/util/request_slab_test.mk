@@ -0,0 +1,6 @@
+TARGET := request_slab_test
+
+SOURCES		:= request_slab_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-radius.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,367 @@
+/*
+ * schedule_sockets_test.c	Tests for spreading sockets across network threads
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/inet.h>
+#include <freeradius-devel/radius.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+#define MAX_NETWORKS	(16)
+
+/** One socket, which is serviced by one network thread
+ *
+ */
+typedef struct fr_listen_test_t {
+	int			sockfd;
+	fr_ipaddr_t		ipaddr;
+	uint16_t		port;
+
+	uint8_t			id;			//!< Of the last packet we read.
+	uint8_t			vector[16];		//!< Of the last packet we read.
+	struct sockaddr_storage	src;			//!< Of the last packet we read.
+	socklen_t		salen;
+
+	pthread_t		reader;			//!< Thread which read the last packet.
+	fr_time_t		recv_time;
+} fr_listen_test_t;
+
+static int			debug_lvl = 0;
+static char const		*secret = "testing123";
+
+static fr_io_final_t test_process(REQUEST *request, fr_io_action_t action)
+{
+	MPRINT1("\t\tPROCESS --- request %"PRIu64" action %d\n", request->number, action);
+	return FR_IO_REPLY;
+}
+
+static int test_decode(UNUSED void const *instance, REQUEST *request, UNUSED uint8_t *const data, UNUSED size_t data_len)
+{
+	request->async->process = test_process;
+
+	return 0;
+}
+
+static ssize_t test_encode(void const *instance, REQUEST *request, uint8_t *buffer, UNUSED size_t buffer_len)
+{
+	FR_MD5_CTX		context;
+	fr_listen_test_t const	*io_ctx = talloc_get_type_abort_const(instance, fr_listen_test_t);
+
+	MPRINT1("\t\tENCODE >>> request %"PRIu64" port %u\n", request->number, io_ctx->port);
+
+	buffer[0] = FR_CODE_ACCESS_ACCEPT;
+	buffer[1] = io_ctx->id;
+	buffer[2] = 0;
+	buffer[3] = 20;
+
+	memcpy(buffer + 4, io_ctx->vector, 16);
+
+	fr_md5_init(&context);
+	fr_md5_update(&context, buffer, 20);
+	fr_md5_update(&context, (uint8_t const *) secret, strlen(secret));
+	fr_md5_final(buffer + 4, &context);
+
+	return 20;
+}
+
+static size_t test_nak(UNUSED void const *ctx, UNUSED uint8_t *const packet, UNUSED size_t packet_len,
+		       UNUSED uint8_t *reply, UNUSED size_t reply_len)
+{
+	return 10;
+}
+
+static int test_open(void *ctx)
+{
+	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+
+	io_ctx->sockfd = fr_socket_server_udp(&io_ctx->ipaddr, &io_ctx->port, NULL, true);
+	if (io_ctx->sockfd < 0) {
+		fr_perror("schedule_sockets_test: Failed creating socket");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_socket_bind(io_ctx->sockfd, &io_ctx->ipaddr, &io_ctx->port, NULL) < 0) {
+		fr_perror("schedule_sockets_test: Failed binding socket");
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+static ssize_t test_read(void *ctx, UNUSED void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer,
+			 size_t buffer_len, size_t *leftover, uint32_t *priority)
+{
+	ssize_t			data_size;
+	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+
+	io_ctx->salen = sizeof(io_ctx->src);
+	*leftover = 0;
+
+	data_size = recvfrom(io_ctx->sockfd, buffer, buffer_len, 0, (struct sockaddr *) &io_ctx->src, &io_ctx->salen);
+	if (data_size <= 0) return data_size;
+
+	io_ctx->id = buffer[1];
+	memcpy(io_ctx->vector, buffer + 4, sizeof(io_ctx->vector));
+	io_ctx->reader = pthread_self();
+
+	io_ctx->recv_time = fr_time();
+	*recv_time = &io_ctx->recv_time;
+	*priority = 0;
+
+	return data_size;
+}
+
+static ssize_t test_write(void *ctx, UNUSED void *packet_ctx,  UNUSED fr_time_t request_time,
+			  uint8_t *buffer, size_t buffer_len)
+{
+	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+
+	return sendto(io_ctx->sockfd, buffer, buffer_len, 0, (struct sockaddr *) &io_ctx->src, io_ctx->salen);
+}
+
+static int test_fd(void const *ctx)
+{
+	fr_listen_test_t const *io_ctx = talloc_get_type_abort_const(ctx, fr_listen_test_t);
+
+	return io_ctx->sockfd;
+}
+
+static fr_app_io_t app_io = {
+	.name = "schedule-sockets-test",
+	.default_message_size = 4096,
+	.open = test_open,
+	.read = test_read,
+	.write = test_write,
+	.fd = test_fd,
+	.nak = test_nak,
+	.encode = test_encode,
+	.decode = test_decode
+};
+
+static void process_set(UNUSED void const *ctx, REQUEST *request)
+{
+	request->async->process = test_process;
+}
+
+static fr_app_t test_app = {
+	.process_set = process_set,
+};
+
+/** Send an Access-Request to a socket, and check the Access-Accept which comes back
+ *
+ */
+static void send_request(int sockfd, fr_listen_test_t const *io_ctx, uint8_t id)
+{
+	uint8_t			packet[20], reply[4096], expected[16];
+	struct sockaddr_storage	dst;
+	socklen_t		salen;
+	struct pollfd		pfd = { .fd = sockfd, .events = POLLIN };
+	FR_MD5_CTX		context;
+	ssize_t			len;
+	int			i;
+
+	packet[0] = FR_CODE_ACCESS_REQUEST;
+	packet[1] = id;
+	packet[2] = 0;
+	packet[3] = sizeof(packet);
+	for (i = 4; i < 20; i++) packet[i] = fr_rand();
+
+	if (fr_ipaddr_to_sockaddr(&io_ctx->ipaddr, io_ctx->port, &dst, &salen) < 0) {
+		fr_perror("schedule_sockets_test");
+		exit(EXIT_FAILURE);
+	}
+
+	if (sendto(sockfd, packet, sizeof(packet), 0, (struct sockaddr *) &dst, salen) != sizeof(packet)) {
+		fprintf(stderr, "schedule_sockets_test: Failed sending packet: %s\n", fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (poll(&pfd, 1, 5000) <= 0) {
+		fprintf(stderr, "schedule_sockets_test: No reply from port %u\n", io_ctx->port);
+		exit(EXIT_FAILURE);
+	}
+
+	len = recv(sockfd, reply, sizeof(reply), 0);
+	if ((len != 20) || (reply[0] != FR_CODE_ACCESS_ACCEPT) || (reply[1] != id)) {
+		fprintf(stderr, "schedule_sockets_test: Bad reply from port %u\n", io_ctx->port);
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(expected, reply + 4, sizeof(expected));
+	memcpy(reply + 4, packet + 4, 16);
+
+	fr_md5_init(&context);
+	fr_md5_update(&context, reply, 20);
+	fr_md5_update(&context, (uint8_t const *) secret, strlen(secret));
+	fr_md5_final(reply + 4, &context);
+
+	if (memcmp(reply + 4, expected, sizeof(expected)) != 0) {
+		fprintf(stderr, "schedule_sockets_test: Bad authenticator in reply from port %u\n", io_ctx->port);
+		exit(EXIT_FAILURE);
+	}
+
+	MPRINT1("Reply %u from port %u\n", id, io_ctx->port);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: schedule_sockets_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Start num network threads, each with one socket.\n");
+	fprintf(stderr, "  -w <num>               Start num worker threads.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, j, client;
+	int			num_networks = 4;
+	int			num_workers = 2;
+	uint16_t		client_port = 0;
+	fr_ipaddr_t		ipaddr;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_schedule_t		*sched;
+	fr_listen_t		listen[MAX_NETWORKS];
+	fr_listen_test_t	*io_ctx[MAX_NETWORKS];
+
+	fr_time_start();
+
+	fr_log_init(&default_log, false);
+
+	while ((c = getopt(argc, argv, "n:w:xh")) != EOF) switch (c) {
+		case 'n':
+			num_networks = atoi(optarg);
+			if ((num_networks <= 0) || (num_networks > MAX_NETWORKS)) usage();
+			break;
+
+		case 'w':
+			num_workers = atoi(optarg);
+			if ((num_workers <= 0) || (num_workers > 1024)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			fr_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	memset(&ipaddr, 0, sizeof(ipaddr));
+	ipaddr.af = AF_INET;
+	ipaddr.prefix = 32;
+	ipaddr.addr.v4.s_addr = htonl(INADDR_LOOPBACK);
+
+	sched = fr_schedule_create(autofree, NULL, &default_log, debug_lvl, num_networks, num_workers, NULL, NULL, NULL);
+	if (!sched) {
+		fr_perror("schedule_sockets_test: Failed to create scheduler");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_schedule_num_networks(sched) != num_networks) {
+		fprintf(stderr, "schedule_sockets_test: Scheduler has %d network threads, expected %d\n",
+			fr_schedule_num_networks(sched), num_networks);
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	One socket per network thread.  Each gets an
+	 *	ephemeral port on the loopback address.
+	 */
+	for (i = 0; i < num_networks; i++) {
+		io_ctx[i] = talloc_zero(autofree, fr_listen_test_t);
+		io_ctx[i]->ipaddr = ipaddr;
+
+		listen[i] = (fr_listen_t) {
+			.app_io = &app_io,
+			.app_io_instance = io_ctx[i],
+			.app = &test_app,
+			.default_message_size = app_io.default_message_size,
+			.num_messages = 64,
+		};
+
+		if (listen[i].app_io->open(listen[i].app_io_instance) < 0) exit(EXIT_FAILURE);
+
+		if (!fr_schedule_socket_add(sched, &listen[i])) {
+			fr_perror("schedule_sockets_test: Failed adding socket");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	client = fr_socket_server_udp(&ipaddr, &client_port, NULL, true);
+	if ((client < 0) || (fr_socket_bind(client, &ipaddr, &client_port, NULL) < 0)) {
+		fr_perror("schedule_sockets_test: Failed creating client socket");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Every socket gets a reply, so every network thread can
+	 *	reach the workers.  Go around twice, so each network
+	 *	thread handles more than one packet.
+	 */
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < num_networks; i++) send_request(client, io_ctx[i], (j * num_networks) + i);
+	}
+
+	/*
+	 *	The sockets were added round-robin, so each one must
+	 *	have been read by a different network thread.
+	 */
+	for (i = 0; i < num_networks; i++) {
+		for (j = i + 1; j < num_networks; j++) {
+			if (pthread_equal(io_ctx[i]->reader, io_ctx[j]->reader)) {
+				fprintf(stderr, "schedule_sockets_test: Sockets %d and %d were read by the same thread\n",
+					i, j);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	close(client);
+
+	(void) fr_schedule_destroy(sched);
+
+	talloc_free(autofree);
+
+	return 0;
+}
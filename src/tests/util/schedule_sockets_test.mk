@@ -0,0 +1,6 @@
+TARGET := schedule_sockets_test
+
+SOURCES		:= schedule_sockets_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
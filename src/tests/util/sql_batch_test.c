@@ -0,0 +1,232 @@
+/*
+ * sql_batch_test.c	Compare accounting insert throughput with and without batching
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/io/time.h>
+
+#include "../../modules/rlm_sql/rlm_sql.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/* Linker hacks */
+char const *get_radius_dir(void)
+{
+	return NULL;
+}
+
+module_instance_t *module_find_with_method(UNUSED rlm_components_t *method,
+					   UNUSED CONF_SECTION *modules, UNUSED char const *name)
+{
+	return NULL;
+}
+
+main_config_t		main_config;				//!< Main server configuration.
+
+void *module_thread_instance_find(UNUSED void *inst)
+{
+	return NULL;
+}
+
+/* Linker hacks */
+
+extern rlm_sql_driver_t rlm_sql_sqlite;
+
+/*
+ *	A cut down version of the radacct table.
+ */
+static char const *create_query =
+	"CREATE TABLE radacct ("
+	"radacctid INTEGER PRIMARY KEY AUTOINCREMENT, "
+	"acctsessionid varchar(64) NOT NULL, "
+	"acctuniqueid varchar(32) NOT NULL UNIQUE, "
+	"username varchar(64) NOT NULL, "
+	"nasipaddress varchar(15) NOT NULL, "
+	"acctstarttime datetime NULL, "
+	"acctinputoctets bigint, "
+	"acctoutputoctets bigint)";
+
+static rlm_sql_config_t	config;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: sql_batch_test [OPTS]\n");
+	fprintf(stderr, "  -b <size>              Number of inserts per transaction (defaults to 100).\n");
+	fprintf(stderr, "  -f <file>              SQLite database to create (defaults to a temporary file).\n");
+	fprintf(stderr, "  -n <num>               Number of inserts for each mode (defaults to 1000).\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void statement(rlm_sql_handle_t *handle, char const *query)
+{
+	if (rlm_sql_sqlite.sql_query(handle, &config, query) != RLM_SQL_OK) {
+		sql_log_entry_t	log[20];
+		size_t		num, i;
+
+		fprintf(stderr, "sql_batch_test: Failed executing \"%s\"\n", query);
+
+		num = rlm_sql_sqlite.sql_error(handle->log_ctx, log, sizeof(log) / sizeof(*log), handle, &config);
+		for (i = 0; i < num; i++) fprintf(stderr, "sql_batch_test: %s\n", log[i].msg);
+
+		exit(EXIT_FAILURE);
+	}
+
+	rlm_sql_sqlite.sql_finish_query(handle, &config);
+}
+
+/** Insert num rows, committing every batch rows, or every row if batch is 0
+ *
+ */
+static fr_time_t run(rlm_sql_handle_t *handle, char const *prefix, int num, int batch)
+{
+	char		query[512];
+	fr_time_t	start;
+	int		i;
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		if (batch && ((i % batch) == 0)) statement(handle, "BEGIN");
+
+		snprintf(query, sizeof(query),
+			 "INSERT INTO radacct (acctsessionid, acctuniqueid, username, nasipaddress, "
+			 "acctstarttime, acctinputoctets, acctoutputoctets) "
+			 "VALUES ('%08x', '%s%08x', 'user%i', '192.0.2.1', '2018-01-01 00:00:00', %i, %i)",
+			 i, prefix, i, i % 1000, i * 100, i * 200);
+		statement(handle, query);
+
+		if (batch && ((((i + 1) % batch) == 0) || ((i + 1) == num))) statement(handle, "COMMIT");
+	}
+
+	return fr_time() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, num = 1000, batch = 100;
+	char			path[] = "/tmp/sql_batch_test.XXXXXX";
+	char const		*filename = NULL;
+	CONF_SECTION		*cs;
+	void			*driver_inst;
+	rlm_sql_handle_t	*handle;
+	rlm_sql_row_t		row;
+	struct timeval		timeout = { .tv_sec = 5 };
+	fr_time_t		single, batched;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "b:f:n:h")) != EOF) switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			break;
+
+		case 'f':
+			filename = optarg;
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'h':
+		default:
+			usage();
+		}
+
+	if ((num <= 0) || (batch <= 0)) usage();
+
+	fr_time_start();
+
+	/*
+	 *	The driver opens existing databases, and SQLite
+	 *	treats an empty file as a new database.
+	 */
+	if (!filename) {
+		int fd;
+
+		fd = mkstemp(path);
+		if (fd < 0) {
+			fprintf(stderr, "sql_batch_test: Failed creating database: %s\n", fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		filename = path;
+	}
+
+	/*
+	 *	Configure the driver the same way rlm_sql does.
+	 */
+	cs = cf_section_alloc(autofree, NULL, "sqlite", NULL);
+	cf_pair_add(cs, cf_pair_alloc(cs, "filename", filename, T_OP_EQ, T_BARE_WORD, T_DOUBLE_QUOTED_STRING));
+	cf_section_rules_push(cs, rlm_sql_sqlite.config);
+
+	driver_inst = talloc_zero_array(autofree, uint8_t, rlm_sql_sqlite.inst_size);
+	if ((cf_section_parse(driver_inst, driver_inst, cs) < 0) ||
+	    (rlm_sql_sqlite.mod_instantiate(&config, driver_inst, cs) < 0)) {
+		fr_perror("sql_batch_test: Failed instantiating driver");
+		exit(EXIT_FAILURE);
+	}
+	config.driver = driver_inst;
+
+	handle = talloc_zero(autofree, rlm_sql_handle_t);
+	handle->log_ctx = talloc_pool(handle, 2048);
+	if (rlm_sql_sqlite.sql_socket_init(handle, &config, &timeout) < 0) {
+		fprintf(stderr, "sql_batch_test: Failed opening database \"%s\"\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	statement(handle, create_query);
+
+	single = run(handle, "s", num, 0);
+	batched = run(handle, "b", num, batch);
+
+	/*
+	 *	Check everything was committed.
+	 */
+	if ((rlm_sql_sqlite.sql_select_query(handle, &config, "SELECT COUNT(*) FROM radacct") != RLM_SQL_OK) ||
+	    (rlm_sql_sqlite.sql_fetch_row(&row, handle, &config) != RLM_SQL_OK) || !row || !row[0]) {
+		fprintf(stderr, "sql_batch_test: Failed counting rows\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (atoi(row[0]) != (num * 2)) {
+		fprintf(stderr, "sql_batch_test: Expected %i rows, found %s\n", num * 2, row[0]);
+		exit(EXIT_FAILURE);
+	}
+	rlm_sql_sqlite.sql_finish_select_query(handle, &config);
+
+	printf("mode            inserts  time (ms)     inserts/s\n");
+	printf("single          %7i  %9" PRIu64 "  %12.0f\n", num, single / 1000000,
+	       (double)num / ((double)single / NANOSEC));
+	printf("batch (%5i)   %7i  %9" PRIu64 "  %12.0f\n", batch, num, batched / 1000000,
+	       (double)num / ((double)batched / NANOSEC));
+
+	talloc_free(autofree);
+
+	if (filename == path) unlink(path);
+
+	return 0;
+}
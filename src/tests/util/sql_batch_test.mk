@@ -0,0 +1,7 @@
+TARGET := sql_batch_test
+
+SOURCES		:= sql_batch_test.c ../../modules/rlm_sql/drivers/rlm_sql_sqlite/rlm_sql_sqlite.c
+
+SRC_CFLAGS	:= -I${top_srcdir}/src/modules/rlm_sql
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS) -lsqlite3
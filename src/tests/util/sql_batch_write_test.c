@@ -0,0 +1,469 @@
+/*
+ * sql_batch_write_test.c	Drive the rlm_sql batch write state machine through failures
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "../../modules/rlm_sql/rlm_sql.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define NUM_REQUESTS	(3)
+
+/*
+ *	A request in the batch, and how the batch code left it.
+ */
+typedef struct {
+	REQUEST				*request;
+	fr_unlang_resume_callback_t	resume;		//!< Set when the request yields.
+	fr_unlang_action_t		signal;
+	void				*rctx;
+	bool				resumable;	//!< Set when the batch is done with the request.
+	bool				cancelled;
+} test_request_t;
+
+/*
+ *	A query which is held, so that a request can be cancelled
+ *	while it's in progress.
+ */
+typedef struct {
+	sql_query_done_t		done;
+	void				*uctx;
+	sql_rcode_t			ret;
+} test_pending_t;
+
+/*
+ *	The "database".  Returns the result of a query, and may change
+ *	the handle in the same way as rlm_sql_query_async.
+ */
+typedef sql_rcode_t (*test_database_t)(rlm_sql_handle_t **handle, char const *query);
+
+static test_request_t		requests[NUM_REQUESTS];
+static test_pending_t		pending;
+static char const		*hold;			//!< Query to hold, or NULL.
+static test_database_t		database;
+static char			transcript[1024];	//!< Queries sent, separated by ';'.
+static int			num_logged;		//!< Queries written to the query log.
+static int			num_calls;		//!< Times database() has been called.
+
+static rlm_sql_handle_t		handles[2];		//!< The original connection, and the new one.
+
+static rlm_sql_config_t		config;
+static fr_dict_attr_t		sql_user;
+static rlm_sql_t		inst;
+static rlm_sql_thread_t		thread;
+static sql_acct_section_t	section;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: sql_batch_write_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS fail(char const *name, char const *msg)
+{
+	fprintf(stderr, "sql_batch_write_test: %s: %s\n", name, msg);
+	exit(EXIT_FAILURE);
+}
+
+/* Linker hacks */
+char const *get_radius_dir(void)
+{
+	return NULL;
+}
+
+module_instance_t *module_find_with_method(UNUSED rlm_components_t *method,
+					   UNUSED CONF_SECTION *modules, UNUSED char const *name)
+{
+	return NULL;
+}
+
+main_config_t		main_config;				//!< Main server configuration.
+
+void *module_thread_instance_find(UNUSED void *instance)
+{
+	return NULL;
+}
+
+/* Linker hacks */
+
+/*
+ *	Replacements for the rest of rlm_sql.
+ */
+const FR_NAME_NUMBER sql_rcode_table[] = {
+	{ "success",		RLM_SQL_OK		},
+	{ "need alt query",	RLM_SQL_ALT_QUERY	},
+	{ "server error",	RLM_SQL_ERROR		},
+	{ "query invalid",	RLM_SQL_QUERY_INVALID	},
+	{ "no connection",	RLM_SQL_RECONNECT	},
+	{ "no more rows",	RLM_SQL_NO_MORE_ROWS	},
+	{ "in progress",	RLM_SQL_YIELD		},
+	{ NULL, 0 }
+};
+
+int sql_set_user(UNUSED rlm_sql_t const *instance, UNUSED REQUEST *request, UNUSED char const *username)
+{
+	return 0;
+}
+
+void rlm_sql_query_log(UNUSED rlm_sql_t const *instance, UNUSED REQUEST *request,
+		       UNUSED sql_acct_section_t *acct_section, UNUSED char const *query)
+{
+	num_logged++;
+}
+
+/*
+ *	Each request's query is the query template, followed by the
+ *	request number.
+ */
+sql_query_t *sql_query_alloc(TALLOC_CTX *ctx, UNUSED rlm_sql_t const *instance, REQUEST *request,
+			     UNUSED rlm_sql_handle_t *handle, UNUSED sql_acct_section_t const *acct_section,
+			     char const *fmt)
+{
+	sql_query_t *query;
+
+	MEM(query = talloc_zero(ctx, sql_query_t));
+	query->text = talloc_typed_asprintf(query, "%s %" PRIu64, fmt, request->number);
+
+	return query;
+}
+
+sql_rcode_t rlm_sql_query_async(UNUSED TALLOC_CTX *ctx, UNUSED rlm_sql_t *instance, UNUSED rlm_sql_thread_t *t,
+				REQUEST *request, rlm_sql_handle_t **handle, sql_query_t const *query,
+				UNUSED bool select, sql_query_done_t done, void *uctx)
+{
+	sql_rcode_t ret;
+
+	/*
+	 *	Any request in the batch may be cancelled while
+	 *	its query is in progress.
+	 */
+	if (request) fail("query", "Batch query was given a request");
+	if (!*handle) fail("query", "Query was sent without a connection");
+
+	strlcat(transcript, query->text, sizeof(transcript));
+	strlcat(transcript, ";", sizeof(transcript));
+
+	num_calls++;
+	ret = database(handle, query->text);
+
+	if (!hold || (strcmp(query->text, hold) != 0)) return ret;
+
+	pending.done = done;
+	pending.uctx = uctx;
+	pending.ret = ret;
+	hold = NULL;
+
+	return RLM_SQL_YIELD;
+}
+
+/*
+ *	Replacements for the connection pool, and the interpreter.
+ */
+void *fr_pool_connection_get(UNUSED fr_pool_t *pool, UNUSED REQUEST *request)
+{
+	return &handles[0];
+}
+
+void fr_pool_connection_release(UNUSED fr_pool_t *pool, UNUSED REQUEST *request, UNUSED void *conn)
+{
+}
+
+int fr_pool_connection_close(UNUSED fr_pool_t *pool, UNUSED REQUEST *request, UNUSED void *conn)
+{
+	return 1;
+}
+
+rlm_rcode_t unlang_module_yield(REQUEST *request, fr_unlang_resume_callback_t callback,
+				fr_unlang_action_t signal_callback, void *ctx)
+{
+	test_request_t *tr = &requests[request->number];
+
+	tr->resume = callback;
+	tr->signal = signal_callback;
+	tr->rctx = ctx;
+
+	return RLM_MODULE_YIELD;
+}
+
+void unlang_resumable(REQUEST *request)
+{
+	requests[request->number].resumable = true;
+}
+
+static sql_rcode_t _sql_finish_query(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *cfg)
+{
+	return RLM_SQL_OK;
+}
+
+static int _sql_affected_rows(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *cfg)
+{
+	return 1;
+}
+
+static rlm_sql_driver_t driver = {
+	.name			= "test",
+	.sql_finish_query	= _sql_finish_query,
+	.sql_affected_rows	= _sql_affected_rows
+};
+
+/*
+ *	Databases for each test.
+ */
+static sql_rcode_t db_ok(UNUSED rlm_sql_handle_t **handle, UNUSED char const *query)
+{
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t db_commit_fails(UNUSED rlm_sql_handle_t **handle, char const *query)
+{
+	if (strcmp(query, "COMMIT") == 0) return RLM_SQL_ERROR;
+
+	return RLM_SQL_OK;
+}
+
+/*
+ *	The connection fails while committing, and can't be
+ *	re-established.
+ */
+static sql_rcode_t db_commit_no_connection(rlm_sql_handle_t **handle, char const *query)
+{
+	if (strcmp(query, "COMMIT") == 0) {
+		*handle = NULL;
+		return RLM_SQL_RECONNECT;
+	}
+
+	return RLM_SQL_OK;
+}
+
+/*
+ *	The connection fails during the second query, and the query
+ *	is sent again on a new connection.  That loses the earlier
+ *	queries in the transaction.
+ */
+static sql_rcode_t db_reconnect(rlm_sql_handle_t **handle, char const *query)
+{
+	if ((num_calls == 3) && (strcmp(query, "INSERT 1") == 0)) *handle = &handles[1];
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t db_reconnect_fails(rlm_sql_handle_t **handle, char const *query)
+{
+	if (strcmp(query, "INSERT 1") == 0) {
+		*handle = NULL;
+		return RLM_SQL_RECONNECT;
+	}
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t db_first_fails(UNUSED rlm_sql_handle_t **handle, char const *query)
+{
+	if (strcmp(query, "INSERT 0") == 0) return RLM_SQL_ERROR;
+
+	return RLM_SQL_OK;
+}
+
+/** Write a batch, and check the queries which were run, and the result for each request
+ *
+ * @param[in] name	of the test.
+ * @param[in] el	to run the batch timer in.
+ * @param[in] pair	query template.
+ * @param[in] db	the database.
+ * @param[in] cancel	request to cancel while its query is held, or -1.
+ * @param[in] expected	queries.
+ * @param[in] rcodes	expected for each request.
+ * @param[in] logged	number of queries which should be logged.
+ */
+static void run(char const *name, fr_event_list_t *el, CONF_PAIR *pair, test_database_t db, int cancel,
+		char const *expected, rlm_rcode_t const rcodes[NUM_REQUESTS], int logged)
+{
+	TALLOC_CTX	*ctx = talloc_init("run");
+	sql_batch_t	*batch;
+	int		i;
+
+	memset(requests, 0, sizeof(requests));
+	memset(&pending, 0, sizeof(pending));
+	transcript[0] = '\0';
+	num_logged = 0;
+	num_calls = 0;
+	database = db;
+	hold = (cancel >= 0) ? talloc_typed_asprintf(ctx, "%s %i", cf_pair_value(pair), cancel) : NULL;
+
+	batch = sql_batch_alloc(&inst, &thread, &section);
+	if (!batch) fail(name, "Failed allocating batch");
+
+	for (i = 0; i < NUM_REQUESTS; i++) {
+		REQUEST *request;
+
+		MEM(request = request_alloc(ctx));
+		MEM(request->packet = talloc_zero(request, RADIUS_PACKET));
+		request->number = i;
+		requests[i].request = request;
+
+		if (sql_batch_add(batch, request, pair) != RLM_MODULE_YIELD) fail(name, "Request didn't yield");
+	}
+
+	/*
+	 *	The batch is full, so it's written immediately.
+	 */
+	for (i = 0; (i < 100) && !transcript[0]; i++) {
+		if (fr_event_corral(el, false) < 0) fail(name, "Failed servicing events");
+		fr_event_service(el);
+	}
+
+	if (cancel >= 0) {
+		test_request_t *tr = &requests[cancel];
+
+		if (!pending.done) fail(name, "Query wasn't held");
+		if (tr->resumable) fail(name, "Request was resumed before its query completed");
+
+		tr->signal(tr->request, &inst, &thread, tr->rctx, FR_ACTION_DONE);
+		tr->cancelled = true;
+		TALLOC_FREE(tr->request);
+
+		pending.done(pending.ret, pending.uctx);
+	}
+
+	if (strcmp(transcript, expected) != 0) {
+		fprintf(stderr, "sql_batch_write_test: %s: Expected queries \"%s\", got \"%s\"\n",
+			name, expected, transcript);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_REQUESTS; i++) {
+		test_request_t	*tr = &requests[i];
+		rlm_rcode_t	rcode;
+
+		if (tr->cancelled) continue;
+		if (!tr->resumable) fail(name, "Request wasn't resumed");
+
+		rcode = tr->resume(tr->request, &inst, &thread, tr->rctx);
+		if (rcode != rcodes[i]) {
+			fprintf(stderr, "sql_batch_write_test: %s: Request %i expected %s, got %s\n", name, i,
+				fr_int2str(mod_rcode_table, rcodes[i], "<INVALID>"),
+				fr_int2str(mod_rcode_table, rcode, "<INVALID>"));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (num_logged != logged) {
+		fprintf(stderr, "sql_batch_write_test: %s: Expected %i queries to be logged, got %i\n",
+			name, logged, num_logged);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-28s ok\n", name);
+
+	talloc_free(batch);
+	talloc_free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_event_list_t		*el;
+	CONF_SECTION		*cs;
+	CONF_PAIR		*pair;
+
+	static rlm_rcode_t const	ok[NUM_REQUESTS] = { RLM_MODULE_OK, RLM_MODULE_OK, RLM_MODULE_OK };
+	static rlm_rcode_t const	failed[NUM_REQUESTS] = { RLM_MODULE_FAIL, RLM_MODULE_FAIL, RLM_MODULE_FAIL };
+
+	default_log.dst = L_DST_NULL;
+
+	while ((c = getopt(argc, argv, "xh")) != EOF) switch (c) {
+		case 'x':
+			default_log.dst = L_DST_STDOUT;
+			rad_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	if (!el) fail("main", "Failed creating event list");
+
+	cs = cf_section_alloc(autofree, NULL, "accounting", NULL);
+	pair = cf_pair_alloc(cs, "start", "INSERT", T_OP_EQ, T_BARE_WORD, T_SINGLE_QUOTED_STRING);
+	cf_pair_add(cs, pair);
+
+	inst.name = "sql";
+	inst.config = &config;
+	inst.driver = &driver;
+	inst.sql_user = &sql_user;
+
+	thread.el = el;
+
+	section.cs = cs;
+	section.batch_size = NUM_REQUESTS;
+
+	run("commit", el, pair, db_ok, -1,
+	    "BEGIN;INSERT 0;INSERT 1;INSERT 2;COMMIT;", ok, 3);
+
+	/*
+	 *	Nothing was committed, so the queries are run again.
+	 */
+	run("commit fails", el, pair, db_commit_fails, -1,
+	    "BEGIN;INSERT 0;INSERT 1;INSERT 2;COMMIT;ROLLBACK;INSERT 0;INSERT 1;INSERT 2;", ok, 3);
+
+	/*
+	 *	Without a connection, the transaction is abandoned,
+	 *	and every request fails.  Including the ones whose
+	 *	queries succeeded.
+	 */
+	run("commit not sent", el, pair, db_commit_no_connection, -1,
+	    "BEGIN;INSERT 0;INSERT 1;INSERT 2;COMMIT;", failed, 0);
+
+	run("reconnect", el, pair, db_reconnect, -1,
+	    "BEGIN;INSERT 0;INSERT 1;ROLLBACK;INSERT 0;INSERT 1;INSERT 2;", ok, 3);
+
+	run("reconnect fails", el, pair, db_reconnect_fails, -1,
+	    "BEGIN;INSERT 0;INSERT 1;", failed, 0);
+
+	/*
+	 *	The cancelled request is skipped, and the rest of
+	 *	the batch is written.
+	 */
+	run("cancel", el, pair, db_ok, 0,
+	    "BEGIN;INSERT 0;INSERT 1;INSERT 2;COMMIT;", ok, 2);
+
+	run("cancel, then fail", el, pair, db_first_fails, 0,
+	    "BEGIN;INSERT 0;ROLLBACK;INSERT 1;INSERT 2;", ok, 2);
+
+	run("cancel, then commit fails", el, pair, db_commit_fails, 1,
+	    "BEGIN;INSERT 0;INSERT 1;INSERT 2;COMMIT;ROLLBACK;INSERT 0;INSERT 2;", ok, 2);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET := sql_batch_write_test
+
+SOURCES		:= sql_batch_write_test.c ../../modules/rlm_sql/sql_batch.c
+
+SRC_CFLAGS	:= -I${top_srcdir}/src/modules/rlm_sql
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,253 @@
+/*
+ * trie_test.c	Tests and benchmarks for longest prefix match tries
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/trie.h>
+#include <freeradius-devel/rad_assert.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static int		debug_lvl = 0;
+
+/*
+ *	The old client list: one rbtree per prefix length, searched
+ *	from the longest prefix to the shortest.
+ */
+typedef struct {
+	rbtree_t	*trees[33];
+	int		min_prefix;
+} prefix_list_t;
+
+static int entry_cmp(void const *one, void const *two)
+{
+	fr_ipaddr_t const *a = one;
+	fr_ipaddr_t const *b = two;
+
+	return fr_ipaddr_cmp(a, b);
+}
+
+static void prefix_list_add(TALLOC_CTX *ctx, prefix_list_t *pl, fr_ipaddr_t *entry)
+{
+	if (!pl->trees[entry->prefix]) pl->trees[entry->prefix] = rbtree_create(ctx, entry_cmp, NULL, 0);
+
+	(void) rbtree_insert(pl->trees[entry->prefix], entry);
+
+	if (entry->prefix < pl->min_prefix) pl->min_prefix = entry->prefix;
+}
+
+static fr_ipaddr_t *prefix_list_find(prefix_list_t *pl, fr_ipaddr_t const *ipaddr)
+{
+	int		i;
+	fr_ipaddr_t	my_ipaddr;
+	void		*data;
+
+	for (i = 32; i >= pl->min_prefix; i--) {
+		if (!pl->trees[i]) continue;
+
+		my_ipaddr = *ipaddr;
+		fr_ipaddr_mask(&my_ipaddr, i);
+
+		data = rbtree_finddata(pl->trees[i], &my_ipaddr);
+		if (data) return data;
+	}
+
+	return NULL;
+}
+
+/*
+ *	Pick a random address.  Most of the addresses are in 10/8, so
+ *	that lookups have a good chance of matching something.
+ */
+static void random_ipaddr(fr_ipaddr_t *ipaddr)
+{
+	uint32_t addr;
+
+	memset(ipaddr, 0, sizeof(*ipaddr));
+
+	addr = (uint32_t) random();
+	if ((addr & 0x0f) != 0) addr = (addr & 0x0000ffff) | 0x0a000000 | ((random() & 0x03) << 16);
+
+	ipaddr->af = AF_INET;
+	ipaddr->prefix = 32;
+	ipaddr->addr.v4.s_addr = htonl(addr);
+}
+
+static uint64_t elapsed_usec(struct timeval *start_t, struct timeval *end_t)
+{
+	return ((uint64_t) (end_t->tv_sec - start_t->tv_sec) * 1000000) + end_t->tv_usec - start_t->tv_usec;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: trie_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Number of prefixes to insert.\n");
+	fprintf(stderr, "  -l <num>               Number of lookups to do.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i;
+	int			num_entries = 40000;
+	int			num_lookups = 1000000;
+	int			found = 0;
+	fr_ipaddr_t		*entries, *lookups;
+	fr_ipaddr_t		*a, *b;
+	fr_trie_t		*ft;
+	prefix_list_t		pl;
+	struct timeval		start_t, end_t;
+	uint64_t		trie_usec, tree_usec;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hl:n:x")) != EOF) switch (c) {
+		case 'l':
+			num_lookups = atoi(optarg);
+			break;
+
+		case 'n':
+			num_entries = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if ((num_entries <= 0) || (num_lookups <= 0)) usage();
+
+	srandom(0x5eed);
+
+	memset(&pl, 0, sizeof(pl));
+	pl.min_prefix = 32;
+
+	ft = fr_trie_create(autofree);
+	rad_assert(ft != NULL);
+
+	/*
+	 *	Mostly /32 and /24, with a few shorter networks, which
+	 *	is what large NAS lists look like.
+	 */
+	entries = talloc_array(autofree, fr_ipaddr_t, num_entries);
+	for (i = 0; i < num_entries; i++) {
+		random_ipaddr(&entries[i]);
+
+		switch (random() & 0x0f) {
+		case 0:
+			fr_ipaddr_mask(&entries[i], 16 + (random() & 0x07));
+			break;
+
+		case 1:
+		case 2:
+		case 3:
+		case 4:
+			fr_ipaddr_mask(&entries[i], 24);
+			break;
+
+		default:
+			break;
+		}
+
+		if (fr_trie_find(ft, &entries[i].addr.v4.s_addr, entries[i].prefix)) continue;
+
+		if (fr_trie_insert(ft, &entries[i].addr.v4.s_addr, entries[i].prefix, &entries[i]) < 0) {
+			fprintf(stderr, "Failed inserting entry %d: %s\n", i, fr_strerror());
+			exit(EXIT_FAILURE);
+		}
+
+		prefix_list_add(autofree, &pl, &entries[i]);
+	}
+
+	/*
+	 *	Check that the trie gives the same answers as the old
+	 *	code.
+	 */
+	lookups = talloc_array(autofree, fr_ipaddr_t, num_lookups);
+	for (i = 0; i < num_lookups; i++) {
+		random_ipaddr(&lookups[i]);
+
+		a = fr_trie_lookup(ft, &lookups[i].addr.v4.s_addr, 32);
+		b = prefix_list_find(&pl, &lookups[i]);
+		if (a != b) {
+			fprintf(stderr, "Lookup %d gave different results\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		if (a) found++;
+	}
+
+	/*
+	 *	Check removal.  Every other entry is deleted, and
+	 *	lookups must fall back to shorter prefixes.
+	 */
+	for (i = 0; i < num_entries; i += 2) {
+		if (fr_trie_find(ft, &entries[i].addr.v4.s_addr, entries[i].prefix) != &entries[i]) continue;
+
+		if (fr_trie_remove(ft, &entries[i].addr.v4.s_addr, entries[i].prefix) != &entries[i]) {
+			fprintf(stderr, "Failed removing entry %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		(void) rbtree_deletebydata(pl.trees[entries[i].prefix], &entries[i]);
+	}
+
+	for (i = 0; i < num_lookups; i++) {
+		if (fr_trie_lookup(ft, &lookups[i].addr.v4.s_addr, 32) != prefix_list_find(&pl, &lookups[i])) {
+			fprintf(stderr, "Lookup %d gave different results after removal\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (debug_lvl) {
+		gettimeofday(&start_t, NULL);
+		for (i = 0; i < num_lookups; i++) {
+			(void) fr_trie_lookup(ft, &lookups[i].addr.v4.s_addr, 32);
+		}
+		gettimeofday(&end_t, NULL);
+		trie_usec = elapsed_usec(&start_t, &end_t);
+
+		gettimeofday(&start_t, NULL);
+		for (i = 0; i < num_lookups; i++) {
+			(void) prefix_list_find(&pl, &lookups[i]);
+		}
+		gettimeofday(&end_t, NULL);
+		tree_usec = elapsed_usec(&start_t, &end_t);
+
+		printf("%u prefixes, %d lookups, %d found\n", fr_trie_num_elements(ft), num_lookups, found);
+		printf("trie   %" PRIu64 " usec\n", trie_usec);
+		printf("rbtree %" PRIu64 " usec\n", tree_usec);
+	}
+
+	talloc_free(autofree);
+
+	return 0;
+}
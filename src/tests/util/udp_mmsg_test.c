@@ -0,0 +1,311 @@
+/*
+ * udp_mmsg_test.c	Tests for batched UDP reads and writes
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/udp.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <poll.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	More than one read batch, so the reader has to come back for
+ *	the rest.
+ */
+#define NUM_PACKETS	(10)
+#define READ_BATCH	(4)
+#define TEST_PACKET_LEN	(256)
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: udp_mmsg_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "udp_mmsg_test: %s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+/** Open a non-blocking UDP socket on the loopback address
+ *
+ */
+static int socket_open(fr_ipaddr_t const *ipaddr, uint16_t *port)
+{
+	int sockfd;
+
+	*port = 0;
+
+	sockfd = fr_socket_server_udp(ipaddr, port, NULL, true);
+	if (sockfd < 0) {
+		fr_perror("udp_mmsg_test: Failed creating socket");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_socket_bind(sockfd, ipaddr, port, NULL) < 0) {
+		fr_perror("udp_mmsg_test: Failed binding socket");
+		exit(EXIT_FAILURE);
+	}
+
+	return sockfd;
+}
+
+/** Wait for a socket to become readable
+ *
+ */
+static void socket_wait(int sockfd)
+{
+	struct pollfd	pfd = { .fd = sockfd, .events = POLLIN };
+
+	if (poll(&pfd, 1, 5000) <= 0) fail("Timed out waiting for packets");
+}
+
+/** Fill in the contents of a packet, which are different for every packet
+ *
+ */
+static size_t packet_fill(uint8_t *data, unsigned int num)
+{
+	size_t len = 20 + (num * 7);
+
+	memset(data, num, len);
+	data[0] = len & 0xff;
+
+	return len;
+}
+
+/** Check that a datagram is the packet we sent, and came from where we sent it
+ *
+ */
+static void packet_check(udp_mmsg_t const *m, unsigned int num,
+			 fr_ipaddr_t const *ipaddr, uint16_t src_port, uint16_t dst_port)
+{
+	uint8_t		expected[TEST_PACKET_LEN];
+	size_t		len;
+
+	len = packet_fill(expected, num);
+
+	if ((m->packet_len != len) || (memcmp(m->data, expected, len) != 0)) {
+		fprintf(stderr, "udp_mmsg_test: Packet %u has the wrong contents (%zu bytes, expected %zu)\n",
+			num, m->packet_len, len);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((fr_ipaddr_cmp(&m->src_ipaddr, ipaddr) != 0) || (m->src_port != src_port)) {
+		fprintf(stderr, "udp_mmsg_test: Packet %u has the wrong source port %u, expected %u\n",
+			num, m->src_port, src_port);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((fr_ipaddr_cmp(&m->dst_ipaddr, ipaddr) != 0) || (m->dst_port != dst_port)) {
+		fprintf(stderr, "udp_mmsg_test: Packet %u has the wrong destination port %u, expected %u\n",
+			num, m->dst_port, dst_port);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!m->when.tv_sec) fail("Packet has no receive time");
+}
+
+/** Point each entry of a batch at its own buffer
+ *
+ */
+static void msgs_init(udp_mmsg_t *msgs, uint8_t buffers[][TEST_PACKET_LEN], unsigned int num)
+{
+	unsigned int i;
+
+	memset(msgs, 0, sizeof(*msgs) * num);
+	for (i = 0; i < num; i++) {
+		msgs[i].data = buffers[i];
+		msgs[i].data_len = TEST_PACKET_LEN;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, client, server, ret;
+	unsigned int		i, received;
+	uint16_t		client_port, server_port;
+	fr_ipaddr_t		ipaddr;
+	udp_mmsg_t		msgs[UDP_MMSG_MAX + 4];
+	static uint8_t		buffers[UDP_MMSG_MAX + 4][TEST_PACKET_LEN];
+	uint8_t			reply[TEST_PACKET_LEN];
+	fr_ipaddr_t		src_ipaddr, dst_ipaddr;
+	uint16_t		src_port, dst_port;
+	int			if_index;
+	struct timeval		when;
+	ssize_t			len;
+
+	while ((c = getopt(argc, argv, "xh")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	memset(&ipaddr, 0, sizeof(ipaddr));
+	ipaddr.af = AF_INET;
+	ipaddr.prefix = 32;
+	ipaddr.addr.v4.s_addr = htonl(INADDR_LOOPBACK);
+
+	client = socket_open(&ipaddr, &client_port);
+	server = socket_open(&ipaddr, &server_port);
+
+	if (debug_lvl) printf("Client port %u, server port %u\n", client_port, server_port);
+
+	/*
+	 *	Nothing has been sent yet, so there's nothing to read,
+	 *	and the read doesn't block.
+	 */
+	msgs_init(msgs, buffers, READ_BATCH);
+	if (udp_recv_mmsg(server, msgs, READ_BATCH, 0) != 0) fail("Read from an empty socket returned packets");
+
+	/*
+	 *	Send the packets in one batch, with the source address
+	 *	set, so that udpfromto is used for every packet.
+	 */
+	msgs_init(msgs, buffers, NUM_PACKETS);
+	for (i = 0; i < NUM_PACKETS; i++) {
+		msgs[i].data_len = packet_fill(msgs[i].data, i);
+		msgs[i].src_ipaddr = ipaddr;
+		msgs[i].src_port = client_port;
+		msgs[i].dst_ipaddr = ipaddr;
+		msgs[i].dst_port = server_port;
+	}
+
+	ret = udp_send_mmsg(client, msgs, NUM_PACKETS, 0);
+	if (ret < 0) {
+		fr_perror("udp_mmsg_test: Failed sending packets");
+		exit(EXIT_FAILURE);
+	}
+	if (ret != NUM_PACKETS) fail("Didn't send all of the packets");
+
+	/*
+	 *	Read them back, a few at a time.  They must come back
+	 *	in order, with the right addresses.
+	 */
+	received = 0;
+	while (received < NUM_PACKETS) {
+		socket_wait(server);
+
+		msgs_init(msgs, buffers, READ_BATCH);
+		ret = udp_recv_mmsg(server, msgs, READ_BATCH, 0);
+		if (ret < 0) {
+			fr_perror("udp_mmsg_test: Failed reading packets");
+			exit(EXIT_FAILURE);
+		}
+		if (ret > READ_BATCH) fail("Read more packets than there was room for");
+
+		if (debug_lvl) printf("Read %d packets\n", ret);
+
+		for (i = 0; i < (unsigned int) ret; i++) {
+			packet_check(&msgs[i], received + i, &ipaddr, client_port, server_port);
+		}
+		received += ret;
+	}
+
+	msgs_init(msgs, buffers, READ_BATCH);
+	if (udp_recv_mmsg(server, msgs, READ_BATCH, 0) != 0) fail("Read more packets than were sent");
+
+	/*
+	 *	Peeking leaves the packet on the socket.
+	 */
+	msgs_init(msgs, buffers, 1);
+	msgs[0].data_len = packet_fill(msgs[0].data, 3);
+	msgs[0].dst_ipaddr = ipaddr;
+	msgs[0].dst_port = server_port;
+	if (udp_send_mmsg(client, msgs, 1, 0) != 1) fail("Failed sending packet to peek at");
+
+	socket_wait(server);
+	msgs_init(msgs, buffers, READ_BATCH);
+	if (udp_recv_mmsg(server, msgs, READ_BATCH, UDP_FLAGS_PEEK) != 1) fail("Failed peeking at packet");
+	packet_check(&msgs[0], 3, &ipaddr, client_port, server_port);
+
+	msgs_init(msgs, buffers, READ_BATCH);
+	if (udp_recv_mmsg(server, msgs, READ_BATCH, 0) != 1) fail("Peeking removed the packet");
+	packet_check(&msgs[0], 3, &ipaddr, client_port, server_port);
+
+	/*
+	 *	Replies go back with the server's address as the
+	 *	source, and are read with the unbatched code.
+	 */
+	msgs_init(msgs, buffers, 1);
+	msgs[0].data_len = packet_fill(msgs[0].data, 5);
+	msgs[0].src_ipaddr = ipaddr;
+	msgs[0].src_port = server_port;
+	msgs[0].dst_ipaddr = ipaddr;
+	msgs[0].dst_port = client_port;
+	if (udp_send_mmsg(server, msgs, 1, 0) != 1) fail("Failed sending reply");
+
+	socket_wait(client);
+	len = udp_recv(client, reply, sizeof(reply), 0, &src_ipaddr, &src_port,
+		       &dst_ipaddr, &dst_port, &if_index, &when);
+	if (len != (ssize_t) packet_fill(buffers[0], 5)) fail("Reply has the wrong length");
+	if (memcmp(reply, buffers[0], len) != 0) fail("Reply has the wrong contents");
+	if ((fr_ipaddr_cmp(&src_ipaddr, &ipaddr) != 0) || (src_port != server_port)) fail("Reply came from the wrong place");
+
+	/*
+	 *	Batches are limited to UDP_MMSG_MAX packets.
+	 */
+	msgs_init(msgs, buffers, UDP_MMSG_MAX + 4);
+	for (i = 0; i < UDP_MMSG_MAX + 4; i++) {
+		msgs[i].data_len = packet_fill(msgs[i].data, i % 16);
+		msgs[i].dst_ipaddr = ipaddr;
+		msgs[i].dst_port = server_port;
+	}
+
+	ret = udp_send_mmsg(client, msgs, UDP_MMSG_MAX + 4, 0);
+	if ((ret <= 0) || (ret > UDP_MMSG_MAX)) fail("Sent the wrong number of packets in a full batch");
+	if (debug_lvl) printf("Sent %d packets in a full batch\n", ret);
+
+	received = 0;
+	while (received < (unsigned int) ret) {
+		int num;
+
+		socket_wait(server);
+
+		msgs_init(msgs, buffers, UDP_MMSG_MAX + 4);
+		num = udp_recv_mmsg(server, msgs, UDP_MMSG_MAX + 4, 0);
+		if ((num <= 0) || (num > UDP_MMSG_MAX)) fail("Read the wrong number of packets in a full batch");
+
+		for (i = 0; i < (unsigned int) num; i++) {
+			packet_check(&msgs[i], (received + i) % 16, &ipaddr, client_port, server_port);
+		}
+		received += num;
+	}
+
+	close(client);
+	close(server);
+
+	return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * work_deque_test.c	Tests for work-stealing deques
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/work_deque.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_THIEVES	(32)
+
+static int		debug_lvl = 0;
+static int		num_entries = 1000000;
+
+static fr_work_deque_t	*wd;
+static _Atomic(int)	*taken;		//!< how many times each entry was taken
+static atomic_bool	done;
+
+typedef struct {
+	int		id;
+	int		num_taken;
+} thief_t;
+
+/**********************************************************************/
+typedef struct rad_request REQUEST;
+REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx);
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request);
+void talloc_const_free(void const *ptr);
+
+REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
+{
+	return NULL;
+}
+
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
+{
+}
+
+void talloc_const_free(void const *ptr)
+{
+	void *tmp;
+	if (!ptr) return;
+
+	memcpy(&tmp, &ptr, sizeof(tmp));
+	talloc_free(tmp);
+}
+/**********************************************************************/
+
+/*
+ *	Entries are offset by one, as the deque doesn't take NULL.
+ */
+static void mark_taken(void *data)
+{
+	intptr_t val = (intptr_t) data;
+
+	rad_assert((val > 0) && (val <= num_entries));
+
+	atomic_fetch_add(&taken[val - 1], 1);
+}
+
+static void *thief_thread(void *arg)
+{
+	thief_t *thief = arg;
+	void *data;
+
+	while (true) {
+		if (fr_work_deque_steal(wd, &data)) {
+			mark_taken(data);
+			thief->num_taken++;
+			continue;
+		}
+
+		if (atomic_load(&done) && (fr_work_deque_size(wd) == 0)) break;
+	}
+
+	return NULL;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: work_deque_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Number of entries to push.\n");
+	fprintf(stderr, "  -s <size>              Set deque size.\n");
+	fprintf(stderr, "  -t <num>               Number of thieves.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i;
+	int		size = 64;
+	int		num_thieves = 4;
+	int		num_popped = 0;
+	intptr_t	val;
+	void		*data;
+	pthread_t	pthread_id[MAX_THIEVES];
+	thief_t		thieves[MAX_THIEVES];
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hn:s:t:x")) != EOF) switch (c) {
+		case 'n':
+			num_entries = atoi(optarg);
+			break;
+
+		case 's':
+			size = atoi(optarg);
+			break;
+
+		case 't':
+			num_thieves = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if ((num_entries <= 0) || (size <= 0) || (num_thieves < 0) || (num_thieves > MAX_THIEVES)) usage();
+
+	wd = fr_work_deque_create(autofree, size);
+	rad_assert(wd != NULL);
+
+	/*
+	 *	Single threaded checks.  pop is LIFO, steal is FIFO.
+	 */
+	for (val = 1; val <= 3; val++) {
+		if (!fr_work_deque_push(wd, (void *) val)) {
+			fprintf(stderr, "Failed pushing %d\n", (int) val);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!fr_work_deque_steal(wd, &data) || ((intptr_t) data != 1)) {
+		fprintf(stderr, "Steal did not return the oldest entry\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!fr_work_deque_pop(wd, &data) || ((intptr_t) data != 3)) {
+		fprintf(stderr, "Pop did not return the newest entry\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!fr_work_deque_pop(wd, &data) || ((intptr_t) data != 2)) {
+		fprintf(stderr, "Pop did not return the last entry\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_work_deque_pop(wd, &data) || fr_work_deque_steal(wd, &data)) {
+		fprintf(stderr, "Took an entry from an empty deque\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	The owner pushes everything, and pops some of it.  The
+	 *	thieves steal the rest.  Every entry must be taken
+	 *	exactly once.
+	 */
+	taken = talloc_array(autofree, _Atomic(int), num_entries);
+	rad_assert(taken != NULL);
+	for (i = 0; i < num_entries; i++) {
+		atomic_init(&taken[i], 0);
+	}
+	atomic_init(&done, false);
+
+	for (i = 0; i < num_thieves; i++) {
+		thieves[i].id = i;
+		thieves[i].num_taken = 0;
+
+		if (pthread_create(&pthread_id[i], NULL, thief_thread, &thieves[i]) != 0) {
+			fprintf(stderr, "Failed creating thread %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (val = 1; val <= num_entries; val++) {
+		/*
+		 *	When the deque is full, do some work ourselves.
+		 */
+		while (!fr_work_deque_push(wd, (void *) val)) {
+			if (fr_work_deque_pop(wd, &data)) {
+				mark_taken(data);
+				num_popped++;
+			}
+		}
+
+		if ((val & 0x03) == 0) {
+			if (fr_work_deque_pop(wd, &data)) {
+				mark_taken(data);
+				num_popped++;
+			}
+		}
+	}
+
+	while (fr_work_deque_pop(wd, &data)) {
+		mark_taken(data);
+		num_popped++;
+	}
+
+	atomic_store(&done, true);
+
+	for (i = 0; i < num_thieves; i++) {
+		pthread_join(pthread_id[i], NULL);
+	}
+
+	for (i = 0; i < num_entries; i++) {
+		if (atomic_load(&taken[i]) != 1) {
+			fprintf(stderr, "Entry %d was taken %d times\n", i + 1, atomic_load(&taken[i]));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (debug_lvl) {
+		printf("owner popped %d\n", num_popped);
+		for (i = 0; i < num_thieves; i++) {
+			printf("thief %d stole %d\n", thieves[i].id, thieves[i].num_taken);
+		}
+	}
+
+	talloc_free(autofree);
+
+	return 0;
+}
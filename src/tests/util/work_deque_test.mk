@@ -0,0 +1,6 @@
+TARGET := work_deque_test
+
+SOURCES		:= work_deque_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
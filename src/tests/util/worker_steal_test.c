@@ -0,0 +1,444 @@
+/*
+ * worker_steal_test.c	Tests for stealing messages which track duplicates
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2018  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/control.h>
+#include <freeradius-devel/io/worker.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <sys/event.h>
+
+#define MAX_MESSAGES		(2048)
+#define MAX_CONTROL_PLANE	(1024)
+#define MAX_KEVENTS		(10)
+#define NUM_WORKERS		(2)
+
+/*
+ *	Enough packets that the owner has a backlog to offer.
+ */
+#define NUM_PACKETS		(32)
+
+#define MPRINT1 if (debug_lvl) printf
+
+typedef struct {
+	int			id;			//!< ID of the worker 0..N
+	pthread_t		pthread_id;		//!< pthread ID of the worker
+	_Atomic(fr_worker_t *)	worker;			//!< pointer to the worker
+	fr_event_list_t		*el;			//!< event list of the worker
+	fr_channel_t		*ch;			//!< channel for communicating with the worker
+} test_worker_t;
+
+static int			debug_lvl = 0;
+static int			kq_master;
+static fr_atomic_queue_t	*aq_master;
+static fr_control_t		*control_master;
+static fr_worker_group_t	*group;
+static test_worker_t		workers[NUM_WORKERS];
+static atomic_int		num_finished;
+
+static int			packet_ctxs[NUM_PACKETS];	//!< Only the address is used.
+static fr_time_t		recv_time[NUM_PACKETS];
+
+static atomic_int		num_decoded[NUM_PACKETS];
+static atomic_int		num_processed[NUM_PACKETS];
+static atomic_bool		stolen[NUM_PACKETS];		//!< Decoded by a worker which doesn't own the channel.
+static atomic_int		dup_number = -1;		//!< The stolen packet which the master duplicates.
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: worker_steal_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "worker_steal_test: %s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+static fr_io_final_t test_process(REQUEST *request, fr_io_action_t action)
+{
+	int i, expected = -1;
+
+	MPRINT1("\t\tPROCESS --- request %"PRIu64" action %d\n", request->number, action);
+
+	if (action != FR_IO_ACTION_RUN) return FR_IO_DONE;
+
+	atomic_fetch_add(&num_processed[request->number], 1);
+
+	/*
+	 *	Slow the owner down, so that it has a backlog to offer.
+	 */
+	if (request->el == workers[0].el) {
+		if (atomic_load(&dup_number) < 0) usleep(1000);
+		return FR_IO_REPLY;
+	}
+
+	/*
+	 *	Keep the first stolen request running until the owner
+	 *	has received a duplicate of it.
+	 */
+	if (!atomic_compare_exchange_strong(&dup_number, &expected, (int) request->number)) return FR_IO_REPLY;
+
+	for (i = 0; i < 5000; i++) {
+		if (atomic_load(&num_decoded[request->number]) > 1) return FR_IO_REPLY;
+		usleep(1000);
+	}
+
+	fail("Owner didn't receive the duplicate");
+}
+
+static int test_decode(UNUSED void const *instance, REQUEST *request, uint8_t *const data, UNUSED size_t data_len)
+{
+	uint32_t number;
+
+	/*
+	 *	The data is the packet number.
+	 */
+	memcpy(&number, data, sizeof(number));
+	rad_assert(number < NUM_PACKETS);
+	request->number = number;
+
+	atomic_fetch_add(&num_decoded[number], 1);
+	if (request->el != workers[0].el) atomic_store(&stolen[number], true);
+
+	MPRINT1("\t\tDECODE <<< request %"PRIu64" - %s\n", request->number,
+		(request->el != workers[0].el) ? "stolen" : "owner");
+
+	return 0;
+}
+
+static ssize_t test_encode(UNUSED void const *instance, REQUEST *request, uint8_t *const data, UNUSED size_t data_len)
+{
+	uint32_t number = request->number;
+
+	memcpy(data, &number, sizeof(number));
+	data[4] = 'R';
+
+	return 5;
+}
+
+static size_t test_nak(UNUSED void const *packet_ctx, uint8_t *const packet, UNUSED size_t packet_len,
+		       uint8_t *reply, UNUSED size_t reply_len)
+{
+	memcpy(reply, packet, sizeof(uint32_t));
+	reply[4] = 'N';
+
+	return 10;
+}
+
+static void process_set(UNUSED void const *ctx, REQUEST *request)
+{
+	request->async->process = test_process;
+}
+
+/*
+ *	The same as proto_radius_udp.
+ */
+static fr_app_io_t app_io = {
+	.name = "worker-steal-test",
+	.default_message_size = 4096,
+	.track_duplicates = true,
+	.nak = test_nak,
+	.encode = test_encode,
+	.decode = test_decode
+};
+
+static fr_app_t test_app = {
+	.process_set = process_set,
+};
+
+static void *worker_thread(void *arg)
+{
+	TALLOC_CTX	*ctx;
+	fr_worker_t	*worker;
+	fr_event_list_t	*el;
+	test_worker_t	*sw = arg;
+
+	MEM(ctx = talloc_init("worker"));
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!el) fail("Failed to create the event list");
+	sw->el = el;
+
+	worker = fr_worker_create(ctx, el, &default_log, debug_lvl);
+	if (!worker) fail("Failed to create the worker");
+
+	if (fr_worker_group_join(group, worker) < 0) {
+		fr_perror("worker_steal_test: Failed joining the worker group");
+		exit(EXIT_FAILURE);
+	}
+
+	atomic_store(&sw->worker, worker);
+
+	MPRINT1("\tWorker %d looping.\n", sw->id);
+	fr_worker(worker);
+
+	/*
+	 *	Other workers may still be looking at our work deque.
+	 */
+	atomic_fetch_add(&num_finished, 1);
+	while (atomic_load(&num_finished) < NUM_WORKERS) usleep(1000);
+
+	MPRINT1("\tWorker %d exiting.\n", sw->id);
+
+	fr_worker_destroy(worker);
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+/** Check a reply, and mark it done
+ *
+ */
+static void check_reply(fr_channel_data_t *reply, int *replies)
+{
+	uint32_t number;
+
+	if ((reply->m.data_size != 5) || (reply->m.data[4] != 'R')) fail("Got a NAK instead of a reply");
+
+	memcpy(&number, reply->m.data, sizeof(number));
+	if (number >= NUM_PACKETS) fail("Got a reply to a packet we didn't send");
+
+	MPRINT1("Master got reply to packet %u\n", number);
+
+	replies[number]++;
+	fr_message_done(&reply->m);
+}
+
+/** Send a message to the owner
+ *
+ */
+static int send_message(fr_message_set_t *ms, uint32_t number, fr_time_t when, int *replies)
+{
+	fr_channel_data_t	*cd, *reply;
+	static fr_listen_t	listen = { .app_io = &app_io, .app = &test_app };
+
+	cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
+	rad_assert(cd != NULL);
+
+	cd->m.when = when;
+	cd->priority = 0;
+	cd->listen = &listen;
+	cd->packet_ctx = &packet_ctxs[number];
+	cd->request.recv_time = &recv_time[number];
+	memcpy(cd->m.data, &number, sizeof(number));
+
+	if (fr_channel_send_request(workers[0].ch, cd, &reply) < 0) fail("Failed sending request");
+
+	if (!reply) return 0;
+
+	check_reply(reply, replies);
+	return 1;
+}
+
+static void sig_ignore(int sig)
+{
+	(void) signal(sig, sig_ignore);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, num_replies = 0;
+	int			replies[NUM_PACKETS];
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_message_set_t	*ms;
+	fr_time_t		start;
+	bool			closed = false, dup_sent = false;
+	struct kevent		events[MAX_KEVENTS];
+
+	if (fr_time_start() < 0) {
+		fprintf(stderr, "Failed to start time: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	fr_log_init(&default_log, false);
+
+	while ((c = getopt(argc, argv, "xh")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	kq_master = kqueue();
+	rad_assert(kq_master >= 0);
+
+	aq_master = fr_atomic_queue_create(autofree, MAX_CONTROL_PLANE);
+	rad_assert(aq_master != NULL);
+
+	control_master = fr_control_create(autofree, kq_master, aq_master, 1024);
+	rad_assert(control_master != NULL);
+
+	signal(SIGTERM, sig_ignore);
+
+	ms = fr_message_set_create(autofree, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!ms) fail("Failed creating message set");
+
+	group = fr_worker_group_create(autofree, NUM_WORKERS);
+	if (!group) fail("Failed creating worker group");
+
+	for (i = 0; i < NUM_WORKERS; i++) {
+		workers[i].id = i;
+		(void) pthread_create(&workers[i].pthread_id, NULL, worker_thread, &workers[i]);
+	}
+
+	for (i = 0; i < NUM_WORKERS; i++) {
+		while (!atomic_load(&workers[i].worker)) usleep(1000);
+	}
+
+	/*
+	 *	Only the first worker has a channel.  The others can
+	 *	only get work by stealing it.
+	 */
+	workers[0].ch = fr_worker_channel_create(atomic_load(&workers[0].worker), autofree, control_master);
+	rad_assert(workers[0].ch != NULL);
+	(void) fr_channel_master_ctx_add(workers[0].ch, &workers[0]);
+
+	memset(replies, 0, sizeof(replies));
+	for (i = 0; i < NUM_PACKETS; i++) {
+		recv_time[i] = fr_time();
+		num_replies += send_message(ms, i, recv_time[i], replies);
+	}
+
+	/*
+	 *	Wait for the replies, and then for the channel to close.
+	 */
+	start = fr_time();
+	while (!closed) {
+		int num_events;
+		fr_time_t now;
+		struct timespec timeout = { 0, 100000000 };
+
+		if ((fr_time() - start) > (10 * (fr_time_t) NANOSEC)) fail("Timed out waiting for replies");
+
+		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, &timeout);
+		if (num_events < 0) {
+			if (errno == EINTR) continue;
+			fail("Failed waiting for kevent");
+		}
+
+		for (i = 0; i < num_events; i++) {
+			(void) fr_channel_service_kevent(workers[0].ch, control_master, &events[i]);
+		}
+
+		/*
+		 *	Once a message has been stolen, send a duplicate
+		 *	of it.  The duplicate has the same key and receive
+		 *	time as the original, but arrives later.
+		 */
+		if (!dup_sent && (atomic_load(&dup_number) >= 0)) {
+			MPRINT1("Master sending duplicate of packet %d\n", atomic_load(&dup_number));
+			num_replies += send_message(ms, atomic_load(&dup_number), fr_time(), replies);
+			dup_sent = true;
+		}
+
+		now = fr_time();
+
+		while (true) {
+			uint32_t		id;
+			size_t			data_size;
+			char			data[256];
+			fr_channel_t		*ch;
+			fr_channel_data_t	*reply;
+
+			data_size = fr_control_message_pop(aq_master, &id, data, sizeof(data));
+			if (!data_size) break;
+
+			rad_assert(id == FR_CONTROL_ID_CHANNEL);
+
+			switch (fr_channel_service_message(now, &ch, data, data_size)) {
+			case FR_CHANNEL_DATA_READY_NETWORK:
+				while ((reply = fr_channel_recv_reply(ch)) != NULL) {
+					check_reply(reply, replies);
+					num_replies++;
+				}
+
+				if (num_replies == NUM_PACKETS) {
+					MPRINT1("Master signaling worker to exit.\n");
+					if (debug_lvl) fr_worker_debug(atomic_load(&workers[0].worker), stdout);
+					if (fr_channel_signal_worker_close(workers[0].ch) < 0) fail("Failed signaling close");
+				}
+				break;
+
+			case FR_CHANNEL_CLOSE:
+				closed = true;
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < NUM_WORKERS; i++) {
+		fr_worker_exit(atomic_load(&workers[i].worker));
+		(void) pthread_kill(workers[i].pthread_id, SIGTERM);
+	}
+
+	for (i = 0; i < NUM_WORKERS; i++) (void) pthread_join(workers[i].pthread_id, NULL);
+
+	/*
+	 *	Every packet is processed and answered exactly once.
+	 *	The duplicate is discarded by the owner, even though
+	 *	the original was being processed by another worker.
+	 */
+	for (i = 0; i < NUM_PACKETS; i++) {
+		if (atomic_load(&num_processed[i]) != 1) {
+			fprintf(stderr, "worker_steal_test: Packet %d was processed %d times\n",
+				i, atomic_load(&num_processed[i]));
+			exit(EXIT_FAILURE);
+		}
+
+		if (replies[i] != 1) {
+			fprintf(stderr, "worker_steal_test: Packet %d got %d replies\n", i, replies[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!dup_sent) fail("No message was stolen");
+	if (atomic_load(&num_decoded[atomic_load(&dup_number)]) != 2) fail("Owner didn't see the duplicate");
+
+	talloc_free(autofree);
+
+	return 0;
+}
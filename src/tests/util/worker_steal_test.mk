@@ -0,0 +1,7 @@
+TARGET := worker_steal_test
+
+SOURCES		:= worker_steal_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
+